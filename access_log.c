@@ -0,0 +1,817 @@
+/**************************************************************
+*
+*                        access_log.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-02
+*
+*     Summary:
+*     Implementation for the access log.
+*
+**************************************************************/
+
+#include "access_log.h"
+#include "logger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define ROW_BYTES 42 /* Byte size of a record in the columns. */
+#define HOST_SLOTS (2 * ACCESS_LOG_BLOCK_ROWS) /* Number of slots of the host
+                                                * table of a block; a power
+                                                * of 2. */
+#define MAX_PAYLOAD (ACCESS_LOG_BLOCK_ROWS * (ROW_BYTES + ACCESS_LOG_HOST_LEN) \
+                     + 2) /* Max byte size of a block payload. */
+
+/* Names of methods, indexed by enum access_method. */
+static const char* method_names[ACCESS_NUM_METHODS] = {
+    "OTHER", "GET", "HEAD", "POST", "CONNECT",
+};
+
+/* Names of cache outcomes, indexed by enum access_cache. */
+static const char* cache_names[ACCESS_NUM_CACHE] = {
+    "none", "hit", "miss", "stale",
+};
+
+/* Request of a client whose response is yet to be written. */
+struct access_pending {
+    int is_open; /* Whether a request is open. */
+    uint32_t client; /* IPv4 address of the client in network byte order. */
+    long start_us; /* Monotonic time in microseconds the request was
+                    * parsed. */
+    uint64_t path_hash; /* access_log_hash() of the URL. */
+    uint8_t method; /* enum access_method. */
+    uint8_t cache; /* enum access_cache. */
+    uint32_t connect_us; /* Microseconds to connect; 0 if none. */
+    uint32_t first_byte_us; /* Microseconds to the first byte; 0 if none. */
+    char host[ACCESS_LOG_HOST_LEN]; /* Host, cut to fit. */
+};
+
+static struct access_log_config config; /* Configuration. */
+static char* log_path = NULL; /* Path of the log file; NULL while closed. */
+static int log_fd = -1; /* FD of the log file. */
+static long file_bytes = 0; /* Byte size of the log file. */
+static long wall_offset_us = 0; /* Wall clock minus monotonic time. */
+static struct access_pending pending[FD_SETSIZE]; /* Open request of each
+                                                    * client. */
+
+/* Columns of the block being filled, in the order they are written. */
+static int64_t col_time[ACCESS_LOG_BLOCK_ROWS];
+static uint32_t col_client[ACCESS_LOG_BLOCK_ROWS];
+static uint16_t col_host[ACCESS_LOG_BLOCK_ROWS];
+static uint64_t col_path[ACCESS_LOG_BLOCK_ROWS];
+static uint8_t col_method[ACCESS_LOG_BLOCK_ROWS];
+static uint16_t col_status[ACCESS_LOG_BLOCK_ROWS];
+static uint8_t col_cache[ACCESS_LOG_BLOCK_ROWS];
+static uint32_t col_bytes[ACCESS_LOG_BLOCK_ROWS];
+static uint32_t col_connect[ACCESS_LOG_BLOCK_ROWS];
+static uint32_t col_first_byte[ACCESS_LOG_BLOCK_ROWS];
+static uint32_t col_total[ACCESS_LOG_BLOCK_ROWS];
+static int rows = 0; /* Number of records in the block. */
+static long block_start_us = 0; /* Time the first record was kept. */
+
+/* Hosts of the block being filled, as they are written. */
+static unsigned char hosts[ACCESS_LOG_BLOCK_ROWS * ACCESS_LOG_HOST_LEN];
+static int hosts_len = 0; /* Byte size of hosts. */
+static int num_hosts = 0; /* Number of hosts. */
+static int host_offsets[ACCESS_LOG_BLOCK_ROWS]; /* Offset of each host in
+                                                 * hosts. */
+static uint16_t host_slots[HOST_SLOTS]; /* 1 + index of the host in each
+                                         * slot; 0 if empty. */
+
+static unsigned char* payload = NULL; /* Scratch buffer of a payload. */
+static unsigned char* deflated = NULL; /* Scratch buffer of a deflated
+                                        * payload. */
+static uLong deflated_cap = 0; /* Byte size of deflated. */
+static struct access_log_stats stats; /* Access log statistics. */
+
+/**
+ * @brief Write a buffer to a file in full.
+ *
+ * @param fd FD for file.
+ * @param buf Buffer.
+ * @param len Byte size of buf.
+ * @return int 0 on success; -1 otherwise, with errno set.
+ */
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Open the log file for appending, and write the file header if it is
+ * empty.
+ *
+ * @return int 0 on success; -1 otherwise, with errno set.
+ */
+static int open_file(void)
+{
+    unsigned char head[ACCESS_LOG_HEAD_SIZE];
+    uint16_t version = ACCESS_LOG_VERSION;
+    uint16_t columns = ACCESS_LOG_COLUMNS;
+    uint32_t byte_order = ACCESS_LOG_BYTE_ORDER;
+    struct stat st;
+
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        return -1;
+    }
+    if (fstat(log_fd, &st) < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    file_bytes = st.st_size;
+    if (file_bytes > 0) {
+        return 0;
+    }
+
+    bzero(head, sizeof(head));
+    memcpy(head, ACCESS_LOG_MAGIC, 4);
+    memcpy(head + 4, &version, 2);
+    memcpy(head + 6, &columns, 2);
+    memcpy(head + 8, &byte_order, 4);
+    if (write_all(log_fd, head, sizeof(head)) < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    file_bytes = sizeof(head);
+    return 0;
+}
+
+/**
+ * @brief Rename the log file to <path>.1, shifting older ones up to
+ * <path>.<keep>, and open a new one.
+ *
+ * @return int 0 on success; -1 if no file is open afterwards.
+ */
+static int rotate(void)
+{
+    size_t len = strlen(log_path) + 16;
+    char* from = malloc(len);
+    char* to = malloc(len);
+
+    if (from == NULL || to == NULL) {
+        PLOG_ERROR("malloc");
+        free(from);
+        free(to);
+        return 0;
+    }
+    close(log_fd);
+    log_fd = -1;
+    for (int i = config.keep - 1; i >= 1; --i) {
+        snprintf(from, len, "%s.%d", log_path, i);
+        snprintf(to, len, "%s.%d", log_path, i + 1);
+        if (rename(from, to) < 0 && errno != ENOENT) {
+            PLOG_ERROR("rename %s", from);
+        }
+    }
+    snprintf(to, len, "%s.1", log_path);
+    if (rename(log_path, to) < 0) {
+        PLOG_ERROR("rename %s", log_path);
+    }
+    free(from);
+    free(to);
+    stats.rotations++;
+
+    if (open_file() < 0) {
+        PLOG_ERROR("open %s", log_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hash a string for the host table: 32-bit FNV-1a.
+ *
+ * @param s String.
+ * @param len Byte size of s.
+ * @return uint32_t Hash.
+ */
+static uint32_t host_hash(const char* s, int len)
+{
+    uint32_t hash = 2166136261U;
+
+    for (int i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)s[i]) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Find the index of a host among the hosts of the block, adding it if
+ * it is new.
+ *
+ * @param host Host.
+ * @return uint16_t Index.
+ */
+static uint16_t host_index(const char* host)
+{
+    int len = strlen(host);
+    uint32_t i = host_hash(host, len) & (HOST_SLOTS - 1);
+
+    while (host_slots[i] != 0) {
+        int at = host_offsets[host_slots[i] - 1];
+
+        if (hosts[at] == len && memcmp(hosts + at + 1, host, len) == 0) {
+            return host_slots[i] - 1;
+        }
+        i = (i + 1) & (HOST_SLOTS - 1);
+    }
+    host_offsets[num_hosts] = hosts_len;
+    hosts[hosts_len] = len;
+    memcpy(hosts + hosts_len + 1, host, len);
+    hosts_len += 1 + len;
+    host_slots[i] = ++num_hosts;
+    return num_hosts - 1;
+}
+
+/**
+ * @brief Append a column to a payload.
+ *
+ * @param out End of the payload.
+ * @param col Column.
+ * @param size Byte size of a value of the column.
+ * @return unsigned char* New end of the payload.
+ */
+static unsigned char* put_column(unsigned char* out, const void* col, int size)
+{
+    memcpy(out, col, (size_t)size * rows);
+    return out + (size_t)size * rows;
+}
+
+/**
+ * @brief Open the log file for appending, and start logging.
+ *
+ * @param new_config Configuration, whose path is copied.
+ * @param now_us Current monotonic time in microseconds, which later times
+ * count from.
+ * @return int 0 on success; -1 otherwise, with errno set.
+ */
+int access_log_open(const struct access_log_config* new_config, long now_us)
+{
+    struct timespec ts;
+
+    access_log_close();
+    config = *new_config;
+    if (config.keep < 1) {
+        config.keep = 1;
+    }
+    log_path = strdup(config.path);
+    payload = malloc(MAX_PAYLOAD);
+    deflated_cap = compressBound(MAX_PAYLOAD);
+    deflated = malloc(deflated_cap);
+    if (log_path == NULL || payload == NULL || deflated == NULL) {
+        access_log_close();
+        errno = ENOMEM;
+        return -1;
+    }
+    if (open_file() < 0) {
+        int err = errno;
+
+        access_log_close();
+        errno = err;
+        return -1;
+    }
+    config.path = log_path;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall_offset_us = ts.tv_sec * 1000000L + ts.tv_nsec / 1000 - now_us;
+    bzero(pending, sizeof(pending));
+    bzero(host_slots, sizeof(host_slots));
+    bzero(&stats, sizeof(stats));
+    rows = 0;
+    hosts_len = 0;
+    num_hosts = 0;
+    return 0;
+}
+
+/**
+ * @brief Write the records kept, close the log file and stop logging.
+ */
+void access_log_close(void)
+{
+    if (log_fd >= 0) {
+        access_log_flush();
+        close(log_fd);
+        log_fd = -1;
+    }
+    free(log_path);
+    log_path = NULL;
+    free(payload);
+    payload = NULL;
+    free(deflated);
+    deflated = NULL;
+}
+
+/**
+ * @brief Whether the log is open.
+ *
+ * @return int 1 if it is; 0 otherwise.
+ */
+int access_log_is_open(void)
+{
+    return log_path != NULL;
+}
+
+/**
+ * @brief Remember the address of an accepted client.
+ *
+ * @param fd FD for client socket.
+ * @param addr Address of the client.
+ */
+void access_log_accept(int fd, const struct sockaddr_in* addr)
+{
+    if (log_path == NULL || fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    if (pending[fd].is_open) {
+        stats.unanswered++;
+        pending[fd].is_open = 0;
+    }
+    pending[fd].client = addr->sin_addr.s_addr;
+}
+
+/**
+ * @brief Open the record of a request that was parsed.
+ *
+ * @param fd FD for client socket.
+ * @param method Method of the request.
+ * @param host Hostname of the request.
+ * @param url URL of the request.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_begin(int fd,
+                      const char* method,
+                      const char* host,
+                      const char* url,
+                      long now_us)
+{
+    struct access_pending* p;
+    int len;
+
+    if (log_path == NULL || fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    p = &pending[fd];
+    if (p->is_open) {
+        stats.unanswered++;
+    }
+    p->is_open = 1;
+    p->start_us = now_us;
+    p->path_hash = access_log_hash(url);
+    p->method = ACCESS_METHOD_OTHER;
+    for (int i = 1; i < ACCESS_NUM_METHODS; ++i) {
+        if (strcmp(method, method_names[i]) == 0) {
+            p->method = i;
+            break;
+        }
+    }
+    p->cache = ACCESS_CACHE_NONE;
+    p->connect_us = 0;
+    p->first_byte_us = 0;
+    len = strlen(host);
+    if (len >= ACCESS_LOG_HOST_LEN) {
+        len = ACCESS_LOG_HOST_LEN - 1;
+    }
+    memcpy(p->host, host, len);
+    p->host[len] = '\0';
+}
+
+/**
+ * @brief Set the cache outcome of the open request of a client.
+ *
+ * @param fd FD for client socket.
+ * @param cache enum access_cache.
+ */
+void access_log_cache(int fd, int cache)
+{
+    if (log_path != NULL && fd >= 0 && fd < FD_SETSIZE) {
+        pending[fd].cache = cache;
+    }
+}
+
+/**
+ * @brief Set the time the open request of a client took to connect to its
+ * server, unless it has one.
+ *
+ * @param fd FD for client socket.
+ * @param us Microseconds the connect took.
+ */
+void access_log_connect(int fd, long us)
+{
+    if (log_path != NULL && fd >= 0 && fd < FD_SETSIZE &&
+        pending[fd].is_open && pending[fd].connect_us == 0) {
+        pending[fd].connect_us = us > 0 ? us : 1;
+    }
+}
+
+/**
+ * @brief Time the first byte of a server for the open request of a client,
+ * unless one came before.
+ *
+ * @param fd FD for client socket.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_first_byte(int fd, long now_us)
+{
+    struct access_pending* p;
+
+    if (log_path == NULL || fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    p = &pending[fd];
+    if (p->is_open && p->first_byte_us == 0) {
+        p->first_byte_us = now_us > p->start_us ? now_us - p->start_us : 1;
+    }
+}
+
+/**
+ * @brief Close the open request of a client with its response, and keep its
+ * record for the next block.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response; 0 if unknown.
+ * @param bytes Byte size of the response.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_end(int fd, int status, long bytes, long now_us)
+{
+    struct access_pending* p;
+
+    if (log_path == NULL || fd < 0 || fd >= FD_SETSIZE ||
+        !pending[fd].is_open) {
+        return;
+    }
+    p = &pending[fd];
+    p->is_open = 0;
+    if (rows == 0) {
+        block_start_us = now_us;
+    }
+    col_time[rows] = wall_offset_us + p->start_us;
+    col_client[rows] = p->client;
+    col_host[rows] = host_index(p->host);
+    col_path[rows] = p->path_hash;
+    col_method[rows] = p->method;
+    col_status[rows] = status;
+    col_cache[rows] = p->cache;
+    col_bytes[rows] = bytes;
+    col_connect[rows] = p->connect_us;
+    col_first_byte[rows] = p->first_byte_us;
+    col_total[rows] = now_us - p->start_us;
+    rows++;
+    if (rows == ACCESS_LOG_BLOCK_ROWS) {
+        access_log_flush();
+    }
+}
+
+/**
+ * @brief Write the records kept if the oldest is ACCESS_LOG_FLUSH_INTERVAL
+ * seconds old. Call it from the event loop.
+ *
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_tick(long now_us)
+{
+    if (rows > 0 &&
+        now_us - block_start_us >= ACCESS_LOG_FLUSH_INTERVAL * 1000000L) {
+        access_log_flush();
+    }
+}
+
+/**
+ * @brief Write the records kept as a block.
+ *
+ * @return int 0 on success, or if none were kept; -1 otherwise.
+ */
+int access_log_flush(void)
+{
+    struct access_log_block_head head;
+    unsigned char* out = payload;
+    const unsigned char* stored = payload;
+    uLong stored_len;
+    uint16_t count = num_hosts;
+    int ret = 0;
+
+    if (rows == 0 || log_path == NULL) {
+        return 0;
+    }
+
+    /* Lay out the columns, then the hosts they point to. */
+    out = put_column(out, col_time, sizeof(col_time[0]));
+    out = put_column(out, col_client, sizeof(col_client[0]));
+    out = put_column(out, col_host, sizeof(col_host[0]));
+    out = put_column(out, col_path, sizeof(col_path[0]));
+    out = put_column(out, col_method, sizeof(col_method[0]));
+    out = put_column(out, col_status, sizeof(col_status[0]));
+    out = put_column(out, col_cache, sizeof(col_cache[0]));
+    out = put_column(out, col_bytes, sizeof(col_bytes[0]));
+    out = put_column(out, col_connect, sizeof(col_connect[0]));
+    out = put_column(out, col_first_byte, sizeof(col_first_byte[0]));
+    out = put_column(out, col_total, sizeof(col_total[0]));
+    memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    memcpy(out, hosts, hosts_len);
+    out += hosts_len;
+
+    head.magic = ACCESS_LOG_BLOCK_MAGIC;
+    head.rows = rows;
+    head.flags = 0;
+    head.raw_len = out - payload;
+    stored_len = head.raw_len;
+    if (config.deflate) {
+        uLong len = deflated_cap;
+
+        /* A column holds alike values, which deflate well. */
+        if (compress2(deflated, &len, payload, head.raw_len, 1) == Z_OK &&
+            len < head.raw_len) {
+            head.flags = ACCESS_LOG_DEFLATED;
+            stored = deflated;
+            stored_len = len;
+        }
+    }
+    head.stored_len = stored_len;
+
+    if (log_fd >= 0 && file_bytes > ACCESS_LOG_HEAD_SIZE &&
+        file_bytes + (long)sizeof(head) + (long)stored_len >
+        config.rotate_bytes) {
+        rotate();
+    }
+    if (log_fd < 0 ||
+        write_all(log_fd, &head, sizeof(head)) < 0 ||
+        write_all(log_fd, stored, stored_len) < 0) {
+        PLOG_ERROR("write access log");
+        stats.dropped += rows;
+        ret = -1;
+    }
+    else {
+        file_bytes += sizeof(head) + stored_len;
+        stats.records += rows;
+        stats.blocks++;
+        stats.raw_bytes += head.raw_len;
+        stats.stored_bytes += sizeof(head) + stored_len;
+    }
+
+    rows = 0;
+    hosts_len = 0;
+    num_hosts = 0;
+    bzero(host_slots, sizeof(host_slots));
+    return ret;
+}
+
+/**
+ * @brief Hash a URL into the path_hash column: 64-bit FNV-1a.
+ *
+ * @param url URL.
+ * @return uint64_t Hash.
+ */
+uint64_t access_log_hash(const char* url)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *url != '\0'; ++url) {
+        hash = (hash ^ (unsigned char)*url) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Open a log file for reading, and check its header.
+ *
+ * @param path Path of the log file.
+ * @return FILE* File, positioned at its first block; NULL if it cannot be
+ * opened, or is not a log file of this format and byte order.
+ */
+FILE* access_log_read_open(const char* path)
+{
+    unsigned char head[ACCESS_LOG_HEAD_SIZE];
+    uint16_t version;
+    uint16_t columns;
+    uint32_t byte_order;
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fread(head, sizeof(head), 1, file) != 1 ||
+        memcmp(head, ACCESS_LOG_MAGIC, 4) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    memcpy(&version, head + 4, 2);
+    memcpy(&columns, head + 6, 2);
+    memcpy(&byte_order, head + 8, 4);
+    if (version != ACCESS_LOG_VERSION || columns != ACCESS_LOG_COLUMNS ||
+        byte_order != ACCESS_LOG_BYTE_ORDER) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * @brief Take a column out of a payload.
+ *
+ * @param in Input and output; position in the payload.
+ * @param end End of the payload.
+ * @param n Number of rows.
+ * @param size Byte size of a value of the column.
+ * @return const unsigned char* Column; NULL if the payload is too short.
+ */
+static const unsigned char* get_column(const unsigned char** in,
+                                       const unsigned char* end,
+                                       int n,
+                                       int size)
+{
+    const unsigned char* col = *in;
+
+    if (end - col < (long)n * size) {
+        return NULL;
+    }
+    *in += (size_t)n * size;
+    return col;
+}
+
+/**
+ * @brief Read the next block of a log file.
+ *
+ * @param file File from access_log_read_open().
+ * @param out Output; records of the block, ACCESS_LOG_BLOCK_ROWS of them at
+ * the most.
+ * @return int Number of records read; 0 at the end of the file; -1 if the
+ * block is truncated or corrupt.
+ */
+int access_log_read(FILE* file, struct access_record* out)
+{
+    struct access_log_block_head head;
+    const unsigned char* cols[ACCESS_LOG_COLUMNS];
+    static const int sizes[ACCESS_LOG_COLUMNS] = {8, 4, 2, 8, 1, 2, 1, 4, 4,
+                                                  4, 4};
+    unsigned char* stored = NULL;
+    unsigned char* raw = NULL;
+    const unsigned char* in;
+    const unsigned char* end;
+    int offsets[ACCESS_LOG_BLOCK_ROWS];
+    uint16_t count;
+    int n = -1;
+
+    if (fread(&head, sizeof(head), 1, file) != 1) {
+        return feof(file) ? 0 : -1;
+    }
+    if (head.magic != ACCESS_LOG_BLOCK_MAGIC ||
+        head.rows > ACCESS_LOG_BLOCK_ROWS || head.raw_len > MAX_PAYLOAD ||
+        head.stored_len > compressBound(MAX_PAYLOAD)) {
+        return -1;
+    }
+    stored = malloc(head.stored_len + 1);
+    raw = malloc(head.raw_len + 1);
+    if (stored == NULL || raw == NULL ||
+        fread(stored, 1, head.stored_len, file) != head.stored_len) {
+        goto done;
+    }
+    if (head.flags & ACCESS_LOG_DEFLATED) {
+        uLong len = head.raw_len;
+
+        if (uncompress(raw, &len, stored, head.stored_len) != Z_OK ||
+            len != head.raw_len) {
+            goto done;
+        }
+    }
+    else if (head.stored_len == head.raw_len) {
+        memcpy(raw, stored, head.raw_len);
+    }
+    else {
+        goto done;
+    }
+
+    in = raw;
+    end = raw + head.raw_len;
+    for (int c = 0; c < ACCESS_LOG_COLUMNS; ++c) {
+        cols[c] = get_column(&in, end, head.rows, sizes[c]);
+        if (cols[c] == NULL) {
+            goto done;
+        }
+    }
+    if (end - in < 2) {
+        goto done;
+    }
+    memcpy(&count, in, 2);
+    in += 2;
+    if (count > ACCESS_LOG_BLOCK_ROWS) {
+        goto done;
+    }
+    for (int h = 0; h < count; ++h) {
+        if (in >= end || end - in < 1 + *in) {
+            goto done;
+        }
+        offsets[h] = in - raw;
+        in += 1 + *in;
+    }
+
+    for (uint32_t r = 0; r < head.rows; ++r) {
+        struct access_record* rec = &out[r];
+        uint16_t host;
+
+        memcpy(&rec->time_us, cols[0] + 8 * r, 8);
+        memcpy(&rec->client, cols[1] + 4 * r, 4);
+        memcpy(&host, cols[2] + 2 * r, 2);
+        memcpy(&rec->path_hash, cols[3] + 8 * r, 8);
+        rec->method = cols[4][r];
+        memcpy(&rec->status, cols[5] + 2 * r, 2);
+        rec->cache = cols[6][r];
+        memcpy(&rec->bytes, cols[7] + 4 * r, 4);
+        memcpy(&rec->connect_us, cols[8] + 4 * r, 4);
+        memcpy(&rec->first_byte_us, cols[9] + 4 * r, 4);
+        memcpy(&rec->total_us, cols[10] + 4 * r, 4);
+        if (host >= count) {
+            goto done;
+        }
+        memcpy(rec->host, raw + offsets[host] + 1, raw[offsets[host]]);
+        rec->host[raw[offsets[host]]] = '\0';
+    }
+    n = head.rows;
+
+done:
+    free(stored);
+    free(raw);
+    return n;
+}
+
+/**
+ * @brief Get the name of a method.
+ *
+ * @param method enum access_method.
+ * @return const char* Name, e.g. "GET"; "OTHER" for others.
+ */
+const char* access_log_method_name(int method)
+{
+    if (method < 0 || method >= ACCESS_NUM_METHODS) {
+        return method_names[ACCESS_METHOD_OTHER];
+    }
+    return method_names[method];
+}
+
+/**
+ * @brief Get the name of a cache outcome.
+ *
+ * @param cache enum access_cache.
+ * @return const char* Name, e.g. "hit".
+ */
+const char* access_log_cache_name(int cache)
+{
+    if (cache < 0 || cache >= ACCESS_NUM_CACHE) {
+        return "unknown";
+    }
+    return cache_names[cache];
+}
+
+/**
+ * @brief Get statistics of the access log.
+ *
+ * @param out_stats Output; access log statistics, non-null.
+ */
+void access_log_get_stats(struct access_log_stats* out_stats)
+{
+    *out_stats = stats;
+}
+
+/**
+ * @brief Print statistics of the access log.
+ */
+void access_log_log_stats(void)
+{
+    LOG_INFO("access log stats:\n"
+             "- records: %ld in %ld blocks, %d kept, %ld dropped\n"
+             "- requests closed unanswered: %ld\n"
+             "- bytes: %ld raw, %ld stored (%.1f%%), %ld rotations",
+             stats.records,
+             stats.blocks,
+             rows,
+             stats.dropped,
+             stats.unanswered,
+             stats.raw_bytes,
+             stats.stored_bytes,
+             stats.raw_bytes > 0 ?
+             100.0 * stats.stored_bytes / stats.raw_bytes : 0.0,
+             stats.rotations);
+}
@@ -0,0 +1,282 @@
+/**************************************************************
+*
+*                        access_log.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-02
+*
+*     Summary:
+*     Interface for the access log: one record of a fixed
+*     schema per response written to a client, kept in memory
+*     column by column and written as a block once
+*     ACCESS_LOG_BLOCK_ROWS records are kept, or once the
+*     oldest is ACCESS_LOG_FLUSH_INTERVAL seconds old.
+*
+*     A record is opened when a request is parsed, takes the
+*     phase timings and cache outcome of the request as they
+*     happen, and is closed when its response is written. The
+*     hot path only stores integers into arrays; formatting is
+*     left to access_log_tool, offline.
+*
+*     File format, in the byte order of the host that wrote it:
+*     - a header: ACCESS_LOG_MAGIC, the version, the number of
+*       columns, ACCESS_LOG_BYTE_ORDER, and 4 reserved bytes.
+*     - blocks, each a struct access_log_block_head, then its
+*       payload, deflated with zlib if ACCESS_LOG_DEFLATED is
+*       set: the columns one after another, in the order of
+*       struct access_record, each an array of rows values,
+*       then the hosts of the block: a uint16_t count, then
+*       each host as a uint8_t length and its bytes. The host
+*       column holds indexes into them.
+*
+*     The file rotates once a block would take it past the
+*     rotate size: it is renamed to <path>.1, which is renamed
+*     to <path>.2 and so on up to <path>.<keep>.
+*
+**************************************************************/
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ACCESS_LOG_MAGIC "PXAL" /* First bytes of a log file. */
+#define ACCESS_LOG_VERSION 1 /* Version of the file format. */
+#define ACCESS_LOG_COLUMNS 11 /* Number of columns of a record. */
+#define ACCESS_LOG_BYTE_ORDER 0x01020304U /* Written as is, to tell the byte
+                                           * order of the file. */
+#define ACCESS_LOG_HEAD_SIZE 16 /* Byte size of the file header. */
+#define ACCESS_LOG_BLOCK_MAGIC 0x4b4c4241U /* First field of a block. */
+#define ACCESS_LOG_BLOCK_ROWS 4096 /* Max number of records per block. */
+#define ACCESS_LOG_FLUSH_INTERVAL 1 /* Max seconds a record is kept before
+                                     * its block is written. */
+#define ACCESS_LOG_ROTATE_MB 64 /* Default byte size in MB of a file before
+                                 * it rotates. */
+#define ACCESS_LOG_KEEP 8 /* Default number of rotated files kept. */
+#define ACCESS_LOG_HOST_LEN 256 /* Max byte size of a host plus 1; longer
+                                 * ones are cut. */
+#define ACCESS_LOG_DEFLATED 1 /* Flag of a block whose payload is
+                               * deflated. */
+
+/* Methods of a request. */
+enum access_method {
+    ACCESS_METHOD_OTHER = 0,
+    ACCESS_METHOD_GET,
+    ACCESS_METHOD_HEAD,
+    ACCESS_METHOD_POST,
+    ACCESS_METHOD_CONNECT,
+    ACCESS_NUM_METHODS,
+};
+
+/* Outcomes of a request at the cache. */
+enum access_cache {
+    ACCESS_CACHE_NONE = 0, /* Not looked up, e.g. a POST. */
+    ACCESS_CACHE_HIT, /* Answered from the cache. */
+    ACCESS_CACHE_MISS, /* Sent to the server. */
+    ACCESS_CACHE_STALE, /* Answered from the cache past its max age, in place
+                         * of a failed server. */
+    ACCESS_NUM_CACHE,
+};
+
+/* A record, as read back from a file. */
+struct access_record {
+    int64_t time_us; /* Wall clock time in microseconds since the epoch the
+                      * request was parsed. */
+    uint32_t client; /* IPv4 address of the client in network byte order. */
+    char host[ACCESS_LOG_HOST_LEN]; /* Host of the request. */
+    uint64_t path_hash; /* access_log_hash() of the request URL. */
+    uint8_t method; /* enum access_method. */
+    uint16_t status; /* Status code of the response; 0 if unknown. */
+    uint8_t cache; /* enum access_cache. */
+    uint32_t bytes; /* Byte size of the response. */
+    uint32_t connect_us; /* Microseconds to connect to the server; 0 if no
+                          * connect was made for the request. */
+    uint32_t first_byte_us; /* Microseconds from the request to the first
+                             * byte of the server; 0 if none came. */
+    uint32_t total_us; /* Microseconds from the request to its response. */
+};
+
+struct access_log_block_head {
+    uint32_t magic; /* ACCESS_LOG_BLOCK_MAGIC. */
+    uint32_t rows; /* Number of records. */
+    uint32_t flags; /* ACCESS_LOG_DEFLATED or 0. */
+    uint32_t raw_len; /* Byte size of the payload. */
+    uint32_t stored_len; /* Byte size of the payload as stored. */
+};
+
+struct access_log_config {
+    const char* path; /* Path of the log file. */
+    long rotate_bytes; /* Byte size of a file before it rotates. */
+    int keep; /* Number of rotated files kept. */
+    int deflate; /* Whether to deflate blocks. */
+};
+
+struct access_log_stats {
+    long records; /* Number of records written. */
+    long blocks; /* Number of blocks written. */
+    long raw_bytes; /* Byte size of block payloads. */
+    long stored_bytes; /* Byte size written, headers included. */
+    long rotations; /* Number of times the file rotated. */
+    long unanswered; /* Number of requests whose client closed, or sent
+                      * another request, before a response. */
+    long dropped; /* Number of records lost to failed writes. */
+};
+
+/**
+ * @brief Open the log file for appending, and start logging.
+ *
+ * @param config Configuration, whose path is copied.
+ * @param now_us Current monotonic time in microseconds, which later times
+ * count from.
+ * @return int 0 on success; -1 otherwise, with errno set.
+ */
+int access_log_open(const struct access_log_config* config, long now_us);
+
+/**
+ * @brief Write the records kept, close the log file and stop logging.
+ */
+void access_log_close(void);
+
+/**
+ * @brief Whether the log is open.
+ *
+ * @return int 1 if it is; 0 otherwise.
+ */
+int access_log_is_open(void);
+
+/**
+ * @brief Remember the address of an accepted client.
+ *
+ * @param fd FD for client socket.
+ * @param addr Address of the client.
+ */
+void access_log_accept(int fd, const struct sockaddr_in* addr);
+
+/**
+ * @brief Open the record of a request that was parsed.
+ *
+ * @param fd FD for client socket.
+ * @param method Method of the request.
+ * @param host Hostname of the request.
+ * @param url URL of the request.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_begin(int fd,
+                      const char* method,
+                      const char* host,
+                      const char* url,
+                      long now_us);
+
+/**
+ * @brief Set the cache outcome of the open request of a client.
+ *
+ * @param fd FD for client socket.
+ * @param cache enum access_cache.
+ */
+void access_log_cache(int fd, int cache);
+
+/**
+ * @brief Set the time the open request of a client took to connect to its
+ * server, unless it has one.
+ *
+ * @param fd FD for client socket.
+ * @param us Microseconds the connect took.
+ */
+void access_log_connect(int fd, long us);
+
+/**
+ * @brief Time the first byte of a server for the open request of a client,
+ * unless one came before.
+ *
+ * @param fd FD for client socket.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_first_byte(int fd, long now_us);
+
+/**
+ * @brief Close the open request of a client with its response, and keep its
+ * record for the next block.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response; 0 if unknown.
+ * @param bytes Byte size of the response.
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_end(int fd, int status, long bytes, long now_us);
+
+/**
+ * @brief Write the records kept if the oldest is ACCESS_LOG_FLUSH_INTERVAL
+ * seconds old. Call it from the event loop.
+ *
+ * @param now_us Current monotonic time in microseconds.
+ */
+void access_log_tick(long now_us);
+
+/**
+ * @brief Write the records kept as a block.
+ *
+ * @return int 0 on success, or if none were kept; -1 otherwise.
+ */
+int access_log_flush(void);
+
+/**
+ * @brief Hash a URL into the path_hash column: 64-bit FNV-1a.
+ *
+ * @param url URL.
+ * @return uint64_t Hash.
+ */
+uint64_t access_log_hash(const char* url);
+
+/**
+ * @brief Open a log file for reading, and check its header.
+ *
+ * @param path Path of the log file.
+ * @return FILE* File, positioned at its first block; NULL if it cannot be
+ * opened, or is not a log file of this format and byte order.
+ */
+FILE* access_log_read_open(const char* path);
+
+/**
+ * @brief Read the next block of a log file.
+ *
+ * @param file File from access_log_read_open().
+ * @param rows Output; records of the block, ACCESS_LOG_BLOCK_ROWS of them at
+ * the most.
+ * @return int Number of records read; 0 at the end of the file; -1 if the
+ * block is truncated or corrupt.
+ */
+int access_log_read(FILE* file, struct access_record* rows);
+
+/**
+ * @brief Get the name of a method.
+ *
+ * @param method enum access_method.
+ * @return const char* Name, e.g. "GET"; "OTHER" for others.
+ */
+const char* access_log_method_name(int method);
+
+/**
+ * @brief Get the name of a cache outcome.
+ *
+ * @param cache enum access_cache.
+ * @return const char* Name, e.g. "hit".
+ */
+const char* access_log_cache_name(int cache);
+
+/**
+ * @brief Get statistics of the access log.
+ *
+ * @param out_stats Output; access log statistics, non-null.
+ */
+void access_log_get_stats(struct access_log_stats* out_stats);
+
+/**
+ * @brief Print statistics of the access log.
+ */
+void access_log_log_stats(void);
+
+#endif /* ACCESS_LOG_H */
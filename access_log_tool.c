@@ -0,0 +1,452 @@
+/**************************************************************
+*
+*                      access_log_tool.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-02
+*
+*     Summary:
+*     Offline reader of access logs written by the proxy with
+*     -L.
+*
+*     Usage: access_log_tool csv|json|stats <file>...
+*     csv prints one line per record, after a line of column
+*     names; json prints one JSON object per record and line;
+*     stats prints the request rate, status classes, cache
+*     hit ratio, percentiles of the phase timings, and the
+*     busiest hosts. Files are read in the order given, e.g.
+*     log.2 log.1 log for rotated files from oldest to newest.
+*
+**************************************************************/
+
+#include "access_log.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOP_HOSTS 10 /* Number of hosts printed by stats. */
+#define MAX_HOSTS 4096 /* Number of slots in the host table; a power of 2.
+                        * Hosts past 3/4 of them are counted as "other". */
+
+/* Statistics of a host. */
+struct host_stats {
+    char name[ACCESS_LOG_HOST_LEN]; /* Host; empty if the slot is free. */
+    long requests; /* Number of requests. */
+    long hits; /* Number of hits, stale ones included. */
+    long misses; /* Number of misses. */
+    long bytes; /* Byte size of responses. */
+    double total_us; /* Sum of the response times. */
+};
+
+/* Growing array of timings. */
+struct samples {
+    long* values; /* Timings. */
+    long len; /* Number of timings. */
+    long cap; /* Capacity of values. */
+};
+
+/* Statistics of all records. */
+struct summary {
+    long records; /* Number of records. */
+    int64_t first_us; /* Earliest request time. */
+    int64_t last_us; /* Latest request time. */
+    long methods[ACCESS_NUM_METHODS]; /* Number of requests per method. */
+    long statuses[6]; /* Number of responses per status class; 0 for
+                       * unknown. */
+    long cache[ACCESS_NUM_CACHE]; /* Number of requests per cache
+                                   * outcome. */
+    long bytes; /* Byte size of responses. */
+    struct samples total; /* Response times. */
+    struct samples first_byte; /* Times to the first byte of servers. */
+    struct samples connect; /* Connect times. */
+    struct host_stats* hosts; /* Table of MAX_HOSTS hosts. */
+    int num_hosts; /* Number of hosts in the table. */
+    struct host_stats other; /* Hosts that do not fit the table. */
+};
+
+/**
+ * @brief Print usage and exit on failure.
+ *
+ * @param prog Program name.
+ */
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s csv|json|stats <file>...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Compare two longs for qsort().
+ *
+ * @param a Pointer to a long.
+ * @param b Pointer to a long.
+ * @return int Negative, zero or positive as a is less than, equal to or
+ * greater than b.
+ */
+static int compare_long(const void* a, const void* b)
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Compare two hosts for qsort(), busiest first.
+ *
+ * @param a Pointer to a struct host_stats.
+ * @param b Pointer to a struct host_stats.
+ * @return int Negative if a has more requests than b; positive if fewer.
+ */
+static int compare_hosts(const void* a, const void* b)
+{
+    long x = ((const struct host_stats*)a)->requests;
+    long y = ((const struct host_stats*)b)->requests;
+
+    return (x < y) - (x > y);
+}
+
+/**
+ * @brief Add a timing to an array.
+ *
+ * @param s Array.
+ * @param value Timing.
+ */
+static void add_sample(struct samples* s, long value)
+{
+    if (s->len == s->cap) {
+        s->cap = s->cap > 0 ? 2 * s->cap : 4096;
+        s->values = realloc(s->values, s->cap * sizeof(long));
+        if (s->values == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->values[s->len++] = value;
+}
+
+/**
+ * @brief Print percentiles of an array of timings, which get sorted.
+ *
+ * @param name Name of the timing.
+ * @param s Array.
+ */
+static void print_percentiles(const char* name, struct samples* s)
+{
+    if (s->len == 0) {
+        printf("  %-10s none\n", name);
+        return;
+    }
+    qsort(s->values, s->len, sizeof(long), compare_long);
+    printf("  %-10s p50 %ld us, p90 %ld us, p99 %ld us, p99.9 %ld us, "
+           "max %ld us (%ld requests)\n",
+           name,
+           s->values[s->len * 50 / 100],
+           s->values[s->len * 90 / 100],
+           s->values[s->len * 99 / 100],
+           s->values[s->len * 999 / 1000],
+           s->values[s->len - 1],
+           s->len);
+}
+
+/**
+ * @brief Find the statistics of a host, adding the host if it is new.
+ *
+ * @param sum Summary.
+ * @param host Host.
+ * @return struct host_stats* Statistics of the host.
+ */
+static struct host_stats* find_host(struct summary* sum, const char* host)
+{
+    uint32_t i = 2166136261U;
+
+    for (const char* c = host; *c != '\0'; ++c) {
+        i = (i ^ (unsigned char)*c) * 16777619U;
+    }
+    i &= MAX_HOSTS - 1;
+    while (sum->hosts[i].name[0] != '\0') {
+        if (strcmp(sum->hosts[i].name, host) == 0) {
+            return &sum->hosts[i];
+        }
+        i = (i + 1) & (MAX_HOSTS - 1);
+    }
+    if (host[0] == '\0' || sum->num_hosts >= MAX_HOSTS / 4 * 3) {
+        return &sum->other;
+    }
+    strcpy(sum->hosts[i].name, host);
+    sum->num_hosts++;
+    return &sum->hosts[i];
+}
+
+/**
+ * @brief Add a record to a summary.
+ *
+ * @param sum Summary.
+ * @param rec Record.
+ */
+static void add_record(struct summary* sum, const struct access_record* rec)
+{
+    struct host_stats* h = find_host(sum, rec->host);
+
+    if (sum->records == 0 || rec->time_us < sum->first_us) {
+        sum->first_us = rec->time_us;
+    }
+    if (sum->records == 0 || rec->time_us > sum->last_us) {
+        sum->last_us = rec->time_us;
+    }
+    sum->records++;
+    sum->methods[rec->method < ACCESS_NUM_METHODS ? rec->method : 0]++;
+    sum->statuses[rec->status >= 100 && rec->status < 600 ?
+                  rec->status / 100 : 0]++;
+    if (rec->cache < ACCESS_NUM_CACHE) {
+        sum->cache[rec->cache]++;
+    }
+    sum->bytes += rec->bytes;
+    add_sample(&sum->total, rec->total_us);
+    if (rec->first_byte_us > 0) {
+        add_sample(&sum->first_byte, rec->first_byte_us);
+    }
+    if (rec->connect_us > 0) {
+        add_sample(&sum->connect, rec->connect_us);
+    }
+
+    h->requests++;
+    h->hits += rec->cache == ACCESS_CACHE_HIT ||
+               rec->cache == ACCESS_CACHE_STALE;
+    h->misses += rec->cache == ACCESS_CACHE_MISS;
+    h->bytes += rec->bytes;
+    h->total_us += rec->total_us;
+}
+
+/**
+ * @brief Print a summary.
+ *
+ * @param sum Summary.
+ */
+static void print_summary(struct summary* sum)
+{
+    double span = (sum->last_us - sum->first_us) / 1e6;
+    long hits = sum->cache[ACCESS_CACHE_HIT] + sum->cache[ACCESS_CACHE_STALE];
+    long lookups = hits + sum->cache[ACCESS_CACHE_MISS];
+    int top = 0;
+
+    printf("%ld requests over %.3f s (%.1f requests/sec), %ld bytes\n",
+           sum->records,
+           span,
+           span > 0 ? sum->records / span : 0.0,
+           sum->bytes);
+    printf("methods:");
+    for (int i = 1; i <= ACCESS_NUM_METHODS; ++i) {
+        int m = i % ACCESS_NUM_METHODS;
+
+        printf(" %s %ld", access_log_method_name(m), sum->methods[m]);
+    }
+    printf("\nstatus: 1xx %ld, 2xx %ld, 3xx %ld, 4xx %ld, 5xx %ld, "
+           "unknown %ld\n",
+           sum->statuses[1],
+           sum->statuses[2],
+           sum->statuses[3],
+           sum->statuses[4],
+           sum->statuses[5],
+           sum->statuses[0]);
+    printf("cache: hit ratio %.1f%% (%ld hits, %ld stale, %ld misses), "
+           "%ld not looked up\n",
+           lookups > 0 ? 100.0 * hits / lookups : 0.0,
+           sum->cache[ACCESS_CACHE_HIT],
+           sum->cache[ACCESS_CACHE_STALE],
+           sum->cache[ACCESS_CACHE_MISS],
+           sum->cache[ACCESS_CACHE_NONE]);
+    printf("timings:\n");
+    print_percentiles("response", &sum->total);
+    print_percentiles("first byte", &sum->first_byte);
+    print_percentiles("connect", &sum->connect);
+
+    qsort(sum->hosts, MAX_HOSTS, sizeof(struct host_stats), compare_hosts);
+    printf("busiest hosts:\n");
+    for (int i = 0; i < MAX_HOSTS && top < TOP_HOSTS; ++i) {
+        struct host_stats* h = &sum->hosts[i];
+
+        if (h->requests == 0) {
+            break;
+        }
+        printf("  %-32s %ld requests, hit ratio %.1f%%, %ld bytes, "
+               "mean %.0f us\n",
+               h->name,
+               h->requests,
+               h->hits + h->misses > 0 ?
+               100.0 * h->hits / (h->hits + h->misses) : 0.0,
+               h->bytes,
+               h->total_us / h->requests);
+        top++;
+    }
+    if (sum->other.requests > 0) {
+        printf("  %-32s %ld requests\n", "(other)", sum->other.requests);
+    }
+}
+
+/**
+ * @brief Print a string as a JSON string, quoted and escaped.
+ *
+ * @param s String.
+ */
+static void print_json_string(const char* s)
+{
+    putchar('"');
+    for (; *s != '\0'; ++s) {
+        unsigned char c = *s;
+
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        }
+        else if (c < 0x20 || c >= 0x7f) {
+            printf("\\u%04x", c);
+        }
+        else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Print a string as a CSV field, quoted if it holds a comma, a quote or
+ * a line break.
+ *
+ * @param s String.
+ */
+static void print_csv_string(const char* s)
+{
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        fputs(s, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *s != '\0'; ++s) {
+        if (*s == '"') {
+            putchar('"');
+        }
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Print a record as a CSV line or a JSON object.
+ *
+ * @param rec Record.
+ * @param json 1 for JSON; 0 for CSV.
+ */
+static void print_record(const struct access_record* rec, int json)
+{
+    char client[INET_ADDRSTRLEN];
+    struct in_addr addr;
+
+    addr.s_addr = rec->client;
+    inet_ntop(AF_INET, &addr, client, sizeof(client));
+    if (json) {
+        printf("{\"time_us\":%lld,\"client\":\"%s\",\"host\":",
+               (long long)rec->time_us,
+               client);
+        print_json_string(rec->host);
+        printf(",\"path_hash\":\"%016llx\",\"method\":\"%s\",\"status\":%u,"
+               "\"cache\":\"%s\",\"bytes\":%u,\"connect_us\":%u,"
+               "\"first_byte_us\":%u,\"total_us\":%u}\n",
+               (unsigned long long)rec->path_hash,
+               access_log_method_name(rec->method),
+               rec->status,
+               access_log_cache_name(rec->cache),
+               rec->bytes,
+               rec->connect_us,
+               rec->first_byte_us,
+               rec->total_us);
+    }
+    else {
+        printf("%lld,%s,", (long long)rec->time_us, client);
+        print_csv_string(rec->host);
+        printf(",%016llx,%s,%u,%s,%u,%u,%u,%u\n",
+               (unsigned long long)rec->path_hash,
+               access_log_method_name(rec->method),
+               rec->status,
+               access_log_cache_name(rec->cache),
+               rec->bytes,
+               rec->connect_us,
+               rec->first_byte_us,
+               rec->total_us);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    struct access_record* rows = NULL;
+    struct summary sum;
+    int mode = 0; /* 0 for csv, 1 for json, 2 for stats. */
+    int failed = 0;
+
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+    if (strcmp(argv[1], "csv") == 0) {
+        mode = 0;
+    }
+    else if (strcmp(argv[1], "json") == 0) {
+        mode = 1;
+    }
+    else if (strcmp(argv[1], "stats") == 0) {
+        mode = 2;
+    }
+    else {
+        usage(argv[0]);
+    }
+
+    rows = malloc(ACCESS_LOG_BLOCK_ROWS * sizeof(struct access_record));
+    bzero(&sum, sizeof(sum));
+    sum.hosts = calloc(MAX_HOSTS, sizeof(struct host_stats));
+    if (rows == NULL || sum.hosts == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    if (mode == 0) {
+        printf("time_us,client,host,path_hash,method,status,cache,bytes,"
+               "connect_us,first_byte_us,total_us\n");
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        FILE* file = access_log_read_open(argv[i]);
+        int n;
+
+        if (file == NULL) {
+            fprintf(stderr, "%s: not an access log\n", argv[i]);
+            failed = 1;
+            continue;
+        }
+        while ((n = access_log_read(file, rows)) > 0) {
+            for (int r = 0; r < n; ++r) {
+                if (mode == 2) {
+                    add_record(&sum, &rows[r]);
+                }
+                else {
+                    print_record(&rows[r], mode == 1);
+                }
+            }
+        }
+        if (n < 0) {
+            /* A block cut short, e.g. by a crash while it was written. */
+            fprintf(stderr, "%s: truncated or corrupt block\n", argv[i]);
+            failed = 1;
+        }
+        fclose(file);
+    }
+    if (mode == 2) {
+        print_summary(&sum);
+    }
+
+    free(rows);
+    free(sum.hosts);
+    free(sum.total.values);
+    free(sum.first_byte.values);
+    free(sum.connect.values);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/**************************************************************
+*
+*                         affinity.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-24
+*
+*     Summary:
+*     Implementation for placing worker processes on CPUs.
+*
+**************************************************************/
+
+#define _GNU_SOURCE /* For sched_setaffinity(), sched_getcpu() and CPU_SET(). */
+#include "affinity.h"
+#include "logger.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define AFFINITY_CPU_DIR "/sys/devices/system/cpu" /* Directory of CPUs in
+                                                   * sysfs. */
+
+/**
+ * @brief Get the number of online CPUs.
+ *
+ * @return int Number of CPUs, at least 1.
+ */
+int affinity_num_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+/**
+ * @brief Get the CPU the calling process runs on.
+ *
+ * @return int CPU index; 0 if unknown.
+ */
+int affinity_current_cpu(void)
+{
+    int cpu = sched_getcpu();
+
+    return cpu >= 0 ? cpu : 0;
+}
+
+/**
+ * @brief Get the NUMA node of a CPU, from the "node<N>" link in its sysfs
+ * directory.
+ *
+ * @param cpu CPU index.
+ * @return int Node index; -1 if unknown, e.g. without NUMA support.
+ */
+int affinity_cpu_node(int cpu)
+{
+    char path[64];
+    DIR* dir;
+    struct dirent* entry;
+    int node = -1;
+
+    snprintf(path, sizeof(path), AFFINITY_CPU_DIR "/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 &&
+            sscanf(entry->d_name + 4, "%d", &node) == 1) {
+            break;
+        }
+        node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * @brief Pin the calling process to a CPU, and have it allocate memory on the
+ * node of the CPU it runs on.
+ *
+ * @param cpu CPU index.
+ * @return int 0 on success; -1 if the process cannot be pinned.
+ */
+int affinity_pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        PLOG_ERROR("sched_setaffinity");
+        return -1;
+    }
+
+    /* Pages are placed on the node of the CPU that first touches them. */
+    if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) < 0) {
+        PLOG_ERROR("set_mempolicy");
+    }
+    return 0;
+}
+
+/**
+ * @brief Open a non-blocking TCP socket listening on a port shared with
+ * SO_REUSEPORT.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections.
+ * @param cpu CPU whose connections the socket prefers.
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+static int affinity_listen(int port, int backlog, int cpu)
+{
+    int sock;
+    int optval = 1;
+    struct sockaddr_in addr;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (setsockopt(sock,
+                   SOL_SOCKET,
+                   SO_REUSEADDR,
+                   &optval,
+                   sizeof(optval)) < 0 ||
+        setsockopt(sock,
+                   SOL_SOCKET,
+                   SO_REUSEPORT,
+                   &optval,
+                   sizeof(optval)) < 0) {
+        int err = errno;
+
+        close(sock);
+        errno = err;
+        return -1;
+    }
+
+    /* A hint only; kernels without it fall back to the BPF program. */
+    if (setsockopt(sock,
+                   SOL_SOCKET,
+                   SO_INCOMING_CPU,
+                   &cpu,
+                   sizeof(cpu)) < 0) {
+        PLOG_ERROR("setsockopt SO_INCOMING_CPU");
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(sock, backlog) < 0) {
+        int err = errno;
+
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Open a group of non-blocking TCP sockets listening on the same port
+ * with SO_REUSEPORT, one per worker, steered by the receiving CPU.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections per socket.
+ * @param socks Output; FDs of the sockets.
+ * @param num_socks Number of sockets, positive.
+ * @return int 0 on success; -1 on failure, with errno set and no socket left
+ * open.
+ */
+int affinity_listen_group(int port, int backlog, int* socks, int num_socks)
+{
+    /* Return the index of the socket: the receiving CPU modulo the number of
+     * sockets, which are indexed in the order they joined the group. */
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)num_socks},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+
+    for (int i = 0; i < num_socks; ++i) {
+        socks[i] = affinity_listen(port, backlog, i);
+        if (socks[i] < 0) {
+            int err = errno;
+
+            while (--i >= 0) {
+                close(socks[i]);
+            }
+            errno = err;
+            return -1;
+        }
+    }
+
+    /* The program steers the whole group. */
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(socks[0],
+                   SOL_SOCKET,
+                   SO_ATTACH_REUSEPORT_CBPF,
+                   &prog,
+                   sizeof(prog)) < 0) {
+        PLOG_ERROR("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+    }
+    return 0;
+}
+
+/**
+ * @brief Busy poll a socket for up to the given time before a read sleeps.
+ *
+ * @param sock FD of the socket.
+ * @param usec Microseconds to busy poll, positive.
+ * @return int 0 on success; -1 on failure, with errno set.
+ */
+int affinity_busy_poll(int sock, int usec)
+{
+    return setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+}
@@ -0,0 +1,81 @@
+/**************************************************************
+*
+*                         affinity.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-24
+*
+*     Summary:
+*     Interface for placing worker processes on CPUs: pinning a
+*     process to a core with memory from its NUMA node, a group
+*     of SO_REUSEPORT listening sockets that steers each
+*     connection to the worker on the CPU that received it, and
+*     busy polling of sockets.
+*
+**************************************************************/
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+/**
+ * @brief Get the number of online CPUs.
+ *
+ * @return int Number of CPUs, at least 1.
+ */
+int affinity_num_cpus(void);
+
+/**
+ * @brief Get the CPU the calling process runs on.
+ *
+ * @return int CPU index; 0 if unknown.
+ */
+int affinity_current_cpu(void);
+
+/**
+ * @brief Get the NUMA node of a CPU.
+ *
+ * @param cpu CPU index.
+ * @return int Node index; -1 if unknown, e.g. without NUMA support.
+ */
+int affinity_cpu_node(int cpu);
+
+/**
+ * @brief Pin the calling process to a CPU, and have it allocate memory on the
+ * node of the CPU it runs on. Memory touched afterwards, e.g. the cache arena
+ * and socket buffers, then lands on the local node.
+ *
+ * @param cpu CPU index.
+ * @return int 0 on success; -1 if the process cannot be pinned. A failure to
+ * set the memory policy is only logged, as kernels without NUMA refuse it.
+ */
+int affinity_pin(int cpu);
+
+/**
+ * @brief Open a group of non-blocking TCP sockets listening on the same port
+ * with SO_REUSEPORT, one per worker. Socket i takes connections received on
+ * CPUs i, i + num_socks, ..., by SO_INCOMING_CPU and a classic BPF program
+ * attached with SO_ATTACH_REUSEPORT_CBPF. Without them, e.g. on old kernels,
+ * the kernel spreads connections by hash.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections per socket.
+ * @param socks Output; FDs of the sockets.
+ * @param num_socks Number of sockets, positive.
+ * @return int 0 on success; -1 on failure, with errno set and no socket left
+ * open.
+ */
+int affinity_listen_group(int port, int backlog, int* socks, int num_socks);
+
+/**
+ * @brief Busy poll a socket for up to the given time before a read sleeps.
+ * select() busy polls too when net.core.busy_poll is set.
+ *
+ * @param sock FD of the socket.
+ * @param usec Microseconds to busy poll, positive. Raising it above the
+ * current value needs CAP_NET_ADMIN.
+ * @return int 0 on success; -1 on failure, with errno set.
+ */
+int affinity_busy_poll(int sock, int usec);
+
+#endif /* AFFINITY_H */
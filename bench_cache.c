@@ -0,0 +1,371 @@
+/**************************************************************
+*
+*                       bench_cache.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-15
+*
+*     Summary:
+*     Micro benchmark for cache lookups and eviction policies.
+*
+*     Usage: ./bench_cache [num_entries]
+*     where [num_entries] is the number of cached elements,
+*     10000000 by default. It reports lookups/sec for hits
+*     and misses on uniformly random keys.
+*
+*     Usage: ./bench_cache -r <trace_file> [capacity]
+*     replays a trace under the LRU and CLOCK policies, and
+*     reports hit ratio and requests/sec of each. Each line
+*     of the trace is "<key> [<size>]". If <trace_file> is
+*     "zipf", a Zipf(0.99) trace over 10 * capacity keys is
+*     generated. [capacity] is 100000 by default.
+*
+**************************************************************/
+
+#include "cache.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_VAL_LEN 8 /* Byte size of each cached value. */
+#define BENCH_ELEM_BYTES 192 /* Arena bytes reserved per element. */
+#define TRACE_VAL_LEN 100 /* Default byte size of a value in a trace. */
+#define TRACE_ZIPF_ALPHA 0.99 /* Skew of the generated trace. */
+#define TRACE_ZIPF_LEN 2000000 /* Number of requests in generated trace. */
+
+struct trace {
+    char** keys; /* Key of each request. */
+    int* sizes; /* Value byte size of each request. */
+    int len; /* Number of requests. */
+};
+
+static uint64_t rng_state = 88172645463325252ULL; /* State of xorshift64. */
+
+/**
+ * @brief Get the next pseudo random number.
+ */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/**
+ * @brief Format the key of the given id, like a hostname + url cache key.
+ *
+ * @param id Key id.
+ * @param prefix Prefix that separates hit keys from miss keys.
+ * @param out_key Output buffer of at least 64 bytes.
+ */
+static void format_key(uint64_t id, const char* prefix, char* out_key)
+{
+    char digits[24];
+    int n = 0;
+    size_t len = strlen(prefix);
+
+    memcpy(out_key, prefix, len);
+    do {
+        digits[n++] = '0' + id % 10;
+        id /= 10;
+    } while (id > 0);
+    while (n > 0) {
+        out_key[len++] = digits[--n];
+    }
+    memcpy(out_key + len, ".html", strlen(".html") + 1);
+}
+
+/**
+ * @brief Get monotonic time in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Look up random keys and report lookups/sec.
+ *
+ * @param name Name of the run.
+ * @param n Number of cached elements.
+ * @param lookups Number of lookups.
+ * @param prefix Key prefix; the same prefix as puts for hits.
+ * @param expected Expected return value of cache_get().
+ */
+static void bench_lookups(const char* name,
+                          int n,
+                          int lookups,
+                          const char* prefix,
+                          int expected)
+{
+    char key[64];
+    char* val = NULL;
+    int val_len = 0;
+    int age = 0;
+    double start;
+    double elapsed;
+
+    start = now_sec();
+    for (int i = 0; i < lookups; ++i) {
+        format_key(rng_next() % n, prefix, key);
+        if (cache_get(key, &val, &val_len, &age) != expected) {
+            fprintf(stderr, "unexpected result for %s\n", key);
+            exit(EXIT_FAILURE);
+        }
+        free(val);
+        val = NULL;
+    }
+    elapsed = now_sec() - start;
+    printf("%-6s lookups: %d in %.3f s, %.0f lookups/sec, %.1f ns/lookup\n",
+           name,
+           lookups,
+           elapsed,
+           lookups / elapsed,
+           elapsed * 1e9 / lookups);
+}
+
+/**
+ * @brief Append a request to the trace.
+ */
+static void trace_append(struct trace* trace, const char* key, int size)
+{
+    if ((trace->len & (trace->len - 1)) == 0) {
+        int cap = trace->len == 0 ? 1 : trace->len * 2;
+        trace->keys = realloc(trace->keys, cap * sizeof(char*));
+        trace->sizes = realloc(trace->sizes, cap * sizeof(int));
+        if (trace->keys == NULL || trace->sizes == NULL) {
+            fprintf(stderr, "fail to grow trace\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace->keys[trace->len] = strdup(key);
+    trace->sizes[trace->len] = size;
+    trace->len++;
+}
+
+/**
+ * @brief Load a trace file of "<key> [<size>]" lines.
+ */
+static void trace_load(struct trace* trace, const char* path)
+{
+    FILE* file;
+    char line[4096];
+    char key[4096];
+    int size;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size = TRACE_VAL_LEN;
+        if (sscanf(line, "%4095s %d", key, &size) >= 1 && size > 0) {
+            trace_append(trace, key, size);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Generate a trace whose key popularity follows a Zipf distribution.
+ *
+ * @param num_keys Number of distinct keys.
+ */
+static void trace_zipf(struct trace* trace, int num_keys)
+{
+    double* cdf = malloc(num_keys * sizeof(double));
+    double sum = 0.0;
+    char key[64];
+
+    if (cdf == NULL) {
+        fprintf(stderr, "fail to allocate cdf\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_keys; ++i) {
+        sum += 1.0 / pow(i + 1, TRACE_ZIPF_ALPHA);
+        cdf[i] = sum;
+    }
+    for (int i = 0; i < TRACE_ZIPF_LEN; ++i) {
+        double u = (rng_next() >> 11) * (1.0 / 9007199254740992.0) * sum;
+        int lo = 0;
+        int hi = num_keys - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] >= u) {
+                hi = mid;
+            }
+            else {
+                lo = mid + 1;
+            }
+        }
+        /* Scatter popular keys, so rank does not follow insertion order. */
+        format_key((uint64_t)lo * 2654435761U % num_keys,
+                   "www.example.com/static/",
+                   key);
+        trace_append(trace, key, TRACE_VAL_LEN);
+    }
+    free(cdf);
+}
+
+/**
+ * @brief Replay a trace: get each key and put it on a miss.
+ *
+ * @param name Name of the policy.
+ * @param policy Eviction policy.
+ * @param capacity Max number of elements.
+ */
+static void trace_replay(const struct trace* trace,
+                         const char* name,
+                         int policy,
+                         int capacity)
+{
+    struct cache_config config;
+    struct cache_stats stats;
+    char* val = NULL;
+    char* buf;
+    int val_len = 0;
+    int age = 0;
+    int max_size = TRACE_VAL_LEN;
+    double start;
+    double elapsed;
+
+    for (int i = 0; i < trace->len; ++i) {
+        if (trace->sizes[i] > max_size) {
+            max_size = trace->sizes[i];
+        }
+    }
+    buf = calloc(max_size, 1);
+    config.capacity = capacity;
+    config.arena_size = (size_t)capacity * (BENCH_ELEM_BYTES + TRACE_VAL_LEN) +
+                        CACHE_DEFAULT_ARENA_SIZE;
+    config.use_huge_pages = 1;
+    config.policy = policy;
+    config.host_quota = 0;
+    if (buf == NULL || cache_init_config(&config) < 0) {
+        fprintf(stderr, "fail to init cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now_sec();
+    for (int i = 0; i < trace->len; ++i) {
+        if (cache_get(trace->keys[i], &val, &val_len, &age) > 0) {
+            free(val);
+            val = NULL;
+            continue;
+        }
+        cache_put(trace->keys[i], buf, trace->sizes[i], 3600);
+    }
+    elapsed = now_sec() - start;
+
+    cache_get_stats(&stats);
+    printf("%-6s hit ratio: %.2f%%, %d requests in %.3f s, "
+           "%.0f requests/sec\n",
+           name,
+           100.0 * stats.hits / (stats.hits + stats.misses),
+           trace->len,
+           elapsed,
+           trace->len / elapsed);
+    cache_clear();
+    free(buf);
+}
+
+/**
+ * @brief Replay a trace under each eviction policy.
+ *
+ * @param path Trace file, or "zipf" to generate a trace.
+ * @param capacity Max number of elements.
+ */
+static int bench_replay(const char* path, int capacity)
+{
+    struct trace trace = {NULL, NULL, 0};
+
+    if (strcmp(path, "zipf") == 0) {
+        trace_zipf(&trace, capacity * 10);
+    }
+    else {
+        trace_load(&trace, path);
+    }
+    if (trace.len == 0) {
+        fprintf(stderr, "empty trace\n");
+        return EXIT_FAILURE;
+    }
+    printf("replay %d requests, capacity %d\n", trace.len, capacity);
+    trace_replay(&trace, "lru", CACHE_POLICY_LRU, capacity);
+    trace_replay(&trace, "clock", CACHE_POLICY_CLOCK, capacity);
+
+    for (int i = 0; i < trace.len; ++i) {
+        free(trace.keys[i]);
+    }
+    free(trace.keys);
+    free(trace.sizes);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    struct cache_config config;
+    struct cache_stats stats;
+    char key[64];
+    char val[BENCH_VAL_LEN] = "value..";
+    int n = 10000000;
+    int lookups;
+    double start;
+
+    if (argc >= 3 && strcmp(argv[1], "-r") == 0) {
+        n = argc == 4 ? atoi(argv[3]) : 100000;
+        if (n <= 0) {
+            fprintf(stderr, "usage: %s -r <trace_file> [capacity]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        return bench_replay(argv[2], n);
+    }
+    if (argc == 2) {
+        n = atoi(argv[1]);
+    }
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [num_entries]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    lookups = n < 1000000 ? 1000000 : n;
+
+    config.capacity = n;
+    config.arena_size = (size_t)n * BENCH_ELEM_BYTES;
+    config.use_huge_pages = 1;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 0;
+    if (cache_init_config(&config) < 0) {
+        fprintf(stderr, "fail to init cache\n");
+        return EXIT_FAILURE;
+    }
+
+    start = now_sec();
+    for (int i = 0; i < n; ++i) {
+        format_key(i, "www.example.com/static/", key);
+        if (cache_put(key, val, BENCH_VAL_LEN, 3600) != 1) {
+            fprintf(stderr, "fail to put %s\n", key);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("put    %d entries in %.3f s\n", n, now_sec() - start);
+
+    bench_lookups("hit", n, lookups, "www.example.com/static/", 1);
+    bench_lookups("miss", n, lookups, "www.example.com/absent/", 0);
+
+    cache_get_stats(&stats);
+    printf("index  %zu bytes, %.1f bytes/entry\n",
+           stats.index_bytes,
+           (double)stats.index_bytes / n);
+    printf("rss    %ld bytes\n", stats.rss_bytes);
+
+    cache_clear();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/**************************************************************
+*
+*                       bench_filter.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-05
+*
+*     Summary:
+*     Micro benchmark for the throughput of streaming filters.
+*
+*     Usage: ./bench_filter [mb]
+*     where [mb] is the size of the uncoded body in MB, 16 by
+*     default. The body is HTML, gzip coded by the server, and
+*     goes through each chain in pieces of a TCP read. It
+*     reports MB/s of uncoded body bytes through rewrite alone,
+*     gunzip then rewrite, and gunzip, rewrite then gzip.
+*
+**************************************************************/
+
+#include "filter.h"
+#include "http_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#define PIECE 8192 /* Byte size of each piece pushed, as the proxy reads. */
+
+static long sunk = 0; /* Byte size handed to the sink. */
+
+/**
+ * @brief Get monotonic time in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Sink that only counts bytes.
+ */
+static int count_sink(void* arg, const char* data, int len)
+{
+    (void)arg;
+    (void)data;
+    sunk += len;
+    return 0;
+}
+
+/**
+ * @brief Build a response of a body.
+ *
+ * @param body Body.
+ * @param len Byte size of body.
+ * @param gzip Whether body is gzip coded.
+ * @param out_len Output; byte size of the response.
+ * @return char* Response.
+ */
+static char* make_response(const char* body, int len, int gzip, int* out_len)
+{
+    char* response = malloc(len + 256);
+    int n;
+
+    if (response == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    n = sprintf(response,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/html\r\n"
+                "%s"
+                "Content-Length: %d\r\n"
+                "\r\n",
+                gzip ? "Content-Encoding: gzip\r\n" : "",
+                len);
+    memcpy(response + n, body, len);
+    *out_len = n + len;
+    return response;
+}
+
+/**
+ * @brief Time a chain over a response.
+ *
+ * @param name Name of the chain.
+ * @param specs Filters of the chain, terminated by NULL.
+ * @param response Response.
+ * @param len Byte size of response.
+ * @param raw_len Byte size of the uncoded body.
+ */
+static void bench_chain(const char* name,
+                        const char** specs,
+                        const char* response,
+                        int len,
+                        int raw_len)
+{
+    struct filter_stream* stream;
+    struct filter_stats stats;
+    int head_len = get_head_len(response, len);
+    char* head;
+    int new_head_len;
+    double start;
+    double elapsed;
+    int ret = 0;
+
+    for (int i = 0; specs[i] != NULL; ++i) {
+        if (filter_add(specs[i]) < 0) {
+            fprintf(stderr, "bad filter %s\n", specs[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    sunk = 0;
+    start = now_sec();
+    if (!filter_open(response, head_len, 1, &stream, &head, &new_head_len)) {
+        fprintf(stderr, "%s does not apply\n", name);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = head_len; i < len && ret == 0; i += PIECE) {
+        ret = filter_push(stream,
+                          response + i,
+                          len - i < PIECE ? len - i : PIECE,
+                          count_sink,
+                          NULL);
+    }
+    elapsed = now_sec() - start;
+    if (ret != 1) {
+        fprintf(stderr, "%s fails\n", name);
+        exit(EXIT_FAILURE);
+    }
+    filter_free(stream);
+    free(head);
+    filter_get_stats(&stats);
+    printf("%-24s %10.1f %12ld %12ld %10ld\n",
+           name,
+           raw_len / 1e6 / elapsed,
+           (long)(len - head_len),
+           sunk,
+           stats.rewrites);
+    filter_clear();
+}
+
+int main(int argc, char** argv)
+{
+    static const char* rewrite[] = {"rewrite=example.com=cdn.example.net",
+                                    NULL};
+    static const char* unzip_rewrite[] = {
+        "gunzip", "rewrite=example.com=cdn.example.net", NULL
+    };
+    static const char* full[] = {
+        "gunzip", "rewrite=example.com=cdn.example.net", "gzip", NULL
+    };
+    long mb = 16;
+    int raw_len;
+    char* raw;
+    char* coded;
+    char* plain_response;
+    char* coded_response;
+    int plain_len;
+    int coded_len;
+    uLongf bound;
+    z_stream zs;
+    int n = 0;
+
+    if (argc == 2) {
+        mb = atol(argv[1]);
+    }
+    if (argc > 2 || mb <= 0 || mb > 1024) {
+        fprintf(stderr, "usage: %s [mb]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    raw_len = mb << 20;
+    raw = malloc(raw_len + 128);
+    if (raw == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    while (n < raw_len) {
+        n += sprintf(raw + n,
+                     "<li><a href=\"https://example.com/item/%d\">"
+                     "item %d</a></li>\n",
+                     n,
+                     n % 997);
+    }
+
+    /* Code the body as a server would. */
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "deflateInit2 fails\n");
+        return EXIT_FAILURE;
+    }
+    bound = deflateBound(&zs, raw_len);
+    coded = malloc(bound);
+    if (coded == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    zs.next_in = (unsigned char*)raw;
+    zs.avail_in = raw_len;
+    zs.next_out = (unsigned char*)coded;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "deflate fails\n");
+        return EXIT_FAILURE;
+    }
+    coded_len = zs.total_out;
+    deflateEnd(&zs);
+
+    plain_response = make_response(raw, raw_len, 0, &plain_len);
+    coded_response = make_response(coded, coded_len, 1, &coded_len);
+    printf("%-24s %10s %12s %12s %10s\n",
+           "chain", "MB/s", "in bytes", "out bytes", "rewrites");
+    bench_chain("rewrite", rewrite, plain_response, plain_len, raw_len);
+    bench_chain("gunzip,rewrite",
+                unzip_rewrite,
+                coded_response,
+                coded_len,
+                raw_len);
+    bench_chain("gunzip,rewrite,gzip", full, coded_response, coded_len,
+                raw_len);
+    free(raw);
+    free(coded);
+    free(plain_response);
+    free(coded_response);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,425 @@
+/**************************************************************
+*
+*                        bench_http.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Throughput benchmark of the HTTP parsers on the fuzz
+*     seed corpus.
+*
+*     Usage: ./bench_http [-o <result>] [-g <baseline>]
+*                         [-t <percent>] [corpus_dir]
+*     parses each input of [corpus_dir], fuzz_corpus by
+*     default, the way the fuzz harnesses do, and reports
+*     MB/s and messages/sec of each parser:
+*     - request: extract_first_request(), parse_request_head()
+*       and parse_host_field() on request/.
+*     - response: extract_first_response() and
+*       parse_response_head() on response/.
+*     - chunked: extract_first_response() on chunked/, after
+*       a chunked response head.
+*     - host: parse_host_field() on host/.
+*     -o writes "<parser> <MB/s>" lines to <result>. -g reads
+*     such a file and fails if any parser is more than
+*     <percent>, 10 by default, slower than in it.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_INPUTS 256 /* Max number of inputs of each parser. */
+#define BENCH_MAX_INPUT_LEN 65536 /* Max byte size of an input. */
+#define BENCH_SECONDS 0.3 /* Duration of each round. */
+#define BENCH_ROUNDS 5 /* The best round of each parser is reported. */
+#define BENCH_TOLERANCE 10.0 /* Default slowdown that fails the gate. */
+
+/* Head of a chunked response, prepended to chunked bodies. */
+static const char chunked_head[] = "HTTP/1.1 200 OK\r\n"
+                                   "Transfer-Encoding: chunked\r\n"
+                                   "\r\n";
+
+struct corpus {
+    char* inputs[BENCH_MAX_INPUTS]; /* Inputs, not null-terminated. */
+    int lens[BENCH_MAX_INPUTS]; /* Byte size of each input. */
+    int num_inputs; /* Number of inputs. */
+    long bytes; /* Total byte size of inputs. */
+};
+
+struct parser {
+    const char* name; /* Name of the parser. */
+    const char* dir; /* Corpus subdirectory. */
+    const char* prefix; /* Bytes prepended to each input. */
+    int (*parse)(const char* input, int len); /* Parse one input. */
+    struct corpus corpus; /* Inputs. */
+    double mb_per_sec; /* Result. */
+};
+
+/**
+ * @brief Get the monotonic time in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Parse each request in a client socket buffer.
+ *
+ * @param input Socket buffer.
+ * @param len Byte size of input.
+ * @return int Number of requests.
+ */
+static int parse_requests(const char* input, int len)
+{
+    char* buf = malloc(len);
+    int n = len;
+    char* request = NULL;
+    int request_len = 0;
+    int count = 0;
+
+    memcpy(buf, input, len);
+    while (extract_first_request(&buf, &n, &request, &request_len) > 0) {
+        char* method = NULL;
+        char* url = NULL;
+        char* version = NULL;
+        char* host = NULL;
+        char* hostname = NULL;
+        int port = -1;
+
+        parse_request_head(request, &method, &url, &version, &host);
+        if (host != NULL) {
+            parse_host_field(host, &hostname, &port);
+        }
+        free(method);
+        free(url);
+        free(version);
+        free(host);
+        free(hostname);
+        free(request);
+        request = NULL;
+        count++;
+    }
+    free(buf);
+    return count;
+}
+
+/**
+ * @brief Parse the response in a server socket buffer.
+ *
+ * @param input Socket buffer.
+ * @param len Byte size of input.
+ * @return int 1 if the response is complete; 0 otherwise.
+ */
+static int parse_response(const char* input, int len)
+{
+    char* buf = malloc(len);
+    int n = len;
+    char* response = NULL;
+    int response_len = 0;
+    int max_age = 0;
+    int is_chunked = 0;
+    int count = 0;
+
+    memcpy(buf, input, len);
+    if (extract_first_response(&buf,
+                               &n,
+                               &response,
+                               &response_len,
+                               &max_age,
+                               &is_chunked) > 0) {
+        char* version = NULL;
+        int status_code = -1;
+        char* phrase = NULL;
+        int content_length = 0;
+        char* cache_control = NULL;
+
+        parse_response_head(response,
+                            response_len,
+                            &version,
+                            &status_code,
+                            &phrase,
+                            &content_length,
+                            &cache_control);
+        free(version);
+        free(phrase);
+        free(cache_control);
+        free(response);
+        count = 1;
+    }
+    free(buf);
+    return count;
+}
+
+/**
+ * @brief Walk the chunked body of a response in a server socket buffer.
+ *
+ * @param input Socket buffer.
+ * @param len Byte size of input.
+ * @return int 1 if the response is complete; 0 otherwise.
+ */
+static int parse_chunked(const char* input, int len)
+{
+    char* buf = malloc(len);
+    int n = len;
+    char* response = NULL;
+    int response_len = 0;
+    int max_age = 0;
+    int is_chunked = 0;
+    int count = 0;
+
+    memcpy(buf, input, len);
+    if (extract_first_response(&buf,
+                               &n,
+                               &response,
+                               &response_len,
+                               &max_age,
+                               &is_chunked) > 0) {
+        free(response);
+        count = 1;
+    }
+    free(buf);
+    return count;
+}
+
+/**
+ * @brief Parse a Host field value.
+ *
+ * @param input Null-terminated field value.
+ * @param len Byte size of input.
+ * @return int 1.
+ */
+static int parse_host(const char* input, int len)
+{
+    char* hostname = NULL;
+    int port = -1;
+
+    (void)len;
+    parse_host_field(input, &hostname, &port);
+    free(hostname);
+    return 1;
+}
+
+/**
+ * @brief Load each file of a corpus directory.
+ *
+ * @param dir Corpus directory.
+ * @param prefix Bytes prepended to each input.
+ * @param out_corpus Output; loaded inputs.
+ * @return int 0 on success; -1 if the directory has no input.
+ */
+static int load_corpus(const char* dir,
+                       const char* prefix,
+                       struct corpus* out_corpus)
+{
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    char path[1024];
+    int prefix_len = strlen(prefix);
+
+    out_corpus->num_inputs = 0;
+    out_corpus->bytes = 0;
+    if (d == NULL) {
+        perror(dir);
+        return -1;
+    }
+    while ((entry = readdir(d)) != NULL &&
+           out_corpus->num_inputs < BENCH_MAX_INPUTS) {
+        FILE* file;
+        char* input;
+        int len;
+
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        file = fopen(path, "rb");
+        if (file == NULL) {
+            continue;
+        }
+        /* One more byte null-terminates Host field values. */
+        input = malloc(prefix_len + BENCH_MAX_INPUT_LEN + 1);
+        memcpy(input, prefix, prefix_len);
+        len = prefix_len + fread(input + prefix_len,
+                                 1,
+                                 BENCH_MAX_INPUT_LEN,
+                                 file);
+        input[len] = '\0';
+        fclose(file);
+        out_corpus->inputs[out_corpus->num_inputs] = input;
+        out_corpus->lens[out_corpus->num_inputs] = len;
+        out_corpus->num_inputs++;
+        out_corpus->bytes += len;
+    }
+    closedir(d);
+    return out_corpus->num_inputs > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Run a parser over its corpus and measure its best throughput.
+ *
+ * @param parser Parser with a loaded corpus; its result is set.
+ */
+static void bench_parser(struct parser* parser)
+{
+    struct corpus* corpus = &parser->corpus;
+    double best = 0;
+    double best_messages = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        double start = now_sec();
+        double elapsed;
+        long passes = 0;
+        long messages = 0;
+
+        do {
+            for (int i = 0; i < corpus->num_inputs; ++i) {
+                messages += parser->parse(corpus->inputs[i], corpus->lens[i]);
+            }
+            passes++;
+            elapsed = now_sec() - start;
+        } while (elapsed < BENCH_SECONDS);
+        if (passes * corpus->bytes / elapsed > best) {
+            best = passes * corpus->bytes / elapsed;
+            best_messages = messages / elapsed;
+        }
+    }
+    parser->mb_per_sec = best / (1024 * 1024);
+    printf("%-8s %3d inputs %8.2f MB/s %10.0f msgs/s\n",
+           parser->name,
+           corpus->num_inputs,
+           parser->mb_per_sec,
+           best_messages);
+}
+
+/**
+ * @brief Compare results against a baseline file.
+ *
+ * @param path Path of the baseline file.
+ * @param parsers Benchmarked parsers.
+ * @param num_parsers Number of parsers.
+ * @param tolerance Slowdown in percent that fails the gate.
+ * @return int 0 if no parser is slower than tolerated; -1 otherwise.
+ */
+static int check_baseline(const char* path,
+                          const struct parser* parsers,
+                          int num_parsers,
+                          double tolerance)
+{
+    FILE* file = fopen(path, "r");
+    char name[64];
+    double baseline;
+    int ret = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fscanf(file, "%63s %lf", name, &baseline) == 2) {
+        for (int i = 0; i < num_parsers; ++i) {
+            double change;
+
+            if (strcmp(name, parsers[i].name) != 0) {
+                continue;
+            }
+            change = (parsers[i].mb_per_sec / baseline - 1) * 100;
+            printf("%-8s %8.2f -> %8.2f MB/s (%+.1f%%)%s\n",
+                   name,
+                   baseline,
+                   parsers[i].mb_per_sec,
+                   change,
+                   change < -tolerance ? " REGRESSION" : "");
+            if (change < -tolerance) {
+                ret = -1;
+            }
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    struct parser parsers[] = {
+        {"request", "request", "", parse_requests, {{0}, {0}, 0, 0}, 0},
+        {"response", "response", "", parse_response, {{0}, {0}, 0, 0}, 0},
+        {"chunked", "chunked", chunked_head, parse_chunked,
+         {{0}, {0}, 0, 0}, 0},
+        {"host", "host", "", parse_host, {{0}, {0}, 0, 0}, 0},
+    };
+    int num_parsers = sizeof(parsers) / sizeof(parsers[0]);
+    const char* corpus_dir = "fuzz_corpus";
+    const char* result = NULL;
+    const char* baseline = NULL;
+    double tolerance = BENCH_TOLERANCE;
+    char dir[1024];
+    int ret = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:g:t:")) != -1) {
+        switch (opt) {
+        case 'o':
+            result = optarg;
+            break;
+        case 'g':
+            baseline = optarg;
+            break;
+        case 't':
+            tolerance = atof(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-o <result>] [-g <baseline>] [-t <percent>] "
+                    "[corpus_dir]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        corpus_dir = argv[optind];
+    }
+
+    for (int i = 0; i < num_parsers; ++i) {
+        snprintf(dir, sizeof(dir), "%s/%s", corpus_dir, parsers[i].dir);
+        if (load_corpus(dir, parsers[i].prefix, &parsers[i].corpus) < 0) {
+            fprintf(stderr, "no input in %s\n", dir);
+            return EXIT_FAILURE;
+        }
+        bench_parser(&parsers[i]);
+    }
+
+    if (result != NULL) {
+        FILE* file = fopen(result, "w");
+
+        if (file == NULL) {
+            perror(result);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < num_parsers; ++i) {
+            fprintf(file, "%s %.2f\n", parsers[i].name, parsers[i].mb_per_sec);
+        }
+        fclose(file);
+    }
+    if (baseline != NULL &&
+        check_baseline(baseline, parsers, num_parsers, tolerance) < 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < num_parsers; ++i) {
+        for (int j = 0; j < parsers[i].corpus.num_inputs; ++j) {
+            free(parsers[i].corpus.inputs[j]);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,1627 @@
+/**************************************************************
+*
+*                        bench_load.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-24
+*
+*     Summary:
+*     Closed-loop load generator that measures the response
+*     time of the proxy on cache hits.
+*
+*     Usage: ./bench_load -p <port> [-c <conns>] [-n <requests>]
+*                         [-u <urls>] [-s <storm_conns>]
+*                         [-r <rtt_ms>] [-l <delay_ms>]
+*                         [-b <bulk_conns>]
+*                         [-- <proxy command>...]
+*     serves a small origin on a loopback port, then keeps
+*     <conns>, 64 by default, keep-alive connections to the
+*     proxy on <port> busy with GET requests for <urls>, 64 by
+*     default, URLs of the origin, until <requests>, 100000 by
+*     default, have been answered. The first tenth warms the
+*     cache and is not measured. It reports requests/sec and
+*     the p50, p99, p99.9 and max response time. Given a proxy
+*     command, it starts the proxy with its log discarded, and
+*     stops it with SIGINT afterwards.
+*
+*     With -s, it also serves a TLS origin, and keeps
+*     <storm_conns> more connections busy with CONNECT requests
+*     to it and TLS handshakes with the proxy in interception
+*     mode, one after another. It reports handshakes/sec and the
+*     p50 and p99 handshake time; the response times of cache
+*     hits then show how long the main loop of the proxy stalls
+*     in the storm. With -c 0, it runs handshakes only, until
+*     <requests> of them are done, and reports the CPU time the
+*     proxy it started spent per handshake.
+*
+*     With -b, it also serves a bulk origin, and keeps
+*     <bulk_conns> more connections busy downloading its
+*     cacheable BENCH_BULK_MB MB body, one after another. It
+*     reports the MB/s of all downloads, the least and most of
+*     one connection and Jain's fairness index of them; the
+*     response times of cache hits then show how long small
+*     requests wait behind bulk transfers.
+*
+*     With -r, it instead serves the TLS origin and sends
+*     <requests> GET requests for one URL of it, one at a time,
+*     each on a new connection with a CONNECT request and a TLS
+*     session resumed from the one before, over a link that
+*     delays each direction by half of <rtt_ms>. The request
+*     goes in TLS 1.3 early data when the ticket allows it. It
+*     reports the p50 and p99 time from the ClientHello to the
+*     whole response, a cache hit after the first request.
+*
+*     With -l, it instead serves an origin whose HTML page takes
+*     <delay_ms> to answer, is never fresh in the cache, and has
+*     a preload Link for each of BENCH_SUBRESOURCES cacheable
+*     subresources. It loads the page <requests> times, one at a
+*     time, as a browser would: each subresource is requested
+*     on a connection of its own as soon as a head of the page,
+*     a "103 Early Hints" or the final one, links it. With -r,
+*     the loads go over the link. It reports the p50 and p99
+*     time from the request of the page to the last byte of the
+*     page and its subresources, and the loads that got early
+*     hints.
+*
+**************************************************************/
+
+#define _GNU_SOURCE /* For memmem(). */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_CONNS 1024 /* Max number of connections to the proxy. */
+#define BENCH_BUF_SIZE 8192 /* Byte size of a response buffer. */
+#define BENCH_BODY_LEN 1024 /* Byte size of a response body of the origin. */
+#define BENCH_START_TRIES 100 /* Attempts to connect a starting proxy. */
+#define BENCH_MAX_STORM 256 /* Max number of connections doing handshakes. */
+#define BENCH_MAX_HANDSHAKES 1000000 /* Max number of handshakes timed. */
+#define BENCH_MAX_LINKS 16 /* Max number of connections over the link. */
+#define BENCH_RTT_WARMUP 2 /* Requests over the link not measured: a full
+                            * handshake and a cache miss first. */
+#define BENCH_SUBRESOURCES 6 /* Number of subresources of a page. */
+#define BENCH_PAGE_WARMUP 2 /* Page loads not measured: the first caches the
+                             * subresources and shows the proxy the links. */
+#define BENCH_MAX_BULK 64 /* Max number of connections downloading. */
+#define BENCH_BULK_MB 16 /* Byte size of the bulk body in MB. */
+#define BENCH_BULK_WRITE (64 * 1024) /* Byte size of a write of the bulk
+                                      * origin, and of a read of a download. */
+
+struct conn {
+    int fd; /* Socket to the proxy. */
+    char buf[BENCH_BUF_SIZE]; /* Response received so far. */
+    int len; /* Byte size of buf. */
+    int need; /* Byte size of the whole response; 0 until its head is in. */
+    long sent_us; /* Time the request was sent in microseconds. */
+};
+
+struct storm_conn {
+    int fd; /* Socket to the proxy. */
+    SSL* ssl; /* TLS connection through the proxy; NULL until the proxy
+               * answers the CONNECT request. */
+    char buf[BENCH_BUF_SIZE]; /* Answer to the CONNECT request so far. */
+    int len; /* Byte size of buf. */
+    long start_us; /* Time the CONNECT request was sent in microseconds. */
+};
+
+struct bulk_conn {
+    int fd; /* Socket to the proxy. */
+    char head[BENCH_BUF_SIZE]; /* Head of the response so far. */
+    long got; /* Byte size of the response received so far. */
+    long need; /* Byte size of the whole response; 0 until its head is in. */
+    long bytes; /* Byte size received while measured. */
+};
+
+struct link_chunk {
+    long due_us; /* Time to deliver it in microseconds. */
+    int len; /* Byte size of data; 0 for the end of the stream. */
+    struct link_chunk* next; /* Next chunk in the same direction. */
+    char data[BENCH_BUF_SIZE]; /* Data read from one end. */
+};
+
+static struct conn conns[BENCH_MAX_CONNS]; /* Connections to the proxy. */
+static int origin_port; /* Port of the origin. */
+static struct storm_conn storm[BENCH_MAX_STORM]; /* Connections doing
+                                                  * handshakes. */
+static int tls_origin_port; /* Port of the TLS origin. */
+static SSL_CTX* storm_ctx; /* TLS client context of the storm. */
+static long handshakes[BENCH_MAX_HANDSHAKES]; /* Handshake times in
+                                               * microseconds. */
+static long num_handshakes = 0; /* Number of handshake times. */
+static SSL_SESSION* next_session = NULL; /* Latest ticket from the proxy. */
+static struct bulk_conn bulk[BENCH_MAX_BULK]; /* Connections downloading. */
+static int bulk_origin_port; /* Port of the bulk origin. */
+
+/**
+ * @brief Get the monotonic time in microseconds.
+ */
+static long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Compare two longs for qsort().
+ */
+static int compare_long(const void* a, const void* b)
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Open a loopback TCP socket listening on an ephemeral port.
+ *
+ * @param port Output; port it listens on.
+ * @return int FD of the socket; exits on failure.
+ */
+static int listen_loopback(int* port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 ||
+        bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(sock, 128) < 0 ||
+        getsockname(sock, (struct sockaddr*)&addr, &len) < 0) {
+        perror("origin");
+        exit(EXIT_FAILURE);
+    }
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+/**
+ * @brief Connect to a loopback port.
+ *
+ * @param port Port.
+ * @return int FD of the socket; -1 on failure.
+ */
+static int connect_loopback(int port)
+{
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+/**
+ * @brief Make the cacheable response of the origins.
+ *
+ * @param out Output buffer of BENCH_BUF_SIZE bytes.
+ * @return int Byte size of the response.
+ */
+static int make_response(char* out)
+{
+    int head_len = snprintf(out, BENCH_BUF_SIZE - BENCH_BODY_LEN,
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Length: %d\r\n"
+                            "Cache-Control: max-age=3600\r\n"
+                            "\r\n",
+                            BENCH_BODY_LEN);
+
+    memset(out + head_len, 'x', BENCH_BODY_LEN);
+    return head_len + BENCH_BODY_LEN;
+}
+
+/**
+ * @brief Make the HTML page of the page origin, which is never fresh in the
+ * cache and has a preload Link for each subresource /u<i>.
+ *
+ * @param out Output buffer of BENCH_BUF_SIZE bytes.
+ * @return int Byte size of the response.
+ */
+static int make_page(char* out)
+{
+    int head_len = snprintf(out, BENCH_BUF_SIZE,
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/html\r\n"
+                            "Cache-Control: max-age=0\r\n");
+
+    for (int i = 0; i < BENCH_SUBRESOURCES; ++i) {
+        head_len += snprintf(out + head_len, BENCH_BUF_SIZE - head_len,
+                             "Link: </u%d>; rel=preload; as=script\r\n",
+                             i);
+    }
+    head_len += snprintf(out + head_len, BENCH_BUF_SIZE - head_len,
+                         "Content-Length: %d\r\n"
+                         "\r\n",
+                         BENCH_BODY_LEN);
+    memset(out + head_len, 'x', BENCH_BODY_LEN);
+    return head_len + BENCH_BODY_LEN;
+}
+
+/**
+ * @brief Answer one request of the proxy to the origin with a cacheable
+ * response, then close the connection.
+ *
+ * @param listen_fd FD of the origin's listening socket.
+ */
+static void serve_origin(int listen_fd)
+{
+    char buf[BENCH_BUF_SIZE];
+    int len = 0;
+    ssize_t n;
+    int fd = accept(listen_fd, NULL, NULL);
+
+    if (fd < 0) {
+        return;
+    }
+    while (memmem(buf, len, "\r\n\r\n", 4) == NULL && len < (int)sizeof(buf)) {
+        n = read(fd, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    len = make_response(buf);
+    if (write(fd, buf, len) < 0) {
+        perror("origin write");
+    }
+    close(fd);
+}
+
+/**
+ * @brief Create a TLS server context with a new self-signed P-256 key, which
+ * signs fast, so the origin keeps up with the proxy.
+ *
+ * @return SSL_CTX* Context; exits on failure.
+ */
+static SSL_CTX* new_origin_ctx(void)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    EVP_PKEY* pkey = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    X509_NAME* name = NULL;
+
+    if (ctx == NULL || pkey == NULL || cert == NULL) {
+        ERR_print_errors_fp(stderr);
+        exit(EXIT_FAILURE);
+    }
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, pkey);
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name,
+                               "CN",
+                               MBSTRING_ASC,
+                               (const unsigned char*)"127.0.0.1",
+                               -1,
+                               -1,
+                               0);
+    X509_set_issuer_name(cert, name);
+    if (X509_sign(cert, pkey, EVP_sha256()) == 0 ||
+        SSL_CTX_use_certificate(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(ctx, pkey) != 1) {
+        ERR_print_errors_fp(stderr);
+        exit(EXIT_FAILURE);
+    }
+    /* The proxy reads its server sockets only for responses. */
+    SSL_CTX_set_num_tickets(ctx, 0);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return ctx;
+}
+
+/**
+ * @brief Serve a TLS origin in a child process, which completes handshakes
+ * of the proxy, answers each request with a cacheable response, and holds
+ * the connections until the proxy closes them.
+ *
+ * @return pid_t Process of the origin.
+ */
+static pid_t start_tls_origin(void)
+{
+    struct pollfd fds[BENCH_MAX_STORM * 2 + 1];
+    SSL* ssls[BENCH_MAX_STORM * 2 + 1];
+    int listen_fd = listen_loopback(&tls_origin_port);
+    int num_fds = 1;
+    SSL_CTX* ctx;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        close(listen_fd);
+        return pid;
+    }
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    ctx = new_origin_ctx();
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    while (poll(fds, num_fds, -1) >= 0) {
+        for (int i = num_fds - 1; i > 0; --i) {
+            char buf[BENCH_BUF_SIZE];
+            int n;
+
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            /* A request fits one record of the proxy. */
+            n = SSL_read(ssls[i], buf, sizeof(buf));
+            if (n > 0) {
+                if (memmem(buf, n, "\r\n\r\n", 4) != NULL) {
+                    n = make_response(buf);
+                    if (SSL_write(ssls[i], buf, n) == n) {
+                        continue;
+                    }
+                }
+                else {
+                    continue;
+                }
+            }
+            /* The proxy closed the connection. */
+            SSL_free(ssls[i]);
+            close(fds[i].fd);
+            fds[i] = fds[--num_fds];
+            ssls[i] = ssls[num_fds];
+        }
+        if ((fds[0].revents & POLLIN) &&
+            num_fds < (int)(sizeof(fds) / sizeof(fds[0]))) {
+            fds[num_fds].fd = accept(listen_fd, NULL, NULL);
+            if (fds[num_fds].fd < 0) {
+                continue;
+            }
+            ssls[num_fds] = SSL_new(ctx);
+            SSL_set_fd(ssls[num_fds], fds[num_fds].fd);
+            if (SSL_accept(ssls[num_fds]) != 1) {
+                SSL_free(ssls[num_fds]);
+                close(fds[num_fds].fd);
+                continue;
+            }
+            fds[num_fds].events = POLLIN;
+            fds[num_fds].revents = 0;
+            num_fds++;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Start a handshake on a storm connection: connect to the proxy and
+ * send a CONNECT request to the TLS origin.
+ *
+ * @param conn Storm connection.
+ * @param port Port of the proxy.
+ */
+static void start_handshake(struct storm_conn* conn, int port)
+{
+    char request[256];
+    int len;
+
+    conn->fd = connect_loopback(port);
+    if (conn->fd < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    len = snprintf(request, sizeof(request),
+                   "CONNECT 127.0.0.1:%d HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:%d\r\n"
+                   "\r\n",
+                   tls_origin_port, tls_origin_port);
+    conn->ssl = NULL;
+    conn->len = 0;
+    conn->start_us = now_us();
+    if (write(conn->fd, request, len) != len) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Step the handshake of a storm connection that is readable, and
+ * start the next one once it is done.
+ *
+ * @param conn Storm connection.
+ * @param port Port of the proxy.
+ * @param timed Whether to record the handshake time.
+ * @return int 1 if the handshake is done; 0 if not yet.
+ */
+static int step_handshake(struct storm_conn* conn, int port, int timed)
+{
+    ssize_t n;
+    int ret;
+
+    if (conn->ssl == NULL) {
+        /* Read the answer to the CONNECT request, then start TLS. */
+        n = read(conn->fd, conn->buf + conn->len,
+                 sizeof(conn->buf) - conn->len - 1);
+        if (n <= 0) {
+            fprintf(stderr, "proxy closed a CONNECT request\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->len += n;
+        conn->buf[conn->len] = '\0';
+        if (strstr(conn->buf, "\r\n\r\n") == NULL) {
+            return 0;
+        }
+        if (strncmp(conn->buf, "HTTP/1.1 200", 12) != 0) {
+            fprintf(stderr, "proxy refused a CONNECT request\n");
+            exit(EXIT_FAILURE);
+        }
+        fcntl(conn->fd, F_SETFL, O_NONBLOCK);
+        conn->ssl = SSL_new(storm_ctx);
+        SSL_set_fd(conn->ssl, conn->fd);
+    }
+    ret = SSL_connect(conn->ssl);
+    if (ret != 1) {
+        if (SSL_get_error(conn->ssl, ret) != SSL_ERROR_WANT_READ) {
+            ERR_print_errors_fp(stderr);
+            fprintf(stderr, "handshake with the proxy failed\n");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
+    if (timed && num_handshakes < BENCH_MAX_HANDSHAKES) {
+        handshakes[num_handshakes++] = now_us() - conn->start_us;
+    }
+    SSL_free(conn->ssl);
+    close(conn->fd);
+    start_handshake(conn, port);
+    return 1;
+}
+
+/**
+ * @brief Serve the bulk origin in a child process, which answers each request
+ * with a cacheable body of BENCH_BULK_MB MB. Each connection is served by a
+ * process of its own.
+ *
+ * @return pid_t Process of the origin.
+ */
+static pid_t start_bulk_origin(void)
+{
+    int listen_fd = listen_loopback(&bulk_origin_port);
+    static char body[BENCH_BULK_WRITE];
+    char buf[BENCH_BUF_SIZE];
+    int len;
+    int n;
+    int fd;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        close(listen_fd);
+        return pid;
+    }
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGCHLD, SIG_IGN);
+    memset(body, 'x', sizeof(body));
+    while (1) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        if (fork() != 0) {
+            close(fd);
+            continue;
+        }
+        len = 0;
+        while (memmem(buf, len, "\r\n\r\n", 4) == NULL &&
+               len < (int)sizeof(buf)) {
+            n = read(fd, buf + len, sizeof(buf) - len);
+            if (n <= 0) {
+                _exit(EXIT_SUCCESS);
+            }
+            len += n;
+        }
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: %ld\r\n"
+                       "Cache-Control: max-age=3600\r\n"
+                       "\r\n",
+                       BENCH_BULK_MB * 1024L * 1024);
+        if (write(fd, buf, len) != len) {
+            _exit(EXIT_SUCCESS);
+        }
+        for (long sent = 0; sent < BENCH_BULK_MB * 1024L * 1024;
+             sent += sizeof(body)) {
+            if (write(fd, body, sizeof(body)) != (ssize_t)sizeof(body)) {
+                _exit(EXIT_SUCCESS);
+            }
+        }
+        _exit(EXIT_SUCCESS);
+    }
+}
+
+/**
+ * @brief Request the bulk body on a download connection.
+ *
+ * @param conn Download connection.
+ */
+static void send_bulk(struct bulk_conn* conn)
+{
+    char request[256];
+    int len;
+
+    len = snprintf(request, sizeof(request),
+                   "GET http://127.0.0.1:%d/bulk HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:%d\r\n"
+                   "\r\n",
+                   bulk_origin_port, bulk_origin_port);
+    conn->got = 0;
+    conn->need = 0;
+    if (write(conn->fd, request, len) != len) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Read what has arrived on a download connection, and request the bulk
+ * body again once it is complete.
+ *
+ * @param conn Download connection.
+ * @param measured Whether to count the bytes read.
+ */
+static void receive_bulk(struct bulk_conn* conn, int measured)
+{
+    static char buf[BENCH_BULK_WRITE];
+    ssize_t n = read(conn->fd, buf, sizeof(buf));
+    char* head_end;
+    char* field;
+    long copy;
+
+    if (n <= 0) {
+        fprintf(stderr, "proxy closed a download\n");
+        exit(EXIT_FAILURE);
+    }
+    if (measured) {
+        conn->bytes += n;
+    }
+    if (conn->need == 0 && conn->got < (long)sizeof(conn->head) - 1) {
+        copy = sizeof(conn->head) - 1 - conn->got;
+        if (copy > n) {
+            copy = n;
+        }
+        memcpy(conn->head + conn->got, buf, copy);
+        conn->head[conn->got + copy] = '\0';
+        head_end = strstr(conn->head, "\r\n\r\n");
+        if (head_end != NULL) {
+            *head_end = '\0';
+            field = strcasestr(conn->head, "\r\nContent-Length:");
+            if (field == NULL) {
+                fprintf(stderr, "download without Content-Length\n");
+                exit(EXIT_FAILURE);
+            }
+            conn->need = head_end + 4 - conn->head +
+                         atol(field + strlen("\r\nContent-Length:"));
+        }
+    }
+    conn->got += n;
+    if (conn->need > 0 && conn->got >= conn->need) {
+        send_bulk(conn);
+    }
+}
+
+/**
+ * @brief Print the throughput of the downloads, and how evenly the
+ * connections shared it.
+ *
+ * @param num_bulk Number of download connections.
+ * @param elapsed Seconds measured.
+ */
+static void report_bulk(int num_bulk, double elapsed)
+{
+    double sum = 0;
+    double sum_sq = 0;
+    double least = 0;
+    double most = 0;
+    double mbps;
+
+    for (int i = 0; i < num_bulk; ++i) {
+        mbps = bulk[i].bytes / elapsed / (1024 * 1024);
+        sum += mbps;
+        sum_sq += mbps * mbps;
+        if (i == 0 || mbps < least) {
+            least = mbps;
+        }
+        if (mbps > most) {
+            most = mbps;
+        }
+    }
+    printf("downloads over %d connections: %.1f MB/s\n"
+           "  per connection min %.1f MB/s, max %.1f MB/s, "
+           "fairness index %.3f\n",
+           num_bulk,
+           sum,
+           least,
+           most,
+           sum_sq > 0 ? sum * sum / (num_bulk * sum_sq) : 0);
+}
+
+/**
+ * @brief Send the next request on a connection.
+ *
+ * @param conn Connection.
+ * @param url Index of the URL.
+ */
+static void send_request(struct conn* conn, int url)
+{
+    char request[256];
+    int len;
+
+    len = snprintf(request, sizeof(request),
+                   "GET http://127.0.0.1:%d/u%d HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:%d\r\n"
+                   "\r\n",
+                   origin_port, url, origin_port);
+    conn->len = 0;
+    conn->need = 0;
+    conn->sent_us = now_us();
+    if (write(conn->fd, request, len) != len) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Read what has arrived on a connection.
+ *
+ * @param conn Connection.
+ * @return int 1 if the response is complete; 0 if not yet; exits if the proxy
+ * closed the connection.
+ */
+static int receive(struct conn* conn)
+{
+    ssize_t n = read(conn->fd, conn->buf + conn->len,
+                     sizeof(conn->buf) - conn->len);
+    char* head_end;
+    char* field;
+
+    if (n <= 0) {
+        fprintf(stderr, "proxy closed a connection\n");
+        exit(EXIT_FAILURE);
+    }
+    conn->len += n;
+    if (conn->need == 0) {
+        head_end = memmem(conn->buf, conn->len, "\r\n\r\n", 4);
+        if (head_end == NULL) {
+            return 0;
+        }
+        *head_end = '\0';
+        field = strcasestr(conn->buf, "\r\nContent-Length:");
+        *head_end = '\r';
+        if (field == NULL) {
+            fprintf(stderr, "response without Content-Length\n");
+            exit(EXIT_FAILURE);
+        }
+        conn->need = head_end + 4 - conn->buf +
+                     atoi(field + strlen("\r\nContent-Length:"));
+    }
+    return conn->len >= conn->need;
+}
+
+/**
+ * @brief Close a connection over the link, with both of its ends, and drop
+ * what it has not delivered.
+ *
+ * @param fds Poll entries of the link; the connection has 2 * i + 1 and
+ * 2 * i + 2.
+ * @param queues Chunks to deliver, by the poll entry they were read from.
+ * @param i Index of the connection.
+ */
+static void close_link(struct pollfd* fds, struct link_chunk** queues, int i)
+{
+    struct link_chunk* chunk;
+
+    for (int end = 2 * i + 1; end <= 2 * i + 2; ++end) {
+        while (queues[end] != NULL) {
+            chunk = queues[end];
+            queues[end] = chunk->next;
+            free(chunk);
+        }
+        close(fds[end].fd);
+        fds[end].fd = -1;
+    }
+}
+
+/**
+ * @brief Serve a link to the proxy in a child process, which emulates a
+ * network path: it forwards each connection to the proxy, and delivers what
+ * either end writes half of a round trip time later.
+ *
+ * @param port Port of the proxy.
+ * @param rtt_us Round trip time in microseconds.
+ * @param out_port Output; port of the link.
+ * @return pid_t Process of the link.
+ */
+static pid_t start_link(int port, long rtt_us, int* out_port)
+{
+    struct pollfd fds[2 * BENCH_MAX_LINKS + 1];
+    struct link_chunk* queues[2 * BENCH_MAX_LINKS + 1];
+    struct link_chunk* chunk;
+    int listen_fd = listen_loopback(out_port);
+    int one = 1;
+    long now;
+    long timeout_us;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        close(listen_fd);
+        return pid;
+    }
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    for (int i = 1; i <= 2 * BENCH_MAX_LINKS; ++i) {
+        fds[i].fd = -1;
+        fds[i].events = POLLIN;
+        queues[i] = NULL;
+    }
+    while (1) {
+        /* Wake up for the first chunk due. */
+        now = now_us();
+        timeout_us = -1;
+        for (int i = 1; i <= 2 * BENCH_MAX_LINKS; ++i) {
+            if (queues[i] != NULL &&
+                (timeout_us < 0 || queues[i]->due_us - now < timeout_us)) {
+                timeout_us = queues[i]->due_us - now > 0 ?
+                             queues[i]->due_us - now : 0;
+            }
+        }
+        if (poll(fds,
+                 2 * BENCH_MAX_LINKS + 1,
+                 timeout_us < 0 ? -1 : (timeout_us + 999) / 1000) < 0) {
+            break;
+        }
+        now = now_us();
+
+        /* Take a new connection and connect it to the proxy. */
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listen_fd, NULL, NULL);
+            int i = 0;
+
+            while (i < BENCH_MAX_LINKS && fds[2 * i + 1].fd >= 0) {
+                i++;
+            }
+            if (client >= 0 && i < BENCH_MAX_LINKS) {
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one,
+                           sizeof(one));
+                fds[2 * i + 1].fd = client;
+                fds[2 * i + 2].fd = connect_loopback(port);
+                fds[2 * i + 1].events = POLLIN;
+                fds[2 * i + 2].events = POLLIN;
+                if (fds[2 * i + 2].fd < 0) {
+                    close_link(fds, queues, i);
+                }
+            }
+            else if (client >= 0) {
+                close(client);
+            }
+        }
+
+        /* Queue what arrived, and the end of a stream. */
+        for (int i = 1; i <= 2 * BENCH_MAX_LINKS; ++i) {
+            struct link_chunk** tail = &queues[i];
+
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            chunk = malloc(sizeof(struct link_chunk));
+            if (chunk == NULL) {
+                perror("malloc");
+                _exit(EXIT_FAILURE);
+            }
+            chunk->len = read(fds[i].fd, chunk->data, sizeof(chunk->data));
+            if (chunk->len <= 0) {
+                chunk->len = 0;
+                fds[i].events = 0;
+            }
+            chunk->due_us = now + rtt_us / 2;
+            chunk->next = NULL;
+            while (*tail != NULL) {
+                tail = &(*tail)->next;
+            }
+            *tail = chunk;
+        }
+
+        /* Deliver what is due to the other end. */
+        for (int i = 1; i <= 2 * BENCH_MAX_LINKS; ++i) {
+            int peer = i % 2 == 1 ? i + 1 : i - 1;
+
+            while (fds[i].fd >= 0 && queues[i] != NULL &&
+                   queues[i]->due_us <= now) {
+                chunk = queues[i];
+                if (chunk->len == 0 ||
+                    write(fds[peer].fd, chunk->data, chunk->len) !=
+                    chunk->len) {
+                    close_link(fds, queues, (i - 1) / 2);
+                    break;
+                }
+                queues[i] = chunk->next;
+                free(chunk);
+            }
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Keep the latest ticket the proxy issues, for the next connection.
+ *
+ * @param ssl Connection that got it.
+ * @param session Session of the ticket.
+ * @return int 1, to own the session.
+ */
+static int keep_session(SSL* ssl, SSL_SESSION* session)
+{
+    (void)ssl;
+    SSL_SESSION_free(next_session);
+    next_session = session;
+    return 1;
+}
+
+/**
+ * @brief Send one GET request through the proxy on a new connection over the
+ * link: a CONNECT request, then a TLS session resumed from the latest ticket,
+ * with the request in early data if the ticket allows it.
+ *
+ * @param ctx TLS client context, which keeps tickets with keep_session().
+ * @param port Port of the link.
+ * @param out_early Output; 1 if the proxy took the early data; 0 otherwise.
+ * @return long Time from the ClientHello to the whole response in
+ * microseconds; exits on failure.
+ */
+static long resume_request(SSL_CTX* ctx, int port, int* out_early)
+{
+    char request[256];
+    char buf[BENCH_BUF_SIZE];
+    SSL_SESSION* session = next_session;
+    SSL* ssl = NULL;
+    int fd = connect_loopback(port);
+    int len = 0;
+    int need = 0;
+    int request_len;
+    long start_us;
+    size_t written;
+    int n;
+
+    if (fd < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    len = snprintf(request, sizeof(request),
+                   "CONNECT 127.0.0.1:%d HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:%d\r\n"
+                   "\r\n",
+                   tls_origin_port, tls_origin_port);
+    if (write(fd, request, len) != len) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+    len = 0;
+    while (memmem(buf, len, "\r\n\r\n", 4) == NULL) {
+        n = read(fd, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            fprintf(stderr, "proxy closed a CONNECT request\n");
+            exit(EXIT_FAILURE);
+        }
+        len += n;
+    }
+    if (strncmp(buf, "HTTP/1.1 200", 12) != 0) {
+        fprintf(stderr, "proxy refused a CONNECT request\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Take the ticket of this session; the next one comes with it. */
+    request_len = snprintf(request, sizeof(request),
+                           "GET /u0 HTTP/1.1\r\n"
+                           "Host: 127.0.0.1:%d\r\n"
+                           "\r\n",
+                           tls_origin_port);
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_clear_mode(ssl, SSL_MODE_AUTO_RETRY);
+    next_session = NULL;
+    if (session != NULL) {
+        SSL_set_session(ssl, session);
+    }
+    start_us = now_us();
+    *out_early = 0;
+    if (session != NULL &&
+        SSL_SESSION_get_max_early_data(session) >= (uint32_t)request_len) {
+        if (SSL_write_early_data(ssl, request, request_len, &written) != 1) {
+            ERR_print_errors_fp(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (SSL_connect(ssl) != 1) {
+        ERR_print_errors_fp(stderr);
+        fprintf(stderr, "handshake with the proxy failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED) {
+        *out_early = 1;
+    }
+    else if (SSL_write(ssl, request, request_len) != request_len) {
+        ERR_print_errors_fp(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Read the response, then wait for the ticket of the next request. */
+    len = 0;
+    while (need == 0 || len < need) {
+        n = SSL_read(ssl, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            if (SSL_get_error(ssl, n) == SSL_ERROR_WANT_READ) {
+                continue;
+            }
+            fprintf(stderr, "proxy closed a connection\n");
+            exit(EXIT_FAILURE);
+        }
+        len += n;
+        if (need == 0 && memmem(buf, len, "\r\n\r\n", 4) != NULL) {
+            char* field = strcasestr(buf, "\r\nContent-Length:");
+
+            if (field == NULL) {
+                fprintf(stderr, "response without Content-Length\n");
+                exit(EXIT_FAILURE);
+            }
+            need = (char*)memmem(buf, len, "\r\n\r\n", 4) + 4 - buf +
+                   atoi(field + strlen("\r\nContent-Length:"));
+        }
+    }
+    start_us = now_us() - start_us;
+    while (next_session == NULL) {
+        n = SSL_read(ssl, buf, sizeof(buf));
+        if (n <= 0 && SSL_get_error(ssl, n) != SSL_ERROR_WANT_READ) {
+            fprintf(stderr, "proxy sent no ticket\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    SSL_SESSION_free(session);
+    close(fd);
+    return start_us;
+}
+
+/**
+ * @brief Time GET requests that resume TLS sessions over the link.
+ *
+ * @param port Port of the link.
+ * @param requests Number of requests.
+ */
+static void bench_resume(int port, long requests)
+{
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    long* times = malloc(sizeof(long) * requests);
+    long measured = 0;
+    long num_early = 0;
+    int early;
+
+    if (ctx == NULL || times == NULL) {
+        fprintf(stderr, "fail to start TLS clients\n");
+        exit(EXIT_FAILURE);
+    }
+    SSL_CTX_set_session_cache_mode(ctx,
+                                   SSL_SESS_CACHE_CLIENT |
+                                   SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, keep_session);
+    for (long i = 0; i < requests; ++i) {
+        long time_us = resume_request(ctx, port, &early);
+
+        if (i >= BENCH_RTT_WARMUP) {
+            times[measured++] = time_us;
+            num_early += early;
+        }
+    }
+    if (measured > 0) {
+        qsort(times, measured, sizeof(long), compare_long);
+        printf("%ld requests over resumed TLS sessions, %ld in early data\n"
+               "  time from ClientHello to response p50 %ld us, p99 %ld us\n",
+               measured,
+               num_early,
+               times[measured / 2],
+               times[measured * 99 / 100]);
+    }
+    SSL_SESSION_free(next_session);
+    next_session = NULL;
+    SSL_CTX_free(ctx);
+    free(times);
+}
+
+/**
+ * @brief Serve the page origin in a child process. A request for /page waits
+ * <delay_us>, then gets the page; other requests get the cacheable response.
+ * Each connection is served by a process of its own, so a page that waits
+ * does not hold back the others.
+ *
+ * @param delay_us Time the origin takes to answer the page in microseconds.
+ * @return pid_t Process of the origin.
+ */
+static pid_t start_page_origin(long delay_us)
+{
+    int listen_fd = listen_loopback(&origin_port);
+    char buf[BENCH_BUF_SIZE];
+    int len;
+    int n;
+    int fd;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        close(listen_fd);
+        return pid;
+    }
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGCHLD, SIG_IGN);
+    while (1) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        if (fork() != 0) {
+            close(fd);
+            continue;
+        }
+        len = 0;
+        while (memmem(buf, len, "\r\n\r\n", 4) == NULL &&
+               len < (int)sizeof(buf)) {
+            n = read(fd, buf + len, sizeof(buf) - len);
+            if (n <= 0) {
+                _exit(EXIT_SUCCESS);
+            }
+            len += n;
+        }
+        if (memmem(buf, len, "/page ", 6) != NULL) {
+            usleep(delay_us);
+            len = make_page(buf);
+        }
+        else {
+            len = make_response(buf);
+        }
+        if (write(fd, buf, len) != len) {
+            perror("origin write");
+        }
+        _exit(EXIT_SUCCESS);
+    }
+}
+
+/**
+ * @brief Request each subresource a head of the page links, unless it is
+ * requested already.
+ *
+ * @param head Head of the page or of a 103 response.
+ * @param head_len Byte size of head.
+ * @param subs Connections of the subresources; -1 FDs for those not
+ * requested.
+ * @param port Port of the proxy or the link.
+ */
+static void request_links(const char* head,
+                          int head_len,
+                          struct conn* subs,
+                          int port)
+{
+    const char* end = head + head_len;
+    const char* p = head;
+    int i;
+
+    while ((p = memmem(p, end - p, "</u", 3)) != NULL) {
+        p += 3;
+        i = atoi(p);
+        if (i < 0 || i >= BENCH_SUBRESOURCES || subs[i].fd >= 0) {
+            continue;
+        }
+        subs[i].fd = connect_loopback(port);
+        if (subs[i].fd < 0) {
+            perror("connect");
+            exit(EXIT_FAILURE);
+        }
+        send_request(&subs[i], i);
+    }
+}
+
+/**
+ * @brief Load the page and its subresources, as a browser would.
+ *
+ * @param port Port of the proxy or the link.
+ * @param out_hinted Output; 1 if the page had a 103 response; 0 otherwise.
+ * @return long Page load time in microseconds; exits on failure.
+ */
+static long load_page(int port, int* out_hinted)
+{
+    static struct conn page; /* Connection of the page. */
+    static struct conn subs[BENCH_SUBRESOURCES]; /* Connection of each
+                                                  * subresource. */
+    struct pollfd fds[BENCH_SUBRESOURCES + 1];
+    int received[BENCH_SUBRESOURCES] = {0};
+    char request[256];
+    char* head_end;
+    char* field;
+    int head_len;
+    int page_done = 0;
+    int done = 0;
+    long start_us = now_us();
+    int len;
+    int n;
+
+    *out_hinted = 0;
+    for (int i = 0; i < BENCH_SUBRESOURCES; ++i) {
+        subs[i].fd = -1;
+    }
+    page.fd = connect_loopback(port);
+    page.len = 0;
+    page.need = 0;
+    len = snprintf(request, sizeof(request),
+                   "GET http://127.0.0.1:%d/page HTTP/1.1\r\n"
+                   "Host: 127.0.0.1:%d\r\n"
+                   "\r\n",
+                   origin_port, origin_port);
+    if (page.fd < 0 || write(page.fd, request, len) != len) {
+        perror("page request");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!page_done || done < BENCH_SUBRESOURCES) {
+        fds[0].fd = page_done ? -1 : page.fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < BENCH_SUBRESOURCES; ++i) {
+            fds[i + 1].fd = received[i] ? -1 : subs[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, BENCH_SUBRESOURCES + 1, 10000) <= 0) {
+            fprintf(stderr, "proxy does not respond\n");
+            exit(EXIT_FAILURE);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            n = read(page.fd, page.buf + page.len,
+                     sizeof(page.buf) - page.len);
+            if (n <= 0) {
+                fprintf(stderr, "proxy closed a connection\n");
+                exit(EXIT_FAILURE);
+            }
+            page.len += n;
+
+            /* Interim responses come first, and each head may link
+             * subresources. */
+            while (page.need == 0 &&
+                   (head_end = memmem(page.buf, page.len, "\r\n\r\n", 4))
+                   != NULL) {
+                head_len = head_end + 4 - page.buf;
+                request_links(page.buf, head_len, subs, port);
+                if (strncmp(page.buf, "HTTP/1.1 1", 10) == 0) {
+                    *out_hinted = 1;
+                    page.len -= head_len;
+                    memmove(page.buf, page.buf + head_len, page.len);
+                    continue;
+                }
+                *head_end = '\0';
+                field = strcasestr(page.buf, "\r\nContent-Length:");
+                *head_end = '\r';
+                if (field == NULL) {
+                    fprintf(stderr, "response without Content-Length\n");
+                    exit(EXIT_FAILURE);
+                }
+                page.need = head_len +
+                            atoi(field + strlen("\r\nContent-Length:"));
+            }
+            page_done = page.need > 0 && page.len >= page.need;
+        }
+        for (int i = 0; i < BENCH_SUBRESOURCES; ++i) {
+            if (fds[i + 1].fd >= 0 &&
+                (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                receive(&subs[i])) {
+                received[i] = 1;
+                done++;
+            }
+        }
+    }
+    start_us = now_us() - start_us;
+    close(page.fd);
+    for (int i = 0; i < BENCH_SUBRESOURCES; ++i) {
+        close(subs[i].fd);
+    }
+    return start_us;
+}
+
+/**
+ * @brief Time page loads, one at a time.
+ *
+ * @param port Port of the proxy or the link.
+ * @param loads Number of page loads.
+ */
+static void bench_pages(int port, long loads)
+{
+    long* times = malloc(sizeof(long) * loads);
+    long measured = 0;
+    long num_hinted = 0;
+    int hinted;
+
+    if (times == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < loads; ++i) {
+        long time_us = load_page(port, &hinted);
+
+        if (i >= BENCH_PAGE_WARMUP) {
+            times[measured++] = time_us;
+            num_hinted += hinted;
+        }
+    }
+    qsort(times, measured, sizeof(long), compare_long);
+    printf("%ld loads of a page with %d subresources, %ld with early hints\n"
+           "  page load time p50 %ld us, p99 %ld us\n",
+           measured,
+           BENCH_SUBRESOURCES,
+           num_hinted,
+           times[measured / 2],
+           times[measured * 99 / 100]);
+    free(times);
+}
+
+/**
+ * @brief Start the proxy with its log discarded, and wait until it accepts
+ * connections.
+ *
+ * @param argv Proxy command and its arguments.
+ * @param port Port of the proxy.
+ * @return pid_t Process of the proxy.
+ */
+static pid_t start_proxy(char** argv, int port)
+{
+    pid_t pid = fork();
+    int fd;
+
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < BENCH_START_TRIES; ++i) {
+        fd = connect_loopback(port);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        usleep(50000);
+    }
+    fprintf(stderr, "proxy does not accept connections\n");
+    kill(pid, SIGINT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    struct pollfd fds[BENCH_MAX_CONNS + BENCH_MAX_STORM + BENCH_MAX_BULK + 1];
+    int port = 0;
+    int num_conns = 64;
+    long requests = 100000;
+    int num_urls = 64;
+    int num_storm = 0;
+    int num_bulk = 0;
+    int bulk_base;
+    long warmup;
+    long* latencies;
+    long sent = 0;
+    long done = 0;
+    long measured = 0;
+    long start_us = 0;
+    double elapsed;
+    pid_t proxy = -1;
+    pid_t tls_origin = -1;
+    pid_t bulk_origin = -1;
+    pid_t link = -1;
+    int link_port;
+    long rtt_ms = 0;
+    long page_delay_ms = 0;
+    pid_t page_origin;
+    struct rusage usage;
+    double cpu_us;
+    int origin;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:n:u:s:r:l:b:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            num_conns = atoi(optarg);
+            break;
+        case 'n':
+            requests = atol(optarg);
+            break;
+        case 'u':
+            num_urls = atoi(optarg);
+            break;
+        case 's':
+            num_storm = atoi(optarg);
+            break;
+        case 'r':
+            rtt_ms = atol(optarg);
+            if (rtt_ms <= 0) {
+                port = 0;
+            }
+            break;
+        case 'l':
+            page_delay_ms = atol(optarg);
+            if (page_delay_ms <= 0) {
+                port = 0;
+            }
+            break;
+        case 'b':
+            num_bulk = atoi(optarg);
+            break;
+        default:
+            port = 0;
+            break;
+        }
+    }
+    if (port <= 0 || num_conns < 0 || num_conns > BENCH_MAX_CONNS ||
+        (rtt_ms == 0 && page_delay_ms == 0 && requests < num_conns) ||
+        num_urls <= 0 || num_storm < 0 || num_storm > BENCH_MAX_STORM ||
+        num_bulk < 0 || num_bulk > BENCH_MAX_BULK ||
+        (rtt_ms == 0 && page_delay_ms == 0 && num_conns == 0 &&
+         num_storm == 0) ||
+        (rtt_ms > 0 && requests <= BENCH_RTT_WARMUP) ||
+        (page_delay_ms > 0 && requests <= BENCH_PAGE_WARMUP)) {
+        fprintf(stderr,
+                "usage: %s -p <port> [-c <conns>] [-n <requests>] "
+                "[-u <urls>] [-s <storm_conns>] [-r <rtt_ms>] "
+                "[-l <delay_ms>] [-b <bulk_conns>] "
+                "[-- <proxy command>...]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (page_delay_ms > 0) {
+        /* Page loads, one at a time, over the link if there is one. */
+        page_origin = start_page_origin(page_delay_ms * 1000);
+        if (optind < argc) {
+            proxy = start_proxy(argv + optind, port);
+        }
+        if (rtt_ms > 0) {
+            link = start_link(port, rtt_ms * 1000, &link_port);
+        }
+        bench_pages(rtt_ms > 0 ? link_port : port, requests);
+        if (link > 0) {
+            kill(link, SIGTERM);
+            waitpid(link, NULL, 0);
+        }
+        if (proxy > 0) {
+            kill(proxy, SIGINT);
+            waitpid(proxy, NULL, 0);
+        }
+        kill(page_origin, SIGTERM);
+        waitpid(page_origin, NULL, 0);
+        return EXIT_SUCCESS;
+    }
+    if (rtt_ms > 0) {
+        /* Requests over the link, one at a time. */
+        tls_origin = start_tls_origin();
+        if (optind < argc) {
+            proxy = start_proxy(argv + optind, port);
+        }
+        link = start_link(port, rtt_ms * 1000, &link_port);
+        bench_resume(link_port, requests);
+        kill(link, SIGTERM);
+        waitpid(link, NULL, 0);
+        if (proxy > 0) {
+            kill(proxy, SIGINT);
+            waitpid(proxy, NULL, 0);
+        }
+        kill(tls_origin, SIGTERM);
+        waitpid(tls_origin, NULL, 0);
+        return EXIT_SUCCESS;
+    }
+    origin = listen_loopback(&origin_port);
+    if (num_storm > 0) {
+        tls_origin = start_tls_origin();
+        storm_ctx = SSL_CTX_new(TLS_client_method());
+        if (storm_ctx == NULL) {
+            ERR_print_errors_fp(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (num_bulk > 0) {
+        bulk_origin = start_bulk_origin();
+    }
+    if (optind < argc) {
+        proxy = start_proxy(argv + optind, port);
+    }
+    warmup = requests / 10;
+    latencies = malloc(sizeof(long) * requests);
+    if (latencies == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < num_conns; ++i) {
+        conns[i].fd = connect_loopback(port);
+        if (conns[i].fd < 0) {
+            perror("connect");
+            return EXIT_FAILURE;
+        }
+        fds[i].fd = conns[i].fd;
+        fds[i].events = POLLIN;
+    }
+    for (int i = 0; i < num_conns; ++i) {
+        send_request(&conns[i], sent++ % num_urls);
+    }
+    fds[num_conns].fd = origin;
+    fds[num_conns].events = POLLIN;
+    for (int i = 0; i < num_storm; ++i) {
+        start_handshake(&storm[i], port);
+        fds[num_conns + 1 + i].fd = storm[i].fd;
+        fds[num_conns + 1 + i].events = POLLIN;
+    }
+    bulk_base = num_conns + 1 + num_storm;
+    for (int i = 0; i < num_bulk; ++i) {
+        bulk[i].fd = connect_loopback(port);
+        if (bulk[i].fd < 0) {
+            perror("connect");
+            return EXIT_FAILURE;
+        }
+        bulk[i].bytes = 0;
+        send_bulk(&bulk[i]);
+        fds[bulk_base + i].fd = bulk[i].fd;
+        fds[bulk_base + i].events = POLLIN;
+    }
+
+    while (done < requests) {
+        if (poll(fds, bulk_base + num_bulk, 10000) <= 0) {
+            fprintf(stderr, "proxy does not respond\n");
+            return EXIT_FAILURE;
+        }
+        if (fds[num_conns].revents & POLLIN) {
+            serve_origin(origin);
+        }
+        for (int i = 0; i < num_storm; ++i) {
+            if (!(fds[num_conns + 1 + i].revents &
+                  (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            /* Without cache hits, handshakes count as the requests. */
+            if (step_handshake(&storm[i], port, done > warmup) &&
+                num_conns == 0 && done++ == warmup) {
+                start_us = now_us();
+            }
+            fds[num_conns + 1 + i].fd = storm[i].fd;
+        }
+        for (int i = 0; i < num_bulk; ++i) {
+            if (fds[bulk_base + i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                receive_bulk(&bulk[i], done > warmup);
+            }
+        }
+        for (int i = 0; i < num_conns; ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) ||
+                !receive(&conns[i])) {
+                continue;
+            }
+            if (done++ == warmup) {
+                start_us = now_us();
+            }
+            if (done > warmup) {
+                latencies[measured++] = now_us() - conns[i].sent_us;
+            }
+            if (sent < requests) {
+                send_request(&conns[i], sent++ % num_urls);
+            }
+        }
+    }
+    elapsed = (now_us() - start_us) / 1e6;
+
+    if (measured > 0) {
+        qsort(latencies, measured, sizeof(long), compare_long);
+        printf("%ld requests over %d connections: %.0f requests/sec\n"
+               "  response time p50 %ld us, p99 %ld us, p99.9 %ld us, "
+               "max %ld us\n",
+               measured,
+               num_conns,
+               measured / elapsed,
+               latencies[measured / 2],
+               latencies[measured * 99 / 100],
+               latencies[measured * 999 / 1000],
+               latencies[measured - 1]);
+    }
+    if (num_storm > 0 && num_handshakes > 0) {
+        qsort(handshakes, num_handshakes, sizeof(long), compare_long);
+        printf("%ld handshakes over %d connections: %.0f handshakes/sec\n"
+               "  handshake time p50 %ld us, p99 %ld us\n",
+               num_handshakes,
+               num_storm,
+               num_handshakes / elapsed,
+               handshakes[num_handshakes / 2],
+               handshakes[num_handshakes * 99 / 100]);
+    }
+    if (num_bulk > 0) {
+        report_bulk(num_bulk, elapsed);
+    }
+
+    for (int i = 0; i < num_conns; ++i) {
+        close(conns[i].fd);
+    }
+    close(origin);
+    free(latencies);
+    for (int i = 0; i < num_storm; ++i) {
+        SSL_free(storm[i].ssl);
+        close(storm[i].fd);
+    }
+    SSL_CTX_free(storm_ctx);
+    for (int i = 0; i < num_bulk; ++i) {
+        close(bulk[i].fd);
+    }
+    if (proxy > 0) {
+        kill(proxy, SIGINT);
+        if (wait4(proxy, NULL, 0, &usage) == proxy) {
+            cpu_us = usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec +
+                     usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+            if (num_conns == 0) {
+                printf("  proxy CPU time %.0f us per handshake\n",
+                       cpu_us / done);
+            }
+            else {
+                printf("  proxy CPU time %.2f s\n", cpu_us / 1e6);
+            }
+        }
+    }
+    if (tls_origin > 0) {
+        kill(tls_origin, SIGTERM);
+        waitpid(tls_origin, NULL, 0);
+    }
+    if (bulk_origin > 0) {
+        kill(bulk_origin, SIGTERM);
+        waitpid(bulk_origin, NULL, 0);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+/**************************************************************
+*
+*                       bench_plugin.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Micro benchmark for the overhead of plugin hooks.
+*
+*     Usage: ./bench_plugin [calls]
+*     where [calls] is the number of calls of each stage,
+*     10000000 by default. It reports ns/call of each stage
+*     as the proxy runs it: without plugins, with a plugin
+*     whose hooks only return, and with one whose hooks
+*     replace their input with a copy, or scan body bytes.
+*
+**************************************************************/
+
+#include "plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char request[] = "GET http://example.com/index.html HTTP/1.1\r\n"
+                              "Host: example.com\r\n"
+                              "User-Agent: bench_plugin\r\n"
+                              "Accept: */*\r\n";
+static const char key[] = "example.com/index.html";
+static const char host[] = "example.com";
+static const char response[] = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/html\r\n"
+                               "Content-Length: 4096\r\n";
+static char body[4096]; /* Body bytes of each body_chunk call. */
+
+/**
+ * @brief Get monotonic time in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Hook of request heads and cache lookups that only returns.
+ */
+static int noop_view(const struct plugin_ctx* ctx,
+                     struct plugin_view in,
+                     struct plugin_view* out)
+{
+    (void)ctx;
+    (void)in;
+    (void)out;
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Hook of servers that only returns.
+ */
+static int noop_upstream(const struct plugin_ctx* ctx,
+                         struct plugin_view in,
+                         int* port,
+                         struct plugin_view* out)
+{
+    (void)ctx;
+    (void)in;
+    (void)port;
+    (void)out;
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Hook of response heads that only returns.
+ */
+static int noop_response(const struct plugin_ctx* ctx,
+                         int status,
+                         struct plugin_view in,
+                         struct plugin_view* out)
+{
+    (void)status;
+    return noop_view(ctx, in, out);
+}
+
+/**
+ * @brief Hook of body bytes that only returns.
+ */
+static int noop_body(const struct plugin_ctx* ctx, struct plugin_view chunk)
+{
+    (void)ctx;
+    (void)chunk;
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Hook of request heads and cache lookups that replaces its input with
+ * a copy from the arena.
+ */
+static int copy_view(const struct plugin_ctx* ctx,
+                     struct plugin_view in,
+                     struct plugin_view* out)
+{
+    char* buf = plugin_alloc(ctx->arena, in.len);
+
+    if (buf == NULL) {
+        return PLUGIN_CONTINUE;
+    }
+    memcpy(buf, in.data, in.len);
+    out->data = buf;
+    out->len = in.len;
+    return PLUGIN_REPLACE;
+}
+
+/**
+ * @brief Hook of servers that replaces the host with a copy.
+ */
+static int copy_upstream(const struct plugin_ctx* ctx,
+                         struct plugin_view in,
+                         int* port,
+                         struct plugin_view* out)
+{
+    (void)port;
+    return copy_view(ctx, in, out);
+}
+
+/**
+ * @brief Hook of response heads that replaces the head with a copy.
+ */
+static int copy_response(const struct plugin_ctx* ctx,
+                         int status,
+                         struct plugin_view in,
+                         struct plugin_view* out)
+{
+    (void)status;
+    return copy_view(ctx, in, out);
+}
+
+/**
+ * @brief Hook of body bytes that scans them for a null byte.
+ */
+static int scan_body(const struct plugin_ctx* ctx, struct plugin_view chunk)
+{
+    (void)ctx;
+    if (memchr(chunk.data, '\0', chunk.len) != NULL) {
+        return PLUGIN_CLOSE;
+    }
+    return PLUGIN_CONTINUE;
+}
+
+static const struct plugin_desc noop_plugin = {
+    PLUGIN_ABI_VERSION, "noop", NULL, NULL,
+    noop_view, noop_view, noop_upstream, noop_response, noop_body,
+};
+
+static const struct plugin_desc copy_plugin = {
+    PLUGIN_ABI_VERSION, "copy", NULL, NULL,
+    copy_view, copy_view, copy_upstream, copy_response, scan_body,
+};
+
+/**
+ * @brief Run a stage as the proxy does, behind PLUGIN_HOOKED.
+ *
+ * @param stage enum plugin_stage.
+ * @return int Verdict; PLUGIN_CONTINUE without hooks.
+ */
+static int run_stage(int stage)
+{
+    struct plugin_view view;
+    struct plugin_view out;
+    int port = 80;
+
+    if (!PLUGIN_HOOKED(stage)) {
+        return PLUGIN_CONTINUE;
+    }
+    switch (stage) {
+    case PLUGIN_REQUEST_HEAD:
+        view.data = request;
+        view.len = sizeof(request) - 1;
+        return plugin_request_head(5, view, &out);
+    case PLUGIN_CACHE_LOOKUP:
+        view.data = key;
+        view.len = sizeof(key) - 1;
+        return plugin_cache_lookup(5, view, &out);
+    case PLUGIN_UPSTREAM_SELECT:
+        view.data = host;
+        view.len = sizeof(host) - 1;
+        return plugin_upstream_select(5, view, &port, &out);
+    case PLUGIN_RESPONSE_HEAD:
+        view.data = response;
+        view.len = sizeof(response) - 1;
+        return plugin_response_head(5, 200, view, &out);
+    default:
+        view.data = body;
+        view.len = sizeof(body);
+        return plugin_body_chunk(5, view);
+    }
+}
+
+/**
+ * @brief Time the calls of each stage.
+ *
+ * @param calls Number of calls of each stage.
+ * @param replaces Whether the hooks replace their input.
+ * @param out_ns Output; ns/call of each stage.
+ */
+static void bench_stages(int calls, int replaces, double* out_ns)
+{
+    double start;
+    int expected;
+
+    for (int stage = 0; stage < PLUGIN_NUM_STAGES; ++stage) {
+        expected = replaces && stage != PLUGIN_BODY_CHUNK ? PLUGIN_REPLACE :
+                   PLUGIN_CONTINUE;
+        start = now_sec();
+        for (int i = 0; i < calls; ++i) {
+            if (run_stage(stage) != expected) {
+                fprintf(stderr, "unexpected verdict of stage %d\n", stage);
+                exit(EXIT_FAILURE);
+            }
+        }
+        out_ns[stage] = (now_sec() - start) * 1e9 / calls;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const char* names[PLUGIN_NUM_STAGES] = {
+        "request_head", "cache_lookup", "upstream_select", "response_head",
+        "body_chunk",
+    };
+    double none_ns[PLUGIN_NUM_STAGES];
+    double noop_ns[PLUGIN_NUM_STAGES];
+    double copy_ns[PLUGIN_NUM_STAGES];
+    int calls = 10000000;
+
+    if (argc == 2) {
+        calls = atoi(argv[1]);
+    }
+    if (argc > 2 || calls <= 0) {
+        fprintf(stderr, "usage: %s [calls]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    memset(body, 'x', sizeof(body));
+
+    bench_stages(calls, 0, none_ns);
+    if (plugin_register(&noop_plugin, NULL) < 0) {
+        fprintf(stderr, "fail to register plugin\n");
+        return EXIT_FAILURE;
+    }
+    bench_stages(calls, 0, noop_ns);
+    plugin_unload_all();
+    if (plugin_register(&copy_plugin, NULL) < 0) {
+        fprintf(stderr, "fail to register plugin\n");
+        return EXIT_FAILURE;
+    }
+    bench_stages(calls, 1, copy_ns);
+    plugin_unload_all();
+
+    printf("%-16s %12s %12s %12s\n", "ns/call", "none", "noop", "copy");
+    for (int stage = 0; stage < PLUGIN_NUM_STAGES; ++stage) {
+        printf("%-16s %12.1f %12.1f %12.1f\n",
+               names[stage],
+               none_ns[stage],
+               noop_ns[stage],
+               copy_ns[stage]);
+    }
+    return EXIT_SUCCESS;
+}
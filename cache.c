@@ -7,71 +7,224 @@
 *     Date: 2021-11-11
 *
 *     Summary:
-*     Implementation for fixed size LRU cache.
+*     Implementation for fixed size LRU/CLOCK cache backed by a
+*     slab arena.
+*
+*     Each element, with its key and value, lives in a single
+*     chunk of the slab arena. Elements are linked in a global
+*     LRU list and in an LRU list of their size class, so that
+*     a class that runs out of chunks evicts within itself.
+*
+*     With the LRU policy, a hit moves the element to the
+*     front of the lists. With the CLOCK policy, a hit only
+*     sets a reference bit in the index entry, and eviction
+*     gives referenced elements at the back a second chance.
+*
+*     Elements are found through a compact open addressing
+*     index. Each 16-byte entry holds a 64-bit fingerprint of
+*     the key packed with the size class, the expiry time and
+*     the location of the element in the arena. Four entries
+*     share a 64-byte bucket, so a lookup miss typically
+*     touches one cache line, and the full key in the element
+*     is only read to verify a matching fingerprint.
+*
+*     Elements are also linked in an LRU list of their host,
+*     and each host accounts the bytes it holds. A host above
+*     its byte quota joins an over-quota list, and eviction
+*     takes from such hosts before anyone else, so one chatty
+*     origin cannot push every other host out of the cache.
+*
+*     The byte budget of the arena can be lowered at run time,
+*     e.g. under memory pressure. Elements are then evicted in
+*     bounded batches until the pages in use fit the budget,
+*     and free pages are handed back to the kernel.
 *
 **************************************************************/
 
 #include "cache.h"
 #include "logger.h"
+#include "netio.h"
+#include "slab.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 struct cache_elem {
     char* key;
     char* val;
     int val_len; /* Byte size of val. */
+    int size; /* Byte size of the chunk requested for this element. */
     time_t creation_time; /* Creation time in seconds. */
     time_t max_age; /* Time-to-live in seconds. */
+    uint64_t hash; /* Hash of key. */
     struct cache_elem* next;
     struct cache_elem* prev;
+    struct cache_elem* class_next; /* Next element in the same size class. */
+    struct cache_elem* class_prev; /* Previous element in the same size
+                                    * class. */
+    struct cache_elem* host_next; /* Next element of the same host. */
+    struct cache_elem* host_prev; /* Previous element of the same host. */
+    int host; /* Index of the host of this element in the host table. */
 };
 typedef struct cache_elem cache_elem;
 
+#define CACHE_MAX_HOSTS 1024 /* Number of slots in the host table; a power of
+                              * 2. */
+#define CACHE_HOST_OTHER 0 /* Slot shared by elements without a host and by
+                            * hosts that do not fit in the table. */
+
+struct cache_host {
+    char name[CACHE_HOST_NAME_LEN]; /* Hostname; empty if the slot is free. */
+    long bytes; /* Sum of chunk sizes of elements of this host. */
+    long quota; /* Bytes above which this host is evicted first; 0 for no
+                 * quota. */
+    int objects; /* Number of elements of this host. */
+    long hits; /* Number of valid elements of this host got. */
+    long misses; /* Number of keys of this host not found or stale. */
+    long evictions; /* Number of valid elements of this host evicted. */
+    struct cache_elem* front; /* Most recently used element of this host. */
+    struct cache_elem* back; /* Least recently used element of this host. */
+    int over_next; /* Next host in the over-quota list; -1 if none. */
+    int over_prev; /* Previous host in the over-quota list; -1 if none. */
+    int is_over; /* 1 if this host is in the over-quota list. */
+    int has_quota; /* 1 if the quota of this host was set explicitly; such a
+                    * host keeps its slot without elements. */
+    int is_removed; /* 1 if the slot was freed; probes go on past it. */
+};
+typedef struct cache_host cache_host;
+
+#define CACHE_BUCKET_SLOTS 4 /* Number of index entries in a bucket. */
+#define CACHE_CLASS_BITS 6 /* Number of low tag bits holding the size class. */
+#define CACHE_CLASS_MASK ((1ULL << CACHE_CLASS_BITS) - 1)
+#define CACHE_TAG_EMPTY 0ULL /* Tag of a never used slot. */
+#define CACHE_TAG_TOMBSTONE 1ULL /* Tag of a slot whose entry is removed. */
+#define CACHE_EXPIRY_MAX 0x7fffffffU /* Largest expiry time. */
+#define CACHE_STALE_SCAN 16 /* Number of elements at the back checked for
+                             * staleness when the cache is full. */
+#define CACHE_ENTRY_REF 0x80000000U /* Bit in expiry set by a hit under the
+                                     * CLOCK policy. */
+
+struct cache_entry {
+    uint64_t tag; /* Key fingerprint in the high 58 bits and size class in the
+                   * low 6 bits; CACHE_TAG_EMPTY or CACHE_TAG_TOMBSTONE if the
+                   * slot is free. */
+    uint32_t loc; /* Location of the element in the arena. */
+    uint32_t expiry; /* Expiry time in seconds since the cache epoch in the
+                      * low 31 bits; CACHE_ENTRY_REF in the high bit. */
+};
+typedef struct cache_entry cache_entry;
+
+struct cache_bucket {
+    cache_entry slots[CACHE_BUCKET_SLOTS];
+} __attribute__((aligned(64)));
+typedef struct cache_bucket cache_bucket;
+
+/**
+ * @brief Hash the given key with 64-bit FNV-1a and a final mix, so that both
+ * low bits (bucket) and high bits (fingerprint) are well distributed.
+ *
+ * @param key Key to hash, non-null.
+ * @return uint64_t Hash of key.
+ */
+uint64_t cache_hash(const char* key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (const unsigned char* p = (const unsigned char*)key; *p != '\0'; ++p) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief Get the fingerprint part of the index tag of a hash.
+ *
+ * @param hash Hash of key.
+ * @return uint64_t Fingerprint that never collides with the free tags.
+ */
+static uint64_t cache_fingerprint(uint64_t hash)
+{
+    uint64_t fp = hash & ~CACHE_CLASS_MASK;
+
+    return fp != 0 ? fp : (1ULL << CACHE_CLASS_BITS);
+}
+
+/**
+ * @brief Get byte size of the chunk holding an element.
+ *
+ * @param key Element key; may be NULL.
+ * @param val_len Byte size of element value.
+ * @return int Byte size of the element header, key and value.
+ */
+static int cache_elem_size(const char* key, const int val_len)
+{
+    int size = sizeof(cache_elem) + val_len;
+
+    if (key != NULL) {
+        size += strlen(key) + 1;
+    }
+    return size;
+}
+
 /**
- * @brief Create a new cache element.
+ * @brief Create a new cache element in the slab arena.
  *
  * @param key Element key.
  * @param val Element value.
  * @param val_len Byte size of element value.
  * @param max_age Time-to-live in seconds.
- * @return cache_elem* Newly created cache element on success; NULL otherwise.
+ * @return cache_elem* Newly created cache element on success; NULL otherwise,
+ * e.g. the size class of the element has no free chunk.
  */
 cache_elem* cache_elem_new(const char* key,
                            const char* val,
                            const int val_len,
                            const time_t max_age)
 {
-    time_t now = time(NULL);
+    time_t now = netio_now();
+    int size = cache_elem_size(key, val != NULL ? val_len : 0);
+    char* data;
 
-    cache_elem* elem = (cache_elem*)malloc(sizeof(cache_elem));
+    cache_elem* elem = (cache_elem*)slab_alloc(size);
     if (elem == NULL) {
-        PLOG_ERROR("malloc");
         return NULL;
     }
-    if (key != NULL) {
-        elem->key = strdup(key);
-    }
-    else {
-        elem->key = NULL;
-    }
+    elem->size = size;
+    data = (char*)(elem + 1); /* Key and value follow the header. */
     if (val != NULL) {
-        elem->val = NULL;
-        elem->val = malloc(val_len);
-        if (elem->val == NULL) {
-            PLOG_ERROR("fail to malloc elem->val");
-            return NULL;
-        }
+        elem->val = data;
         memcpy(elem->val, val, val_len);
         elem->val_len = val_len;
+        data += val_len;
     }
     else {
         elem->val = NULL;
         elem->val_len = 0;
     }
+    if (key != NULL) {
+        elem->key = data;
+        strcpy(elem->key, key);
+    }
+    else {
+        elem->key = NULL;
+    }
     elem->creation_time = now;
     elem->max_age = max_age;
+    elem->hash = key != NULL ? cache_hash(key) : 0;
     elem->prev = NULL;
     elem->next = NULL;
+    elem->class_prev = NULL;
+    elem->class_next = NULL;
+    elem->host_prev = NULL;
+    elem->host_next = NULL;
+    elem->host = CACHE_HOST_OTHER;
     return elem;
 }
 
@@ -85,21 +238,19 @@ void cache_elem_free(cache_elem** elem)
     if (elem == NULL || *elem == NULL) {
         return;
     }
-    free((*elem)->key);
-    free((*elem)->val);
-    free(*elem);
+    slab_free(*elem, (*elem)->size);
     *elem = NULL;
 }
 
 /**
  * @brief Get age of the given cache element in seconds.
- * 
+ *
  * @param elem Cache element.
  * @return time_t Age in seconds.
  */
 time_t cache_elem_age(cache_elem* elem)
 {
-    return time(NULL) - elem->creation_time;
+    return netio_now() - elem->creation_time;
 }
 
 /**
@@ -119,304 +270,1077 @@ struct cache {
     /* Doubly linked list of cache elements. */
     struct cache_elem* front;
     struct cache_elem* back;
+    struct cache_elem dummy_front;
+    struct cache_elem dummy_back;
+    /* Doubly linked list of cache elements of each size class. */
+    struct cache_elem* class_front[SLAB_MAX_CLASSES + 1];
+    struct cache_elem* class_back[SLAB_MAX_CLASSES + 1];
+    long val_bytes; /* Sum of val_len of all elements. */
+    long hits; /* Number of valid elements got. */
+    long misses; /* Number of keys not found or stale. */
+    long evictions; /* Number of valid elements evicted for space. */
+    cache_bucket* index; /* Buckets of the index. */
+    uint32_t index_mask; /* Number of buckets - 1; a power of 2 - 1. */
+    long index_tombstones; /* Number of removed entries in the index. */
+    time_t epoch; /* Time that expiry times in the index count from. */
+    int policy; /* Eviction policy, CACHE_POLICY_LRU or CACHE_POLICY_CLOCK. */
+    cache_host* hosts; /* Host table of CACHE_MAX_HOSTS slots. */
+    int num_hosts; /* Number of used slots in the host table. */
+    long host_quota; /* Default byte quota of each host; 0 for no quota. */
+    int over_front; /* First host in the over-quota list; -1 if empty. */
+    size_t budget_bytes; /* Max bytes of arena pages in use. */
+    time_t stale_grace; /* Seconds stale elements are kept after their max
+                         * age, to serve when their origin fails. */
+    long stale_hits; /* Number of stale elements got. */
 };
 typedef struct cache cache;
 
 cache* the_cache = NULL; /* Global singleton cache. */
 
 /**
- * @brief Initialize an empty cache of the given capacity.
+ * @brief Allocate an empty index that holds the given number of elements at a
+ * load factor of at most 3/4.
  *
- * @param capacity Max size of the cache, > 0.
+ * @param capacity Max number of elements, > 0.
  * @return 0 on success; -1 otherwise.
  */
-int cache_init(int capacity)
+static int cache_index_init(int capacity)
 {
-    cache_elem* dummy_front;
-    cache_elem* dummy_back;
-
-    if (capacity <= 0 || the_cache != NULL) {
-        /* Invalid capacity or the cache has already been initialized. */
-        return -1;
-    }
+    uint64_t min_buckets;
+    uint64_t buckets = 1;
+    void* index = NULL;
 
-    the_cache = (cache*)malloc(sizeof(cache));
-    if (the_cache == NULL) {
-        PLOG_ERROR("malloc");
-        return -1;
+    min_buckets = ((uint64_t)capacity * 4 / 3 + CACHE_BUCKET_SLOTS - 1) /
+                  CACHE_BUCKET_SLOTS;
+    while (buckets < min_buckets) {
+        buckets <<= 1;
     }
-    the_cache->capacity = capacity;
-    the_cache->size = 0;
-
-    /* Create dummy nodes at front and back. Then, the doubly linked list won't
-     * be empty. It facilities insertions and removals. */
-    dummy_front = cache_elem_new(NULL, NULL, 0, 0);
-    if (dummy_front == NULL) {
-        PLOG_ERROR("malloc");
-        free(the_cache);
-        the_cache = NULL;
+    if (buckets > UINT32_MAX) {
+        LOG_ERROR("cache capacity %d is too large", capacity);
         return -1;
     }
-    dummy_back = cache_elem_new(NULL, NULL, 0, 0);
-    if (dummy_back == NULL) {
-        PLOG_ERROR("malloc");
-        free(dummy_front);
-        free(the_cache);
-        the_cache = NULL;
+    if (posix_memalign(&index, sizeof(cache_bucket),
+                       buckets * sizeof(cache_bucket)) != 0) {
+        LOG_ERROR("fail to allocate cache index");
         return -1;
     }
-    dummy_front->prev = NULL;
-    dummy_front->next = dummy_back;
-    dummy_back->next = NULL;
-    dummy_back->prev = dummy_front;
-    the_cache->front = dummy_front;
-    the_cache->back = dummy_back;
+    memset(index, 0, buckets * sizeof(cache_bucket));
+    the_cache->index = index;
+    the_cache->index_mask = buckets - 1;
+    the_cache->index_tombstones = 0;
+    the_cache->epoch = netio_now();
     return 0;
 }
 
 /**
- * Free the cache.
+ * @brief Get the expiry time of an element in the index.
+ *
+ * @param elem Cache element, non-null.
+ * @return uint32_t Seconds since the cache epoch when the element is stale.
  */
-void cache_clear(void)
+static uint32_t cache_entry_expiry(const cache_elem* elem)
 {
-    cache_elem* curr;
-    cache_elem* next;
+    long long expiry = (long long)elem->creation_time + elem->max_age -
+                       the_cache->epoch;
 
-    if (the_cache == NULL) {
-        return;
+    if (expiry < 0) {
+        return 0;
     }
-
-    curr = the_cache->front;
-    while (curr != NULL) {
-        next = curr->next;
-        cache_elem_free(&curr);
-        curr = next;
+    if (expiry > CACHE_EXPIRY_MAX) {
+        return CACHE_EXPIRY_MAX;
     }
-    free(the_cache);
-    the_cache = NULL;
+    return expiry;
 }
 
 /**
- * Get the element by the given key from cache, no matter it is valid or not.
+ * @brief Check whether an index entry is expired, without touching the
+ * element.
  *
- * @param key Key of the element to get, non-null.
- * @return A pointer to the element of the given key if found; otherwise, NULL.
+ * @param entry Index entry in use, non-null.
+ * @return int 1 if the element is stale; 0 otherwise.
  */
-cache_elem* cache_force_get_elem(const char* key)
+static int cache_entry_is_stale(const cache_entry* entry)
 {
-    cache_elem* elem;
+    return netio_now() - the_cache->epoch >=
+           (time_t)(entry->expiry & ~CACHE_ENTRY_REF);
+}
 
-    /* Invalid args. */
-    if (the_cache == NULL || key == NULL) {
-        return NULL;
-    }
+/**
+ * @brief Check whether an index entry is past its stale grace period, so it
+ * can no longer stand in for its origin.
+ *
+ * @param entry Index entry in use, non-null.
+ * @return int 1 if the element is past its grace period; 0 otherwise.
+ */
+static int cache_entry_is_past_grace(const cache_entry* entry)
+{
+    return netio_now() - the_cache->epoch >=
+           (time_t)(entry->expiry & ~CACHE_ENTRY_REF) + the_cache->stale_grace;
+}
+
+/**
+ * @brief Find the index entry of the given key.
+ *
+ * Probing stops at the first never used slot. Only a slot whose fingerprint
+ * matches reads the element to compare the full key.
+ *
+ * @param key Key of the element, non-null.
+ * @param hash Hash of key.
+ * @return cache_entry* Entry of the key if found; NULL otherwise.
+ */
+static cache_entry* cache_index_find(const char* key, uint64_t hash)
+{
+    uint64_t fp = cache_fingerprint(hash);
+    uint32_t b = hash & the_cache->index_mask;
+
+    while (1) {
+        cache_entry* slots = the_cache->index[b].slots;
 
-    elem = the_cache->front->next;
-    while (elem != the_cache->back) {
-        if (strcmp(elem->key, key) == 0) {
-            return elem;
+        for (int i = 0; i < CACHE_BUCKET_SLOTS; ++i) {
+            if (slots[i].tag == CACHE_TAG_EMPTY) {
+                return NULL;
+            }
+            if ((slots[i].tag & ~CACHE_CLASS_MASK) == fp) {
+                cache_elem* elem = slab_ptr(slots[i].loc);
+                if (strcmp(elem->key, key) == 0) {
+                    return &slots[i];
+                }
+            }
         }
-        elem = elem->next;
+        b = (b + 1) & the_cache->index_mask;
     }
-    return NULL;
 }
 
 /**
- * Update the element of the given key.
+ * @brief Find the index entry of the given element.
  *
- * @param key Key of the element to be updated, non-null.
- * @param val Value of the element to be updated, non-null.
- * @param val_len Byte size of val.
- * @param max_age Time-to-live of the element in seconds, >= 0.
- * @return Number of elements updated in cache.
+ * @param elem Element in cache, non-null.
+ * @return cache_entry* Entry of the element if found; NULL otherwise.
  */
-int cache_update(const char* key,
-                 const char* val,
-                 const int val_len,
-                 const int max_age)
+static cache_entry* cache_index_find_elem(const cache_elem* elem)
 {
-    cache_elem* elem;
+    uint64_t fp = cache_fingerprint(elem->hash);
+    uint32_t loc = slab_loc(elem);
+    uint32_t b = elem->hash & the_cache->index_mask;
 
-    /* Validate args. */
-    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
-        return 0;
-    }
+    while (1) {
+        cache_entry* slots = the_cache->index[b].slots;
 
-    elem = cache_force_get_elem(key);
-    if (elem == NULL) {
-        return 0;
-    }
-    /* Update element contents. */
-    free(elem->val);
-    elem->val = NULL;
-    elem->val = malloc(val_len);
-    if (elem->val == NULL) {
-        PLOG_ERROR("malloc");
-        return 0;
+        for (int i = 0; i < CACHE_BUCKET_SLOTS; ++i) {
+            if (slots[i].tag == CACHE_TAG_EMPTY) {
+                return NULL;
+            }
+            if ((slots[i].tag & ~CACHE_CLASS_MASK) == fp &&
+                slots[i].loc == loc) {
+                return &slots[i];
+            }
+        }
+        b = (b + 1) & the_cache->index_mask;
     }
-    memcpy(elem->val, val, val_len);
-    elem->val_len = val_len;
-    elem->creation_time = time(NULL);
-    elem->max_age = max_age;
-    /* Move the updated element to the front. */
-    /* Detach the update element. */
-    elem->prev->next = elem->next;
-    elem->next->prev = elem->prev;
-    /* Insert the updated element at the front. */
-    elem->next = the_cache->front->next;
-    the_cache->front->next->prev = elem;
-    elem->prev = the_cache->front;
-    the_cache->front->next = elem;
-    return 1;
 }
 
 /**
- * Remove the given element from cache, regardless of whether element is valid
- * and in cache.
+ * @brief Put an entry of the given element into the first free slot along its
+ * probe sequence.
  *
- * @param elem Element to remove, non-null.
- * @return Number of removed elements.
+ * @param elem Element whose key is not in the index, non-null.
  */
-int cache_force_remove_elem(cache_elem** elem)
+static void cache_index_put(const cache_elem* elem)
 {
-    /* Validate args. */
-    if (the_cache == NULL || elem == NULL || *elem == NULL) {
-        return 0;
-    }
+    uint32_t b = elem->hash & the_cache->index_mask;
 
-    (*elem)->prev->next = (*elem)->next;
-    (*elem)->next->prev = (*elem)->prev;
-    cache_elem_free(elem);
-    (the_cache->size)--;
-    return 1;
+    while (1) {
+        cache_entry* slots = the_cache->index[b].slots;
+
+        for (int i = 0; i < CACHE_BUCKET_SLOTS; ++i) {
+            if (slots[i].tag == CACHE_TAG_EMPTY ||
+                slots[i].tag == CACHE_TAG_TOMBSTONE) {
+                if (slots[i].tag == CACHE_TAG_TOMBSTONE) {
+                    (the_cache->index_tombstones)--;
+                }
+                slots[i].tag = cache_fingerprint(elem->hash) |
+                               (uint64_t)slab_class_of(elem->size);
+                slots[i].loc = slab_loc(elem);
+                slots[i].expiry = cache_entry_expiry(elem);
+                return;
+            }
+        }
+        b = (b + 1) & the_cache->index_mask;
+    }
 }
 
 /**
- * Remove and free all the stale elements in cache.
- * @return Number of removed elements.
+ * @brief Rebuild the index without tombstones.
  */
-int cache_remove_all_stale(void)
+static void cache_index_rebuild(void)
 {
-    int count = 0;
-    cache_elem* curr;
-    cache_elem* next;
+    cache_elem* elem;
 
-    if (the_cache == NULL) {
-        return 0;
+    memset(the_cache->index,
+           0,
+           ((size_t)the_cache->index_mask + 1) * sizeof(cache_bucket));
+    the_cache->index_tombstones = 0;
+    for (elem = the_cache->front->next;
+         elem != the_cache->back;
+         elem = elem->next) {
+        cache_index_put(elem);
     }
+}
 
-    curr = the_cache->front->next;
-    while (curr != the_cache->back) {
-        next = curr->next;
-        if (cache_elem_is_stale(curr)) {
-            cache_force_remove_elem(&curr);
-            count++;
-        }
-        curr = next;
+/**
+ * @brief Add an entry of the given element to the index.
+ *
+ * @param elem Element whose key is not in the index, non-null.
+ */
+static void cache_index_add(const cache_elem* elem)
+{
+    uint64_t slots = ((uint64_t)the_cache->index_mask + 1) *
+                     CACHE_BUCKET_SLOTS;
+
+    cache_index_put(elem);
+    /* Keep free slots, so that probing terminates quickly. The element is
+     * already linked, so it survives the rebuild. */
+    if ((uint64_t)the_cache->size + the_cache->index_tombstones >
+        slots / 8 * 7) {
+        cache_index_rebuild();
     }
-    return count;
 }
 
 /**
- * Remove and free the last element in cache.
+ * @brief Remove the entry of the given element from the index.
  *
- * @return Number of elements removed.
+ * @param elem Element in the index, non-null.
  */
-int cache_pop_back(void)
+static void cache_index_remove(const cache_elem* elem)
 {
-    cache_elem* last;
+    cache_entry* entry = cache_index_find_elem(elem);
 
-    /* Invalid args. */
-    if (the_cache == NULL || the_cache->size <= 0) {
-        return 0;
+    if (entry == NULL) {
+        return;
     }
-
-    last = the_cache->back->prev;
-    last->prev->next = last->next;
-    last->next->prev = last->prev;
-    cache_elem_free(&last);
-    (the_cache->size)--;
-    return 1;
+    entry->tag = CACHE_TAG_TOMBSTONE;
+    (the_cache->index_tombstones)++;
 }
 
 /**
- * Add element at the front of cache, regardless of capacity.
+ * @brief Allocate an empty host table.
  *
- * @param elem Element to remove, non-null.
- * @return Number of elements added.
+ * @param host_quota Default byte quota of each host; 0 for no quota.
+ * @return 0 on success; -1 otherwise.
  */
-int cache_force_push_front(cache_elem* elem)
+static int cache_hosts_init(long host_quota)
 {
-    /* Validate args. */
-    if (the_cache == NULL || elem == NULL) {
-        return 0;
+    the_cache->hosts = calloc(CACHE_MAX_HOSTS, sizeof(cache_host));
+    if (the_cache->hosts == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
     }
-
-    elem->next = the_cache->front->next;
-    the_cache->front->next->prev = elem;
-    elem->prev = the_cache->front;
-    the_cache->front->next = elem;
-    (the_cache->size)++;
-    return 1;
+    for (int i = 0; i < CACHE_MAX_HOSTS; ++i) {
+        the_cache->hosts[i].over_next = -1;
+        the_cache->hosts[i].over_prev = -1;
+    }
+    strcpy(the_cache->hosts[CACHE_HOST_OTHER].name, "*");
+    the_cache->hosts[CACHE_HOST_OTHER].quota = host_quota;
+    the_cache->num_hosts = 1;
+    the_cache->host_quota = host_quota;
+    the_cache->over_front = -1;
+    return 0;
 }
 
 /**
- * Put the given element (key, val, ttl) into cache.
+ * @brief Find the slot of the given host in the host table, adding the host
+ * if it is new.
  *
- * @param key Key of the element to be put, non-null.
- * @param val Value of the element to be put, non-null.
- * @param val_len Byte size of val.
- * @param max_age Time-to-live of the element in seconds, >= 0.
- * @return Number of elements put into cache.
+ * A host gives its slot back once it holds no elements, unless its quota was
+ * set explicitly, so the table holds at most CACHE_MAX_HOSTS * 3 / 4 hosts
+ * with elements at a time, and only hosts past that share CACHE_HOST_OTHER.
+ *
+ * @param host Hostname; NULL or empty for CACHE_HOST_OTHER.
+ * @param add 1 to add the host if it is not found; 0 otherwise.
+ * @return int Index of the host; CACHE_HOST_OTHER if the host is not found
+ * and cannot be added; -1 if add is 0 and the host is not found.
  */
-int cache_put(const char* key,
-              const char* val,
-              const int val_len,
-              const int max_age)
+static int cache_host_find(const char* host, int add)
 {
-    cache_elem* elem = NULL;
+    uint32_t i;
+    int free_slot = -1; /* First freed slot of the probe. */
 
-    /* Invalid args. */
-    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
-        return 0;
+    if (host == NULL || *host == '\0' ||
+        strlen(host) >= CACHE_HOST_NAME_LEN) {
+        return CACHE_HOST_OTHER;
     }
+    i = cache_hash(host) & (CACHE_MAX_HOSTS - 1);
+    for (int n = 0; n < CACHE_MAX_HOSTS; ++n) {
+        cache_host* h = &the_cache->hosts[i];
 
-    /* If KEY is found in CACHE, update the element. */
-    if (cache_update(key, val, val_len, max_age) > 0) {
-        return 1;
+        if (i != CACHE_HOST_OTHER) {
+            if (h->is_removed) {
+                if (free_slot < 0) {
+                    free_slot = i;
+                }
+            }
+            else if (h->name[0] == '\0') {
+                if (free_slot < 0) {
+                    free_slot = i;
+                }
+                break;
+            }
+            else if (strcmp(h->name, host) == 0) {
+                return i;
+            }
+        }
+        i = (i + 1) & (CACHE_MAX_HOSTS - 1);
     }
-
-    elem = cache_elem_new(key, val, val_len, max_age);
-    /* If CACHE is full, remove stale elements first. */
-    if (the_cache->size == the_cache->capacity &&
-        cache_remove_all_stale() == 0) {
-        /* If no stale element, remove the least recently used element. */
-        cache_pop_back();
+    if (!add) {
+        return -1;
     }
-    /* Add the new element to the front. */
-    cache_force_push_front(elem);
-    return 1;
+    if (the_cache->num_hosts >= CACHE_MAX_HOSTS / 4 * 3 || free_slot < 0) {
+        return CACHE_HOST_OTHER;
+    }
+    strcpy(the_cache->hosts[free_slot].name, host);
+    the_cache->hosts[free_slot].quota = the_cache->host_quota;
+    the_cache->hosts[free_slot].is_removed = 0;
+    (the_cache->num_hosts)++;
+    return free_slot;
 }
 
 /**
- * Get value of key from cache.
+ * @brief Give back the slot of a host that holds no elements.
  *
- * If the key is found, *out_val will be set to a copy of the value.
- * If the key is not found, *out_val will remain.
- * @param key Key of the element to get, non-null.
- * @param out_val Pointer to returned value, non-null.
- * *out_val won't be freed in this function.
- * Caller is responsible to free *out_val after using.
- * @param out_val_len Output; byte size of *out_val.
- * @param out_age Output; age of this element in seconds.
- * @return Number of valid elements we get.
+ * The slot becomes a tombstone, so probes for hosts past it still find them.
+ * If the next slot was never used, no probe goes on past this one, so it and
+ * the tombstones before it become never used again.
+ *
+ * @param i Index of the host, other than CACHE_HOST_OTHER.
  */
-int cache_get(const char* key,
-              char** out_val,
-              int* out_val_len,
-              int* out_age)
+static void cache_host_free(int i)
+{
+    cache_host* h = &the_cache->hosts[i];
+    cache_host* next = &the_cache->hosts[(i + 1) & (CACHE_MAX_HOSTS - 1)];
+
+    memset(h, 0, sizeof(*h));
+    h->over_next = -1;
+    h->over_prev = -1;
+    (the_cache->num_hosts)--;
+    if (next->name[0] != '\0' || next->is_removed) {
+        h->is_removed = 1;
+        return;
+    }
+    i = (i - 1) & (CACHE_MAX_HOSTS - 1);
+    while (i != CACHE_HOST_OTHER && the_cache->hosts[i].is_removed) {
+        the_cache->hosts[i].is_removed = 0;
+        i = (i - 1) & (CACHE_MAX_HOSTS - 1);
+    }
+}
+
+/**
+ * @brief Link or unlink a host in the over-quota list after its bytes or
+ * quota changed.
+ *
+ * @param i Index of the host.
+ */
+static void cache_host_check_quota(int i)
+{
+    cache_host* h = &the_cache->hosts[i];
+    int is_over = h->quota > 0 && h->bytes > h->quota;
+
+    if (is_over == h->is_over) {
+        return;
+    }
+    if (is_over) {
+        h->over_prev = -1;
+        h->over_next = the_cache->over_front;
+        if (h->over_next >= 0) {
+            the_cache->hosts[h->over_next].over_prev = i;
+        }
+        the_cache->over_front = i;
+    }
+    else {
+        if (h->over_prev >= 0) {
+            the_cache->hosts[h->over_prev].over_next = h->over_next;
+        }
+        else {
+            the_cache->over_front = h->over_next;
+        }
+        if (h->over_next >= 0) {
+            the_cache->hosts[h->over_next].over_prev = h->over_prev;
+        }
+        h->over_prev = -1;
+        h->over_next = -1;
+    }
+    h->is_over = is_over;
+}
+
+/**
+ * @brief Link the given element at the front of the list of its host.
+ *
+ * @param elem Element to link, non-null.
+ */
+static void cache_host_push_front(cache_elem* elem)
+{
+    cache_host* h = &the_cache->hosts[elem->host];
+
+    elem->host_prev = NULL;
+    elem->host_next = h->front;
+    if (elem->host_next != NULL) {
+        elem->host_next->host_prev = elem;
+    }
+    else {
+        h->back = elem;
+    }
+    h->front = elem;
+}
+
+/**
+ * @brief Unlink the given element from the list of its host.
+ *
+ * @param elem Element to unlink, non-null.
+ */
+static void cache_host_remove(cache_elem* elem)
+{
+    cache_host* h = &the_cache->hosts[elem->host];
+
+    if (elem->host_prev != NULL) {
+        elem->host_prev->host_next = elem->host_next;
+    }
+    else {
+        h->front = elem->host_next;
+    }
+    if (elem->host_next != NULL) {
+        elem->host_next->host_prev = elem->host_prev;
+    }
+    else {
+        h->back = elem->host_prev;
+    }
+    elem->host_prev = NULL;
+    elem->host_next = NULL;
+}
+
+/**
+ * @brief Account an element added to or removed from its host.
+ *
+ * @param elem Element, non-null.
+ * @param sign 1 if the element is added; -1 if it is removed.
+ */
+static void cache_host_account(const cache_elem* elem, int sign)
+{
+    cache_host* h = &the_cache->hosts[elem->host];
+
+    h->bytes += sign * elem->size;
+    h->objects += sign;
+    cache_host_check_quota(elem->host);
+    if (h->objects == 0 && !h->has_quota && elem->host != CACHE_HOST_OTHER) {
+        cache_host_free(elem->host);
+    }
+}
+
+/**
+ * @brief Initialize an empty cache of the given capacity.
+ *
+ * @param capacity Max size of the cache, > 0.
+ * @return 0 on success; -1 otherwise.
+ */
+int cache_init(int capacity)
+{
+    struct cache_config config;
+
+    config.capacity = capacity;
+    config.arena_size = CACHE_DEFAULT_ARENA_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 0;
+    return cache_init_config(&config);
+}
+
+/**
+ * @brief Initialize an empty cache with the given configuration.
+ *
+ * @param config Cache configuration, non-null.
+ * @return 0 on success; -1 otherwise.
+ */
+int cache_init_config(const struct cache_config* config)
+{
+    cache_elem* dummy_front;
+    cache_elem* dummy_back;
+
+    if (config == NULL ||
+        config->capacity <= 0 ||
+        config->host_quota < 0 ||
+        (config->policy != CACHE_POLICY_LRU &&
+         config->policy != CACHE_POLICY_CLOCK) ||
+        the_cache != NULL) {
+        /* Invalid capacity or the cache has already been initialized. */
+        return -1;
+    }
+
+    the_cache = (cache*)malloc(sizeof(cache));
+    if (the_cache == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    if (slab_init(config->arena_size, config->use_huge_pages) < 0) {
+        LOG_ERROR("fail to init cache arena");
+        free(the_cache);
+        the_cache = NULL;
+        return -1;
+    }
+    if (cache_index_init(config->capacity) < 0) {
+        slab_clear();
+        free(the_cache);
+        the_cache = NULL;
+        return -1;
+    }
+    if (cache_hosts_init(config->host_quota) < 0) {
+        slab_clear();
+        free(the_cache->index);
+        free(the_cache);
+        the_cache = NULL;
+        return -1;
+    }
+    the_cache->capacity = config->capacity;
+    the_cache->policy = config->policy;
+    the_cache->budget_bytes = (config->arena_size + SLAB_PAGE_SIZE - 1) /
+                              SLAB_PAGE_SIZE * SLAB_PAGE_SIZE;
+    the_cache->size = 0;
+    the_cache->val_bytes = 0;
+    the_cache->hits = 0;
+    the_cache->misses = 0;
+    the_cache->evictions = 0;
+    the_cache->stale_grace = 0;
+    the_cache->stale_hits = 0;
+    for (int i = 0; i <= SLAB_MAX_CLASSES; ++i) {
+        the_cache->class_front[i] = NULL;
+        the_cache->class_back[i] = NULL;
+    }
+
+    /* Create dummy nodes at front and back. Then, the doubly linked list won't
+     * be empty. It facilities insertions and removals. */
+    dummy_front = &the_cache->dummy_front;
+    dummy_back = &the_cache->dummy_back;
+    memset(dummy_front, 0, sizeof(cache_elem));
+    memset(dummy_back, 0, sizeof(cache_elem));
+    dummy_front->prev = NULL;
+    dummy_front->next = dummy_back;
+    dummy_back->next = NULL;
+    dummy_back->prev = dummy_front;
+    the_cache->front = dummy_front;
+    the_cache->back = dummy_back;
+    return 0;
+}
+
+/**
+ * Free the cache.
+ */
+void cache_clear(void)
+{
+    if (the_cache == NULL) {
+        return;
+    }
+
+    /* All elements live in the arena. */
+    slab_clear();
+    free(the_cache->index);
+    free(the_cache->hosts);
+    free(the_cache);
+    the_cache = NULL;
+}
+
+/**
+ * Get the element by the given key from cache, no matter it is valid or not.
+ *
+ * @param key Key of the element to get, non-null.
+ * @return A pointer to the element of the given key if found; otherwise, NULL.
+ */
+cache_elem* cache_force_get_elem(const char* key)
+{
+    cache_entry* entry;
+
+    /* Invalid args. */
+    if (the_cache == NULL || key == NULL) {
+        return NULL;
+    }
+
+    entry = cache_index_find(key, cache_hash(key));
+    if (entry == NULL) {
+        return NULL;
+    }
+    return slab_ptr(entry->loc);
+}
+
+/**
+ * @brief Link the given element at the front of the list of its size class.
+ *
+ * @param elem Element to link, non-null.
+ */
+static void cache_class_push_front(cache_elem* elem)
+{
+    int cls = slab_class_of(elem->size);
+
+    elem->class_prev = NULL;
+    elem->class_next = the_cache->class_front[cls];
+    if (elem->class_next != NULL) {
+        elem->class_next->class_prev = elem;
+    }
+    else {
+        the_cache->class_back[cls] = elem;
+    }
+    the_cache->class_front[cls] = elem;
+}
+
+/**
+ * @brief Unlink the given element from the list of its size class.
+ *
+ * @param elem Element to unlink, non-null.
+ */
+static void cache_class_remove(cache_elem* elem)
+{
+    int cls = slab_class_of(elem->size);
+
+    if (elem->class_prev != NULL) {
+        elem->class_prev->class_next = elem->class_next;
+    }
+    else {
+        the_cache->class_front[cls] = elem->class_next;
+    }
+    if (elem->class_next != NULL) {
+        elem->class_next->class_prev = elem->class_prev;
+    }
+    else {
+        the_cache->class_back[cls] = elem->class_prev;
+    }
+    elem->class_prev = NULL;
+    elem->class_next = NULL;
+}
+
+/**
+ * @brief Move the given element to the front of all its lists.
+ *
+ * @param elem Element in cache, non-null.
+ */
+static void cache_move_to_front(cache_elem* elem)
+{
+    /* Detach the element. */
+    elem->prev->next = elem->next;
+    elem->next->prev = elem->prev;
+    /* Insert the element at the front. */
+    elem->next = the_cache->front->next;
+    the_cache->front->next->prev = elem;
+    elem->prev = the_cache->front;
+    the_cache->front->next = elem;
+
+    cache_class_remove(elem);
+    cache_class_push_front(elem);
+    cache_host_remove(elem);
+    cache_host_push_front(elem);
+}
+
+/**
+ * @brief Under the CLOCK policy, check and clear the reference bit of an
+ * element that is about to be evicted. A referenced element gets a second
+ * chance at the front of the lists instead.
+ *
+ * @param elem Eviction candidate in cache, non-null.
+ * @return int 1 if the element got a second chance; 0 if it should be
+ * evicted.
+ */
+static int cache_second_chance(cache_elem* elem)
+{
+    cache_entry* entry;
+
+    if (the_cache->policy != CACHE_POLICY_CLOCK) {
+        return 0;
+    }
+    entry = cache_index_find_elem(elem);
+    if (entry == NULL || !(entry->expiry & CACHE_ENTRY_REF)) {
+        return 0;
+    }
+    entry->expiry &= ~CACHE_ENTRY_REF;
+    cache_move_to_front(elem);
+    return 1;
+}
+
+/**
+ * Remove the given element from cache, regardless of whether element is valid
+ * and in cache.
+ *
+ * @param elem Element to remove, non-null.
+ * @return Number of removed elements.
+ */
+int cache_force_remove_elem(cache_elem** elem)
+{
+    /* Validate args. */
+    if (the_cache == NULL || elem == NULL || *elem == NULL) {
+        return 0;
+    }
+
+    cache_index_remove(*elem);
+    (*elem)->prev->next = (*elem)->next;
+    (*elem)->next->prev = (*elem)->prev;
+    cache_class_remove(*elem);
+    cache_host_remove(*elem);
+    cache_host_account(*elem, -1);
+    the_cache->val_bytes -= (*elem)->val_len;
+    cache_elem_free(elem);
+    (the_cache->size)--;
+    return 1;
+}
+
+/**
+ * Remove and free all the stale elements in cache.
+ * @return Number of removed elements.
+ */
+int cache_remove_all_stale(void)
+{
+    int count = 0;
+    cache_elem* curr;
+    cache_elem* next;
+
+    if (the_cache == NULL) {
+        return 0;
+    }
+
+    curr = the_cache->front->next;
+    while (curr != the_cache->back) {
+        next = curr->next;
+        if (cache_elem_is_stale(curr)) {
+            cache_force_remove_elem(&curr);
+            count++;
+        }
+        curr = next;
+    }
+    return count;
+}
+
+/**
+ * @brief Remove and free the stale elements among the last few elements in
+ * cache. Unlike cache_remove_all_stale(), it takes bounded time.
+ *
+ * @param limit Max number of elements to check from the back.
+ * @return Number of removed elements.
+ */
+int cache_remove_stale_back(int limit)
+{
+    int count = 0;
+    cache_elem* curr;
+    cache_elem* prev;
+
+    if (the_cache == NULL) {
+        return 0;
+    }
+
+    curr = the_cache->back->prev;
+    while (curr != the_cache->front && limit-- > 0) {
+        prev = curr->prev;
+        if (cache_elem_is_stale(curr)) {
+            cache_force_remove_elem(&curr);
+            count++;
+        }
+        curr = prev;
+    }
+    return count;
+}
+
+/**
+ * @brief Remove and free an element to make room, counting it as an eviction
+ * if it is still valid.
+ *
+ * @param elem Element in cache, non-null.
+ * @return Number of elements removed.
+ */
+static int cache_evict(cache_elem** elem)
+{
+    TRACE2(cache_evict, (*elem)->hash, (*elem)->val_len);
+    if (!cache_elem_is_stale(*elem)) {
+        (the_cache->evictions)++;
+        (the_cache->hosts[(*elem)->host].evictions)++;
+    }
+    return cache_force_remove_elem(elem);
+}
+
+/**
+ * Remove and free the last element in cache.
+ *
+ * @return Number of elements removed.
+ */
+int cache_pop_back(void)
+{
+    cache_elem* last;
+
+    /* Invalid args. */
+    if (the_cache == NULL || the_cache->size <= 0) {
+        return 0;
+    }
+
+    last = the_cache->back->prev;
+    /* Each element gets at most one second chance, so this terminates. */
+    while (cache_second_chance(last)) {
+        last = the_cache->back->prev;
+    }
+    return cache_evict(&last);
+}
+
+/**
+ * @brief Remove and free the least recently used element of the given size
+ * class.
+ *
+ * @param cls Size class.
+ * @return Number of elements removed.
+ */
+int cache_pop_back_class(int cls)
+{
+    cache_elem* last;
+
+    if (the_cache == NULL || cls < 0 || cls > SLAB_MAX_CLASSES) {
+        return 0;
+    }
+
+    last = the_cache->class_back[cls];
+    if (last == NULL) {
+        return 0;
+    }
+    while (cache_second_chance(last)) {
+        last = the_cache->class_back[cls];
+    }
+    return cache_evict(&last);
+}
+
+/**
+ * @brief Remove and free the least recently used element of the first host
+ * above its quota.
+ *
+ * @return Number of elements removed; 0 if no host is above its quota.
+ */
+int cache_pop_back_over_quota(void)
+{
+    cache_host* h;
+    cache_elem* last;
+
+    if (the_cache == NULL || the_cache->over_front < 0) {
+        return 0;
+    }
+
+    h = &the_cache->hosts[the_cache->over_front];
+    last = h->back;
+    while (cache_second_chance(last)) {
+        last = h->back;
+    }
+    return cache_evict(&last);
+}
+
+/**
+ * Add element at the front of cache, regardless of capacity.
+ *
+ * @param elem Element to remove, non-null.
+ * @return Number of elements added.
+ */
+int cache_force_push_front(cache_elem* elem)
+{
+    /* Validate args. */
+    if (the_cache == NULL || elem == NULL) {
+        return 0;
+    }
+
+    elem->next = the_cache->front->next;
+    the_cache->front->next->prev = elem;
+    elem->prev = the_cache->front;
+    the_cache->front->next = elem;
+    cache_class_push_front(elem);
+    cache_host_push_front(elem);
+    cache_host_account(elem, 1);
+    the_cache->val_bytes += elem->val_len;
+    (the_cache->size)++;
+    cache_index_add(elem);
+    return 1;
+}
+
+/**
+ * @brief Create a new element, evicting others until the arena can hold it.
+ *
+ * Elements of hosts above their quota are evicted first. Then elements of
+ * the same size class, since freeing them makes room right away. If the class
+ * is empty, the globally least recently used element is evicted, which
+ * eventually hands a whole page back.
+ *
+ * @param host Hostname that owns the element; NULL for no host. Its slot is
+ * found after the evictions, which may free it.
+ * @param key Element key, non-null.
+ * @param val Element value, non-null.
+ * @param val_len Byte size of element value.
+ * @param max_age Time-to-live in seconds.
+ * @return cache_elem* Newly created element; NULL if it cannot fit.
+ */
+static cache_elem* cache_elem_new_evict(const char* host,
+                                        const char* key,
+                                        const char* val,
+                                        const int val_len,
+                                        const time_t max_age)
+{
+    cache_elem* elem;
+    int cls = slab_class_of(cache_elem_size(key, val_len));
+
+    if (cls < 0) {
+        /* Larger than the whole arena. */
+        return NULL;
+    }
+    while ((elem = cache_elem_new(key, val, val_len, max_age)) == NULL) {
+        if (cache_pop_back_over_quota() == 0 &&
+            cache_pop_back_class(cls) == 0 &&
+            cache_pop_back() == 0) {
+            return NULL;
+        }
+    }
+    elem->host = cache_host_find(host, 1);
+    TRACE3(cache_put, elem->hash, val_len, max_age);
+    return elem;
+}
+
+/**
+ * Update the element of the given key.
+ *
+ * The element is rebuilt in a chunk that fits the new value and moved to the
+ * front.
+ *
+ * @param host Hostname that owns the element; NULL for no host.
+ * @param key Key of the element to be updated, non-null.
+ * @param val Value of the element to be updated, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @return Number of elements updated in cache.
+ */
+int cache_update(const char* host,
+                 const char* key,
+                 const char* val,
+                 const int val_len,
+                 const int max_age)
+{
+    cache_elem* elem;
+
+    /* Validate args. */
+    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
+        return 0;
+    }
+
+    elem = cache_force_get_elem(key);
+    if (elem == NULL) {
+        return 0;
+    }
+    /* Free the old chunk first, so it can be reused by the new contents. */
+    cache_force_remove_elem(&elem);
+    elem = cache_elem_new_evict(host, key, val, val_len, max_age);
+    if (elem == NULL) {
+        return 0;
+    }
+    /* Add the updated element to the front. */
+    cache_force_push_front(elem);
+    return 1;
+}
+
+/**
+ * Put the given element (key, val, ttl) into cache.
+ *
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @return Number of elements put into cache.
+ */
+int cache_put(const char* key,
+              const char* val,
+              const int val_len,
+              const int max_age)
+{
+    return cache_put_host(NULL, key, val, val_len, max_age);
+}
+
+/**
+ * @brief Put the given element (key, val, ttl) of the given host into cache.
+ *
+ * @param host Hostname that owns the element; NULL for no host.
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @return Number of elements put into cache.
+ */
+int cache_put_host(const char* host,
+                   const char* key,
+                   const char* val,
+                   const int val_len,
+                   const int max_age)
+{
+    cache_elem* elem = NULL;
+
+    /* Invalid args. */
+    if (the_cache == NULL || key == NULL || val == NULL || val_len < 0) {
+        return 0;
+    }
+
+    /* If KEY is found in CACHE, update the element. */
+    if (cache_force_get_elem(key) != NULL) {
+        return cache_update(host, key, val, val_len, max_age);
+    }
+
+    /* If CACHE is full, remove stale elements near the back first. */
+    if (the_cache->size == the_cache->capacity &&
+        cache_remove_stale_back(CACHE_STALE_SCAN) == 0 &&
+        cache_pop_back_over_quota() == 0) {
+        /* If no stale element and no host is above its quota, remove the
+         * least recently used element. */
+        cache_pop_back();
+    }
+    elem = cache_elem_new_evict(host, key, val, val_len, max_age);
+    if (elem == NULL) {
+        LOG_ERROR("cache arena cannot hold %d bytes", val_len);
+        return 0;
+    }
+    /* Add the new element to the front. */
+    cache_force_push_front(elem);
+    return 1;
+}
+
+/**
+ * Get value of key from cache.
+ *
+ * If the key is found, *out_val will be set to a copy of the value.
+ * If the key is not found, *out_val will remain.
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * *out_val won't be freed in this function.
+ * Caller is responsible to free *out_val after using.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of valid elements we get.
+ */
+int cache_get(const char* key,
+              char** out_val,
+              int* out_val_len,
+              int* out_age)
+{
+    return cache_get_host(NULL, key, out_val, out_val_len, out_age);
+}
+
+/**
+ * @brief Get value of key of the given host from cache.
+ *
+ * It behaves as cache_get(), and also counts the hit or miss for the host.
+ *
+ * @param host Hostname that owns the key; NULL for no host.
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of valid elements we get.
+ */
+int cache_get_host(const char* host,
+                   const char* key,
+                   char** out_val,
+                   int* out_val_len,
+                   int* out_age)
 {
     cache_elem* elem = NULL;
+    cache_entry* entry = NULL;
+    uint64_t hash;
+    int h;
 
     /* Validate args. */
     if (the_cache == NULL ||
@@ -428,19 +1352,370 @@ int cache_get(const char* key,
         return 0;
     }
 
-    elem = cache_force_get_elem(key);
-    if (elem == NULL) {
+    /* A host is only added when it stores an element; misses of unknown
+     * hosts count on CACHE_HOST_OTHER. */
+    h = cache_host_find(host, 0);
+    if (h < 0) {
+        h = CACHE_HOST_OTHER;
+    }
+    hash = cache_hash(key);
+    entry = cache_index_find(key, hash);
+    if (entry == NULL) {
+        (the_cache->misses)++;
+        (the_cache->hosts[h].misses)++;
+        TRACE1(cache_miss, hash);
         return 0;
     }
-    /* Remove the stale element. */
-    if (cache_elem_is_stale(elem)) {
-        cache_force_remove_elem(&elem);
+    elem = slab_ptr(entry->loc);
+    /* Remove the stale element, unless it may still stand in for its
+     * origin. */
+    if (cache_entry_is_stale(entry)) {
+        /* Count the miss first, as removing the last element of the host
+         * frees its slot. */
+        (the_cache->misses)++;
+        (the_cache->hosts[h].misses)++;
+        if (cache_entry_is_past_grace(entry)) {
+            cache_force_remove_elem(&elem);
+        }
+        TRACE1(cache_miss, hash);
         return 0;
     }
     *out_val = NULL;
     *out_val = malloc(elem->val_len);
+    if (*out_val == NULL) {
+        PLOG_ERROR("malloc");
+        return 0;
+    }
+    memcpy(*out_val, elem->val, elem->val_len);
+    *out_val_len = elem->val_len;
+    *out_age = cache_elem_age(elem);
+    (the_cache->hits)++;
+    (the_cache->hosts[elem->host].hits)++;
+    TRACE3(cache_hit, hash, elem->val_len, *out_age);
+    if (the_cache->policy == CACHE_POLICY_CLOCK) {
+        /* Only a bit in the index entry is written on a hit. */
+        entry->expiry |= CACHE_ENTRY_REF;
+    }
+    else {
+        cache_move_to_front(elem);
+    }
+    return 1;
+}
+
+/**
+ * @brief Get value of key from cache even if it is stale, as long as it is
+ * within the stale grace period. The element is neither moved nor counted as
+ * a hit, as it only stands in for an origin that failed.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of elements we get.
+ */
+int cache_get_stale(const char* key,
+                    char** out_val,
+                    int* out_val_len,
+                    int* out_age)
+{
+    cache_elem* elem = NULL;
+    cache_entry* entry = NULL;
+
+    if (the_cache == NULL ||
+        key == NULL ||
+        out_val == NULL ||
+        out_val_len == NULL ||
+        out_age == NULL) {
+
+        return 0;
+    }
+
+    entry = cache_index_find(key, cache_hash(key));
+    if (entry == NULL) {
+        return 0;
+    }
+    elem = slab_ptr(entry->loc);
+    if (cache_entry_is_past_grace(entry)) {
+        cache_force_remove_elem(&elem);
+        return 0;
+    }
+    *out_val = malloc(elem->val_len);
+    if (*out_val == NULL) {
+        PLOG_ERROR("malloc");
+        return 0;
+    }
     memcpy(*out_val, elem->val, elem->val_len);
     *out_val_len = elem->val_len;
     *out_age = cache_elem_age(elem);
+    (the_cache->stale_hits)++;
     return 1;
 }
+
+/**
+ * @brief Set how long stale elements are kept for cache_get_stale().
+ *
+ * @param seconds Seconds after max age; 0 removes stale elements as soon as
+ * they are looked up.
+ * @return 0 on success; -1 if the cache is not initialized or seconds is
+ * negative.
+ */
+int cache_set_stale_grace(long seconds)
+{
+    if (the_cache == NULL || seconds < 0) {
+        return -1;
+    }
+    the_cache->stale_grace = seconds;
+    return 0;
+}
+
+/**
+ * @brief Set the byte quota of the given host.
+ *
+ * @param host Hostname; NULL for elements without a host.
+ * @param quota Max bytes of the host before it is evicted first; 0 for no
+ * quota.
+ * @return 0 on success; -1 if the cache is not initialized, quota is negative
+ * or the host table is full.
+ */
+int cache_set_host_quota(const char* host, long quota)
+{
+    int h;
+
+    if (the_cache == NULL || quota < 0) {
+        return -1;
+    }
+    h = cache_host_find(host, 1);
+    if (h == CACHE_HOST_OTHER && host != NULL && *host != '\0') {
+        return -1;
+    }
+    the_cache->hosts[h].quota = quota;
+    the_cache->hosts[h].has_quota = 1;
+    cache_host_check_quota(h);
+    return 0;
+}
+
+/**
+ * @brief Get statistics of the given host.
+ *
+ * @param host Hostname; NULL for elements without a host.
+ * @param out_stats Output; host statistics, non-null.
+ * @return 0 on success; -1 if the cache is not initialized or the host is
+ * unknown.
+ */
+int cache_get_host_stats(const char* host, struct cache_host_stats* out_stats)
+{
+    int h;
+
+    if (the_cache == NULL || out_stats == NULL) {
+        return -1;
+    }
+    h = cache_host_find(host, 0);
+    if (h < 0) {
+        return -1;
+    }
+    strcpy(out_stats->name, the_cache->hosts[h].name);
+    out_stats->bytes = the_cache->hosts[h].bytes;
+    out_stats->quota = the_cache->hosts[h].quota;
+    out_stats->objects = the_cache->hosts[h].objects;
+    out_stats->hits = the_cache->hosts[h].hits;
+    out_stats->misses = the_cache->hosts[h].misses;
+    out_stats->evictions = the_cache->hosts[h].evictions;
+    return 0;
+}
+
+/**
+ * @brief Set the byte budget of arena pages in use. Lowering the budget does
+ * not evict anything by itself; call cache_shrink() until it returns 0.
+ *
+ * @param bytes Max bytes of arena pages in use; rounded down to whole pages,
+ * at least one page and at most the arena size.
+ * @return 0 on success; -1 if the cache is not initialized.
+ */
+int cache_set_budget(size_t bytes)
+{
+    if (the_cache == NULL) {
+        return -1;
+    }
+    slab_set_page_limit(bytes / SLAB_PAGE_SIZE);
+    the_cache->budget_bytes = (size_t)slab_get_page_limit() * SLAB_PAGE_SIZE;
+    return 0;
+}
+
+/**
+ * @brief Evict a bounded batch of elements towards the byte budget, then hand
+ * free pages back to the kernel.
+ *
+ * Hosts above their quota are evicted first, then the least recently used
+ * elements, until the pages in use fit the budget or the batch is done.
+ *
+ * @param max_evictions Max number of elements to evict in this call, > 0.
+ * @return int 1 if the pages in use still exceed the budget; 0 otherwise.
+ */
+int cache_shrink(int max_evictions)
+{
+    int limit;
+
+    if (the_cache == NULL) {
+        return 0;
+    }
+    limit = the_cache->budget_bytes / SLAB_PAGE_SIZE;
+    while (slab_pages_used() > limit && max_evictions-- > 0) {
+        if (cache_pop_back_over_quota() == 0 && cache_pop_back() == 0) {
+            break;
+        }
+    }
+    slab_release_free_pages();
+    return slab_pages_used() > limit;
+}
+
+/**
+ * @brief Get resident set size of this process from /proc/self/statm.
+ *
+ * @return long RSS in bytes; -1 if unknown.
+ */
+static long get_rss(void)
+{
+    FILE* file;
+    long total_pages = 0;
+    long resident_pages = 0;
+
+    file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    if (fscanf(file, "%ld %ld", &total_pages, &resident_pages) != 2) {
+        resident_pages = -1;
+    }
+    fclose(file);
+    if (resident_pages < 0) {
+        return -1;
+    }
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Get statistics of the cache.
+ *
+ * @param out_stats Output; cache statistics, non-null.
+ * @return 0 on success; -1 if the cache is not initialized.
+ */
+int cache_get_stats(struct cache_stats* out_stats)
+{
+    struct slab_stats slab;
+
+    if (the_cache == NULL || out_stats == NULL) {
+        return -1;
+    }
+    slab_get_stats(&slab);
+    out_stats->size = the_cache->size;
+    out_stats->capacity = the_cache->capacity;
+    out_stats->hits = the_cache->hits;
+    out_stats->misses = the_cache->misses;
+    out_stats->evictions = the_cache->evictions;
+    out_stats->stale_hits = the_cache->stale_hits;
+    out_stats->logical_bytes = the_cache->val_bytes;
+    out_stats->requested_bytes = slab.bytes_requested;
+    out_stats->allocated_bytes = slab.bytes_allocated;
+    out_stats->assigned_bytes = slab.bytes_assigned;
+    out_stats->arena_bytes = slab.arena_size;
+    out_stats->budget_bytes = the_cache->budget_bytes;
+    out_stats->huge_pages = slab.huge_pages;
+    out_stats->index_bytes = ((size_t)the_cache->index_mask + 1) *
+                             sizeof(cache_bucket);
+    out_stats->index_tombstones = the_cache->index_tombstones;
+    out_stats->rss_bytes = get_rss();
+    return 0;
+}
+
+/**
+ * @brief Print cache statistics, including fragmentation of the arena and
+ * RSS against the logical cache size.
+ */
+void cache_log_stats(void)
+{
+    struct cache_stats stats;
+    struct slab_stats slab;
+    double internal_frag = 0.0;
+    double external_frag = 0.0;
+
+    if (cache_get_stats(&stats) < 0) {
+        return;
+    }
+    /* Wasted bytes inside handed out chunks. */
+    if (stats.allocated_bytes > 0) {
+        internal_frag = 1.0 - (double)stats.requested_bytes /
+                              stats.allocated_bytes;
+    }
+    /* Free chunks in pages that are assigned to a class. */
+    if (stats.assigned_bytes > 0) {
+        external_frag = 1.0 - (double)stats.allocated_bytes /
+                              stats.assigned_bytes;
+    }
+    LOG_INFO("cache stats:\n"
+             "- elements: %d/%d\n"
+             "- hits: %ld\n"
+             "- misses: %ld\n"
+             "- stale hits: %ld\n"
+             "- evictions: %ld\n"
+             "- logical bytes: %ld\n"
+             "- allocated bytes: %zu\n"
+             "- arena bytes: %zu/%zu assigned (%s)\n"
+             "- budget bytes: %zu\n"
+             "- index bytes: %zu (%ld tombstones)\n"
+             "- internal fragmentation: %.1f%%\n"
+             "- external fragmentation: %.1f%%\n"
+             "- rss bytes: %ld (%.2fx logical)",
+             stats.size,
+             stats.capacity,
+             stats.hits,
+             stats.misses,
+             stats.stale_hits,
+             stats.evictions,
+             stats.logical_bytes,
+             stats.allocated_bytes,
+             stats.assigned_bytes,
+             stats.arena_bytes,
+             stats.huge_pages ? "huge pages" : "regular pages",
+             stats.budget_bytes,
+             stats.index_bytes,
+             stats.index_tombstones,
+             internal_frag * 100,
+             external_frag * 100,
+             stats.rss_bytes,
+             stats.logical_bytes > 0 ?
+             (double)stats.rss_bytes / stats.logical_bytes : 0.0);
+
+    for (int i = 0; i < CACHE_MAX_HOSTS; ++i) {
+        cache_host* h = &the_cache->hosts[i];
+        long lookups = h->hits + h->misses;
+
+        if (h->name[0] == '\0' || (h->objects == 0 && lookups == 0)) {
+            continue;
+        }
+        LOG_INFO("- host %s: %d elements, %ld/%ld bytes%s, "
+                 "hit ratio %.1f%% (%ld/%ld), %ld evictions",
+                 h->name,
+                 h->objects,
+                 h->bytes,
+                 h->quota,
+                 h->is_over ? " (over quota)" : "",
+                 lookups > 0 ? 100.0 * h->hits / lookups : 0.0,
+                 h->hits,
+                 lookups,
+                 h->evictions);
+    }
+
+    slab_get_stats(&slab);
+    for (int i = 0; i <= slab.num_classes; ++i) {
+        if (slab.classes[i].pages == 0) {
+            continue;
+        }
+        LOG_INFO("- class %d: chunk %zu bytes, %d pages, %ld used, "
+                 "%zu bytes requested",
+                 i,
+                 slab.classes[i].chunk_size,
+                 slab.classes[i].pages,
+                 slab.classes[i].chunks_used,
+                 slab.classes[i].bytes_requested);
+    }
+}
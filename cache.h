@@ -7,13 +7,66 @@
 *     Date: 2021-11-11
 *
 *     Summary:
-*     Interface for fixed size LRU cache.
+*     Interface for fixed size LRU/CLOCK cache backed by a slab
+*     arena, with per-host byte quotas.
 *
 **************************************************************/
 
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <stddef.h>
+
+#define CACHE_DEFAULT_ARENA_SIZE (64 * 1024 * 1024) /* 64 MB. */
+#define CACHE_HOST_NAME_LEN 64 /* Max byte size of a hostname, including the
+                                * NUL; longer hosts share one slot. */
+
+/* Eviction policies. */
+#define CACHE_POLICY_LRU 0 /* Move an element to the front on every hit. */
+#define CACHE_POLICY_CLOCK 1 /* Set a reference bit on a hit; give referenced
+                              * elements a second chance on eviction. */
+
+struct cache_config {
+    int capacity; /* Max number of elements, > 0. */
+    size_t arena_size; /* Byte size of the arena holding all elements. */
+    int use_huge_pages; /* 1 to back the arena with 2 MB huge pages. */
+    int policy; /* Eviction policy, CACHE_POLICY_LRU or CACHE_POLICY_CLOCK. */
+    long host_quota; /* Default byte quota of each host, >= 0; 0 for no
+                      * quota. */
+};
+
+struct cache_stats {
+    int size; /* Number of elements. */
+    int capacity; /* Max number of elements. */
+    long hits; /* Number of valid elements got. */
+    long misses; /* Number of keys not found or stale. */
+    long evictions; /* Number of valid elements evicted for space. */
+    long stale_hits; /* Number of stale elements got to serve when their
+                      * origin failed. */
+    long logical_bytes; /* Sum of byte sizes of cached values. */
+    size_t requested_bytes; /* Bytes requested from the arena, including
+                             * element headers and keys. */
+    size_t allocated_bytes; /* Bytes of chunks handed out by the arena. */
+    size_t assigned_bytes; /* Bytes of arena pages assigned to size classes. */
+    size_t arena_bytes; /* Byte size of the arena. */
+    size_t budget_bytes; /* Max bytes of arena pages in use. */
+    int huge_pages; /* 1 if the arena is backed by explicit huge pages. */
+    size_t index_bytes; /* Byte size of the index. */
+    long index_tombstones; /* Number of removed entries in the index. */
+    long rss_bytes; /* Resident set size of the process; -1 if unknown. */
+};
+
+struct cache_host_stats {
+    char name[CACHE_HOST_NAME_LEN]; /* Hostname; "*" for elements without a
+                                     * host or hosts that do not fit. */
+    long bytes; /* Arena bytes requested by elements of this host. */
+    long quota; /* Byte quota of this host; 0 for no quota. */
+    int objects; /* Number of elements of this host. */
+    long hits; /* Number of valid elements of this host got. */
+    long misses; /* Number of keys of this host not found or stale. */
+    long evictions; /* Number of valid elements of this host evicted. */
+};
+
 /**
  * @brief Initialize an empty cache of the given capacity.
  *
@@ -22,6 +75,14 @@
  */
 int cache_init(int capacity);
 
+/**
+ * @brief Initialize an empty cache with the given configuration.
+ *
+ * @param config Cache configuration, non-null.
+ * @return 0 on success; -1 otherwise.
+ */
+int cache_init_config(const struct cache_config* config);
+
 /**
  * Free the cache.
  */
@@ -41,6 +102,25 @@ int cache_put(const char* key,
               const int val_len,
               const int max_age);
 
+/**
+ * @brief Put the given element (key, val, ttl) of the given host into cache.
+ *
+ * Bytes of the element count against the quota of the host. When the cache
+ * needs room, elements of hosts above their quota are evicted first.
+ *
+ * @param host Hostname that owns the element; NULL for no host.
+ * @param key Key of the element to be put, non-null.
+ * @param val Value of the element to be put, non-null.
+ * @param val_len Byte size of val.
+ * @param max_age Time-to-live of the element in seconds, >= 0.
+ * @return Number of elements put into cache.
+ */
+int cache_put_host(const char* host,
+                   const char* key,
+                   const char* val,
+                   const int val_len,
+                   const int max_age);
+
 /**
  * Get value of key from cache.
  *
@@ -59,4 +139,105 @@ int cache_get(const char* key,
               int* out_val_len,
               int* out_age);
 
+/**
+ * @brief Get value of key of the given host from cache.
+ *
+ * It behaves as cache_get(), and also counts the hit or miss for the host.
+ *
+ * @param host Hostname that owns the key; NULL for no host.
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of valid elements we get.
+ */
+int cache_get_host(const char* host,
+                   const char* key,
+                   char** out_val,
+                   int* out_val_len,
+                   int* out_age);
+
+/**
+ * @brief Get value of key from cache even if it is stale, as long as it is
+ * within the stale grace period. The element is neither moved nor counted as
+ * a hit, as it only stands in for an origin that failed.
+ *
+ * @param key Key of the element to get, non-null.
+ * @param out_val Pointer to returned value, non-null.
+ * @param out_val_len Output; byte size of *out_val.
+ * @param out_age Output; age of this element in seconds.
+ * @return Number of elements we get.
+ */
+int cache_get_stale(const char* key,
+                    char** out_val,
+                    int* out_val_len,
+                    int* out_age);
+
+/**
+ * @brief Set how long stale elements are kept for cache_get_stale().
+ * Within this period after its max age, a stale element is a miss for
+ * cache_get_host() but is not removed; it is still the first to go when the
+ * cache needs room.
+ *
+ * @param seconds Seconds after max age; 0, the default, removes stale
+ * elements as soon as they are looked up.
+ * @return 0 on success; -1 if the cache is not initialized or seconds is
+ * negative.
+ */
+int cache_set_stale_grace(long seconds);
+
+/**
+ * @brief Set the byte quota of the given host, overriding the default quota.
+ *
+ * @param host Hostname; NULL for elements without a host.
+ * @param quota Max bytes of the host before it is evicted first; 0 for no
+ * quota.
+ * @return 0 on success; -1 if the cache is not initialized, quota is negative
+ * or the host table is full.
+ */
+int cache_set_host_quota(const char* host, long quota);
+
+/**
+ * @brief Get statistics of the given host.
+ *
+ * @param host Hostname; NULL for elements without a host.
+ * @param out_stats Output; host statistics, non-null.
+ * @return 0 on success; -1 if the cache is not initialized or the host is
+ * unknown.
+ */
+int cache_get_host_stats(const char* host, struct cache_host_stats* out_stats);
+
+/**
+ * @brief Set the byte budget of arena pages in use. Lowering the budget does
+ * not evict anything by itself; call cache_shrink() until it returns 0.
+ *
+ * @param bytes Max bytes of arena pages in use; rounded down to whole pages,
+ * at least one page and at most the arena size.
+ * @return 0 on success; -1 if the cache is not initialized.
+ */
+int cache_set_budget(size_t bytes);
+
+/**
+ * @brief Evict a bounded batch of elements towards the byte budget, then hand
+ * free pages back to the kernel.
+ *
+ * @param max_evictions Max number of elements to evict in this call, > 0.
+ * @return int 1 if the pages in use still exceed the budget; 0 otherwise.
+ */
+int cache_shrink(int max_evictions);
+
+/**
+ * @brief Get statistics of the cache.
+ *
+ * @param out_stats Output; cache statistics, non-null.
+ * @return 0 on success; -1 if the cache is not initialized.
+ */
+int cache_get_stats(struct cache_stats* out_stats);
+
+/**
+ * @brief Print cache statistics, including fragmentation of the arena and
+ * RSS against the logical cache size.
+ */
+void cache_log_stats(void);
+
 #endif /* CACHE_H */
@@ -0,0 +1,552 @@
+/**************************************************************
+*
+*                         compress.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-17
+*
+*     Summary:
+*     Implementation for gzip storage of compressible responses
+*     in cache.
+*
+*     Textual responses are stored gzip coded at the fastest
+*     level, which usually shrinks them several times. Since
+*     nearly every client accepts gzip, most hits are served
+*     straight from the stored bytes, and only the rest pay
+*     for decompression.
+*
+**************************************************************/
+
+#include "compress.h"
+#include "http_utils.h"
+#include "logger.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <zlib.h>
+
+#define COMPRESS_MAX_RAW (1 << 30) /* Largest decompressed body. */
+
+static struct compress_stats stats; /* Statistics of compression. */
+
+/* Content types worth compressing, matched as prefixes. */
+static const char* compressible_types[] = {
+    "text/",
+    "application/json",
+    "application/javascript",
+    "application/x-javascript",
+    "application/xml",
+    "application/xhtml+xml",
+    "image/svg+xml",
+    NULL
+};
+
+/**
+ * @brief Get CPU time of this thread in nanoseconds.
+ */
+static double cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Check whether a response has a textual, i.e. compressible, content
+ * type.
+ *
+ * @param response HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @return int 1 if it is textual; 0 otherwise.
+ */
+int compress_is_textual(const char* response, int len)
+{
+    const char* type;
+    int type_len;
+
+    if (!find_header_field(response, len, HTTP_HEADER_CONTENT_TYPE,
+                           &type, &type_len)) {
+        return 0;
+    }
+    for (int i = 0; compressible_types[i] != NULL; ++i) {
+        int n = strlen(compressible_types[i]);
+
+        if (type_len >= n && strncasecmp(type, compressible_types[i], n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether a Vary field value lists Accept-Encoding or "*".
+ *
+ * @param value Field value, field names separated by commas; it need not be
+ * null-terminated.
+ * @param len Byte size of value.
+ * @return int 1 if it does; 0 otherwise.
+ */
+static int varies_on_encoding(const char* value, int len)
+{
+    const char* end = value + len;
+    const char* item_end;
+    int n;
+
+    while (value < end) {
+        item_end = memchr(value, ',', end - value);
+        if (item_end == NULL) {
+            item_end = end;
+        }
+        while (value < item_end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        n = item_end - value;
+        while (n > 0 && (value[n - 1] == ' ' || value[n - 1] == '\t')) {
+            n--;
+        }
+        if ((n == 1 && *value == '*') ||
+            (n == 15 && strncasecmp(value, "accept-encoding", 15) == 0)) {
+            return 1;
+        }
+        value = item_end + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy a header line of a response into the head of a response whose
+ * body the proxy changed. A strong ETag becomes weak, as the bytes differ.
+ * If the new body is gzip coded, the first Vary field gets Accept-Encoding
+ * unless it lists it or "*".
+ *
+ * A line grows by at most 2 bytes for an ETag, which is at least 8 bytes
+ * long, and COMPRESS_VARY_EXTRA bytes for the first Vary field.
+ *
+ * @param line Header line, with its line ending.
+ * @param line_len Byte size of line.
+ * @param header Field name of line.
+ * @param value Field value within line.
+ * @param value_len Byte size of value.
+ * @param gzip 1 if the new body is gzip coded; 0 otherwise.
+ * @param io_vary Input and output; 1 once a Vary field was copied.
+ * @param out Output buffer.
+ * @return int Byte size written to out.
+ */
+int compress_copy_field(const char* line,
+                        int line_len,
+                        enum http_header header,
+                        const char* value,
+                        int value_len,
+                        int gzip,
+                        int* io_vary,
+                        char* out)
+{
+    const char* at = NULL; /* Where the added bytes go. */
+    const char* added = NULL;
+    int n;
+
+    if (header == HTTP_HEADER_ETAG && value_len > 0 && value[0] == '"') {
+        at = value;
+        added = "W/";
+    }
+    else if (header == HTTP_HEADER_VARY && gzip && !*io_vary &&
+             !varies_on_encoding(value, value_len)) {
+        at = value + value_len;
+        added = value_len > 0 ? ", Accept-Encoding" : "Accept-Encoding";
+    }
+    if (header == HTTP_HEADER_VARY) {
+        *io_vary = 1;
+    }
+    if (at == NULL) {
+        memcpy(out, line, line_len);
+        return line_len;
+    }
+    n = at - line;
+    memcpy(out, line, n);
+    memcpy(out + n, added, strlen(added));
+    memcpy(out + n + strlen(added), at, line + line_len - at);
+    return line_len + strlen(added);
+}
+
+/**
+ * @brief Check whether a header line has one of the given field names.
+ *
+ * @param line Start of the header line.
+ * @param end End of the head that contains line.
+ * @param headers List of field names, terminated by HTTP_HEADER_UNKNOWN.
+ * @return int 1 if the field name is listed; 0 otherwise.
+ */
+static int has_field_name(const char* line,
+                          const char* end,
+                          const enum http_header* headers)
+{
+    enum http_header header;
+    const char* value;
+    int value_len;
+
+    if (parse_header_field(line, end, &header, &value, &value_len) < 0 ||
+        header == HTTP_HEADER_UNKNOWN) {
+        return 0;
+    }
+    for (int i = 0; headers[i] != HTTP_HEADER_UNKNOWN; ++i) {
+        if (headers[i] == header) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Build a response from the head of another one and a new body.
+ * Header lines go through compress_copy_field().
+ *
+ * @param response HTTP response whose head is reused.
+ * @param head_len Byte size of the head, including the empty line.
+ * @param drop List of header fields to leave out, terminated by
+ * HTTP_HEADER_UNKNOWN.
+ * @param gzip 1 if the new body is gzip coded; 0 otherwise.
+ * @param extra Header lines to append, each ending with "\r\n".
+ * @param body New body.
+ * @param body_len Byte size of body.
+ * @param out_response Output pointer to the new response.
+ * @param out_len Output; byte size of *out_response.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int build_response(const char* response,
+                          int head_len,
+                          const enum http_header* drop,
+                          int gzip,
+                          const char* extra,
+                          const char* body,
+                          int body_len,
+                          char** out_response,
+                          int* out_len)
+{
+    const char* st = response;
+    const char* end = response + head_len - 2; /* Start of the empty line. */
+    const char* line_end;
+    const char* value;
+    enum http_header header;
+    int value_len;
+    int vary = 0;
+    char* out;
+    int n = 0;
+
+    out = malloc(head_len + head_len / 4 + COMPRESS_VARY_EXTRA +
+                 strlen(extra) + body_len);
+    if (out == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    while (st < end) {
+        line_end = memchr(st, '\n', end - st);
+        if (line_end == NULL) {
+            break;
+        }
+        line_end++; /* Start of the next line. */
+        /* Always keep the status line. */
+        if (st == response) {
+            memcpy(out + n, st, line_end - st);
+            n += line_end - st;
+        }
+        else if (!has_field_name(st, end, drop)) {
+            if (parse_header_field(st, end + 2, &header, &value,
+                                   &value_len) < 0) {
+                header = HTTP_HEADER_UNKNOWN;
+                value = st;
+                value_len = 0;
+            }
+            n += compress_copy_field(st, line_end - st, header, value,
+                                     value_len, gzip, &vary, out + n);
+        }
+        st = line_end;
+    }
+    memcpy(out + n, extra, strlen(extra));
+    n += strlen(extra);
+    if (gzip && !vary) {
+        memcpy(out + n, "Vary: Accept-Encoding\r\n", 23);
+        n += 23;
+    }
+    memcpy(out + n, "\r\n", 2);
+    n += 2;
+    memcpy(out + n, body, body_len);
+    n += body_len;
+    *out_response = out;
+    *out_len = n;
+    return 0;
+}
+
+/**
+ * @brief Compress a complete response for storage, if it is worth it.
+ *
+ * @param response Complete HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param out_response Output pointer to the compressed response; it is not
+ * changed if the response is stored as is. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_response.
+ * @return int 1 if the response is compressed; 0 otherwise.
+ */
+int compress_response(const char* response,
+                      int len,
+                      char** out_response,
+                      int* out_len)
+{
+    static const enum http_header drop[] = {HTTP_HEADER_CONTENT_LENGTH,
+                                            HTTP_HEADER_UNKNOWN};
+    const char* value;
+    int value_len;
+    int head_len;
+    int body_len;
+    unsigned char* body;
+    char extra[128];
+    z_stream zs;
+    double start = cpu_ns();
+    int ret;
+
+    if (response == NULL || out_response == NULL || out_len == NULL) {
+        return 0;
+    }
+    head_len = get_head_len(response, len);
+    body_len = len - head_len;
+    if (head_len < 0 ||
+        body_len < COMPRESS_MIN_BODY ||
+        get_status_code(response, len) != 200 ||
+        !find_header_field(response, len, HTTP_HEADER_CONTENT_LENGTH,
+                           &value, &value_len) ||
+        atoi(value) != body_len ||
+        find_header_field(response, len, HTTP_HEADER_CONTENT_ENCODING,
+                          &value, &value_len) ||
+        find_header_field(response, len, HTTP_HEADER_TRANSFER_ENCODING,
+                          &value, &value_len) ||
+        !compress_is_textual(response, len)) {
+        (stats.skipped)++;
+        return 0;
+    }
+
+    /* Window bits of 15 + 16 write a gzip header and trailer. */
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, COMPRESS_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOG_ERROR("deflateInit2");
+        return 0;
+    }
+    body = malloc(deflateBound(&zs, body_len));
+    if (body == NULL) {
+        PLOG_ERROR("malloc");
+        deflateEnd(&zs);
+        return 0;
+    }
+    zs.next_in = (unsigned char*)response + head_len;
+    zs.avail_in = body_len;
+    zs.next_out = body;
+    zs.avail_out = deflateBound(&zs, body_len);
+    ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END || zs.total_out > (uLong)(body_len - body_len / 8)) {
+        /* Not worth the decompression on hits. */
+        free(body);
+        (stats.skipped)++;
+        stats.compress_ns += cpu_ns() - start;
+        return 0;
+    }
+
+    sprintf(extra,
+            "Content-Encoding: gzip\r\nContent-Length: %lu\r\n",
+            zs.total_out);
+    ret = build_response(response, head_len, drop, 1, extra,
+                         (char*)body, zs.total_out, out_response, out_len);
+    free(body);
+    if (ret < 0) {
+        return 0;
+    }
+    (stats.objects)++;
+    stats.raw_bytes += len;
+    stats.stored_bytes += *out_len;
+    stats.compress_ns += cpu_ns() - start;
+    return 1;
+}
+
+/**
+ * @brief Check whether the client of a request accepts gzip content coding.
+ *
+ * @param request HTTP request head; it need not be null-terminated.
+ * @param len Byte size of request.
+ * @return int 1 if Accept-Encoding lists gzip with a non-zero q value; 0
+ * otherwise.
+ */
+int compress_accepts_gzip(const char* request, int len)
+{
+    const char* st;
+    const char* end;
+    int value_len;
+
+    if (request == NULL ||
+        !find_header_field(request, len, HTTP_HEADER_ACCEPT_ENCODING,
+                           &st, &value_len)) {
+        return 0;
+    }
+    end = st + value_len;
+    while (st < end) {
+        const char* item_end = memchr(st, ',', end - st);
+        const char* q;
+
+        if (item_end == NULL) {
+            item_end = end;
+        }
+        while (st < item_end && *st == ' ') {
+            st++;
+        }
+        if (item_end - st >= 4 &&
+            strncasecmp(st, "gzip", 4) == 0 &&
+            (st + 4 == item_end || st[4] == ';' || st[4] == ' ')) {
+            /* "gzip;q=0" explicitly refuses gzip. */
+            q = memchr(st, '=', item_end - st);
+            return q == NULL || strtod(q + 1, NULL) > 0;
+        }
+        st = item_end + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prepare a cached response for a client.
+ *
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param accepts_gzip 1 if the client accepts gzip; 0 otherwise.
+ * @param out_response Output pointer to the decompressed response; it is not
+ * changed unless 1 is returned. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_response.
+ * @return int 1 if the response is decompressed; 0 if it is served as stored;
+ * -1 if it cannot be decompressed.
+ */
+int compress_serve(const char* response,
+                   int len,
+                   int accepts_gzip,
+                   char** out_response,
+                   int* out_len)
+{
+    static const enum http_header drop[] = {HTTP_HEADER_CONTENT_LENGTH,
+                                            HTTP_HEADER_CONTENT_ENCODING,
+                                            HTTP_HEADER_UNKNOWN};
+    const char* value;
+    int value_len;
+    int head_len;
+    int body_len;
+    const unsigned char* body;
+    uint32_t raw_len;
+    unsigned char* raw;
+    char extra[64];
+    z_stream zs;
+    double start;
+    int ret;
+
+    if (response == NULL ||
+        !find_header_field(response, len, HTTP_HEADER_CONTENT_ENCODING,
+                           &value, &value_len) ||
+        value_len != 4 ||
+        strncasecmp(value, "gzip", 4) != 0) {
+        return 0;
+    }
+    if (accepts_gzip) {
+        (stats.hits_direct)++;
+        return 0;
+    }
+
+    start = cpu_ns();
+    head_len = get_head_len(response, len);
+    body_len = len - head_len;
+    if (head_len < 0 || body_len < 18) {
+        /* Shorter than an empty gzip member. */
+        return -1;
+    }
+    /* The gzip trailer ends with the decompressed size mod 2^32. */
+    body = (const unsigned char*)response + head_len;
+    raw_len = body[body_len - 4] |
+              (uint32_t)body[body_len - 3] << 8 |
+              (uint32_t)body[body_len - 2] << 16 |
+              (uint32_t)body[body_len - 1] << 24;
+    if (raw_len > COMPRESS_MAX_RAW) {
+        return -1;
+    }
+    raw = malloc(raw_len + 1);
+    if (raw == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK) {
+        LOG_ERROR("inflateInit2");
+        free(raw);
+        return -1;
+    }
+    zs.next_in = (unsigned char*)body;
+    zs.avail_in = body_len;
+    zs.next_out = raw;
+    zs.avail_out = raw_len + 1; /* One spare byte detects a wrong size. */
+    ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END || zs.total_out != raw_len) {
+        LOG_ERROR("cannot decompress cached response");
+        free(raw);
+        return -1;
+    }
+
+    sprintf(extra, "Content-Length: %u\r\n", raw_len);
+    ret = build_response(response, head_len, drop, 0, extra,
+                         (char*)raw, raw_len, out_response, out_len);
+    free(raw);
+    if (ret < 0) {
+        return -1;
+    }
+    (stats.hits_inflated)++;
+    stats.inflate_ns += cpu_ns() - start;
+    return 1;
+}
+
+/**
+ * @brief Get statistics of compression.
+ *
+ * @param out_stats Output; compression statistics, non-null.
+ */
+void compress_get_stats(struct compress_stats* out_stats)
+{
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+}
+
+/**
+ * @brief Print compression statistics, including the gain of cache capacity
+ * and the CPU cost per hit.
+ */
+void compress_log_stats(void)
+{
+    long hits = stats.hits_direct + stats.hits_inflated;
+
+    LOG_INFO("compression stats:\n"
+             "- compressed responses: %ld (%ld stored as is)\n"
+             "- bytes: %ld raw, %ld stored (%.2fx capacity)\n"
+             "- compression cpu: %.1f us/response\n"
+             "- compressed hits: %ld served as stored, %ld decompressed\n"
+             "- decompression cpu: %.1f us/decompressed hit, "
+             "%.1f us/compressed hit",
+             stats.objects,
+             stats.skipped,
+             stats.raw_bytes,
+             stats.stored_bytes,
+             stats.stored_bytes > 0 ?
+             (double)stats.raw_bytes / stats.stored_bytes : 1.0,
+             stats.objects + stats.skipped > 0 ?
+             stats.compress_ns / 1e3 / (stats.objects + stats.skipped) : 0.0,
+             stats.hits_direct,
+             stats.hits_inflated,
+             stats.hits_inflated > 0 ?
+             stats.inflate_ns / 1e3 / stats.hits_inflated : 0.0,
+             hits > 0 ? stats.inflate_ns / 1e3 / hits : 0.0);
+}
@@ -0,0 +1,142 @@
+/**************************************************************
+*
+*                         compress.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-17
+*
+*     Summary:
+*     Interface for gzip storage of compressible responses in
+*     cache.
+*
+**************************************************************/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "http_headers.h"
+
+#define COMPRESS_LEVEL 1 /* zlib level; the fastest one. */
+#define COMPRESS_MIN_BODY 256 /* Smallest body worth compressing. */
+#define COMPRESS_VARY_EXTRA 32 /* Max bytes compress_copy_field() adds to the
+                                * first Vary line of a head. */
+
+struct compress_stats {
+    long objects; /* Number of responses stored compressed. */
+    long skipped; /* Number of responses stored as is. */
+    long raw_bytes; /* Byte size of compressed responses before
+                     * compression. */
+    long stored_bytes; /* Byte size of compressed responses as stored. */
+    double compress_ns; /* CPU time spent on compression. */
+    long hits_direct; /* Number of compressed hits served as stored. */
+    long hits_inflated; /* Number of compressed hits decompressed for clients
+                         * that do not accept gzip. */
+    double inflate_ns; /* CPU time spent on decompression. */
+};
+
+/**
+ * @brief Compress a complete response for storage, if it is worth it.
+ *
+ * Only "200 OK" responses with a Content-Length, no Content-Encoding, a body
+ * of at least COMPRESS_MIN_BODY bytes and a textual Content-Type (text,
+ * JSON, JavaScript, XML or SVG) are compressed, and only if gzip saves at
+ * least 1/8 of the body. The compressed response carries
+ * "Content-Encoding: gzip", its own Content-Length, Accept-Encoding in its
+ * Vary field and a weak ETag.
+ *
+ * @param response Complete HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param out_response Output pointer to the compressed response; it is not
+ * changed if the response is stored as is. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_response.
+ * @return int 1 if the response is compressed; 0 otherwise.
+ */
+int compress_response(const char* response,
+                      int len,
+                      char** out_response,
+                      int* out_len);
+
+/**
+ * @brief Check whether the client of a request accepts gzip content coding.
+ *
+ * @param request HTTP request head; it need not be null-terminated.
+ * @param len Byte size of request.
+ * @return int 1 if Accept-Encoding lists gzip with a non-zero q value; 0
+ * otherwise.
+ */
+int compress_accepts_gzip(const char* request, int len);
+
+/**
+ * @brief Copy a header line of a response into the head of a response whose
+ * body the proxy changed. A strong ETag becomes weak, as the bytes differ.
+ * If the new body is gzip coded, the first Vary field gets Accept-Encoding
+ * unless it lists it or "*".
+ *
+ * A line grows by at most 2 bytes for an ETag, which is at least 8 bytes
+ * long, and COMPRESS_VARY_EXTRA bytes for the first Vary field.
+ *
+ * @param line Header line, with its line ending.
+ * @param line_len Byte size of line.
+ * @param header Field name of line.
+ * @param value Field value within line.
+ * @param value_len Byte size of value.
+ * @param gzip 1 if the new body is gzip coded; 0 otherwise.
+ * @param io_vary Input and output; 1 once a Vary field was copied.
+ * @param out Output buffer.
+ * @return int Byte size written to out.
+ */
+int compress_copy_field(const char* line,
+                        int line_len,
+                        enum http_header header,
+                        const char* value,
+                        int value_len,
+                        int gzip,
+                        int* io_vary,
+                        char* out);
+
+/**
+ * @brief Check whether a response has a textual, i.e. compressible, content
+ * type.
+ *
+ * @param response HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @return int 1 if it is textual; 0 otherwise.
+ */
+int compress_is_textual(const char* response, int len);
+
+/**
+ * @brief Prepare a cached response for a client.
+ *
+ * A gzip coded response is served as stored to a client that accepts gzip,
+ * and decompressed for other clients. Other responses are served as stored.
+ *
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param accepts_gzip 1 if the client accepts gzip; 0 otherwise.
+ * @param out_response Output pointer to the decompressed response; it is not
+ * changed unless 1 is returned. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_response.
+ * @return int 1 if the response is decompressed; 0 if it is served as stored;
+ * -1 if it cannot be decompressed.
+ */
+int compress_serve(const char* response,
+                   int len,
+                   int accepts_gzip,
+                   char** out_response,
+                   int* out_len);
+
+/**
+ * @brief Get statistics of compression.
+ *
+ * @param out_stats Output; compression statistics, non-null.
+ */
+void compress_get_stats(struct compress_stats* out_stats);
+
+/**
+ * @brief Print compression statistics, including the gain of cache capacity
+ * and the CPU cost per hit.
+ */
+void compress_log_stats(void);
+
+#endif /* COMPRESS_H */
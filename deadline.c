@@ -0,0 +1,399 @@
+/**************************************************************
+*
+*                         deadline.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-21
+*
+*     Summary:
+*     Implementation for per-phase socket deadlines.
+*
+**************************************************************/
+
+#include "deadline.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+/* Names of reasons, indexed by enum deadline_reason. */
+static const char* reason_names[DEADLINE_NUM_REASONS] = {
+    "header", "body", "rate", "connect", "first_byte", "idle",
+};
+
+static struct deadline_config config; /* Deadlines of each phase. */
+static int heap[FD_SETSIZE]; /* FDs in a min-heap by deadline. */
+static int heap_len = 0; /* Number of FDs in heap. */
+static int pos[FD_SETSIZE]; /* 1 + index of each FD in heap; 0 if absent, so
+                             * the heap starts empty. */
+static time_t when[FD_SETSIZE]; /* Deadline of each FD in heap. */
+static int reasons[FD_SETSIZE]; /* enum deadline_reason of each FD in
+                                 * heap. */
+static struct deadline_stats stats; /* Sockets closed for each reason. */
+
+/**
+ * @brief Fill a configuration with the default deadlines.
+ *
+ * @param config Output; configuration.
+ */
+void deadline_init_config(struct deadline_config* config)
+{
+    config->header = DEADLINE_HEADER;
+    config->body = DEADLINE_BODY;
+    config->min_rate = DEADLINE_MIN_RATE;
+    config->connect = DEADLINE_CONNECT;
+    config->first_byte = DEADLINE_FIRST_BYTE;
+    config->idle = DEADLINE_IDLE;
+    config->tunnel = DEADLINE_TUNNEL;
+}
+
+/**
+ * @brief Set one deadline of a configuration from an option.
+ *
+ * @param config Configuration, non-null.
+ * @param option "<name>=<value>", where name is header, body, rate, connect,
+ * first_byte, idle or tunnel, and value is in seconds, or bytes/sec for rate.
+ * A value of 0 turns the deadline off.
+ * @return int 0 on success; -1 if the option is malformed.
+ */
+int deadline_parse_option(struct deadline_config* config, const char* option)
+{
+    const char* sep = strchr(option, '=');
+    char name[16];
+    char* end = NULL;
+    long value;
+
+    if (sep == NULL || sep - option >= (int)sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, option, sep - option);
+    name[sep - option] = '\0';
+    value = strtol(sep + 1, &end, 10);
+    if (end == sep + 1 || *end != '\0' || value < 0 || value > INT_MAX) {
+        return -1;
+    }
+
+    if (strcmp(name, "header") == 0) {
+        config->header = value;
+    }
+    else if (strcmp(name, "body") == 0) {
+        config->body = value;
+    }
+    else if (strcmp(name, "rate") == 0) {
+        config->min_rate = value;
+    }
+    else if (strcmp(name, "connect") == 0) {
+        config->connect = value;
+    }
+    else if (strcmp(name, "first_byte") == 0) {
+        config->first_byte = value;
+    }
+    else if (strcmp(name, "idle") == 0) {
+        config->idle = value;
+    }
+    else if (strcmp(name, "tunnel") == 0) {
+        config->tunnel = value;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Take a deadline if it is on and earlier than the best so far.
+ *
+ * @param seconds Seconds after base; 0 if the deadline is off.
+ * @param base Time the deadline counts from.
+ * @param reason enum deadline_reason of the deadline.
+ * @param best Input and output; earliest deadline; 0 if none.
+ * @param best_reason Input and output; reason of best.
+ */
+static void take_earliest(long seconds,
+                          time_t base,
+                          int reason,
+                          time_t* best,
+                          int* best_reason)
+{
+    if (seconds <= 0) {
+        return;
+    }
+    if (*best == 0 || base + seconds < *best) {
+        *best = base + seconds;
+        *best_reason = reason;
+    }
+}
+
+/**
+ * @brief Get the deadline of a socket in a phase.
+ *
+ * @param config Configuration, non-null.
+ * @param phase enum deadline_phase of the socket.
+ * @param start Time the phase started.
+ * @param last_input Time of the last input or output of the socket.
+ * @param bytes Byte size received in the phase.
+ * @param out_reason Output; enum deadline_reason of the deadline.
+ * @return time_t Time after which the socket is closed; 0 if none.
+ */
+time_t deadline_of(const struct deadline_config* config,
+                   int phase,
+                   time_t start,
+                   time_t last_input,
+                   long bytes,
+                   int* out_reason)
+{
+    time_t best = 0;
+
+    *out_reason = DEADLINE_REASON_IDLE;
+    switch (phase) {
+    case DEADLINE_PHASE_HEAD:
+        /* Counted from the first byte, so trickling bytes does not extend
+         * it. */
+        take_earliest(config->header, start, DEADLINE_REASON_HEADER,
+                      &best, out_reason);
+        break;
+    case DEADLINE_PHASE_IDLE:
+        take_earliest(config->idle, last_input, DEADLINE_REASON_IDLE,
+                      &best, out_reason);
+        break;
+    case DEADLINE_PHASE_FIRST_BYTE:
+        take_earliest(config->first_byte, start, DEADLINE_REASON_FIRST_BYTE,
+                      &best, out_reason);
+        break;
+    case DEADLINE_PHASE_BODY:
+        take_earliest(config->body, last_input, DEADLINE_REASON_BODY,
+                      &best, out_reason);
+        /* Each byte buys 1 / min_rate seconds past the grace period. */
+        if (config->min_rate > 0) {
+            take_earliest(DEADLINE_RATE_GRACE + bytes / config->min_rate,
+                          start,
+                          DEADLINE_REASON_RATE,
+                          &best,
+                          out_reason);
+        }
+        break;
+    case DEADLINE_PHASE_TUNNEL:
+        take_earliest(config->tunnel, last_input, DEADLINE_REASON_IDLE,
+                      &best, out_reason);
+        break;
+    default:
+        break;
+    }
+    return best;
+}
+
+/**
+ * @brief Whether the deadline at heap index i is earlier than at index j.
+ */
+static int heap_less(int i, int j)
+{
+    return when[heap[i]] < when[heap[j]];
+}
+
+/**
+ * @brief Swap two entries of the heap and update their indices.
+ */
+static void heap_swap(int i, int j)
+{
+    int fd = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = fd;
+    pos[heap[i]] = i + 1;
+    pos[heap[j]] = j + 1;
+}
+
+/**
+ * @brief Move an entry of the heap up or down to its place.
+ *
+ * @param i Index of the entry.
+ */
+static void heap_fix(int i)
+{
+    while (i > 0 && heap_less(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= heap_len) {
+            break;
+        }
+        if (child + 1 < heap_len && heap_less(child + 1, child)) {
+            child++;
+        }
+        if (!heap_less(child, i)) {
+            break;
+        }
+        heap_swap(i, child);
+        i = child;
+    }
+}
+
+/**
+ * @brief Clear all deadlines and statistics, and use a configuration.
+ *
+ * @param new_config Configuration; NULL for the defaults.
+ */
+void deadline_init(const struct deadline_config* new_config)
+{
+    if (new_config != NULL) {
+        config = *new_config;
+    }
+    else {
+        deadline_init_config(&config);
+    }
+    heap_len = 0;
+    memset(pos, 0, sizeof(pos));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Set the deadline of a socket from its phase, replacing any earlier
+ * one.
+ *
+ * @param fd FD of the socket.
+ * @param phase enum deadline_phase of the socket.
+ * @param start Time the phase started.
+ * @param last_input Time of the last input or output of the socket.
+ * @param bytes Byte size received in the phase.
+ */
+void deadline_arm(int fd,
+                  int phase,
+                  time_t start,
+                  time_t last_input,
+                  long bytes)
+{
+    int reason;
+    time_t deadline;
+
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        return;
+    }
+    deadline = deadline_of(&config, phase, start, last_input, bytes, &reason);
+    if (deadline == 0) {
+        deadline_cancel(fd);
+        return;
+    }
+    when[fd] = deadline;
+    reasons[fd] = reason;
+    if (pos[fd] == 0) {
+        heap[heap_len++] = fd;
+        pos[fd] = heap_len;
+    }
+    heap_fix(pos[fd] - 1);
+}
+
+/**
+ * @brief Remove the deadline of a socket, if any.
+ *
+ * @param fd FD of the socket.
+ */
+void deadline_cancel(int fd)
+{
+    int i;
+
+    if (fd < 0 || fd >= FD_SETSIZE || pos[fd] == 0) {
+        return;
+    }
+    i = pos[fd] - 1;
+    heap_len--;
+    if (i != heap_len) {
+        heap_swap(i, heap_len);
+        heap_fix(i);
+    }
+    pos[fd] = 0;
+}
+
+/**
+ * @brief Get the earliest deadline.
+ *
+ * @param out_when Output; time of the earliest deadline.
+ * @return int FD of the socket with the earliest deadline; -1 if none.
+ */
+int deadline_next(time_t* out_when)
+{
+    if (heap_len == 0) {
+        return -1;
+    }
+    *out_when = when[heap[0]];
+    return heap[0];
+}
+
+/**
+ * @brief Remove an expired deadline, i.e. one before now, and count the
+ * socket as closed for its reason.
+ *
+ * @param now Current time.
+ * @param out_reason Output; enum deadline_reason of the deadline.
+ * @return int FD of the socket to close; -1 if no deadline expired.
+ */
+int deadline_expire(time_t now, int* out_reason)
+{
+    int fd;
+
+    if (heap_len == 0 || when[heap[0]] >= now) {
+        return -1;
+    }
+    fd = heap[0];
+    *out_reason = reasons[fd];
+    stats.kills[reasons[fd]]++;
+    deadline_cancel(fd);
+    return fd;
+}
+
+/**
+ * @brief Count a socket closed for a reason outside the heap, e.g. a connect
+ * that timed out.
+ *
+ * @param reason enum deadline_reason.
+ */
+void deadline_count(int reason)
+{
+    if (reason >= 0 && reason < DEADLINE_NUM_REASONS) {
+        stats.kills[reason]++;
+    }
+}
+
+/**
+ * @brief Get the name of a reason.
+ *
+ * @param reason enum deadline_reason.
+ * @return const char* Name, as in deadline_parse_option().
+ */
+const char* deadline_reason_name(int reason)
+{
+    if (reason < 0 || reason >= DEADLINE_NUM_REASONS) {
+        return "unknown";
+    }
+    return reason_names[reason];
+}
+
+/**
+ * @brief Get deadline statistics.
+ *
+ * @param out_stats Output; deadline statistics, non-null.
+ */
+void deadline_get_stats(struct deadline_stats* out_stats)
+{
+    *out_stats = stats;
+}
+
+/**
+ * @brief Print the number of sockets closed for each reason.
+ */
+void deadline_log_stats(void)
+{
+    LOG_INFO("deadline stats:\n"
+             "- closed sockets: %ld header, %ld body, %ld rate, "
+             "%ld connect, %ld first_byte, %ld idle",
+             stats.kills[DEADLINE_REASON_HEADER],
+             stats.kills[DEADLINE_REASON_BODY],
+             stats.kills[DEADLINE_REASON_RATE],
+             stats.kills[DEADLINE_REASON_CONNECT],
+             stats.kills[DEADLINE_REASON_FIRST_BYTE],
+             stats.kills[DEADLINE_REASON_IDLE]);
+}
@@ -0,0 +1,185 @@
+/**************************************************************
+*
+*                         deadline.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-21
+*
+*     Summary:
+*     Interface for per-phase socket deadlines.
+*
+*     Each socket is in one phase of its life, e.g. a client
+*     sending a request head or a server yet to answer, and
+*     each phase has its own deadline. Deadlines of all
+*     sockets are kept in a min-heap indexed by FD, so the
+*     proxy finds expired sockets without scanning them all.
+*
+**************************************************************/
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <time.h>
+
+#define DEADLINE_HEADER 10 /* Default seconds to receive a request head. */
+#define DEADLINE_BODY 30 /* Default seconds without progress of a response. */
+#define DEADLINE_MIN_RATE 512 /* Default min bytes/sec of a response. */
+#define DEADLINE_RATE_GRACE 10 /* Seconds of a response before its min rate
+                                * applies. */
+#define DEADLINE_CONNECT 5 /* Default seconds to connect a server. */
+#define DEADLINE_FIRST_BYTE 30 /* Default seconds for a server to start its
+                                * response. */
+#define DEADLINE_IDLE 75 /* Default seconds a keep-alive socket may idle. */
+#define DEADLINE_TUNNEL 600 /* Default seconds a CONNECT tunnel may idle. */
+
+enum deadline_phase {
+    DEADLINE_PHASE_HEAD = 0, /* Client sending a request head. */
+    DEADLINE_PHASE_IDLE, /* Between requests of a keep-alive socket. */
+    DEADLINE_PHASE_FIRST_BYTE, /* Server yet to start its response. */
+    DEADLINE_PHASE_BODY, /* Server sending its response. */
+    DEADLINE_PHASE_TUNNEL, /* Either end of a CONNECT tunnel. */
+};
+
+enum deadline_reason {
+    DEADLINE_REASON_HEADER = 0, /* Request head not complete in time. */
+    DEADLINE_REASON_BODY, /* Response made no progress in time. */
+    DEADLINE_REASON_RATE, /* Response slower than the min rate. */
+    DEADLINE_REASON_CONNECT, /* Server not connected in time. */
+    DEADLINE_REASON_FIRST_BYTE, /* Server did not start its response in
+                                 * time. */
+    DEADLINE_REASON_IDLE, /* Keep-alive socket or tunnel idle too long. */
+    DEADLINE_NUM_REASONS, /* Number of reasons. */
+};
+
+struct deadline_config {
+    int header; /* Seconds to receive a request head from its first byte, or
+                 * from accept. */
+    int body; /* Seconds a response may go without a byte. */
+    long min_rate; /* Min bytes/sec of a response, averaged from its first
+                    * byte, after DEADLINE_RATE_GRACE seconds. */
+    int connect; /* Seconds to connect a server. */
+    int first_byte; /* Seconds from a request to the first byte of its
+                     * response. */
+    int idle; /* Seconds a keep-alive socket may idle. */
+    int tunnel; /* Seconds a CONNECT tunnel may idle. */
+};
+
+struct deadline_stats {
+    long kills[DEADLINE_NUM_REASONS]; /* Number of sockets closed for each
+                                       * enum deadline_reason. */
+};
+
+/**
+ * @brief Fill a configuration with the default deadlines.
+ *
+ * @param config Output; configuration.
+ */
+void deadline_init_config(struct deadline_config* config);
+
+/**
+ * @brief Set one deadline of a configuration from an option.
+ *
+ * @param config Configuration, non-null.
+ * @param option "<name>=<value>", where name is header, body, rate, connect,
+ * first_byte, idle or tunnel, and value is in seconds, or bytes/sec for rate.
+ * A value of 0 turns the deadline off.
+ * @return int 0 on success; -1 if the option is malformed.
+ */
+int deadline_parse_option(struct deadline_config* config, const char* option);
+
+/**
+ * @brief Get the deadline of a socket in a phase.
+ *
+ * @param config Configuration, non-null.
+ * @param phase enum deadline_phase of the socket.
+ * @param start Time the phase started.
+ * @param last_input Time of the last input or output of the socket.
+ * @param bytes Byte size received in the phase.
+ * @param out_reason Output; enum deadline_reason of the deadline.
+ * @return time_t Time after which the socket is closed; 0 if none.
+ */
+time_t deadline_of(const struct deadline_config* config,
+                   int phase,
+                   time_t start,
+                   time_t last_input,
+                   long bytes,
+                   int* out_reason);
+
+/**
+ * @brief Clear all deadlines and statistics, and use a configuration.
+ *
+ * @param config Configuration; NULL for the defaults.
+ */
+void deadline_init(const struct deadline_config* config);
+
+/**
+ * @brief Set the deadline of a socket from its phase, replacing any earlier
+ * one.
+ *
+ * @param fd FD of the socket.
+ * @param phase enum deadline_phase of the socket.
+ * @param start Time the phase started.
+ * @param last_input Time of the last input or output of the socket.
+ * @param bytes Byte size received in the phase.
+ */
+void deadline_arm(int fd,
+                  int phase,
+                  time_t start,
+                  time_t last_input,
+                  long bytes);
+
+/**
+ * @brief Remove the deadline of a socket, if any.
+ *
+ * @param fd FD of the socket.
+ */
+void deadline_cancel(int fd);
+
+/**
+ * @brief Get the earliest deadline.
+ *
+ * @param out_when Output; time of the earliest deadline.
+ * @return int FD of the socket with the earliest deadline; -1 if none.
+ */
+int deadline_next(time_t* out_when);
+
+/**
+ * @brief Remove an expired deadline, i.e. one before now, and count the
+ * socket as closed for its reason.
+ *
+ * @param now Current time.
+ * @param out_reason Output; enum deadline_reason of the deadline.
+ * @return int FD of the socket to close; -1 if no deadline expired.
+ */
+int deadline_expire(time_t now, int* out_reason);
+
+/**
+ * @brief Count a socket closed for a reason outside the heap, e.g. a connect
+ * that timed out.
+ *
+ * @param reason enum deadline_reason.
+ */
+void deadline_count(int reason);
+
+/**
+ * @brief Get the name of a reason.
+ *
+ * @param reason enum deadline_reason.
+ * @return const char* Name, as in deadline_parse_option().
+ */
+const char* deadline_reason_name(int reason);
+
+/**
+ * @brief Get deadline statistics.
+ *
+ * @param out_stats Output; deadline statistics, non-null.
+ */
+void deadline_get_stats(struct deadline_stats* out_stats);
+
+/**
+ * @brief Print the number of sockets closed for each reason.
+ */
+void deadline_log_stats(void);
+
+#endif /* DEADLINE_H */
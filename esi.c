@@ -0,0 +1,562 @@
+/**************************************************************
+*
+*                           esi.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-06
+*
+*     Summary:
+*     Implementation for assembling pages from a shell and
+*     cached fragments with Edge Side Includes.
+*
+*     Literal parts point into the copy of the shell body, and
+*     each include owns the body of its fragment until it goes
+*     out, so a page holds the shell and the fragments not yet
+*     handed to the client.
+*
+**************************************************************/
+
+#define _GNU_SOURCE /* For memmem(). */
+
+#include "esi.h"
+#include "compress.h"
+#include "http_utils.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define ESI_TAG "<esi:include" /* Start of an include. */
+#define ESI_END_TAG "</esi:include>" /* End of an include that is not
+                                      * self-closing. */
+#define ESI_MAX_PARTS (2 * ESI_MAX_INCLUDES + 1) /* Max number of parts. */
+
+/* A part of a page. */
+struct esi_part {
+    char* src; /* src of an include; NULL for a literal part. */
+    const char* data; /* Bytes of the part. */
+    char* owned; /* Bytes of an include, owned by the part; NULL if none. */
+    int len; /* Byte size of data. */
+    int ready; /* Whether the part may go out. */
+};
+
+struct esi_page {
+    char* body; /* Copy of the body of the shell. */
+    struct esi_part parts[ESI_MAX_PARTS]; /* Parts in page order. */
+    int num_parts; /* Number of parts. */
+    int next; /* Index of the first part not handed out. */
+    int done; /* Whether the last chunk was handed out. */
+    long sent; /* Bytes of the body handed out, with their framing. */
+};
+
+static struct esi_stats stats; /* Statistics of pages. */
+
+/**
+ * @brief Check whether a response is the shell of a page.
+ *
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ * @return int 1 if it is a "200 OK" response whose Surrogate-Control has
+ * content="ESI/1.0"; 0 otherwise.
+ */
+int esi_is_shell(const char* response, int head_len)
+{
+    static const char token[] = "content=\"ESI/1.0\"";
+    const char* value;
+    int value_len;
+
+    if (get_status_code(response, head_len) != 200 ||
+        !find_header_field(response, head_len, HTTP_HEADER_SURROGATE_CONTROL,
+                           &value, &value_len)) {
+        return 0;
+    }
+    for (int i = 0; i + (int)sizeof(token) - 1 <= value_len; ++i) {
+        if (strncasecmp(value + i, token, sizeof(token) - 1) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Append a part to a page.
+ *
+ * @param page Page.
+ * @param src src of an include, null-terminated copy; NULL for a literal
+ * part.
+ * @param data Bytes of a literal part.
+ * @param len Byte size of data.
+ */
+static void add_part(struct esi_page* page,
+                     char* src,
+                     const char* data,
+                     int len)
+{
+    struct esi_part* part = &page->parts[page->num_parts++];
+
+    part->src = src;
+    part->data = data;
+    part->len = len;
+    part->ready = src == NULL;
+}
+
+/**
+ * @brief Decode a complete chunked body.
+ *
+ * @param body Chunked body.
+ * @param len Byte size of body.
+ * @param out Output; decoded bytes; at least len bytes.
+ * @return int Byte size of out; -1 if body is malformed or cut.
+ */
+static int dechunk(const char* body, int len, char* out)
+{
+    const char* p = body;
+    const char* end = body + len;
+    const char* line_end;
+    char* q;
+    long size;
+    int n = 0;
+
+    for (;;) {
+        /* The size line ends before the end of body, so strtol() stops. */
+        line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL) {
+            return -1;
+        }
+        size = strtol(p, &q, 16);
+        if (q == p || size < 0) {
+            return -1;
+        }
+        p = line_end + 1;
+        if (size == 0) {
+            return n;
+        }
+        if (end - p < size + 2) {
+            return -1;
+        }
+        memcpy(out + n, p, size);
+        n += size;
+        p += size + 2;
+    }
+}
+
+/**
+ * @brief Decode the body of a complete response from gzip and chunked
+ * framing.
+ *
+ * @param response Complete response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param out_body Output pointer to the body, null-terminated. Caller is
+ * responsible to free it.
+ * @param out_len Output; byte size of *out_body.
+ * @return int 0 on success; -1 if response is malformed or cut.
+ */
+static int decode_body(const char* response,
+                       int len,
+                       char** out_body,
+                       int* out_len)
+{
+    char* raw = NULL;
+    int raw_len;
+    const char* value;
+    int value_len;
+    int head_len;
+    char* body;
+    int body_len;
+
+    if (compress_serve(response, len, 0, &raw, &raw_len) < 0) {
+        return -1;
+    }
+    if (raw != NULL) {
+        response = raw;
+        len = raw_len;
+    }
+    head_len = get_head_len(response, len);
+    if (head_len < 0 || (body = malloc(len - head_len + 1)) == NULL) {
+        free(raw);
+        return -1;
+    }
+    if (find_header_field(response, head_len, HTTP_HEADER_TRANSFER_ENCODING,
+                          &value, &value_len)) {
+        body_len = dechunk(response + head_len, len - head_len, body);
+    }
+    else {
+        body_len = len - head_len;
+        memcpy(body, response + head_len, body_len);
+    }
+    free(raw);
+    if (body_len < 0) {
+        free(body);
+        return -1;
+    }
+    body[body_len] = '\0';
+    *out_body = body;
+    *out_len = body_len;
+    return 0;
+}
+
+/**
+ * @brief Split the body of a shell into parts. The body is decoded from gzip
+ * and chunked framing.
+ *
+ * @param response Complete shell response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param out_page Output pointer to the page, which keeps the decoded body.
+ * Caller is responsible to free it with esi_free().
+ * @return int Number of includes; -1 if the response or an include is
+ * malformed, or the shell has more than ESI_MAX_INCLUDES.
+ */
+int esi_parse(const char* response, int len, struct esi_page** out_page)
+{
+    struct esi_page* page = calloc(1, sizeof(*page));
+    const char* st;
+    const char* end;
+    const char* tag;
+    const char* tag_end;
+    const char* src;
+    const char* src_end;
+    int includes = 0;
+
+    if (page == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
+    }
+    if (decode_body(response, len, &page->body, &len) < 0) {
+        free(page);
+        return -1;
+    }
+    st = page->body;
+    end = page->body + len;
+    while ((tag = memmem(st, end - st, ESI_TAG, strlen(ESI_TAG))) != NULL) {
+        tag_end = memchr(tag, '>', end - tag);
+        if (tag_end == NULL || includes == ESI_MAX_INCLUDES) {
+            esi_free(page);
+            return -1;
+        }
+        src = memmem(tag, tag_end - tag, "src=\"", 5);
+        src_end = src != NULL ? memchr(src + 5, '"', tag_end - src - 5) : NULL;
+        if (src_end == NULL || src_end == src + 5) {
+            esi_free(page);
+            return -1;
+        }
+        add_part(page, NULL, st, tag - st);
+        add_part(page, strndup(src + 5, src_end - src - 5), NULL, 0);
+        if (page->parts[page->num_parts - 1].src == NULL) {
+            PLOG_FATAL("strndup");
+        }
+        includes++;
+        st = tag_end + 1;
+        if (tag_end[-1] != '/' &&
+            end - st >= (int)strlen(ESI_END_TAG) &&
+            memcmp(st, ESI_END_TAG, strlen(ESI_END_TAG)) == 0) {
+            st += strlen(ESI_END_TAG);
+        }
+    }
+    add_part(page, NULL, st, end - st);
+    (stats.pages)++;
+    stats.includes += includes;
+    *out_page = page;
+    return includes;
+}
+
+/**
+ * @brief Get the number of parts of a page.
+ *
+ * @param page Page.
+ * @return int Number of parts, literal and included.
+ */
+int esi_num_parts(const struct esi_page* page)
+{
+    return page->num_parts;
+}
+
+/**
+ * @brief Get the bytes of the body of a page handed out so far.
+ *
+ * @param page Page.
+ * @return long Byte size, with the chunked framing.
+ */
+long esi_sent(const struct esi_page* page)
+{
+    return page->sent;
+}
+
+/**
+ * @brief Get the src of an include.
+ *
+ * @param page Page.
+ * @param part Index of a part.
+ * @return const char* Null-terminated src; NULL for a literal part.
+ */
+const char* esi_src(const struct esi_page* page, int part)
+{
+    return page->parts[part].src;
+}
+
+/**
+ * @brief Resolve the src of an include against the URL of its shell.
+ *
+ * @param src src of the include: an absolute "http://" URL, an absolute path
+ * or a relative path.
+ * @param base Absolute "http://" URL of the shell.
+ * @param out_url Output pointer to the absolute URL. Caller is responsible to
+ * free it.
+ * @param out_host Output pointer to the host of the URL, with its port if it
+ * has one. Caller is responsible to free it.
+ * @return int 0 on success; -1 if src or base is not of plain HTTP.
+ */
+int esi_resolve(const char* src,
+                const char* base,
+                char** out_url,
+                char** out_host)
+{
+    const char* path;
+    const char* dir_end; /* End of the directory of the path of base. */
+    char* url;
+    int prefix_len;
+
+    if (strncmp(base, "http://", 7) != 0 ||
+        (strstr(src, "://") != NULL && strncmp(src, "http://", 7) != 0)) {
+        return -1;
+    }
+    path = strchr(base + 7, '/');
+    if (strncmp(src, "http://", 7) == 0) {
+        url = strdup(src);
+        if (url == NULL) {
+            PLOG_FATAL("strdup");
+        }
+    }
+    else {
+        if (path == NULL) {
+            /* The path of "http://host" is "/". */
+            prefix_len = strlen(base);
+        }
+        else if (src[0] == '/') {
+            prefix_len = path - base;
+        }
+        else {
+            dir_end = path + strcspn(path, "?#");
+            while (dir_end[-1] != '/') {
+                dir_end--;
+            }
+            prefix_len = dir_end - base;
+        }
+        url = malloc(prefix_len + strlen(src) + 2);
+        if (url == NULL) {
+            PLOG_FATAL("malloc");
+        }
+        sprintf(url, "%.*s%s%s",
+                prefix_len,
+                base,
+                path == NULL && src[0] != '/' ? "/" : "",
+                src);
+    }
+    *out_host = strndup(url + 7, strcspn(url + 7, "/?#"));
+    if (*out_host == NULL) {
+        PLOG_FATAL("strndup");
+    }
+    *out_url = url;
+    return 0;
+}
+
+/**
+ * @brief Fill an include with the body of its response. A response other
+ * than "200 OK" leaves the include empty. The body is decoded from gzip and
+ * chunked framing.
+ *
+ * @param page Page.
+ * @param part Index of an include.
+ * @param response Complete response; NULL if its fetch failed, which leaves
+ * the include empty.
+ * @param len Byte size of response.
+ * @param cached 1 if the response is from the cache; 0 from a server.
+ */
+void esi_fill(struct esi_page* page,
+              int part,
+              const char* response,
+              int len,
+              int cached)
+{
+    struct esi_part* p = &page->parts[part];
+
+    if (p->src == NULL || p->ready) {
+        return;
+    }
+    p->ready = 1;
+    if (response == NULL ||
+        get_status_code(response, len) != 200 ||
+        decode_body(response, len, &p->owned, &p->len) < 0) {
+        p->len = 0;
+        (stats.failed)++;
+        return;
+    }
+    p->data = p->owned;
+    if (cached) {
+        (stats.hits)++;
+    }
+    else {
+        (stats.fetches)++;
+    }
+}
+
+/**
+ * @brief Hand the sink each part not handed out yet, framed as chunks, up to
+ * the first include still pending, and the last chunk once all are out.
+ *
+ * @param page Page.
+ * @param sink Destination of the page.
+ * @param arg Argument of sink.
+ * @return int 1 if the whole page was handed out; 0 if an include is
+ * pending; -1 if the sink failed.
+ */
+int esi_drain(struct esi_page* page, esi_sink_fn sink, void* arg)
+{
+    struct esi_part* part;
+    char size_line[16];
+    int n;
+
+    while (page->next < page->num_parts) {
+        part = &page->parts[page->next];
+        if (!part->ready) {
+            (stats.waits)++;
+            return 0;
+        }
+        if (part->len > 0) {
+            n = sprintf(size_line, "%x\r\n", part->len);
+            if (sink(arg, size_line, n) < 0 ||
+                sink(arg, part->data, part->len) < 0 ||
+                sink(arg, "\r\n", 2) < 0) {
+                return -1;
+            }
+            page->sent += n + part->len + 2;
+        }
+        /* A fragment is no longer needed once it is out. */
+        free(part->owned);
+        part->owned = NULL;
+        part->data = NULL;
+        page->next++;
+    }
+    if (!page->done) {
+        if (sink(arg, "0\r\n\r\n", 5) < 0) {
+            return -1;
+        }
+        page->sent += 5;
+        page->done = 1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Build the head of an assembled page from the head of its shell.
+ *
+ * The page is uncoded and chunked, and has no Content-Length, ETag or
+ * Surrogate-Control.
+ *
+ * @param response Shell response.
+ * @param head_len Byte size of its head, including the empty line.
+ * @param out_head Output pointer to the head, without the empty line. Caller
+ * is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 otherwise.
+ */
+int esi_page_head(const char* response,
+                  int head_len,
+                  char** out_head,
+                  int* out_head_len)
+{
+    static const char chunked[] = "Transfer-Encoding: chunked\r\n";
+    const char* st = response;
+    const char* end = response + head_len - 2; /* Start of the empty line. */
+    const char* value;
+    enum http_header header;
+    int value_len;
+    int line_len;
+    char* out;
+    int n = 0;
+
+    out = malloc(head_len + sizeof(chunked));
+    if (out == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    while (st < end) {
+        line_len = parse_header_field(st, end + 2, &header, &value, &value_len);
+        if (line_len < 0) {
+            break;
+        }
+        /* Always keep the status line. */
+        if (st == response ||
+            (header != HTTP_HEADER_CONTENT_LENGTH &&
+             header != HTTP_HEADER_CONTENT_ENCODING &&
+             header != HTTP_HEADER_TRANSFER_ENCODING &&
+             header != HTTP_HEADER_ETAG &&
+             header != HTTP_HEADER_SURROGATE_CONTROL)) {
+            memcpy(out + n, st, line_len);
+            n += line_len;
+        }
+        st += line_len;
+    }
+    memcpy(out + n, chunked, sizeof(chunked) - 1);
+    n += sizeof(chunked) - 1;
+    *out_head = out;
+    *out_head_len = n;
+    return 0;
+}
+
+/**
+ * @brief Free a page.
+ *
+ * @param page Page; NULL for none.
+ */
+void esi_free(struct esi_page* page)
+{
+    if (page == NULL) {
+        return;
+    }
+    for (int i = 0; i < page->num_parts; ++i) {
+        free(page->parts[i].src);
+        free(page->parts[i].owned);
+    }
+    free(page->body);
+    free(page);
+}
+
+/**
+ * @brief Get statistics of pages.
+ *
+ * @param out_stats Output; page statistics, non-null.
+ */
+void esi_get_stats(struct esi_stats* out_stats)
+{
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+}
+
+/**
+ * @brief Clear statistics of pages.
+ */
+void esi_clear_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Print statistics of pages.
+ */
+void esi_log_stats(void)
+{
+    LOG_INFO("esi stats:\n"
+             "- pages: %ld assembled, %ld includes\n"
+             "- fragments: %ld from cache, %ld fetched, %ld failed\n"
+             "- waits on pending fragments: %ld",
+             stats.pages,
+             stats.includes,
+             stats.hits,
+             stats.fetches,
+             stats.failed,
+             stats.waits);
+}
@@ -0,0 +1,198 @@
+/**************************************************************
+*
+*                           esi.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-06
+*
+*     Summary:
+*     Interface for assembling pages from a shell and cached
+*     fragments with Edge Side Includes.
+*
+*     A shell is a "200 OK" response whose Surrogate-Control
+*     has content="ESI/1.0". Its body is split into literal
+*     parts and <esi:include src="..."/> parts. The shell and
+*     each fragment are requested and cached as responses of
+*     their own, under their own keys and max ages; a page
+*     only tracks which parts are ready, and hands the client
+*     every part up to the first one still pending.
+*
+**************************************************************/
+
+#ifndef ESI_H
+#define ESI_H
+
+#define ESI_MAX_INCLUDES 32 /* Max number of includes of a page. */
+
+/* Role of the response of a server in the assembly of pages. */
+enum esi_role {
+    ESI_NONE = 0, /* Not part of a page. */
+    ESI_MAYBE, /* Response to a GET that may be a shell, held until its head
+                * tells. */
+    ESI_SHELL, /* Shell of a page, held until it is complete. */
+    ESI_FRAGMENT, /* Fragment of the page of its client. */
+};
+
+struct esi_stats {
+    long pages; /* Number of pages assembled. */
+    long includes; /* Number of includes. */
+    long hits; /* Number of fragments found in the cache. */
+    long fetches; /* Number of fragments fetched from servers. */
+    long failed; /* Number of fragments left empty on a failed fetch, or a
+                  * response other than "200 OK". */
+    long waits; /* Number of times a page waited on a fragment, after the
+                 * parts before it went out. */
+};
+
+struct esi_page;
+
+/**
+ * @brief Hand bytes of an assembled page to its client.
+ *
+ * @param arg Argument given with the bytes.
+ * @param data Bytes.
+ * @param len Byte size of data, positive.
+ * @return int 0 on success; -1 to fail the page.
+ */
+typedef int (*esi_sink_fn)(void* arg, const char* data, int len);
+
+/**
+ * @brief Check whether a response is the shell of a page.
+ *
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ * @return int 1 if it is a "200 OK" response whose Surrogate-Control has
+ * content="ESI/1.0"; 0 otherwise.
+ */
+int esi_is_shell(const char* response, int head_len);
+
+/**
+ * @brief Split the body of a shell into parts. The body is decoded from gzip
+ * and chunked framing.
+ *
+ * @param response Complete shell response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @param out_page Output pointer to the page, which keeps the decoded body.
+ * Caller is responsible to free it with esi_free().
+ * @return int Number of includes; -1 if the response or an include is
+ * malformed, or the shell has more than ESI_MAX_INCLUDES.
+ */
+int esi_parse(const char* response, int len, struct esi_page** out_page);
+
+/**
+ * @brief Get the number of parts of a page.
+ *
+ * @param page Page.
+ * @return int Number of parts, literal and included.
+ */
+int esi_num_parts(const struct esi_page* page);
+
+/**
+ * @brief Get the bytes of the body of a page handed out so far.
+ *
+ * @param page Page.
+ * @return long Byte size, with the chunked framing.
+ */
+long esi_sent(const struct esi_page* page);
+
+/**
+ * @brief Get the src of an include.
+ *
+ * @param page Page.
+ * @param part Index of a part.
+ * @return const char* Null-terminated src; NULL for a literal part.
+ */
+const char* esi_src(const struct esi_page* page, int part);
+
+/**
+ * @brief Resolve the src of an include against the URL of its shell.
+ *
+ * @param src src of the include: an absolute "http://" URL, an absolute path
+ * or a relative path.
+ * @param base Absolute "http://" URL of the shell.
+ * @param out_url Output pointer to the absolute URL. Caller is responsible to
+ * free it.
+ * @param out_host Output pointer to the host of the URL, with its port if it
+ * has one. Caller is responsible to free it.
+ * @return int 0 on success; -1 if src or base is not of plain HTTP.
+ */
+int esi_resolve(const char* src,
+                const char* base,
+                char** out_url,
+                char** out_host);
+
+/**
+ * @brief Fill an include with the body of its response. A response other
+ * than "200 OK" leaves the include empty. The body is decoded from gzip and
+ * chunked framing.
+ *
+ * @param page Page.
+ * @param part Index of an include.
+ * @param response Complete response; NULL if its fetch failed, which leaves
+ * the include empty.
+ * @param len Byte size of response.
+ * @param cached 1 if the response is from the cache; 0 from a server.
+ */
+void esi_fill(struct esi_page* page,
+              int part,
+              const char* response,
+              int len,
+              int cached);
+
+/**
+ * @brief Hand the sink each part not handed out yet, framed as chunks, up to
+ * the first include still pending, and the last chunk once all are out.
+ *
+ * @param page Page.
+ * @param sink Destination of the page.
+ * @param arg Argument of sink.
+ * @return int 1 if the whole page was handed out; 0 if an include is
+ * pending; -1 if the sink failed.
+ */
+int esi_drain(struct esi_page* page, esi_sink_fn sink, void* arg);
+
+/**
+ * @brief Build the head of an assembled page from the head of its shell.
+ *
+ * The page is uncoded and chunked, and has no Content-Length, ETag or
+ * Surrogate-Control.
+ *
+ * @param response Shell response.
+ * @param head_len Byte size of its head, including the empty line.
+ * @param out_head Output pointer to the head, without the empty line. Caller
+ * is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 otherwise.
+ */
+int esi_page_head(const char* response,
+                  int head_len,
+                  char** out_head,
+                  int* out_head_len);
+
+/**
+ * @brief Free a page.
+ *
+ * @param page Page; NULL for none.
+ */
+void esi_free(struct esi_page* page);
+
+/**
+ * @brief Get statistics of pages.
+ *
+ * @param out_stats Output; page statistics, non-null.
+ */
+void esi_get_stats(struct esi_stats* out_stats);
+
+/**
+ * @brief Clear statistics of pages.
+ */
+void esi_clear_stats(void);
+
+/**
+ * @brief Print statistics of pages.
+ */
+void esi_log_stats(void);
+
+#endif /* ESI_H */
@@ -0,0 +1,241 @@
+/**************************************************************
+*
+*                          fairq.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-08
+*
+*     Summary:
+*     Implementation for the fair scheduling of ready sockets
+*     in the main loop.
+*
+*     Tags count bytes over weights. A flow keeps the finish
+*     tag of its last turn; a socket queued in a round starts
+*     at the later of that and the virtual clock, the start tag
+*     of the latest socket served.
+*
+**************************************************************/
+
+#include "fairq.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+/* Ready socket queued in a round. */
+struct fairq_entry {
+    int fd; /* FD of the socket. */
+    int flow; /* FD of the client of the socket. */
+    int bulk; /* Whether the socket is bulk. */
+    long start; /* Start tag. */
+};
+
+static long budget = FAIRQ_ROUND_KB * 1024L; /* Bulk data a round moves; 0
+                                              * for FD order. */
+static long finish[FD_SETSIZE]; /* Finish tag of each flow. */
+static long vclock = 0; /* Start tag of the latest socket served. */
+static struct fairq_entry queue[FD_SETSIZE]; /* Sockets of the round. */
+static int queue_len = 0; /* Number of sockets in queue. */
+static int next_index = 0; /* Index of the next socket in queue to serve. */
+static int current = -1; /* Index of the socket in service; -1 if none. */
+static int in_round = 0; /* Whether a round has started and not ended. */
+static int sorted = 0; /* Whether queue is in serving order. */
+static long round_used = 0; /* Bulk data moved in the round so far. */
+static int round_cut = 0; /* Whether the round left bulk sockets. */
+static struct fairq_stats stats; /* Statistics of scheduling. */
+
+/**
+ * @brief Compare two sockets by start tag, then by FD, for qsort().
+ */
+static int compare_tag(const void* a, const void* b)
+{
+    const struct fairq_entry* x = a;
+    const struct fairq_entry* y = b;
+
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+    return x->fd - y->fd;
+}
+
+/**
+ * @brief Compare two sockets by FD, for qsort().
+ */
+static int compare_fd(const void* a, const void* b)
+{
+    return ((const struct fairq_entry*)a)->fd -
+           ((const struct fairq_entry*)b)->fd;
+}
+
+/**
+ * @brief Forget all flows, clear statistics, and set the budget of a round.
+ *
+ * @param round_bytes Byte size of bulk data a round moves before it leaves
+ * the other bulk sockets to the next one; 0 to serve ready sockets in FD order
+ * without a budget.
+ */
+void fairq_init(long round_bytes)
+{
+    budget = round_bytes;
+    memset(finish, 0, sizeof(finish));
+    vclock = 0;
+    queue_len = 0;
+    next_index = 0;
+    current = -1;
+    in_round = 0;
+    sorted = 0;
+    round_used = 0;
+    round_cut = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Queue a ready socket in the current round.
+ *
+ * @param fd FD of the socket.
+ * @param flow FD of the client the socket serves, or the socket itself if it
+ * serves none, e.g. the listening socket.
+ * @param bulk Whether the socket is bulk.
+ */
+void fairq_add(int fd, int flow, int bulk)
+{
+    struct fairq_entry* entry;
+
+    if (fd < 0 || fd >= FD_SETSIZE || flow < 0 || flow >= FD_SETSIZE) {
+        LOG_ERROR("socket %d of flow %d out of range", fd, flow);
+        return;
+    }
+    if (!in_round) {
+        in_round = 1;
+        sorted = 0;
+        queue_len = 0;
+        next_index = 0;
+        round_used = 0;
+        round_cut = 0;
+        (stats.rounds)++;
+    }
+    if (queue_len == FD_SETSIZE) {
+        return;
+    }
+    entry = &queue[queue_len++];
+    entry->fd = fd;
+    entry->flow = flow;
+    entry->bulk = bulk;
+    entry->start = finish[flow] > vclock ? finish[flow] : vclock;
+}
+
+/**
+ * @brief Take the next socket to serve in the current round. Once it returns
+ * -1, the round is over, and the next fairq_add() starts a new one.
+ *
+ * @return int FD of the socket; -1 if the round is over.
+ */
+int fairq_next(void)
+{
+    struct fairq_entry* entry;
+
+    current = -1;
+    if (!in_round) {
+        return -1;
+    }
+    if (!sorted) {
+        qsort(queue, queue_len, sizeof(queue[0]),
+              budget > 0 ? compare_tag : compare_fd);
+        sorted = 1;
+    }
+    while (next_index < queue_len) {
+        entry = &queue[next_index++];
+        if (entry->bulk && budget > 0 && round_used >= budget) {
+            /* Still ready in the next round, which it is ahead in. */
+            (stats.deferred)++;
+            round_cut = 1;
+            continue;
+        }
+        current = entry - queue;
+        return entry->fd;
+    }
+    if (round_cut) {
+        (stats.cut)++;
+    }
+    in_round = 0;
+    return -1;
+}
+
+/**
+ * @brief Charge the turn of the socket fairq_next() returned last to its flow.
+ *
+ * @param bytes Byte size it read or sent; 0 if none, e.g. it was closed.
+ */
+void fairq_charge(int bytes)
+{
+    struct fairq_entry* entry;
+    long* tag;
+
+    if (current < 0) {
+        return;
+    }
+    entry = &queue[current];
+    tag = &finish[entry->flow];
+    if (*tag < entry->start) {
+        *tag = entry->start;
+    }
+    if (vclock < entry->start) {
+        vclock = entry->start;
+    }
+    if (entry->bulk) {
+        *tag += bytes / FAIRQ_WEIGHT_BULK;
+        round_used += bytes;
+        (stats.bulk)++;
+        stats.bulk_bytes += bytes;
+    }
+    else {
+        *tag += bytes / FAIRQ_WEIGHT_INTERACTIVE;
+        (stats.interactive)++;
+        stats.interactive_bytes += bytes;
+    }
+    current = -1;
+}
+
+/**
+ * @brief Forget a flow once its client is gone, so a new client on its FD
+ * starts afresh.
+ *
+ * @param flow FD of the client.
+ */
+void fairq_forget(int flow)
+{
+    if (flow >= 0 && flow < FD_SETSIZE) {
+        finish[flow] = 0;
+    }
+}
+
+/**
+ * @brief Get statistics of scheduling.
+ *
+ * @param out_stats Output; statistics, non-null.
+ */
+void fairq_get_stats(struct fairq_stats* out_stats)
+{
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+}
+
+/**
+ * @brief Print statistics of scheduling.
+ */
+void fairq_log_stats(void)
+{
+    LOG_INFO("scheduling stats:\n"
+             "- rounds: %ld, %ld cut short by the bulk budget\n"
+             "- interactive turns: %ld, %ld bytes\n"
+             "- bulk turns: %ld, %ld bytes, %ld deferred",
+             stats.rounds,
+             stats.cut,
+             stats.interactive,
+             stats.interactive_bytes,
+             stats.bulk,
+             stats.bulk_bytes,
+             stats.deferred);
+}
@@ -0,0 +1,108 @@
+/**************************************************************
+*
+*                          fairq.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-08
+*
+*     Summary:
+*     Interface for the fair scheduling of ready sockets in
+*     the main loop.
+*
+*     Each round of the main loop serves the sockets that
+*     select() found ready, one turn each, in the order of
+*     start-time fair queuing over flows: a flow is a client
+*     with the servers it talks to, and each turn advances the
+*     tag of its flow by the bytes it moved over the weight of
+*     the socket. A socket is interactive, e.g. a request head or a
+*     small response, until its phase has received more than
+*     FAIRQ_BULK_BYTES; then it is bulk, with a lower weight.
+*     A flow that was idle starts at the tag of the socket in
+*     service, so a new request goes ahead of bulk transfers
+*     that were busy all along. Bulk sockets are served while
+*     the round has moved less than its budget, and the rest
+*     wait for the next round; interactive ones are always
+*     served, so the loop polls again for new requests after a
+*     bounded amount of bulk work. A cached body larger than
+*     FAIRQ_QUANTUM is held for its client, which is sent a
+*     quantum of it per round as a bulk socket.
+*
+**************************************************************/
+
+#ifndef FAIRQ_H
+#define FAIRQ_H
+
+#define FAIRQ_ROUND_KB 64 /* Default KB of bulk data a round moves. */
+#define FAIRQ_BULK_BYTES (64 * 1024) /* Byte size a socket receives in its
+                                      * phase before it is bulk. */
+#define FAIRQ_QUANTUM (32 * 1024) /* Max byte size of a held response a
+                                   * client is sent per round. */
+#define FAIRQ_WEIGHT_INTERACTIVE 8 /* Weight of an interactive socket. */
+#define FAIRQ_WEIGHT_BULK 1 /* Weight of a bulk socket. */
+
+struct fairq_stats {
+    long rounds; /* Number of rounds with ready sockets. */
+    long cut; /* Number of rounds that left bulk sockets to the next one. */
+    long interactive; /* Number of interactive sockets served. */
+    long bulk; /* Number of bulk sockets served. */
+    long deferred; /* Number of ready bulk sockets left to a later round. */
+    long interactive_bytes; /* Byte size moved by interactive sockets. */
+    long bulk_bytes; /* Byte size moved by bulk sockets. */
+};
+
+/**
+ * @brief Forget all flows, clear statistics, and set the budget of a round.
+ *
+ * @param round_bytes Byte size of bulk data a round moves before it leaves
+ * the other bulk sockets to the next one; 0 to serve ready sockets in FD order
+ * without a budget.
+ */
+void fairq_init(long round_bytes);
+
+/**
+ * @brief Queue a ready socket in the current round.
+ *
+ * @param fd FD of the socket.
+ * @param flow FD of the client the socket serves, or the socket itself if it
+ * serves none, e.g. the listening socket.
+ * @param bulk Whether the socket is bulk.
+ */
+void fairq_add(int fd, int flow, int bulk);
+
+/**
+ * @brief Take the next socket to serve in the current round. Once it returns
+ * -1, the round is over, and the next fairq_add() starts a new one.
+ *
+ * @return int FD of the socket; -1 if the round is over.
+ */
+int fairq_next(void);
+
+/**
+ * @brief Charge the turn of the socket fairq_next() returned last to its flow.
+ *
+ * @param bytes Byte size it read or sent; 0 if none, e.g. it was closed.
+ */
+void fairq_charge(int bytes);
+
+/**
+ * @brief Forget a flow once its client is gone, so a new client on its FD
+ * starts afresh.
+ *
+ * @param flow FD of the client.
+ */
+void fairq_forget(int flow);
+
+/**
+ * @brief Get statistics of scheduling.
+ *
+ * @param out_stats Output; statistics, non-null.
+ */
+void fairq_get_stats(struct fairq_stats* out_stats);
+
+/**
+ * @brief Print statistics of scheduling.
+ */
+void fairq_log_stats(void);
+
+#endif /* FAIRQ_H */
@@ -0,0 +1,938 @@
+/**************************************************************
+*
+*                          filter.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-05
+*
+*     Summary:
+*     Implementation for the chain of streaming filters that
+*     transform response bodies on their way to clients.
+*
+*     A stream is a pipeline of stages: a deframer of the body
+*     as the server framed it, the filters that apply, and a
+*     framer of chunks. Each stage hands the next slices of
+*     bytes. The deframer and rewrite hand on slices of their
+*     input in place, and only gunzip, gzip and the framer copy
+*     into their windows.
+*
+**************************************************************/
+
+#include "filter.h"
+#include "compress.h"
+#include "http_utils.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#define FRAME_HEAD_LEN 10 /* Room for a hex chunk size and "\r\n". */
+#define FRAME_LAST "0\r\n\r\n" /* Last chunk, without trailers. */
+
+/* A filter of the chain. */
+struct filter_conf {
+    enum filter_kind kind; /* Kind of the filter. */
+    char* from; /* String replaced by rewrite. */
+    int from_len; /* Byte size of from. */
+    char* to; /* Replacement of from. */
+    int to_len; /* Byte size of to. */
+    int* fail; /* Failure function of from: fail[k] is the byte size of the
+                * longest proper prefix of from that ends from[0..k]. */
+};
+
+/* Kinds of stages of a stream. */
+enum stage_kind {
+    STAGE_LENGTH = 0, /* Deframe a body of a Content-Length. */
+    STAGE_CHUNKED, /* Deframe a chunked body. */
+    STAGE_GUNZIP, /* Filter FILTER_GUNZIP. */
+    STAGE_REWRITE, /* Filter FILTER_REWRITE. */
+    STAGE_GZIP, /* Filter FILTER_GZIP. */
+    STAGE_FRAME, /* Frame the body as chunks for the sink. */
+};
+
+/* States of the deframer of a chunked body. */
+enum chunked_state {
+    CHUNKED_SIZE = 0, /* In the hex size of a chunk. */
+    CHUNKED_EXT, /* In the rest of the size line. */
+    CHUNKED_DATA, /* In the data of a chunk. */
+    CHUNKED_DATA_CR, /* Before the "\r" after the data. */
+    CHUNKED_DATA_LF, /* Before the "\n" after the data. */
+    CHUNKED_TRAILER, /* At the start of a trailer line or the empty line. */
+    CHUNKED_TRAILER_LINE, /* In a trailer line. */
+    CHUNKED_TRAILER_LF, /* Before the "\n" of the empty line. */
+};
+
+/* A stage of a stream. */
+struct stage {
+    enum stage_kind kind; /* Kind of the stage. */
+    const struct filter_conf* conf; /* Filter of rewrite. */
+    long remaining; /* Deframers; bytes left of the body or the chunk. */
+    int state; /* STAGE_CHUNKED; enum chunked_state. */
+    int digits; /* STAGE_CHUNKED; number of hex digits of the size. */
+    int matched; /* STAGE_REWRITE; byte size of the prefix of from that ends
+                  * the bytes taken. */
+    int held; /* STAGE_REWRITE; bytes of the matched prefix taken in former
+               * slices, and not handed on. */
+    z_stream zs; /* STAGE_GUNZIP and STAGE_GZIP; zlib stream. */
+    int zs_open; /* Whether zs is initialized. */
+    int zs_end; /* STAGE_GUNZIP; whether the gzip stream ended. */
+    char* window; /* Gunzip and gzip; output window. STAGE_FRAME; chunk with
+                   * room for its size line before the data, and for its
+                   * "\r\n" and the last chunk after. */
+    int window_len; /* Byte size of bytes held in window. */
+};
+
+struct filter_stream {
+    struct stage stages[FILTER_MAX + 2]; /* Deframer, filters, framer. */
+    int num_stages; /* Number of stages. */
+    int done; /* Whether the last chunk was handed out. */
+    int failed; /* Whether the stream failed. */
+    filter_sink_fn sink; /* Sink of the push in progress. */
+    void* arg; /* Argument of sink. */
+};
+
+static struct filter_conf chain[FILTER_MAX]; /* Filters of the chain. */
+static int chain_len = 0; /* Number of filters of the chain. */
+static struct filter_stats stats; /* Statistics of filters. */
+
+static int stage_push(struct filter_stream* stream,
+                      int i,
+                      const char* data,
+                      int len,
+                      int last);
+
+/**
+ * @brief Hand bytes to the stage after a stage.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int emit(struct filter_stream* stream,
+                int i,
+                const char* data,
+                int len,
+                int last)
+{
+    if (len == 0 && !last) {
+        return 0;
+    }
+    return stage_push(stream, i + 1, data, len, last);
+}
+
+/**
+ * @brief Take bytes of a body of a Content-Length.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int push_length(struct filter_stream* stream,
+                       int i,
+                       const char* data,
+                       int len)
+{
+    struct stage* st = &stream->stages[i];
+    int take = len < st->remaining ? len : (int)st->remaining;
+
+    st->remaining -= take;
+    stats.in_bytes += take;
+    if (take > 0 || st->remaining == 0) {
+        return emit(stream, i, data, take, st->remaining == 0);
+    }
+    return 0;
+}
+
+/**
+ * @brief Take bytes of a chunked body.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 on bad framing or failure downstream.
+ */
+static int push_chunked(struct filter_stream* stream,
+                        int i,
+                        const char* data,
+                        int len)
+{
+    struct stage* st = &stream->stages[i];
+    const char* p = data;
+    const char* end = data + len;
+    const char* q;
+    int take;
+    int v;
+
+    while (p < end) {
+        switch (st->state) {
+        case CHUNKED_SIZE:
+            v = *p >= '0' && *p <= '9' ? *p - '0' :
+                *p >= 'a' && *p <= 'f' ? *p - 'a' + 10 :
+                *p >= 'A' && *p <= 'F' ? *p - 'A' + 10 : -1;
+            if (v >= 0) {
+                st->remaining = st->remaining * 16 + v;
+                if (st->remaining > INT_MAX) {
+                    return -1;
+                }
+                st->digits++;
+                p++;
+            }
+            else if (st->digits == 0) {
+                return -1;
+            }
+            else {
+                st->state = CHUNKED_EXT;
+            }
+            break;
+        case CHUNKED_EXT:
+            q = memchr(p, '\n', end - p);
+            if (q == NULL) {
+                p = end;
+                break;
+            }
+            p = q + 1;
+            st->state = st->remaining > 0 ? CHUNKED_DATA : CHUNKED_TRAILER;
+            break;
+        case CHUNKED_DATA:
+            take = end - p < st->remaining ? end - p : (int)st->remaining;
+            stats.in_bytes += take;
+            if (emit(stream, i, p, take, 0) < 0) {
+                return -1;
+            }
+            p += take;
+            st->remaining -= take;
+            if (st->remaining == 0) {
+                st->state = CHUNKED_DATA_CR;
+            }
+            break;
+        case CHUNKED_DATA_CR:
+        case CHUNKED_DATA_LF:
+            if (*p != (st->state == CHUNKED_DATA_CR ? '\r' : '\n')) {
+                return -1;
+            }
+            p++;
+            if (st->state == CHUNKED_DATA_CR) {
+                st->state = CHUNKED_DATA_LF;
+            }
+            else {
+                st->state = CHUNKED_SIZE;
+                st->digits = 0;
+            }
+            break;
+        case CHUNKED_TRAILER:
+            if (*p == '\r') {
+                p++;
+                st->state = CHUNKED_TRAILER_LF;
+            }
+            else {
+                st->state = CHUNKED_TRAILER_LINE;
+            }
+            break;
+        case CHUNKED_TRAILER_LINE:
+            q = memchr(p, '\n', end - p);
+            if (q == NULL) {
+                p = end;
+                break;
+            }
+            p = q + 1;
+            st->state = CHUNKED_TRAILER;
+            break;
+        default: /* CHUNKED_TRAILER_LF */
+            if (*p != '\n') {
+                return -1;
+            }
+            /* Trailers are dropped; the new body has none. */
+            return emit(stream, i, NULL, 0, 1);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode bytes of a gzip coded body.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body.
+ * @return int 0 on success; -1 on bad coding or failure downstream.
+ */
+static int push_gunzip(struct filter_stream* stream,
+                       int i,
+                       const char* data,
+                       int len,
+                       int last)
+{
+    struct stage* st = &stream->stages[i];
+    int full = 0; /* Whether the window filled, so inflate may hold more. */
+    int ret;
+
+    /* Bytes after the end of the gzip stream are ignored. */
+    st->zs.next_in = (unsigned char*)data;
+    st->zs.avail_in = len;
+    while (!st->zs_end && (st->zs.avail_in > 0 || full)) {
+        st->zs.next_out = (unsigned char*)st->window + st->window_len;
+        st->zs.avail_out = FILTER_WINDOW - st->window_len;
+        ret = inflate(&st->zs, Z_NO_FLUSH);
+        if (ret == Z_BUF_ERROR) {
+            /* Nothing more without input. */
+            break;
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            return -1;
+        }
+        st->zs_end = ret == Z_STREAM_END;
+        st->window_len = FILTER_WINDOW - st->zs.avail_out;
+        full = st->window_len == FILTER_WINDOW;
+        if (full) {
+            if (emit(stream, i, st->window, st->window_len, 0) < 0) {
+                return -1;
+            }
+            st->window_len = 0;
+        }
+    }
+    if (!last) {
+        return 0;
+    }
+    /* A body cut before the end of its gzip stream is bad. */
+    if (!st->zs_end) {
+        return -1;
+    }
+    return emit(stream, i, st->window, st->window_len, 1);
+}
+
+/**
+ * @brief Replace each occurrence of a string in bytes of an uncoded body.
+ *
+ * Bytes that cannot be part of an occurrence are handed on as slices of data.
+ * A prefix of the string that ends a slice is held back, and handed on from
+ * the string itself once the next bytes show it is not an occurrence.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body.
+ * @return int 0 on success; -1 on failure downstream.
+ */
+static int push_rewrite(struct filter_stream* stream,
+                        int i,
+                        const char* data,
+                        int len,
+                        int last)
+{
+    struct stage* st = &stream->stages[i];
+    const struct filter_conf* conf = st->conf;
+    const char* start = data; /* Start of the bytes not handed on. */
+    int m = st->matched;
+    int next;
+    int n;
+
+    for (int k = 0; k < len; ++k) {
+        while (m > 0 && conf->from[m] != data[k]) {
+            next = conf->fail[m - 1];
+            /* The first m - next bytes of the match are not an occurrence;
+             * those held back go first. */
+            n = m - next < st->held ? m - next : st->held;
+            if (n > 0) {
+                if (emit(stream, i, conf->from, n, 0) < 0) {
+                    return -1;
+                }
+                st->held -= n;
+            }
+            m = next;
+        }
+        if (conf->from[m] == data[k]) {
+            m++;
+        }
+        if (m == conf->from_len) {
+            /* Hand on the bytes before the occurrence, then its
+             * replacement. */
+            n = data + k + 1 - (m - st->held) - start;
+            if (emit(stream, i, start, n, 0) < 0 ||
+                emit(stream, i, conf->to, conf->to_len, 0) < 0) {
+                return -1;
+            }
+            (stats.rewrites)++;
+            start = data + k + 1;
+            m = 0;
+            st->held = 0;
+        }
+    }
+    /* Hold back the matched prefix that ends data. */
+    n = data + len - (m - st->held) - start;
+    if (emit(stream, i, start, n, 0) < 0) {
+        return -1;
+    }
+    st->matched = m;
+    st->held = m;
+    if (!last) {
+        return 0;
+    }
+    st->matched = 0;
+    st->held = 0;
+    if (emit(stream, i, conf->from, m, 0) < 0) {
+        return -1;
+    }
+    return emit(stream, i, NULL, 0, 1);
+}
+
+/**
+ * @brief Code bytes of an uncoded body with gzip.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body.
+ * @return int 0 on success; -1 on failure downstream.
+ */
+static int push_gzip(struct filter_stream* stream,
+                     int i,
+                     const char* data,
+                     int len,
+                     int last)
+{
+    struct stage* st = &stream->stages[i];
+    int flush = last ? Z_FINISH : Z_NO_FLUSH;
+
+    st->zs.next_in = (unsigned char*)data;
+    st->zs.avail_in = len;
+    for (;;) {
+        st->zs.next_out = (unsigned char*)st->window + st->window_len;
+        st->zs.avail_out = FILTER_WINDOW - st->window_len;
+        if (deflate(&st->zs, flush) == Z_STREAM_ERROR) {
+            return -1;
+        }
+        st->window_len = FILTER_WINDOW - st->zs.avail_out;
+        if (st->window_len < FILTER_WINDOW) {
+            /* deflate took all input, and finished if asked to. */
+            break;
+        }
+        if (emit(stream, i, st->window, st->window_len, 0) < 0) {
+            return -1;
+        }
+        st->window_len = 0;
+    }
+    if (!last) {
+        return 0;
+    }
+    return emit(stream, i, st->window, st->window_len, 1);
+}
+
+/**
+ * @brief Hand the sink the chunk held in the window of the framer.
+ *
+ * @param stream Stream.
+ * @param st Framer.
+ * @param last Whether to append the last chunk.
+ * @return int 0 on success; -1 if the sink fails.
+ */
+static int flush_frame(struct filter_stream* stream,
+                       struct stage* st,
+                       int last)
+{
+    char* data = st->window + FRAME_HEAD_LEN;
+    char* out = data;
+    char size_line[FRAME_HEAD_LEN + 1];
+    int n = 0;
+
+    if (st->window_len > 0) {
+        n = sprintf(size_line, "%x\r\n", st->window_len);
+        out = data - n;
+        memcpy(out, size_line, n);
+        memcpy(data + st->window_len, "\r\n", 2);
+        n += st->window_len + 2;
+    }
+    if (last) {
+        memcpy(out + n, FRAME_LAST, sizeof(FRAME_LAST) - 1);
+        n += sizeof(FRAME_LAST) - 1;
+    }
+    st->window_len = 0;
+    if (n == 0) {
+        return 0;
+    }
+    stats.out_bytes += n;
+    return stream->sink(stream->arg, out, n);
+}
+
+/**
+ * @brief Frame bytes of the new body as chunks, and hand them to the sink.
+ *
+ * Small slices gather in the window; a slice of a window or more goes out as
+ * a chunk of its own without a copy.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body.
+ * @return int 0 on success; -1 if the sink fails.
+ */
+static int push_frame(struct filter_stream* stream,
+                      int i,
+                      const char* data,
+                      int len,
+                      int last)
+{
+    struct stage* st = &stream->stages[i];
+    char size_line[FRAME_HEAD_LEN + 1];
+    int n;
+
+    if (st->window_len + len > FILTER_WINDOW &&
+        flush_frame(stream, st, 0) < 0) {
+        return -1;
+    }
+    if (len >= FILTER_WINDOW) {
+        n = sprintf(size_line, "%x\r\n", len);
+        stats.out_bytes += n + len + 2;
+        if (stream->sink(stream->arg, size_line, n) < 0 ||
+            stream->sink(stream->arg, data, len) < 0 ||
+            stream->sink(stream->arg, "\r\n", 2) < 0) {
+            return -1;
+        }
+    }
+    else if (len > 0) {
+        memcpy(st->window + FRAME_HEAD_LEN + st->window_len, data, len);
+        st->window_len += len;
+    }
+    if (!last) {
+        return 0;
+    }
+    if (flush_frame(stream, st, 1) < 0) {
+        return -1;
+    }
+    stream->done = 1;
+    return 0;
+}
+
+/**
+ * @brief Hand bytes to a stage of a stream.
+ *
+ * @param stream Stream.
+ * @param i Index of the stage.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param last Whether they end the body; deframers find it themselves.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int stage_push(struct filter_stream* stream,
+                      int i,
+                      const char* data,
+                      int len,
+                      int last)
+{
+    switch (stream->stages[i].kind) {
+    case STAGE_LENGTH:
+        return push_length(stream, i, data, len);
+    case STAGE_CHUNKED:
+        return push_chunked(stream, i, data, len);
+    case STAGE_GUNZIP:
+        return push_gunzip(stream, i, data, len, last);
+    case STAGE_REWRITE:
+        return push_rewrite(stream, i, data, len, last);
+    case STAGE_GZIP:
+        return push_gzip(stream, i, data, len, last);
+    default:
+        return push_frame(stream, i, data, len, last);
+    }
+}
+
+/**
+ * @brief Append a filter to the chain.
+ *
+ * @param spec "gunzip", "gzip" or "rewrite=<from>=<to>", where <from> is not
+ * empty and has no '='.
+ * @return int 0 on success; -1 if spec is bad or the chain is full.
+ */
+int filter_add(const char* spec)
+{
+    struct filter_conf* conf;
+    const char* eq;
+    int k = 0;
+
+    if (spec == NULL || chain_len == FILTER_MAX) {
+        return -1;
+    }
+    conf = &chain[chain_len];
+    memset(conf, 0, sizeof(*conf));
+    if (strcmp(spec, "gunzip") == 0) {
+        conf->kind = FILTER_GUNZIP;
+    }
+    else if (strcmp(spec, "gzip") == 0) {
+        conf->kind = FILTER_GZIP;
+    }
+    else if (strncmp(spec, "rewrite=", 8) == 0 &&
+             (eq = strchr(spec + 8, '=')) != NULL && eq > spec + 8) {
+        conf->kind = FILTER_REWRITE;
+        conf->from_len = eq - spec - 8;
+        conf->from = strndup(spec + 8, conf->from_len);
+        conf->to = strdup(eq + 1);
+        conf->to_len = strlen(eq + 1);
+        conf->fail = malloc(conf->from_len * sizeof(int));
+        if (conf->from == NULL || conf->to == NULL || conf->fail == NULL) {
+            PLOG_ERROR("malloc");
+            free(conf->from);
+            free(conf->to);
+            free(conf->fail);
+            return -1;
+        }
+        conf->fail[0] = 0;
+        for (int j = 1; j < conf->from_len; ++j) {
+            while (k > 0 && conf->from[j] != conf->from[k]) {
+                k = conf->fail[k - 1];
+            }
+            if (conf->from[j] == conf->from[k]) {
+                k++;
+            }
+            conf->fail[j] = k;
+        }
+    }
+    else {
+        return -1;
+    }
+    chain_len++;
+    return 0;
+}
+
+/**
+ * @brief Remove all filters from the chain, and clear statistics.
+ */
+void filter_clear(void)
+{
+    for (int i = 0; i < chain_len; ++i) {
+        free(chain[i].from);
+        free(chain[i].to);
+        free(chain[i].fail);
+    }
+    memset(chain, 0, sizeof(chain));
+    chain_len = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Get the number of filters in the chain.
+ *
+ * @return int Number of filters; 0 if responses pass as is.
+ */
+int filter_count(void)
+{
+    return chain_len;
+}
+
+/**
+ * @brief Build the head of a filtered response.
+ *
+ * @param response Response.
+ * @param head_len Byte size of its head, including the empty line.
+ * @param gzip Whether the new body is gzip coded.
+ * @param vary Whether the proxy gzip coded the new body, so it varies on
+ * Accept-Encoding.
+ * @param out_head Output pointer to the new head, without the empty line.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int build_head(const char* response,
+                      int head_len,
+                      int gzip,
+                      int vary,
+                      char** out_head,
+                      int* out_head_len)
+{
+    const char* st = response;
+    const char* end = response + head_len - 2; /* Start of the empty line. */
+    const char* value;
+    enum http_header header;
+    int value_len;
+    int line_len;
+    int has_vary = 0;
+    char* out;
+    int n = 0;
+
+    /* Room for the weak prefix of ETags, Accept-Encoding in Vary and the
+     * added lines. */
+    out = malloc(head_len + head_len / 4 + COMPRESS_VARY_EXTRA + 128);
+    if (out == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    while (st < end) {
+        line_len = parse_header_field(st, end + 2, &header, &value, &value_len);
+        if (line_len < 0) {
+            break;
+        }
+        if (st == response) {
+            /* Always keep the status line. */
+            header = HTTP_HEADER_UNKNOWN;
+        }
+        if (header == HTTP_HEADER_UNKNOWN) {
+            memcpy(out + n, st, line_len);
+            n += line_len;
+        }
+        else if (header != HTTP_HEADER_CONTENT_LENGTH &&
+                 header != HTTP_HEADER_TRANSFER_ENCODING &&
+                 header != HTTP_HEADER_CONTENT_ENCODING) {
+            /* The bytes change, and so do the validator and Vary. */
+            n += compress_copy_field(st, line_len, header, value, value_len,
+                                     vary, &has_vary, out + n);
+        }
+        st += line_len;
+    }
+    n += sprintf(out + n, "%s%sTransfer-Encoding: chunked\r\n",
+                 gzip ? "Content-Encoding: gzip\r\n" : "",
+                 vary && !has_vary ? "Vary: Accept-Encoding\r\n" : "");
+    *out_head = out;
+    *out_head_len = n;
+    return 0;
+}
+
+/**
+ * @brief Open a stream of the filters that apply to a response.
+ *
+ * Only "200 OK" responses with a textual Content-Type, a Content-Length or a
+ * chunked body, and no Content-Encoding but gzip are filtered. The new head
+ * has no Content-Length, "Transfer-Encoding: chunked", the Content-Encoding
+ * of the new body, a weak ETag and Accept-Encoding in Vary if gzip applies.
+ *
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ * @param accepts_gzip 1 if the client accepts gzip; 0 otherwise.
+ * @param out_stream Output pointer to the stream. Caller is responsible to
+ * free it with filter_free().
+ * @param out_head Output pointer to the new head, without the empty line.
+ * Caller is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 1 if a stream is opened; 0 if the response passes as is.
+ */
+int filter_open(const char* response,
+                int head_len,
+                int accepts_gzip,
+                struct filter_stream** out_stream,
+                char** out_head,
+                int* out_head_len)
+{
+    struct filter_stream* stream;
+    struct stage* st;
+    const char* value;
+    int value_len;
+    int chunked = 0;
+    long length = 0;
+    int gzip = 0; /* Whether the body is gzip coded at this point. */
+    int gzipped = 0; /* Whether a gzip filter applies. */
+    int ok = 1;
+
+    if (chain_len == 0) {
+        return 0;
+    }
+    if (get_status_code(response, head_len) != 200 ||
+        !compress_is_textual(response, head_len)) {
+        (stats.passed)++;
+        return 0;
+    }
+    if (find_header_field(response, head_len, HTTP_HEADER_TRANSFER_ENCODING,
+                          &value, &value_len)) {
+        chunked = value_len == 7 && strncasecmp(value, "chunked", 7) == 0;
+        ok = chunked;
+    }
+    else if (find_header_field(response, head_len, HTTP_HEADER_CONTENT_LENGTH,
+                               &value, &value_len)) {
+        length = strtol(value, NULL, 10);
+        ok = length >= 0;
+    }
+    else {
+        ok = 0;
+    }
+    if (ok && find_header_field(response, head_len,
+                                HTTP_HEADER_CONTENT_ENCODING,
+                                &value, &value_len)) {
+        gzip = (value_len == 4 && strncasecmp(value, "gzip", 4) == 0) ||
+               (value_len == 6 && strncasecmp(value, "x-gzip", 6) == 0);
+        ok = gzip || (value_len == 8 && strncasecmp(value, "identity", 8) == 0);
+    }
+    if (!ok) {
+        (stats.passed)++;
+        return 0;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (stream == NULL) {
+        PLOG_ERROR("calloc");
+        return 0;
+    }
+    st = &stream->stages[stream->num_stages++];
+    st->kind = chunked ? STAGE_CHUNKED : STAGE_LENGTH;
+    st->remaining = chunked ? 0 : length;
+    for (int i = 0; i < chain_len; ++i) {
+        if ((chain[i].kind == FILTER_GUNZIP && !gzip) ||
+            (chain[i].kind == FILTER_REWRITE && gzip) ||
+            (chain[i].kind == FILTER_GZIP && (gzip || !accepts_gzip))) {
+            continue;
+        }
+        st = &stream->stages[stream->num_stages++];
+        st->conf = &chain[i];
+        if (chain[i].kind == FILTER_REWRITE) {
+            st->kind = STAGE_REWRITE;
+            continue;
+        }
+        st->window = malloc(FILTER_WINDOW);
+        if (st->window == NULL) {
+            PLOG_ERROR("malloc");
+            filter_free(stream);
+            return 0;
+        }
+        /* Window bits of 15 + 16 read and write a gzip header and
+         * trailer. */
+        if (chain[i].kind == FILTER_GUNZIP) {
+            st->kind = STAGE_GUNZIP;
+            st->zs_open = inflateInit2(&st->zs, 15 + 16) == Z_OK;
+            gzip = 0;
+        }
+        else {
+            st->kind = STAGE_GZIP;
+            st->zs_open = deflateInit2(&st->zs, FILTER_LEVEL, Z_DEFLATED,
+                                       15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            gzip = 1;
+            gzipped = 1;
+        }
+        if (!st->zs_open) {
+            LOG_ERROR("fail to init zlib stream");
+            filter_free(stream);
+            return 0;
+        }
+    }
+    if (stream->num_stages == 1) {
+        /* None of the filters applies. */
+        filter_free(stream);
+        (stats.passed)++;
+        return 0;
+    }
+    st = &stream->stages[stream->num_stages++];
+    st->kind = STAGE_FRAME;
+    st->window = malloc(FRAME_HEAD_LEN + FILTER_WINDOW + 2 +
+                        sizeof(FRAME_LAST) - 1);
+    if (st->window == NULL ||
+        build_head(response, head_len, gzip, gzipped,
+                   out_head, out_head_len) < 0) {
+        if (st->window == NULL) {
+            PLOG_ERROR("malloc");
+        }
+        filter_free(stream);
+        return 0;
+    }
+    (stats.streams)++;
+    *out_stream = stream;
+    return 1;
+}
+
+/**
+ * @brief Take bytes of a body, in the framing of the response it came in,
+ * and hand the sink what the filters put out. Bytes after the end of the body
+ * are ignored.
+ *
+ * @param stream Stream.
+ * @param data Bytes of the body; none to only check its end, e.g. for an
+ * empty body.
+ * @param len Byte size of data.
+ * @param sink Destination of the new body.
+ * @param arg Argument of sink.
+ * @return int 1 if the body ended and its last chunk was handed out; 0 if
+ * more is due; -1 if the stream failed, after which it takes nothing.
+ */
+int filter_push(struct filter_stream* stream,
+                const char* data,
+                int len,
+                filter_sink_fn sink,
+                void* arg)
+{
+    if (stream->failed) {
+        return -1;
+    }
+    if (stream->done) {
+        return 1;
+    }
+    stream->sink = sink;
+    stream->arg = arg;
+    if (stage_push(stream, 0, data, len, 0) < 0) {
+        stream->failed = 1;
+        (stats.errors)++;
+        return -1;
+    }
+    return stream->done;
+}
+
+/**
+ * @brief Free a stream.
+ *
+ * @param stream Stream; NULL for none.
+ */
+void filter_free(struct filter_stream* stream)
+{
+    struct stage* st;
+
+    if (stream == NULL) {
+        return;
+    }
+    for (int i = 0; i < stream->num_stages; ++i) {
+        st = &stream->stages[i];
+        if (st->zs_open) {
+            if (st->kind == STAGE_GUNZIP) {
+                inflateEnd(&st->zs);
+            }
+            else {
+                deflateEnd(&st->zs);
+            }
+        }
+        free(st->window);
+    }
+    free(stream);
+}
+
+/**
+ * @brief Get statistics of filters.
+ *
+ * @param out_stats Output; filter statistics, non-null.
+ */
+void filter_get_stats(struct filter_stats* out_stats)
+{
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+}
+
+/**
+ * @brief Print statistics of filters.
+ */
+void filter_log_stats(void)
+{
+    static const char* names[] = {"gunzip", "rewrite", "gzip"};
+    char desc[FILTER_MAX * 10] = "";
+
+    for (int i = 0; i < chain_len; ++i) {
+        strcat(desc, i > 0 ? ", " : "");
+        strcat(desc, names[chain[i].kind]);
+    }
+    LOG_INFO("filter stats:\n"
+             "- chain: %s\n"
+             "- responses: %ld filtered, %ld passed, %ld failed\n"
+             "- bytes: %ld in, %ld out\n"
+             "- rewrites: %ld",
+             desc,
+             stats.streams,
+             stats.passed,
+             stats.errors,
+             stats.in_bytes,
+             stats.out_bytes,
+             stats.rewrites);
+}
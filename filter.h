@@ -0,0 +1,155 @@
+/**************************************************************
+*
+*                          filter.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-05
+*
+*     Summary:
+*     Interface for the chain of streaming filters that
+*     transform response bodies on their way to clients.
+*
+*     The chain is configured once, e.g. gunzip, then rewrite,
+*     then gzip. Each response opens a stream of the filters
+*     that apply to it: gunzip to a gzip coded body, rewrite
+*     to an uncoded one, and gzip to an uncoded one for a
+*     client that accepts gzip. A response none applies to
+*     passes as is.
+*
+*     A stream takes the body as it comes, in its framing
+*     from the server, and hands the sink the new body framed
+*     as chunked, since its length is unknown until its end.
+*     Each filter owns a window of FILTER_WINDOW bytes and
+*     hands it on when it is full, so a stream holds a bounded
+*     amount of memory whatever the body size; the sink writes
+*     each window before the stream takes more input, which
+*     holds back the server while the client is slow.
+*
+**************************************************************/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#define FILTER_MAX 8 /* Max number of filters in the chain. */
+#define FILTER_WINDOW 16384 /* Byte size of the output window of a filter. */
+#define FILTER_LEVEL 1 /* zlib level of the gzip filter; the fastest. */
+
+/* Filters of the chain. */
+enum filter_kind {
+    FILTER_GUNZIP = 0, /* Decode a gzip coded body. */
+    FILTER_REWRITE, /* Replace each occurrence of a string in an uncoded
+                     * body. */
+    FILTER_GZIP, /* Code an uncoded body with gzip. */
+};
+
+struct filter_stats {
+    long streams; /* Number of responses filtered. */
+    long passed; /* Number of responses the chain was offered but did not
+                  * apply to. */
+    long in_bytes; /* Byte size of bodies taken in, without framing. */
+    long out_bytes; /* Byte size of bodies handed out, with framing. */
+    long rewrites; /* Number of strings replaced. */
+    long errors; /* Number of streams failed on bad framing or coding, or
+                  * their sink. */
+};
+
+struct filter_stream;
+
+/**
+ * @brief Hand bytes of a framed body to its destination.
+ *
+ * @param arg Argument given with the bytes.
+ * @param data Bytes.
+ * @param len Byte size of data, positive.
+ * @return int 0 on success; -1 to fail the stream.
+ */
+typedef int (*filter_sink_fn)(void* arg, const char* data, int len);
+
+/**
+ * @brief Append a filter to the chain.
+ *
+ * @param spec "gunzip", "gzip" or "rewrite=<from>=<to>", where <from> is not
+ * empty and has no '='.
+ * @return int 0 on success; -1 if spec is bad or the chain is full.
+ */
+int filter_add(const char* spec);
+
+/**
+ * @brief Remove all filters from the chain, and clear statistics.
+ */
+void filter_clear(void);
+
+/**
+ * @brief Get the number of filters in the chain.
+ *
+ * @return int Number of filters; 0 if responses pass as is.
+ */
+int filter_count(void);
+
+/**
+ * @brief Open a stream of the filters that apply to a response.
+ *
+ * Only "200 OK" responses with a textual Content-Type, a Content-Length or a
+ * chunked body, and no Content-Encoding but gzip are filtered. The new head
+ * has no Content-Length, "Transfer-Encoding: chunked", the Content-Encoding
+ * of the new body, a weak ETag and Accept-Encoding in Vary if gzip applies.
+ *
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ * @param accepts_gzip 1 if the client accepts gzip; 0 otherwise.
+ * @param out_stream Output pointer to the stream. Caller is responsible to
+ * free it with filter_free().
+ * @param out_head Output pointer to the new head, without the empty line.
+ * Caller is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 1 if a stream is opened; 0 if the response passes as is.
+ */
+int filter_open(const char* response,
+                int head_len,
+                int accepts_gzip,
+                struct filter_stream** out_stream,
+                char** out_head,
+                int* out_head_len);
+
+/**
+ * @brief Take bytes of a body, in the framing of the response it came in,
+ * and hand the sink what the filters put out. Bytes after the end of the body
+ * are ignored.
+ *
+ * @param stream Stream.
+ * @param data Bytes of the body; none to only check its end, e.g. for an
+ * empty body.
+ * @param len Byte size of data.
+ * @param sink Destination of the new body.
+ * @param arg Argument of sink.
+ * @return int 1 if the body ended and its last chunk was handed out; 0 if
+ * more is due; -1 if the stream failed, after which it takes nothing.
+ */
+int filter_push(struct filter_stream* stream,
+                const char* data,
+                int len,
+                filter_sink_fn sink,
+                void* arg);
+
+/**
+ * @brief Free a stream.
+ *
+ * @param stream Stream; NULL for none.
+ */
+void filter_free(struct filter_stream* stream);
+
+/**
+ * @brief Get statistics of filters.
+ *
+ * @param out_stats Output; filter statistics, non-null.
+ */
+void filter_get_stats(struct filter_stats* out_stats);
+
+/**
+ * @brief Print statistics of filters.
+ */
+void filter_log_stats(void);
+
+#endif /* FILTER_H */
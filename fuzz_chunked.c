@@ -0,0 +1,57 @@
+/**************************************************************
+*
+*                        fuzz_chunked.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Fuzz harness of the chunked body walker. The input is a
+*     chunked body, appended to a fixed response head so that
+*     every run reaches the walker.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Head of a chunked response. */
+static const char head[] = "HTTP/1.1 200 OK\r\n"
+                           "Transfer-Encoding: chunked\r\n"
+                           "\r\n";
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    int head_len = strlen(head);
+    char* buf;
+    int n = head_len + size;
+    char* response = NULL;
+    int response_len = 0;
+    int max_age = 0;
+    int is_chunked = 0;
+
+    if (size > 1 << 20) {
+        return 0;
+    }
+    /* Socket buffers are not null-terminated. */
+    buf = malloc(n);
+    if (buf == NULL) {
+        return 0;
+    }
+    memcpy(buf, head, head_len);
+    memcpy(buf + head_len, data, size);
+
+    if (extract_first_response(&buf,
+                               &n,
+                               &response,
+                               &response_len,
+                               &max_age,
+                               &is_chunked) > 0) {
+        free(response);
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**************************************************************
+*
+*                         fuzz_host.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Fuzz harness of Host field parsing. The input is the
+*     value of a Host field.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* host;
+    char* hostname = NULL;
+    int port = -1;
+
+    if (size > 1 << 20) {
+        return 0;
+    }
+    /* Field values are null-terminated copies. */
+    host = malloc(size + 1);
+    if (host == NULL) {
+        return 0;
+    }
+    memcpy(host, data, size);
+    host[size] = '\0';
+
+    parse_host_field(host, &hostname, &port);
+    free(hostname);
+    free(host);
+    return 0;
+}
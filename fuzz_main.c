@@ -0,0 +1,266 @@
+/**************************************************************
+*
+*                         fuzz_main.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Standalone driver for the parser fuzz harnesses, for
+*     builds without libFuzzer.
+*
+*     Usage: fuzz_<target> [-n <runs>] [-s <seed>] <file|dir>...
+*     Each file, and each file in each directory, is run
+*     through LLVMFuzzerTestOneInput() once. With -n, random
+*     mutations of those inputs are run afterwards. A single
+*     file argument is also how AFL runs the harness, e.g.
+*     "afl-fuzz -i fuzz_corpus/request -o out ./fuzz_request @@".
+*     Crashes are caught by the sanitizers the harness is built
+*     with.
+*
+**************************************************************/
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_INPUTS 1024 /* Max number of seed inputs. */
+#define MAX_INPUT_LEN 65536 /* Max byte size of an input. */
+#define MAX_MUTATIONS 8 /* Max number of mutations stacked on an input. */
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+/* Tokens of HTTP framing, inserted by mutations. */
+static const char* tokens[] = {
+    "\r\n", "\r\n\r\n", ": ", ":", " ", ";", ",", "0\r\n\r\n", "\r\n0\r\n",
+    "Content-Length: ", "Transfer-Encoding: chunked\r\n", "Host: ",
+    "HTTP/1.1 ", "GET ", "-1", "ffffffffffffffff", "99999999999",
+};
+
+static uint8_t* inputs[MAX_INPUTS]; /* Seed inputs. */
+static size_t input_lens[MAX_INPUTS]; /* Byte size of each seed input. */
+static int num_inputs = 0; /* Number of seed inputs. */
+static uint32_t rand_state = 1; /* State of the random generator. */
+
+/**
+ * @brief Get the next random number of xorshift32.
+ *
+ * @return uint32_t Random number.
+ */
+static uint32_t next_rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+/**
+ * @brief Read a file, run it through the harness once and keep it as a seed.
+ *
+ * @param path Path of the file.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int run_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    uint8_t* data;
+    size_t size;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    data = malloc(MAX_INPUT_LEN);
+    if (data == NULL) {
+        perror("malloc");
+        fclose(file);
+        return -1;
+    }
+    size = fread(data, 1, MAX_INPUT_LEN, file);
+    fclose(file);
+    /* An exact size buffer lets the sanitizer catch reads past its end. */
+    data = realloc(data, size > 0 ? size : 1);
+    LLVMFuzzerTestOneInput(data, size);
+    if (num_inputs < MAX_INPUTS) {
+        inputs[num_inputs] = data;
+        input_lens[num_inputs] = size;
+        num_inputs++;
+    }
+    else {
+        free(data);
+    }
+    return 0;
+}
+
+/**
+ * @brief Run a file, or each regular file in a directory.
+ *
+ * @param path Path of the file or directory.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int run_path(const char* path)
+{
+    struct stat st;
+    struct dirent* entry;
+    DIR* dir;
+    char child[1024];
+
+    if (stat(path, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return run_file(path);
+    }
+    dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (stat(child, &st) == 0 && S_ISREG(st.st_mode)) {
+            run_file(child);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+/**
+ * @brief Apply one random mutation to an input.
+ *
+ * @param data Input; it has room for MAX_INPUT_LEN bytes.
+ * @param size Byte size of the input.
+ * @return size_t Byte size of the mutated input.
+ */
+static size_t mutate(uint8_t* data, size_t size)
+{
+    size_t pos = size > 0 ? next_rand() % size : 0;
+
+    switch (next_rand() % 6) {
+    case 0: /* Flip a bit. */
+        if (size > 0) {
+            data[pos] ^= 1 << (next_rand() % 8);
+        }
+        break;
+    case 1: /* Set a random byte. */
+        if (size > 0) {
+            data[pos] = next_rand();
+        }
+        break;
+    case 2: /* Delete a range. */
+        if (size > 0) {
+            size_t len = next_rand() % (size - pos) + 1;
+
+            memmove(data + pos, data + pos + len, size - pos - len);
+            size -= len;
+        }
+        break;
+    case 3: /* Insert a token. */
+    {
+        const char* token = tokens[next_rand() %
+                                   (sizeof(tokens) / sizeof(tokens[0]))];
+        size_t len = strlen(token);
+
+        if (size + len <= MAX_INPUT_LEN) {
+            memmove(data + pos + len, data + pos, size - pos);
+            memcpy(data + pos, token, len);
+            size += len;
+        }
+        break;
+    }
+    case 4: /* Duplicate a range. */
+        if (size > 0) {
+            size_t len = next_rand() % (size - pos) + 1;
+
+            if (size + len <= MAX_INPUT_LEN) {
+                memmove(data + pos + len, data + pos, size - pos);
+                size += len;
+            }
+        }
+        break;
+    default: /* Truncate. */
+        size = pos;
+        break;
+    }
+    return size;
+}
+
+/**
+ * @brief Run random mutations of the seed inputs.
+ *
+ * @param runs Number of runs.
+ */
+static void run_mutations(long runs)
+{
+    uint8_t* data = malloc(MAX_INPUT_LEN);
+    uint8_t* copy;
+
+    if (data == NULL || num_inputs == 0) {
+        free(data);
+        return;
+    }
+    for (long i = 0; i < runs; ++i) {
+        int k = next_rand() % num_inputs;
+        size_t size = input_lens[k];
+        int n = next_rand() % MAX_MUTATIONS + 1;
+
+        memcpy(data, inputs[k], size);
+        for (int j = 0; j < n; ++j) {
+            size = mutate(data, size);
+        }
+        /* An exact size copy lets the sanitizer catch reads past its end. */
+        copy = malloc(size > 0 ? size : 1);
+        if (copy == NULL) {
+            break;
+        }
+        memcpy(copy, data, size);
+        LLVMFuzzerTestOneInput(copy, size);
+        free(copy);
+    }
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    long runs = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            runs = atol(optarg);
+            break;
+        case 's':
+            rand_state = strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-n <runs>] [-s <seed>] <file|dir>...\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        if (run_path(argv[i]) < 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    run_mutations(runs);
+    fprintf(stderr, "%s: %d inputs, %ld mutations, no crash\n",
+            argv[0], num_inputs, runs);
+    for (int i = 0; i < num_inputs; ++i) {
+        free(inputs[i]);
+    }
+    return EXIT_SUCCESS;
+}
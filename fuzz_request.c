@@ -0,0 +1,59 @@
+/**************************************************************
+*
+*                       fuzz_request.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Fuzz harness of client request parsing. The input is the
+*     socket buffer of a client, parsed as the proxy does:
+*     each complete request is extracted, then its request
+*     line and Host field are parsed.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* buf;
+    int n = size;
+    char* request = NULL;
+    int request_len = 0;
+
+    if (size == 0 || size > 1 << 20) {
+        return 0;
+    }
+    /* Socket buffers are not null-terminated. */
+    buf = malloc(size);
+    if (buf == NULL) {
+        return 0;
+    }
+    memcpy(buf, data, size);
+
+    while (extract_first_request(&buf, &n, &request, &request_len) > 0) {
+        char* method = NULL;
+        char* url = NULL;
+        char* version = NULL;
+        char* host = NULL;
+        char* hostname = NULL;
+        int port = -1;
+
+        parse_request_head(request, &method, &url, &version, &host);
+        parse_host_field(host, &hostname, &port);
+        free(method);
+        free(url);
+        free(version);
+        free(host);
+        free(hostname);
+        free(request);
+        request = NULL;
+    }
+    free(buf);
+    return 0;
+}
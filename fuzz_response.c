@@ -0,0 +1,79 @@
+/**************************************************************
+*
+*                       fuzz_response.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-19
+*
+*     Summary:
+*     Fuzz harness of server response parsing. The input is
+*     the socket buffer of a server; a complete response is
+*     extracted, then its head is parsed as for caching and
+*     split as for serving from cache.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    char* buf;
+    int n = size;
+    char* response = NULL;
+    int response_len = 0;
+    int max_age = 0;
+    int is_chunked = 0;
+
+    if (size == 0 || size > 1 << 20) {
+        return 0;
+    }
+    /* Socket buffers are not null-terminated. */
+    buf = malloc(size);
+    if (buf == NULL) {
+        return 0;
+    }
+    memcpy(buf, data, size);
+
+    if (extract_first_response(&buf,
+                               &n,
+                               &response,
+                               &response_len,
+                               &max_age,
+                               &is_chunked) > 0) {
+        char* version = NULL;
+        int status_code = -1;
+        char* phrase = NULL;
+        int content_length = 0;
+        char* cache_control = NULL;
+        char* head = NULL;
+        int head_len = 0;
+        char* body = NULL;
+        int body_len = 0;
+
+        parse_response_head(response,
+                            response_len,
+                            &version,
+                            &status_code,
+                            &phrase,
+                            &content_length,
+                            &cache_control);
+        parse_body_head(response,
+                        response_len,
+                        &head,
+                        &head_len,
+                        &body,
+                        &body_len);
+        free(version);
+        free(phrase);
+        free(cache_control);
+        free(head);
+        free(body);
+        free(response);
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,291 @@
+/**************************************************************
+*
+*                      gen_http_headers.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-18
+*
+*     Summary:
+*     Build time generator of the perfect hash of header field
+*     names.
+*
+*     Usage: gen_http_headers -e|-t <header_list>
+*     -e prints http_headers.h, the enum of header names;
+*     -t prints http_headers_table.h, the hash table.
+*
+*     The hash of a name folds its length and 3 of its chars,
+*     lower cased by setting bit 5, into a 32 bit key, then
+*     takes the top bits of the key times a seed. The seed and
+*     the number of bits are searched until no 2 names share a
+*     slot, so a lookup is one multiplication, one load and
+*     one compare of the candidate.
+*
+**************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_HEADERS 255 /* Slots are unsigned char; 0 is unknown. */
+#define MAX_NAME_LEN 64 /* Max byte size of a header name. */
+#define MIN_BITS 6 /* Smallest table is 64 slots. */
+#define MAX_BITS 12 /* Largest table is 4096 slots. */
+#define MAX_TRIES 1000000 /* Seeds to try for each table size. */
+
+/*
+ * Hash of a header name; it must match the HTTP_HEADER_KEY and
+ * HTTP_HEADER_SLOT macros printed by print_table().
+ */
+#define FOLD(c) ((uint32_t)((unsigned char)(c) | 0x20))
+#define KEY(name, len) ((uint32_t)(len) | \
+                        FOLD((name)[0]) << 8 | \
+                        FOLD((name)[(len) / 2]) << 16 | \
+                        FOLD((name)[(len) - 1]) << 24)
+#define SLOT(key, seed, bits) ((uint32_t)((key) * (seed)) >> (32 - (bits)))
+
+static char names[MAX_HEADERS][MAX_NAME_LEN + 1]; /* Registered names. */
+static int num_names = 0; /* Number of registered names. */
+
+/**
+ * @brief Read header names from a list file. Empty lines and lines starting
+ * with '#' are skipped.
+ *
+ * @param path Path of the list file.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int read_names(const char* path)
+{
+    char line[256];
+    FILE* file = fopen(path, "r");
+    int line_no = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int len = strlen(line);
+
+        line_no++;
+        while (len > 0 && strchr(" \t\r\n", line[len - 1]) != NULL) {
+            line[--len] = '\0';
+        }
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+        if (len > MAX_NAME_LEN ||
+            strspn(line, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                         "abcdefghijklmnopqrstuvwxyz"
+                         "0123456789-") != (size_t)len) {
+            fprintf(stderr, "%s:%d: invalid header name\n", path, line_no);
+            fclose(file);
+            return -1;
+        }
+        for (int i = 0; i < num_names; ++i) {
+            if (strcasecmp(names[i], line) == 0) {
+                fprintf(stderr, "%s:%d: duplicate header name %s\n",
+                        path, line_no, line);
+                fclose(file);
+                return -1;
+            }
+        }
+        if (num_names == MAX_HEADERS) {
+            fprintf(stderr, "%s:%d: too many header names\n", path, line_no);
+            fclose(file);
+            return -1;
+        }
+        strcpy(names[num_names++], line);
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Search a seed and a table size for which the hash is perfect.
+ *
+ * @param out_seed Output; odd multiplier of the key.
+ * @param out_bits Output; the table has 1 << *out_bits slots.
+ * @return int 0 on success; -1 if two names share a key or no seed is found.
+ */
+static int find_seed(uint32_t* out_seed, int* out_bits)
+{
+    static unsigned char used[1 << MAX_BITS];
+    uint32_t keys[MAX_HEADERS];
+    uint32_t state = 2463534242u; /* Fixed, so the output is reproducible. */
+
+    for (int i = 0; i < num_names; ++i) {
+        keys[i] = KEY(names[i], (int)strlen(names[i]));
+        for (int j = 0; j < i; ++j) {
+            if (keys[i] == keys[j]) {
+                fprintf(stderr, "%s and %s share a hash key\n",
+                        names[j], names[i]);
+                return -1;
+            }
+        }
+    }
+    for (int bits = MIN_BITS; bits <= MAX_BITS; ++bits) {
+        if (num_names > (1 << bits) / 2) {
+            continue;
+        }
+        for (int t = 0; t < MAX_TRIES; ++t) {
+            uint32_t seed;
+            int i;
+
+            /* xorshift32. */
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            seed = state | 1;
+            memset(used, 0, 1 << bits);
+            for (i = 0; i < num_names; ++i) {
+                uint32_t slot = SLOT(keys[i], seed, bits);
+
+                if (used[slot]) {
+                    break;
+                }
+                used[slot] = 1;
+            }
+            if (i == num_names) {
+                *out_seed = seed;
+                *out_bits = bits;
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr, "no perfect hash is found\n");
+    return -1;
+}
+
+/**
+ * @brief Get the enum constant of a header name, e.g. HTTP_HEADER_ETAG for
+ * "ETag".
+ *
+ * @param name Header name.
+ * @param out Output buffer of at least 13 + MAX_NAME_LEN bytes.
+ */
+static void get_enum_name(const char* name, char* out)
+{
+    int n = sprintf(out, "HTTP_HEADER_");
+
+    for (; *name != '\0'; ++name) {
+        out[n++] = *name == '-' ? '_' :
+                   (*name >= 'a' && *name <= 'z') ? *name - 'a' + 'A' : *name;
+    }
+    out[n] = '\0';
+}
+
+/**
+ * @brief Print http_headers.h.
+ *
+ * @param list Path of the list file.
+ */
+static void print_enum(const char* list)
+{
+    char enum_name[13 + MAX_NAME_LEN];
+
+    printf("/* Generated by gen_http_headers from %s; do not edit. */\n\n"
+           "#ifndef HTTP_HEADERS_H\n"
+           "#define HTTP_HEADERS_H\n\n"
+           "enum http_header {\n"
+           "    HTTP_HEADER_UNKNOWN = 0, /* Not a registered name. */\n",
+           list);
+    for (int i = 0; i < num_names; ++i) {
+        get_enum_name(names[i], enum_name);
+        printf("    %s, /* %s */\n", enum_name, names[i]);
+    }
+    printf("    NUM_HTTP_HEADERS\n"
+           "};\n\n"
+           "#endif /* HTTP_HEADERS_H */\n");
+}
+
+/**
+ * @brief Print http_headers_table.h.
+ *
+ * @param list Path of the list file.
+ * @param seed Multiplier of the key.
+ * @param bits The table has 1 << bits slots.
+ */
+static void print_table(const char* list, uint32_t seed, int bits)
+{
+    static unsigned char slots[1 << MAX_BITS];
+    int max_len = 0;
+
+    memset(slots, 0, sizeof(slots));
+    for (int i = 0; i < num_names; ++i) {
+        int len = strlen(names[i]);
+
+        slots[SLOT(KEY(names[i], len), seed, bits)] = i + 1;
+        if (len > max_len) {
+            max_len = len;
+        }
+    }
+
+    printf("/* Generated by gen_http_headers from %s; do not edit. */\n\n"
+           "#ifndef HTTP_HEADERS_TABLE_H\n"
+           "#define HTTP_HEADERS_TABLE_H\n\n"
+           "#include \"http_headers.h\"\n"
+           "#include <stdint.h>\n\n"
+           "#define HTTP_HEADER_MAX_LEN %d\n"
+           "#define HTTP_HEADER_FOLD(c) "
+           "((uint32_t)((unsigned char)(c) | 0x20))\n"
+           "#define HTTP_HEADER_KEY(name, len) ((uint32_t)(len) | \\\n"
+           "    HTTP_HEADER_FOLD((name)[0]) << 8 | \\\n"
+           "    HTTP_HEADER_FOLD((name)[(len) / 2]) << 16 | \\\n"
+           "    HTTP_HEADER_FOLD((name)[(len) - 1]) << 24)\n"
+           "#define HTTP_HEADER_SLOT(key) \\\n"
+           "    ((uint32_t)((key) * 0x%08xu) >> %d)\n\n",
+           list, max_len, seed, 32 - bits);
+
+    printf("/* Enum of the name hashed to each slot. */\n"
+           "static const unsigned char http_header_slots[%d] = {",
+           1 << bits);
+    for (int i = 0; i < 1 << bits; ++i) {
+        printf("%s%d,", i % 16 == 0 ? "\n    " : " ", slots[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Canonical name of each enum. */\n"
+           "static const char* const http_header_names[NUM_HTTP_HEADERS] = {\n"
+           "    \"\",\n");
+    for (int i = 0; i < num_names; ++i) {
+        printf("    \"%s\",\n", names[i]);
+    }
+    printf("};\n\n");
+
+    printf("/* Byte size of the name of each enum. */\n"
+           "static const unsigned char http_header_lens[NUM_HTTP_HEADERS] = {\n"
+           "    0,");
+    for (int i = 0; i < num_names; ++i) {
+        printf("%s%d,", (i + 1) % 16 == 0 ? "\n    " : " ",
+               (int)strlen(names[i]));
+    }
+    printf("\n};\n\n"
+           "#endif /* HTTP_HEADERS_TABLE_H */\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t seed;
+    int bits;
+
+    if (argc != 3 ||
+        (strcmp(argv[1], "-e") != 0 && strcmp(argv[1], "-t") != 0)) {
+        fprintf(stderr, "Usage: %s -e|-t <header_list>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (read_names(argv[2]) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (strcmp(argv[1], "-e") == 0) {
+        print_enum(argv[2]);
+        return EXIT_SUCCESS;
+    }
+    if (find_seed(&seed, &bits) < 0) {
+        return EXIT_FAILURE;
+    }
+    print_table(argv[2], seed, bits);
+    return EXIT_SUCCESS;
+}
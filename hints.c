@@ -0,0 +1,368 @@
+/**************************************************************
+*
+*                          hints.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-07
+*
+*     Summary:
+*     Implementation for "103 Early Hints" from the preload
+*     links of earlier responses.
+*
+*     Each slot of the table keeps a copy of its key and the
+*     link-values of its preload links, joined by ", " as one
+*     Link field, so a 103 response is built without parsing.
+*
+**************************************************************/
+
+#include "hints.h"
+#include "http_utils.h"
+#include "logger.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define HINTS_HEAD "HTTP/1.1 103 Early Hints\r\nLink: " /* Start of a 103
+                                                         * response. */
+
+/* Preload links of a key. */
+struct hints_slot {
+    char* key; /* Cache key; NULL for a free slot. */
+    char* links; /* Link-values joined by ", ". */
+    int links_len; /* Byte size of links. */
+};
+
+static struct hints_slot table[HINTS_SLOTS]; /* Hint table. */
+static struct hints_stats stats; /* Statistics of early hints. */
+
+/**
+ * @brief Hash a key with FNV-1a.
+ *
+ * @param key Key.
+ * @return uint32_t Hash.
+ */
+static uint32_t hints_hash(const char* key)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *key != '\0'; ++key) {
+        hash = (hash ^ (unsigned char)*key) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Check whether a space-separated list has a token, case
+ * insensitively.
+ *
+ * @param list List; it need not be null-terminated.
+ * @param len Byte size of list.
+ * @param token Null-terminated token.
+ * @return int 1 if list has token; 0 otherwise.
+ */
+static int has_token(const char* list, int len, const char* token)
+{
+    int token_len = strlen(token);
+    int i = 0;
+    int st;
+
+    while (i < len) {
+        while (i < len && (list[i] == ' ' || list[i] == '\t')) {
+            i++;
+        }
+        st = i;
+        while (i < len && list[i] != ' ' && list[i] != '\t') {
+            i++;
+        }
+        if (i - st == token_len &&
+            strncasecmp(list + st, token, token_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether a link-value has rel=preload. Only the first rel
+ * parameter counts, and it may list several relation types.
+ *
+ * @param link Link-value, "<uri>" followed by parameters; it need not be
+ * null-terminated.
+ * @param len Byte size of link.
+ * @return int 1 if it is a preload link; 0 otherwise.
+ */
+static int is_preload(const char* link, int len)
+{
+    const char* end = link + len;
+    const char* p = memchr(link, '>', len);
+    const char* name;
+    const char* value;
+    int name_len;
+    int value_len;
+
+    if (p == NULL) {
+        return 0;
+    }
+    p++;
+    while (p < end) {
+        while (p < end && (*p == ';' || *p == ' ' || *p == '\t')) {
+            p++;
+        }
+        name = p;
+        while (p < end && *p != '=' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        name_len = p - name;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        value = p;
+        value_len = 0;
+        if (p < end && *p == '=') {
+            p++;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (p < end && *p == '"') {
+                value = ++p;
+                while (p < end && *p != '"') {
+                    p += *p == '\\' && p + 1 < end ? 2 : 1;
+                }
+                value_len = p - value;
+            }
+            else {
+                value = p;
+                while (p < end && *p != ';') {
+                    p++;
+                }
+                value_len = p - value;
+            }
+        }
+        if (name_len == 3 && strncasecmp(name, "rel", 3) == 0) {
+            return has_token(value, value_len, "preload");
+        }
+        while (p < end && *p != ';') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Append the preload links of a Link field value.
+ *
+ * @param value Field value, link-values separated by commas; it need not be
+ * null-terminated.
+ * @param len Byte size of value.
+ * @param out Output buffer of HINTS_MAX_LEN bytes.
+ * @param out_len Input and output; byte size of out.
+ */
+static void add_links(const char* value, int len, char* out, int* out_len)
+{
+    const char* st = value;
+    const char* link;
+    int link_len;
+    int in_uri = 0; /* Whether within <>. */
+    int in_quote = 0; /* Whether within a quoted string. */
+
+    for (int i = 0; i <= len; ++i) {
+        if (i < len) {
+            if (in_quote) {
+                if (value[i] == '\\') {
+                    i++;
+                }
+                else if (value[i] == '"') {
+                    in_quote = 0;
+                }
+                continue;
+            }
+            if (value[i] == '"' && !in_uri) {
+                in_quote = 1;
+            }
+            else if (value[i] == '<') {
+                in_uri = 1;
+            }
+            else if (value[i] == '>') {
+                in_uri = 0;
+            }
+            if (value[i] != ',' || in_uri) {
+                continue;
+            }
+        }
+
+        /* A link-value ends at a comma outside its URI and quotes. */
+        link = st;
+        link_len = value + i - st;
+        while (link_len > 0 && (*link == ' ' || *link == '\t')) {
+            link++;
+            link_len--;
+        }
+        while (link_len > 0 &&
+               (link[link_len - 1] == ' ' || link[link_len - 1] == '\t')) {
+            link_len--;
+        }
+        if (link_len > 0 && is_preload(link, link_len) &&
+            *out_len + link_len + 2 <= HINTS_MAX_LEN) {
+            if (*out_len > 0) {
+                memcpy(out + *out_len, ", ", 2);
+                *out_len += 2;
+            }
+            memcpy(out + *out_len, link, link_len);
+            *out_len += link_len;
+        }
+        st = value + i + 1;
+    }
+}
+
+/**
+ * @brief Remember the preload links of a response under its key, or forget
+ * the key if the response has none. Only "200 OK" responses with an HTML
+ * Content-Type count.
+ *
+ * @param key Cache key of the response.
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ */
+void hints_learn(const char* key, const char* response, int head_len)
+{
+    struct hints_slot* slot = &table[hints_hash(key) & (HINTS_SLOTS - 1)];
+    char links[HINTS_MAX_LEN];
+    int links_len = 0;
+    const char* st = response;
+    const char* end = response + head_len;
+    const char* value;
+    enum http_header header;
+    int value_len;
+    int line_len;
+
+    if (get_status_code(response, head_len) != 200 ||
+        !find_header_field(response, head_len, HTTP_HEADER_CONTENT_TYPE,
+                           &value, &value_len) ||
+        value_len < 9 || strncasecmp(value, "text/html", 9) != 0) {
+        return;
+    }
+
+    /* Each Link field may carry several links. */
+    while (st < end) {
+        line_len = parse_header_field(st, end, &header, &value, &value_len);
+        if (line_len < 0) {
+            break;
+        }
+        if (header == HTTP_HEADER_LINK) {
+            add_links(value, value_len, links, &links_len);
+        }
+        st += line_len;
+    }
+
+    if (links_len == 0) {
+        if (slot->key != NULL && strcmp(slot->key, key) == 0) {
+            free(slot->key);
+            free(slot->links);
+            slot->key = NULL;
+            slot->links = NULL;
+            (stats.forgotten)++;
+        }
+        return;
+    }
+    if (slot->key != NULL && strcmp(slot->key, key) != 0) {
+        free(slot->key);
+        slot->key = NULL;
+        (stats.replaced)++;
+    }
+    if (slot->key == NULL) {
+        slot->key = strdup(key);
+        if (slot->key == NULL) {
+            PLOG_FATAL("strdup");
+        }
+    }
+    free(slot->links);
+    slot->links = malloc(links_len);
+    if (slot->links == NULL) {
+        PLOG_FATAL("malloc");
+    }
+    memcpy(slot->links, links, links_len);
+    slot->links_len = links_len;
+    (stats.learned)++;
+}
+
+/**
+ * @brief Build the 103 response of the preload links of a key.
+ *
+ * @param key Cache key of a request.
+ * @param out_hints Output pointer to the "103 Early Hints" response, with its
+ * empty line. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_hints.
+ * @return int 1 if the key has preload links; 0 otherwise.
+ */
+int hints_get(const char* key, char** out_hints, int* out_len)
+{
+    struct hints_slot* slot = &table[hints_hash(key) & (HINTS_SLOTS - 1)];
+    int head_len = strlen(HINTS_HEAD);
+    char* hints;
+
+    if (slot->key == NULL || strcmp(slot->key, key) != 0) {
+        return 0;
+    }
+    hints = malloc(head_len + slot->links_len + 4);
+    if (hints == NULL) {
+        PLOG_ERROR("malloc");
+        return 0;
+    }
+    memcpy(hints, HINTS_HEAD, head_len);
+    memcpy(hints + head_len, slot->links, slot->links_len);
+    memcpy(hints + head_len + slot->links_len, "\r\n\r\n", 4);
+    *out_hints = hints;
+    *out_len = head_len + slot->links_len + 4;
+    (stats.sent)++;
+    return 1;
+}
+
+/**
+ * @brief Forget all keys, and clear statistics.
+ */
+void hints_clear(void)
+{
+    for (int i = 0; i < HINTS_SLOTS; ++i) {
+        free(table[i].key);
+        free(table[i].links);
+    }
+    memset(table, 0, sizeof(table));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Get statistics of early hints.
+ *
+ * @param out_stats Output; statistics, non-null.
+ */
+void hints_get_stats(struct hints_stats* out_stats)
+{
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+}
+
+/**
+ * @brief Print statistics of early hints.
+ */
+void hints_log_stats(void)
+{
+    int keys = 0;
+
+    for (int i = 0; i < HINTS_SLOTS; ++i) {
+        keys += table[i].key != NULL;
+    }
+    LOG_INFO("early hints stats:\n"
+             "- keys: %d with preload links, %ld learned, %ld forgotten, "
+             "%ld replaced\n"
+             "- 103 responses sent: %ld",
+             keys,
+             stats.learned,
+             stats.forgotten,
+             stats.replaced,
+             stats.sent);
+}
@@ -0,0 +1,80 @@
+/**************************************************************
+*
+*                          hints.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-07
+*
+*     Summary:
+*     Interface for "103 Early Hints" from the preload links of
+*     earlier responses.
+*
+*     The Link fields of each "200 OK" HTML response are
+*     remembered under its cache key, keeping only the links
+*     with rel=preload. A later request for the key that misses
+*     the cache gets them in a 103 response at once, so the
+*     client fetches the subresources while the server works on
+*     the page. The links outlive the cached response, in a
+*     table of HINTS_SLOTS keys where a new key takes the slot
+*     of the one it collides with.
+*
+**************************************************************/
+
+#ifndef HINTS_H
+#define HINTS_H
+
+#define HINTS_SLOTS 1024 /* Number of slots in the hint table; a power of
+                          * 2. */
+#define HINTS_MAX_LEN 2048 /* Max byte size of the preload links of a key;
+                            * links past it are left out. */
+
+struct hints_stats {
+    long learned; /* Number of responses whose preload links were kept. */
+    long forgotten; /* Number of keys dropped as their response no longer had
+                     * preload links. */
+    long replaced; /* Number of keys that lost their slot to another. */
+    long sent; /* Number of 103 responses built. */
+};
+
+/**
+ * @brief Remember the preload links of a response under its key, or forget
+ * the key if the response has none. Only "200 OK" responses with an HTML
+ * Content-Type count.
+ *
+ * @param key Cache key of the response.
+ * @param response Response, which contains its whole head; it need not be
+ * null-terminated.
+ * @param head_len Byte size of the head, including the empty line.
+ */
+void hints_learn(const char* key, const char* response, int head_len);
+
+/**
+ * @brief Build the 103 response of the preload links of a key.
+ *
+ * @param key Cache key of a request.
+ * @param out_hints Output pointer to the "103 Early Hints" response, with its
+ * empty line. Caller is responsible to free it.
+ * @param out_len Output; byte size of *out_hints.
+ * @return int 1 if the key has preload links; 0 otherwise.
+ */
+int hints_get(const char* key, char** out_hints, int* out_len);
+
+/**
+ * @brief Forget all keys, and clear statistics.
+ */
+void hints_clear(void);
+
+/**
+ * @brief Get statistics of early hints.
+ *
+ * @param out_stats Output; statistics, non-null.
+ */
+void hints_get_stats(struct hints_stats* out_stats);
+
+/**
+ * @brief Print statistics of early hints.
+ */
+void hints_log_stats(void);
+
+#endif /* HINTS_H */
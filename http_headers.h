@@ -0,0 +1,69 @@
+/* Generated by gen_http_headers from http_headers.txt; do not edit. */
+
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+enum http_header {
+    HTTP_HEADER_UNKNOWN = 0, /* Not a registered name. */
+    HTTP_HEADER_ACCEPT, /* Accept */
+    HTTP_HEADER_ACCEPT_CHARSET, /* Accept-Charset */
+    HTTP_HEADER_ACCEPT_ENCODING, /* Accept-Encoding */
+    HTTP_HEADER_ACCEPT_LANGUAGE, /* Accept-Language */
+    HTTP_HEADER_ACCEPT_RANGES, /* Accept-Ranges */
+    HTTP_HEADER_AGE, /* Age */
+    HTTP_HEADER_ALLOW, /* Allow */
+    HTTP_HEADER_ALT_SVC, /* Alt-Svc */
+    HTTP_HEADER_AUTHORIZATION, /* Authorization */
+    HTTP_HEADER_CACHE_CONTROL, /* Cache-Control */
+    HTTP_HEADER_CONNECTION, /* Connection */
+    HTTP_HEADER_CONTENT_DISPOSITION, /* Content-Disposition */
+    HTTP_HEADER_CONTENT_ENCODING, /* Content-Encoding */
+    HTTP_HEADER_CONTENT_LANGUAGE, /* Content-Language */
+    HTTP_HEADER_CONTENT_LENGTH, /* Content-Length */
+    HTTP_HEADER_CONTENT_LOCATION, /* Content-Location */
+    HTTP_HEADER_CONTENT_RANGE, /* Content-Range */
+    HTTP_HEADER_CONTENT_TYPE, /* Content-Type */
+    HTTP_HEADER_COOKIE, /* Cookie */
+    HTTP_HEADER_DATE, /* Date */
+    HTTP_HEADER_ETAG, /* ETag */
+    HTTP_HEADER_EXPECT, /* Expect */
+    HTTP_HEADER_EXPIRES, /* Expires */
+    HTTP_HEADER_FORWARDED, /* Forwarded */
+    HTTP_HEADER_FROM, /* From */
+    HTTP_HEADER_HOST, /* Host */
+    HTTP_HEADER_IF_MATCH, /* If-Match */
+    HTTP_HEADER_IF_MODIFIED_SINCE, /* If-Modified-Since */
+    HTTP_HEADER_IF_NONE_MATCH, /* If-None-Match */
+    HTTP_HEADER_IF_RANGE, /* If-Range */
+    HTTP_HEADER_IF_UNMODIFIED_SINCE, /* If-Unmodified-Since */
+    HTTP_HEADER_KEEP_ALIVE, /* Keep-Alive */
+    HTTP_HEADER_LAST_MODIFIED, /* Last-Modified */
+    HTTP_HEADER_LINK, /* Link */
+    HTTP_HEADER_LOCATION, /* Location */
+    HTTP_HEADER_ORIGIN, /* Origin */
+    HTTP_HEADER_PRAGMA, /* Pragma */
+    HTTP_HEADER_PROXY_AUTHENTICATE, /* Proxy-Authenticate */
+    HTTP_HEADER_PROXY_AUTHORIZATION, /* Proxy-Authorization */
+    HTTP_HEADER_PROXY_CONNECTION, /* Proxy-Connection */
+    HTTP_HEADER_RANGE, /* Range */
+    HTTP_HEADER_REFERER, /* Referer */
+    HTTP_HEADER_RETRY_AFTER, /* Retry-After */
+    HTTP_HEADER_SERVER, /* Server */
+    HTTP_HEADER_SET_COOKIE, /* Set-Cookie */
+    HTTP_HEADER_STRICT_TRANSPORT_SECURITY, /* Strict-Transport-Security */
+    HTTP_HEADER_SURROGATE_CONTROL, /* Surrogate-Control */
+    HTTP_HEADER_TE, /* TE */
+    HTTP_HEADER_TRAILER, /* Trailer */
+    HTTP_HEADER_TRANSFER_ENCODING, /* Transfer-Encoding */
+    HTTP_HEADER_UPGRADE, /* Upgrade */
+    HTTP_HEADER_USER_AGENT, /* User-Agent */
+    HTTP_HEADER_VARY, /* Vary */
+    HTTP_HEADER_VIA, /* Via */
+    HTTP_HEADER_WWW_AUTHENTICATE, /* WWW-Authenticate */
+    HTTP_HEADER_WARNING, /* Warning */
+    HTTP_HEADER_X_FORWARDED_FOR, /* X-Forwarded-For */
+    HTTP_HEADER_X_FORWARDED_PROTO, /* X-Forwarded-Proto */
+    NUM_HTTP_HEADERS
+};
+
+#endif /* HTTP_HEADERS_H */
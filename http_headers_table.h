@@ -0,0 +1,109 @@
+/* Generated by gen_http_headers from http_headers.txt; do not edit. */
+
+#ifndef HTTP_HEADERS_TABLE_H
+#define HTTP_HEADERS_TABLE_H
+
+#include "http_headers.h"
+#include <stdint.h>
+
+#define HTTP_HEADER_MAX_LEN 25
+#define HTTP_HEADER_FOLD(c) ((uint32_t)((unsigned char)(c) | 0x20))
+#define HTTP_HEADER_KEY(name, len) ((uint32_t)(len) | \
+    HTTP_HEADER_FOLD((name)[0]) << 8 | \
+    HTTP_HEADER_FOLD((name)[(len) / 2]) << 16 | \
+    HTTP_HEADER_FOLD((name)[(len) - 1]) << 24)
+#define HTTP_HEADER_SLOT(key) \
+    ((uint32_t)((key) * 0xd06e8965u) >> 24)
+
+/* Enum of the name hashed to each slot. */
+static const unsigned char http_header_slots[256] = {
+    0, 0, 0, 0, 54, 0, 0, 0, 23, 0, 0, 39, 0, 0, 0, 0,
+    0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 42, 0, 49, 58, 0,
+    0, 53, 16, 0, 34, 0, 0, 0, 29, 0, 0, 0, 0, 41, 2, 57,
+    0, 0, 0, 0, 0, 0, 0, 45, 9, 0, 0, 0, 0, 0, 33, 51,
+    32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 43, 47,
+    0, 0, 0, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 28, 0, 0, 0, 31, 0, 0, 0, 0, 0, 11, 0, 0, 0, 17,
+    0, 0, 0, 6, 0, 0, 55, 22, 0, 0, 0, 0, 52, 36, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 20, 0, 0, 0, 0, 0,
+    21, 0, 0, 0, 0, 14, 0, 0, 0, 0, 0, 0, 0, 13, 0, 18,
+    0, 0, 0, 0, 0, 26, 0, 0, 0, 0, 0, 0, 0, 38, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 50, 0, 0, 0, 0, 0, 1, 0, 0,
+    0, 56, 30, 0, 48, 0, 0, 0, 0, 0, 8, 37, 0, 35, 0, 0,
+    0, 0, 40, 0, 0, 0, 0, 0, 44, 0, 0, 46, 0, 7, 0, 0,
+    25, 24, 0, 0, 0, 0, 0, 19, 4, 0, 0, 0, 0, 0, 0, 0,
+    3, 27, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0, 0, 5, 0, 0,
+};
+
+/* Canonical name of each enum. */
+static const char* const http_header_names[NUM_HTTP_HEADERS] = {
+    "",
+    "Accept",
+    "Accept-Charset",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Accept-Ranges",
+    "Age",
+    "Allow",
+    "Alt-Svc",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Disposition",
+    "Content-Encoding",
+    "Content-Language",
+    "Content-Length",
+    "Content-Location",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "ETag",
+    "Expect",
+    "Expires",
+    "Forwarded",
+    "From",
+    "Host",
+    "If-Match",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "If-Unmodified-Since",
+    "Keep-Alive",
+    "Last-Modified",
+    "Link",
+    "Location",
+    "Origin",
+    "Pragma",
+    "Proxy-Authenticate",
+    "Proxy-Authorization",
+    "Proxy-Connection",
+    "Range",
+    "Referer",
+    "Retry-After",
+    "Server",
+    "Set-Cookie",
+    "Strict-Transport-Security",
+    "Surrogate-Control",
+    "TE",
+    "Trailer",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Vary",
+    "Via",
+    "WWW-Authenticate",
+    "Warning",
+    "X-Forwarded-For",
+    "X-Forwarded-Proto",
+};
+
+/* Byte size of the name of each enum. */
+static const unsigned char http_header_lens[NUM_HTTP_HEADERS] = {
+    0, 6, 14, 15, 15, 13, 3, 5, 7, 13, 13, 10, 19, 16, 16, 14,
+    16, 13, 12, 6, 4, 4, 6, 7, 9, 4, 4, 8, 17, 13, 8, 19,
+    10, 13, 4, 8, 6, 6, 18, 19, 16, 5, 7, 11, 6, 10, 25, 17,
+    2, 7, 17, 7, 10, 4, 3, 16, 7, 15, 17,
+};
+
+#endif /* HTTP_HEADERS_TABLE_H */
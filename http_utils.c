@@ -11,11 +11,204 @@
 *
 **************************************************************/
 
+#define _GNU_SOURCE /* For strptime() and timegm(). */
 #include "http_utils.h"
+#include "http_headers_table.h"
 #include "logger.h"
+#include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
+#define HTTP_DATE_LEN 64 /* Max byte size of an HTTP date. */
+
+/* Fields copied from a cached response into a 304 response. */
+static const enum http_header not_modified_fields[] = {
+    HTTP_HEADER_ETAG,
+    HTTP_HEADER_LAST_MODIFIED,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_EXPIRES,
+    HTTP_HEADER_VARY,
+    HTTP_HEADER_CONTENT_LOCATION,
+    HTTP_HEADER_DATE,
+};
+/* Value of each hex digit; -1 for other chars. */
+static const signed char hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+#define NUM_NOT_MODIFIED_FIELDS \
+    (sizeof(not_modified_fields) / sizeof(not_modified_fields[0]))
+
+
+/**
+ * @brief Find the empty line between the head and body of an HTTP message.
+ *
+ * It looks for the first "\n" of "\r\n\r\n" with memchr(), which scans many
+ * bytes per step, and is faster than memmem() on this short needle.
+ *
+ * @param msg HTTP request or response; it need not be null-terminated.
+ * @param len Byte size of msg.
+ * @return const char* Start of the first "\r\n\r\n"; NULL if it is not found.
+ */
+static const char* find_empty_line(const char* msg, int len)
+{
+    const char* end = msg + len;
+    const char* pos = msg;
+
+    while (pos < end) {
+        pos = memchr(pos, '\n', end - pos);
+        if (pos == NULL || end - pos < 3) {
+            return NULL;
+        }
+        if (pos > msg && pos[-1] == '\r' && pos[1] == '\r' && pos[2] == '\n') {
+            return pos - 1;
+        }
+        pos++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Parse the value of a Content-Length field.
+ *
+ * @param value Field value; it need not be null-terminated.
+ * @param len Byte size of value.
+ * @return int Content length; 0 if value is not a non-negative decimal number;
+ * INT_MAX if it does not fit in an int.
+ */
+static int parse_content_length(const char* value, int len)
+{
+    long length = 0;
+
+    if (len <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < len; ++i) {
+        if (value[i] < '0' || value[i] > '9') {
+            return 0;
+        }
+        length = length * 10 + (value[i] - '0');
+        if (length > INT_MAX) {
+            return INT_MAX;
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief Walk a chunked body, including the last chunk and the trailer.
+ *
+ * @param body Start of the body; it need not be null-terminated.
+ * @param len Byte size of the buffered body.
+ * @return int Byte size of the body if it is complete; 0 if it is incomplete;
+ * -1 if it violates the chunk format.
+ */
+static int get_chunked_len(const char* body, int len)
+{
+    const char* end = body + len;
+    const char* st = body;
+    const char* line_end;
+
+    while (1) {
+        long chunk_size = 0;
+        const char* digits = st;
+
+        /* Get claimed chunk size. */
+        while (st < end && hex_values[(unsigned char)*st] >= 0) {
+            chunk_size = chunk_size * 16 + hex_values[(unsigned char)*st];
+            if (chunk_size > INT_MAX) {
+                return -1;
+            }
+            st++;
+        }
+        if (st == end) {
+            /* Chunk size is incomplete. */
+            return 0;
+        }
+        if (st == digits) {
+            return -1;
+        }
+        /* Skip chunk extensions and "\r\n". */
+        line_end = memchr(st, '\n', end - st);
+        if (line_end == NULL) {
+            return 0;
+        }
+        if (line_end[-1] != '\r') {
+            return -1;
+        }
+        st = line_end + 1; /* Start of chunk data. */
+        if (chunk_size == 0) {
+            break;
+        }
+        /* Check actual chunk size and the "\r\n" after it. */
+        if (end - st < chunk_size + 2) {
+            return 0;
+        }
+        st += chunk_size;
+        if (st[0] != '\r' || st[1] != '\n') {
+            return -1;
+        }
+        st += 2; /* Start of chunk size. */
+    }
+
+    /* Skip trailer fields up to the empty line. */
+    while (1) {
+        line_end = memchr(st, '\n', end - st);
+        if (line_end == NULL) {
+            return 0;
+        }
+        if (line_end == st || line_end[-1] != '\r') {
+            return -1;
+        }
+        if (line_end == st + 1) {
+            /* Empty line. */
+            return line_end + 1 - body;
+        }
+        st = line_end + 1;
+    }
+}
+
+/**
+ * @brief Get the status code of a response.
+ *
+ * @param response HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @return int Status code; -1 if the status line is invalid.
+ */
+int get_status_code(const char* response, int len)
+{
+    const char* sp;
+
+    if (response == NULL || len <= 0) {
+        return -1;
+    }
+    sp = memchr(response, ' ', len);
+    if (sp == NULL ||
+        response + len - sp < 4 ||
+        !isdigit((unsigned char)sp[1]) ||
+        !isdigit((unsigned char)sp[2]) ||
+        !isdigit((unsigned char)sp[3])) {
+        return -1;
+    }
+    return (sp[1] - '0') * 100 + (sp[2] - '0') * 10 + (sp[3] - '0');
+}
 
 /**
  * @brief Parse HTTP request/response and extract its head and body.
@@ -42,15 +235,15 @@ void parse_body_head(const char* buf,
                      char** out_body,
                      int* out_body_len)
 {
-    char* pos;
+    const char* pos;
     unsigned size;
 
-    if (buf == NULL) {
+    if (buf == NULL || n < 4) {
         return;
     }
 
     /* Find the empty line between head and body. */
-    pos = strstr(buf, "\r\n\r\n");
+    pos = find_empty_line(buf, n);
     /* Invalid response; End of head is not found. */
     if (pos == NULL) {
         return;
@@ -113,7 +306,7 @@ char* get_prefix(const char* str, const char* delim, char** out_prefix)
      * delimiter. */
     len = end - str;
     *out_prefix = malloc(len + 1);
-    if (out_prefix == NULL) {
+    if (*out_prefix == NULL) {
         PLOG_ERROR("malloc");
         return NULL;
     }
@@ -167,38 +360,6 @@ int parse_request_line(const char* line,
     return st - line;
 }
 
-/**
- * @brief Parse the given HTTP header line and extract field name and value.
- *
- * @param line String that starts with a HTTP header line to parse. It may
- * contain other content after the header line.
- * @param out_name Output pointer to a string copy of field name.
- * @param out_value Output pointer to a string copy of field value.
- * @return Length of header line including "\r\n"; -1 if the given request line
- * is invalid.
- */
-int parse_header_line(const char* line, char** out_name, char** out_value)
-{
-    char* st; /* Start of a field. */
-
-    /* Extract field name. */
-    st = get_prefix(line, ": ", out_name);
-    /* ": " is not found. */
-    if (st == NULL) {
-        return -1;
-    }
-
-    /* Extract field value. */
-    st = get_prefix(st, "\r\n", out_value);
-    /* "\r\n" is not found. */
-    if (st == NULL) {
-        return -1;
-    }
-    /* `st` points to the end of `line`. */
-
-    return st - line;
-}
-
 /**
  * @brief Parse the given HTTP request and extract method, url, version and host
  * fields.
@@ -222,34 +383,27 @@ void parse_request_head(const char* request,
     const char* st = request; /* Start of the part to parse. */
     const char* end = request + strlen(request); /* End of request. */
     int len = 0; /* Byte size of the last parsed part. */
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
+    enum http_header header; /* Field name of a header line. */
+    const char* value = NULL; /* Field value of a header line. */
+    int value_len = 0; /* Byte size of the field value. */
 
     /* Parse request line. */
     len = parse_request_line(st, out_method, out_url, out_version);
+    if (len < 0) {
+        return;
+    }
 
     /* Parse each header line. */
     st += len; /* End of request line. */
     while (st < end) {
-        len = parse_header_line(st, &name, &value);
+        len = parse_header_field(st, end, &header, &value, &value_len);
         if (len < 0) {
-            free(name);
-            name = NULL;
-            free(value);
-            value = NULL;
             break;
         }
-        if (name != NULL && strcmp(name, "Host") == 0) {
-            *out_host = value;
-            value = NULL;
-            free(name);
-            name = NULL;
+        if (header == HTTP_HEADER_HOST) {
+            *out_host = strndup(value, value_len);
             break;
         }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
         st += len;
     }
 }
@@ -259,17 +413,24 @@ void parse_request_head(const char* request,
  * hostname and port number.
  *
  * @param host Host field value in an HTTP request. It may not contain port
- * number.
+ * number. If it is NULL, i.e. the request has no Host field, out_hostname and
+ * out_port remain their original values.
  * @param out_hostname Output pointer to a string copy of hostname without port
  * number.
  * @param out_port Output pointer to an integer copy of port number.
- * If port number is not specified in host field, out_port remains its original
- * value.
+ * If port number is not specified in host field, or is not in [1, 65535],
+ * out_port remains its original value.
  */
 void parse_host_field(const char* host, char** out_hostname, int* out_port)
 {
     char* st; /* Start of port number. */
+    char* end; /* End of port number. */
+    long port;
 
+    /* A request without Host field. */
+    if (host == NULL) {
+        return;
+    }
     st = get_prefix(host, ":", out_hostname);
     /* No ":" is found. */
     if (st == NULL) {
@@ -278,10 +439,12 @@ void parse_host_field(const char* host, char** out_hostname, int* out_port)
         return;
     }
     /* Convert substring after the first ":" to port number in integer. */
-    if (st < host + strlen(host)) {
-        *out_port = atoi(st);
+    port = strtol(st, &end, 10);
+    /* If the first ":" is the last char, or the port number is invalid,
+     * out_port will remain. */
+    if (end != st && port > 0 && port <= 65535) {
+        *out_port = port;
     }
-    /* If the first ":" is the last char, out_port will remain.*/
 }
 
 /**
@@ -303,19 +466,19 @@ int parse_status_line(const char* line,
                       char** out_phrase)
 {
     char* st;
-    char* status_code;
+    char* status_code = NULL;
     
     /* Extract version field. */
     st = get_prefix(line, " ", out_version);
     /* " " is not found. */
-    if (*out_version == NULL) {
+    if (st == NULL) {
         return -1;
     }
 
     /* Extract status code field. */
     st = get_prefix(st, " ", &status_code);
     /* " " is not found. */
-    if (status_code == NULL) {
+    if (st == NULL) {
         return -1;
     }
     *out_status_code = atoi(status_code);
@@ -325,7 +488,7 @@ int parse_status_line(const char* line,
     /* Extract phrase field. */
     st = get_prefix(st, "\r\n", out_phrase);
     /* "\r\n" is not found. */
-    if (*out_phrase == NULL) {
+    if (st == NULL) {
         return -1;
     }
 
@@ -359,31 +522,60 @@ void parse_response_head(const char* response,
     const char* st = response; /* Start of the part to parse. */
     const char* end = response + response_len; /* End of response. */
     int len = 0; /* Byte size of the last parsed part. */
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
+    enum http_header header; /* Field name of a header line. */
+    const char* value = NULL; /* Field value of a header line. */
+    int value_len = 0; /* Byte size of the field value. */
+    const char* line_end; /* End of status line. */
+    char* line; /* Null-terminated copy of status line. */
+    char* cache_control = NULL; /* Copy of cache control field. */
+    int head_len; /* Byte size of head. */
 
     /* Parse status line. */
-    len = parse_status_line(response, out_version, out_status_code, out_phrase);
+    line_end = memchr(response, '\n', response_len);
+    if (line_end == NULL) {
+        return;
+    }
+    line = strndup(response, line_end + 1 - response);
+    if (line == NULL) {
+        PLOG_ERROR("strndup");
+        return;
+    }
+    len = parse_status_line(line, out_version, out_status_code, out_phrase);
+    free(line);
+    line = NULL;
+    if (len < 0) {
+        return;
+    }
+    /* Parse header lines only, if the head is complete. */
+    head_len = get_head_len(response, response_len);
+    if (head_len > 0) {
+        end = response + head_len;
+    }
 
     /* Parse each header line. */
     st += len; /* End of status line. */
     while (st < end) {
-        len = parse_header_line(st, &name, &value);
-        if (name != NULL) {
-            if (strcmp(name, "Content-Length") == 0) {
-                *out_content_length = atoi(value);
-            }
-            else if (strcmp(name, "Cache-Control") == 0) {
-                *out_cache_control = value;
-                value = NULL;
-            }
+        len = parse_header_field(st, end, &header, &value, &value_len);
+        if (len < 0) {
+            break;
+        }
+        switch (header) {
+        case HTTP_HEADER_CONTENT_LENGTH:
+            *out_content_length = parse_content_length(value, value_len);
+            break;
+        case HTTP_HEADER_CACHE_CONTROL:
+            /* The last one wins. */
+            free(cache_control);
+            cache_control = strndup(value, value_len);
+            break;
+        default:
+            break;
         }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
         st += len;
     }
+    if (cache_control != NULL) {
+        *out_cache_control = cache_control;
+    }
 }
 
 /**
@@ -417,6 +609,372 @@ void parse_cache_control(const char* cache_control, int* out_max_age)
     *out_max_age = atoi(pos);
 }
 
+/**
+ * @brief Get the byte size of the head of an HTTP request or response,
+ * including the empty line.
+ *
+ * @param msg HTTP request or response; it need not be null-terminated.
+ * @param len Byte size of msg.
+ * @return int Byte size of head; -1 if the head is incomplete.
+ */
+int get_head_len(const char* msg, int len)
+{
+    const char* end;
+
+    if (msg == NULL || len < 4) {
+        return -1;
+    }
+    end = find_empty_line(msg, len);
+    if (end == NULL) {
+        return -1;
+    }
+    return end + 4 - msg;
+}
+
+/**
+ * @brief Map a header field name to its enum, case insensitively.
+ *
+ * Names are registered in http_headers.txt, from which a perfect hash is
+ * generated at build time.
+ *
+ * @param name Field name; it need not be null-terminated.
+ * @param len Byte size of name.
+ * @return enum http_header Enum of the name; HTTP_HEADER_UNKNOWN if the name
+ * is not registered.
+ */
+enum http_header lookup_header_name(const char* name, int len)
+{
+    enum http_header header;
+
+    if (len <= 0 || len > HTTP_HEADER_MAX_LEN) {
+        return HTTP_HEADER_UNKNOWN;
+    }
+    /* The slot holds the only registered name that may match. */
+    header = http_header_slots[HTTP_HEADER_SLOT(HTTP_HEADER_KEY(name, len))];
+    if (http_header_lens[header] != len ||
+        strncasecmp(http_header_names[header], name, len) != 0) {
+        return HTTP_HEADER_UNKNOWN;
+    }
+    return header;
+}
+
+/**
+ * @brief Get the canonical spelling of a header field name.
+ *
+ * @param header Enum of the name.
+ * @return const char* Null-terminated name; an empty string for
+ * HTTP_HEADER_UNKNOWN.
+ */
+const char* get_header_name(enum http_header header)
+{
+    if (header <= HTTP_HEADER_UNKNOWN || header >= NUM_HTTP_HEADERS) {
+        return http_header_names[HTTP_HEADER_UNKNOWN];
+    }
+    return http_header_names[header];
+}
+
+/**
+ * @brief Parse the given header line without copying it.
+ *
+ * @param line Start of a header line; it need not be null-terminated.
+ * @param end End of the buffer that contains line.
+ * @param out_header Output; enum of the field name; HTTP_HEADER_UNKNOWN if
+ * the name is not registered or the line has no colon.
+ * @param out_value Output pointer to the start of the field value in line,
+ * without leading and trailing spaces.
+ * @param out_value_len Output; byte size of the field value.
+ * @return int Byte size of the line including "\r\n"; -1 if the line does not
+ * end before end.
+ */
+int parse_header_field(const char* line,
+                       const char* end,
+                       enum http_header* out_header,
+                       const char** out_value,
+                       int* out_value_len)
+{
+    const char* line_end;
+    const char* colon;
+    const char* value;
+    const char* value_end;
+
+    line_end = memchr(line, '\r', end - line);
+    if (line_end == NULL || line_end + 1 >= end || line_end[1] != '\n') {
+        return -1;
+    }
+    colon = memchr(line, ':', line_end - line);
+    if (colon == NULL) {
+        *out_header = HTTP_HEADER_UNKNOWN;
+        *out_value = line_end;
+        *out_value_len = 0;
+        return line_end + 2 - line;
+    }
+    *out_header = lookup_header_name(line, colon - line);
+
+    value = colon + 1;
+    value_end = line_end;
+    while (value < value_end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    while (value_end > value &&
+           (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+        value_end--;
+    }
+    *out_value = value;
+    *out_value_len = value_end - value;
+    return line_end + 2 - line;
+}
+
+/**
+ * @brief Find the given header field of an HTTP request or response head.
+ *
+ * The buffer need not be null-terminated. Field names are compared case
+ * insensitively, and leading and trailing spaces of the value are skipped.
+ *
+ * @param msg HTTP request or response. It contains the whole head.
+ * @param len Byte size of msg.
+ * @param header Enum of the field name to find.
+ * @param out_value Output pointer to the start of the field value in msg; it
+ * is not changed if the field is not found.
+ * @param out_value_len Output; byte size of the field value; it is not changed
+ * if the field is not found.
+ * @return int 1 if the field is found; 0 otherwise.
+ */
+int find_header_field(const char* msg,
+                      int len,
+                      enum http_header header,
+                      const char** out_value,
+                      int* out_value_len)
+{
+    int head_len = get_head_len(msg, len);
+    const char* st;
+    const char* end;
+    enum http_header line_header;
+    const char* value;
+    int value_len;
+    int line_len;
+
+    if (head_len < 0 || header == HTTP_HEADER_UNKNOWN) {
+        return 0;
+    }
+    end = msg + head_len; /* End of the empty line. */
+    /* Skip the request or status line. */
+    st = memchr(msg, '\n', end - msg);
+    if (st == NULL) {
+        return 0;
+    }
+    st++;
+    while (st < end - 2) {
+        line_len = parse_header_field(st, end, &line_header, &value, &value_len);
+        if (line_len < 0) {
+            return 0;
+        }
+        if (line_header == header) {
+            *out_value = value;
+            *out_value_len = value_len;
+            return 1;
+        }
+        st += line_len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Strip the weakness indicator "W/" of an entity tag.
+ *
+ * @param etag Entity tag; it need not be null-terminated.
+ * @param len Input: byte size of etag; output: byte size of the opaque tag.
+ * @return const char* Start of the opaque tag.
+ */
+static const char* strip_weak(const char* etag, int* len)
+{
+    if (*len >= 2 && etag[0] == 'W' && etag[1] == '/') {
+        *len -= 2;
+        return etag + 2;
+    }
+    return etag;
+}
+
+/**
+ * @brief Check whether a list of entity tags in If-None-Match matches the
+ * given entity tag, using the weak comparison.
+ *
+ * @param list Field value of If-None-Match; it need not be null-terminated.
+ * @param list_len Byte size of list.
+ * @param etag Field value of ETag; it need not be null-terminated.
+ * @param etag_len Byte size of etag.
+ * @return int 1 if any entity tag in list matches, or list is "*"; 0
+ * otherwise.
+ */
+static int etag_list_matches(const char* list,
+                             int list_len,
+                             const char* etag,
+                             int etag_len)
+{
+    const char* end = list + list_len;
+    const char* st = list;
+
+    etag = strip_weak(etag, &etag_len);
+    while (st < end) {
+        const char* comma = memchr(st, ',', end - st);
+        const char* tag_end = comma != NULL ? comma : end;
+        int tag_len;
+
+        while (st < tag_end && (*st == ' ' || *st == '\t')) {
+            st++;
+        }
+        while (tag_end > st && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+            tag_end--;
+        }
+        tag_len = tag_end - st;
+        if (tag_len == 1 && *st == '*') {
+            return 1;
+        }
+        st = strip_weak(st, &tag_len);
+        if (tag_len == etag_len && memcmp(st, etag, tag_len) == 0) {
+            return 1;
+        }
+        st = comma != NULL ? comma + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse an HTTP date in the preferred IMF-fixdate format, e.g.
+ * "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ * @param value HTTP date; it need not be null-terminated.
+ * @param len Byte size of value.
+ * @return time_t Seconds since the Epoch; -1 if value is not a valid date.
+ */
+static time_t parse_http_date(const char* value, int len)
+{
+    char date[HTTP_DATE_LEN];
+    struct tm tm;
+    char* end;
+
+    if (len <= 0 || len >= HTTP_DATE_LEN) {
+        return -1;
+    }
+    memcpy(date, value, len);
+    date[len] = '\0';
+    bzero(&tm, sizeof(tm));
+    end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+/**
+ * @brief Evaluate the conditional fields of a client request against the
+ * validators of a cached response.
+ *
+ * If-None-Match is compared with ETag using the weak comparison; only if the
+ * request has no If-None-Match, If-Modified-Since is compared with
+ * Last-Modified.
+ *
+ * @param request HTTP request head; it need not be null-terminated.
+ * @param request_len Byte size of request.
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param response_len Byte size of response.
+ * @return int 1 if the cached response is not modified, i.e. the client may
+ * be answered with "304 Not Modified"; 0 otherwise.
+ */
+int is_not_modified(const char* request,
+                    int request_len,
+                    const char* response,
+                    int response_len)
+{
+    const char* cond;
+    int cond_len;
+    const char* validator;
+    int validator_len;
+    time_t since;
+    time_t modified;
+
+    if (find_header_field(request, request_len, HTTP_HEADER_IF_NONE_MATCH,
+                          &cond, &cond_len)) {
+        if (cond_len == 1 && *cond == '*') {
+            return 1;
+        }
+        if (!find_header_field(response, response_len, HTTP_HEADER_ETAG,
+                               &validator, &validator_len)) {
+            return 0;
+        }
+        return etag_list_matches(cond, cond_len, validator, validator_len);
+    }
+    if (find_header_field(request, request_len, HTTP_HEADER_IF_MODIFIED_SINCE,
+                          &cond, &cond_len)) {
+        if (!find_header_field(response, response_len, HTTP_HEADER_LAST_MODIFIED,
+                               &validator, &validator_len)) {
+            return 0;
+        }
+        since = parse_http_date(cond, cond_len);
+        modified = parse_http_date(validator, validator_len);
+        return since >= 0 && modified >= 0 && modified <= since;
+    }
+    return 0;
+}
+
+/**
+ * @brief Make the head of a "304 Not Modified" response from a cached
+ * response.
+ *
+ * Only the fields a 304 response carries are copied: ETag, Last-Modified,
+ * Cache-Control, Expires, Vary, Content-Location and Date.
+ *
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param response_len Byte size of response.
+ * @param out_head Output pointer to a null-terminated string of the head
+ * without the empty line. Caller is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 if the head of response is incomplete.
+ */
+int make_not_modified(const char* response,
+                      int response_len,
+                      char** out_head,
+                      int* out_head_len)
+{
+    static const char* status_line = "HTTP/1.1 304 Not Modified\r\n";
+    int response_head_len = get_head_len(response, response_len);
+    const char* value;
+    int value_len;
+    char* head;
+    int len;
+
+    if (response_head_len < 0) {
+        return -1;
+    }
+    /* A copied field is at most 1 byte longer than in response, for the
+     * space after the colon. */
+    head = malloc(strlen(status_line) + response_head_len +
+                  NUM_NOT_MODIFIED_FIELDS + 1);
+    if (head == NULL) {
+        PLOG_FATAL("malloc");
+    }
+    strcpy(head, status_line);
+    len = strlen(status_line);
+    for (size_t i = 0; i < NUM_NOT_MODIFIED_FIELDS; ++i) {
+        const char* name = get_header_name(not_modified_fields[i]);
+
+        if (find_header_field(response, response_head_len,
+                              not_modified_fields[i], &value, &value_len)) {
+            memcpy(head + len, name, strlen(name));
+            len += strlen(name);
+            memcpy(head + len, ": ", 2);
+            len += 2;
+            memcpy(head + len, value, value_len);
+            len += value_len;
+            memcpy(head + len, "\r\n", 2);
+            len += 2;
+        }
+    }
+    head[len] = '\0';
+    *out_head = head;
+    *out_head_len = len;
+    return 0;
+}
+
 /**
  * @brief Extract the first complete HTTP request from buf.
  * 
@@ -441,7 +999,7 @@ int extract_first_request(char** buf,
     }
 
     /* Find the empty line between head and body. */
-    end = strstr(*buf, "\r\n\r\n");
+    end = (char*)find_empty_line(*buf, *n);
     if (end == NULL) {
         /* Request head is incomplete. */
         return 0;
@@ -500,8 +1058,10 @@ int extract_first_response(char** buf,
     char* st = NULL;
     char* end = NULL;
     int len = 0;
-    char* name = NULL; /* Field name of a header line. */
-    char* value = NULL; /* Field value of a header line. */
+    enum http_header header; /* Field name of a header line. */
+    const char* value = NULL; /* Field value of a header line. */
+    int value_len = 0; /* Byte size of the field value. */
+    char* cache_control = NULL;
     int content_length = 0;
 
     if (buf == NULL || *buf == NULL) {
@@ -509,7 +1069,7 @@ int extract_first_response(char** buf,
     }
 
     /* Find the empty line between head and body. */
-    end = strstr(*buf, "\r\n\r\n");
+    end = (char*)find_empty_line(*buf, *n);
     if (end == NULL) {
         /* Request head is incomplete. */
         return 0;
@@ -519,84 +1079,55 @@ int extract_first_response(char** buf,
     /* From now on, the head is completed. */
 
     /* Skip the status line. */
-    st = strstr(*buf, "\r\n");
-    st += strlen("\r\n"); /* Start of the first header line. */
+    st = memchr(*buf, '\n', end - *buf);
+    st += 1; /* Start of the first header line. */
 
     /* Get content length and cache control. */
     *out_max_age = 3600; /* 1h by default. */
     while (st < end) {
-        len = parse_header_line(st, &name, &value);
-        if (name != NULL) {
-            if (strcmp(name, "Content-Length") == 0) {
-                content_length = atoi(value);
-            }
-            else if (strcmp(name, "Cache-Control") == 0) {
-                parse_cache_control(value, out_max_age);
-                /* TODO: Handle other cache-control value. */
-            }
-            else if (strcmp(name, "Transfer-Encoding") == 0 &&
-                     strcmp(value, "chunked") == 0) {
+        len = parse_header_field(st, end, &header, &value, &value_len);
+        if (len < 0) {
+            break;
+        }
+        switch (header) {
+        case HTTP_HEADER_CONTENT_LENGTH:
+            content_length = parse_content_length(value, value_len);
+            break;
+        case HTTP_HEADER_CACHE_CONTROL:
+            cache_control = strndup(value, value_len);
+            parse_cache_control(cache_control, out_max_age);
+            /* TODO: Handle other cache-control value. */
+            free(cache_control);
+            cache_control = NULL;
+            break;
+        case HTTP_HEADER_TRANSFER_ENCODING:
+            /* Chunked is the last coding applied. */
+            if (value_len >= 7 &&
+                strncasecmp(value + value_len - 7, "chunked", 7) == 0) {
                 *is_chunked = 1;
             }
+            break;
+        default:
+            break;
         }
-        free(name);
-        name = NULL;
-        free(value);
-        value = NULL;
         st += len;
     }
 
     /* Check the completeness of body. */
     st = end + strlen("\r\n"); /* Start of body. */
     if (*is_chunked) {
-        long chunk_size = 0;
-
-        if (*n - 5 >= 0 && strncmp(&(*buf)[*n - 5], "0\r\n\r\n", 5) != 0) {
+        /* A complete chunked body ends with an empty line. */
+        if (*n < 4 || memcmp(*buf + *n - 4, "\r\n\r\n", 4) != 0) {
             /* Body is incomplete. */
             return 0;
         }
-        /* The last 5 char in buffer fit the end of chunked response. */
-        /* Check completeness of each chunk. */
-        end = st;
-        while (1) {
-            /* Get claimed chunk size. */
-            chunk_size = strtol(end, &end, 16);
-            if (chunk_size == 0 &&
-                *n - (end - *buf) == 4 &&
-                strncmp(end, "\r\n\r\n", 4) == 0) {
-                /* Response is complete. */
-                break;
-            }
-            /* Skip "\r\n". */
-            if (*n - (end - *buf) < 2) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            if (strncmp(end, "\r\n", 2) != 0) {
-                /* Violate chunk format. */
-                return 0;
-            }
-            end += 2; /* Start of chunk data. */
-            /* Check actual chunk size. */
-            if (*n - (end - *buf) < chunk_size) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            end += chunk_size;
-            /* Skip "\r\n" */
-            if (*n - (end - *buf) < 2) {
-                /* Chunk is incomplete. */
-                return 0;
-            }
-            if (strncmp(end, "\r\n", 2) != 0) {
-                /* Violate chunk format. */
-                return 0;
-            }
-            end += 2; /* Start of chunk size. */
+        if (get_chunked_len(st, *n - (st - *buf)) <= 0) {
+            /* Body is incomplete, or violates chunk format. */
+            return 0;
         }
     }
     else {
-        if (*n - (end - *buf) < content_length) {
+        if (*n - (st - *buf) < content_length) {
             /* Body is incomplete. */
             return 0;
         }
@@ -14,6 +14,8 @@
 #ifndef HTTP_PARSER_H
 #define HTTP_PARSER_H
 
+#include "http_headers.h"
+
 /**
  * @brief Parse HTTP request/response and extract its head and body.
  *
@@ -64,12 +66,13 @@ void parse_request_head(const char* request,
  * hostname and port number.
  *
  * @param host Host field value in an HTTP request. It may not contain port
- * number.
+ * number. If it is NULL, i.e. the request has no Host field, out_hostname and
+ * out_port remain their original values.
  * @param out_hostname Output pointer to a string copy of hostname without port
  * number.
  * @param out_port Output pointer to an integer copy of port number.
- * If port number is not specified in host field, out_port remains its original
- * value.
+ * If port number is not specified in host field, or is not in [1, 65535],
+ * out_port remains its original value.
  */
 void parse_host_field(const char* host, char** out_hostname, int* out_port);
 
@@ -91,6 +94,15 @@ int parse_status_line(const char* line,
                       int* out_status_code,
                       char** out_phrase);
 
+/**
+ * @brief Get the status code of a response.
+ *
+ * @param response HTTP response; it need not be null-terminated.
+ * @param len Byte size of response.
+ * @return int Status code; -1 if the status line is invalid.
+ */
+int get_status_code(const char* response, int len);
+
 /**
  * @brief Parse the given HTTP response, extract version, status code, phrase, 
  * content length and cache_control fields.
@@ -124,6 +136,117 @@ void parse_response_head(const char* response,
  */
 void parse_cache_control(const char* cache_control, int* out_max_age);
 
+/**
+ * @brief Map a header field name to its enum, case insensitively.
+ *
+ * Names are registered in http_headers.txt, from which a perfect hash is
+ * generated at build time.
+ *
+ * @param name Field name; it need not be null-terminated.
+ * @param len Byte size of name.
+ * @return enum http_header Enum of the name; HTTP_HEADER_UNKNOWN if the name
+ * is not registered.
+ */
+enum http_header lookup_header_name(const char* name, int len);
+
+/**
+ * @brief Get the canonical spelling of a header field name.
+ *
+ * @param header Enum of the name.
+ * @return const char* Null-terminated name; an empty string for
+ * HTTP_HEADER_UNKNOWN.
+ */
+const char* get_header_name(enum http_header header);
+
+/**
+ * @brief Parse the given header line without copying it.
+ *
+ * @param line Start of a header line; it need not be null-terminated.
+ * @param end End of the buffer that contains line.
+ * @param out_header Output; enum of the field name; HTTP_HEADER_UNKNOWN if
+ * the name is not registered or the line has no colon.
+ * @param out_value Output pointer to the start of the field value in line,
+ * without leading and trailing spaces.
+ * @param out_value_len Output; byte size of the field value.
+ * @return int Byte size of the line including "\r\n"; -1 if the line does not
+ * end before end.
+ */
+int parse_header_field(const char* line,
+                       const char* end,
+                       enum http_header* out_header,
+                       const char** out_value,
+                       int* out_value_len);
+
+/**
+ * @brief Find the given header field of an HTTP request or response head.
+ *
+ * The buffer need not be null-terminated. Field names are compared case
+ * insensitively, and leading and trailing spaces of the value are skipped.
+ *
+ * @param msg HTTP request or response. It contains the whole head.
+ * @param len Byte size of msg.
+ * @param header Enum of the field name to find.
+ * @param out_value Output pointer to the start of the field value in msg; it
+ * is not changed if the field is not found.
+ * @param out_value_len Output; byte size of the field value; it is not changed
+ * if the field is not found.
+ * @return int 1 if the field is found; 0 otherwise.
+ */
+int find_header_field(const char* msg,
+                      int len,
+                      enum http_header header,
+                      const char** out_value,
+                      int* out_value_len);
+
+/**
+ * @brief Get the byte size of the head of an HTTP request or response,
+ * including the empty line.
+ *
+ * @param msg HTTP request or response; it need not be null-terminated.
+ * @param len Byte size of msg.
+ * @return int Byte size of head; -1 if the head is incomplete.
+ */
+int get_head_len(const char* msg, int len);
+
+/**
+ * @brief Evaluate the conditional fields of a client request against the
+ * validators of a cached response.
+ *
+ * If-None-Match is compared with ETag using the weak comparison; only if the
+ * request has no If-None-Match, If-Modified-Since is compared with
+ * Last-Modified.
+ *
+ * @param request HTTP request head; it need not be null-terminated.
+ * @param request_len Byte size of request.
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param response_len Byte size of response.
+ * @return int 1 if the cached response is not modified, i.e. the client may
+ * be answered with "304 Not Modified"; 0 otherwise.
+ */
+int is_not_modified(const char* request,
+                    int request_len,
+                    const char* response,
+                    int response_len);
+
+/**
+ * @brief Make the head of a "304 Not Modified" response from a cached
+ * response.
+ *
+ * Only the fields a 304 response carries are copied: ETag, Last-Modified,
+ * Cache-Control, Expires, Vary, Content-Location and Date.
+ *
+ * @param response Cached HTTP response; it need not be null-terminated.
+ * @param response_len Byte size of response.
+ * @param out_head Output pointer to a null-terminated string of the head
+ * without the empty line. Caller is responsible to free it.
+ * @param out_head_len Output; byte size of *out_head.
+ * @return int 0 on success; -1 if the head of response is incomplete.
+ */
+int make_not_modified(const char* response,
+                      int response_len,
+                      char** out_head,
+                      int* out_head_len);
+
 /**
  * @brief Extract the first complete HTTP request from buf.
  * 
@@ -0,0 +1,480 @@
+/**************************************************************
+*
+*                         key_pool.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-29
+*
+*     Summary:
+*     Implementation for a pool of threads that runs the RSA
+*     private key operations of TLS handshakes.
+*
+*     An operation is a task shared by the paused job and the
+*     thread that runs it. Each holds a reference, and the last
+*     to let go frees the task and closes its eventfd, so an SSL
+*     freed mid-handshake, which drops the job's reference
+*     through the wait context, never leaves the thread writing
+*     to a closed or reused FD.
+*
+**************************************************************/
+
+#define OPENSSL_SUPPRESS_DEPRECATED /* For RSA_METHOD, the only hook of private
+                                     * key operations in libssl. */
+#include "key_pool.h"
+#include "logger.h"
+#include <openssl/async.h>
+#include <openssl/rsa.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Private encrypt or decrypt of an RSA_METHOD. */
+typedef int (*key_op)(int flen,
+                      const unsigned char* from,
+                      unsigned char* to,
+                      RSA* rsa,
+                      int padding);
+
+struct key_task {
+    key_op op; /* Operation of the default RSA method to run. */
+    RSA* rsa; /* Key, referenced by the task. */
+    unsigned char* from; /* Copy of the input. */
+    int flen; /* Byte size of from. */
+    unsigned char* to; /* Output of RSA_size() bytes. */
+    int padding; /* Padding mode. */
+    int ret; /* Result of op. */
+    int done; /* Whether ret is set. */
+    int refs; /* Number of references, by the job and the thread. */
+    int fd; /* eventfd the thread signals once done. */
+    struct key_task* next; /* Next task in the queue. */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* Guards the queue
+                                                          * and tasks. */
+static pthread_cond_t queued_cond = PTHREAD_COND_INITIALIZER; /* Signals a
+                                                               * queued task or
+                                                               * stop. */
+static struct key_task* queue_head = NULL; /* Oldest queued task. */
+static struct key_task* queue_tail = NULL; /* Newest queued task. */
+static int num_queued = 0; /* Number of queued tasks. */
+static int stopping = 0; /* Set to stop the threads. */
+static pthread_t threads[KEY_POOL_MAX_THREADS]; /* Threads of the pool. */
+static int num_threads = 0; /* Number of running threads. */
+static RSA_METHOD* method = NULL; /* Method of wrapped keys. */
+static const char wait_key = 0; /* Address that keys the eventfd of a task in
+                                 * the wait context of its job. */
+static struct key_pool_stats stats; /* Statistics of the pool. */
+
+/**
+ * @brief Drop a reference to a task, and free it with the last one.
+ *
+ * @param task Task, non-null.
+ */
+static void key_task_release(struct key_task* task)
+{
+    int refs;
+
+    pthread_mutex_lock(&lock);
+    refs = --task->refs;
+    pthread_mutex_unlock(&lock);
+    if (refs > 0) {
+        return;
+    }
+    close(task->fd);
+    RSA_free(task->rsa);
+    free(task->from);
+    free(task->to);
+    free(task);
+}
+
+/**
+ * @brief Run queued tasks until the pool stops and the queue is empty.
+ *
+ * @param arg Unused.
+ * @return void* NULL.
+ */
+static void* key_pool_worker(void* arg)
+{
+    struct key_task* task;
+    int ret;
+
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (queue_head == NULL && !stopping) {
+            pthread_cond_wait(&queued_cond, &lock);
+        }
+        if (queue_head == NULL) {
+            break;
+        }
+        task = queue_head;
+        queue_head = task->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        num_queued--;
+        pthread_mutex_unlock(&lock);
+
+        ret = task->op(task->flen, task->from, task->to, task->rsa,
+                       task->padding);
+
+        pthread_mutex_lock(&lock);
+        task->ret = ret;
+        task->done = 1;
+        pthread_mutex_unlock(&lock);
+        if (eventfd_write(task->fd, 1) < 0) {
+            PLOG_ERROR("eventfd_write");
+        }
+        key_task_release(task);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief Drop the job's reference to its task when its SSL is freed while
+ * the job waits. It is the cleanup of the task's FD in the wait context.
+ *
+ * @param ctx Wait context.
+ * @param key Key of the FD.
+ * @param fd eventfd of the task.
+ * @param task Task.
+ */
+static void key_pool_abandon(ASYNC_WAIT_CTX* ctx,
+                             const void* key,
+                             OSSL_ASYNC_FD fd,
+                             void* task)
+{
+    (void)ctx;
+    (void)key;
+    (void)fd;
+    key_task_release(task);
+}
+
+/**
+ * @brief Queue a task for the pool.
+ *
+ * @param task Task with one reference, non-null.
+ * @return int 0 on success; -1 if the queue is full.
+ */
+static int key_pool_submit(struct key_task* task)
+{
+    pthread_mutex_lock(&lock);
+    if (num_queued >= KEY_POOL_QUEUE) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    task->refs++;
+    if (queue_tail == NULL) {
+        queue_head = task;
+    }
+    else {
+        queue_tail->next = task;
+    }
+    queue_tail = task;
+    num_queued++;
+    if (num_queued > stats.max_queued) {
+        stats.max_queued = num_queued;
+    }
+    pthread_cond_signal(&queued_cond);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/**
+ * @brief Run a private key operation on the pool and pause the async job
+ * until it is done, or on the calling thread outside an async job.
+ *
+ * @param op Operation of the default RSA method.
+ * @param flen Byte size of from.
+ * @param from Input.
+ * @param to Output of RSA_size() bytes.
+ * @param rsa Key.
+ * @param padding Padding mode.
+ * @return int Result of op: byte size of the output; -1 on failure.
+ */
+static int key_pool_run(key_op op,
+                        int flen,
+                        const unsigned char* from,
+                        unsigned char* to,
+                        RSA* rsa,
+                        int padding)
+{
+    ASYNC_JOB* job = ASYNC_get_current_job();
+    ASYNC_WAIT_CTX* wait_ctx = NULL;
+    struct key_task* task = NULL;
+    struct pollfd pfd;
+    int done = 0;
+    int ret;
+
+    if (job == NULL || num_threads == 0) {
+        stats.inline_ops++;
+        return op(flen, from, to, rsa, padding);
+    }
+    wait_ctx = ASYNC_get_wait_ctx(job);
+
+    /* The task outlives this frame if the SSL is freed meanwhile, so it
+     * holds copies of the input and the key. */
+    task = calloc(1, sizeof(*task));
+    if (task == NULL ||
+        (task->from = malloc(flen > 0 ? flen : 1)) == NULL ||
+        (task->to = malloc(RSA_size(rsa))) == NULL ||
+        (task->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        PLOG_ERROR("key task");
+        if (task != NULL) {
+            free(task->from);
+            free(task->to);
+            free(task);
+        }
+        stats.inline_ops++;
+        return op(flen, from, to, rsa, padding);
+    }
+    memcpy(task->from, from, flen);
+    task->op = op;
+    task->flen = flen;
+    task->padding = padding;
+    task->refs = 1;
+    RSA_up_ref(rsa);
+    task->rsa = rsa;
+
+    if (ASYNC_WAIT_CTX_set_wait_fd(wait_ctx,
+                                   &wait_key,
+                                   task->fd,
+                                   task,
+                                   key_pool_abandon) == 0) {
+        key_task_release(task);
+        stats.inline_ops++;
+        return op(flen, from, to, rsa, padding);
+    }
+    if (key_pool_submit(task) < 0) {
+        ASYNC_WAIT_CTX_clear_fd(wait_ctx, &wait_key);
+        key_task_release(task);
+        stats.queue_full++;
+        stats.inline_ops++;
+        return op(flen, from, to, rsa, padding);
+    }
+    stats.offloaded++;
+
+    /* The caller resumes the job once the eventfd is readable, or earlier.
+     * The job pauses at least once even if the thread is done already, so
+     * the caller always sees the operation go to the pool. It waits on the
+     * FD itself if the job cannot pause. */
+    do {
+        if (ASYNC_pause_job() == 0) {
+            pfd.fd = task->fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, -1);
+        }
+        pthread_mutex_lock(&lock);
+        done = task->done;
+        pthread_mutex_unlock(&lock);
+    } while (!done);
+    ASYNC_WAIT_CTX_clear_fd(wait_ctx, &wait_key);
+    ret = task->ret;
+    if (ret > 0) {
+        memcpy(to, task->to, ret);
+    }
+    key_task_release(task);
+    return ret;
+}
+
+/**
+ * @brief Private encrypt, i.e. sign, of wrapped keys.
+ */
+static int key_pool_priv_enc(int flen,
+                             const unsigned char* from,
+                             unsigned char* to,
+                             RSA* rsa,
+                             int padding)
+{
+    return key_pool_run(RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL()),
+                        flen,
+                        from,
+                        to,
+                        rsa,
+                        padding);
+}
+
+/**
+ * @brief Private decrypt, e.g. of an RSA key exchange, of wrapped keys.
+ */
+static int key_pool_priv_dec(int flen,
+                             const unsigned char* from,
+                             unsigned char* to,
+                             RSA* rsa,
+                             int padding)
+{
+    return key_pool_run(RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL()),
+                        flen,
+                        from,
+                        to,
+                        rsa,
+                        padding);
+}
+
+/**
+ * @brief Start the threads of the pool, and clear its statistics.
+ *
+ * @param n Number of threads, from 1 to KEY_POOL_MAX_THREADS.
+ * @return int 0 on success; -1 otherwise, with no thread left running.
+ */
+int key_pool_init(int n)
+{
+    sigset_t all_signals;
+    sigset_t old_signals;
+    int err = 0;
+
+    if (n < 1 || n > KEY_POOL_MAX_THREADS || num_threads > 0) {
+        return -1;
+    }
+    memset(&stats, 0, sizeof(stats));
+    stopping = 0;
+
+    /* Threads inherit a mask that blocks all signals, so the handlers of the
+     * caller, e.g. one that frees its state and exits, run on its thread. */
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+    for (num_threads = 0; num_threads < n; ++num_threads) {
+        err = pthread_create(&threads[num_threads],
+                             NULL,
+                             key_pool_worker,
+                             NULL);
+        if (err != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    if (err != 0) {
+        LOG_ERROR("pthread_create: %s", strerror(err));
+        key_pool_clear();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stop the threads of the pool once the operations they have queued
+ * are done. Keys wrapped by the pool must be freed first.
+ */
+void key_pool_clear(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&queued_cond);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    num_threads = 0;
+    RSA_meth_free(method);
+    method = NULL;
+}
+
+/**
+ * @brief Wrap an RSA private key, so that its private key operations go
+ * to the pool inside async jobs.
+ *
+ * @param pkey RSA private key, non-null.
+ * @return EVP_PKEY* New key, which the caller frees; NULL if the key is not
+ * RSA or on failure.
+ */
+EVP_PKEY* key_pool_wrap(EVP_PKEY* pkey)
+{
+    EVP_PKEY* wrapped;
+    RSA* rsa;
+
+    if (EVP_PKEY_get_base_id(pkey) != EVP_PKEY_RSA) {
+        return NULL;
+    }
+    if (method == NULL) {
+        method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+        if (method == NULL ||
+            RSA_meth_set1_name(method, "key_pool") == 0 ||
+            RSA_meth_set_priv_enc(method, key_pool_priv_enc) == 0 ||
+            RSA_meth_set_priv_dec(method, key_pool_priv_dec) == 0) {
+            RSA_meth_free(method);
+            method = NULL;
+            return NULL;
+        }
+    }
+
+    /* A key with its own method stays on the legacy code path of libcrypto,
+     * which calls the method, instead of going to a provider. */
+    rsa = EVP_PKEY_get1_RSA(pkey);
+    if (rsa == NULL) {
+        return NULL;
+    }
+    wrapped = EVP_PKEY_new();
+    if (wrapped == NULL ||
+        RSA_set_method(rsa, method) == 0 ||
+        EVP_PKEY_assign_RSA(wrapped, rsa) == 0) {
+        EVP_PKEY_free(wrapped);
+        RSA_free(rsa);
+        return NULL;
+    }
+    return wrapped;
+}
+
+/**
+ * @brief Replace the private key of an SSL_CTX with its wrapped key.
+ *
+ * @param ctx SSL_CTX with a certificate and private key, non-null.
+ * @return int 0 on success; -1 if the key is not RSA, the platform has no
+ * async jobs, or on failure, with the key left as it was.
+ */
+int key_pool_use(SSL_CTX* ctx)
+{
+    EVP_PKEY* pkey = SSL_CTX_get0_privatekey(ctx);
+    EVP_PKEY* wrapped;
+    int ret;
+
+    if (!ASYNC_is_capable()) {
+        LOG_ERROR("no async jobs on this platform");
+        return -1;
+    }
+    if (pkey == NULL || (wrapped = key_pool_wrap(pkey)) == NULL) {
+        LOG_ERROR("only RSA private keys go to the key pool");
+        return -1;
+    }
+    ret = SSL_CTX_use_PrivateKey(ctx, wrapped);
+    EVP_PKEY_free(wrapped);
+    return ret == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Get statistics of the pool.
+ *
+ * @param out_stats Output; pool statistics, non-null.
+ */
+void key_pool_get_stats(struct key_pool_stats* out_stats)
+{
+    pthread_mutex_lock(&lock);
+    *out_stats = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Print statistics of the pool.
+ */
+void key_pool_log_stats(void)
+{
+    struct key_pool_stats out;
+
+    key_pool_get_stats(&out);
+    LOG_INFO("key pool stats:\n"
+             "- threads: %d\n"
+             "- offloaded private key operations: %ld\n"
+             "- inline private key operations: %ld, %ld with the queue full\n"
+             "- max queued: %d",
+             num_threads,
+             out.offloaded,
+             out.inline_ops,
+             out.queue_full,
+             out.max_queued);
+}
@@ -0,0 +1,91 @@
+/**************************************************************
+*
+*                         key_pool.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-29
+*
+*     Summary:
+*     Interface for a pool of threads that runs the RSA private
+*     key operations of TLS handshakes, so a signature does not
+*     stall the event loop.
+*
+*     The private key of an SSL_CTX is wrapped in an RSA_METHOD
+*     whose private encrypt and decrypt hand the operation to
+*     the pool when they run inside an OpenSSL async job, i.e.
+*     on an SSL with SSL_MODE_ASYNC. The job then pauses, and
+*     the handshake call returns SSL_ERROR_WANT_ASYNC. Once a
+*     thread is done, it signals an eventfd registered with the
+*     job's wait context (SSL_get_all_async_fds()); calling the
+*     handshake again resumes the job with the result.
+*
+*     Outside an async job, or with KEY_POOL_QUEUE operations
+*     already waiting, an operation runs on the calling thread.
+*
+**************************************************************/
+
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
+#define KEY_POOL_MAX_THREADS 64 /* Max number of threads in the pool. */
+#define KEY_POOL_QUEUE 256 /* Max number of operations waiting for a
+                            * thread. */
+
+struct key_pool_stats {
+    long offloaded; /* Number of operations run by the pool. */
+    long inline_ops; /* Number of operations run on the calling thread. */
+    long queue_full; /* Number of those run there as the queue was full. */
+    int max_queued; /* Max number of operations that waited at once. */
+};
+
+/**
+ * @brief Start the threads of the pool, and clear its statistics.
+ *
+ * @param num_threads Number of threads, from 1 to KEY_POOL_MAX_THREADS.
+ * @return int 0 on success; -1 otherwise, with no thread left running.
+ */
+int key_pool_init(int num_threads);
+
+/**
+ * @brief Stop the threads of the pool once the operations they have queued
+ * are done. Keys wrapped by the pool must be freed first.
+ */
+void key_pool_clear(void);
+
+/**
+ * @brief Wrap an RSA private key, so that its private key operations go
+ * to the pool inside async jobs.
+ *
+ * @param pkey RSA private key, non-null.
+ * @return EVP_PKEY* New key, which the caller frees; NULL if the key is not
+ * RSA or on failure.
+ */
+EVP_PKEY* key_pool_wrap(EVP_PKEY* pkey);
+
+/**
+ * @brief Replace the private key of an SSL_CTX with its wrapped key. Set
+ * SSL_MODE_ASYNC on each SSL whose handshakes should use the pool.
+ *
+ * @param ctx SSL_CTX with a certificate and private key, non-null.
+ * @return int 0 on success; -1 if the key is not RSA, the platform has no
+ * async jobs, or on failure, with the key left as it was.
+ */
+int key_pool_use(SSL_CTX* ctx);
+
+/**
+ * @brief Get statistics of the pool.
+ *
+ * @param out_stats Output; pool statistics, non-null.
+ */
+void key_pool_get_stats(struct key_pool_stats* out_stats);
+
+/**
+ * @brief Print statistics of the pool.
+ */
+void key_pool_log_stats(void);
+
+#endif /* KEY_POOL_H */
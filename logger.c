@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
+int log_quiet = 0;
+
 /**
  * @brief Print log message with source file path and line number to stderr.
  *
@@ -23,6 +23,10 @@
  */
 void print_log(const char* file, int line, const char* fmt, ...);
 
+/* Nonzero to drop info and error messages, e.g. in simulation; fatal messages
+ * are always printed. */
+extern int log_quiet;
+
 #define LOG_RED "\x1B[31m"
 #define LOG_NORMAL "\x1B[0m"
 
@@ -31,7 +35,12 @@ void print_log(const char* file, int line, const char* fmt, ...);
  *
  * @param fmt Message format.
  */
-#define LOG_INFO(fmt, ...) print_log(__FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)                                                     \
+        do {                                                                   \
+            if (!log_quiet) {                                                  \
+                print_log(__FILE__, __LINE__, fmt, ##__VA_ARGS__);             \
+            }                                                                  \
+        } while(0)
 
 /**
  * @brief Print error message to stderr.
@@ -39,10 +48,14 @@ void print_log(const char* file, int line, const char* fmt, ...);
  * @param fmt Message format.
  */
 #define LOG_ERROR(fmt, ...)                                                    \
-        print_log(__FILE__,                                                    \
-                  __LINE__,                                                    \
-                  LOG_RED "error: " LOG_NORMAL fmt,                            \
-                  ##__VA_ARGS__)
+        do {                                                                   \
+            if (!log_quiet) {                                                  \
+                print_log(__FILE__,                                            \
+                          __LINE__,                                            \
+                          LOG_RED "error: " LOG_NORMAL fmt,                    \
+                          ##__VA_ARGS__);                                      \
+            }                                                                  \
+        } while(0)
 
 /**
  * @brief Print fatal message to stderr and exit on failure.
@@ -0,0 +1,171 @@
+/**************************************************************
+*
+*                       mem_pressure.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-16
+*
+*     Summary:
+*     Implementation for reading memory pressure of the cgroup
+*     and sizing the cache budget from it.
+*
+*     The budget follows additive increase, multiplicative
+*     decrease: it drops fast when the kernel reports stalls
+*     or memory nears the limit, and creeps back once both
+*     have subsided, so it does not oscillate.
+*
+**************************************************************/
+
+#include "mem_pressure.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MEM_PRESSURE_HIGH 0.9 /* Fraction of the limit that is pressure. */
+#define MEM_PRESSURE_LOW 0.8 /* Fraction of the limit below which the budget
+                              * may regrow. */
+#define MEM_PRESSURE_SHRINK 4 /* The budget shrinks by 1/4 under pressure. */
+#define MEM_PRESSURE_GROW 16 /* The budget regrows by 1/16 of the max. */
+#define MEM_PRESSURE_PATH_LEN 512 /* Max byte size of a cgroup file path. */
+
+/**
+ * @brief Read a single integer from a cgroup file.
+ *
+ * @param dir Directory of the cgroup.
+ * @param name File name.
+ * @param out_value Output; the value; -1 for "max".
+ * @return int 0 on success; -1 otherwise.
+ */
+static int read_long(const char* dir, const char* name, long* out_value)
+{
+    char path[MEM_PRESSURE_PATH_LEN];
+    char buf[64];
+    FILE* file;
+    int ok;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    ok = fgets(buf, sizeof(buf), file) != NULL;
+    fclose(file);
+    if (!ok) {
+        return -1;
+    }
+    if (strncmp(buf, "max", 3) == 0) {
+        *out_value = -1;
+        return 0;
+    }
+    return sscanf(buf, "%ld", out_value) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Read the "some avg10" value of a PSI file.
+ *
+ * @param path Path of the PSI file.
+ * @param out_avg10 Output; percentage of time some task stalled.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int read_psi(const char* path, double* out_avg10)
+{
+    char line[256];
+    FILE* file;
+    int ret = -1;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "some avg10=%lf", out_avg10) == 1) {
+            ret = 0;
+            break;
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+/**
+ * @brief Read memory pressure of the cgroup.
+ *
+ * It reads memory.pressure, memory.current and memory.max of cgroup v2, or
+ * memory.usage_in_bytes and memory.limit_in_bytes of cgroup v1. If the cgroup
+ * has no pressure file, the system wide /proc/pressure/memory is used.
+ *
+ * @param cgroup_dir Directory of the cgroup, non-null.
+ * @param out_pressure Output; fields that cannot be read are set to -1.
+ * @return int 0 if any field is read; -1 otherwise.
+ */
+int mem_pressure_read(const char* cgroup_dir,
+                      struct mem_pressure* out_pressure)
+{
+    char path[MEM_PRESSURE_PATH_LEN];
+
+    if (cgroup_dir == NULL || out_pressure == NULL) {
+        return -1;
+    }
+    out_pressure->some_avg10 = -1;
+    out_pressure->current = -1;
+    out_pressure->limit = -1;
+
+    snprintf(path, sizeof(path), "%s/memory.pressure", cgroup_dir);
+    if (read_psi(path, &out_pressure->some_avg10) < 0 &&
+        read_psi("/proc/pressure/memory", &out_pressure->some_avg10) < 0) {
+        out_pressure->some_avg10 = -1;
+    }
+    if (read_long(cgroup_dir, "memory.current", &out_pressure->current) < 0 &&
+        read_long(cgroup_dir,
+                  "memory.usage_in_bytes",
+                  &out_pressure->current) < 0) {
+        out_pressure->current = -1;
+    }
+    if (read_long(cgroup_dir, "memory.max", &out_pressure->limit) < 0 &&
+        read_long(cgroup_dir,
+                  "memory.limit_in_bytes",
+                  &out_pressure->limit) < 0) {
+        out_pressure->limit = -1;
+    }
+    return out_pressure->some_avg10 >= 0 || out_pressure->current >= 0 ?
+           0 : -1;
+}
+
+/**
+ * @brief Get the next cache budget from the current budget and pressure.
+ *
+ * @param config Sizing configuration, non-null.
+ * @param pressure Latest pressure reading, non-null.
+ * @param budget Current budget in bytes.
+ * @return size_t Next budget in bytes, within [min_budget, max_budget].
+ */
+size_t mem_pressure_next_budget(const struct mem_pressure_config* config,
+                                const struct mem_pressure* pressure,
+                                size_t budget)
+{
+    long limit = config->limit > 0 ? config->limit : pressure->limit;
+    int stalled = pressure->some_avg10 >= config->psi_threshold;
+    int calm = pressure->some_avg10 < config->psi_threshold / 2;
+    size_t step = config->max_budget / MEM_PRESSURE_GROW;
+
+    /* Without a limit, cgroup v1 reports a huge one that never triggers. */
+    if (limit > 0 && pressure->current >= 0) {
+        stalled = stalled || pressure->current > limit * MEM_PRESSURE_HIGH;
+        calm = calm && pressure->current < limit * MEM_PRESSURE_LOW;
+    }
+
+    if (stalled) {
+        budget -= budget / MEM_PRESSURE_SHRINK;
+    }
+    else if (calm) {
+        budget = budget + step > config->max_budget ?
+                 config->max_budget : budget + step;
+    }
+    if (budget < config->min_budget) {
+        budget = config->min_budget;
+    }
+    if (budget > config->max_budget) {
+        budget = config->max_budget;
+    }
+    return budget;
+}
@@ -0,0 +1,71 @@
+/**************************************************************
+*
+*                       mem_pressure.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-16
+*
+*     Summary:
+*     Interface for reading memory pressure of the cgroup and
+*     sizing the cache budget from it.
+*
+**************************************************************/
+
+#ifndef MEM_PRESSURE_H
+#define MEM_PRESSURE_H
+
+#include <stddef.h>
+
+#define MEM_PRESSURE_CGROUP_DIR "/sys/fs/cgroup" /* Default cgroup v2 mount. */
+#define MEM_PRESSURE_PSI_THRESHOLD 10.0 /* Default percentage of time stalled
+                                         * on memory that counts as pressure. */
+
+struct mem_pressure {
+    double some_avg10; /* Percentage of time in the last 10 s that some task
+                        * stalled on memory; -1 if unknown. */
+    long current; /* Bytes of memory charged to the cgroup; -1 if unknown. */
+    long limit; /* Byte limit of the cgroup; -1 if none or unknown. */
+};
+
+struct mem_pressure_config {
+    long limit; /* Byte limit to keep memory under; 0 to use the limit of the
+                 * cgroup. */
+    double psi_threshold; /* Percentage of time stalled on memory, in the last
+                           * 10 s, above which the budget shrinks. */
+    size_t min_budget; /* Smallest budget in bytes. */
+    size_t max_budget; /* Largest budget in bytes, i.e. the arena size. */
+};
+
+/**
+ * @brief Read memory pressure of the cgroup.
+ *
+ * It reads memory.pressure, memory.current and memory.max of cgroup v2, or
+ * memory.usage_in_bytes and memory.limit_in_bytes of cgroup v1. If the cgroup
+ * has no pressure file, the system wide /proc/pressure/memory is used.
+ *
+ * @param cgroup_dir Directory of the cgroup, non-null.
+ * @param out_pressure Output; fields that cannot be read are set to -1.
+ * @return int 0 if any field is read; -1 otherwise.
+ */
+int mem_pressure_read(const char* cgroup_dir,
+                      struct mem_pressure* out_pressure);
+
+/**
+ * @brief Get the next cache budget from the current budget and pressure.
+ *
+ * Under pressure, i.e. stall time above the threshold or memory above 90% of
+ * the limit, the budget shrinks by a quarter. Once stall time is below half
+ * the threshold and memory below 80% of the limit, it regrows by 1/16 of the
+ * max budget. In between, it holds.
+ *
+ * @param config Sizing configuration, non-null.
+ * @param pressure Latest pressure reading, non-null.
+ * @param budget Current budget in bytes.
+ * @return size_t Next budget in bytes, within [min_budget, max_budget].
+ */
+size_t mem_pressure_next_budget(const struct mem_pressure_config* config,
+                                const struct mem_pressure* pressure,
+                                size_t budget);
+
+#endif /* MEM_PRESSURE_H */
@@ -0,0 +1,382 @@
+/**************************************************************
+*
+*                          netio.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Implementation for the socket, clock and DNS layer of the
+*     proxy.
+*
+**************************************************************/
+
+#include "netio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @brief Open a non-blocking TCP socket listening on all addresses.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections.
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+static int sys_listen(int port, int backlog)
+{
+    int sock;
+    int optval = 1;
+    struct sockaddr_in addr;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    /* Allow reuse of local addresses. */
+    if (setsockopt(sock,
+                   SOL_SOCKET,
+                   SO_REUSEADDR,
+                   (const void*)&optval,
+                   sizeof(int)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    /* Set socket non-block. */
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    /* Build the sock's internet address. */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET; /* Use the Internet. */
+    addr.sin_port = htons((unsigned short)port); /* Port to listen. */
+    addr.sin_addr.s_addr = htonl(INADDR_ANY); /* Let the system figure out our
+                                               * IP address. */
+
+    /* Associate the proxy socket with the given IP address and port. */
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(sock, backlog) < 0) {
+        int err = errno;
+
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Accept a pending client, with Nagle's algorithm off.
+ *
+ * @param listen_fd FD of the listening socket.
+ * @param addr Output; client address.
+ * @return int FD of the client socket; -1 on failure, with errno set.
+ */
+static int sys_accept(int listen_fd, struct sockaddr_in* addr)
+{
+    socklen_t size = sizeof(*addr);
+    int optval = 1;
+    int sock = accept(listen_fd, (struct sockaddr*)addr, &size);
+
+    /* A response goes out in several writes; with Nagle's algorithm the later
+     * ones wait for the client's delayed ACK of the first, up to 40 ms. */
+    if (sock >= 0) {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+    return sock;
+}
+
+/**
+ * @brief Open a TCP socket, with Nagle's algorithm off.
+ *
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+static int sys_socket(void)
+{
+    int optval = 1;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock >= 0) {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+    return sock;
+}
+
+/**
+ * @brief Connect a socket.
+ *
+ * The send timeout of a blocking socket also bounds connect(), which then
+ * fails with EINPROGRESS; it is reset afterwards so it does not bound writes.
+ *
+ * @param fd FD of the socket.
+ * @param addr Server address.
+ * @param timeout Max seconds to wait; 0 to wait as long as the system does.
+ * @return int 0 on success; -1 on failure, with errno set, to ETIMEDOUT if
+ * the connection is not established in time.
+ */
+static int sys_connect(int fd, const struct sockaddr_in* addr, int timeout)
+{
+    struct timeval tv;
+    int ret;
+    int err;
+
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    if (timeout > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    ret = connect(fd, (const struct sockaddr*)addr, sizeof(*addr));
+    err = errno;
+    if (timeout > 0) {
+        tv.tv_sec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    if (ret < 0 && err == EINPROGRESS) {
+        err = ETIMEDOUT;
+    }
+    errno = err;
+    return ret;
+}
+
+/**
+ * @brief Resolve the IPv4 addresses of a hostname.
+ *
+ * @param hostname Hostname.
+ * @param addrs Output; addresses of the host.
+ * @param max Max number of addresses to store in addrs, positive.
+ * @return int Number of addresses stored; -1 if the host cannot be resolved.
+ */
+static int sys_resolve(const char* hostname, struct in_addr* addrs, int max)
+{
+    struct hostent* server = gethostbyname(hostname);
+    int n = 0;
+
+    if (server == NULL || server->h_addrtype != AF_INET) {
+        return -1;
+    }
+    while (n < max && server->h_addr_list[n] != NULL) {
+        memcpy(&addrs[n], server->h_addr_list[n], sizeof(*addrs));
+        n++;
+    }
+    return n > 0 ? n : -1;
+}
+
+/**
+ * @brief Wait until a socket is readable or the timeout expires.
+ *
+ * @param nfds Largest FD in readfds plus 1.
+ * @param readfds Input and output; sockets to wait on, then readable ones.
+ * @param timeout Max wait; NULL to wait forever.
+ * @return int Number of readable sockets; -1 on failure, with errno set.
+ */
+static int sys_select(int nfds, fd_set* readfds, struct timeval* timeout)
+{
+    return select(nfds, readfds, NULL, NULL, timeout);
+}
+
+/**
+ * @brief Get the current time.
+ *
+ * @return time_t Current time in seconds since the epoch.
+ */
+static time_t sys_now(void)
+{
+    return time(NULL);
+}
+
+/**
+ * @brief Get a monotonic time to measure latencies with.
+ *
+ * @return long Microseconds since an arbitrary point.
+ */
+static long sys_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static const struct netio_ops sys_ops = {
+    sys_listen,
+    sys_accept,
+    sys_socket,
+    sys_connect,
+    read,
+    write,
+    close,
+    sys_select,
+    sys_resolve,
+    sys_now,
+    sys_now_us,
+}; /* Operations of the system. */
+static const struct netio_ops* ops = &sys_ops; /* Installed operations. */
+
+/**
+ * @brief Install socket, clock and DNS operations.
+ *
+ * @param new_ops Operations; NULL restores the system ones. It must outlive
+ * its use.
+ */
+void netio_set_ops(const struct netio_ops* new_ops)
+{
+    ops = new_ops != NULL ? new_ops : &sys_ops;
+}
+
+/**
+ * @brief Open a non-blocking TCP socket listening on all addresses.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections.
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+int netio_listen(int port, int backlog)
+{
+    return ops->listen(port, backlog);
+}
+
+/**
+ * @brief Accept a pending client.
+ *
+ * @param listen_fd FD of the listening socket.
+ * @param addr Output; client address.
+ * @return int FD of the client socket; -1 on failure, with errno set.
+ */
+int netio_accept(int listen_fd, struct sockaddr_in* addr)
+{
+    return ops->accept(listen_fd, addr);
+}
+
+/**
+ * @brief Open a TCP socket.
+ *
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+int netio_socket(void)
+{
+    return ops->socket();
+}
+
+/**
+ * @brief Connect a socket.
+ *
+ * @param fd FD of the socket.
+ * @param addr Server address.
+ * @param timeout Max seconds to wait; 0 to wait as long as the system does.
+ * @return int 0 on success; -1 on failure, with errno set, to ETIMEDOUT if
+ * the connection is not established in time.
+ */
+int netio_connect(int fd, const struct sockaddr_in* addr, int timeout)
+{
+    return ops->connect(fd, addr, timeout);
+}
+
+/**
+ * @brief Read a socket.
+ *
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param n Byte size of buf.
+ * @return ssize_t Byte size read; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+ssize_t netio_read(int fd, void* buf, size_t n)
+{
+    return ops->read(fd, buf, n);
+}
+
+/**
+ * @brief Write all bytes to a socket, retrying on short writes and EINTR.
+ *
+ * A blocking socket may still write less than asked, e.g. when a signal
+ * arrives mid-write; the rest would be lost otherwise.
+ *
+ * @param fd FD of the socket.
+ * @param buf Bytes to write.
+ * @param n Byte size of buf.
+ * @return ssize_t n on success; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+ssize_t netio_write(int fd, const void* buf, size_t n)
+{
+    size_t sent = 0;
+
+    while (sent < n) {
+        ssize_t ret = ops->write(fd, (const char*)buf + sent, n - sent);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            return 0;
+        }
+        sent += ret;
+    }
+    return n;
+}
+
+/**
+ * @brief Close a socket.
+ *
+ * @param fd FD of the socket.
+ * @return int 0 on success; -1 on failure, with errno set.
+ */
+int netio_close(int fd)
+{
+    return ops->close(fd);
+}
+
+/**
+ * @brief Wait until a socket is readable or the timeout expires.
+ *
+ * @param nfds Largest FD in readfds plus 1.
+ * @param readfds Input and output; sockets to wait on, then readable ones.
+ * @param timeout Max wait; NULL to wait forever.
+ * @return int Number of readable sockets; -1 on failure, with errno set.
+ */
+int netio_select(int nfds, fd_set* readfds, struct timeval* timeout)
+{
+    return ops->select(nfds, readfds, timeout);
+}
+
+/**
+ * @brief Resolve the IPv4 addresses of a hostname.
+ *
+ * @param hostname Hostname.
+ * @param addrs Output; addresses of the host.
+ * @param max Max number of addresses to store in addrs, positive.
+ * @return int Number of addresses stored; -1 if the host cannot be resolved.
+ */
+int netio_resolve(const char* hostname, struct in_addr* addrs, int max)
+{
+    return ops->resolve(hostname, addrs, max);
+}
+
+/**
+ * @brief Get the current time.
+ *
+ * @return time_t Current time in seconds since the epoch.
+ */
+time_t netio_now(void)
+{
+    return ops->now();
+}
+
+/**
+ * @brief Get a monotonic time to measure latencies with.
+ *
+ * @return long Microseconds since an arbitrary point.
+ */
+long netio_now_us(void)
+{
+    return ops->now_us();
+}
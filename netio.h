@@ -0,0 +1,158 @@
+/**************************************************************
+*
+*                          netio.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Interface for the socket, clock and DNS layer of the
+*     proxy. Calls go to the system by default; a simulator
+*     can install its own operations to run the proxy in
+*     virtual time.
+*
+**************************************************************/
+
+#ifndef NETIO_H
+#define NETIO_H
+
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct netio_ops {
+    int (*listen)(int port, int backlog); /* Open a listening TCP socket. */
+    int (*accept)(int listen_fd,
+                  struct sockaddr_in* addr); /* Accept a client. */
+    int (*socket)(void); /* Open a TCP socket. */
+    int (*connect)(int fd,
+                   const struct sockaddr_in* addr,
+                   int timeout); /* Connect a socket. */
+    ssize_t (*read)(int fd, void* buf, size_t n); /* Read a socket. */
+    ssize_t (*write)(int fd,
+                     const void* buf,
+                     size_t n); /* Write a socket; it may write less than n
+                                 * bytes. */
+    int (*close)(int fd); /* Close a socket. */
+    int (*select)(int nfds,
+                  fd_set* readfds,
+                  struct timeval* timeout); /* Wait for readable sockets. */
+    int (*resolve)(const char* hostname,
+                   struct in_addr* addrs,
+                   int max); /* Resolve IPv4 addresses. */
+    time_t (*now)(void); /* Current time in seconds. */
+    long (*now_us)(void); /* Monotonic time in microseconds. */
+};
+
+/**
+ * @brief Install socket, clock and DNS operations.
+ *
+ * @param ops Operations; NULL restores the system ones. It must outlive its
+ * use.
+ */
+void netio_set_ops(const struct netio_ops* ops);
+
+/**
+ * @brief Open a non-blocking TCP socket listening on all addresses.
+ *
+ * @param port Port to listen on.
+ * @param backlog Max length of the queue of pending connections.
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+int netio_listen(int port, int backlog);
+
+/**
+ * @brief Accept a pending client. The system one turns Nagle's algorithm off,
+ * so a response written in pieces is not held back for delayed ACKs.
+ *
+ * @param listen_fd FD of the listening socket.
+ * @param addr Output; client address.
+ * @return int FD of the client socket; -1 on failure, with errno set.
+ */
+int netio_accept(int listen_fd, struct sockaddr_in* addr);
+
+/**
+ * @brief Open a TCP socket. The system one turns Nagle's algorithm off.
+ *
+ * @return int FD of the socket; -1 on failure, with errno set.
+ */
+int netio_socket(void);
+
+/**
+ * @brief Connect a socket.
+ *
+ * @param fd FD of the socket.
+ * @param addr Server address.
+ * @param timeout Max seconds to wait; 0 to wait as long as the system does.
+ * @return int 0 on success; -1 on failure, with errno set, to ETIMEDOUT if
+ * the connection is not established in time.
+ */
+int netio_connect(int fd, const struct sockaddr_in* addr, int timeout);
+
+/**
+ * @brief Read a socket.
+ *
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param n Byte size of buf.
+ * @return ssize_t Byte size read; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+ssize_t netio_read(int fd, void* buf, size_t n);
+
+/**
+ * @brief Write all bytes to a socket, retrying on short writes and EINTR.
+ *
+ * @param fd FD of the socket.
+ * @param buf Bytes to write.
+ * @param n Byte size of buf.
+ * @return ssize_t n on success; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+ssize_t netio_write(int fd, const void* buf, size_t n);
+
+/**
+ * @brief Close a socket.
+ *
+ * @param fd FD of the socket.
+ * @return int 0 on success; -1 on failure, with errno set.
+ */
+int netio_close(int fd);
+
+/**
+ * @brief Wait until a socket is readable or the timeout expires.
+ *
+ * @param nfds Largest FD in readfds plus 1.
+ * @param readfds Input and output; sockets to wait on, then readable ones.
+ * @param timeout Max wait; NULL to wait forever.
+ * @return int Number of readable sockets; -1 on failure, with errno set.
+ */
+int netio_select(int nfds, fd_set* readfds, struct timeval* timeout);
+
+/**
+ * @brief Resolve the IPv4 addresses of a hostname.
+ *
+ * @param hostname Hostname.
+ * @param addrs Output; addresses of the host.
+ * @param max Max number of addresses to store in addrs, positive.
+ * @return int Number of addresses stored; -1 if the host cannot be resolved.
+ */
+int netio_resolve(const char* hostname, struct in_addr* addrs, int max);
+
+/**
+ * @brief Get the current time.
+ *
+ * @return time_t Current time in seconds since the epoch.
+ */
+time_t netio_now(void);
+
+/**
+ * @brief Get a monotonic time to measure latencies with.
+ *
+ * @return long Microseconds since an arbitrary point.
+ */
+long netio_now_us(void);
+
+#endif /* NETIO_H */
@@ -0,0 +1,468 @@
+/**************************************************************
+*
+*                          plugin.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Implementation for loading plugins and running their
+*     hooks.
+*
+**************************************************************/
+
+#include "plugin.h"
+#include "logger.h"
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Verdicts allowed at each stage, as bit masks. */
+#define ALLOW(v) (1U << (v))
+#define ALLOW_REQUEST_HEAD (ALLOW(PLUGIN_CONTINUE) | ALLOW(PLUGIN_REPLACE) | \
+                            ALLOW(PLUGIN_RESPOND) | ALLOW(PLUGIN_CLOSE))
+#define ALLOW_CACHE_LOOKUP (ALLOW(PLUGIN_CONTINUE) | ALLOW(PLUGIN_REPLACE) | \
+                            ALLOW(PLUGIN_BYPASS) | ALLOW(PLUGIN_CLOSE))
+#define ALLOW_REPLACE (ALLOW(PLUGIN_CONTINUE) | ALLOW(PLUGIN_REPLACE) | \
+                       ALLOW(PLUGIN_CLOSE))
+#define ALLOW_BODY_CHUNK (ALLOW(PLUGIN_CONTINUE) | ALLOW(PLUGIN_CLOSE))
+
+/* A registered plugin. */
+struct plugin {
+    const struct plugin_desc* desc; /* Descriptor. */
+    void* handle; /* Handle of its shared object; NULL if linked in. */
+    void* data; /* Data its init returned. */
+};
+
+/* Names of stages, indexed by enum plugin_stage. */
+static const char* stage_names[PLUGIN_NUM_STAGES] = {
+    "request_head", "cache_lookup", "upstream_select", "response_head",
+    "body_chunk",
+};
+
+int plugin_hooks[PLUGIN_NUM_STAGES]; /* Number of hooks of each stage. */
+static struct plugin plugins[PLUGIN_MAX]; /* Plugins in load order. */
+static int num_plugins = 0; /* Number of plugins. */
+static char arena_mem[PLUGIN_ARENA_SIZE]; /* Memory of the arena. */
+static struct plugin_arena arena = {arena_mem, PLUGIN_ARENA_SIZE, 0};
+static struct plugin_stats stats; /* Plugin statistics. */
+
+/**
+ * @brief Register a plugin, calling its init.
+ *
+ * @param desc Descriptor.
+ * @param arg Argument of its init; NULL for none.
+ * @param handle Handle of its shared object; NULL if linked in.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int add_plugin(const struct plugin_desc* desc,
+                      const char* arg,
+                      void* handle)
+{
+    struct plugin* p;
+
+    if (num_plugins == PLUGIN_MAX) {
+        LOG_ERROR("too many plugins");
+        return -1;
+    }
+    if (desc->abi_version != PLUGIN_ABI_VERSION) {
+        LOG_ERROR("plugin %s is built for ABI %d, not %d",
+                  desc->name != NULL ? desc->name : "?",
+                  desc->abi_version,
+                  PLUGIN_ABI_VERSION);
+        return -1;
+    }
+    p = &plugins[num_plugins];
+    p->desc = desc;
+    p->handle = handle;
+    p->data = NULL;
+    if (desc->init != NULL && desc->init(arg, &p->data) != 0) {
+        LOG_ERROR("plugin %s failed to init", desc->name);
+        return -1;
+    }
+    num_plugins++;
+    plugin_hooks[PLUGIN_REQUEST_HEAD] += desc->request_head != NULL;
+    plugin_hooks[PLUGIN_CACHE_LOOKUP] += desc->cache_lookup != NULL;
+    plugin_hooks[PLUGIN_UPSTREAM_SELECT] += desc->upstream_select != NULL;
+    plugin_hooks[PLUGIN_RESPONSE_HEAD] += desc->response_head != NULL;
+    plugin_hooks[PLUGIN_BODY_CHUNK] += desc->body_chunk != NULL;
+    LOG_INFO("loaded plugin %s", desc->name);
+    return 0;
+}
+
+/**
+ * @brief Load a plugin from a shared object, and register its hooks.
+ *
+ * @param spec Path of the shared object, then optionally '=' and the argument
+ * of its init, e.g. "./plugin_example.so=header=X-Edge: 1".
+ * @return int 0 on success; -1 otherwise.
+ */
+int plugin_load(const char* spec)
+{
+    char* path = strdup(spec);
+    char* arg = NULL;
+    void* handle;
+    const struct plugin_desc* desc;
+
+    if (path == NULL) {
+        PLOG_ERROR("strdup");
+        return -1;
+    }
+    arg = strchr(path, '=');
+    if (arg != NULL) {
+        *arg++ = '\0';
+    }
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        LOG_ERROR("dlopen: %s", dlerror());
+        free(path);
+        return -1;
+    }
+    desc = dlsym(handle, PLUGIN_SYMBOL);
+    if (desc == NULL) {
+        LOG_ERROR("%s has no %s", path, PLUGIN_SYMBOL);
+        dlclose(handle);
+        free(path);
+        return -1;
+    }
+    if (add_plugin(desc, arg, handle) < 0) {
+        dlclose(handle);
+        free(path);
+        return -1;
+    }
+    free(path);
+    return 0;
+}
+
+/**
+ * @brief Register the hooks of a plugin linked in, e.g. by a test.
+ *
+ * @param desc Descriptor, which must outlive the registration.
+ * @param arg Argument of its init; NULL for none.
+ * @return int 0 on success; -1 if its ABI version differs, its init fails or
+ * PLUGIN_MAX plugins are registered.
+ */
+int plugin_register(const struct plugin_desc* desc, const char* arg)
+{
+    return add_plugin(desc, arg, NULL);
+}
+
+/**
+ * @brief Call the fini of each plugin, unload them and clear statistics.
+ */
+void plugin_unload_all(void)
+{
+    for (int i = num_plugins - 1; i >= 0; --i) {
+        if (plugins[i].desc->fini != NULL) {
+            plugins[i].desc->fini(plugins[i].data);
+        }
+        if (plugins[i].handle != NULL) {
+            dlclose(plugins[i].handle);
+        }
+    }
+    num_plugins = 0;
+    memset(plugin_hooks, 0, sizeof(plugin_hooks));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Start a run of a stage: reset the arena and fill the context.
+ *
+ * @param ctx Output; context of the hooks.
+ * @param fd FD for client socket.
+ * @param stage enum plugin_stage.
+ */
+static void start_run(struct plugin_ctx* ctx, int fd, int stage)
+{
+    arena.used = 0;
+    stats.runs[stage]++;
+    ctx->client_fd = fd;
+    ctx->data = NULL;
+    ctx->arena = &arena;
+}
+
+/**
+ * @brief Check the verdict of a hook against its stage and output.
+ *
+ * @param verdict Verdict of the hook.
+ * @param allowed Verdicts allowed at the stage, as a bit mask.
+ * @param out Output of the hook.
+ * @return int The verdict; PLUGIN_CONTINUE if it is not allowed, or has no
+ * output.
+ */
+static int check_verdict(int verdict,
+                         unsigned allowed,
+                         const struct plugin_view* out)
+{
+    if (verdict < 0 || verdict >= 32 || !(allowed & ALLOW(verdict)) ||
+        ((verdict == PLUGIN_REPLACE || verdict == PLUGIN_RESPOND) &&
+         out->data == NULL)) {
+        stats.invalid++;
+        return PLUGIN_CONTINUE;
+    }
+    return verdict;
+}
+
+/**
+ * @brief Count the verdict a run ends with.
+ *
+ * @param verdict Verdict.
+ * @return int The verdict.
+ */
+static int end_run(int verdict)
+{
+    switch (verdict) {
+    case PLUGIN_REPLACE:
+        stats.replaced++;
+        break;
+    case PLUGIN_RESPOND:
+        stats.responded++;
+        break;
+    case PLUGIN_BYPASS:
+        stats.bypassed++;
+        break;
+    case PLUGIN_CLOSE:
+        stats.closed++;
+        break;
+    default:
+        break;
+    }
+    return verdict;
+}
+
+/**
+ * @brief Run the request_head hooks.
+ *
+ * @param fd FD for client socket.
+ * @param head Request head.
+ * @param out Output; the new head for PLUGIN_REPLACE, or the response for
+ * PLUGIN_RESPOND.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_RESPOND or
+ * PLUGIN_CLOSE.
+ */
+int plugin_request_head(int fd,
+                        struct plugin_view head,
+                        struct plugin_view* out)
+{
+    struct plugin_ctx ctx;
+    struct plugin_view next;
+    int verdict = PLUGIN_CONTINUE;
+    int v;
+
+    start_run(&ctx, fd, PLUGIN_REQUEST_HEAD);
+    for (int i = 0; i < num_plugins; ++i) {
+        if (plugins[i].desc->request_head == NULL) {
+            continue;
+        }
+        ctx.data = plugins[i].data;
+        next.data = NULL;
+        next.len = 0;
+        v = plugins[i].desc->request_head(&ctx, head, &next);
+        v = check_verdict(v, ALLOW_REQUEST_HEAD, &next);
+        if (v == PLUGIN_REPLACE) {
+            head = next;
+            verdict = v;
+        }
+        else if (v != PLUGIN_CONTINUE) {
+            *out = next;
+            return end_run(v);
+        }
+    }
+    *out = head;
+    return end_run(verdict);
+}
+
+/**
+ * @brief Run the cache_lookup hooks.
+ *
+ * @param fd FD for client socket.
+ * @param key Cache key.
+ * @param out Output; the new key for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_BYPASS or
+ * PLUGIN_CLOSE.
+ */
+int plugin_cache_lookup(int fd,
+                        struct plugin_view key,
+                        struct plugin_view* out)
+{
+    struct plugin_ctx ctx;
+    struct plugin_view next;
+    int verdict = PLUGIN_CONTINUE;
+    int v;
+
+    start_run(&ctx, fd, PLUGIN_CACHE_LOOKUP);
+    for (int i = 0; i < num_plugins; ++i) {
+        if (plugins[i].desc->cache_lookup == NULL) {
+            continue;
+        }
+        ctx.data = plugins[i].data;
+        next.data = NULL;
+        next.len = 0;
+        v = plugins[i].desc->cache_lookup(&ctx, key, &next);
+        v = check_verdict(v, ALLOW_CACHE_LOOKUP, &next);
+        if (v == PLUGIN_REPLACE) {
+            key = next;
+            verdict = v;
+        }
+        else if (v != PLUGIN_CONTINUE) {
+            *out = key;
+            return end_run(v);
+        }
+    }
+    *out = key;
+    return end_run(verdict);
+}
+
+/**
+ * @brief Run the upstream_select hooks.
+ *
+ * @param fd FD for client socket.
+ * @param host Hostname.
+ * @param port Input and output; port.
+ * @param out Output; the new hostname for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE.
+ */
+int plugin_upstream_select(int fd,
+                           struct plugin_view host,
+                           int* port,
+                           struct plugin_view* out)
+{
+    struct plugin_ctx ctx;
+    struct plugin_view next;
+    int verdict = PLUGIN_CONTINUE;
+    int v;
+
+    start_run(&ctx, fd, PLUGIN_UPSTREAM_SELECT);
+    for (int i = 0; i < num_plugins; ++i) {
+        if (plugins[i].desc->upstream_select == NULL) {
+            continue;
+        }
+        ctx.data = plugins[i].data;
+        next.data = NULL;
+        next.len = 0;
+        v = plugins[i].desc->upstream_select(&ctx, host, port, &next);
+        v = check_verdict(v, ALLOW_REPLACE, &next);
+        if (v == PLUGIN_REPLACE) {
+            host = next;
+            verdict = v;
+        }
+        else if (v != PLUGIN_CONTINUE) {
+            *out = host;
+            return end_run(v);
+        }
+    }
+    *out = host;
+    return end_run(verdict);
+}
+
+/**
+ * @brief Run the response_head hooks.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response; 0 if unknown.
+ * @param head Response head.
+ * @param out Output; the new head for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE.
+ */
+int plugin_response_head(int fd,
+                         int status,
+                         struct plugin_view head,
+                         struct plugin_view* out)
+{
+    struct plugin_ctx ctx;
+    struct plugin_view next;
+    int verdict = PLUGIN_CONTINUE;
+    int v;
+
+    start_run(&ctx, fd, PLUGIN_RESPONSE_HEAD);
+    for (int i = 0; i < num_plugins; ++i) {
+        if (plugins[i].desc->response_head == NULL) {
+            continue;
+        }
+        ctx.data = plugins[i].data;
+        next.data = NULL;
+        next.len = 0;
+        v = plugins[i].desc->response_head(&ctx, status, head, &next);
+        v = check_verdict(v, ALLOW_REPLACE, &next);
+        if (v == PLUGIN_REPLACE) {
+            head = next;
+            verdict = v;
+        }
+        else if (v != PLUGIN_CONTINUE) {
+            *out = head;
+            return end_run(v);
+        }
+    }
+    *out = head;
+    return end_run(verdict);
+}
+
+/**
+ * @brief Run the body_chunk hooks.
+ *
+ * @param fd FD for client socket.
+ * @param chunk Body bytes.
+ * @return int PLUGIN_CONTINUE or PLUGIN_CLOSE.
+ */
+int plugin_body_chunk(int fd, struct plugin_view chunk)
+{
+    struct plugin_ctx ctx;
+    struct plugin_view none = {NULL, 0};
+    int v;
+
+    start_run(&ctx, fd, PLUGIN_BODY_CHUNK);
+    for (int i = 0; i < num_plugins; ++i) {
+        if (plugins[i].desc->body_chunk == NULL) {
+            continue;
+        }
+        ctx.data = plugins[i].data;
+        v = plugins[i].desc->body_chunk(&ctx, chunk);
+        v = check_verdict(v, ALLOW_BODY_CHUNK, &none);
+        if (v != PLUGIN_CONTINUE) {
+            return end_run(v);
+        }
+    }
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Get statistics of plugins.
+ *
+ * @param out_stats Output; plugin statistics, non-null.
+ */
+void plugin_get_stats(struct plugin_stats* out_stats)
+{
+    *out_stats = stats;
+}
+
+/**
+ * @brief Print statistics of plugins.
+ */
+void plugin_log_stats(void)
+{
+    LOG_INFO("plugin stats:\n"
+             "- plugins: %d\n"
+             "- runs: %s %ld, %s %ld, %s %ld, %s %ld, %s %ld\n"
+             "- verdicts: %ld replaced, %ld answered, %ld bypassed, "
+             "%ld closed, %ld invalid",
+             num_plugins,
+             stage_names[0],
+             stats.runs[0],
+             stage_names[1],
+             stats.runs[1],
+             stage_names[2],
+             stats.runs[2],
+             stage_names[3],
+             stats.runs[3],
+             stage_names[4],
+             stats.runs[4],
+             stats.replaced,
+             stats.responded,
+             stats.bypassed,
+             stats.closed,
+             stats.invalid);
+    for (int i = 0; i < num_plugins; ++i) {
+        LOG_INFO("- plugin %d: %s", i, plugins[i].desc->name);
+    }
+}
@@ -0,0 +1,160 @@
+/**************************************************************
+*
+*                          plugin.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Interface for loading plugins and running their hooks,
+*     on the side of the proxy; plugin_api.h is the side of
+*     plugins.
+*
+*     The proxy checks PLUGIN_HOOKED(stage) before it builds
+*     the input of a stage, so a stage without hooks costs one
+*     load and one branch. Each run resets the arena, whose
+*     outputs are valid until the next run.
+*
+**************************************************************/
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "plugin_api.h"
+
+#define PLUGIN_MAX 16 /* Max number of plugins. */
+#define PLUGIN_ARENA_SIZE 65536 /* Byte size of the arena of a run. */
+
+/* Stages with hooks. */
+enum plugin_stage {
+    PLUGIN_REQUEST_HEAD = 0,
+    PLUGIN_CACHE_LOOKUP,
+    PLUGIN_UPSTREAM_SELECT,
+    PLUGIN_RESPONSE_HEAD,
+    PLUGIN_BODY_CHUNK,
+    PLUGIN_NUM_STAGES,
+};
+
+struct plugin_stats {
+    long runs[PLUGIN_NUM_STAGES]; /* Number of runs of each stage. */
+    long replaced; /* Number of inputs replaced. */
+    long responded; /* Number of requests answered by a plugin. */
+    long bypassed; /* Number of cache lookups bypassed. */
+    long closed; /* Number of clients closed, or servers refused, by a
+                  * plugin. */
+    long invalid; /* Number of verdicts not allowed at their stage, or
+                   * without an output, taken as PLUGIN_CONTINUE. */
+};
+
+/* Number of hooks of each stage, indexed by enum plugin_stage. */
+extern int plugin_hooks[PLUGIN_NUM_STAGES];
+
+/**
+ * @brief Whether a stage has hooks.
+ *
+ * @param stage enum plugin_stage.
+ */
+#define PLUGIN_HOOKED(stage) (plugin_hooks[(stage)] > 0)
+
+/**
+ * @brief Load a plugin from a shared object, and register its hooks.
+ *
+ * @param spec Path of the shared object, then optionally '=' and the argument
+ * of its init, e.g. "./plugin_example.so=header=X-Edge: 1".
+ * @return int 0 on success; -1 otherwise.
+ */
+int plugin_load(const char* spec);
+
+/**
+ * @brief Register the hooks of a plugin linked in, e.g. by a test.
+ *
+ * @param desc Descriptor, which must outlive the registration.
+ * @param arg Argument of its init; NULL for none.
+ * @return int 0 on success; -1 if its ABI version differs, its init fails or
+ * PLUGIN_MAX plugins are registered.
+ */
+int plugin_register(const struct plugin_desc* desc, const char* arg);
+
+/**
+ * @brief Call the fini of each plugin, unload them and clear statistics.
+ */
+void plugin_unload_all(void);
+
+/**
+ * @brief Run the request_head hooks.
+ *
+ * @param fd FD for client socket.
+ * @param head Request head.
+ * @param out Output; the new head for PLUGIN_REPLACE, or the response for
+ * PLUGIN_RESPOND.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_RESPOND or
+ * PLUGIN_CLOSE.
+ */
+int plugin_request_head(int fd,
+                        struct plugin_view head,
+                        struct plugin_view* out);
+
+/**
+ * @brief Run the cache_lookup hooks.
+ *
+ * @param fd FD for client socket.
+ * @param key Cache key.
+ * @param out Output; the new key for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_BYPASS or
+ * PLUGIN_CLOSE.
+ */
+int plugin_cache_lookup(int fd,
+                        struct plugin_view key,
+                        struct plugin_view* out);
+
+/**
+ * @brief Run the upstream_select hooks.
+ *
+ * @param fd FD for client socket.
+ * @param host Hostname.
+ * @param port Input and output; port.
+ * @param out Output; the new hostname for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE.
+ */
+int plugin_upstream_select(int fd,
+                           struct plugin_view host,
+                           int* port,
+                           struct plugin_view* out);
+
+/**
+ * @brief Run the response_head hooks.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response; 0 if unknown.
+ * @param head Response head.
+ * @param out Output; the new head for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE.
+ */
+int plugin_response_head(int fd,
+                         int status,
+                         struct plugin_view head,
+                         struct plugin_view* out);
+
+/**
+ * @brief Run the body_chunk hooks.
+ *
+ * @param fd FD for client socket.
+ * @param chunk Body bytes.
+ * @return int PLUGIN_CONTINUE or PLUGIN_CLOSE.
+ */
+int plugin_body_chunk(int fd, struct plugin_view chunk);
+
+/**
+ * @brief Get statistics of plugins.
+ *
+ * @param out_stats Output; plugin statistics, non-null.
+ */
+void plugin_get_stats(struct plugin_stats* out_stats);
+
+/**
+ * @brief Print statistics of plugins.
+ */
+void plugin_log_stats(void);
+
+#endif /* PLUGIN_H */
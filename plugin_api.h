@@ -0,0 +1,244 @@
+/**************************************************************
+*
+*                        plugin_api.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Interface for plugins of the proxy, the only header a
+*     plugin includes. A plugin is a shared object that exports
+*     a struct plugin_desc named PLUGIN_SYMBOL, loaded with -x.
+*
+*     Hooks run on the event loop at five stages:
+*     - request_head: a request head was parsed; a hook may
+*       replace the head sent upstream, answer the request
+*       itself, or close the client, e.g. for auth.
+*     - cache_lookup: a GET or HEAD is about to look up its
+*       cache key; a hook may replace the key, e.g. to drop
+*       query parameters, or bypass the cache.
+*     - upstream_select: a server is about to be resolved and
+*       connected; a hook may replace its host and port, e.g.
+*       to route to a pool.
+*     - response_head: a response head is about to be written
+*       to a client, from a server or the cache; a hook may
+*       replace it, e.g. to inject headers.
+*     - body_chunk: body bytes are about to be written to a
+*       client; a hook sees them as they go and may close the
+*       client.
+*
+*     Inputs are views into the proxy's own buffers, valid only
+*     during the call; nothing is copied for a hook that reads.
+*     A hook that replaces an input allocates its output from
+*     the arena of the call, which the proxy takes over and
+*     reuses after the stage; a hook never frees. Hooks of one
+*     stage run in the order plugins were loaded, each on the
+*     output of the one before, until one answers, bypasses or
+*     closes.
+*
+*     Heads are the start line and header lines, each ending
+*     in CRLF, without the empty line after them. A replaced
+*     request head is sent as is, but the proxy acts on the
+*     method, URL and host of the original one.
+*
+*     The ABI changes only with PLUGIN_ABI_VERSION; a plugin
+*     built against another version is refused.
+*
+**************************************************************/
+
+#ifndef PLUGIN_API_H
+#define PLUGIN_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PLUGIN_ABI_VERSION 1 /* Version of this interface. */
+#define PLUGIN_SYMBOL "proxy_plugin" /* Name of the struct plugin_desc a
+                                      * plugin exports. */
+
+/* Bytes that a hook reads in place; not null-terminated. */
+struct plugin_view {
+    const char* data; /* First byte. */
+    size_t len; /* Byte size. */
+};
+
+/* Bump allocator for the outputs of a hook. */
+struct plugin_arena {
+    char* base; /* Memory of the arena. */
+    size_t size; /* Byte size of base. */
+    size_t used; /* Byte size allocated. */
+};
+
+/* What a hook tells the proxy to do. */
+enum plugin_verdict {
+    PLUGIN_CONTINUE = 0, /* Go on with the input as is. */
+    PLUGIN_REPLACE, /* Go on with *out in place of the input. */
+    PLUGIN_RESPOND, /* request_head only: write *out, a whole response, to
+                     * the client, and drop the request. */
+    PLUGIN_BYPASS, /* cache_lookup only: neither look up nor store the
+                    * response. */
+    PLUGIN_CLOSE, /* Close the client. */
+};
+
+/* Context of a hook call. */
+struct plugin_ctx {
+    int client_fd; /* FD for the client socket; requests of a client come
+                    * one after another on it. */
+    void* data; /* Data the plugin's init returned. */
+    struct plugin_arena* arena; /* Arena of the call. */
+};
+
+/**
+ * @brief Hook of a request head.
+ *
+ * @param ctx Context.
+ * @param head Request head.
+ * @param out Output; the new head for PLUGIN_REPLACE, or the response for
+ * PLUGIN_RESPOND.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_RESPOND or
+ * PLUGIN_CLOSE.
+ */
+typedef int (*plugin_request_head_fn)(const struct plugin_ctx* ctx,
+                                      struct plugin_view head,
+                                      struct plugin_view* out);
+
+/**
+ * @brief Hook of a cache lookup.
+ *
+ * @param ctx Context.
+ * @param key Cache key: the host, then the URL.
+ * @param out Output; the new key for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE, PLUGIN_BYPASS or
+ * PLUGIN_CLOSE.
+ */
+typedef int (*plugin_cache_lookup_fn)(const struct plugin_ctx* ctx,
+                                      struct plugin_view key,
+                                      struct plugin_view* out);
+
+/**
+ * @brief Hook of the choice of a server.
+ *
+ * @param ctx Context.
+ * @param host Hostname to connect to.
+ * @param port Input and output; port to connect to, which the hook may change
+ * with any verdict.
+ * @param out Output; the new hostname for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE, which refuses
+ * the server as if it could not be connected.
+ */
+typedef int (*plugin_upstream_select_fn)(const struct plugin_ctx* ctx,
+                                         struct plugin_view host,
+                                         int* port,
+                                         struct plugin_view* out);
+
+/**
+ * @brief Hook of a response head.
+ *
+ * @param ctx Context.
+ * @param status Status code of the response; 0 if unknown.
+ * @param head Response head.
+ * @param out Output; the new head for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE, PLUGIN_REPLACE or PLUGIN_CLOSE.
+ */
+typedef int (*plugin_response_head_fn)(const struct plugin_ctx* ctx,
+                                       int status,
+                                       struct plugin_view head,
+                                       struct plugin_view* out);
+
+/**
+ * @brief Hook of body bytes, in the transfer coding of the response.
+ *
+ * @param ctx Context.
+ * @param chunk Body bytes.
+ * @return int PLUGIN_CONTINUE or PLUGIN_CLOSE.
+ */
+typedef int (*plugin_body_chunk_fn)(const struct plugin_ctx* ctx,
+                                    struct plugin_view chunk);
+
+/* Descriptor a plugin exports as PLUGIN_SYMBOL. Hooks it has no use for are
+ * NULL, and cost nothing. */
+struct plugin_desc {
+    int abi_version; /* PLUGIN_ABI_VERSION it was built against. */
+    const char* name; /* Name, for logs. */
+    int (*init)(const char* arg, void** out_data); /* Called once at load
+                                                    * with the argument of -x,
+                                                    * or NULL; returns 0 on
+                                                    * success. May be NULL. */
+    void (*fini)(void* data); /* Called once at exit. May be NULL. */
+    plugin_request_head_fn request_head; /* Hook of request heads. */
+    plugin_cache_lookup_fn cache_lookup; /* Hook of cache lookups. */
+    plugin_upstream_select_fn upstream_select; /* Hook of servers. */
+    plugin_response_head_fn response_head; /* Hook of response heads. */
+    plugin_body_chunk_fn body_chunk; /* Hook of body bytes. */
+};
+
+/**
+ * @brief Allocate from an arena, 8-byte aligned.
+ *
+ * @param arena Arena of the call.
+ * @param len Byte size.
+ * @return void* Memory, valid until the proxy is done with the stage; NULL if
+ * the arena is full.
+ */
+static inline void* plugin_alloc(struct plugin_arena* arena, size_t len)
+{
+    size_t at = (arena->used + 7) & ~(size_t)7;
+
+    if (at > arena->size || arena->size - at < len) {
+        return NULL;
+    }
+    arena->used = at + len;
+    return arena->base + at;
+}
+
+/**
+ * @brief Find a header field in a head, by a case-insensitive name.
+ *
+ * @param head Head.
+ * @param name Field name, e.g. "Authorization".
+ * @param out_value Output; the value without surrounding blanks, as a view
+ * into head.
+ * @return int 1 if found; 0 otherwise.
+ */
+static inline int plugin_find_header(struct plugin_view head,
+                                     const char* name,
+                                     struct plugin_view* out_value)
+{
+    size_t name_len = strlen(name);
+    const char* end = head.data + head.len;
+    const char* line = memchr(head.data, '\n', head.len);
+
+    while (line != NULL && ++line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        const char* v;
+        size_t i;
+
+        if (eol == NULL) {
+            eol = end;
+        }
+        for (i = 0; i < name_len && line + i < eol; ++i) {
+            if ((line[i] | 0x20) != (name[i] | 0x20)) {
+                break;
+            }
+        }
+        if (i == name_len && line + i < eol && line[i] == ':') {
+            v = line + i + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            while (eol > v && (eol[-1] == '\r' || eol[-1] == ' ' ||
+                               eol[-1] == '\t' || eol[-1] == '\n')) {
+                eol--;
+            }
+            out_value->data = v;
+            out_value->len = eol - v;
+            return 1;
+        }
+        line = memchr(line, '\n', end - line);
+    }
+    return 0;
+}
+
+#endif /* PLUGIN_API_H */
@@ -0,0 +1,271 @@
+/**************************************************************
+*
+*                      plugin_example.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Example plugin, built to plugin_example.so. Its argument
+*     is a list of rules separated by ';':
+*     - deny=<prefix>: answer 403 to requests whose URL starts
+*       with prefix.
+*     - nocache=<text>: bypass the cache for keys that contain
+*       text.
+*     - route=<host>:<port>: connect to host:port for every
+*       server.
+*     - header=<line>: inject a header line into responses.
+*     It counts the body bytes it sees, and prints them at exit.
+*
+**************************************************************/
+
+#include "plugin_api.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_RULE 256 /* Max byte size of a rule value. */
+
+/* Rules of the plugin. */
+struct example {
+    char deny[MAX_RULE]; /* URL prefix answered with 403; empty for none. */
+    char nocache[MAX_RULE]; /* Text of cache keys bypassed; empty for
+                             * none. */
+    char route_host[MAX_RULE]; /* Host of every server; empty for none. */
+    int route_port; /* Port of every server. */
+    char header[MAX_RULE]; /* Header line injected; empty for none. */
+    long body_bytes; /* Number of body bytes seen. */
+};
+
+static const char forbidden[] = "HTTP/1.1 403 Forbidden\r\n"
+                                "Content-Length: 0\r\n"
+                                "\r\n";
+
+/**
+ * @brief Copy a rule value, cut at the next ';'.
+ *
+ * @param dst Output; null-terminated value.
+ * @param src Value.
+ * @return const char* The byte after the value.
+ */
+static const char* copy_value(char* dst, const char* src)
+{
+    size_t len = strcspn(src, ";");
+
+    if (len >= MAX_RULE) {
+        len = MAX_RULE - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    src += strcspn(src, ";");
+    return *src == ';' ? src + 1 : src;
+}
+
+/**
+ * @brief Parse the rules.
+ *
+ * @param arg Rules; NULL for none.
+ * @param out_data Output; struct example.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int example_init(const char* arg, void** out_data)
+{
+    struct example* ex = calloc(1, sizeof(*ex));
+    char* colon;
+
+    if (ex == NULL) {
+        return -1;
+    }
+    while (arg != NULL && *arg != '\0') {
+        if (strncmp(arg, "deny=", 5) == 0) {
+            arg = copy_value(ex->deny, arg + 5);
+        }
+        else if (strncmp(arg, "nocache=", 8) == 0) {
+            arg = copy_value(ex->nocache, arg + 8);
+        }
+        else if (strncmp(arg, "route=", 6) == 0) {
+            arg = copy_value(ex->route_host, arg + 6);
+            colon = strrchr(ex->route_host, ':');
+            if (colon == NULL || (ex->route_port = atoi(colon + 1)) <= 0) {
+                fprintf(stderr, "plugin_example: bad route\n");
+                free(ex);
+                return -1;
+            }
+            *colon = '\0';
+        }
+        else if (strncmp(arg, "header=", 7) == 0) {
+            arg = copy_value(ex->header, arg + 7);
+        }
+        else {
+            fprintf(stderr, "plugin_example: bad rule %s\n", arg);
+            free(ex);
+            return -1;
+        }
+    }
+    *out_data = ex;
+    return 0;
+}
+
+/**
+ * @brief Print the body bytes seen, and free the rules.
+ *
+ * @param data struct example.
+ */
+static void example_fini(void* data)
+{
+    struct example* ex = data;
+
+    fprintf(stderr, "plugin_example: %ld body bytes\n", ex->body_bytes);
+    free(ex);
+}
+
+/**
+ * @brief Answer 403 to a denied URL.
+ *
+ * @param ctx Context.
+ * @param head Request head.
+ * @param out Output; the response for PLUGIN_RESPOND.
+ * @return int PLUGIN_CONTINUE or PLUGIN_RESPOND.
+ */
+static int example_request_head(const struct plugin_ctx* ctx,
+                                struct plugin_view head,
+                                struct plugin_view* out)
+{
+    struct example* ex = ctx->data;
+    size_t len = strlen(ex->deny);
+    const char* url = memchr(head.data, ' ', head.len);
+    const char* path;
+
+    if (len == 0 || url == NULL) {
+        return PLUGIN_CONTINUE;
+    }
+    url++;
+    /* The URL of a proxy request is absolute; match its path. */
+    path = url;
+    if (head.data + head.len - url > 7 && memcmp(url, "http://", 7) == 0) {
+        path = memchr(url + 7, '/', head.data + head.len - url - 7);
+        if (path == NULL) {
+            return PLUGIN_CONTINUE;
+        }
+    }
+    if ((size_t)(head.data + head.len - path) < len ||
+        memcmp(path, ex->deny, len) != 0) {
+        return PLUGIN_CONTINUE;
+    }
+    out->data = forbidden;
+    out->len = sizeof(forbidden) - 1;
+    return PLUGIN_RESPOND;
+}
+
+/**
+ * @brief Bypass the cache for a key with the nocache text.
+ *
+ * @param ctx Context.
+ * @param key Cache key.
+ * @param out Unused.
+ * @return int PLUGIN_CONTINUE or PLUGIN_BYPASS.
+ */
+static int example_cache_lookup(const struct plugin_ctx* ctx,
+                                struct plugin_view key,
+                                struct plugin_view* out)
+{
+    struct example* ex = ctx->data;
+    size_t len = strlen(ex->nocache);
+
+    (void)out;
+    for (size_t i = 0; len > 0 && i + len <= key.len; ++i) {
+        if (memcmp(key.data + i, ex->nocache, len) == 0) {
+            return PLUGIN_BYPASS;
+        }
+    }
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Route every server to the route rule.
+ *
+ * @param ctx Context.
+ * @param host Hostname.
+ * @param port Input and output; port.
+ * @param out Output; the new hostname for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE or PLUGIN_REPLACE.
+ */
+static int example_upstream_select(const struct plugin_ctx* ctx,
+                                   struct plugin_view host,
+                                   int* port,
+                                   struct plugin_view* out)
+{
+    struct example* ex = ctx->data;
+
+    (void)host;
+    if (ex->route_host[0] == '\0') {
+        return PLUGIN_CONTINUE;
+    }
+    out->data = ex->route_host;
+    out->len = strlen(ex->route_host);
+    *port = ex->route_port;
+    return PLUGIN_REPLACE;
+}
+
+/**
+ * @brief Append the header rule to a response head.
+ *
+ * @param ctx Context.
+ * @param status Status code of the response.
+ * @param head Response head.
+ * @param out Output; the new head for PLUGIN_REPLACE.
+ * @return int PLUGIN_CONTINUE or PLUGIN_REPLACE.
+ */
+static int example_response_head(const struct plugin_ctx* ctx,
+                                 int status,
+                                 struct plugin_view head,
+                                 struct plugin_view* out)
+{
+    struct example* ex = ctx->data;
+    size_t len = strlen(ex->header);
+    char* buf;
+
+    (void)status;
+    if (len == 0) {
+        return PLUGIN_CONTINUE;
+    }
+    buf = plugin_alloc(ctx->arena, head.len + len + 2);
+    if (buf == NULL) {
+        return PLUGIN_CONTINUE;
+    }
+    memcpy(buf, head.data, head.len);
+    memcpy(buf + head.len, ex->header, len);
+    memcpy(buf + head.len + len, "\r\n", 2);
+    out->data = buf;
+    out->len = head.len + len + 2;
+    return PLUGIN_REPLACE;
+}
+
+/**
+ * @brief Count body bytes.
+ *
+ * @param ctx Context.
+ * @param chunk Body bytes.
+ * @return int PLUGIN_CONTINUE.
+ */
+static int example_body_chunk(const struct plugin_ctx* ctx,
+                              struct plugin_view chunk)
+{
+    struct example* ex = ctx->data;
+
+    ex->body_bytes += chunk.len;
+    return PLUGIN_CONTINUE;
+}
+
+/* Descriptor of the plugin. */
+const struct plugin_desc proxy_plugin = {
+    PLUGIN_ABI_VERSION,
+    "example",
+    example_init,
+    example_fini,
+    example_request_head,
+    example_cache_lookup,
+    example_upstream_select,
+    example_response_head,
+    example_body_chunk,
+};
@@ -9,48 +9,159 @@
 *     Summary:
 *     Main driver for HTTP proxy.
 *
-*     Usage: ./proxy <port> [<cert> <key>]
+*     Usage: ./proxy [-m <MB>] [-H] <port> [<cert> <key>
+*                    [<cert> <key>]]
+*     * -m <MB> sets the byte size of the cache arena in MB.
+*     * -H backs the cache arena with 2 MB huge pages.
+*     * -w <workers> runs that many worker processes; see
+*     README.md for the other options.
 *     * <port> is the port that the proxy listens on.
 *     * <cert> is the certificate PEM file for SSL interception.
 *     * <key> is the private key PEM file for SSL interception.
 *     * If both <cert> and <key> are provided, the proxy will
-*     run in SSL interception mode.
+*     run in SSL interception mode. A second pair with another
+*     key type, e.g. ECDSA next to RSA, is served to clients
+*     that prefer it.
 *     If neither of them provided, the proxy will in default
 *     mode without SSL interception.
 *
 **************************************************************/
 
+#include "access_log.h"
+#include "affinity.h"
 #include "cache.h"
+#include "compress.h"
+#include "deadline.h"
+#include "esi.h"
+#include "fairq.h"
+#include "filter.h"
+#include "hints.h"
 #include "http_utils.h"
+#include "key_pool.h"
 #include "logger.h"
+#include "mem_pressure.h"
+#include "netio.h"
+#include "plugin.h"
+#include "proxy.h"
 #include "sock_buf.h"
+#include "tls.h"
+#include "trace.h"
+#include "upstream.h"
 #include <arpa/inet.h>
-#include <fcntl.h>
-#include <netdb.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/ssl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define BUF_SIZE 8192
 #define CACHE_SIZE 100
+#define CACHE_ARENA_MB 64 /* Default byte size of the cache arena in MB. */
+#define MAX_HOST_QUOTAS 64 /* Max number of per-host quota options. */
+#define MEM_CHECK_INTERVAL 1 /* Seconds between memory pressure checks. */
+#define MIN_CACHE_BUDGET_MB 4 /* Smallest cache budget under pressure. */
+#define SHRINK_BATCH 64 /* Max number of cache elements evicted per loop. */
+#define MAX_SERVER_ADDRS 8 /* Max number of resolved addresses of a server. */
+#define MAX_HOSTNAME_LEN 256 /* Max byte size of a hostname, with its null. */
+#define MAX_CONNECT_TRIES 3 /* Max number of connects per request, counting
+                             * retries. */
+#define STALE_GRACE 60 /* Default seconds past max age that a cached response
+                        * may stand in for a failed server. */
+#define LISTEN_BACKLOG SOMAXCONN /* Max length of the queue of pending
+                                  * clients; a short queue drops bursts of
+                                  * connections, which retry a second later. */
+#define MAX_WORKERS 256 /* Max number of worker processes. */
+#define MAX_CERTS 2 /* Max number of certificates for SSL, e.g. an ECDSA and an
+                     * RSA one. */
 
 static int listen_port = 9999; /* Port that proxy listens on. */
 static int listen_sock; /* Listening socket of the proxy. */
 static fd_set active_fd_set; /* FD sets of all active sockets. */
 static fd_set read_fd_set;   /* FD sets of all sockets read to be read. */
 static int max_fd = 4; /* Largest used FD so far. */
-static SSL_CTX* ssl_ctx; /* SSL context for this proxy. */
+static SSL_CTX* ssl_ctx; /* SSL context of connections with clients. */
+static SSL_CTX* upstream_ssl_ctx; /* SSL context of connections to servers. */
 static int use_ssl = 0; /* Whether to use SSL interception. */
-static const char* CERT_FILE = NULL; /* Certificate file for SSL. */
-static const char* KEY_FILE = NULL; /* Private key file for SSL. */
+static const char* cert_files[MAX_CERTS]; /* Certificate files for SSL. */
+static const char* key_files[MAX_CERTS]; /* Private key file of each
+                                          * certificate. */
+static int num_certs = 0; /* Number of certificates. */
+static size_t cache_arena_mb = CACHE_ARENA_MB; /* Cache arena size in MB. */
+static int cache_huge_pages = 0; /* Whether to use huge pages for cache. */
+static int cache_policy = CACHE_POLICY_LRU; /* Cache eviction policy. */
+static long cache_host_quota = 0; /* Default byte quota of each host in cache;
+                                   * 0 for no quota. */
+static char* host_quotas[MAX_HOST_QUOTAS]; /* Per-host quota options, each of
+                                            * "<host>=<MB>". */
+static int num_host_quotas = 0; /* Number of per-host quota options. */
+static struct mem_pressure_config mem_config = {
+    0, MEM_PRESSURE_PSI_THRESHOLD, 0, 0
+}; /* Cache budget sizing under memory pressure. */
+static const char* cgroup_dir = NULL; /* Directory of the memory cgroup. */
+static size_t cache_budget = 0; /* Byte budget of the cache. */
+static int cache_shrinking = 0; /* 1 while the cache exceeds its budget. */
+static time_t next_mem_check = 0; /* Time of the next memory pressure check. */
+static int use_compression = 0; /* Whether to store compressible responses
+                                 * gzip coded in cache. */
+static struct deadline_config deadline_config; /* Deadlines of each phase of
+                                                * a socket. */
+static struct upstream_config upstream_config; /* Retry budget, hedging
+                                               * delay and breakers. */
+static long stale_grace = STALE_GRACE; /* Seconds past max age that a cached
+                                        * response may be served stale. */
+static volatile sig_atomic_t dump_stats = 0; /* Set by SIGUSR1 to print
+                                              * statistics. */
+static int num_workers = 0; /* Number of worker processes; 0 to serve in this
+                             * process. */
+static int pin_workers = 0; /* Whether to pin each worker to a CPU. */
+static int busy_poll_us = 0; /* Microseconds to busy poll each socket; 0 for
+                              * none. */
+static int worker_sock = -1; /* Listening socket of this worker, from the
+                              * group of all workers; -1 to open one. */
+static pid_t worker_pids[MAX_WORKERS]; /* Worker processes, in the parent. */
+static int key_threads = 0; /* Threads that run private key operations of
+                             * client handshakes; 0 to run them in the main
+                             * loop. */
+static int async_client[FD_SETSIZE]; /* Client whose handshake waits on each
+                                      * FD of a private key operation; -1 if
+                                      * none. */
+static long max_early_data = 0; /* Max byte size of TLS 1.3 early data a
+                                 * resuming client may send; 0 to refuse
+                                 * it. */
+static int worker_index = -1; /* Index of this worker; -1 in the parent, or
+                               * without workers. */
+static const char* access_log_path = NULL; /* Path of the access log; NULL
+                                            * for none. */
+static long access_log_rotate_mb = ACCESS_LOG_ROTATE_MB; /* Size in MB of the
+                                                          * access log before
+                                                          * it rotates. */
+static int access_log_deflate = 0; /* Whether to deflate access log
+                                    * blocks. */
+static const char* plugin_specs[PLUGIN_MAX]; /* Plugins to load, each of
+                                              * "<path>[=<arg>]". */
+static int num_plugin_specs = 0; /* Number of plugins to load. */
+static const char* filter_specs[FILTER_MAX]; /* Filters of response bodies,
+                                              * in the order they run. */
+static int num_filter_specs = 0; /* Number of filters. */
+static int use_esi = 0; /* Whether to assemble pages with Edge Side
+                         * Includes. */
+static int use_hints = 0; /* Whether to send "103 Early Hints" of preload
+                           * links on cache misses. */
+static long fairq_round_kb = FAIRQ_ROUND_KB; /* KB of bulk data a round of
+                                              * the main loop moves; 0 for FD
+                                              * order. */
 
 /**
  * @brief Initialzed a listening socket that listens on the given port.
@@ -60,38 +171,11 @@ static const char* KEY_FILE = NULL; /* Private key file for SSL. */
 int init_listen_sock(int port)
 {
     int sock;
-    int optval;
-    struct sockaddr_in addr;
 
-    /* Create a socket. */
-    sock = socket(AF_INET, SOCK_STREAM, 0);
+    /* Non-blocking, and allows reuse of local addresses. */
+    sock = netio_listen(port, LISTEN_BACKLOG);
     if (sock < 0) {
-        PLOG_FATAL("socket");
-    }
-
-    /* Allow reuse of local addresses. */
-    optval = 1;
-    if (setsockopt(sock, SOL_SOCKET,
-                   SO_REUSEADDR,
-                   (const void *)&optval,
-                   sizeof(int)) < 0) {
-        PLOG_FATAL("setsockopt");
-    }
-
-    /* Set socket non-block. */
-    fcntl(sock, F_SETFL, O_NONBLOCK);
-
-    /* Build the sock's internet address. */
-    addr.sin_family = AF_INET; /* Use the Internet. */
-    addr.sin_port = htons((unsigned short)port); /* Port to listen. */
-    addr.sin_addr.s_addr = htonl(INADDR_ANY); /* Let the system figure out our
-                                               * IP address. */
-
-    /* Associate the proxy socket with the given IP address and port. */
-    if (bind(sock,
-             (struct sockaddr*)&addr,
-             sizeof(addr)) < 0) {
-        PLOG_FATAL("bind");
+        PLOG_FATAL("listen");
     }
 
     return sock;
@@ -102,6 +186,9 @@ int init_listen_sock(int port)
  */
 void init_ssl(void)
 {
+    int aes_hw;
+    int num_pooled = 0;
+
     /* Register libcrypto and libssl error strings. */
     SSL_load_error_strings();
 
@@ -111,28 +198,57 @@ void init_ssl(void)
     /* Add all digest and cipher algoritms to the table. */
     OpenSSL_add_all_algorithms();
 
-    /* Create a new SSL_CTX object as framework for TLS/SSL functions. */
-    ssl_ctx = SSL_CTX_new(SSLv23_method());
-    if (ssl_ctx == NULL) {
+    /* Create SSL_CTX objects as framework for TLS/SSL functions, one for each
+     * leg, with the same versions, groups and ciphers. */
+    ssl_ctx = SSL_CTX_new(TLS_server_method());
+    upstream_ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (ssl_ctx == NULL || upstream_ssl_ctx == NULL) {
         ERR_print_errors_fp(stderr);
         LOG_FATAL("SSL_CTX_new");
     }
-
-    /*  Load certificates. */
-    if (SSL_CTX_use_certificate_file(ssl_ctx,
-                                     CERT_FILE,
-                                     SSL_FILETYPE_PEM) != 1) {
+    aes_hw = tls_has_aes_hw();
+    if (tls_tune_ctx(ssl_ctx, aes_hw) < 0 ||
+        tls_tune_ctx(upstream_ssl_ctx, aes_hw) < 0) {
         ERR_print_errors_fp(stderr);
-        LOG_FATAL("SSL_CTX_use_certificate_file");
+        LOG_FATAL("tls_tune_ctx");
     }
+    LOG_INFO("prefer %s", aes_hw ? "AES-GCM" : "ChaCha20-Poly1305");
 
-    /* Load private key and implicitly check the consistency of the private key
-     * with the certificate. */
-    if (SSL_CTX_use_PrivateKey_file(ssl_ctx,
-                                    KEY_FILE,
-                                    SSL_FILETYPE_PEM) != 1) {
-        ERR_print_errors_fp(stderr);
-        LOG_FATAL("SSL_CTX_use_PrivateKey_file");
+    /* Start the key pool before loading the keys it wraps. */
+    if (key_threads > 0 && key_pool_init(key_threads) < 0) {
+        LOG_ERROR("key_pool_init");
+        key_threads = 0;
+    }
+
+    /* Load certificates and private keys, at most one of each key type;
+     * each handshake picks one. */
+    for (int i = 0; i < num_certs; ++i) {
+        if (tls_use_cert(ssl_ctx, cert_files[i], key_files[i]) < 0) {
+            LOG_FATAL("tls_use_cert");
+        }
+
+        /* Sign client handshakes with the RSA key on the key pool, so the
+         * main loop serves other sockets meanwhile. */
+        if (key_threads > 0 &&
+            EVP_PKEY_get_base_id(SSL_CTX_get0_privatekey(ssl_ctx)) ==
+            EVP_PKEY_RSA &&
+            key_pool_use(ssl_ctx) == 0) {
+            num_pooled++;
+        }
+    }
+    if (key_threads > 0 && num_pooled == 0) {
+        LOG_ERROR("private key operations stay in the main loop");
+        key_pool_clear();
+        key_threads = 0;
+    }
+    else if (key_threads > 0) {
+        LOG_INFO("run private key operations on %d threads", key_threads);
+    }
+
+    /* Take requests in early data from resuming clients. */
+    if (max_early_data > 0 &&
+        tls_enable_early_data(ssl_ctx, max_early_data) < 0) {
+        LOG_FATAL("tls_enable_early_data");
     }
 }
 
@@ -141,8 +257,14 @@ void init_ssl(void)
  */
 void clear_ssl(void)
 {
-    /* SSL context for this proxy. */
+    /* SSL contexts for this proxy. */
     SSL_CTX_free(ssl_ctx);
+    SSL_CTX_free(upstream_ssl_ctx);
+
+    /* Stop the key pool once no key refers to it. */
+    if (key_threads > 0) {
+        key_pool_clear();
+    }
 
     // /* Free SSL_COMP_get_compression_methods() called by SSL_library_init(). */
     // sk_SSL_COMP_free(SSL_COMP_get_compression_methods());
@@ -159,16 +281,42 @@ void clear_ssl(void)
     ERR_free_strings();
 }
 
+/**
+ * @brief Stop waiting for the private key operation of a client's handshake,
+ * and watch the client again.
+ *
+ * @param client_sock FD for client socket.
+ */
+void stop_async_wait(int client_sock)
+{
+    struct sock_buf* sock_buf = sock_buf_get(client_sock);
+    int async_fd;
+
+    if (sock_buf == NULL || sock_buf->async_fd < 0) {
+        return;
+    }
+    async_fd = sock_buf->async_fd;
+    FD_CLR(async_fd, &active_fd_set);
+    FD_CLR(async_fd, &read_fd_set);
+    async_client[async_fd] = -1;
+    sock_buf->async_fd = -1;
+    FD_SET(client_sock, &active_fd_set);
+}
+
 /**
  * @brief Initialize the proxy.
  */
 void init_proxy(void)
 {
-    /* Setup listening socket. */
-    listen_sock = init_listen_sock(listen_port);
-    if (listen(listen_sock, 1) < 0) {
-        PLOG_FATAL("listen");
+    struct cache_config cache_config;
+
+    /* Setup listening socket, unless this worker has one of the group. */
+    listen_sock = worker_sock >= 0 ? worker_sock :
+                  init_listen_sock(listen_port);
+    if (busy_poll_us > 0 && affinity_busy_poll(listen_sock, busy_poll_us) < 0) {
+        PLOG_ERROR("setsockopt SO_BUSY_POLL");
     }
+    max_fd = listen_sock;
     LOG_INFO("listen on port %d", listen_port);
 
     if (use_ssl) {
@@ -178,12 +326,92 @@ void init_proxy(void)
     /* Init FD set for select(). */
     FD_ZERO(&active_fd_set);
     FD_SET(listen_sock, &active_fd_set);
+    for (int fd = 0; fd < FD_SETSIZE; ++fd) {
+        async_client[fd] = -1;
+    }
 
     /* Init LRU cache. */
-    cache_init(CACHE_SIZE);
+    cache_config.capacity = CACHE_SIZE;
+    cache_config.arena_size = cache_arena_mb * 1024 * 1024;
+    cache_config.use_huge_pages = cache_huge_pages;
+    cache_config.policy = cache_policy;
+    cache_config.host_quota = cache_host_quota;
+    if (cache_init_config(&cache_config) < 0) {
+        LOG_FATAL("cache_init_config");
+    }
+    cache_budget = cache_config.arena_size;
+    mem_config.max_budget = cache_config.arena_size;
+    mem_config.min_budget = (size_t)MIN_CACHE_BUDGET_MB * 1024 * 1024;
+    if (mem_config.min_budget > mem_config.max_budget) {
+        mem_config.min_budget = mem_config.max_budget;
+    }
+    /* Prefer cgroup v2; fall back to the v1 memory controller. */
+    if (cgroup_dir == NULL) {
+        cgroup_dir = MEM_PRESSURE_CGROUP_DIR;
+        if (access(MEM_PRESSURE_CGROUP_DIR "/memory.current", R_OK) < 0) {
+            cgroup_dir = MEM_PRESSURE_CGROUP_DIR "/memory";
+        }
+    }
+    cache_shrinking = 0;
+    next_mem_check = 0;
+    for (int i = 0; i < num_host_quotas; ++i) {
+        char* sep = strchr(host_quotas[i], '=');
+
+        *sep = '\0';
+        if (cache_set_host_quota(host_quotas[i],
+                                 atol(sep + 1) * 1024 * 1024) < 0) {
+            LOG_FATAL("cannot set cache quota of %s", host_quotas[i]);
+        }
+        *sep = '=';
+    }
+    cache_set_stale_grace(stale_grace);
 
-    /* Init socket buffer array. */
+    /* Init socket deadlines, scheduling, upstream state and buffer array. */
+    deadline_init(&deadline_config);
+    fairq_init(fairq_round_kb * 1024);
+    if (upstream_init(&upstream_config) < 0) {
+        LOG_FATAL("upstream_init");
+    }
     sock_buf_arr_init();
+
+    /* Open the access log; each worker writes its own. */
+    if (access_log_path != NULL) {
+        struct access_log_config log_config;
+        char path[PATH_MAX];
+
+        if (worker_index >= 0) {
+            snprintf(path,
+                     sizeof(path),
+                     "%s.w%d",
+                     access_log_path,
+                     worker_index);
+        }
+        else {
+            snprintf(path, sizeof(path), "%s", access_log_path);
+        }
+        log_config.path = path;
+        log_config.rotate_bytes = access_log_rotate_mb * 1024 * 1024;
+        log_config.keep = ACCESS_LOG_KEEP;
+        log_config.deflate = access_log_deflate;
+        if (access_log_open(&log_config, netio_now_us()) < 0) {
+            PLOG_FATAL("open %s", path);
+        }
+        LOG_INFO("access log to %s", path);
+    }
+
+    /* Load plugins, whose hooks run in the order given. */
+    for (int i = 0; i < num_plugin_specs; ++i) {
+        if (plugin_load(plugin_specs[i]) < 0) {
+            LOG_FATAL("cannot load plugin %s", plugin_specs[i]);
+        }
+    }
+
+    /* Chain the filters of response bodies. */
+    for (int i = 0; i < num_filter_specs; ++i) {
+        if (filter_add(filter_specs[i]) < 0) {
+            LOG_FATAL("bad filter %s", filter_specs[i]);
+        }
+    }
 }
 
 /**
@@ -191,23 +419,43 @@ void init_proxy(void)
  */
 void clear_proxy(void)
 {
+    /* Stop waiting for private key operations, whose FDs close with the SSL
+     * of their clients. */
+    for (int fd = 0; fd < FD_SETSIZE; ++fd) {
+        if (async_client[fd] >= 0) {
+            stop_async_wait(async_client[fd]);
+        }
+    }
+
     /* Free LRU cache. */
     cache_clear();
 
-    /* Free socket buffer array. */
+    /* Free socket buffer array and upstream state. */
     sock_buf_arr_clear();
+    upstream_clear();
 
     /* Close all sockets. */
     for (int fd = 0; fd < FD_SETSIZE; ++fd) {
         if (FD_ISSET(fd, &active_fd_set)) {
             FD_CLR(fd, &active_fd_set);
-            close(fd);
+            netio_close(fd);
         }
     }
 
     if (use_ssl) {
         clear_ssl();
     }
+
+    /* Write the access log records kept. */
+    access_log_close();
+
+    /* Unload plugins and filters. */
+    plugin_unload_all();
+    filter_clear();
+    esi_clear_stats();
+
+    /* Forget preload links. */
+    hints_clear();
 }
 
 /**
@@ -221,6 +469,18 @@ void INT_handler(int sig)
     exit(EXIT_SUCCESS);
 }
 
+/**
+ * @brief SIGUSR1 handler that requests statistics to be printed by the main
+ * loop.
+ *
+ * @param sig
+ */
+void USR1_handler(int sig)
+{
+    (void)sig;
+    dump_stats = 1;
+}
+
 /**
  * @brief SIGPIPE hander that ignores this signal.
  *
@@ -238,21 +498,22 @@ void accept_client(void)
 {
     int client_sock; /* FD for client sockect. */
     struct sockaddr_in client_addr; /* Client address. */
-    unsigned size = sizeof(client_addr);
 
-    client_sock = accept(listen_sock,
-                        (struct sockaddr *)&client_addr,
-                        &size);
+    client_sock = netio_accept(listen_sock, &client_addr);
     if (client_sock < 0) {
         PLOG_ERROR("accept");
         /* Ignore this client. */
         return;
     }
 
+    if (busy_poll_us > 0) {
+        affinity_busy_poll(client_sock, busy_poll_us);
+    }
+
     /* Create socket buffer for this new client. */
     if (sock_buf_add_client(client_sock) == 0) {
         LOG_ERROR("fail to add client socket buffer");
-        close(client_sock);
+        netio_close(client_sock);
         return;
     }
 
@@ -264,68 +525,177 @@ void accept_client(void)
     /* Add new client to selection FD set. */
     FD_SET(client_sock, &active_fd_set);
 
+    TRACE3(accept,
+           client_sock,
+           client_addr.sin_addr.s_addr,
+           ntohs(client_addr.sin_port));
+    access_log_accept(client_sock, &client_addr);
     LOG_INFO("accept %s:%hu",
              inet_ntoa(client_addr.sin_addr),
              ntohs(client_addr.sin_port));
 }
 
 /**
- * Connect to server by the given hostname and port.
+ * Connect to server by the given hostname and port, trying its resolved
+ * addresses in turn.
+ *
+ * A failed connect is retried on the next address while the retry budget of
+ * the host allows. A connect that timed out is retried only on another
+ * address, as it has blocked the proxy for the whole timeout already.
+ * Addresses that failed to connect lately are tried last, and a host whose
+ * addresses all fail counts a failure against its breaker.
  *
  * @param hostname Server hostname without port number.
  * @param port Server port number.
  * @param client_sock FD for client socket.
- * @param connected_sock Socket for the other side of a CONNECT method; -1 if 
- * method is not CONNECT.
  * @param key String for cache key, i.e. hostname + url in GET request.
- * @return Socket of the new connected server.
+ * @param avoid Address to try last, e.g. that of the attempt to hedge; NULL
+ * for none.
+ * @return Socket of the new connected server; -1 on failure.
  */
-int connect_server(const char *hostname,
-                   const int port,
-                   int client_sock,
-                   char* key) {
-    int server_sock;
-    struct hostent *server;
+int connect_upstream(const char* hostname,
+                     const int port,
+                     int client_sock,
+                     char* key,
+                     const struct in_addr* avoid)
+{
+    int server_sock = -1;
     struct sockaddr_in server_addr;
+    struct in_addr addrs[MAX_SERVER_ADDRS];
+    struct in_addr order[MAX_SERVER_ADDRS];
+    int num_addrs;
+    int num_order = 0;
+    int first;
+    int tries = 0;
+    time_t now = netio_now();
+    long start_us = netio_now_us();
+    const char* target = hostname; /* Hostname to resolve and connect. */
+    char routed[MAX_HOSTNAME_LEN]; /* Hostname a plugin routes to. */
+    int target_port = port; /* Port to connect. */
+
+    TRACE3(connect_start, client_sock, hostname, port);
+
+    /* Plugins may route the server to another address, which keeps the
+     * breaker and cache of the requested host. */
+    if (PLUGIN_HOOKED(PLUGIN_UPSTREAM_SELECT)) {
+        struct plugin_view view = {hostname, strlen(hostname)};
+        struct plugin_view out;
+        int verdict;
+
+        verdict = plugin_upstream_select(client_sock,
+                                         view,
+                                         &target_port,
+                                         &out);
+        if (verdict == PLUGIN_CLOSE) {
+            LOG_INFO("plugin refuses %s", hostname);
+            TRACE4(connect_done,
+                   client_sock,
+                   -1,
+                   0,
+                   netio_now_us() - start_us);
+            return -1;
+        }
+        if (verdict == PLUGIN_REPLACE && out.len < sizeof(routed)) {
+            memcpy(routed, out.data, out.len);
+            routed[out.len] = '\0';
+            target = routed;
+        }
+        if (target != hostname || target_port != port) {
+            LOG_INFO("plugin routes %s:%d to %s:%d",
+                     hostname,
+                     port,
+                     target,
+                     target_port);
+        }
+    }
 
-    /* Create server socket. */
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
-        PLOG_ERROR("socket");
+    /* Get the server's DNS entries. */
+    num_addrs = netio_resolve(target, addrs, MAX_SERVER_ADDRS);
+    if (num_addrs <= 0) {
+        LOG_ERROR("cannot resolve host: %s", target);
+        TRACE4(connect_done, client_sock, -1, 0, netio_now_us() - start_us);
         return -1;
     }
+    first = upstream_next_addr(target, num_addrs);
 
-    /* Get the server's DNS entry. */
-    server = gethostbyname(hostname);
-    if (server == NULL) {
-        LOG_ERROR("cannot resolve host: %s", hostname);
-        return -1;
+    /* Take the addresses in turn from the first, with ejected ones and the
+     * one to avoid last. */
+    for (int last = 0; last < 2; ++last) {
+        for (int i = 0; i < num_addrs; ++i) {
+            struct in_addr addr = addrs[(first + i) % num_addrs];
+
+            if ((upstream_is_ejected(target, addr, now) ||
+                 (avoid != NULL && addr.s_addr == avoid->s_addr)) == last) {
+                order[num_order++] = addr;
+            }
+        }
     }
 
-    /* Build the server's Internet address. */
-    bzero((char *)&server_addr, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr,
-          (char *)&server_addr.sin_addr.s_addr,
-          server->h_length);
-    server_addr.sin_port = htons(port);
+    while (server_sock < 0 && tries < MAX_CONNECT_TRIES) {
+        if (tries > 0) {
+            if ((errno == ETIMEDOUT && num_addrs == 1) ||
+                !upstream_take_budget(hostname, 0)) {
+                break;
+            }
+            LOG_INFO("retry connect to %s", hostname);
+        }
+
+        /* Build the server's Internet address. */
+        bzero((char *)&server_addr, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(target_port);
+        server_addr.sin_addr = order[tries % num_addrs];
+        tries++;
+
+        /* Create server socket. */
+        server_sock = netio_socket();
+        if (server_sock < 0) {
+            PLOG_ERROR("socket");
+            return -1;
+        }
+
+        /* Create a connection with the server. */
+        if (netio_connect(server_sock,
+                          &server_addr,
+                          deadline_config.connect) < 0) {
+            int err = errno;
 
-    /* Create a connection with the server. */
-    if (connect(server_sock,
-                (struct sockaddr *)&server_addr,
-                sizeof(server_addr)) < 0) {
-        PLOG_ERROR("connect");
+            if (err == ETIMEDOUT) {
+                deadline_count(DEADLINE_REASON_CONNECT);
+            }
+            PLOG_ERROR("connect");
+            netio_close(server_sock);
+            server_sock = -1;
+            if (num_addrs > 1) {
+                upstream_eject(target, server_addr.sin_addr, netio_now());
+            }
+            errno = err;
+        }
+    }
+    TRACE4(connect_done,
+           client_sock,
+           server_sock,
+           tries,
+           netio_now_us() - start_us);
+    if (server_sock < 0) {
+        upstream_report(hostname, 0, netio_now());
         return -1;
     }
+    access_log_connect(client_sock, netio_now_us() - start_us);
+    if (busy_poll_us > 0) {
+        affinity_busy_poll(server_sock, busy_poll_us);
+    }
 
     /* Create socket buffer for this server. */
     if (sock_buf_add_server(server_sock,
                             client_sock,
                             key) == 0) {
       LOG_ERROR("fail to add server socket buffer");
-      close(server_sock);
+      netio_close(server_sock);
       return -1;
     }
+    sock_buf_get(server_sock)->addr = server_addr;
+    sock_buf_get(server_sock)->host = strdup(hostname);
 
     /* Update upperbound of used FD for sockets. */
     if (server_sock > max_fd) {
@@ -335,12 +705,32 @@ int connect_server(const char *hostname,
     /* Add new server to selection FD set. */
     FD_SET(server_sock, &active_fd_set);
 
-    LOG_INFO("connect to %s:%d", hostname, port);
+    LOG_INFO("connect to %s:%d", target, target_port);
 
     return server_sock;
 }
 
+/**
+ * Connect to server by the given hostname and port for a request of a client.
+ *
+ * @param hostname Server hostname without port number.
+ * @param port Server port number.
+ * @param client_sock FD for client socket.
+ * @param key String for cache key, i.e. hostname + url in GET request.
+ * @return Socket of the new connected server; -1 on failure.
+ */
+int connect_server(const char *hostname,
+                   const int port,
+                   int client_sock,
+                   char* key) {
+    /* Each request earns its host a share of a retry or hedge. */
+    upstream_add_request(hostname);
+    return connect_upstream(hostname, port, client_sock, key, NULL);
+}
+
 void disconnect_client(int fd);
+void fill_fragment(int fd, int part, const char* response, int len);
+void resume_requests(int fd);
 
 /**
  * @brief Disconnect the given server.
@@ -353,33 +743,45 @@ void disconnect_server(int fd)
     struct sock_buf* server_buf = NULL;
     int is_forward = 0;
     int peer;
+    int is_fragment = 0; /* Whether the server fetches a fragment. */
+    int page_client = -1; /* Client of the page of the fragment. */
+    int part = 0; /* Include of the fragment. */
 
     if (sock_buf_get(fd) == NULL) {
         return;
     }
 
+    /* The other attempt of a hedged request carries on alone. */
+    server_buf = sock_buf_get(fd);
+    if (sock_buf_get(server_buf->hedge_peer) != NULL) {
+        sock_buf_get(server_buf->hedge_peer)->hedge_peer = -1;
+    }
+
     /* Close SSL connection. */
     if (sock_buf_is_ssl(fd)) {
         /* Close SSL connection between the proxy and the server.*/
         server_buf = sock_buf_get(fd);
-        SSL_shutdown(server_buf->ssl);
+        tls_shutdown(server_buf->ssl, fd);
         SSL_free(server_buf->ssl);
         server_buf->ssl = NULL;
 
         /* Close SSL connection between the proxy and the client.*/
         client_buf = sock_buf_get(server_buf->peer);
         if (client_buf != NULL && client_buf->ssl != NULL) {
-            SSL_shutdown(client_buf->ssl);
+            stop_async_wait(server_buf->peer);
+            tls_shutdown(client_buf->ssl, server_buf->peer);
             SSL_free(client_buf->ssl);
             client_buf->ssl = NULL;
         }
     }
 
     /* Close TCP connection. */
-    close(fd);
+    netio_close(fd);
 
-    /* Remove from FD set for select(). */
+    /* Remove from FD sets for select(). The FD may be reused by a new socket
+     * before the main loop reaches it, and must not look readable then. */
     FD_CLR(fd, &active_fd_set);
+    FD_CLR(fd, &read_fd_set);
 
     /* Find the peer that directly forward to. */
     is_forward = sock_buf_is_forward(fd);
@@ -389,7 +791,16 @@ void disconnect_server(int fd)
         peer = server_buf->peer;
     }
 
-    /* Remove socket buffer. */
+    /* A fragment that did not come leaves its include empty. */
+    server_buf = sock_buf_get(fd);
+    if (server_buf->esi == ESI_FRAGMENT) {
+        is_fragment = 1;
+        page_client = server_buf->peer;
+        part = server_buf->esi_part;
+    }
+
+    /* Remove socket buffer, with the filters of its response. */
+    filter_free(server_buf->filter);
     sock_buf_rm(fd);
 
     /* Disconnect the peer that directly forward to. */
@@ -397,6 +808,13 @@ void disconnect_server(int fd)
         disconnect_client(peer);
     }
 
+    /* The page goes on past the include once the server is gone. */
+    if (is_fragment) {
+        fill_fragment(page_client, part, NULL, 0);
+        resume_requests(page_client);
+    }
+
+    TRACE2(disconnect, fd, 0);
     LOG_INFO("disconnect server (fd: %d)", fd);
 }
 
@@ -414,14 +832,21 @@ void disconnect_client(int fd)
         return;
     }
 
+    /* Stop waiting for its handshake before its SSL closes the FD waited on. */
+    stop_async_wait(fd);
+
     /* Close TCP connection. */
-    close(fd);
+    netio_close(fd);
 
-    /* Remove from FD set for select(). */
+    /* Remove from FD sets for select(). The FD may be reused by a new socket
+     * before the main loop reaches it, and must not look readable then. */
     FD_CLR(fd, &active_fd_set);
+    FD_CLR(fd, &read_fd_set);
 
-    /* Remove socket buffer. */
+    /* Remove socket buffer, with the page it assembles. */
+    esi_free(sock_buf_get(fd)->esi_page);
     sock_buf_rm(fd);
+    fairq_forget(fd);
 
     /* Close connected server. */
     for (int i = 0; i <= max_fd; ++i) {
@@ -431,18 +856,76 @@ void disconnect_client(int fd)
         }
     }
 
+    TRACE2(disconnect, fd, 1);
     LOG_INFO("disconnect client (fd: %d)", fd);
 }
 
+int ssl_accept_client(int client_sock, int server_sock);
+int reply_connection_established(int fd, char *version);
+void trace_response(int fd, int status, int len);
+
+/**
+ * @brief Continue the handshake with a server with the input it has. Once it
+ * is done, reply Connection Established to its client and start the
+ * handshake with the client; if it fails, disconnect both.
+ *
+ * @param server_sock FD for server socket.
+ * @return int 0 if the handshake is done or waits; -1 if the server is
+ * disconnected.
+ */
+int continue_connect(int server_sock)
+{
+    struct sock_buf* sock_buf = sock_buf_get(server_sock);
+    char* version = NULL;
+    int client_sock = sock_buf->peer;
+    int ret;
+
+    ret = tls_handshake(sock_buf->ssl, server_sock);
+    if (ret == TLS_WANT_READ) {
+        return 0;
+    }
+    if (ret != 1) {
+        LOG_ERROR("SSL_connect");
+        ERR_print_errors_fp(stderr);
+        TRACE4(tls_done, server_sock, 0, 0,
+               netio_now_us() - sock_buf->handshake_us);
+        disconnect_server(server_sock);
+        /* The client waits for a reply that never comes. */
+        disconnect_client(client_sock);
+        return -1;
+    }
+    TRACE4(tls_done, server_sock, 0, 1,
+           netio_now_us() - sock_buf->handshake_us);
+    LOG_INFO("established SSL connection with server (fd %d)", server_sock);
+
+    /* The server waits for requests of the client. */
+    sock_buf_set_phase(server_sock, DEADLINE_PHASE_IDLE);
+
+    /* Establish SSL connection with client. */
+    version = sock_buf->version;
+    sock_buf->version = NULL;
+    if (reply_connection_established(client_sock, version) == 0 &&
+        ssl_accept_client(client_sock, server_sock) < 0) {
+        LOG_ERROR("ssl_accept_client");
+    }
+    free(version);
+    return 0;
+}
+
 /**
- * Establish SSL connection to server.
+ * Start SSL connection to server. The handshake goes on as the server
+ * replies, and its client is answered once it is done.
  *
  * @param hostname Server hostname without port number.
  * @param port Server port number.
  * @param client_sock FD for client socket.
+ * @param version String of HTTP version field in the CONNECT request.
  * @return int Socket of the new connected server on success; -1 otherwise.
  */
-int ssl_connect_server(const char* hostname, int port, int client_sock)
+int ssl_connect_server(const char* hostname,
+                       int port,
+                       int client_sock,
+                       const char* version)
 {
     int server_sock;
     struct sock_buf* sock_buf = NULL;
@@ -458,32 +941,247 @@ int ssl_connect_server(const char* hostname, int port, int client_sock)
         LOG_ERROR("unknown socket %d", client_sock);
         return -1;
     }
-    ssl = SSL_new(ssl_ctx);
+    ssl = SSL_new(upstream_ssl_ctx);
     if (ssl == NULL) {
         LOG_ERROR("SSL_new");
         ERR_print_errors_fp(stderr);
         disconnect_server(server_sock);
         return -1;
     }
-    if (SSL_set_fd(ssl, server_sock) == 0) {
-        LOG_ERROR("SSL_set_fd");
-        ERR_print_errors_fp(stderr);
-        disconnect_server(server_sock);
-        return -1;
-    }
-    if (SSL_connect(ssl) != 1) {
-        LOG_ERROR("SSL_connect");
+    if (tls_attach(ssl) < 0) {
+        LOG_ERROR("tls_attach");
         ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
         disconnect_server(server_sock);
         return -1;
     }
+    SSL_set_connect_state(ssl);
     sock_buf->ssl = ssl;
     sock_buf->peer = client_sock;
+    sock_buf->version = strdup(version);
+    sock_buf->handshake_us = netio_now_us();
+    TRACE2(tls_start, server_sock, 0);
+    if (continue_connect(server_sock) < 0) {
+        return -1;
+    }
     return server_sock;
 }
 
+void handle_client_request(int fd);
+void serve_cached(int fd,
+                  char* request,
+                  int request_len,
+                  char* val,
+                  int val_len,
+                  int age,
+                  int is_head,
+                  int is_stale);
+
+/**
+ * @brief Answer the leading requests a client sent in TLS early data that are
+ * GET requests for fresh cached responses, before its handshake is done. An
+ * attacker may replay early data to another process, or a client may resend
+ * it after a refusal, so a request that would reach a server, and those after
+ * it, wait for the end of the handshake.
+ *
+ * @param fd FD for client socket.
+ */
+void serve_early_requests(int fd)
+{
+    struct sock_buf* sock_buf = sock_buf_get(fd);
+    char* request = NULL;
+    int request_len;
+    char* method = NULL;
+    char* url = NULL;
+    char* version = NULL;
+    char* host = NULL;
+    char* hostname = NULL;
+    char* key = NULL;
+    char* val = NULL;
+    int val_len = 0;
+    int age = 0;
+    int port = -1;
+    int is_hit;
+    int handled = 0; /* Whether any request is answered. */
+
+    /* Plugins see requests and cache keys once the handshake is done. */
+    if (PLUGIN_HOOKED(PLUGIN_REQUEST_HEAD) ||
+        PLUGIN_HOOKED(PLUGIN_CACHE_LOOKUP)) {
+        return;
+    }
+
+    while (sock_buf_get(fd) == sock_buf && sock_buf->held == NULL &&
+           (request_len = get_head_len(sock_buf->buf, sock_buf->size)) > 0) {
+        /* Look at the leading request, and take it only on a cache hit. */
+        request = strndup(sock_buf->buf, request_len);
+        if (request == NULL) {
+            PLOG_FATAL("strndup");
+        }
+        parse_request_head(request, &method, &url, &version, &host);
+        parse_host_field(host, &hostname, &port);
+        is_hit = 0;
+        if (method != NULL && url != NULL && hostname != NULL &&
+            strcmp(method, "GET") == 0) {
+            key = malloc(strlen(hostname) + strlen(url) + 1);
+            if (key == NULL) {
+                PLOG_FATAL("malloc");
+            }
+            strcpy(key, hostname);
+            strcat(key, url);
+            is_hit = cache_get_host(hostname, key, &val, &val_len, &age) > 0;
+        }
+        if (is_hit) {
+            free(request);
+            extract_first_request(&(sock_buf->buf),
+                                  &(sock_buf->size),
+                                  &request,
+                                  &request_len);
+            sock_buf->request_us = netio_now_us();
+            TRACE4(request_parsed, fd, method, url, request_len);
+            access_log_begin(fd, method, hostname, url, sock_buf->request_us);
+            access_log_cache(fd, ACCESS_CACHE_HIT);
+            LOG_INFO("cache hit in early data");
+            serve_cached(fd, request, request_len, val, val_len, age, 0, 0);
+        }
+        free(method);
+        method = NULL;
+        free(url);
+        url = NULL;
+        free(version);
+        version = NULL;
+        free(host);
+        host = NULL;
+        free(hostname);
+        hostname = NULL;
+        free(key);
+        key = NULL;
+        free(request);
+        request = NULL;
+        if (!is_hit) {
+            break;
+        }
+        handled = 1;
+    }
+
+    /* The next request head is due from its first byte. */
+    if (handled && sock_buf_get(fd) == sock_buf) {
+        sock_buf_set_phase(fd,
+                           sock_buf->size > 0 ? DEADLINE_PHASE_HEAD :
+                           DEADLINE_PHASE_IDLE);
+    }
+}
+
+/**
+ * @brief Read the TLS early data of a client into its buffer, and answer what
+ * it can from the cache, then continue the handshake.
+ *
+ * @param client_sock FD for client socket.
+ * @return int As tls_handshake(); -1 also if the client is disconnected on
+ * the write of an answer.
+ */
+int read_early_data(int client_sock)
+{
+    struct sock_buf* sock_buf = sock_buf_get(client_sock);
+    char buf[BUF_SIZE];
+    int n;
+
+    while ((n = tls_read_early(sock_buf->ssl,
+                               client_sock,
+                               buf,
+                               sizeof(buf))) > 0) {
+        sock_buf_update_input(client_sock, n);
+        if (sock_buf_buffer(client_sock, buf, n) < 0) {
+            PLOG_ERROR("sock_buf_buffer");
+            return -1;
+        }
+    }
+    if (n == 0) {
+        /* No more early data; requests after it wait for the handshake. */
+        sock_buf->in_early_data = 0;
+        serve_early_requests(client_sock);
+        if (sock_buf_get(client_sock) != sock_buf) {
+            return -1;
+        }
+        return tls_handshake(sock_buf->ssl, client_sock);
+    }
+    if (n == TLS_WANT_READ) {
+        serve_early_requests(client_sock);
+        if (sock_buf_get(client_sock) != sock_buf) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Continue the handshake of a client with the input it has, or once
+ * the private key operation it waits for is done. If it waits for one again,
+ * the main loop watches the FD of the operation instead of the client.
+ *
+ * @param client_sock FD for client socket.
+ * @return int 0 if the handshake is done or waits; -1 if the client is
+ * disconnected.
+ */
+int continue_accept(int client_sock)
+{
+    struct sock_buf* sock_buf = sock_buf_get(client_sock);
+    OSSL_ASYNC_FD async_fd;
+    size_t num_fds = 0;
+    int ret;
+
+    if (sock_buf->in_early_data) {
+        ret = read_early_data(client_sock);
+        if (sock_buf_get(client_sock) != sock_buf) {
+            /* Disconnected on the write of an answer. */
+            return -1;
+        }
+    }
+    else {
+        ret = tls_handshake(sock_buf->ssl, client_sock);
+    }
+    if (ret == TLS_WANT_READ) {
+        return 0;
+    }
+    if (ret == 1) {
+        SSL_clear_mode(sock_buf->ssl, SSL_MODE_ASYNC);
+        TRACE4(tls_done, client_sock, 1, 1,
+               netio_now_us() - sock_buf->handshake_us);
+        LOG_INFO("established SSL connection with client (fd %d)",
+                 client_sock);
+
+        /* Handle requests held back from early data. */
+        if (sock_buf->size > 0) {
+            handle_client_request(client_sock);
+        }
+        return 0;
+    }
+    if (ret == TLS_WANT_ASYNC &&
+        SSL_get_all_async_fds(sock_buf->ssl, NULL, &num_fds) == 1 &&
+        num_fds == 1 &&
+        SSL_get_all_async_fds(sock_buf->ssl, &async_fd, &num_fds) == 1 &&
+        async_fd < FD_SETSIZE) {
+        FD_CLR(client_sock, &active_fd_set);
+        FD_CLR(client_sock, &read_fd_set);
+        FD_SET(async_fd, &active_fd_set);
+        async_client[async_fd] = client_sock;
+        sock_buf->async_fd = async_fd;
+        if (async_fd > max_fd) {
+            max_fd = async_fd;
+        }
+        return 0;
+    }
+    LOG_ERROR("SSL_accept");
+    ERR_print_errors_fp(stderr);
+    TRACE4(tls_done, client_sock, 1, 0,
+           netio_now_us() - sock_buf->handshake_us);
+    disconnect_client(client_sock);
+    return -1;
+}
+
 /**
- * @brief Establish SSL connection with client.
+ * @brief Start SSL connection with client. The handshake goes on as the
+ * client sends its flights, or as its private key operation is done with the
+ * key pool on.
  * 
  * @param client_sock FD for client socket.
  * @param server_sock FD for client socket.
@@ -506,21 +1204,23 @@ int ssl_accept_client(int client_sock, int server_sock)
         disconnect_client(client_sock);
         return -1;
     }
-    if (SSL_set_fd(ssl, client_sock) == 0) {
-        LOG_ERROR("SSL_set_fd");
+    if (tls_attach(ssl) < 0) {
+        LOG_ERROR("tls_attach");
         ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
         disconnect_client(client_sock);
         return -1;
     }
-    if (SSL_accept(ssl) != 1) {
-        LOG_ERROR("SSL_accept");
-        ERR_print_errors_fp(stderr);
-        disconnect_client(client_sock);
-        return -1;
+    SSL_set_accept_state(ssl);
+    if (key_threads > 0) {
+        SSL_set_mode(ssl, SSL_MODE_ASYNC);
     }
     sock_buf->ssl = ssl;
+    sock_buf->in_early_data = max_early_data > 0;
     sock_buf->peer = server_sock;
-    return 0;
+    sock_buf->handshake_us = netio_now_us();
+    TRACE2(tls_start, client_sock, 1);
+    return continue_accept(client_sock);
 }
 
 /**
@@ -529,7 +1229,7 @@ int ssl_accept_client(int client_sock, int server_sock)
  * @param fd FD for a client/server socket.
  * @param version version string for HTTP request.
  *
- * @return int 0 if succeed; -1 if client is disconnected, -2 if wrote a partial message.
+ * @return int 0 if succeed; -1 if client is disconnected.
  */
 int reply_connection_established(int fd, char *version){
     char * message = NULL;
@@ -546,7 +1246,9 @@ int reply_connection_established(int fd, char *version){
     strcat(message, " 200 Connection Established\r\n\r\n");
     message[size] = '\0';
 
-    n = write(fd, message, size);
+    n = netio_write(fd, message, size);
+    free(message);
+    message = NULL;
     if (n < 0) {
         PLOG_ERROR("write");
         disconnect_client(fd);
@@ -557,37 +1259,956 @@ int reply_connection_established(int fd, char *version){
         disconnect_client(fd);
         return -1;
     }
-    else if(n < size){
-        LOG_ERROR("Cannot write the whole message");
-        return -2;
-    }
     else {
         LOG_INFO("replied Connection Established");
+        trace_response(fd, 200, size);
     }
 
-    free(message);
-    message = NULL;
-
     return 0;
 }
 
+void handle_other_request(int fd,
+                          char* request,
+                          int request_len,
+                          char* hostname,
+                          int port);
+
 /**
- * @brief Handle GET request.
- * 
- * @param fd FD for client socket.
- * @param request Client request.
- * @param request_len Byte size of client request.
- * @param url URL in client request.
- * @param hostname Hostname in client request.
- * @param port Port number in client request.
+ * @brief Time a GET request sent to a server, and schedule its hedge after
+ * the hedging delay of the host, if it has one.
+ *
+ * @param server_sock FD for server socket.
+ * @param request Request sent to the server.
+ * @param request_len Byte size of the request.
  */
-void handle_get_request(int fd,
-                        char* request,
-                        int request_len,
-                        char* url,
-                        char* hostname,
-                        int port) {
-    struct sock_buf* client_buf = NULL;
+void arm_hedge(int server_sock, const char* request, int request_len)
+{
+    struct sock_buf* server_buf = NULL;
+    long delay;
+
+    server_buf = sock_buf_get(server_sock);
+    if (server_buf == NULL) {
+        return;
+    }
+    server_buf->sent_us = netio_now_us();
+    delay = upstream_hedge_delay(server_buf->host);
+    if (delay < 0) {
+        return;
+    }
+    server_buf->request = malloc(request_len);
+    if (server_buf->request == NULL) {
+        PLOG_ERROR("malloc");
+        return;
+    }
+    memcpy(server_buf->request, request, request_len);
+    server_buf->request_len = request_len;
+    server_buf->hedge_at = server_buf->sent_us + delay;
+}
+
+/**
+ * @brief Send the requests whose servers have not answered by their hedge
+ * time once more, to another address of the host, or over a new connection if
+ * it has one address, while the hedge budget of the host allows. The first
+ * attempt to answer serves the client.
+ *
+ * @param now_us Current time in microseconds.
+ * @return long Time in microseconds of the next hedge; 0 if none.
+ */
+long fire_hedges(long now_us)
+{
+    struct sock_buf* server_buf = NULL;
+    struct sock_buf* hedge_buf = NULL;
+    long next = 0;
+    int hedge;
+
+    for (int fd = 0; fd <= max_fd; ++fd) {
+        server_buf = sock_buf_get(fd);
+        if (server_buf == NULL || server_buf->hedge_at == 0) {
+            continue;
+        }
+        if (server_buf->hedge_at > now_us) {
+            if (next == 0 || server_buf->hedge_at < next) {
+                next = server_buf->hedge_at;
+            }
+            continue;
+        }
+        server_buf->hedge_at = 0;
+        if (!upstream_take_budget(server_buf->host, 1)) {
+            continue;
+        }
+        hedge = connect_upstream(server_buf->host,
+                                 ntohs(server_buf->addr.sin_port),
+                                 server_buf->peer,
+                                 server_buf->key,
+                                 &server_buf->addr.sin_addr);
+        if (hedge < 0) {
+            continue;
+        }
+        hedge_buf = sock_buf_get(hedge);
+        if (netio_write(hedge,
+                        server_buf->request,
+                        server_buf->request_len) <= 0) {
+            PLOG_ERROR("write");
+            disconnect_server(hedge);
+            continue;
+        }
+        hedge_buf->sent_us = netio_now_us();
+        hedge_buf->filter_body = server_buf->filter_body;
+        hedge_buf->accepts_gzip = server_buf->accepts_gzip;
+        hedge_buf->esi = server_buf->esi;
+        hedge_buf->esi_part = server_buf->esi_part;
+        if (server_buf->base_url != NULL) {
+            hedge_buf->base_url = strdup(server_buf->base_url);
+            if (hedge_buf->base_url == NULL) {
+                PLOG_FATAL("strdup");
+            }
+        }
+        hedge_buf->is_hedge = 1;
+        hedge_buf->hedge_peer = fd;
+        server_buf->hedge_peer = hedge;
+        LOG_INFO("hedge request to server (fd: %d) on server (fd: %d)",
+                 fd,
+                 hedge);
+    }
+    return next;
+}
+
+/**
+ * @brief Record the latency of the first byte of a response to a timed
+ * request, and disconnect the other attempt if the request was hedged.
+ *
+ * @param fd FD for server socket.
+ */
+void take_first_byte(int fd)
+{
+    struct sock_buf* server_buf = NULL;
+    int other;
+
+    server_buf = sock_buf_get(fd);
+    if (server_buf == NULL) {
+        return;
+    }
+    upstream_add_latency(server_buf->host,
+                         netio_now_us() - server_buf->sent_us);
+    server_buf->sent_us = 0;
+    server_buf->hedge_at = 0;
+    free(server_buf->request);
+    server_buf->request = NULL;
+    other = server_buf->hedge_peer;
+    if (other >= 0) {
+        if (server_buf->is_hedge) {
+            upstream_count_hedge_won();
+        }
+        LOG_INFO("server (fd: %d) answered first; drop server (fd: %d)",
+                 fd,
+                 other);
+        disconnect_server(other);
+    }
+}
+
+/**
+ * @brief Fire the response_done probe for a response written to a client,
+ * with the time since its request was parsed, and close its record in the
+ * access log.
+ *
+ * @param fd FD for client socket; the probe is skipped if it is closed.
+ * @param status Status code of the response; 0 if unknown.
+ * @param len Byte size of the response.
+ */
+void trace_response(int fd, int status, int len)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+    long now_us;
+
+    if (client_buf != NULL && client_buf->is_client) {
+        now_us = netio_now_us();
+        TRACE4(response_done,
+               fd,
+               status,
+               len,
+               now_us - client_buf->request_us);
+        access_log_end(fd, status, len, now_us);
+    }
+}
+
+/**
+ * @brief Write bytes to a client, over SSL if it uses it, and leave it
+ * connected on failure.
+ *
+ * @param fd FD for client socket.
+ * @param buf Bytes to write.
+ * @param n Byte size of buf.
+ * @return int 1 on success; 0 otherwise.
+ */
+int send_client(int fd, const char* buf, int n)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+    int is_ssl = 0;
+
+    if (client_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
+        return 0;
+    }
+    is_ssl = sock_buf_is_ssl(fd);
+    if (is_ssl) {
+        n = tls_write(client_buf->ssl, fd, buf, n);
+    }
+    else {
+        n = netio_write(fd, buf, n);
+    }
+    if (n < 0) {
+        if (is_ssl) {
+            LOG_ERROR("SSL_write");
+            ERR_print_errors_fp(stderr);
+        }
+        else {
+            PLOG_ERROR("write");
+        }
+        return 0;
+    }
+    if (n == 0) {
+        LOG_ERROR("client socket is closed on the other side");
+        return 0;
+    }
+    sock_buf_touch(fd);
+    return 1;
+}
+
+/**
+ * @brief Write bytes to a client, over SSL if it uses it.
+ *
+ * @param fd FD for client socket.
+ * @param buf Bytes to write.
+ * @param n Byte size of buf.
+ * @return int 1 on success; 0 if the client is unknown, or disconnected on
+ * failure.
+ */
+int write_client(int fd, const char* buf, int n)
+{
+    if (!send_client(fd, buf, n)) {
+        disconnect_client(fd);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Sink of response bodies: let the body plugins see bytes, then write
+ * them to the client.
+ *
+ * @param arg FD for client socket, cast to a pointer.
+ * @param data Body bytes.
+ * @param len Byte size of data.
+ * @return int 0 on success; -1 if a plugin closes the client or the write
+ * fails, and the client is to be disconnected.
+ */
+int send_body(void* arg, const char* data, int len)
+{
+    int fd = (int)(intptr_t)arg;
+    struct plugin_view view;
+
+    if (PLUGIN_HOOKED(PLUGIN_BODY_CHUNK)) {
+        view.data = data;
+        view.len = len;
+        if (plugin_body_chunk(fd, view) == PLUGIN_CLOSE) {
+            LOG_INFO("plugin closes client (fd %d)", fd);
+            return -1;
+        }
+    }
+    return send_client(fd, data, len) ? 0 : -1;
+}
+
+/**
+ * @brief Write the head of a response to a client, as the response plugins
+ * leave it, followed by the empty line.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response; 0 if unknown.
+ * @param head Head without the empty line.
+ * @param head_len Byte size of head.
+ * @return int 1 on success; 0 if the client is unknown, or disconnected as a
+ * plugin closes it or a write fails.
+ */
+int write_head(int fd, int status, const char* head, int head_len)
+{
+    struct plugin_view view;
+    struct plugin_view out;
+
+    out.data = head;
+    out.len = head_len;
+    if (PLUGIN_HOOKED(PLUGIN_RESPONSE_HEAD)) {
+        view = out;
+        if (plugin_response_head(fd, status, view, &out) == PLUGIN_CLOSE) {
+            LOG_INFO("plugin closes client (fd %d)", fd);
+            disconnect_client(fd);
+            return 0;
+        }
+    }
+    return write_client(fd, out.data, out.len) &&
+           write_client(fd, "\r\n", 2);
+}
+
+/**
+ * @brief Run the response plugins on a cached response, with its Age field
+ * moved into its head.
+ *
+ * @param fd FD for client socket.
+ * @param status Status code of the response.
+ * @param head Input and output; response head, replaced if a plugin does.
+ * @param head_len Input and output; byte size of head.
+ * @param age_line Input and output; header lines of the age, freed and set to
+ * NULL.
+ * @param body Response body.
+ * @param body_len Byte size of body.
+ * @return int 0 to write the response; -1 if a plugin closes the client.
+ */
+int run_cached_plugins(int fd,
+                       int status,
+                       char** head,
+                       int* head_len,
+                       char** age_line,
+                       const char* body,
+                       int body_len)
+{
+    struct plugin_view view;
+    struct plugin_view out;
+    int age_len = *age_line != NULL ? strlen(*age_line) : 0;
+    char* merged = NULL;
+
+    merged = realloc(*head, *head_len + age_len + 1);
+    if (merged == NULL) {
+        PLOG_FATAL("realloc");
+    }
+    memcpy(merged + *head_len, *age_line, age_len);
+    *head = merged;
+    *head_len += age_len;
+    free(*age_line);
+    *age_line = NULL;
+
+    if (PLUGIN_HOOKED(PLUGIN_RESPONSE_HEAD)) {
+        view.data = *head;
+        view.len = *head_len;
+        switch (plugin_response_head(fd, status, view, &out)) {
+        case PLUGIN_CLOSE:
+            return -1;
+        case PLUGIN_REPLACE:
+            merged = malloc(out.len + 1);
+            if (merged == NULL) {
+                PLOG_FATAL("malloc");
+            }
+            memcpy(merged, out.data, out.len);
+            free(*head);
+            *head = merged;
+            *head_len = out.len;
+            break;
+        default:
+            break;
+        }
+    }
+    if (PLUGIN_HOOKED(PLUGIN_BODY_CHUNK) && body_len > 0) {
+        view.data = body;
+        view.len = body_len;
+        if (plugin_body_chunk(fd, view) == PLUGIN_CLOSE) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether a request line is HTTP/1.1. An HTTP/1.0 client knows
+ * neither chunked bodies nor interim responses.
+ *
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @return int 1 if it is HTTP/1.1; 0 otherwise.
+ */
+int is_http11(const char* request, int request_len)
+{
+    const char* line_end = memchr(request, '\r', request_len);
+
+    return line_end != NULL && line_end - request >= 8 &&
+           strncmp(line_end - 8, "HTTP/1.1", 8) == 0;
+}
+
+/**
+ * @brief Answer a GET or HEAD request with a cached response, or with
+ * "304 Not Modified" if the validators of the request match.
+ *
+ * @param fd FD for client socket.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param val Cached response; freed here.
+ * @param val_len Byte size of val.
+ * @param age Age of the cached response in seconds.
+ * @param is_head 1 for a HEAD request; 0 for GET.
+ * @param is_stale 1 if the response is stale and stands in for a failed
+ * server, which a Warning header tells the client.
+ */
+void serve_cached(int fd,
+                  char* request,
+                  int request_len,
+                  char* val,
+                  int val_len,
+                  int age,
+                  int is_head,
+                  int is_stale)
+{
+    struct sock_buf* client_buf = NULL;
+    int is_ssl = 0;
+    char* head = NULL;
+    int head_len = 0;
+    char* body = NULL;
+    int body_len = 0;
+    char* age_line = NULL;
+    char* raw = NULL;
+    int raw_len = 0;
+    int status = 200;
+    int closed = 0; /* Whether a plugin closes the client. */
+    struct filter_stream* filter = NULL; /* Filters of the body. */
+    char* filtered_head = NULL;
+    int filtered_len = 0;
+    int filtered = 1; /* Result of the filters; 1 once the body is done. */
+    int send_len; /* Byte size of the body sent now. */
+    int n = 0;
+
+    client_buf = sock_buf_get(fd);
+    if (client_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
+        free(val);
+        return;
+    }
+    is_ssl = sock_buf_is_ssl(fd);
+
+    if (is_not_modified(request, request_len, val, val_len) &&
+        make_not_modified(val, val_len, &head, &head_len) == 0) {
+        /* Validators match; answer without the body. */
+        LOG_INFO("not modified");
+        status = 304;
+        body = strdup("");
+    }
+    else {
+        /* Decompress a gzip coded response for a client without gzip. */
+        if (compress_serve(val,
+                           val_len,
+                           compress_accepts_gzip(request, request_len),
+                           &raw,
+                           &raw_len) == 1) {
+            free(val);
+            val = raw;
+            val_len = raw_len;
+        }
+        parse_body_head(val, val_len, &head, &head_len, &body, &body_len);
+        if (is_head) {
+            body_len = 0;
+        }
+        /* The cache keeps the response as the server sent it, and the
+         * filters run on each hit. Their chunked body is only for
+         * HTTP/1.1 clients. */
+        else if (filter_count() > 0 &&
+                 is_http11(request, request_len) &&
+                 filter_open(val,
+                             get_head_len(val, val_len),
+                             compress_accepts_gzip(request, request_len),
+                             &filter,
+                             &filtered_head,
+                             &filtered_len) == 1) {
+            free(head);
+            head = filtered_head;
+            head_len = filtered_len;
+        }
+    }
+
+    /* Create header line for age field. */
+    age_line = malloc(100);
+    if (age_line == NULL) {
+        PLOG_ERROR("malloc");
+    }
+    else {
+        bzero(age_line, 100);
+        sprintf(age_line, "Age: %d\r\n", age);
+        if (is_stale) {
+            strcat(age_line, "Warning: 110 - \"Response is Stale\"\r\n");
+        }
+    }
+
+    /* Let plugins see the response, with its Age field in its head. */
+    if (PLUGIN_HOOKED(PLUGIN_RESPONSE_HEAD) ||
+        PLUGIN_HOOKED(PLUGIN_BODY_CHUNK)) {
+        closed = run_cached_plugins(fd,
+                                    status,
+                                    &head,
+                                    &head_len,
+                                    &age_line,
+                                    body,
+                                    filter == NULL ? body_len : 0) < 0;
+    }
+
+    /* A large body goes out a quantum per round of the main loop, so other
+     * clients are served in between. */
+    send_len = body_len;
+    if (fairq_round_kb > 0 && filter == NULL && body_len > FAIRQ_QUANTUM) {
+        send_len = FAIRQ_QUANTUM;
+    }
+
+    /* Forward cached response to the client. Over SSL, its records go out in
+     * one write. */
+    if (!closed && is_ssl) {
+        n = tls_send(client_buf->ssl, head, head_len);
+        if (n > 0 && age_line != NULL) {
+            n = tls_send(client_buf->ssl, age_line, strlen(age_line));
+        }
+        if (n > 0) {
+            n = tls_send(client_buf->ssl, "\r\n", strlen("\r\n"));
+        }
+        if (n > 0 && send_len > 0 && filter == NULL) {
+            n = tls_send(client_buf->ssl, body, send_len);
+        }
+        if (n > 0) {
+            n = tls_flush(client_buf->ssl, fd);
+        }
+    }
+    else if (!closed) {
+        n = netio_write(fd, head, head_len);
+        if (age_line != NULL) {
+            n = netio_write(fd, age_line, strlen(age_line));
+        }
+        n = netio_write(fd, "\r\n", strlen("\r\n"));
+        if (send_len > 0 && filter == NULL) {
+            n = netio_write(fd, body, send_len);
+        }
+    }
+    if (!closed && n > 0 && filter != NULL) {
+        /* The filtered body goes out window by window. */
+        filtered = filter_push(filter,
+                               body,
+                               body_len,
+                               send_body,
+                               (void*)(intptr_t)fd);
+    }
+    if (closed) {
+        LOG_INFO("plugin closes client (fd %d)", fd);
+        disconnect_client(fd);
+    }
+    else if (filtered != 1) {
+        LOG_ERROR("fail to filter cached response to client (fd %d)", fd);
+        disconnect_client(fd);
+    }
+    else if (n < 0) {
+        if (is_ssl) {
+            ERR_print_errors_fp(stderr);
+            LOG_ERROR("SSL_write");
+        }
+        else {
+            PLOG_ERROR("write");
+        }
+        disconnect_client(fd);
+    }
+    else if (n == 0) {
+        LOG_ERROR("client socket is closed on the other side");
+        disconnect_client(fd);
+    }
+    else {
+        LOG_INFO("forward %d bytes from cache to client (fd %d)",
+                 head_len + body_len,
+                 fd);
+        if (send_len < body_len) {
+            /* The response is traced once send_held() writes the rest. */
+            client_buf->held = body;
+            client_buf->held_len = body_len;
+            client_buf->held_sent = send_len;
+            client_buf->held_status = status;
+            client_buf->held_head_len = head_len;
+            body = NULL;
+        }
+        else {
+            trace_response(fd, status, head_len + body_len);
+        }
+    }
+
+    free(val);
+    val = NULL;
+    free(head);
+    head = NULL;
+    free(body);
+    body = NULL;
+    free(age_line);
+    age_line = NULL;
+    filter_free(filter);
+    filter = NULL;
+}
+
+/**
+ * @brief Send a client the next quantum of the cached body held for it. Once
+ * the body is out, trace its response and handle the requests that waited
+ * for it.
+ *
+ * @param fd FD for client socket.
+ * @return int Byte size sent; 0 if none, or if the client was disconnected.
+ */
+int send_held(int fd)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+    int n;
+
+    if (client_buf == NULL || client_buf->held == NULL) {
+        return 0;
+    }
+    n = client_buf->held_len - client_buf->held_sent;
+    if (n > FAIRQ_QUANTUM) {
+        n = FAIRQ_QUANTUM;
+    }
+    if (!write_client(fd, client_buf->held + client_buf->held_sent, n)) {
+        return 0;
+    }
+    client_buf->held_sent += n;
+    if (client_buf->held_sent == client_buf->held_len) {
+        trace_response(fd,
+                       client_buf->held_status,
+                       client_buf->held_head_len + client_buf->held_len);
+        free(client_buf->held);
+        client_buf->held = NULL;
+        resume_requests(fd);
+    }
+    return n;
+}
+
+/**
+ * @brief Handle the requests of a client that waited for its held body or
+ * its page, once neither is left.
+ *
+ * @param fd FD for client socket.
+ */
+void resume_requests(int fd)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+
+    if (client_buf != NULL &&
+        client_buf->is_client &&
+        client_buf->held == NULL &&
+        client_buf->esi_page == NULL &&
+        client_buf->size > 0) {
+        handle_client_request(fd);
+    }
+}
+
+/**
+ * @brief Whether a request may go to a server, given its breaker. A request
+ * that fails fast is answered with a stale cached response if there is one,
+ * and "503 Service Unavailable" otherwise.
+ *
+ * @param fd FD for client socket.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param hostname Server hostname.
+ * @param key Cache key of a GET request; NULL for other requests.
+ * @return int 1 if the request may go to the server; 0 if it was answered.
+ */
+int allow_server(int fd,
+                 char* request,
+                 int request_len,
+                 const char* hostname,
+                 const char* key)
+{
+    static const char unavailable[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                      "Content-Length: 0\r\n"
+                                      "\r\n";
+    char* val = NULL;
+    int val_len = 0;
+    int age = 0;
+
+    if (upstream_allow(hostname, netio_now())) {
+        return 1;
+    }
+    LOG_INFO("fail fast: breaker of %s is open", hostname);
+    if (key != NULL && cache_get_stale(key, &val, &val_len, &age) > 0) {
+        LOG_INFO("serve stale response");
+        access_log_cache(fd, ACCESS_CACHE_STALE);
+        serve_cached(fd, request, request_len, val, val_len, age, 0, 1);
+        return 0;
+    }
+    if (netio_write(fd, unavailable, strlen(unavailable)) <= 0) {
+        PLOG_ERROR("write");
+        disconnect_client(fd);
+    }
+    else {
+        trace_response(fd, 503, strlen(unavailable));
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the absolute URL of a GET request, which includes of a shell
+ * resolve against.
+ *
+ * @param url URL in the request line, absolute or a path.
+ * @param hostname Hostname of the request.
+ * @param port Port number of the request.
+ * @return char* Absolute "http://" URL. Caller is responsible to free it.
+ */
+char* make_base_url(const char* url, const char* hostname, int port)
+{
+    char* base = NULL;
+
+    if (strncmp(url, "http://", 7) == 0) {
+        base = strdup(url);
+    }
+    else {
+        base = malloc(strlen(hostname) + strlen(url) + 32);
+        if (base != NULL && port == 80) {
+            sprintf(base, "http://%s%s", hostname, url);
+        }
+        else if (base != NULL) {
+            sprintf(base, "http://%s:%d%s", hostname, port, url);
+        }
+    }
+    if (base == NULL) {
+        PLOG_FATAL("malloc");
+    }
+    return base;
+}
+
+/**
+ * @brief Write the parts of the page of a client that are ready, up to the
+ * first include still pending. The page is traced and freed once it is all
+ * out, and the client is disconnected if a write fails.
+ *
+ * @param fd FD for client socket.
+ */
+void drain_page(int fd)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+    int ret;
+
+    if (client_buf == NULL || client_buf->esi_page == NULL) {
+        return;
+    }
+    ret = esi_drain(client_buf->esi_page, send_body, (void*)(intptr_t)fd);
+    if (ret < 0) {
+        LOG_ERROR("fail to write page to client (fd %d)", fd);
+        disconnect_client(fd);
+    }
+    else if (ret == 1) {
+        LOG_INFO("page assembled for client (fd %d)", fd);
+        trace_response(fd,
+                       200,
+                       client_buf->page_head_len +
+                       esi_sent(client_buf->esi_page));
+        esi_free(client_buf->esi_page);
+        client_buf->esi_page = NULL;
+    }
+}
+
+/**
+ * @brief Fill an include of the page of a client with a fragment from a
+ * server, and write the parts it lets out.
+ *
+ * @param fd FD for client socket.
+ * @param part Index of the include.
+ * @param response Complete response; NULL if its fetch failed.
+ * @param len Byte size of response.
+ */
+void fill_fragment(int fd, int part, const char* response, int len)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+
+    if (client_buf == NULL || client_buf->esi_page == NULL) {
+        return;
+    }
+    esi_fill(client_buf->esi_page, part, response, len, 0);
+    drain_page(fd);
+}
+
+/**
+ * @brief Fill an include of the page of a client from the cache, or start to
+ * fetch it from its server. A fragment is cached under its own key, as the
+ * response to a GET of its URL. If the breaker of its server is open, it is
+ * filled from a stale response, or left empty.
+ *
+ * @param fd FD for client socket.
+ * @param part Index of the include.
+ * @param base Absolute URL of the shell.
+ */
+void fetch_fragment(int fd, int part, const char* base)
+{
+    struct esi_page* page = sock_buf_get(fd)->esi_page;
+    struct sock_buf* server_buf = NULL;
+    char* url = NULL;
+    char* host = NULL;
+    char* hostname = NULL;
+    int port = 80;
+    char* key = NULL;
+    char* request = NULL;
+    char* val = NULL;
+    int val_len = 0;
+    int age = 0;
+    int server_sock;
+    int n;
+
+    if (esi_resolve(esi_src(page, part), base, &url, &host) < 0) {
+        LOG_ERROR("cannot include %s", esi_src(page, part));
+        esi_fill(page, part, NULL, 0, 0);
+        return;
+    }
+    parse_host_field(host, &hostname, &port);
+    key = malloc(strlen(hostname) + strlen(url) + 1);
+    request = malloc(strlen(url) + strlen(host) + 64);
+    if (key == NULL || request == NULL) {
+        PLOG_FATAL("malloc");
+    }
+    strcpy(key, hostname);
+    strcat(key, url);
+    if (cache_get_host(hostname, key, &val, &val_len, &age) > 0) {
+        esi_fill(page, part, val, val_len, 1);
+        free(val);
+    }
+    else if (!upstream_allow(hostname, netio_now())) {
+        /* A server whose breaker is open fails fast, as for a client. */
+        LOG_INFO("fail fast: breaker of %s is open", hostname);
+        if (cache_get_stale(key, &val, &val_len, &age) > 0) {
+            esi_fill(page, part, val, val_len, 1);
+            free(val);
+        }
+        else {
+            esi_fill(page, part, NULL, 0, 0);
+        }
+    }
+    else {
+        /* The fetches of a page run in parallel, each on its own server
+         * connection. */
+        n = sprintf(request, "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", url, host);
+        server_sock = connect_server(hostname, port, fd, key);
+        if (server_sock >= 0 && netio_write(server_sock, request, n) <= 0) {
+            PLOG_ERROR("write");
+            disconnect_server(server_sock);
+            server_sock = -1;
+        }
+        if (server_sock < 0) {
+            esi_fill(page, part, NULL, 0, 0);
+        }
+        else {
+            server_buf = sock_buf_get(server_sock);
+            server_buf->esi = ESI_FRAGMENT;
+            server_buf->esi_part = part;
+        }
+    }
+    free(url);
+    free(host);
+    free(hostname);
+    free(key);
+    free(request);
+}
+
+/**
+ * @brief Assemble a page from its shell for a client. The head goes out at
+ * once, each include is filled from the cache or fetched from its server, and
+ * the parts go out in page order as they become ready. The response is traced
+ * once the page is all out. A shell that does not parse goes out as is.
+ *
+ * @param fd FD for client socket.
+ * @param response Complete shell response.
+ * @param len Byte size of response.
+ * @param base Absolute URL of the shell.
+ */
+void assemble_page(int fd, const char* response, int len, const char* base)
+{
+    struct sock_buf* client_buf = sock_buf_get(fd);
+    struct esi_page* page = NULL;
+    char* head = NULL;
+    int head_len = 0;
+    int ok;
+
+    if (client_buf == NULL) {
+        LOG_ERROR("unknown socket %d", fd);
+        return;
+    }
+    /* A client has one page at a time. */
+    if (client_buf->esi_page != NULL ||
+        esi_parse(response, len, &page) < 0 ||
+        esi_page_head(response,
+                      get_head_len(response, len),
+                      &head,
+                      &head_len) < 0) {
+        LOG_ERROR("cannot assemble page; forward its shell as is");
+        esi_free(page);
+        if (write_client(fd, response, len)) {
+            trace_response(fd, 200, len);
+        }
+        return;
+    }
+    ok = write_head(fd, 200, head, head_len);
+    free(head);
+    if (!ok) {
+        esi_free(page);
+        return;
+    }
+    client_buf->esi_page = page;
+    client_buf->page_head_len = head_len + 2;
+    for (int i = 0; i < esi_num_parts(page); ++i) {
+        if (esi_src(page, i) != NULL) {
+            fetch_fragment(fd, i, base);
+        }
+    }
+    drain_page(fd);
+}
+
+/**
+ * @brief Send "103 Early Hints" with the preload links learned for a key, so
+ * the client fetches them while the server works on the response. An
+ * HTTP/1.0 client gets none, as it knows no interim responses.
+ *
+ * @param fd FD for client socket.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param key Cache key of the request.
+ * @return int 1 if the client is still connected; 0 if a write failed and it
+ * was disconnected.
+ */
+int send_early_hints(int fd,
+                     const char* request,
+                     int request_len,
+                     const char* key)
+{
+    char* hints = NULL;
+    int hints_len = 0;
+    int ok;
+
+    if (!is_http11(request, request_len) ||
+        !hints_get(key, &hints, &hints_len)) {
+        return 1;
+    }
+    LOG_INFO("early hints to client (fd %d)", fd);
+    ok = write_client(fd, hints, hints_len);
+    free(hints);
+    return ok;
+}
+
+/**
+ * @brief Handle GET or HEAD request.
+ *
+ * A cached response answers a HEAD request with its head, and a conditional
+ * request whose validators match with "304 Not Modified". A HEAD request
+ * that misses the cache is forwarded to the server as is. With ESI, a shell
+ * that answers a GET of a plain HTTP client is assembled into its page.
+ * With early hints, a GET that misses gets the preload links of the last
+ * response to it while the server works.
+ * 
+ * @param fd FD for client socket.
+ * @param request Client request.
+ * @param request_len Byte size of client request.
+ * @param url URL in client request.
+ * @param hostname Hostname in client request.
+ * @param port Port number in client request.
+ * @param is_head 1 for a HEAD request; 0 for a GET request.
+ */
+void handle_get_request(int fd,
+                        char* request,
+                        int request_len,
+                        char* url,
+                        char* hostname,
+                        int port,
+                        int is_head) {
+    struct sock_buf* client_buf = NULL;
     struct sock_buf* server_buf = NULL;
     int is_ssl = 0;
     char* key = NULL;
@@ -596,6 +2217,7 @@ void handle_get_request(int fd,
     int age = 0;
     int n;
     int server_sock;
+    int use_page = 0; /* Whether a shell is assembled into its page. */
 
     client_buf = sock_buf_get(fd);
     if (client_buf == NULL) {
@@ -603,6 +2225,8 @@ void handle_get_request(int fd,
         return;
     }
     is_ssl = sock_buf_is_ssl(fd);
+    use_page = use_esi && !is_ssl && !is_head &&
+               is_http11(request, request_len);
 
     /* Check cache. */
     /* Use hostname + url as cache key. */
@@ -612,77 +2236,72 @@ void handle_get_request(int fd,
     }
     strcpy(key, hostname);
     strcat(key, url);
-    if (cache_get(key, &val, &val_len, &age) > 0) {
-        char* head = NULL;
-        int head_len = 0;
-        char* body = NULL;
-        int body_len = 0;
-        char* age_line = NULL;
 
-        LOG_INFO("cache hit");
+    /* Plugins may rewrite the key, or keep the response out of the cache,
+     * which a NULL key does from here on. */
+    if (PLUGIN_HOOKED(PLUGIN_CACHE_LOOKUP)) {
+        struct plugin_view view = {key, strlen(key)};
+        struct plugin_view out;
 
-        /* Create header line for age field. */
-        age_line = malloc(100);
-        if (age_line == NULL) {
-            PLOG_ERROR("malloc");
-        }
-        else {
-            bzero(age_line, 100);
-            sprintf(age_line, "Age: %d\r\n", age);
-        }
-
-        /* Forward cached response to the client. */
-        parse_body_head(val, val_len, &head, &head_len, &body, &body_len);
-        if (is_ssl) {
-            n = SSL_write(client_buf->ssl, head, head_len);
-            if (age_line != NULL) {
-                n = SSL_write(client_buf->ssl, age_line, strlen(age_line));
-            }
-            n = SSL_write(client_buf->ssl, "\r\n", strlen("\r\n"));
-            n = SSL_write(client_buf->ssl, body, body_len);
-        }
-        else {
-            n = write(fd, head, head_len);
-            if (age_line != NULL) {
-                n = write(fd, age_line, strlen(age_line));
-            }
-            n = write(fd, "\r\n", strlen("\r\n"));
-            n = write(fd, body, body_len);
-        }
-        if (n < 0) {
-            if (is_ssl) {
-                ERR_print_errors_fp(stderr);
-                LOG_ERROR("SSL_write");
-            }
-            else {
-                PLOG_ERROR("write");
-            }
+        switch (plugin_cache_lookup(fd, view, &out)) {
+        case PLUGIN_CLOSE:
+            LOG_INFO("plugin closes client (fd %d)", fd);
+            free(key);
+            key = NULL;
             disconnect_client(fd);
+            return;
+        case PLUGIN_REPLACE:
+            free(key);
+            key = strndup(out.data, out.len);
+            if (key == NULL) {
+                PLOG_FATAL("strndup");
+            }
+            break;
+        case PLUGIN_BYPASS:
+            LOG_INFO("plugin bypasses cache");
+            free(key);
+            key = NULL;
+            break;
+        default:
+            break;
         }
-        else if (n == 0) {
-            LOG_ERROR("client socket is closed on the other side");
-            disconnect_client(fd);
+    }
+    if (key != NULL &&
+        cache_get_host(hostname, key, &val, &val_len, &age) > 0) {
+        LOG_INFO("cache hit");
+        access_log_cache(fd, ACCESS_CACHE_HIT);
+        if (use_page && esi_is_shell(val, get_head_len(val, val_len))) {
+            char* base = make_base_url(url, hostname, port);
+
+            assemble_page(fd, val, val_len, base);
+            free(base);
+            free(val);
         }
         else {
-            LOG_INFO("forward %d bytes from cache to client (fd %d)",
-                     val_len,
-                     fd);
+            serve_cached(fd, request, request_len, val, val_len, age, is_head,
+                         0);
         }
-
         free(key);
         key = NULL;
-        free(val);
-        val = NULL;
-        free(head);
-        head = NULL;
-        free(body);
-        body = NULL;
-        free(age_line);
-        age_line = NULL;
-
         return;
     }
-    LOG_INFO("cache miss");
+    if (key != NULL) {
+        LOG_INFO("cache miss");
+        access_log_cache(fd, ACCESS_CACHE_MISS);
+    }
+    if (is_head) {
+        /* A response to HEAD has no body to cache. */
+        free(key);
+        key = NULL;
+        handle_other_request(fd, request, request_len, hostname, port);
+        return;
+    }
+    if (use_hints && key != NULL &&
+        !send_early_hints(fd, request, request_len, key)) {
+        free(key);
+        key = NULL;
+        return;
+    }
 
     /* Connect the requested server. */
     if (is_ssl) {
@@ -694,9 +2313,18 @@ void handle_get_request(int fd,
             key = NULL;
             return;
         }
-        server_buf->key = strdup(key);
+        free(server_buf->key);
+        server_buf->key = key != NULL ? strdup(key) : NULL;
+        free(server_buf->host);
+        server_buf->host = strdup(hostname);
+        sock_buf_set_phase(server_sock, DEADLINE_PHASE_FIRST_BYTE);
     }
     else {
+        if (!allow_server(fd, request, request_len, hostname, key)) {
+            free(key);
+            key = NULL;
+            return;
+        }
         server_sock = connect_server(hostname, port, fd, key);
         if (server_sock < 0) {
             /* Fail to connect the request server. */
@@ -704,14 +2332,28 @@ void handle_get_request(int fd,
             key = NULL;
             return;
         }
+        server_buf = sock_buf_get(server_sock);
+    }
+
+    /* The response to a GET of an HTTP/1.1 client may go through the
+     * filters, which frame it as chunks. */
+    server_buf->filter_body = filter_count() > 0 &&
+                              is_http11(request, request_len);
+    server_buf->accepts_gzip = compress_accepts_gzip(request, request_len);
+
+    /* The response may be the shell of a page, held until its head tells. */
+    if (use_page) {
+        server_buf->esi = ESI_MAYBE;
+        free(server_buf->base_url);
+        server_buf->base_url = make_base_url(url, hostname, port);
     }
 
     /* Forward request to server. */
     if (is_ssl) {
-        n = SSL_write(server_buf->ssl, request, request_len);
+        n = tls_write(server_buf->ssl, server_sock, request, request_len);
     }
     else {
-        n = write(server_sock, request, request_len);
+        n = netio_write(server_sock, request, request_len);
     }
     if (n < 0) {
         if (is_ssl) {
@@ -727,6 +2369,9 @@ void handle_get_request(int fd,
         LOG_ERROR("server socket is closed on the other side");
         disconnect_server(server_sock);
     }
+    if (n > 0 && !is_ssl) {
+        arm_hedge(server_sock, request, request_len);
+    }
 
     free(key);
     key = NULL;
@@ -747,23 +2392,18 @@ void handle_connect_request(int client_sock,
 {
     int server_sock;
 
+    if (!allow_server(client_sock, NULL, 0, hostname, NULL)) {
+        return;
+    }
     if (use_ssl) {
-        /* Establish SSL connection with server. */
-        server_sock = ssl_connect_server(hostname, port, client_sock);
+        /* Start SSL connection with server; the client is answered and
+         * its handshake starts once it is done. */
+        server_sock = ssl_connect_server(hostname, port, client_sock, version);
         if (server_sock < 0) {
             LOG_ERROR("ssl_connect_server");
             return;
         }
-        LOG_INFO("established SSL connection with %s:%d", hostname, port);
-
-        reply_connection_established(client_sock, version);
-
-        /* Establish SSL connection with client. */
-        if (ssl_accept_client(client_sock, server_sock) < 0) {
-            LOG_ERROR("ssl_accept_client");
-            return;
-        }
-        LOG_INFO("established SSL connection with client (fd %d)", client_sock);
+        LOG_INFO("connecting SSL to %s:%d", hostname, port);
     }
     else {
         struct sock_buf* client_buf = NULL;
@@ -782,6 +2422,8 @@ void handle_connect_request(int client_sock,
         client_buf->is_forward = 1;
         server_buf->peer = client_sock;
         server_buf->is_forward = 1;
+        sock_buf_set_phase(client_sock, DEADLINE_PHASE_TUNNEL);
+        sock_buf_set_phase(server_sock, DEADLINE_PHASE_TUNNEL);
 
         /* Reply client with "Connection Established". */
         reply_connection_established(client_sock, version);
@@ -823,8 +2465,13 @@ void handle_other_request(int fd,
             LOG_ERROR("unknown socket %d", fd);
             return;
         }
+        server_buf->filter_body = 0;
+        sock_buf_set_phase(server_sock, DEADLINE_PHASE_FIRST_BYTE);
     }
     else {
+        if (!allow_server(fd, request, request_len, hostname, NULL)) {
+            return;
+        }
         server_sock = connect_server(hostname, port, fd, NULL);
         if (server_sock < 0) {
             /* Fail to connect the request server. */
@@ -834,10 +2481,10 @@ void handle_other_request(int fd,
 
     /* Forward request to server. */
     if (is_ssl) {
-        n = SSL_write(server_buf->ssl, request, request_len);
+        n = tls_write(server_buf->ssl, server_sock, request, request_len);
     }
     else {
-        n = write(server_sock, request, request_len);
+        n = netio_write(server_sock, request, request_len);
     }
     if (n < 0) {
         if (is_ssl) {
@@ -855,6 +2502,63 @@ void handle_other_request(int fd,
     }
 }
 
+/**
+ * @brief Run the request_head plugins on a request, and answer or close its
+ * client if one says so.
+ *
+ * @param fd FD for client socket.
+ * @param request Input and output; client request, replaced by one with the
+ * same body if a plugin replaces its head.
+ * @param request_len Input and output; byte size of request.
+ * @return int 1 if the request is done with; 0 to handle it.
+ */
+int run_request_plugins(int fd, char** request, int* request_len)
+{
+    struct plugin_view view;
+    struct plugin_view out;
+    int head_len = get_head_len(*request, *request_len);
+    int status;
+    char* replaced = NULL;
+    int replaced_len;
+
+    if (head_len <= 0) {
+        return 0;
+    }
+    view.data = *request;
+    view.len = head_len - 2;
+    switch (plugin_request_head(fd, view, &out)) {
+    case PLUGIN_REPLACE:
+        replaced_len = out.len + 2 + *request_len - head_len;
+        replaced = malloc(replaced_len + 1);
+        if (replaced == NULL) {
+            PLOG_FATAL("malloc");
+        }
+        memcpy(replaced, out.data, out.len);
+        memcpy(replaced + out.len, "\r\n", 2);
+        memcpy(replaced + out.len + 2,
+               *request + head_len,
+               *request_len - head_len);
+        replaced[replaced_len] = '\0';
+        free(*request);
+        *request = replaced;
+        *request_len = replaced_len;
+        return 0;
+    case PLUGIN_RESPOND:
+        LOG_INFO("plugin answers request");
+        status = get_status_code(out.data, out.len);
+        if (write_client(fd, out.data, out.len)) {
+            trace_response(fd, status > 0 ? status : 0, out.len);
+        }
+        return 1;
+    case PLUGIN_CLOSE:
+        LOG_INFO("plugin closes client (fd %d)", fd);
+        disconnect_client(fd);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 /**
  * @brief Handle client request if the request inf buffer is completed.
  * 
@@ -872,6 +2576,7 @@ void handle_client_request(int fd)
     char* hostname = NULL; /* Server hostname without port number. */
     int port = -1; /* Server port in client request. 80 by default. */
     int is_ssl = 0; /* Whether the client is using SSL connection. */
+    int handled = 0; /* Whether any request is handled. */
 
     sock_buf = sock_buf_get(fd);
     if (sock_buf == NULL) {
@@ -879,21 +2584,36 @@ void handle_client_request(int fd)
     }
     is_ssl = sock_buf_is_ssl(fd);
 
-    /* Extract the leading completed request. */
-    while (extract_first_request(&(sock_buf->buf),
+    /* Extract the leading completed request. Requests after a held body or
+     * a page being assembled wait until it is out. */
+    while (sock_buf->held == NULL &&
+           sock_buf->esi_page == NULL &&
+           extract_first_request(&(sock_buf->buf),
                                  &(sock_buf->size),
                                  &request,
                                  &request_len) > 0) {
 
-        fprintf(stderr, "================\n");
         LOG_INFO("client request:\n"
-                 "%s", request);
-        fprintf(stderr, "================\n");
+                 "================\n"
+                 "%s"
+                 "================", request);
 
         /* Parse request. */
         parse_request_head(request, &method, &url, &version, &host);
         port = -1;
         parse_host_field(host, &hostname, &port);
+        if (method == NULL || url == NULL || version == NULL ||
+            hostname == NULL) {
+            LOG_ERROR("malformed request or no Host field");
+            free(method);
+            free(url);
+            free(version);
+            free(host);
+            free(hostname);
+            free(request);
+            disconnect_client(fd);
+            return;
+        }
         LOG_INFO("parsed request:\n"
                  "- method: %s\n"
                  "- url: %s\n"
@@ -905,9 +2625,16 @@ void handle_client_request(int fd)
                  version,
                  host,
                  hostname);
+        sock_buf->request_us = netio_now_us();
+        TRACE4(request_parsed, fd, method, url, request_len);
+        access_log_begin(fd, method, hostname, url, sock_buf->request_us);
 
-        if (strcmp(method, "GET") == 0) {
-            LOG_INFO("handle GET method");
+        if (PLUGIN_HOOKED(PLUGIN_REQUEST_HEAD) &&
+            run_request_plugins(fd, &request, &request_len)) {
+            /* A plugin answered the request, or closed the client. */
+        }
+        else if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+            LOG_INFO("handle %s method", method);
 
             if (port < 0) {
                 if (is_ssl) {
@@ -919,7 +2646,13 @@ void handle_client_request(int fd)
             }
             LOG_INFO("port: %d", port);
 
-            handle_get_request(fd, request, request_len, url, hostname, port);
+            handle_get_request(fd,
+                               request,
+                               request_len,
+                               url,
+                               hostname,
+                               port,
+                               strcmp(method, "HEAD") == 0);
         }
         else if (strcmp(method, "CONNECT") == 0) {
             LOG_INFO("handle CONNECT method");
@@ -959,6 +2692,19 @@ void handle_client_request(int fd)
         hostname = NULL;
         free(request);
         request = NULL;
+
+        /* The handler disconnects the client if it fails to write. */
+        if (sock_buf_get(fd) != sock_buf) {
+            return;
+        }
+        handled = 1;
+    }
+
+    /* The next request head is due from its first byte. */
+    if (handled && !sock_buf->is_forward) {
+        sock_buf_set_phase(fd,
+                           sock_buf->size > 0 ? DEADLINE_PHASE_HEAD :
+                           DEADLINE_PHASE_IDLE);
     }
 }
 
@@ -975,6 +2721,8 @@ void handle_server_response(int fd)
     int max_age = 3600;
     struct sock_buf* server_buf = NULL;
     int is_ssl = 0;
+    int status;
+    int page_client = -1; /* Client of the page of a shell or fragment. */
 
     server_buf = sock_buf_get(fd);
     if (server_buf == NULL) {
@@ -994,37 +2742,125 @@ void handle_server_response(int fd)
         return;
     }
 
-    /* Parse response. */
-    int status_code = -1;
-    char* version = NULL;
-    char* phrase = NULL;
-    parse_status_line(response,
-                      &version,
-                      &status_code,
-                      &phrase);
-    free(version);
-    version = NULL;
-    free(phrase);
-    phrase = NULL;
+    /* Bytes of the next response went to the client as they came. */
+    server_buf->head_forwarded = server_buf->size > 0;
+    filter_free(server_buf->filter);
+    server_buf->filter = NULL;
+
+    /* A 5xx response counts against the breaker of the server. A shell and
+     * a fragment are traced as part of their page. */
+    status = get_status_code(response, response_len);
+    if (server_buf->esi != ESI_FRAGMENT && server_buf->esi != ESI_SHELL) {
+        trace_response(server_buf->peer,
+                       status > 0 ? status : 0,
+                       response_len);
+    }
+    upstream_report(server_buf->host,
+                    status > 0 && status < 500,
+                    netio_now());
+
+    /* Remember the preload links of a page for its next miss. */
+    if (use_hints && status == 200 && server_buf->key != NULL) {
+        hints_learn(server_buf->key,
+                    response,
+                    get_head_len(response, response_len));
+    }
 
     /* Cache response whose status is 200 OK. */
-    if (status_code == 200 &&
-        cache_put(server_buf->key, response, response_len, max_age) == 0) {
-        LOG_ERROR("fail to cache server response");
+    if (status == 200 && server_buf->key != NULL) {
+        char* stored = response;
+        int stored_len = response_len;
+
+        if (use_compression) {
+            compress_response(response, response_len, &stored, &stored_len);
+        }
+        if (cache_put_host(server_buf->host,
+                           server_buf->key,
+                           stored,
+                           stored_len,
+                           max_age) == 0) {
+            LOG_ERROR("fail to cache server response");
+        }
+        if (stored != response) {
+            free(stored);
+        }
+    }
+
+    /* A shell and its fragments are cached as they are, and the page is
+     * assembled for the client. */
+    if (server_buf->esi == ESI_SHELL) {
+        server_buf->esi = ESI_NONE;
+        page_client = server_buf->peer;
+        assemble_page(server_buf->peer,
+                      response,
+                      response_len,
+                      server_buf->base_url);
+    }
+    else if (server_buf->esi == ESI_FRAGMENT) {
+        server_buf->esi = ESI_NONE;
+        page_client = server_buf->peer;
+        fill_fragment(server_buf->peer,
+                      server_buf->esi_part,
+                      response,
+                      response_len);
     }
 
     /* Disconnect server. */
     if (!is_ssl) {
         disconnect_server(fd);
     }
+    else {
+        sock_buf_set_phase(fd, DEADLINE_PHASE_IDLE);
+    }
 
     free(response);
     response = NULL;
+
+    /* Requests that waited for the page go on once it is out. */
+    if (page_client >= 0) {
+        resume_requests(page_client);
+    }
+}
+
+/**
+ * @brief Forward body bytes of a server response to its client, through the
+ * filters of the response if it has any. The client, and with it the server,
+ * is disconnected on failure.
+ *
+ * @param server_buf Socket buffer of the server.
+ * @param buf Body bytes.
+ * @param n Byte size of buf; 0 only to check the end of a filtered body.
+ */
+void forward_body(struct sock_buf* server_buf, const char* buf, int n)
+{
+    int peer = server_buf->peer;
+
+    if (server_buf->filter != NULL) {
+        /* Each window of filtered bytes is written before the filters take
+         * more, so a slow client holds back the server. */
+        if (filter_push(server_buf->filter,
+                        buf,
+                        n,
+                        send_body,
+                        (void*)(intptr_t)peer) < 0) {
+            LOG_ERROR("fail to filter response to client (fd %d)", peer);
+            disconnect_client(peer);
+        }
+        return;
+    }
+    if (n > 0 && send_body((void*)(intptr_t)peer, buf, n) < 0) {
+        disconnect_client(peer);
+    }
 }
 
 /**
  * @brief Fast forward partial server response to its client.
  *
+ * With response plugins or filters, the response is held until its head is
+ * complete, which goes out as the filters and plugins leave it, and the body
+ * bytes go out as they come after the filters and plugins see them. The shell
+ * of a page, and a fragment, are held until they are complete.
+ *
  * @param server_sock FD for server socket.
  * @param buf Response buffer.
  * @param n Response byte size.
@@ -1032,67 +2868,88 @@ void handle_server_response(int fd)
 void fast_forward(int server_sock, const char* buf, int n)
 {
     struct sock_buf* server_buf = NULL;
-    int is_ssl = 0; /* Whether this socket is one end of a SSL connection. */
+    struct plugin_view out;
+    char* head = NULL; /* Head of the filtered response. */
+    int new_head_len;
+    int head_len;
+    int status;
+    int ok;
 
-    is_ssl = sock_buf_is_ssl(server_sock);
     server_buf = sock_buf_get(server_sock);
     if (server_buf == NULL) {
         LOG_ERROR("unknown socket %d", server_sock);
         return;
     }
-
-    if (is_ssl) {
-        struct sock_buf* client_buf = NULL;
-
-        client_buf = sock_buf_get(server_buf->peer);
-        if (client_buf == NULL) {
-            LOG_ERROR("unknown socket %d", client_buf);
-            return;
-        }
-        if (!sock_buf_is_ssl(server_buf->peer)) {
-            LOG_ERROR("client is not in SSL connection");
-            return;
-        }
-        n = SSL_write(client_buf->ssl, buf, n);
+    if (!PLUGIN_HOOKED(PLUGIN_RESPONSE_HEAD) &&
+        !PLUGIN_HOOKED(PLUGIN_BODY_CHUNK) &&
+        !server_buf->filter_body &&
+        server_buf->esi == ESI_NONE) {
+        write_client(server_buf->peer, buf, n);
+        return;
     }
-    else {
-        n = write(server_buf->peer, buf, n);
+
+    /* Body bytes of a response whose head went out. */
+    if (server_buf->head_forwarded) {
+        forward_body(server_buf, buf, n);
+        return;
     }
-    if (n < 0) {
-        if (is_ssl) {
-            LOG_ERROR("SSL_write");
-            ERR_print_errors_fp(stderr);
-        }
-        else {
-            PLOG_ERROR("write");
-        }
-        disconnect_client(server_buf->peer);
+    if (server_buf->esi == ESI_SHELL || server_buf->esi == ESI_FRAGMENT) {
+        return;
     }
-    else if (n == 0) {
-        LOG_ERROR("client socket is closed on the other side");
-        disconnect_client(server_buf->peer);
+
+    /* Hold the response until its head is complete. */
+    head_len = get_head_len(server_buf->buf, server_buf->size);
+    if (head_len <= 0) {
+        return;
     }
-    else {
-        #if 0
-        LOG_INFO("forward %d bytes from server (fd %d) to client (fd %d)",
-                    n,
-                    server_sock,
-                    server_buf->peer);
-        #endif
+    if (server_buf->esi == ESI_MAYBE) {
+        if (esi_is_shell(server_buf->buf, head_len)) {
+            server_buf->esi = ESI_SHELL;
+            return;
+        }
+        server_buf->esi = ESI_NONE;
+    }
+    server_buf->head_forwarded = 1;
+    out.data = server_buf->buf;
+    out.len = head_len - 2;
+    if (server_buf->filter_body &&
+        filter_open(server_buf->buf,
+                    head_len,
+                    server_buf->accepts_gzip,
+                    &server_buf->filter,
+                    &head,
+                    &new_head_len) == 1) {
+        out.data = head;
+        out.len = new_head_len;
+    }
+
+    /* The head goes out before the next stage reuses the arena. The client,
+     * and with it the server, is disconnected if a plugin closes it or a
+     * write fails. */
+    status = get_status_code(server_buf->buf, head_len);
+    ok = write_head(server_buf->peer, status > 0 ? status : 0, out.data,
+                    out.len);
+    free(head);
+    if (ok && (server_buf->size > head_len || server_buf->filter != NULL)) {
+        forward_body(server_buf,
+                     server_buf->buf + head_len,
+                     server_buf->size - head_len);
     }
-
 }
 
 /**
  * @brief Handle incoming message from a client/server.
  * 
  * @param fd FD for a client/server socket.
+ * @return int Byte size received; 0 if none, e.g. a handshake step, or if the
+ * socket was closed.
  */
-void handle_msg(int fd)
+int handle_msg(int fd)
 {
     struct sock_buf* sock_buf = NULL; /* Socket buffer. */
     char buf[BUF_SIZE]; /* Message buffer. */
     int n; /* Byte size actually received or sent. */
+    int received; /* Byte size received, once n is sent. */
     int is_client = 0; /* Whether this socket is for a client. */
     int is_ssl = 0; /* Whether this socket is one end of a SSL connection. */
     int is_forward = 0; /* Whether simply forward data to its peer. */
@@ -1100,19 +2957,46 @@ void handle_msg(int fd)
     sock_buf = sock_buf_get(fd);
     if (sock_buf == NULL) {
         LOG_ERROR("unknown socket %d", fd);
-        return;
+        return 0;
     }
     is_client = sock_buf_is_client(fd);
     is_forward = sock_buf_is_forward(fd);
     is_ssl = sock_buf_is_ssl(fd);
 
+    /* Step a handshake with the input. */
+    if (is_ssl && !SSL_is_init_finished(sock_buf->ssl)) {
+        n = tls_fill(sock_buf->ssl, fd);
+        if (n <= 0) {
+            if (n < 0) {
+                PLOG_ERROR("read");
+            }
+            if (is_client) {
+                disconnect_client(fd);
+            }
+            else {
+                disconnect_server(fd);
+            }
+        }
+        else if (is_client) {
+            continue_accept(fd);
+        }
+        else {
+            continue_connect(fd);
+        }
+        return 0;
+    }
+
     /* Receive message. */
     bzero(buf, BUF_SIZE);
     if (is_ssl) {
-        n = SSL_read(sock_buf->ssl, buf, BUF_SIZE);
+        n = tls_read(sock_buf->ssl, fd, buf, BUF_SIZE);
+        if (n == TLS_WANT_READ) {
+            /* A partial record, or one without data. */
+            return 0;
+        }
     }
     else {
-        n = read(fd, buf, BUF_SIZE);
+        n = netio_read(fd, buf, BUF_SIZE);
     }
     if (n < 0) {
         if (is_ssl) {
@@ -1124,11 +3008,11 @@ void handle_msg(int fd)
         }
         if (is_client) {
             disconnect_client(fd);
-            return;
+            return 0;
         }
         else {
             disconnect_server(fd);
-            return;
+            return 0;
         }
     }
     else if (n == 0) {
@@ -1136,12 +3020,12 @@ void handle_msg(int fd)
         if (is_client) {
             LOG_INFO("client socket is closed on the other side");
             disconnect_client(fd);
-            return;
+            return 0;
         }
         else {
             LOG_INFO("server socket is closed on the other side");
             disconnect_server(fd);
-            return;
+            return 0;
         }
     }
     #if 0
@@ -1153,8 +3037,16 @@ void handle_msg(int fd)
     }
     #endif
 
-    /* Update the last input time of the socket. */
-    sock_buf_update_input_time(fd);
+    /* Time the first byte of a response, which wins a hedged request. */
+    if (!is_client && sock_buf->sent_us > 0) {
+        take_first_byte(fd);
+    }
+    if (!is_client && !is_forward && access_log_is_open()) {
+        access_log_first_byte(sock_buf->peer, netio_now_us());
+    }
+
+    /* Update the last input time and phase of the socket. */
+    sock_buf_update_input(fd, n);
 
     /* Forward encrypted messages originated from a CONNECT method. */
     if (is_forward) {
@@ -1163,7 +3055,8 @@ void handle_msg(int fd)
                 fd,
                 sock_buf->peer);
         #endif
-        n = write(sock_buf->peer, buf, n);
+        received = n;
+        n = netio_write(sock_buf->peer, buf, n);
         if (n < 0) {
             PLOG_ERROR("write");
             if (is_client) {
@@ -1181,13 +3074,16 @@ void handle_msg(int fd)
                 disconnect_client(sock_buf->peer);
             }
         }
-        return;
+        if (n > 0) {
+            sock_buf_touch(sock_buf->peer);
+        }
+        return received;
     }
 
     /* Write received message into socket buffer. */
     if (sock_buf_buffer(fd, buf, n) < 0) {
         PLOG_ERROR("sock_buf_input");
-        return;
+        return n;
     }
 
     /* Parse socket buffer. */
@@ -1201,25 +3097,633 @@ void handle_msg(int fd)
         /* Handle server response in its buffer. */
         handle_server_response(fd);
     }
+    return n;
 }
 
-int main(int argc, char** argv)
+/**
+ * @brief Resize the cache budget from the latest memory pressure, and evict a
+ * bounded batch while the cache exceeds its budget.
+ *
+ * @param now Current time in seconds.
+ * @param next_check Input and output; time of the next pressure check.
+ */
+void check_mem_pressure(time_t now, time_t* next_check)
+{
+    struct mem_pressure pressure;
+    size_t budget;
+
+    if (now >= *next_check) {
+        *next_check = now + MEM_CHECK_INTERVAL;
+        if (mem_pressure_read(cgroup_dir, &pressure) == 0) {
+            budget = mem_pressure_next_budget(&mem_config,
+                                              &pressure,
+                                              cache_budget);
+            if (budget != cache_budget) {
+                LOG_INFO("memory pressure %.2f%%, %ld/%ld bytes; "
+                         "cache budget %zu -> %zu bytes",
+                         pressure.some_avg10,
+                         pressure.current,
+                         pressure.limit,
+                         cache_budget,
+                         budget);
+                cache_shrinking = budget < cache_budget;
+                cache_budget = budget;
+                cache_set_budget(budget);
+            }
+        }
+    }
+    if (cache_shrinking) {
+        cache_shrinking = cache_shrink(SHRINK_BATCH);
+    }
+}
+
+/**
+ * @brief Close a socket past its deadline. The client of a server is closed
+ * too, as its response can no longer come complete, unless another attempt
+ * of a hedged request is still alive.
+ *
+ * @param fd FD for a client/server socket.
+ * @param reason enum deadline_reason.
+ */
+void close_expired(int fd, int reason)
+{
+    struct sock_buf* sock_buf = NULL;
+    int client;
+    int is_hedged;
+
+    sock_buf = sock_buf_get(fd);
+    if (sock_buf == NULL) {
+        return;
+    }
+    LOG_INFO("close %s (fd: %d) past its %s deadline",
+             sock_buf->is_client ? "client" : "server",
+             fd,
+             deadline_reason_name(reason));
+    if (sock_buf->is_client) {
+        disconnect_client(fd);
+    }
+    else {
+        client = sock_buf->peer;
+        is_hedged = sock_buf->hedge_peer >= 0;
+        if (reason == DEADLINE_REASON_FIRST_BYTE) {
+            /* A server that never answers counts against its breaker. */
+            upstream_report(sock_buf->host, 0, netio_now());
+        }
+        disconnect_server(fd);
+        /* The other attempt of a hedged request may still answer. */
+        if (!is_hedged) {
+            disconnect_client(client);
+        }
+    }
+}
+
+/**
+ * @brief Signal handler of the parent of the workers that passes the signal
+ * on to each worker.
+ *
+ * @param sig Signal number.
+ */
+void workers_handler(int sig)
+{
+    for (int i = 0; i < num_workers; ++i) {
+        kill(worker_pids[i], sig);
+    }
+}
+
+/**
+ * @brief Pin this process to a CPU, so its memory comes from the local node.
+ *
+ * @param cpu CPU index.
+ */
+void pin_cpu(int cpu)
+{
+    if (affinity_pin(cpu) < 0) {
+        LOG_FATAL("cannot pin to CPU %d", cpu);
+    }
+    LOG_INFO("pinned to CPU %d on node %d", cpu, affinity_cpu_node(cpu));
+}
+
+/**
+ * @brief Fork the worker processes. Each takes its own socket of a
+ * SO_REUSEPORT group listening on the port, so connections are steered to the
+ * worker on the CPU that received them, and its own share of the cache arena,
+ * and worker i is pinned to CPU i modulo the number of CPUs if asked. It
+ * returns in each worker; the parent passes SIGINT and SIGUSR1 on to the
+ * workers and exits once they have all exited.
+ */
+void start_workers(void)
+{
+    int socks[MAX_WORKERS];
+    int num_cpus = affinity_num_cpus();
+    int status;
+    pid_t pid;
+
+    if (affinity_listen_group(listen_port,
+                              LISTEN_BACKLOG,
+                              socks,
+                              num_workers) < 0) {
+        PLOG_FATAL("listen");
+    }
+
+    /* Workers share the arena size, as they cache apart. */
+    cache_arena_mb /= num_workers;
+    if (cache_arena_mb < MIN_CACHE_BUDGET_MB) {
+        cache_arena_mb = MIN_CACHE_BUDGET_MB;
+    }
+
+    for (int i = 0; i < num_workers; ++i) {
+        pid = fork();
+        if (pid < 0) {
+            PLOG_FATAL("fork");
+        }
+        if (pid == 0) {
+            for (int j = 0; j < num_workers; ++j) {
+                if (j != i) {
+                    close(socks[j]);
+                }
+            }
+            worker_sock = socks[i];
+            worker_index = i;
+            if (pin_workers) {
+                pin_cpu(i % num_cpus);
+            }
+            return;
+        }
+        worker_pids[i] = pid;
+    }
+    for (int i = 0; i < num_workers; ++i) {
+        close(socks[i]);
+    }
+    LOG_INFO("started %d workers on port %d", num_workers, listen_port);
+
+    signal(SIGINT, workers_handler);
+    signal(SIGUSR1, workers_handler);
+    for (;;) {
+        pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        LOG_INFO("worker (pid %d) exited with status %d",
+                 (int)pid,
+                 WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    }
+    LOG_INFO("shut down");
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Print usage and exit on failure.
+ *
+ * @param prog Program name.
+ */
+void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-m <cache_mb>] [-H] [-e lru|clock] [-q <host_mb>] "
+            "[-Q <host>=<mb>]... [-M <limit_mb>] [-P <psi_pct>] "
+            "[-C <cgroup_dir>] [-z] [-T <deadline>=<sec>]... "
+            "[-h <hedge_ms>] [-b <budget_pct>] [-B <failures>] "
+            "[-S <stale_sec>] [-w <workers>] [-A] [-U <busy_poll_us>] "
+            "[-k <key_threads>] [-E <early_bytes>] [-L <access_log>] "
+            "[-R <rotate_mb>] [-Z] [-x <plugin>[=<arg>]]... "
+            "[-t <filter>]... [-I] [-N] [-F <round_kb>] <port> "
+            "[<cert_file> <key_file> "
+            "[<cert_file> <key_file>]]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parse command line options and arguments into the proxy settings.
+ * Settings not given are reset to their defaults, so it can be called once per
+ * run of a simulation.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments, starting with the program name.
+ */
+void parse_args(int argc, char** argv)
 {
+    int opt;
+
+    cache_arena_mb = CACHE_ARENA_MB;
+    cache_huge_pages = 0;
+    cache_policy = CACHE_POLICY_LRU;
+    cache_host_quota = 0;
+    num_host_quotas = 0;
+    mem_config.limit = 0;
+    mem_config.psi_threshold = MEM_PRESSURE_PSI_THRESHOLD;
+    cgroup_dir = NULL;
+    use_compression = 0;
+    deadline_init_config(&deadline_config);
+    upstream_config.budget_ratio = UPSTREAM_BUDGET_RATIO;
+    upstream_config.hedge_min_us = 0;
+    upstream_config.breaker_failures = UPSTREAM_FAILURES;
+    upstream_config.breaker_open = UPSTREAM_OPEN_TIME;
+    stale_grace = STALE_GRACE;
+    num_workers = 0;
+    pin_workers = 0;
+    busy_poll_us = 0;
+    key_threads = 0;
+    max_early_data = 0;
+    access_log_path = NULL;
+    access_log_rotate_mb = ACCESS_LOG_ROTATE_MB;
+    access_log_deflate = 0;
+    num_plugin_specs = 0;
+    num_filter_specs = 0;
+    use_esi = 0;
+    use_hints = 0;
+    fairq_round_kb = FAIRQ_ROUND_KB;
+    worker_sock = -1;
+    worker_index = -1;
+    use_ssl = 0;
+    optind = 1;
+
+    /* Parse cmd line options. */
+    while ((opt = getopt(argc,
+                         argv,
+                         "m:He:q:Q:M:P:C:zT:h:b:B:S:w:AU:k:E:L:R:Zx:t:INF:"))
+           != -1) {
+        switch (opt) {
+        case 'm':
+            cache_arena_mb = atol(optarg);
+            if (cache_arena_mb <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'H':
+            cache_huge_pages = 1;
+            break;
+        case 'e':
+            if (strcmp(optarg, "lru") == 0) {
+                cache_policy = CACHE_POLICY_LRU;
+            }
+            else if (strcmp(optarg, "clock") == 0) {
+                cache_policy = CACHE_POLICY_CLOCK;
+            }
+            else {
+                usage(argv[0]);
+            }
+            break;
+        case 'q':
+            cache_host_quota = atol(optarg) * 1024 * 1024;
+            if (cache_host_quota < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'Q':
+            if (num_host_quotas == MAX_HOST_QUOTAS ||
+                strchr(optarg, '=') == NULL ||
+                atol(strchr(optarg, '=') + 1) < 0) {
+                usage(argv[0]);
+            }
+            host_quotas[num_host_quotas++] = optarg;
+            break;
+        case 'M':
+            mem_config.limit = atol(optarg) * 1024 * 1024;
+            if (mem_config.limit < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'P':
+            mem_config.psi_threshold = atof(optarg);
+            if (mem_config.psi_threshold <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'C':
+            cgroup_dir = optarg;
+            break;
+        case 'z':
+            use_compression = 1;
+            break;
+        case 'T':
+            if (deadline_parse_option(&deadline_config, optarg) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'h':
+            upstream_config.hedge_min_us = atol(optarg) * 1000;
+            if (upstream_config.hedge_min_us <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'b':
+            upstream_config.budget_ratio = atof(optarg) / 100;
+            if (upstream_config.budget_ratio < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'B':
+            upstream_config.breaker_failures = atoi(optarg);
+            if (upstream_config.breaker_failures < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            stale_grace = atol(optarg);
+            if (stale_grace < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            num_workers = atoi(optarg);
+            if (num_workers < 0 || num_workers > MAX_WORKERS) {
+                usage(argv[0]);
+            }
+            break;
+        case 'A':
+            pin_workers = 1;
+            break;
+        case 'U':
+            busy_poll_us = atoi(optarg);
+            if (busy_poll_us <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            key_threads = atoi(optarg);
+            if (key_threads <= 0 || key_threads > KEY_POOL_MAX_THREADS) {
+                usage(argv[0]);
+            }
+            break;
+        case 'E':
+            max_early_data = atol(optarg);
+            if (max_early_data <= 0 || max_early_data > UINT32_MAX) {
+                usage(argv[0]);
+            }
+            break;
+        case 'L':
+            access_log_path = optarg;
+            break;
+        case 'R':
+            access_log_rotate_mb = atol(optarg);
+            if (access_log_rotate_mb <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'Z':
+            access_log_deflate = 1;
+            break;
+        case 'x':
+            if (num_plugin_specs == PLUGIN_MAX) {
+                usage(argv[0]);
+            }
+            plugin_specs[num_plugin_specs++] = optarg;
+            break;
+        case 't':
+            if (num_filter_specs == FILTER_MAX) {
+                usage(argv[0]);
+            }
+            filter_specs[num_filter_specs++] = optarg;
+            break;
+        case 'I':
+            use_esi = 1;
+            break;
+        case 'N':
+            use_hints = 1;
+            break;
+        case 'F':
+            fairq_round_kb = atol(optarg);
+            if (fairq_round_kb < 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
     /* Parse cmd line args. */
-    if (argc != 2 && argc != 4) {
-        fprintf(stderr, "usage: %s <port> [<cert_file> <key_file>]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    if (argc - optind < 1 || argc - optind > 1 + 2 * MAX_CERTS ||
+        (argc - optind) % 2 == 0) {
+        usage(argv[0]);
     }
-    listen_port = atoi(argv[1]);
-    if (argc == 4) {
+    listen_port = atoi(argv[optind]);
+    num_certs = (argc - optind - 1) / 2;
+    for (int i = 0; i < num_certs; ++i) {
+        cert_files[i] = argv[optind + 1 + 2 * i];
+        key_files[i] = argv[optind + 2 + 2 * i];
+    }
+    if (num_certs > 0) {
         use_ssl = 1; /* Raise flag for SSL interception. */
-        CERT_FILE = argv[2];
-        KEY_FILE = argv[3];
         LOG_INFO("run in SSL interception mode");
     }
     else {
         LOG_INFO("run in default mode");
     }
+}
+
+/**
+ * @brief Whether a socket holds input in its SSL, read from the socket before
+ * but not handled yet, which select() no longer reports.
+ *
+ * @param fd FD for socket.
+ * @return int 1 if it holds input; 0 otherwise.
+ */
+int has_ssl_input(int fd)
+{
+    struct sock_buf* sock_buf = sock_buf_get(fd);
+
+    return sock_buf != NULL &&
+           sock_buf->ssl != NULL &&
+           SSL_is_init_finished(sock_buf->ssl) &&
+           tls_has_input(sock_buf->ssl);
+}
+
+/**
+ * @brief Queue a socket in the round of the scheduler, under the client it
+ * serves. A client with a held body, or a socket whose phase has received more
+ * than FAIRQ_BULK_BYTES, e.g. a large response, is bulk.
+ *
+ * @param fd FD for socket, which is readable or holds a body.
+ */
+void queue_ready(int fd)
+{
+    struct sock_buf* sock_buf = sock_buf_get(fd);
+    int flow = fd;
+
+    if (async_client[fd] >= 0) {
+        flow = async_client[fd];
+    }
+    else if (sock_buf != NULL && !sock_buf->is_client &&
+             sock_buf_get(sock_buf->peer) != NULL) {
+        flow = sock_buf->peer;
+    }
+    fairq_add(fd, flow,
+              sock_buf != NULL &&
+              (sock_buf->held != NULL ||
+               sock_buf->phase_bytes > FAIRQ_BULK_BYTES));
+}
+
+/**
+ * @brief Run one iteration of the main loop: wait for input, then handle each
+ * readable socket and close idle ones.
+ */
+void poll_proxy(void)
+{
+    struct timeval timeout;
+    fd_set ssl_fd_set; /* Sockets with input in their SSLs. */
+    fd_set held_fd_set; /* Clients with held bodies. */
+    int num_ssl_input = 0;
+    int num_held = 0;
+    struct sock_buf* sock_buf;
+    int fd;
+    int n;
+    int reason;
+    long now_us;
+    long next_hedge;
+    time_t polled_at;
+
+    /* Find sockets with input left in their SSLs, e.g. a request that came
+     * in one read with the end of a handshake. */
+    FD_ZERO(&ssl_fd_set);
+    if (use_ssl) {
+        for (fd = 0; fd <= max_fd; ++fd) {
+            if (FD_ISSET(fd, &active_fd_set) && has_ssl_input(fd)) {
+                FD_SET(fd, &ssl_fd_set);
+                num_ssl_input++;
+            }
+        }
+    }
+
+    /* Find clients with bodies held for them, which are due a quantum this
+     * round whether they are readable or not. */
+    FD_ZERO(&held_fd_set);
+    for (fd = 0; fairq_round_kb > 0 && fd <= max_fd; ++fd) {
+        sock_buf = sock_buf_get(fd);
+        if (sock_buf != NULL && sock_buf->held != NULL) {
+            FD_SET(fd, &held_fd_set);
+            num_held++;
+        }
+    }
+
+    /* Block until input arrives on one or more active sockets. */
+    read_fd_set = active_fd_set;
+    /* Wake up for memory pressure checks, and poll while shrinking. */
+    timeout.tv_sec = cache_shrinking ? 0 : MEM_CHECK_INTERVAL;
+    timeout.tv_usec = 0;
+    if (upstream_config.hedge_min_us > 0) {
+        /* Hedge requests that are due, and wake up for the next one. */
+        now_us = netio_now_us();
+        next_hedge = fire_hedges(now_us);
+        if (next_hedge > 0 &&
+            next_hedge - now_us < timeout.tv_sec * 1000000L) {
+            timeout.tv_sec = (next_hedge - now_us) / 1000000;
+            timeout.tv_usec = (next_hedge - now_us) % 1000000;
+        }
+    }
+    if (num_ssl_input > 0 || num_held > 0) {
+        /* Input or output is ready already; only look for more. */
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+    }
+    if (netio_select(max_fd + 1, &read_fd_set, &timeout) < 0) {
+        if (errno != EINTR) {
+            PLOG_FATAL("select");
+        }
+        FD_ZERO(&read_fd_set);
+    }
+    for (fd = 0; num_ssl_input > 0 && fd <= max_fd; ++fd) {
+        if (FD_ISSET(fd, &ssl_fd_set)) {
+            FD_SET(fd, &read_fd_set);
+        }
+    }
+    polled_at = netio_now();
+    if (dump_stats) {
+        dump_stats = 0;
+        cache_log_stats();
+        compress_log_stats();
+        deadline_log_stats();
+        upstream_log_stats();
+        if (key_threads > 0) {
+            key_pool_log_stats();
+        }
+        if (use_ssl) {
+            tls_log_stats();
+        }
+        if (access_log_is_open()) {
+            access_log_log_stats();
+        }
+        if (num_plugin_specs > 0) {
+            plugin_log_stats();
+        }
+        if (filter_count() > 0) {
+            filter_log_stats();
+        }
+        if (use_esi) {
+            esi_log_stats();
+        }
+        if (use_hints) {
+            hints_log_stats();
+        }
+        fairq_log_stats();
+    }
+    if (access_log_is_open()) {
+        access_log_tick(netio_now_us());
+    }
+    check_mem_pressure(netio_now(), &next_mem_check);
+
+    /* Serve readable sockets in the fair order of their clients, one read
+     * each. Bulk sockets past the budget of the round stay readable, so the
+     * next poll returns at once with them and any new requests. */
+    for (fd = 0; fd <= max_fd; ++fd) {
+        if (FD_ISSET(fd, &read_fd_set) || FD_ISSET(fd, &held_fd_set)) {
+            queue_ready(fd);
+        }
+    }
+    while ((fd = fairq_next()) >= 0) {
+        /* Send a quantum of a held body; a client closed earlier in the round
+         * holds none. */
+        if (!FD_ISSET(fd, &read_fd_set)) {
+            fairq_charge(send_held(fd));
+            continue;
+        }
+        /* Accept new client. */
+        if (fd == listen_sock) {
+            accept_client();
+        }
+        /* Resume the handshake whose private key operation is done. */
+        else if (async_client[fd] >= 0) {
+            int client_sock = async_client[fd];
+
+            stop_async_wait(client_sock);
+            continue_accept(client_sock);
+        }
+        /* Handle arriving data from a connected socket, and send a quantum of
+         * the body it holds. */
+        else {
+            n = handle_msg(fd);
+            if (FD_ISSET(fd, &held_fd_set)) {
+                n += send_held(fd);
+            }
+            fairq_charge(n);
+        }
+    }
+
+    /* Close sockets past their deadline, earliest first. Deadlines count to
+     * the time of the poll, so a handler that blocked, e.g. on a connect,
+     * does not expire peers whose input arrived meanwhile; the next poll
+     * reads it first. */
+    while ((fd = deadline_expire(polled_at, &reason)) >= 0) {
+        close_expired(fd, reason);
+    }
+}
+
+#ifndef PROXY_NO_MAIN
+int main(int argc, char** argv)
+{
+    parse_args(argc, argv);
+
+    /* Workers return here; a single process pins to the CPU it is on. */
+    if (num_workers > 0) {
+        start_workers();
+    }
+    else if (pin_workers) {
+        pin_cpu(affinity_current_cpu());
+    }
 
     init_proxy();
 
@@ -1229,34 +3733,12 @@ int main(int argc, char** argv)
     /* Ignore SIGPIPE. */
     signal(SIGPIPE, PIPE_hander);
 
+    /* Print statistics by SIGUSR1. */
+    signal(SIGUSR1, USR1_handler);
+
     /* Main loop. */
     while(true) {
-        /* Block until input arrives on one or more active sockets. */
-        read_fd_set = active_fd_set;
-        if (select(max_fd + 1, &read_fd_set, NULL, NULL, NULL) < 0) {
-            PLOG_FATAL("select");
-        }
-        for (int fd = 0; fd <= max_fd; ++fd) {
-            if (FD_ISSET(fd, &read_fd_set)) {
-                /* Accept new client. */
-                if (fd == listen_sock) {
-                    accept_client();
-                }
-                /* Handle arriving data from a connected socket. */
-                else {
-                    handle_msg(fd);
-                }
-            }
-            /*remove timeout socket*/
-            if (sock_buf_is_timeout(fd)) {
-                if (sock_buf_is_client(fd)) {
-                    disconnect_client(fd);
-                }
-                else {
-                    disconnect_server(fd);
-                }
-            }
-        }
+        poll_proxy();
     }
 
     clear_proxy();
@@ -1264,3 +3746,4 @@ int main(int argc, char** argv)
 
     return EXIT_SUCCESS;
 }
+#endif /* PROXY_NO_MAIN */
@@ -0,0 +1,45 @@
+/**************************************************************
+*
+*                           proxy.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Interface for driving the proxy's event loop, for the
+*     simulator. proxy.c built with -DPROXY_NO_MAIN provides
+*     it without main().
+*
+**************************************************************/
+
+#ifndef PROXY_H
+#define PROXY_H
+
+/**
+ * @brief Parse command line options and arguments into the proxy settings.
+ * Settings not given are reset to their defaults, so it can be called once per
+ * run of a simulation.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments, starting with the program name.
+ */
+void parse_args(int argc, char** argv);
+
+/**
+ * @brief Initialize the proxy.
+ */
+void init_proxy(void);
+
+/**
+ * @brief Run one iteration of the main loop: wait for input, then handle each
+ * readable socket and close idle ones.
+ */
+void poll_proxy(void);
+
+/**
+ * @brief Free all the proxy resource.
+ */
+void clear_proxy(void);
+
+#endif /* PROXY_H */
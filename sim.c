@@ -0,0 +1,1404 @@
+/**************************************************************
+*
+*                            sim.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Implementation for the deterministic simulator of the
+*     proxy.
+*
+*     Each connection between the proxy and a simulated peer
+*     holds the bytes the peer sends, each with the virtual
+*     time it arrives, and the bytes the proxy writes. select()
+*     never sleeps: when no socket is readable, it jumps the
+*     clock to the next arrival, delivery, close or reset.
+*     Clients check every byte they receive against the
+*     response their origin generates for their URL, so cross
+*     talk between connections, e.g. through a reused FD, is
+*     caught as corruption.
+*
+**************************************************************/
+
+#define _GNU_SOURCE /* For memmem(). */
+
+#include "sim.h"
+#include "http_utils.h"
+#include "logger.h"
+#include "netio.h"
+#include "proxy.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+#define SIM_NEVER LONG_MAX /* Time of an event that never happens. */
+#define SIM_EPOCH 1600000000 /* Seconds since the epoch at virtual time 0. */
+#define SIM_USEC 1000000L /* Microseconds per second. */
+#define SIM_LISTEN_PORT "9999" /* Port the proxy listens on. */
+#define SIM_MAX_ARGS 64 /* Max number of arguments of the proxy. */
+#define SIM_IDLE_GRACE 700 /* Seconds to let the proxy close idle sockets
+                            * after all clients left; above its timeout. */
+#define SIM_MAX_BODY 12000 /* Max byte size of a generated body beyond 64. */
+#define SIM_MAX_AGE 30 /* Max max-age of a generated response. */
+#define SIM_MAX_PIECE 64 /* Max byte size of a piece sent by a slow peer. */
+#define SIM_SLOWLORIS_GAP 2 /* Seconds between bytes of a slowloris client. */
+#define SIM_SYN_TIMEOUT 127 /* Seconds the system tries to connect. */
+#define SIM_JITTER_MIN 100000 /* Min delay in microseconds of a late
+                               * response. */
+#define SIM_JITTER_MAX 1000000 /* Max delay in microseconds of a late
+                                * response. */
+
+/* Response of the proxy to CONNECT. */
+static const char established[] = "HTTP/1.1 200 Connection Established\r\n"
+                                  "\r\n";
+
+/* Status line of the proxy's response to a request that failed fast. */
+static const char unavailable[] = "HTTP/1.1 503 ";
+
+enum sim_state {
+    SIM_WAITING = 0, /* Client waits for its response. */
+    SIM_COMPLETED, /* Client received its complete response. */
+    SIM_TIMED_OUT, /* Client gave up waiting. */
+    SIM_CLOSED, /* Proxy closed the client first. */
+    SIM_RESET, /* Client reset its connection. */
+    SIM_REJECTED, /* Proxy failed the request fast. */
+};
+
+struct sim_delivery {
+    long at; /* Virtual time in microseconds the bytes arrive. */
+    int upto; /* Byte size of sent data that has arrived by then. */
+};
+
+struct sim_conn {
+    int fd; /* FD of the proxy's end; -1 if it is not accepted or closed. */
+    int is_client; /* 1 for a client; 0 for a socket to an origin. */
+    int is_tunnel; /* Whether it carries a CONNECT tunnel. */
+    int in_backlog; /* Whether the client waits to be accepted. */
+    int origin; /* Index of the origin; -1 if a socket is not connected. */
+    int url; /* Index of the URL a client requests. */
+    long id; /* Number of a client. */
+    long spawned_at; /* Time a client sent its request. */
+    char* in; /* Bytes sent by the peer to the proxy. */
+    int in_len; /* Byte size of in. */
+    int in_cap; /* Capacity of in. */
+    int in_ready; /* Byte size of in that has arrived. */
+    int in_read; /* Byte size of in the proxy has read. */
+    struct sim_delivery* deliveries; /* Arrival times of in, in order. */
+    int num_deliveries; /* Number of deliveries. */
+    int cap_deliveries; /* Capacity of deliveries. */
+    int next_delivery; /* Index of the first delivery yet to arrive. */
+    long fin_at; /* Time the peer closes the connection. */
+    long rst_at; /* Time the peer resets the connection. */
+    char* out; /* Bytes written by the proxy to the peer. */
+    int out_len; /* Byte size of out. */
+    int out_cap; /* Capacity of out. */
+    int state; /* enum sim_state of a client. */
+    long deadline; /* Time a waiting client gives up. */
+    int responded; /* Whether an origin responded, or a tunnel client sent
+                    * its data. */
+    int is_corrupt; /* Whether corruption is counted for it. */
+    int is_faulted; /* Whether a fault hit the path of a client, which
+                     * excuses a timeout. */
+    int index; /* Index in conns. */
+};
+
+static const struct sim_config* cfg; /* Configuration of the run. */
+static struct sim_result* res; /* Result of the run. */
+static int running = 0; /* Whether outcomes are counted. */
+static uint64_t rand_state; /* State of the random generator. */
+static long now_us; /* Virtual time in microseconds. */
+static struct sim_conn* fds[FD_SETSIZE]; /* Connection of each proxy FD. */
+static int listen_fd = -1; /* FD of the proxy's listening socket. */
+static struct sim_conn** conns = NULL; /* Live connections. */
+static int num_conns = 0; /* Number of live connections. */
+static int cap_conns = 0; /* Capacity of conns. */
+static struct sim_conn** backlog = NULL; /* Clients waiting to be accepted,
+                                          * in a ring. */
+static int backlog_head = 0; /* Index of the first client in backlog. */
+static int backlog_len = 0; /* Number of clients in backlog. */
+static long spawned = 0; /* Number of clients spawned. */
+static int waiting = 0; /* Number of clients waiting for responses. */
+static long next_arrival = 0; /* Time the next client arrives. */
+static char* body_buf = NULL; /* Scratch buffer of a generated body. */
+static long* latencies = NULL; /* Times in microseconds of complete
+                                * responses. */
+static struct sim_conn* reading_client = NULL; /* Client the proxy read from
+                                                * last, whose request it
+                                                * handles. */
+
+/**
+ * @brief Get the next random number of xorshift64*.
+ *
+ * @return uint64_t Random number.
+ */
+static uint64_t sim_rand(void)
+{
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 2685821657736338717ULL;
+}
+
+/**
+ * @brief Draw an event of the given probability.
+ *
+ * @param p Probability.
+ * @return int 1 if the event happens; 0 otherwise.
+ */
+static int sim_chance(double p)
+{
+    return p > 0 && (sim_rand() >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+/**
+ * @brief Draw a uniform number in [lo, hi].
+ *
+ * @param lo Smallest number.
+ * @param hi Largest number.
+ * @return long Random number.
+ */
+static long sim_uniform(long lo, long hi)
+{
+    return lo + (long)(sim_rand() % (uint64_t)(hi - lo + 1));
+}
+
+/**
+ * @brief Fold a call of the proxy into the digest of the run.
+ *
+ * @param op Operation, e.g. 'r' for read.
+ * @param fd FD of the call.
+ * @param ret Return value of the call.
+ */
+static void sim_trace(int op, int fd, long ret)
+{
+    uint64_t words[4] = {(uint64_t)op, (uint64_t)fd, (uint64_t)ret,
+                         (uint64_t)now_us};
+
+    for (int i = 0; i < 4; ++i) {
+        res->digest = (res->digest ^ words[i]) * 1099511628211ULL;
+    }
+}
+
+/**
+ * @brief Mix the index of an origin and a URL into a hash.
+ *
+ * @param origin Index of the origin.
+ * @param url Index of the URL.
+ * @return uint64_t Hash.
+ */
+static uint64_t url_hash(int origin, int url)
+{
+    uint64_t x = (uint64_t)origin << 32 | (uint32_t)url;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief Get the byte size of the body an origin serves for a URL. Some bodies
+ * take more than one read of the proxy.
+ *
+ * @param origin Index of the origin.
+ * @param url Index of the URL.
+ * @return int Byte size of the body.
+ */
+static int body_len(int origin, int url)
+{
+    return 64 + url_hash(origin, url) % SIM_MAX_BODY;
+}
+
+/**
+ * @brief Generate the body an origin serves for a URL; bodies of different
+ * URLs differ.
+ *
+ * @param origin Index of the origin.
+ * @param url Index of the URL.
+ * @return const char* Body of body_len() bytes, valid until the next call.
+ */
+static const char* make_body(int origin, int url)
+{
+    int len = body_len(origin, url);
+    int n = 0;
+
+    while (n < len) {
+        char word[32];
+        int word_len = snprintf(word, sizeof(word), "origin%d/u%d:%d ",
+                                origin, url, n);
+
+        if (word_len > len - n) {
+            word_len = len - n;
+        }
+        memcpy(body_buf + n, word, word_len);
+        n += word_len;
+    }
+    return body_buf;
+}
+
+/**
+ * @brief Append bytes to a growing buffer, keeping it null-terminated for
+ * sscanf() and atoi().
+ *
+ * @param buf Input and output; buffer.
+ * @param len Input and output; byte size of *buf.
+ * @param cap Input and output; capacity of *buf.
+ * @param data Bytes to append.
+ * @param n Byte size of data.
+ */
+static void buf_append(char** buf, int* len, int* cap, const char* data, int n)
+{
+    if (*len + n + 1 > *cap) {
+        *cap = (*len + n + 1) * 2;
+        *buf = realloc(*buf, *cap);
+        if (*buf == NULL) {
+            PLOG_FATAL("realloc");
+        }
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+}
+
+/**
+ * @brief Create a connection.
+ *
+ * @param is_client 1 for a client; 0 for a socket to an origin.
+ * @return struct sim_conn* New connection.
+ */
+static struct sim_conn* conn_new(int is_client)
+{
+    struct sim_conn* conn = calloc(1, sizeof(struct sim_conn));
+
+    if (conn == NULL) {
+        PLOG_FATAL("calloc");
+    }
+    conn->fd = -1;
+    conn->is_client = is_client;
+    conn->origin = -1;
+    conn->fin_at = SIM_NEVER;
+    conn->rst_at = SIM_NEVER;
+    conn->deadline = SIM_NEVER;
+    if (num_conns == cap_conns) {
+        cap_conns = cap_conns > 0 ? cap_conns * 2 : 64;
+        conns = realloc(conns, cap_conns * sizeof(struct sim_conn*));
+        if (conns == NULL) {
+            PLOG_FATAL("realloc");
+        }
+    }
+    conn->index = num_conns;
+    conns[num_conns++] = conn;
+    return conn;
+}
+
+/**
+ * @brief Free a connection once neither end needs it: the proxy closed it,
+ * and a client is done.
+ *
+ * @param conn Connection.
+ */
+static void conn_release(struct sim_conn* conn)
+{
+    if (conn->fd >= 0 || conn->in_backlog ||
+        (conn->is_client && conn->state == SIM_WAITING)) {
+        return;
+    }
+    if (reading_client == conn) {
+        reading_client = NULL;
+    }
+    conns[conn->index] = conns[--num_conns];
+    conns[conn->index]->index = conn->index;
+    free(conn->in);
+    free(conn->out);
+    free(conn->deliveries);
+    free(conn);
+}
+
+/**
+ * @brief Get the time the last sent byte of a peer arrives.
+ *
+ * @param conn Connection.
+ * @return long Virtual time in microseconds; now if nothing is in flight.
+ */
+static long conn_last_at(const struct sim_conn* conn)
+{
+    if (conn->num_deliveries > 0 &&
+        conn->deliveries[conn->num_deliveries - 1].at > now_us) {
+        return conn->deliveries[conn->num_deliveries - 1].at;
+    }
+    return now_us;
+}
+
+/**
+ * @brief Schedule the arrival of sent bytes.
+ *
+ * @param conn Connection.
+ * @param at Virtual time in microseconds the bytes arrive.
+ * @param upto Byte size of sent data that has arrived by then.
+ */
+static void conn_deliver(struct sim_conn* conn, long at, int upto)
+{
+    if (conn->num_deliveries == conn->cap_deliveries) {
+        conn->cap_deliveries = conn->cap_deliveries > 0 ?
+                               conn->cap_deliveries * 2 : 4;
+        conn->deliveries = realloc(conn->deliveries,
+                                   conn->cap_deliveries *
+                                   sizeof(struct sim_delivery));
+        if (conn->deliveries == NULL) {
+            PLOG_FATAL("realloc");
+        }
+    }
+    conn->deliveries[conn->num_deliveries].at = at;
+    conn->deliveries[conn->num_deliveries].upto = upto;
+    conn->num_deliveries++;
+}
+
+/**
+ * @brief Send bytes from a peer to the proxy. A slow peer sends them in small
+ * pieces with delays in between.
+ *
+ * @param conn Connection.
+ * @param data Bytes to send.
+ * @param n Byte size of data.
+ * @param latency_us Max delay in microseconds before the bytes arrive.
+ */
+static void conn_send(struct sim_conn* conn,
+                      const char* data,
+                      int n,
+                      long latency_us)
+{
+    long at = conn_last_at(conn);
+    int is_slow = sim_chance(cfg->slow_rate);
+    int sent = 0;
+
+    buf_append(&conn->in, &conn->in_len, &conn->in_cap, data, n);
+    if (is_slow) {
+        res->faults++;
+    }
+    while (sent < n) {
+        int piece = is_slow ? sim_uniform(1, SIM_MAX_PIECE) : n - sent;
+
+        if (piece > n - sent) {
+            piece = n - sent;
+        }
+        sent += piece;
+        at += is_slow ? sim_uniform(1000, 20000) : sim_uniform(1, latency_us);
+        conn_deliver(conn, at, conn->in_len - n + sent);
+    }
+}
+
+/**
+ * @brief Send bytes from a slowloris client to the proxy, one at a time with
+ * SIM_SLOWLORIS_GAP seconds in between.
+ *
+ * @param conn Client connection.
+ * @param data Bytes to send.
+ * @param n Byte size of data.
+ */
+static void conn_trickle(struct sim_conn* conn, const char* data, int n)
+{
+    long at = conn_last_at(conn);
+
+    buf_append(&conn->in, &conn->in_len, &conn->in_cap, data, n);
+    for (int sent = 1; sent <= n; ++sent) {
+        at += SIM_SLOWLORIS_GAP * SIM_USEC;
+        conn_deliver(conn, at, conn->in_len - n + sent);
+    }
+}
+
+/**
+ * @brief Move arrived deliveries into the readable bytes of a connection.
+ *
+ * @param conn Connection.
+ */
+static void conn_update(struct sim_conn* conn)
+{
+    while (conn->next_delivery < conn->num_deliveries &&
+           conn->deliveries[conn->next_delivery].at <= now_us) {
+        conn->in_ready = conn->deliveries[conn->next_delivery].upto;
+        conn->next_delivery++;
+    }
+}
+
+/**
+ * @brief Whether the proxy's end of a connection is readable.
+ *
+ * @param conn Connection.
+ * @return int 1 if a read does not block; 0 otherwise.
+ */
+static int conn_readable(struct sim_conn* conn)
+{
+    conn_update(conn);
+    return conn->in_ready > conn->in_read ||
+           conn->fin_at <= now_us ||
+           conn->rst_at <= now_us;
+}
+
+/**
+ * @brief Get the time of the next event of a connection.
+ *
+ * @param conn Connection.
+ * @return long Virtual time in microseconds after now; SIM_NEVER if there is
+ * none.
+ */
+static long conn_next_event(struct sim_conn* conn)
+{
+    long next = SIM_NEVER;
+
+    conn_update(conn);
+    if (conn->next_delivery < conn->num_deliveries) {
+        next = conn->deliveries[conn->next_delivery].at;
+    }
+    if (conn->fin_at > now_us && conn->fin_at < next) {
+        next = conn->fin_at;
+    }
+    if (conn->rst_at > now_us && conn->rst_at < next) {
+        next = conn->rst_at;
+    }
+    if (conn->is_client && conn->state == SIM_WAITING &&
+        conn->deadline < next) {
+        next = conn->deadline;
+    }
+    return next;
+}
+
+/**
+ * @brief Count corruption of a connection once.
+ *
+ * @param conn Connection.
+ */
+static void conn_corrupt(struct sim_conn* conn)
+{
+    if (!conn->is_corrupt) {
+        conn->is_corrupt = 1;
+        res->corrupt++;
+    }
+}
+
+/**
+ * @brief Finish a waiting client with an outcome. A client that completed or
+ * gave up closes its end.
+ *
+ * @param conn Client connection.
+ * @param state Outcome.
+ */
+static void client_finish(struct sim_conn* conn, int state)
+{
+    if (conn->state != SIM_WAITING) {
+        return;
+    }
+    conn->state = state;
+    waiting--;
+    if (!running) {
+        return;
+    }
+    switch (state) {
+    case SIM_COMPLETED:
+        latencies[res->completed++] = now_us - conn->spawned_at;
+        break;
+    case SIM_TIMED_OUT:
+        res->timed_out++;
+        res->stalled += !conn->is_faulted;
+        break;
+    case SIM_CLOSED:
+        res->closed++;
+        res->stalled += !conn->is_faulted;
+        break;
+    case SIM_REJECTED:
+        res->rejected++;
+        break;
+    default:
+        res->reset++;
+        break;
+    }
+    if (state == SIM_COMPLETED || state == SIM_TIMED_OUT ||
+        state == SIM_REJECTED) {
+        conn->fin_at = conn_last_at(conn);
+    }
+}
+
+/**
+ * @brief Spawn a client: pick a URL or a tunnel, send the request, and queue
+ * the connection for accept().
+ */
+static void spawn_client(void)
+{
+    struct sim_conn* conn = conn_new(1);
+    char host[64];
+    char request[256];
+    int len;
+    long r;
+
+    conn->id = spawned++;
+    conn->spawned_at = now_us;
+    conn->is_tunnel = sim_chance(cfg->tunnel_rate);
+    conn->origin = sim_uniform(0, cfg->num_origins - 1);
+    /* Skew requests towards low URLs, so popular ones hit the cache. */
+    r = sim_uniform(0, cfg->num_urls - 1);
+    conn->url = r * sim_uniform(0, cfg->num_urls - 1) / cfg->num_urls;
+    if (sim_chance(cfg->dns_fail_rate)) {
+        snprintf(host, sizeof(host), "nx%d.sim", conn->origin);
+        conn->is_faulted = 1;
+        res->faults++;
+    }
+    else {
+        snprintf(host, sizeof(host), "origin%d.sim", conn->origin);
+    }
+    if (conn->is_tunnel) {
+        len = snprintf(request, sizeof(request),
+                       "CONNECT %s:%d HTTP/1.1\r\n"
+                       "Host: %s:%d\r\n"
+                       "\r\n",
+                       host, SIM_TUNNEL_PORT, host, SIM_TUNNEL_PORT);
+    }
+    else {
+        len = snprintf(request, sizeof(request),
+                       "GET /u%d HTTP/1.1\r\n"
+                       "Host: %s\r\n"
+                       "X-Sim-Client: %ld\r\n"
+                       "\r\n",
+                       conn->url, host, conn->id);
+    }
+    if (sim_chance(cfg->slowloris_rate)) {
+        conn_trickle(conn, request, len);
+        conn->is_faulted = 1;
+        res->faults++;
+    }
+    else {
+        conn_send(conn, request, len, 2000);
+    }
+    conn->deadline = now_us + SIM_CLIENT_TIMEOUT * SIM_USEC;
+    if (sim_chance(cfg->client_reset_rate)) {
+        conn->rst_at = now_us + sim_uniform(0, 50000);
+        conn->is_faulted = 1;
+        res->faults++;
+    }
+    waiting++;
+    conn->in_backlog = 1;
+    backlog[(backlog_head + backlog_len) % cfg->max_concurrent] = conn;
+    backlog_len++;
+    next_arrival = now_us + sim_uniform(0, cfg->arrival_ms * 2000);
+}
+
+/**
+ * @brief Check the bytes a client has received so far.
+ *
+ * @param conn Client connection.
+ */
+static void client_receive(struct sim_conn* conn)
+{
+    int status_len = strlen(unavailable);
+
+    /* A request that failed fast gets a head without body. */
+    if (strncmp(conn->out,
+                unavailable,
+                conn->out_len < status_len ? conn->out_len : status_len) == 0) {
+        if (memmem(conn->out, conn->out_len, "\r\n\r\n", 4) != NULL) {
+            client_finish(conn, SIM_REJECTED);
+        }
+        return;
+    }
+    if (conn->is_tunnel) {
+        char expected[128];
+        int expected_len = snprintf(expected, sizeof(expected),
+                                    "%sPONG %ld\n", established, conn->id);
+        int n = conn->out_len < expected_len ? conn->out_len : expected_len;
+
+        if (conn->out_len > expected_len ||
+            memcmp(conn->out, expected, n) != 0) {
+            conn_corrupt(conn);
+            client_finish(conn, SIM_CLOSED);
+            return;
+        }
+        if (!conn->responded && conn->out_len >= (int)strlen(established)) {
+            char ping[32];
+            int ping_len = snprintf(ping, sizeof(ping), "PING %ld\n",
+                                    conn->id);
+
+            conn->responded = 1;
+            conn_send(conn, ping, ping_len, 2000);
+        }
+        if (conn->out_len == expected_len) {
+            client_finish(conn, SIM_COMPLETED);
+        }
+    }
+    else {
+        char* head_end = memmem(conn->out, conn->out_len, "\r\n\r\n", 4);
+        int head_len;
+        const char* value;
+        int value_len;
+        int expected_len = body_len(conn->origin, conn->url);
+
+        if (head_end == NULL) {
+            return;
+        }
+        head_len = head_end + 4 - conn->out;
+        if (strncmp(conn->out, "HTTP/1.1 200 ", 13) != 0 ||
+            !find_header_field(conn->out,
+                               head_len,
+                               HTTP_HEADER_CONTENT_LENGTH,
+                               &value,
+                               &value_len) ||
+            atoi(value) != expected_len ||
+            conn->out_len - head_len > expected_len) {
+            conn_corrupt(conn);
+            client_finish(conn, SIM_CLOSED);
+            return;
+        }
+        if (conn->out_len - head_len < expected_len) {
+            return;
+        }
+        if (memcmp(conn->out + head_len,
+                   make_body(conn->origin, conn->url),
+                   expected_len) != 0) {
+            conn_corrupt(conn);
+            client_finish(conn, SIM_CLOSED);
+            return;
+        }
+        client_finish(conn, SIM_COMPLETED);
+    }
+}
+
+/**
+ * @brief Mark the client whose request an origin received as hit by a fault.
+ *
+ * @param conn Origin connection.
+ */
+static void fault_client(const struct sim_conn* conn)
+{
+    const char* client = memmem(conn->out, conn->out_len,
+                                "X-Sim-Client: ", 14);
+
+    for (int i = 0; client != NULL && i < num_conns; ++i) {
+        if (conns[i]->is_client && conns[i]->id == atol(client + 14)) {
+            conns[i]->is_faulted = 1;
+        }
+    }
+}
+
+/**
+ * @brief Handle the bytes an origin has received so far, and respond once
+ * its request is complete.
+ *
+ * @param conn Origin connection.
+ */
+static void origin_receive(struct sim_conn* conn)
+{
+    char response[256];
+    int url;
+    int origin;
+
+    if (conn->responded) {
+        /* One request per connection. */
+        conn_corrupt(conn);
+        return;
+    }
+    if (conn->is_tunnel) {
+        char* nl = memchr(conn->out, '\n', conn->out_len);
+        int len;
+
+        if (nl == NULL) {
+            return;
+        }
+        conn->responded = 1;
+        if (strncmp(conn->out, "PING ", 5) != 0) {
+            conn_corrupt(conn);
+            return;
+        }
+        len = snprintf(response, sizeof(response), "PONG %.*s\n",
+                       (int)(nl - conn->out - 5), conn->out + 5);
+        conn_send(conn, response, len, 10000);
+        conn->fin_at = conn_last_at(conn);
+    }
+    else {
+        const char* head_end = memmem(conn->out, conn->out_len,
+                                      "\r\n\r\n", 4);
+        const char* value;
+        int value_len;
+        int len;
+        int body;
+
+        if (head_end == NULL) {
+            return;
+        }
+        conn->responded = 1;
+        res->origin_requests++;
+        /* The request must be for this origin. */
+        if (sscanf(conn->out, "GET /u%d HTTP/1.1\r\n", &url) != 1 ||
+            !find_header_field(conn->out,
+                               head_end + 4 - conn->out,
+                               HTTP_HEADER_HOST,
+                               &value,
+                               &value_len) ||
+            sscanf(value, "origin%d.sim", &origin) != 1 ||
+            origin != conn->origin ||
+            url < 0 ||
+            url >= cfg->num_urls) {
+            conn_corrupt(conn);
+            return;
+        }
+        body = body_len(origin, url);
+        len = snprintf(response, sizeof(response),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %d\r\n"
+                       "Cache-Control: max-age=%d\r\n"
+                       "\r\n",
+                       body,
+                       (int)(1 + url_hash(origin, url) % SIM_MAX_AGE));
+        if (sim_chance(cfg->stall_rate)) {
+            /* Never respond. */
+            res->faults++;
+            fault_client(conn);
+        }
+        else if (sim_chance(cfg->origin_reset_rate)) {
+            /* Send part of the response, then reset. */
+            int part = sim_uniform(0, len + body - 1);
+
+            res->faults++;
+            fault_client(conn);
+            if (part > len) {
+                conn_send(conn, response, len, 10000);
+                conn_send(conn, make_body(origin, url), part - len, 10000);
+            }
+            else {
+                conn_send(conn, response, part, 10000);
+            }
+            conn->rst_at = conn_last_at(conn) + 1;
+        }
+        else {
+            if (sim_chance(cfg->jitter_rate)) {
+                /* Respond late; the response is complete, so it is no
+                 * fault. */
+                conn_deliver(conn,
+                             now_us + sim_uniform(SIM_JITTER_MIN,
+                                                  SIM_JITTER_MAX),
+                             conn->in_len);
+            }
+            conn_send(conn, response, len, 10000);
+            conn_send(conn, make_body(origin, url), body, 10000);
+        }
+    }
+}
+
+/**
+ * @brief Process the events due now: client arrivals, resets and timeouts.
+ */
+static void sim_step(void)
+{
+    while (spawned < cfg->clients &&
+           waiting < cfg->max_concurrent &&
+           next_arrival <= now_us) {
+        spawn_client();
+    }
+    for (int i = 0; i < num_conns; ++i) {
+        struct sim_conn* conn = conns[i];
+
+        if (!conn->is_client || conn->state != SIM_WAITING) {
+            continue;
+        }
+        if (conn->rst_at <= now_us) {
+            client_finish(conn, SIM_RESET);
+        }
+        else if (conn->deadline <= now_us) {
+            client_finish(conn, SIM_TIMED_OUT);
+        }
+    }
+}
+
+/**
+ * @brief Get a connection of a proxy FD, counting a bad call if there is
+ * none.
+ *
+ * @param fd FD.
+ * @return struct sim_conn* Connection; NULL if the FD is not open.
+ */
+static struct sim_conn* get_conn(int fd)
+{
+    if (fd < 0 || fd >= FD_SETSIZE || fds[fd] == NULL) {
+        res->bad_fd++;
+        errno = EBADF;
+        return NULL;
+    }
+    return fds[fd];
+}
+
+/**
+ * @brief Allocate the lowest free FD, as the kernel does, so FDs are reused
+ * as soon as they are closed.
+ *
+ * @return int FD; -1 if none is free.
+ */
+static int alloc_fd(void)
+{
+    for (int fd = 3; fd < FD_SETSIZE; ++fd) {
+        if (fds[fd] == NULL && fd != listen_fd) {
+            return fd;
+        }
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+/**
+ * @brief Open the proxy's listening socket.
+ *
+ * @param port Ignored.
+ * @param backlog Ignored; the simulated backlog has room for every client.
+ * @return int FD of the socket.
+ */
+static int sim_listen(int port, int backlog_size)
+{
+    (void)port;
+    (void)backlog_size;
+    listen_fd = alloc_fd();
+    sim_trace('l', listen_fd, listen_fd);
+    return listen_fd;
+}
+
+/**
+ * @brief Accept the first client in the backlog.
+ *
+ * @param fd FD of the listening socket.
+ * @param addr Output; client address.
+ * @return int FD of the client; -1 if none is waiting.
+ */
+static int sim_accept(int fd, struct sockaddr_in* addr)
+{
+    struct sim_conn* conn;
+    int client_fd;
+
+    if (fd != listen_fd) {
+        res->bad_fd++;
+        errno = EBADF;
+        return -1;
+    }
+    if (backlog_len == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    client_fd = alloc_fd();
+    if (client_fd < 0) {
+        return -1;
+    }
+    conn = backlog[backlog_head];
+    backlog_head = (backlog_head + 1) % cfg->max_concurrent;
+    backlog_len--;
+    conn->in_backlog = 0;
+    conn->fd = client_fd;
+    fds[client_fd] = conn;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(0x0a010000 | (conn->id & 0xffff));
+    addr->sin_port = htons(1024 + conn->id % 60000);
+    sim_trace('a', fd, client_fd);
+    return client_fd;
+}
+
+/**
+ * @brief Open a socket for a connection to an origin.
+ *
+ * @return int FD of the socket; -1 if no FD is free.
+ */
+static int sim_socket(void)
+{
+    int fd = alloc_fd();
+
+    if (fd >= 0) {
+        fds[fd] = conn_new(0);
+        fds[fd]->fd = fd;
+    }
+    sim_trace('s', fd, fd);
+    return fd;
+}
+
+/**
+ * @brief Connect a socket to an origin, which may refuse it, or not answer so
+ * the connect blocks until its timeout.
+ *
+ * @param fd FD of the socket.
+ * @param addr Address of a replica of the origin,
+ * 10.<replica>.0.<index + 1>.
+ * @param timeout Max seconds to wait; 0 to wait as long as the system does.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int sim_connect(int fd, const struct sockaddr_in* addr, int timeout)
+{
+    struct sim_conn* conn = get_conn(fd);
+    uint32_t ip = ntohl(addr->sin_addr.s_addr);
+    long origin = (long)(ip & 0xff00ffff) - 0x0a000001;
+    long replica = (long)(ip >> 16 & 0xff);
+    int port = ntohs(addr->sin_port);
+    int ret = 0;
+
+    if (conn == NULL) {
+        return -1;
+    }
+    if (conn->is_client || conn->origin >= 0) {
+        res->bad_fd++;
+        errno = EISCONN;
+        ret = -1;
+    }
+    else if (origin < 0 || origin >= cfg->num_origins ||
+             replica >= SIM_REPLICAS ||
+             (port != SIM_ORIGIN_PORT && port != SIM_TUNNEL_PORT)) {
+        errno = ECONNREFUSED;
+        ret = -1;
+    }
+    else if (sim_chance(cfg->refuse_rate)) {
+        res->faults++;
+        if (reading_client != NULL) {
+            reading_client->is_faulted = 1;
+        }
+        errno = ECONNREFUSED;
+        ret = -1;
+    }
+    else if (origin < cfg->down_origins || sim_chance(cfg->blackhole_rate)) {
+        res->faults++;
+        if (reading_client != NULL) {
+            reading_client->is_faulted = 1;
+        }
+        now_us += (timeout > 0 ? timeout : SIM_SYN_TIMEOUT) * SIM_USEC;
+        errno = ETIMEDOUT;
+        ret = -1;
+    }
+    else {
+        conn->origin = origin;
+        conn->is_tunnel = port == SIM_TUNNEL_PORT;
+    }
+    sim_trace('c', fd, ret);
+    return ret;
+}
+
+/**
+ * @brief Read the bytes of a peer that have arrived.
+ *
+ * @param fd FD of the proxy's end.
+ * @param buf Output buffer.
+ * @param n Byte size of buf.
+ * @return ssize_t Byte size read; 0 once the peer closed; -1 on reset, or if
+ * nothing has arrived.
+ */
+static ssize_t sim_read(int fd, void* buf, size_t n)
+{
+    struct sim_conn* conn = get_conn(fd);
+    ssize_t ret;
+
+    if (conn == NULL) {
+        return -1;
+    }
+    conn_update(conn);
+    if (!conn->is_client && conn->origin < 0) {
+        res->bad_fd++;
+        errno = ENOTCONN;
+        ret = -1;
+    }
+    else if (conn->rst_at <= now_us) {
+        errno = ECONNRESET;
+        ret = -1;
+    }
+    else if (conn->in_ready > conn->in_read) {
+        if (conn->is_client) {
+            reading_client = conn;
+        }
+        ret = conn->in_ready - conn->in_read;
+        if ((size_t)ret > n) {
+            ret = n;
+        }
+        memcpy(buf, conn->in + conn->in_read, ret);
+        conn->in_read += ret;
+    }
+    else if (conn->fin_at <= now_us) {
+        ret = 0;
+    }
+    else {
+        res->would_block++;
+        errno = EAGAIN;
+        ret = -1;
+    }
+    sim_trace('r', fd, ret);
+    return ret;
+}
+
+/**
+ * @brief Write bytes to a peer, which may take only part of them or be
+ * interrupted.
+ *
+ * @param fd FD of the proxy's end.
+ * @param buf Bytes to write.
+ * @param n Byte size of buf.
+ * @return ssize_t Byte size written; -1 on failure.
+ */
+static ssize_t sim_write(int fd, const void* buf, size_t n)
+{
+    struct sim_conn* conn = get_conn(fd);
+    ssize_t ret = n;
+
+    if (conn == NULL) {
+        return -1;
+    }
+    if (!conn->is_client && conn->origin < 0) {
+        res->bad_fd++;
+        errno = ENOTCONN;
+        ret = -1;
+    }
+    else if (conn->rst_at <= now_us) {
+        errno = ECONNRESET;
+        ret = -1;
+    }
+    else if (sim_chance(cfg->eintr_rate)) {
+        res->faults++;
+        errno = EINTR;
+        ret = -1;
+    }
+    else {
+        if (n > 1 && sim_chance(cfg->short_write_rate)) {
+            res->faults++;
+            ret = sim_uniform(1, n - 1);
+        }
+        if (conn->is_client && conn->state != SIM_WAITING) {
+            /* A finished client takes no more bytes, but a completed or
+             * rejected one must not be sent any. */
+            if (conn->state == SIM_COMPLETED || conn->state == SIM_REJECTED) {
+                conn_corrupt(conn);
+            }
+        }
+        else {
+            buf_append(&conn->out, &conn->out_len, &conn->out_cap, buf, ret);
+            if (conn->is_client) {
+                client_receive(conn);
+            }
+            else {
+                origin_receive(conn);
+            }
+        }
+    }
+    sim_trace('w', fd, ret);
+    return ret;
+}
+
+/**
+ * @brief Close the proxy's end of a connection. A client still waiting sees
+ * the connection closed.
+ *
+ * @param fd FD of the proxy's end.
+ * @return int 0 on success; -1 if the FD is not open.
+ */
+static int sim_close(int fd)
+{
+    struct sim_conn* conn;
+
+    if (fd == listen_fd) {
+        listen_fd = -1;
+        sim_trace('x', fd, 0);
+        return 0;
+    }
+    conn = get_conn(fd);
+    if (conn == NULL) {
+        return -1;
+    }
+    fds[fd] = NULL;
+    conn->fd = -1;
+    if (conn->is_client) {
+        client_finish(conn, SIM_CLOSED);
+    }
+    conn_release(conn);
+    sim_trace('x', fd, 0);
+    return 0;
+}
+
+/**
+ * @brief Wait until a socket is readable or the timeout expires, jumping the
+ * virtual clock from event to event.
+ *
+ * @param nfds Largest FD in readfds plus 1.
+ * @param readfds Input and output; sockets to wait on, then readable ones.
+ * @param timeout Max wait; NULL to wait forever.
+ * @return int Number of readable sockets.
+ */
+static int sim_select(int nfds, fd_set* readfds, struct timeval* timeout)
+{
+    long deadline = SIM_NEVER;
+    fd_set ready;
+    int num_ready;
+
+    if (timeout != NULL) {
+        deadline = now_us + timeout->tv_sec * SIM_USEC + timeout->tv_usec;
+    }
+    while (1) {
+        long next = SIM_NEVER;
+
+        sim_step();
+        FD_ZERO(&ready);
+        num_ready = 0;
+        for (int fd = 0; fd < nfds; ++fd) {
+            if (!FD_ISSET(fd, readfds)) {
+                continue;
+            }
+            if ((fd == listen_fd && backlog_len > 0) ||
+                (fds[fd] != NULL && conn_readable(fds[fd]))) {
+                FD_SET(fd, &ready);
+                num_ready++;
+            }
+        }
+        if (num_ready > 0 || now_us >= deadline) {
+            break;
+        }
+
+        /* Jump to the next event. */
+        if (spawned < cfg->clients && waiting < cfg->max_concurrent) {
+            next = next_arrival;
+        }
+        for (int i = 0; i < num_conns; ++i) {
+            long at = conn_next_event(conns[i]);
+
+            if (at < next) {
+                next = at;
+            }
+        }
+        if (next == SIM_NEVER && deadline == SIM_NEVER) {
+            /* Nothing will ever happen. */
+            break;
+        }
+        now_us = next < deadline ? next : deadline;
+    }
+    *readfds = ready;
+    sim_trace('p', nfds, num_ready);
+    return num_ready;
+}
+
+/**
+ * @brief Resolve origin<i>.sim to 10.<r>.0.<i + 1>, for each replica r. Other
+ * names do not resolve.
+ *
+ * @param hostname Hostname.
+ * @param addrs Output; addresses of the origin.
+ * @param max Max number of addresses to store in addrs, positive.
+ * @return int Number of addresses stored; -1 otherwise.
+ */
+static int sim_resolve(const char* hostname, struct in_addr* addrs, int max)
+{
+    int origin;
+    char end;
+    int ret = -1;
+
+    if (sscanf(hostname, "origin%d.si%c", &origin, &end) == 2 &&
+        end == 'm' &&
+        origin >= 0 &&
+        origin < cfg->num_origins) {
+        for (ret = 0; ret < SIM_REPLICAS && ret < max; ++ret) {
+            addrs[ret].s_addr = htonl(0x0a000001 + (ret << 16) + origin);
+        }
+    }
+    sim_trace('d', -1, ret);
+    return ret;
+}
+
+/**
+ * @brief Get the virtual time.
+ *
+ * @return time_t Virtual time in seconds since the epoch.
+ */
+static time_t sim_now(void)
+{
+    return SIM_EPOCH + now_us / SIM_USEC;
+}
+
+/**
+ * @brief Get the virtual time in microseconds.
+ *
+ * @return long Virtual time in microseconds since the epoch.
+ */
+static long sim_now_us(void)
+{
+    return SIM_EPOCH * SIM_USEC + now_us;
+}
+
+static const struct netio_ops sim_ops = {
+    sim_listen,
+    sim_accept,
+    sim_socket,
+    sim_connect,
+    sim_read,
+    sim_write,
+    sim_close,
+    sim_select,
+    sim_resolve,
+    sim_now,
+    sim_now_us,
+}; /* Operations of the simulator. */
+
+/**
+ * @brief Compare two longs for qsort().
+ */
+static int compare_long(const void* a, const void* b)
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Fill a configuration with defaults: moderate fault rates and a
+ * small set of origins and URLs, so the cache gets both hits and misses.
+ *
+ * @param config Output; configuration.
+ */
+void sim_init_config(struct sim_config* config)
+{
+    config->seed = 1;
+    config->clients = 10000;
+    config->max_concurrent = 32;
+    config->num_origins = 8;
+    config->num_urls = 64;
+    config->arrival_ms = 1;
+    config->tunnel_rate = 0.1;
+    config->slow_rate = 0.05;
+    config->short_write_rate = 0.05;
+    config->eintr_rate = 0.01;
+    config->client_reset_rate = 0.01;
+    config->origin_reset_rate = 0.01;
+    config->dns_fail_rate = 0.005;
+    config->refuse_rate = 0.005;
+    config->slowloris_rate = 0.002;
+    config->stall_rate = 0.002;
+    config->blackhole_rate = 0.001;
+    config->jitter_rate = 0;
+    config->down_origins = 0;
+    config->proxy_args = NULL;
+    config->verbose = 0;
+}
+
+/**
+ * @brief Run the proxy in simulation until every client has left, then check
+ * that no socket is left open.
+ *
+ * @param config Simulation configuration.
+ * @param result Output; outcomes and violations of the run.
+ * @return int 0 if the run has no violation, i.e. no corrupt, stalled,
+ * would_block, bad_fd, leaked_fds or hung count; -1 otherwise.
+ */
+int sim_run(const struct sim_config* config, struct sim_result* result)
+{
+    char* argv[SIM_MAX_ARGS];
+    int argc = 0;
+    char* args = NULL;
+    long done_at = SIM_NEVER;
+    int saved_quiet = log_quiet;
+
+    /* Reset the simulation. */
+    cfg = config;
+    res = result;
+    memset(res, 0, sizeof(*res));
+    res->digest = 14695981039346656037ULL;
+    rand_state = config->seed * 0x9e3779b97f4a7c15ULL + 1;
+    now_us = 0;
+    memset(fds, 0, sizeof(fds));
+    listen_fd = -1;
+    spawned = 0;
+    waiting = 0;
+    next_arrival = 0;
+    reading_client = NULL;
+    backlog_head = 0;
+    backlog_len = 0;
+    backlog = calloc(config->max_concurrent, sizeof(struct sim_conn*));
+    body_buf = malloc(64 + SIM_MAX_BODY);
+    latencies = malloc(config->clients * sizeof(long));
+    if (backlog == NULL || body_buf == NULL || latencies == NULL) {
+        PLOG_FATAL("malloc");
+    }
+
+    /* Build the proxy's arguments. The cgroup and pressure options keep the
+     * host's memory pressure out of the run. */
+    argv[argc++] = "proxy";
+    argv[argc++] = "-m";
+    argv[argc++] = "8";
+    argv[argc++] = "-C";
+    argv[argc++] = "/nonexistent";
+    argv[argc++] = "-P";
+    argv[argc++] = "1000";
+    if (config->proxy_args != NULL) {
+        args = strdup(config->proxy_args);
+        for (char* arg = strtok(args, " ");
+             arg != NULL && argc < SIM_MAX_ARGS - 2;
+             arg = strtok(NULL, " ")) {
+            argv[argc++] = arg;
+        }
+    }
+    argv[argc++] = SIM_LISTEN_PORT;
+    argv[argc] = NULL;
+
+    log_quiet = !config->verbose;
+    netio_set_ops(&sim_ops);
+    running = 1;
+    parse_args(argc, argv);
+    init_proxy();
+
+    while (1) {
+        poll_proxy();
+        res->polls++;
+        if (spawned == config->clients && waiting == 0) {
+            int open = 0;
+
+            if (done_at == SIM_NEVER) {
+                done_at = now_us;
+            }
+            for (int i = 0; i < num_conns; ++i) {
+                open += conns[i]->fd >= 0;
+            }
+            if (open == 0 || now_us - done_at > SIM_IDLE_GRACE * SIM_USEC) {
+                res->leaked_fds = open;
+                break;
+            }
+        }
+        else if (spawned == config->clients &&
+                 now_us > next_arrival +
+                          (SIM_CLIENT_TIMEOUT + SIM_IDLE_GRACE) * SIM_USEC) {
+            /* Clients wait no longer than their timeout. */
+            res->hung = waiting;
+            break;
+        }
+    }
+    res->virtual_sec = (double)now_us / SIM_USEC;
+    if (res->completed > 0) {
+        qsort(latencies, res->completed, sizeof(long), compare_long);
+        res->p50_ms = latencies[(res->completed - 1) / 2] / 1000.0;
+        res->p99_ms = latencies[(res->completed * 99 + 99) / 100 - 1] /
+                      1000.0;
+    }
+
+    /* Close the rest without counting outcomes. */
+    running = 0;
+    clear_proxy();
+    netio_set_ops(NULL);
+    log_quiet = saved_quiet;
+    while (num_conns > 0) {
+        struct sim_conn* conn = conns[num_conns - 1];
+
+        conn->fd = -1;
+        conn->in_backlog = 0;
+        conn->state = SIM_CLOSED;
+        conn_release(conn);
+    }
+    free(conns);
+    conns = NULL;
+    cap_conns = 0;
+    free(backlog);
+    backlog = NULL;
+    free(body_buf);
+    body_buf = NULL;
+    free(latencies);
+    latencies = NULL;
+    free(args);
+
+    return res->corrupt > 0 || res->stalled > 0 || res->would_block > 0 ||
+           res->bad_fd > 0 || res->leaked_fds > 0 || res->hung > 0 ? -1 : 0;
+}
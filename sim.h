@@ -0,0 +1,114 @@
+/**************************************************************
+*
+*                            sim.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Interface for the deterministic simulator of the proxy.
+*
+*     The simulator installs its own socket, clock and DNS
+*     operations (see netio.h) and drives the proxy's event
+*     loop with scripted clients and origin servers in virtual
+*     time. All choices, including injected faults, come from
+*     one seeded random generator, so a seed replays a run
+*     exactly.
+*
+**************************************************************/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_ORIGIN_PORT 80 /* Port of origin servers. */
+#define SIM_TUNNEL_PORT 443 /* Port of origin servers for CONNECT tunnels. */
+#define SIM_CLIENT_TIMEOUT 60 /* Seconds before a client gives up. */
+#define SIM_REPLICAS 2 /* Number of addresses of each origin, one per
+                        * replica. */
+
+struct sim_config {
+    uint64_t seed; /* Seed of all random choices. */
+    long clients; /* Number of client connections to simulate. */
+    int max_concurrent; /* Max number of clients waiting at once. */
+    int num_origins; /* Number of origin servers. */
+    int num_urls; /* Number of URLs on each origin server. */
+    double arrival_ms; /* Mean time between client arrivals. */
+    double tunnel_rate; /* Probability that a client tunnels with CONNECT. */
+    double slow_rate; /* Probability that a peer sends in small pieces with
+                       * delays in between. */
+    double short_write_rate; /* Probability that a write of the proxy writes
+                              * only part of its bytes. */
+    double eintr_rate; /* Probability that a write of the proxy is
+                        * interrupted. */
+    double client_reset_rate; /* Probability that a client resets its
+                               * connection after sending its request. */
+    double origin_reset_rate; /* Probability that an origin resets its
+                               * connection in the middle of a response. */
+    double dns_fail_rate; /* Probability that a request names a host that
+                           * does not resolve. */
+    double refuse_rate; /* Probability that an origin refuses a
+                         * connection. */
+    double slowloris_rate; /* Probability that a client sends its request one
+                            * byte at a time, seconds apart. */
+    double stall_rate; /* Probability that an origin never responds. */
+    double blackhole_rate; /* Probability that an origin never answers a
+                            * connection attempt. */
+    double jitter_rate; /* Probability that an origin responds 100 ms to 1 s
+                         * late. */
+    int down_origins; /* Number of origins, from the first, that never answer
+                       * a connection attempt. */
+    const char* proxy_args; /* Extra options of the proxy separated by
+                             * spaces, e.g. "-z -e clock"; may be NULL. */
+    int verbose; /* Whether to print the proxy's log. */
+};
+
+struct sim_result {
+    long completed; /* Clients that received their complete response. */
+    long timed_out; /* Clients that gave up waiting. */
+    long closed; /* Clients closed by the proxy before a complete response. */
+    long reset; /* Clients that reset their connection. */
+    long rejected; /* Clients answered "503 Service Unavailable" while the
+                    * breaker of their origin was open. */
+    long origin_requests; /* Requests that reached an origin server. */
+    long corrupt; /* Clients and origins that received bytes that were not
+                   * meant for them. */
+    long stalled; /* Clients that timed out or were closed with no fault on
+                   * their path, e.g. after a lost short write. */
+    long would_block; /* Reads of the proxy on a socket with nothing to read,
+                       * which block a real proxy. */
+    long bad_fd; /* Calls of the proxy on a closed or unconnected FD. */
+    long leaked_fds; /* Sockets still open after all clients left and idle
+                      * sockets timed out. */
+    long hung; /* Clients still waiting at the end of the run. */
+    long polls; /* Iterations of the proxy's main loop. */
+    long faults; /* Number of injected faults. */
+    double p50_ms; /* Median time to a complete response. */
+    double p99_ms; /* 99th percentile time to a complete response. */
+    double virtual_sec; /* Simulated time. */
+    uint64_t digest; /* Hash of every call of the proxy and its result; equal
+                      * digests mean identical runs. */
+};
+
+/**
+ * @brief Fill a configuration with defaults: moderate fault rates and a
+ * small set of origins and URLs, so the cache gets both hits and misses.
+ *
+ * @param config Output; configuration.
+ */
+void sim_init_config(struct sim_config* config);
+
+/**
+ * @brief Run the proxy in simulation until every client has left, then check
+ * that no socket is left open.
+ *
+ * @param config Simulation configuration.
+ * @param result Output; outcomes and violations of the run.
+ * @return int 0 if the run has no violation, i.e. no corrupt, stalled,
+ * would_block, bad_fd, leaked_fds or hung count; -1 otherwise.
+ */
+int sim_run(const struct sim_config* config, struct sim_result* result);
+
+#endif /* SIM_H */
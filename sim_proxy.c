@@ -0,0 +1,186 @@
+/**************************************************************
+*
+*                         sim_proxy.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Driver of the deterministic simulator of the proxy.
+*
+*     Usage: ./sim_proxy [-s <seed>] [-r <runs>] [-n <clients>]
+*                        [-c <concurrent>] [-j <jitter_rate>]
+*                        [-d <down_origins>] [-F] [-v]
+*                        [-- <proxy options>...]
+*     runs the proxy in simulation with seeds <seed> to
+*     <seed> + <runs> - 1 and reports the outcomes, latency
+*     percentiles, violations, sockets closed past their
+*     deadlines, retries, hedges and breakers, and simulated
+*     connections per minute of each run.
+*     -j sets the probability that an origin responds late.
+*     -d takes the first <down_origins> origins down.
+*     -F turns off fault injection. -v prints the proxy's log.
+*     Options after "--" are passed to the proxy, e.g.
+*     "-- -z -e clock". It exits on failure at the first run
+*     with a violation; its seed replays it exactly.
+*
+**************************************************************/
+
+#include "sim.h"
+#include "deadline.h"
+#include "upstream.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Get the monotonic time in seconds.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    struct sim_config config;
+    struct sim_result result;
+    long runs = 1;
+    char proxy_args[1024] = "";
+    int opt;
+
+    sim_init_config(&config);
+    while ((opt = getopt(argc, argv, "s:r:n:c:j:d:Fv")) != -1) {
+        switch (opt) {
+        case 's':
+            config.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            runs = atol(optarg);
+            break;
+        case 'n':
+            config.clients = atol(optarg);
+            break;
+        case 'c':
+            config.max_concurrent = atoi(optarg);
+            break;
+        case 'j':
+            config.jitter_rate = atof(optarg);
+            break;
+        case 'd':
+            config.down_origins = atoi(optarg);
+            break;
+        case 'F':
+            config.slow_rate = 0;
+            config.short_write_rate = 0;
+            config.eintr_rate = 0;
+            config.client_reset_rate = 0;
+            config.origin_reset_rate = 0;
+            config.dns_fail_rate = 0;
+            config.refuse_rate = 0;
+            config.slowloris_rate = 0;
+            config.stall_rate = 0;
+            config.blackhole_rate = 0;
+            break;
+        case 'v':
+            config.verbose = 1;
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-s <seed>] [-r <runs>] [-n <clients>] "
+                    "[-c <concurrent>] [-j <jitter_rate>] "
+                    "[-d <down_origins>] [-F] [-v] "
+                    "[-- <proxy options>...]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (runs <= 0 || config.clients <= 0 || config.max_concurrent <= 0) {
+        fprintf(stderr, "runs, clients and concurrent must be positive\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = optind; i < argc; ++i) {
+        if (strlen(proxy_args) + strlen(argv[i]) + 2 > sizeof(proxy_args)) {
+            fprintf(stderr, "too many proxy options\n");
+            return EXIT_FAILURE;
+        }
+        strcat(proxy_args, " ");
+        strcat(proxy_args, argv[i]);
+    }
+    config.proxy_args = proxy_args;
+
+    for (long run = 0; run < runs; ++run) {
+        struct deadline_stats stats;
+        struct upstream_stats upstream;
+        double start = now_sec();
+        double elapsed;
+        int ret;
+
+        ret = sim_run(&config, &result);
+        elapsed = now_sec() - start;
+        printf("seed %" PRIu64 ": %ld clients in %.1f virtual s, "
+               "%.0f conns/min, digest %016" PRIx64 "\n"
+               "  completed %ld, timed out %ld, closed %ld, reset %ld, "
+               "rejected %ld; "
+               "%ld origin requests, %ld faults, %ld polls\n"
+               "  response time p50 %.1f ms, p99 %.1f ms\n"
+               "  corrupt %ld, stalled %ld, would block %ld, bad fd %ld, "
+               "leaked fds %ld, hung %ld\n",
+               config.seed,
+               config.clients,
+               result.virtual_sec,
+               config.clients / elapsed * 60,
+               result.digest,
+               result.completed,
+               result.timed_out,
+               result.closed,
+               result.reset,
+               result.rejected,
+               result.origin_requests,
+               result.faults,
+               result.polls,
+               result.p50_ms,
+               result.p99_ms,
+               result.corrupt,
+               result.stalled,
+               result.would_block,
+               result.bad_fd,
+               result.leaked_fds,
+               result.hung);
+        deadline_get_stats(&stats);
+        printf("  closed past deadline: %ld header, %ld body, %ld rate, "
+               "%ld connect, %ld first_byte, %ld idle\n",
+               stats.kills[DEADLINE_REASON_HEADER],
+               stats.kills[DEADLINE_REASON_BODY],
+               stats.kills[DEADLINE_REASON_RATE],
+               stats.kills[DEADLINE_REASON_CONNECT],
+               stats.kills[DEADLINE_REASON_FIRST_BYTE],
+               stats.kills[DEADLINE_REASON_IDLE]);
+        upstream_get_stats(&upstream);
+        printf("  upstream: %ld retried connects, %ld hedges, %ld answered "
+               "first, %ld over budget\n",
+               upstream.retries,
+               upstream.hedges,
+               upstream.hedges_won,
+               upstream.denied);
+        printf("  breakers: opened %ld times, %ld probes, %ld failed fast; "
+               "%ld addresses ejected\n",
+               upstream.opened,
+               upstream.probes,
+               upstream.rejected,
+               upstream.ejections);
+        if (ret < 0) {
+            printf("FAIL; replay with -s %" PRIu64 "\n", config.seed);
+            return EXIT_FAILURE;
+        }
+        config.seed++;
+    }
+    return EXIT_SUCCESS;
+}
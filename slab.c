@@ -0,0 +1,593 @@
+/**************************************************************
+*
+*                          slab.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-14
+*
+*     Summary:
+*     Implementation for size-class slab allocator over one
+*     large arena, optionally backed by 2 MB huge pages.
+*
+*     The arena is split into SLAB_PAGE_SIZE pages. A page is
+*     either free, assigned to one size class and cut into
+*     equal chunks, or part of a run of pages holding one
+*     large object. A page that has no chunk in use goes back
+*     to the free pages, so classes do not calcify.
+*
+*     A page limit below the arena size caps the pages in use,
+*     and free pages can be handed back to the kernel, so the
+*     cache can shrink under memory pressure.
+*
+**************************************************************/
+
+#include "slab.h"
+#include "logger.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define SLAB_GROWTH_FACTOR 1.25 /* Ratio between adjacent chunk sizes. */
+#define PAGE_FREE -1 /* Class of a free page. */
+#define PAGE_RUN_TAIL -2 /* Class of a non-leading page in a page run. */
+#define PAGE_NONE -1 /* Null page index in a list. */
+
+struct slab_page {
+    int cls; /* Size class; PAGE_FREE or PAGE_RUN_TAIL otherwise. */
+    int run; /* Number of pages in the run starting at this page. */
+    int used; /* Number of chunks in use. */
+    int carved; /* Number of chunks ever handed out. Chunks beyond it are
+                 * never touched, so they do not count towards RSS. */
+    void* free_list; /* Singly linked list of returned chunks. */
+    int prev; /* Previous page with free chunks in the same class. */
+    int next; /* Next page with free chunks in the same class. */
+    int resident; /* 1 if the page may hold physical memory, i.e. it has been
+                   * used since it was last handed back to the kernel. */
+};
+
+struct slab_class {
+    size_t chunk_size; /* Byte size of each chunk. */
+    int per_page; /* Number of chunks per page. */
+    int partial; /* Head of the list of pages with free chunks. */
+    int pages; /* Number of pages assigned to this class. */
+    long used; /* Number of chunks in use. */
+    size_t requested; /* Sum of requested byte sizes of used chunks. */
+};
+
+static char* arena = NULL; /* Start of the first page. */
+static void* arena_map = NULL; /* Start of the mapping. */
+static size_t arena_map_size = 0; /* Byte size of the mapping. */
+static int huge_pages = 0; /* Whether the mapping uses MAP_HUGETLB. */
+static int num_pages = 0; /* Number of pages in the arena. */
+static int free_pages = 0; /* Number of free pages. */
+static int page_limit = 0; /* Max number of pages in use. */
+static struct slab_page* pages = NULL; /* Page descriptors. */
+static struct slab_class classes[SLAB_MAX_CLASSES + 1]; /* Size classes; the
+                                                         * last one in use is
+                                                         * for page runs. */
+static int num_classes = 0; /* Number of small size classes. */
+
+/**
+ * @brief Map anonymous memory for the arena, aligned to SLAB_PAGE_SIZE.
+ *
+ * @param size Byte size of the arena, a multiple of SLAB_PAGE_SIZE.
+ * @param use_huge_pages Whether to try explicit huge pages first.
+ * @return int 0 on success; -1 otherwise.
+ */
+static int arena_map_pages(size_t size, int use_huge_pages)
+{
+    void* map;
+    uintptr_t start;
+
+    if (use_huge_pages) {
+        /* Without MAP_NORESERVE, mmap fails up front if not enough huge pages
+         * are reserved, instead of raising SIGBUS on first touch. */
+        map = mmap(NULL,
+                   size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1,
+                   0);
+        if (map != MAP_FAILED) {
+            arena_map = map;
+            arena_map_size = size;
+            arena = map;
+            huge_pages = 1;
+            return 0;
+        }
+        PLOG_ERROR("mmap with MAP_HUGETLB; fall back to transparent huge "
+                   "pages");
+    }
+
+    /* Over-allocate one page so that the arena can be aligned, which lets the
+     * kernel back it with transparent huge pages. */
+    map = mmap(NULL,
+               size + SLAB_PAGE_SIZE,
+               PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+               -1,
+               0);
+    if (map == MAP_FAILED) {
+        PLOG_ERROR("mmap");
+        return -1;
+    }
+    arena_map = map;
+    arena_map_size = size + SLAB_PAGE_SIZE;
+    start = ((uintptr_t)map + SLAB_PAGE_SIZE - 1) &
+            ~(uintptr_t)(SLAB_PAGE_SIZE - 1);
+    arena = (char*)start;
+    huge_pages = 0;
+    if (use_huge_pages && madvise(arena, size, MADV_HUGEPAGE) < 0) {
+        PLOG_ERROR("madvise");
+    }
+    return 0;
+}
+
+/**
+ * @brief Map the arena and set up size classes.
+ *
+ * @param arena_size Byte size of the arena; rounded up to SLAB_PAGE_SIZE.
+ * @param use_huge_pages 1 to back the arena with explicit 2 MB huge pages,
+ * falling back to transparent huge pages if none are reserved; 0 otherwise.
+ * @return int 0 on success; -1 otherwise.
+ */
+int slab_init(size_t arena_size, int use_huge_pages)
+{
+    size_t size;
+    double chunk_size;
+
+    if (arena != NULL ||
+        arena_size == 0 ||
+        arena_size > (size_t)UINT32_MAX * SLAB_ALIGN) {
+        return -1;
+    }
+
+    num_pages = (arena_size + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE;
+    size = (size_t)num_pages * SLAB_PAGE_SIZE;
+    pages = malloc(num_pages * sizeof(struct slab_page));
+    if (pages == NULL) {
+        PLOG_ERROR("malloc");
+        return -1;
+    }
+    if (arena_map_pages(size, use_huge_pages) < 0) {
+        free(pages);
+        pages = NULL;
+        return -1;
+    }
+    for (int i = 0; i < num_pages; ++i) {
+        pages[i].cls = PAGE_FREE;
+        pages[i].run = 0;
+        pages[i].used = 0;
+        pages[i].carved = 0;
+        pages[i].free_list = NULL;
+        pages[i].prev = PAGE_NONE;
+        pages[i].next = PAGE_NONE;
+        pages[i].resident = 0;
+    }
+    free_pages = num_pages;
+    page_limit = num_pages;
+
+    /* Chunk sizes grow geometrically, so internal fragmentation of any class
+     * is bounded by the growth factor. */
+    num_classes = 0;
+    chunk_size = SLAB_MIN_CHUNK;
+    while (num_classes < SLAB_MAX_CLASSES) {
+        size_t aligned = ((size_t)chunk_size + SLAB_ALIGN - 1) &
+                         ~(size_t)(SLAB_ALIGN - 1);
+        if (aligned > SLAB_MAX_CHUNK) {
+            aligned = SLAB_MAX_CHUNK;
+        }
+        classes[num_classes].chunk_size = aligned;
+        classes[num_classes].per_page = SLAB_PAGE_SIZE / aligned;
+        num_classes++;
+        if (aligned == SLAB_MAX_CHUNK) {
+            break;
+        }
+        chunk_size = aligned * SLAB_GROWTH_FACTOR;
+    }
+    for (int i = 0; i <= num_classes; ++i) {
+        classes[i].partial = PAGE_NONE;
+        classes[i].pages = 0;
+        classes[i].used = 0;
+        classes[i].requested = 0;
+    }
+    /* Page runs are accounted in units of whole pages. */
+    classes[num_classes].chunk_size = SLAB_PAGE_SIZE;
+    classes[num_classes].per_page = 1;
+    return 0;
+}
+
+/**
+ * @brief Unmap the arena. All allocated chunks become invalid.
+ */
+void slab_clear(void)
+{
+    if (arena == NULL) {
+        return;
+    }
+    if (munmap(arena_map, arena_map_size) < 0) {
+        PLOG_ERROR("munmap");
+    }
+    arena = NULL;
+    arena_map = NULL;
+    arena_map_size = 0;
+    free(pages);
+    pages = NULL;
+    num_pages = 0;
+    free_pages = 0;
+    page_limit = 0;
+    num_classes = 0;
+}
+
+/**
+ * @brief Get the size class that serves the given byte size.
+ *
+ * @param size Byte size to allocate, > 0.
+ * @return int Index of size class; slab_large_class() for page runs; -1 if the
+ * size cannot fit in the arena.
+ */
+int slab_class_of(size_t size)
+{
+    int lo = 0;
+    int hi = num_classes - 1;
+
+    if (arena == NULL || size == 0) {
+        return -1;
+    }
+    if (size > SLAB_MAX_CHUNK) {
+        if (size > (size_t)num_pages * SLAB_PAGE_SIZE) {
+            return -1;
+        }
+        return num_classes;
+    }
+    /* Binary search the first class whose chunk fits. */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (classes[mid].chunk_size >= size) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Get the index of the pseudo class for objects larger than
+ * SLAB_MAX_CHUNK, which take a run of whole pages.
+ *
+ * @return int Index of the page run class.
+ */
+int slab_large_class(void)
+{
+    return num_classes;
+}
+
+/**
+ * @brief Take a run of free pages.
+ *
+ * @param run Number of contiguous pages, > 0.
+ * @param cls Class to assign the pages to.
+ * @return int Index of the first page; PAGE_NONE if no such run.
+ */
+static int page_run_take(int run, int cls)
+{
+    int start = 0;
+
+    if (free_pages < run || num_pages - free_pages + run > page_limit) {
+        return PAGE_NONE;
+    }
+    /* First fit. */
+    for (int i = 0; i < num_pages; ++i) {
+        if (pages[i].cls != PAGE_FREE) {
+            start = i + 1;
+            continue;
+        }
+        if (i - start + 1 == run) {
+            pages[start].cls = cls;
+            pages[start].run = run;
+            pages[start].used = 0;
+            pages[start].carved = 0;
+            pages[start].free_list = NULL;
+            for (int j = start + 1; j <= i; ++j) {
+                pages[j].cls = PAGE_RUN_TAIL;
+                pages[j].run = 0;
+            }
+            for (int j = start; j <= i; ++j) {
+                pages[j].resident = 1;
+            }
+            free_pages -= run;
+            classes[cls].pages += run;
+            return start;
+        }
+    }
+    return PAGE_NONE;
+}
+
+/**
+ * @brief Give a run of pages back to the free pages.
+ *
+ * @param start Index of the first page of the run.
+ */
+static void page_run_release(int start)
+{
+    int run = pages[start].run;
+
+    classes[pages[start].cls].pages -= run;
+    for (int j = start; j < start + run; ++j) {
+        pages[j].cls = PAGE_FREE;
+        pages[j].run = 0;
+        pages[j].used = 0;
+        pages[j].carved = 0;
+        pages[j].free_list = NULL;
+        pages[j].prev = PAGE_NONE;
+        pages[j].next = PAGE_NONE;
+    }
+    free_pages += run;
+}
+
+/**
+ * @brief Link a page at the head of the partial list of its class.
+ */
+static void partial_push(int page)
+{
+    struct slab_class* c = &classes[pages[page].cls];
+
+    pages[page].prev = PAGE_NONE;
+    pages[page].next = c->partial;
+    if (c->partial != PAGE_NONE) {
+        pages[c->partial].prev = page;
+    }
+    c->partial = page;
+}
+
+/**
+ * @brief Unlink a page from the partial list of its class.
+ */
+static void partial_remove(int page)
+{
+    struct slab_class* c = &classes[pages[page].cls];
+
+    if (pages[page].prev != PAGE_NONE) {
+        pages[pages[page].prev].next = pages[page].next;
+    }
+    else {
+        c->partial = pages[page].next;
+    }
+    if (pages[page].next != PAGE_NONE) {
+        pages[pages[page].next].prev = pages[page].prev;
+    }
+    pages[page].prev = PAGE_NONE;
+    pages[page].next = PAGE_NONE;
+}
+
+/**
+ * @brief Allocate a chunk from the arena.
+ *
+ * @param size Byte size to allocate, > 0.
+ * @return void* Pointer to the chunk; NULL if neither the size class nor the
+ * free pages can serve it. The caller may evict from slab_class_of(size) and
+ * retry.
+ */
+void* slab_alloc(size_t size)
+{
+    int cls;
+    int page;
+    struct slab_class* c;
+    struct slab_page* p;
+    void* chunk;
+
+    cls = slab_class_of(size);
+    if (cls < 0) {
+        return NULL;
+    }
+    c = &classes[cls];
+
+    if (cls == num_classes) {
+        page = page_run_take((size + SLAB_PAGE_SIZE - 1) / SLAB_PAGE_SIZE,
+                             cls);
+        if (page == PAGE_NONE) {
+            return NULL;
+        }
+        pages[page].used = 1;
+        c->used++;
+        c->requested += size;
+        return arena + (size_t)page * SLAB_PAGE_SIZE;
+    }
+
+    page = c->partial;
+    if (page == PAGE_NONE) {
+        page = page_run_take(1, cls);
+        if (page == PAGE_NONE) {
+            return NULL;
+        }
+        partial_push(page);
+    }
+    p = &pages[page];
+    if (p->free_list != NULL) {
+        chunk = p->free_list;
+        p->free_list = *(void**)chunk;
+    }
+    else {
+        chunk = arena + (size_t)page * SLAB_PAGE_SIZE +
+                (size_t)p->carved * c->chunk_size;
+        p->carved++;
+    }
+    p->used++;
+    if (p->used == c->per_page) {
+        partial_remove(page);
+    }
+    c->used++;
+    c->requested += size;
+    return chunk;
+}
+
+/**
+ * @brief Return a chunk to the arena.
+ *
+ * @param ptr Chunk returned by slab_alloc(); NULL is ignored.
+ * @param size Byte size passed to slab_alloc() for this chunk.
+ */
+void slab_free(void* ptr, size_t size)
+{
+    int page;
+    struct slab_page* p;
+    struct slab_class* c;
+
+    if (ptr == NULL || arena == NULL) {
+        return;
+    }
+    page = ((char*)ptr - arena) / SLAB_PAGE_SIZE;
+    if (page < 0 || page >= num_pages || pages[page].cls < 0) {
+        LOG_ERROR("free chunk %p not in use", ptr);
+        return;
+    }
+    p = &pages[page];
+    c = &classes[p->cls];
+    c->used--;
+    c->requested -= size;
+
+    if (p->cls == num_classes) {
+        page_run_release(page);
+        return;
+    }
+
+    *(void**)ptr = p->free_list;
+    p->free_list = ptr;
+    if (p->used == c->per_page) {
+        partial_push(page);
+    }
+    p->used--;
+    if (p->used == 0) {
+        /* Hand the empty page back so any class can reuse it. */
+        partial_remove(page);
+        page_run_release(page);
+    }
+}
+
+/**
+ * @brief Cap the number of pages in use. Pages in use beyond the limit stay
+ * until they are freed, but no new page is taken while at or above it.
+ *
+ * @param limit Max number of pages in use; clamped to [1, number of pages].
+ */
+void slab_set_page_limit(int limit)
+{
+    if (limit < 1) {
+        limit = 1;
+    }
+    if (limit > num_pages) {
+        limit = num_pages;
+    }
+    page_limit = limit;
+}
+
+/**
+ * @brief Get the max number of pages in use.
+ *
+ * @return int Page limit.
+ */
+int slab_get_page_limit(void)
+{
+    return page_limit;
+}
+
+/**
+ * @brief Get the number of pages in use, i.e. assigned to a class or a run.
+ *
+ * @return int Number of pages in use.
+ */
+int slab_pages_used(void)
+{
+    return num_pages - free_pages;
+}
+
+/**
+ * @brief Hand physical memory of free pages back to the kernel. A page that
+ * is used again is faulted back in zero-filled.
+ *
+ * @return size_t Bytes handed back.
+ */
+size_t slab_release_free_pages(void)
+{
+    size_t released = 0;
+
+    for (int i = 0; i < num_pages; ++i) {
+        if (pages[i].cls != PAGE_FREE || !pages[i].resident) {
+            continue;
+        }
+        if (madvise(arena + (size_t)i * SLAB_PAGE_SIZE,
+                    SLAB_PAGE_SIZE,
+                    MADV_DONTNEED) < 0) {
+            PLOG_ERROR("madvise");
+            break;
+        }
+        pages[i].resident = 0;
+        released += SLAB_PAGE_SIZE;
+    }
+    return released;
+}
+
+/**
+ * @brief Get the compact location of a chunk, i.e. its offset in the arena in
+ * units of SLAB_ALIGN. It addresses arenas of up to 64 GB.
+ *
+ * @param ptr Chunk returned by slab_alloc().
+ * @return uint32_t Location of the chunk.
+ */
+uint32_t slab_loc(const void* ptr)
+{
+    return ((const char*)ptr - arena) / SLAB_ALIGN;
+}
+
+/**
+ * @brief Get the chunk at the given compact location.
+ *
+ * @param loc Location returned by slab_loc().
+ * @return void* Pointer to the chunk.
+ */
+void* slab_ptr(uint32_t loc)
+{
+    return arena + (size_t)loc * SLAB_ALIGN;
+}
+
+/**
+ * @brief Get usage statistics of the arena.
+ *
+ * @param out_stats Output; statistics of the arena and each class.
+ */
+void slab_get_stats(struct slab_stats* out_stats)
+{
+    if (out_stats == NULL) {
+        return;
+    }
+    memset(out_stats, 0, sizeof(*out_stats));
+    if (arena == NULL) {
+        return;
+    }
+    out_stats->arena_size = (size_t)num_pages * SLAB_PAGE_SIZE;
+    out_stats->huge_pages = huge_pages;
+    out_stats->pages_total = num_pages;
+    out_stats->pages_free = free_pages;
+    out_stats->pages_limit = page_limit;
+    out_stats->num_classes = num_classes;
+    for (int i = 0; i <= num_classes; ++i) {
+        struct slab_class_stats* s = &out_stats->classes[i];
+
+        s->chunk_size = classes[i].chunk_size;
+        s->pages = classes[i].pages;
+        s->chunks_used = classes[i].used;
+        s->bytes_requested = classes[i].requested;
+        out_stats->bytes_requested += classes[i].requested;
+        out_stats->bytes_assigned += (size_t)classes[i].pages * SLAB_PAGE_SIZE;
+        if (i < num_classes) {
+            out_stats->bytes_allocated +=
+                (size_t)classes[i].used * classes[i].chunk_size;
+        }
+    }
+    /* Page runs are allocated in whole pages. */
+    out_stats->bytes_allocated +=
+        (size_t)classes[num_classes].pages * SLAB_PAGE_SIZE;
+}
@@ -0,0 +1,157 @@
+/**************************************************************
+*
+*                          slab.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-14
+*
+*     Summary:
+*     Interface for size-class slab allocator over one large
+*     arena, optionally backed by 2 MB huge pages.
+*
+**************************************************************/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_PAGE_SIZE (2 * 1024 * 1024) /* Byte size of a slab page, which
+                                          * matches a 2 MB huge page. */
+#define SLAB_MIN_CHUNK 64 /* Byte size of the smallest chunk. */
+#define SLAB_MAX_CHUNK (SLAB_PAGE_SIZE / 2) /* Byte size of the largest chunk;
+                                             * larger objects take a run of
+                                             * whole pages. */
+#define SLAB_MAX_CLASSES 63 /* Upper bound of the number of size classes, so
+                            * that a class index fits in 6 bits. */
+#define SLAB_ALIGN 16 /* Alignment of chunks. */
+
+struct slab_class_stats {
+    size_t chunk_size; /* Byte size of each chunk in this class. */
+    int pages; /* Number of pages assigned to this class. */
+    long chunks_used; /* Number of chunks in use. */
+    size_t bytes_requested; /* Sum of requested byte sizes of used chunks. */
+};
+
+struct slab_stats {
+    size_t arena_size; /* Byte size of the arena. */
+    int huge_pages; /* 1 if the arena is backed by explicit huge pages. */
+    int pages_total; /* Number of pages in the arena. */
+    int pages_free; /* Number of pages not assigned to any class. */
+    int pages_limit; /* Max number of pages in use. */
+    size_t bytes_requested; /* Logical bytes requested by live allocations. */
+    size_t bytes_allocated; /* Bytes of chunks or page runs handed out. */
+    size_t bytes_assigned; /* Bytes of pages assigned to classes. */
+    int num_classes; /* Number of small size classes. */
+    struct slab_class_stats classes[SLAB_MAX_CLASSES + 1]; /* The last valid
+                                                            * entry is for
+                                                            * page runs. */
+};
+
+/**
+ * @brief Map the arena and set up size classes.
+ *
+ * @param arena_size Byte size of the arena; rounded up to SLAB_PAGE_SIZE.
+ * @param use_huge_pages 1 to back the arena with explicit 2 MB huge pages,
+ * falling back to transparent huge pages if none are reserved; 0 otherwise.
+ * @return int 0 on success; -1 otherwise.
+ */
+int slab_init(size_t arena_size, int use_huge_pages);
+
+/**
+ * @brief Unmap the arena. All allocated chunks become invalid.
+ */
+void slab_clear(void);
+
+/**
+ * @brief Get the size class that serves the given byte size.
+ *
+ * @param size Byte size to allocate, > 0.
+ * @return int Index of size class; slab_large_class() for page runs; -1 if the
+ * size cannot fit in the arena.
+ */
+int slab_class_of(size_t size);
+
+/**
+ * @brief Get the index of the pseudo class for objects larger than
+ * SLAB_MAX_CHUNK, which take a run of whole pages.
+ *
+ * @return int Index of the page run class.
+ */
+int slab_large_class(void);
+
+/**
+ * @brief Allocate a chunk from the arena.
+ *
+ * @param size Byte size to allocate, > 0.
+ * @return void* Pointer to the chunk; NULL if neither the size class nor the
+ * free pages can serve it. The caller may evict from slab_class_of(size) and
+ * retry.
+ */
+void* slab_alloc(size_t size);
+
+/**
+ * @brief Return a chunk to the arena.
+ *
+ * @param ptr Chunk returned by slab_alloc(); NULL is ignored.
+ * @param size Byte size passed to slab_alloc() for this chunk.
+ */
+void slab_free(void* ptr, size_t size);
+
+/**
+ * @brief Cap the number of pages in use. Pages in use beyond the limit stay
+ * until they are freed, but no new page is taken while at or above it.
+ *
+ * @param limit Max number of pages in use; clamped to [1, number of pages].
+ */
+void slab_set_page_limit(int limit);
+
+/**
+ * @brief Get the max number of pages in use.
+ *
+ * @return int Page limit.
+ */
+int slab_get_page_limit(void);
+
+/**
+ * @brief Get the number of pages in use, i.e. assigned to a class or a run.
+ *
+ * @return int Number of pages in use.
+ */
+int slab_pages_used(void);
+
+/**
+ * @brief Hand physical memory of free pages back to the kernel. A page that
+ * is used again is faulted back in zero-filled.
+ *
+ * @return size_t Bytes handed back.
+ */
+size_t slab_release_free_pages(void);
+
+/**
+ * @brief Get the compact location of a chunk, i.e. its offset in the arena in
+ * units of SLAB_ALIGN. It addresses arenas of up to 64 GB.
+ *
+ * @param ptr Chunk returned by slab_alloc().
+ * @return uint32_t Location of the chunk.
+ */
+uint32_t slab_loc(const void* ptr);
+
+/**
+ * @brief Get the chunk at the given compact location.
+ *
+ * @param loc Location returned by slab_loc().
+ * @return void* Pointer to the chunk.
+ */
+void* slab_ptr(uint32_t loc);
+
+/**
+ * @brief Get usage statistics of the arena.
+ *
+ * @param out_stats Output; statistics of the arena and each class.
+ */
+void slab_get_stats(struct slab_stats* out_stats);
+
+#endif /* SLAB_H */
@@ -12,13 +12,14 @@
 **************************************************************/
 
 #include "sock_buf.h"
+#include "deadline.h"
 #include "logger.h"
+#include "netio.h"
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
 
 static struct sock_buf *sock_buf_arr[FD_SETSIZE];
-static const time_t TIMEOUT = 600; /* Timeout for idle socket buffer. */
 
 /**
  * @brief Create an empty socket message buffer array.
@@ -77,14 +78,50 @@ int sock_buf_add_client(int fd)
     }
     new_sock_buf->buf = NULL;
     new_sock_buf->size = 0;
-    new_sock_buf->last_input = time(NULL);
+    new_sock_buf->last_input = netio_now();
+    new_sock_buf->phase = DEADLINE_PHASE_HEAD; /* The request head is due
+                                                * from accept. */
+    new_sock_buf->phase_start = new_sock_buf->last_input;
+    new_sock_buf->phase_bytes = 0;
     new_sock_buf->is_client = 1;
     new_sock_buf->is_forward = 0;
     new_sock_buf->ssl = NULL;
     new_sock_buf->peer = -1;
     new_sock_buf->key = NULL;
+    new_sock_buf->host = NULL;
     new_sock_buf->is_chunked = 0;
+    memset(&new_sock_buf->addr, 0, sizeof(new_sock_buf->addr));
+    new_sock_buf->request = NULL;
+    new_sock_buf->request_len = 0;
+    new_sock_buf->sent_us = 0;
+    new_sock_buf->head_forwarded = 0;
+    new_sock_buf->filter_body = 0;
+    new_sock_buf->accepts_gzip = 0;
+    new_sock_buf->filter = NULL;
+    new_sock_buf->esi = 0;
+    new_sock_buf->esi_part = 0;
+    new_sock_buf->base_url = NULL;
+    new_sock_buf->esi_page = NULL;
+    new_sock_buf->page_head_len = 0;
+    new_sock_buf->held = NULL;
+    new_sock_buf->held_len = 0;
+    new_sock_buf->held_sent = 0;
+    new_sock_buf->held_status = 0;
+    new_sock_buf->held_head_len = 0;
+    new_sock_buf->request_us = 0;
+    new_sock_buf->hedge_at = 0;
+    new_sock_buf->hedge_peer = -1;
+    new_sock_buf->is_hedge = 0;
+    new_sock_buf->async_fd = -1;
+    new_sock_buf->handshake_us = 0;
+    new_sock_buf->version = NULL;
+    new_sock_buf->in_early_data = 0;
     sock_buf_arr[fd] = new_sock_buf;
+    deadline_arm(fd,
+                 new_sock_buf->phase,
+                 new_sock_buf->phase_start,
+                 new_sock_buf->last_input,
+                 0);
     return 1;
 }
 
@@ -113,17 +150,53 @@ int sock_buf_add_server(int fd, int client, char* key)
     }
     new_sock_buf->buf = NULL;
     new_sock_buf->size = 0;
-    new_sock_buf->last_input = time(NULL);
+    new_sock_buf->last_input = netio_now();
+    new_sock_buf->phase = DEADLINE_PHASE_FIRST_BYTE; /* A server is connected
+                                                      * for a request. */
+    new_sock_buf->phase_start = new_sock_buf->last_input;
+    new_sock_buf->phase_bytes = 0;
     new_sock_buf->is_client = 0;
     new_sock_buf->is_forward = 0;
     new_sock_buf->ssl = NULL;
     new_sock_buf->peer = client;
     new_sock_buf->key = NULL;
+    new_sock_buf->host = NULL;
     if (key != NULL) {
         new_sock_buf->key = strdup(key);
     }
     new_sock_buf->is_chunked = 0;
+    memset(&new_sock_buf->addr, 0, sizeof(new_sock_buf->addr));
+    new_sock_buf->request = NULL;
+    new_sock_buf->request_len = 0;
+    new_sock_buf->sent_us = 0;
+    new_sock_buf->head_forwarded = 0;
+    new_sock_buf->filter_body = 0;
+    new_sock_buf->accepts_gzip = 0;
+    new_sock_buf->filter = NULL;
+    new_sock_buf->esi = 0;
+    new_sock_buf->esi_part = 0;
+    new_sock_buf->base_url = NULL;
+    new_sock_buf->esi_page = NULL;
+    new_sock_buf->page_head_len = 0;
+    new_sock_buf->held = NULL;
+    new_sock_buf->held_len = 0;
+    new_sock_buf->held_sent = 0;
+    new_sock_buf->held_status = 0;
+    new_sock_buf->held_head_len = 0;
+    new_sock_buf->request_us = 0;
+    new_sock_buf->hedge_at = 0;
+    new_sock_buf->hedge_peer = -1;
+    new_sock_buf->is_hedge = 0;
+    new_sock_buf->async_fd = -1;
+    new_sock_buf->handshake_us = 0;
+    new_sock_buf->version = NULL;
+    new_sock_buf->in_early_data = 0;
     sock_buf_arr[fd] = new_sock_buf;
+    deadline_arm(fd,
+                 new_sock_buf->phase,
+                 new_sock_buf->phase_start,
+                 new_sock_buf->last_input,
+                 0);
     return 1;
 }
 
@@ -141,12 +214,18 @@ int sock_buf_rm(int fd)
 
     free(sock_buf_arr[fd]->buf);
     free(sock_buf_arr[fd]->key);
+    free(sock_buf_arr[fd]->host);
+    free(sock_buf_arr[fd]->request);
+    free(sock_buf_arr[fd]->version);
+    free(sock_buf_arr[fd]->base_url);
+    free(sock_buf_arr[fd]->held);
     if (sock_buf_arr[fd]->ssl != NULL) {
         SSL_shutdown(sock_buf_arr[fd]->ssl);
         SSL_free(sock_buf_arr[fd]->ssl);
     }
     free(sock_buf_arr[fd]);
     sock_buf_arr[fd] = NULL;
+    deadline_cancel(fd);
     return 1;
 }
 
@@ -235,27 +314,94 @@ int sock_buf_is_forward(int fd)
 }
 
 /**
- * @brief Update last_input of a socket to the current time
+ * @brief Set the deadline of a socket from its phase.
+ *
+ * @param fd Valid FD for socket with a buffer.
+ */
+static void arm_deadline(int fd)
+{
+    struct sock_buf* sock_buf = sock_buf_arr[fd];
+
+    deadline_arm(fd,
+                 sock_buf->phase,
+                 sock_buf->phase_start,
+                 sock_buf->last_input,
+                 sock_buf->phase_bytes);
+}
+
+/**
+ * @brief Update last_input of a socket to the current time, count the
+ * received bytes, and move the socket to the phase the input starts: an idle
+ * client to receiving a request head, and a server yet to answer to sending
+ * its response. Its deadline follows.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
+ * @param size Byte size received.
  */
-void sock_buf_update_input_time(int fd){
+void sock_buf_update_input(int fd, int size)
+{
+    struct sock_buf* sock_buf = NULL;
+
     if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
         return;
     }
-    sock_buf_arr[fd]->last_input = time(NULL);
+    sock_buf = sock_buf_arr[fd];
+    sock_buf->last_input = netio_now();
+    if (sock_buf->phase == DEADLINE_PHASE_IDLE) {
+        sock_buf->phase = sock_buf->is_client ? DEADLINE_PHASE_HEAD :
+                          DEADLINE_PHASE_BODY;
+        sock_buf->phase_start = sock_buf->last_input;
+        sock_buf->phase_bytes = 0;
+    }
+    else if (sock_buf->phase == DEADLINE_PHASE_FIRST_BYTE) {
+        sock_buf->phase = DEADLINE_PHASE_BODY;
+        sock_buf->phase_start = sock_buf->last_input;
+        sock_buf->phase_bytes = 0;
+    }
+    sock_buf->phase_bytes += size;
+    arm_deadline(fd);
 }
 
 /**
- * @brief Whether the socket is timeout (current time - last_input > TIMEOUT).
+ * @brief Update last_input of a socket for output forwarded to it, which
+ * keeps an idle socket or tunnel alive.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
  */
-int sock_buf_is_timeout(int fd) {
+void sock_buf_touch(int fd)
+{
+    struct sock_buf* sock_buf = NULL;
+
     if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
-        return 0;
+        return;
+    }
+    sock_buf = sock_buf_arr[fd];
+    if (sock_buf->last_input != netio_now()) {
+        sock_buf->last_input = netio_now();
+        if (sock_buf->phase == DEADLINE_PHASE_IDLE ||
+            sock_buf->phase == DEADLINE_PHASE_TUNNEL) {
+            arm_deadline(fd);
+        }
+    }
+}
+
+/**
+ * @brief Move a socket to a phase starting now, and set its deadline.
+ *
+ * @param fd FD for socket.
+ * @param phase enum deadline_phase.
+ */
+void sock_buf_set_phase(int fd, int phase)
+{
+    struct sock_buf* sock_buf = NULL;
+
+    if (!is_valid_fd(fd) || sock_buf_arr[fd] == NULL) {
+        return;
     }
-    return time(NULL) - sock_buf_arr[fd]->last_input > TIMEOUT;
+    sock_buf = sock_buf_arr[fd];
+    sock_buf->phase = phase;
+    sock_buf->phase_start = netio_now();
+    sock_buf->last_input = sock_buf->phase_start;
+    sock_buf->phase_bytes = 0;
+    arm_deadline(fd);
 }
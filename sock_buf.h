@@ -14,20 +14,71 @@
 #ifndef SOCK_BUF_H
 #define SOCK_BUF_H
 
+#include <netinet/in.h>
 #include <time.h>
 #include <openssl/ssl.h>
 
+struct esi_page;
+struct filter_stream;
+
 struct sock_buf {
     char* buf; /* Buffer for plaintext received from the socket. */
     int size; /* Byte size of buffered data. */
-    time_t last_input; /* Time for the last input to the buffer. */
+    time_t last_input; /* Time for the last input to the buffer, or output
+                        * forwarded to the socket. */
+    int phase; /* enum deadline_phase of the socket. */
+    time_t phase_start; /* Time the phase started. */
+    long phase_bytes; /* Byte size received in the phase. */
     int is_client; /* Whether the socket is for a client. */
     int is_forward; /* Whether simply forward data to its peer. */
     SSL* ssl; /* SSL structure for SSL/TLS connection. */
     int peer; /* Socket FD for the other end of the connection regardless of
                * proxy. */
     char* key; /* Key for the cached server response. */
+    char* host; /* Hostname of a server, which owns its cached response. */
     int is_chunked; /* 1 for "Transfer-Encoding: chunked"; 0 otherwise. */
+    struct sockaddr_in addr; /* Address a server is connected to. */
+    char* request; /* Copy of the request sent to a server, kept to hedge
+                    * it; NULL if it is not hedged. */
+    int request_len; /* Byte size of request. */
+    long sent_us; /* Time in microseconds the request was sent to a server;
+                   * 0 once its first byte arrived, or if untimed. */
+    long request_us; /* Time in microseconds a client's latest request was
+                      * parsed, which its response is traced against. */
+    long hedge_at; /* Time in microseconds to hedge the request; 0 if
+                    * never. */
+    int hedge_peer; /* Socket FD of the other attempt of a hedged request; -1
+                     * if none. */
+    int is_hedge; /* Whether the server is connected for a hedge. */
+    int async_fd; /* FD that signals the end of the private key operation a
+                   * client's handshake waits for; -1 if none. */
+    long handshake_us; /* Time in microseconds the handshake of a socket
+                        * started. */
+    char* version; /* HTTP version of the CONNECT request a server's handshake
+                    * is for, to answer once it is done; NULL otherwise. */
+    int in_early_data; /* Whether a client's handshake may still carry TLS
+                        * early data. */
+    int head_forwarded; /* Whether the head of a server's current response
+                         * went to its client, after response plugins. */
+    int filter_body; /* Whether a server's response may go through the
+                      * filters, i.e. it answers a GET. */
+    int accepts_gzip; /* Whether the client of a server accepts gzip. */
+    struct filter_stream* filter; /* Filters of a server's current response;
+                                   * NULL if it passes as is. */
+    int esi; /* enum esi_role of a server's response. */
+    int esi_part; /* Index of the include a fragment server fetches. */
+    char* base_url; /* Absolute URL of the GET a server answers, which
+                     * includes of a shell resolve against; NULL if none. */
+    struct esi_page* esi_page; /* Page being assembled for a client; NULL if
+                                * none. */
+    int page_head_len; /* Byte size of the head of the page, with its empty
+                        * line. */
+    char* held; /* Rest of a cached body held for a client, which goes out a
+                 * quantum per round of the main loop; NULL if none. */
+    int held_len; /* Byte size of held. */
+    int held_sent; /* Byte size of held sent so far. */
+    int held_status; /* Status code of the response whose body is held. */
+    int held_head_len; /* Byte size of the head of that response. */
 };
 
 /**
@@ -119,20 +170,30 @@ int sock_buf_buffer(int fd, char* data, int size);
 int sock_buf_is_forward(int fd);
 
 /**
- * @brief Update last_input of a socket to the current time
+ * @brief Update last_input of a socket to the current time, count the
+ * received bytes, and move the socket to the phase the input starts: an idle
+ * client to receiving a request head, and a server yet to answer to sending
+ * its response. Its deadline follows.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
+ * @param size Byte size received.
  */
-void sock_buf_update_input_time(int fd);
+void sock_buf_update_input(int fd, int size);
 
+/**
+ * @brief Update last_input of a socket for output forwarded to it, which
+ * keeps an idle socket or tunnel alive.
+ *
+ * @param fd FD for socket.
+ */
+void sock_buf_touch(int fd);
 
 /**
- * @brief Whether the socket is timeout (current time - last_input > TIMEOUT).
+ * @brief Move a socket to a phase starting now, and set its deadline.
  *
  * @param fd FD for socket.
- * @return int 1 if it should simply forward the data; 0 otherwise.
+ * @param phase enum deadline_phase.
  */
-int sock_buf_is_timeout(int fd);
+void sock_buf_set_phase(int fd, int phase);
 
 #endif /* SOCK_BUF_H */
@@ -0,0 +1,254 @@
+/**************************************************************
+*
+*                      test_access_log.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-02
+*
+*     Summary:
+*     Test driver for the access log.
+*
+**************************************************************/
+
+#include "access_log.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOG_PATH "/tmp/test_access_log.bin" /* Log file of the tests. */
+
+static struct access_record rows[ACCESS_LOG_BLOCK_ROWS]; /* Records read. */
+
+/**
+ * @brief Remove the log file and its rotated files.
+ */
+void remove_logs(void)
+{
+    char path[64];
+
+    unlink(LOG_PATH);
+    for (int i = 1; i <= ACCESS_LOG_KEEP + 1; ++i) {
+        snprintf(path, sizeof(path), "%s.%d", LOG_PATH, i);
+        unlink(path);
+    }
+}
+
+/**
+ * @brief Log a request of a client, from its parse to its response.
+ *
+ * @param fd FD for client socket.
+ * @param host Host.
+ * @param url URL.
+ * @param start_us Time in microseconds the request is parsed.
+ */
+void log_request(int fd, const char* host, const char* url, long start_us)
+{
+    access_log_begin(fd, "GET", host, url, start_us);
+    access_log_cache(fd, ACCESS_CACHE_MISS);
+    access_log_connect(fd, 300);
+    access_log_connect(fd, 900);
+    access_log_first_byte(fd, start_us + 1000);
+    access_log_first_byte(fd, start_us + 2000);
+    access_log_end(fd, 200, 5000, start_us + 2500);
+}
+
+void test_access_log_round_trip(void)
+{
+    struct access_log_config config = {LOG_PATH, 1 << 30, 2, 1};
+    struct access_log_stats stats;
+    struct sockaddr_in addr;
+    FILE* file;
+    long start_us = 1000000;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST access_log round trip\n");
+    remove_logs();
+    assert(access_log_open(&config, start_us) == 0);
+    assert(access_log_is_open());
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_addr.s_addr = inet_addr("10.1.2.3");
+    access_log_accept(5, &addr);
+    log_request(5, "example.com", "/a", start_us + 10);
+
+    /* A cache hit has no connect or first byte. */
+    access_log_begin(5, "HEAD", "other.org", "/b", start_us + 20);
+    access_log_cache(5, ACCESS_CACHE_HIT);
+    access_log_end(5, 304, 100, start_us + 50);
+
+    /* A request answered by no response is dropped. */
+    access_log_begin(6, "POST", "example.com", "/c", start_us + 30);
+    access_log_begin(6, "BREW", "example.com", "/d", start_us + 40);
+    access_log_end(6, 0, 0, start_us + 60);
+    access_log_end(6, 200, 10, start_us + 70);
+
+    /* Nothing is written until a block is due. */
+    access_log_tick(start_us + 100);
+    access_log_get_stats(&stats);
+    assert(stats.records == 0);
+    access_log_tick(start_us + 2 * ACCESS_LOG_FLUSH_INTERVAL * 1000000L);
+    access_log_get_stats(&stats);
+    assert(stats.records == 3);
+    assert(stats.blocks == 1);
+    assert(stats.unanswered == 1);
+    access_log_close();
+    assert(!access_log_is_open());
+
+    file = access_log_read_open(LOG_PATH);
+    assert(file != NULL);
+    assert(access_log_read(file, rows) == 3);
+    assert(rows[0].time_us - rows[1].time_us == -10);
+    assert(rows[0].client == inet_addr("10.1.2.3"));
+    assert(strcmp(rows[0].host, "example.com") == 0);
+    assert(rows[0].path_hash == access_log_hash("/a"));
+    assert(rows[0].method == ACCESS_METHOD_GET);
+    assert(rows[0].status == 200);
+    assert(rows[0].cache == ACCESS_CACHE_MISS);
+    assert(rows[0].bytes == 5000);
+    assert(rows[0].connect_us == 300);
+    assert(rows[0].first_byte_us == 1000);
+    assert(rows[0].total_us == 2500);
+    assert(strcmp(rows[1].host, "other.org") == 0);
+    assert(rows[1].method == ACCESS_METHOD_HEAD);
+    assert(rows[1].status == 304);
+    assert(rows[1].cache == ACCESS_CACHE_HIT);
+    assert(rows[1].connect_us == 0);
+    assert(rows[1].first_byte_us == 0);
+    assert(rows[1].total_us == 30);
+    assert(rows[2].method == ACCESS_METHOD_OTHER);
+    assert(rows[2].status == 0);
+    assert(rows[2].cache == ACCESS_CACHE_NONE);
+    assert(rows[2].path_hash == access_log_hash("/d"));
+    assert(access_log_read(file, rows) == 0);
+    fclose(file);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_access_log_blocks(void)
+{
+    struct access_log_config config = {LOG_PATH, 1 << 30, 2, 1};
+    struct access_log_stats stats;
+    char host[32];
+    FILE* file;
+    int total = 0;
+    int n;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST access_log blocks\n");
+    remove_logs();
+    assert(access_log_open(&config, 0) == 0);
+
+    /* A full block is written at once, and its columns deflate. */
+    for (int i = 0; i < ACCESS_LOG_BLOCK_ROWS + 10; ++i) {
+        snprintf(host, sizeof(host), "host%d.example.com", i % 7);
+        log_request(10 + i % 100, host, "/index.html", i * 1000L);
+    }
+    access_log_get_stats(&stats);
+    assert(stats.records == ACCESS_LOG_BLOCK_ROWS);
+    assert(stats.blocks == 1);
+    assert(stats.stored_bytes < stats.raw_bytes / 4);
+    access_log_close();
+    access_log_get_stats(&stats);
+    assert(stats.records == ACCESS_LOG_BLOCK_ROWS + 10);
+
+    file = access_log_read_open(LOG_PATH);
+    assert(file != NULL);
+    while ((n = access_log_read(file, rows)) > 0) {
+        for (int r = 0; r < n; ++r) {
+            snprintf(host,
+                     sizeof(host),
+                     "host%d.example.com",
+                     (total + r) % 7);
+            assert(strcmp(rows[r].host, host) == 0);
+        }
+        total += n;
+    }
+    assert(n == 0);
+    assert(total == ACCESS_LOG_BLOCK_ROWS + 10);
+    fclose(file);
+
+    /* Reopening appends to the file. */
+    assert(access_log_open(&config, 0) == 0);
+    log_request(5, "example.com", "/", 0);
+    access_log_close();
+    file = access_log_read_open(LOG_PATH);
+    assert(access_log_read(file, rows) == ACCESS_LOG_BLOCK_ROWS);
+    assert(access_log_read(file, rows) == 10);
+    assert(access_log_read(file, rows) == 1);
+    assert(access_log_read(file, rows) == 0);
+    fclose(file);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_access_log_rotate(void)
+{
+    struct access_log_config config = {LOG_PATH, 1500, 2, 0};
+    struct access_log_stats stats;
+    FILE* file;
+    FILE* raw;
+    char path[64];
+    char junk[8] = "PXALjunk";
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST access_log rotate\n");
+    remove_logs();
+    assert(access_log_open(&config, 0) == 0);
+
+    /* Each block of 20 records takes more than half of the rotate size. */
+    for (int b = 0; b < 4; ++b) {
+        for (int i = 0; i < 20; ++i) {
+            log_request(5, "example.com", "/", b * 100 + i);
+        }
+        assert(access_log_flush() == 0);
+    }
+    access_log_get_stats(&stats);
+    assert(stats.blocks == 4);
+    assert(stats.rotations == 3);
+    assert(stats.stored_bytes > stats.raw_bytes);
+    access_log_close();
+
+    /* Two rotated files are kept, each with one block. */
+    snprintf(path, sizeof(path), "%s.2", LOG_PATH);
+    file = access_log_read_open(path);
+    assert(file != NULL);
+    assert(access_log_read(file, rows) == 20);
+    assert(rows[0].total_us == 2500);
+    assert(access_log_read(file, rows) == 0);
+    fclose(file);
+    snprintf(path, sizeof(path), "%s.3", LOG_PATH);
+    assert(access_log_read_open(path) == NULL);
+
+    /* A block cut short reads as corrupt. */
+    assert(truncate(LOG_PATH, ACCESS_LOG_HEAD_SIZE + 30) == 0);
+    file = access_log_read_open(LOG_PATH);
+    assert(file != NULL);
+    assert(access_log_read(file, rows) == -1);
+    fclose(file);
+
+    /* Another format is refused. */
+    raw = fopen(LOG_PATH, "wb");
+    fwrite(junk, sizeof(junk), 1, raw);
+    fwrite(junk, sizeof(junk), 1, raw);
+    fclose(raw);
+    assert(access_log_read_open(LOG_PATH) == NULL);
+    remove_logs();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_access_log_round_trip();
+    test_access_log_blocks();
+    test_access_log_rotate();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
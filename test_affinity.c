@@ -0,0 +1,133 @@
+/**************************************************************
+*
+*                       test_affinity.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-24
+*
+*     Summary:
+*     Test driver for placing worker processes on CPUs.
+*
+**************************************************************/
+
+#define _GNU_SOURCE /* For sched_getaffinity() and CPU_COUNT(). */
+#include "affinity.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void test_affinity_pin(void)
+{
+    cpu_set_t saved;
+    cpu_set_t set;
+    int cpu;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST affinity_pin()\n");
+    assert(affinity_num_cpus() >= 1);
+    assert(sched_getaffinity(0, sizeof(saved), &saved) == 0);
+
+    /* Pin to the CPU we are on, which is allowed. */
+    cpu = affinity_current_cpu();
+    assert(cpu >= 0 && cpu < CPU_SETSIZE);
+    assert(affinity_pin(cpu) == 0);
+    assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+    assert(CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set));
+    assert(affinity_current_cpu() == cpu);
+    assert(affinity_cpu_node(cpu) >= -1);
+    assert(affinity_cpu_node(CPU_SETSIZE) == -1);
+
+    /* A CPU that does not exist cannot be pinned. */
+    if (affinity_num_cpus() < CPU_SETSIZE) {
+        assert(affinity_pin(CPU_SETSIZE - 1) == -1);
+    }
+    assert(sched_setaffinity(0, sizeof(saved), &saved) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/**
+ * @brief Find a port that is free to listen on.
+ *
+ * @return int Port.
+ */
+static int free_port(void)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    assert(sock >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    assert(getsockname(sock, (struct sockaddr*)&addr, &len) == 0);
+    close(sock);
+    return ntohs(addr.sin_port);
+}
+
+void test_affinity_listen_group(void)
+{
+    int socks[3];
+    int port = free_port();
+    struct sockaddr_in addr;
+    struct pollfd fds[3];
+    int accepted = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST affinity_listen_group()\n");
+    assert(affinity_listen_group(port, 16, socks, 3) == 0);
+
+    /* Connections arrive at the sockets of the group. */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 6; ++i) {
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+
+        assert(connect(client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        for (int j = 0; j < 3; ++j) {
+            fds[j].fd = socks[j];
+            fds[j].events = POLLIN;
+        }
+        assert(poll(fds, 3, 1000) > 0);
+        for (int j = 0; j < 3; ++j) {
+            int sock = accept(socks[j], NULL, NULL);
+
+            if (sock >= 0) {
+                /* Busy polling may need CAP_NET_ADMIN. */
+                assert(affinity_busy_poll(sock, 50) == 0 || errno == EPERM);
+                close(sock);
+                accepted++;
+            }
+        }
+        close(client);
+    }
+    assert(accepted == 6);
+    for (int j = 0; j < 3; ++j) {
+        close(socks[j]);
+    }
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_affinity_pin();
+    test_affinity_listen_group();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
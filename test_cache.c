@@ -12,7 +12,9 @@
 **************************************************************/
 
 #include "cache.h"
+#include "slab.h"
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,10 +24,18 @@ struct cache_elem {
     char* key;
     char* val;
     int val_len; /* Byte size of val. */
+    int size; /* Byte size of the chunk requested for this element. */
     time_t creation_time; /* Creation time in seconds. */
     time_t max_age; /* Time-to-live in seconds. */
+    uint64_t hash; /* Hash of key. */
     struct cache_elem* next;
     struct cache_elem* prev;
+    struct cache_elem* class_next; /* Next element in the same size class. */
+    struct cache_elem* class_prev; /* Previous element in the same size
+                                    * class. */
+    struct cache_elem* host_next; /* Next element of the same host. */
+    struct cache_elem* host_prev; /* Previous element of the same host. */
+    int host; /* Index of the host of this element in the host table. */
 };
 typedef struct cache_elem cache_elem;
 
@@ -36,6 +46,7 @@ cache_elem* cache_elem_new(const char* key,
 void cache_elem_free(cache_elem** elem);
 time_t cache_elem_age(cache_elem* elem);
 int cache_elem_is_stale(cache_elem* elem);
+cache_elem* cache_force_get_elem(const char* key);
 
 void test_cache_elem_new_normal(void)
 {
@@ -306,10 +317,28 @@ struct cache {
     /* Doubly linked list of cache elements. */
     struct cache_elem* front;
     struct cache_elem* back;
+    struct cache_elem dummy_front;
+    struct cache_elem dummy_back;
+    /* Doubly linked list of cache elements of each size class. */
+    struct cache_elem* class_front[SLAB_MAX_CLASSES + 1];
+    struct cache_elem* class_back[SLAB_MAX_CLASSES + 1];
+    long val_bytes; /* Sum of val_len of all elements. */
+    long hits; /* Number of valid elements got. */
+    long misses; /* Number of keys not found or stale. */
+    long evictions; /* Number of valid elements evicted for space. */
+    void* index; /* Buckets of the index. */
+    uint32_t index_mask; /* Number of buckets - 1; a power of 2 - 1. */
+    long index_tombstones; /* Number of removed entries in the index. */
+    time_t epoch; /* Time that expiry times in the index count from. */
+    int policy; /* Eviction policy, CACHE_POLICY_LRU or CACHE_POLICY_CLOCK. */
+    void* hosts; /* Host table of CACHE_MAX_HOSTS slots. */
+    int num_hosts; /* Number of used slots in the host table. */
+    long host_quota; /* Default byte quota of each host; 0 for no quota. */
+    int over_front; /* First host in the over-quota list; -1 if empty. */
 };
 typedef struct cache cache;
 
-cache* the_cache; /* Global singleton cache declearation. */
+extern cache* the_cache; /* Global singleton cache declearation. */
 
 /* Assert that the cache is empty and in a valid state. */
 void assert_cache_empty(void)
@@ -398,7 +427,6 @@ void assert_cache_elem(const cache_elem* elem,
 
 void test_cache_put_add(void)
 {
-    time_t creation_time;
     char* key1;
     char* val1;
     int val_len1;
@@ -412,7 +440,6 @@ void test_cache_put_add(void)
 
     fprintf(stderr, "--------------------\n");
     fprintf(stderr, "TEST cache_put() add 2 elements\n");
-    creation_time = time(NULL);
     assert(cache_init(10) == 0);
 
     /* Add one element. */
@@ -424,8 +451,8 @@ void test_cache_put_add(void)
     assert(cache_put(key1, val1, val_len1, max_age1) == 1);
     assert(the_cache->size == 1);
     /* Check dummy front and back. */
-    assert_cache_elem(the_cache->front, NULL, NULL, 0, creation_time, 0);
-    assert_cache_elem(the_cache->back, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(the_cache->front, NULL, NULL, 0, 0, 0);
+    assert_cache_elem(the_cache->back, NULL, NULL, 0, 0, 0);
     /* Check elements. */
     assert_cache_elem(the_cache->front->next,
                       key1,
@@ -444,8 +471,8 @@ void test_cache_put_add(void)
     assert(cache_put(key2, val2, val_len2, max_age2) == 1);
     assert(the_cache->size == 2);
     /* Check dummy front and back. */
-    assert_cache_elem(the_cache->front, NULL, NULL, 0, creation_time, 0);
-    assert_cache_elem(the_cache->back, NULL, NULL, 0, creation_time, 0);
+    assert_cache_elem(the_cache->front, NULL, NULL, 0, 0, 0);
+    assert_cache_elem(the_cache->back, NULL, NULL, 0, 0, 0);
     /* Check elements. */
     assert_cache_elem(the_cache->front->next,
                       key2,
@@ -466,20 +493,395 @@ void test_cache_put_add(void)
     fprintf(stderr, "--------------------\n");
 }
 
+void test_cache_put_arena_full(void)
+{
+    struct cache_config config;
+    struct cache_stats stats;
+    char* val;
+    char key[32];
+    int val_len;
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() arena full\n");
+    /* 2 pages, each holds 2 chunks of the largest class. */
+    config.capacity = 100;
+    config.arena_size = 2 * SLAB_PAGE_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 0;
+    assert(cache_init_config(&config) == 0);
+    val_len = SLAB_MAX_CHUNK - 1024;
+    val = malloc(val_len);
+    assert(val != NULL);
+    for (int i = 0; i < 10; ++i) {
+        memset(val, 'a' + i, val_len);
+        sprintf(key, "key%d", i);
+        assert(cache_put(key, val, val_len, 100) == 1);
+    }
+    assert(cache_get_stats(&stats) == 0);
+    assert(stats.size == 4);
+    assert(stats.evictions == 6);
+    assert(stats.logical_bytes == 4L * val_len);
+    assert(stats.allocated_bytes <= stats.assigned_bytes);
+    assert(stats.assigned_bytes <= stats.arena_bytes);
+    /* The most recent ones survive. */
+    assert(cache_get("key9", &out_val, &out_val_len, &out_age) == 1);
+    assert(out_val_len == val_len);
+    assert(out_val[0] == 'a' + 9);
+    free(out_val);
+    out_val = NULL;
+    assert(cache_get("key0", &out_val, &out_val_len, &out_age) == 0);
+    assert(out_val == NULL);
+
+    /* A small value takes a page from the large values. */
+    assert(cache_put("small", "value", 6, 100) == 1);
+    assert(cache_get("small", &out_val, &out_val_len, &out_age) == 1);
+    assert(strcmp(out_val, "value") == 0);
+    free(out_val);
+    out_val = NULL;
+
+    /* Values larger than the arena are rejected. */
+    free(val);
+    val_len = 3 * SLAB_PAGE_SIZE;
+    val = calloc(val_len, 1);
+    assert(val != NULL);
+    assert(cache_put("huge", val, val_len, 100) == 0);
+    free(val);
+    val = NULL;
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_many(void)
+{
+    struct cache_stats stats;
+    char key[32];
+    char val[32];
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+    int capacity = 1000;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put() many elements through the index\n");
+    assert(cache_init(capacity) == 0);
+    /* Churn through many more keys than capacity, which leaves tombstones in
+     * the index and forces it to be rebuilt. */
+    for (int i = 0; i < 20 * capacity; ++i) {
+        sprintf(key, "key%d", i);
+        sprintf(val, "val%d", i);
+        assert(cache_put(key, val, strlen(val) + 1, 100) == 1);
+    }
+    assert(cache_get_stats(&stats) == 0);
+    assert(stats.size == capacity);
+    assert(stats.index_tombstones < capacity);
+    assert(stats.index_bytes % 64 == 0);
+    for (int i = 0; i < 20 * capacity; ++i) {
+        sprintf(key, "key%d", i);
+        sprintf(val, "val%d", i);
+        if (i < 19 * capacity) {
+            assert(cache_get(key, &out_val, &out_val_len, &out_age) == 0);
+            continue;
+        }
+        assert(cache_get(key, &out_val, &out_val_len, &out_age) == 1);
+        assert(strcmp(out_val, val) == 0);
+        free(out_val);
+        out_val = NULL;
+    }
+    /* Update keeps one element per key. */
+    assert(cache_put("key19999", "new", 4, 100) == 1);
+    assert(cache_get("key19999", &out_val, &out_val_len, &out_age) == 1);
+    assert(strcmp(out_val, "new") == 0);
+    free(out_val);
+    out_val = NULL;
+    assert(cache_get_stats(&stats) == 0);
+    assert(stats.size == capacity);
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_host_quota(void)
+{
+    struct cache_host_stats stats;
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put_host() over quota\n");
+    assert(cache_init(4) == 0);
+    /* Host "a" is above its quota as soon as it holds anything. */
+    assert(cache_set_host_quota("a", 1) == 0);
+    assert(cache_put_host("b", "b1", "1", 2, 100) == 1);
+    assert(cache_put_host("a", "a1", "1", 2, 100) == 1);
+    assert(cache_put_host("a", "a2", "2", 2, 100) == 1);
+    assert(cache_put_host("a", "a3", "3", 2, 100) == 1);
+    /* "b1" is least recently used, but "a1" is evicted. */
+    assert(cache_put_host("b", "b2", "2", 2, 100) == 1);
+    assert(cache_get_host("a", "a1", &out_val, &out_val_len, &out_age) == 0);
+    assert(cache_get_host("b", "b1", &out_val, &out_val_len, &out_age) == 1);
+    free(out_val);
+    out_val = NULL;
+
+    assert(cache_get_host_stats("a", &stats) == 0);
+    assert(strcmp(stats.name, "a") == 0);
+    assert(stats.objects == 2);
+    assert(stats.quota == 1);
+    assert(stats.evictions == 1);
+    assert(stats.hits == 0 && stats.misses == 1);
+    assert(cache_get_host_stats("b", &stats) == 0);
+    assert(stats.objects == 2);
+    assert(stats.quota == 0);
+    assert(stats.evictions == 0);
+    assert(stats.hits == 1 && stats.misses == 0);
+    assert(cache_get_host_stats("c", &stats) == -1);
+
+    /* Without a quota, "a" falls back to plain LRU. */
+    assert(cache_set_host_quota("a", 0) == 0);
+    assert(cache_put_host("c", "c1", "1", 2, 100) == 1);
+    assert(cache_get_host("a", "a2", &out_val, &out_val_len, &out_age) == 0);
+    assert(cache_get_host_stats("b", &stats) == 0);
+    assert(stats.objects == 2);
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_put_host_recycle(void)
+{
+    struct cache_config config;
+    struct cache_host_stats stats;
+    char host[32];
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_put_host() past the host table\n");
+    config.capacity = 4;
+    config.arena_size = 4 * SLAB_PAGE_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 1000;
+    assert(cache_init_config(&config) == 0);
+    /* A host with an explicit quota keeps its slot without elements. */
+    assert(cache_set_host_quota("pinned", 2000) == 0);
+    assert(cache_put_host("pinned", "p1", "1", 2, 100) == 1);
+
+    /* Lookups of unknown hosts take no slot. */
+    for (int i = 0; i < 2000; ++i) {
+        sprintf(host, "get%d", i);
+        assert(cache_get_host(host, "k", &out_val, &out_val_len,
+                              &out_age) == 0);
+    }
+    assert(cache_get_host_stats("get0", &stats) == -1);
+    assert(cache_get_host_stats(NULL, &stats) == 0);
+    assert(stats.misses == 2000);
+
+    /* Each host gives its slot back once its element is evicted. */
+    for (int i = 0; i < 2000; ++i) {
+        sprintf(host, "put%d", i);
+        assert(cache_put_host(host, host, "1", 2, 100) == 1);
+    }
+    assert(cache_get_host_stats("put0", &stats) == -1);
+    assert(cache_get_host_stats("put1999", &stats) == 0);
+    assert(stats.objects == 1);
+    assert(cache_get_host_stats("pinned", &stats) == 0);
+    assert(stats.objects == 0 && stats.quota == 2000);
+
+    /* A new host still gets its own slot and the default quota. */
+    assert(cache_put_host("new", "n1", "1", 2, 100) == 1);
+    assert(cache_get_host_stats("new", &stats) == 0);
+    assert(strcmp(stats.name, "new") == 0);
+    assert(stats.objects == 1 && stats.quota == 1000);
+    assert(cache_get_host_stats(NULL, &stats) == 0);
+    assert(stats.objects == 0);
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_shrink(void)
+{
+    struct cache_config config;
+    struct cache_stats stats;
+    char* val;
+    char key[16];
+    int val_len = SLAB_MAX_CHUNK - 1024; /* Two elements per page. */
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_shrink()\n");
+    config.capacity = 100;
+    config.arena_size = 4 * SLAB_PAGE_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 0;
+    assert(cache_init_config(&config) == 0);
+    val = calloc(val_len, 1);
+    assert(val != NULL);
+    for (int i = 0; i < 8; ++i) {
+        sprintf(key, "%d", i);
+        assert(cache_put(key, val, val_len, 100) == 1);
+    }
+    assert(cache_shrink(1) == 0);
+
+    /* Lower the budget to one page; each batch evicts one element. */
+    assert(cache_set_budget(SLAB_PAGE_SIZE) == 0);
+    cache_get_stats(&stats);
+    assert(stats.budget_bytes == SLAB_PAGE_SIZE);
+    assert(stats.size == 8);
+    for (int i = 0; i < 5; ++i) {
+        assert(cache_shrink(1) == 1);
+    }
+    assert(cache_shrink(1) == 0);
+    cache_get_stats(&stats);
+    assert(stats.size == 2);
+    assert(stats.assigned_bytes == SLAB_PAGE_SIZE);
+    /* The most recently used elements survive. */
+    assert(cache_force_get_elem("7") != NULL);
+    assert(cache_force_get_elem("6") != NULL);
+    /* New elements evict within the budget. */
+    assert(cache_put("8", val, val_len, 100) == 1);
+    cache_get_stats(&stats);
+    assert(stats.size == 2);
+    assert(stats.assigned_bytes == SLAB_PAGE_SIZE);
+
+    /* Regrow. */
+    assert(cache_set_budget(4 * SLAB_PAGE_SIZE) == 0);
+    assert(cache_put("9", val, val_len, 100) == 1);
+    cache_get_stats(&stats);
+    assert(stats.size == 3);
+    free(val);
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
 void test_cache_put(void)
 {
     /* TODO */
     // test_cache_put_invalid_args();
     test_cache_put_add();
+    test_cache_put_arena_full();
+    test_cache_put_many();
+    test_cache_put_host_quota();
+    test_cache_put_host_recycle();
+    test_cache_shrink();
     // test_cache_put_update_valid();
     // test_cache_put_update_stale();
     // test_cache_put_full_clean_stale();
     // test_cache_put_full_pop_back();
 }
 
+/* Put keys "a", "b" and "c", get "a", then put "d" into a cache of 3. */
+void put_abc_get_a_put_d(int policy)
+{
+    struct cache_config config;
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+
+    config.capacity = 3;
+    config.arena_size = SLAB_PAGE_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = policy;
+    config.host_quota = 0;
+    assert(cache_init_config(&config) == 0);
+    assert(cache_put("a", "1", 2, 100) == 1);
+    assert(cache_put("b", "2", 2, 100) == 1);
+    assert(cache_put("c", "3", 2, 100) == 1);
+    assert(cache_get("a", &out_val, &out_val_len, &out_age) == 1);
+    free(out_val);
+    out_val = NULL;
+    if (policy == CACHE_POLICY_LRU) {
+        /* The hit moves "a" to the front. */
+        assert(strcmp(the_cache->front->next->key, "a") == 0);
+    }
+    else {
+        /* The hit does not touch the lists. */
+        assert(strcmp(the_cache->front->next->key, "c") == 0);
+        assert(strcmp(the_cache->back->prev->key, "a") == 0);
+    }
+    assert(cache_put("d", "4", 2, 100) == 1);
+    /* Either way, "b" is evicted and "a" survives. */
+    assert(cache_get("b", &out_val, &out_val_len, &out_age) == 0);
+    assert(cache_get("a", &out_val, &out_val_len, &out_age) == 1);
+    free(out_val);
+    out_val = NULL;
+    cache_clear();
+}
+
+void test_cache_get_lru(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_get() LRU policy\n");
+    put_abc_get_a_put_d(CACHE_POLICY_LRU);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_get_clock(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_get() CLOCK policy\n");
+    put_abc_get_a_put_d(CACHE_POLICY_CLOCK);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_cache_get_stale(void)
+{
+    struct cache_config config;
+    struct cache_stats stats;
+    char* out_val = NULL;
+    int out_val_len = 0;
+    int out_age = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST cache_get_stale()\n");
+    config.capacity = 3;
+    config.arena_size = SLAB_PAGE_SIZE;
+    config.use_huge_pages = 0;
+    config.policy = CACHE_POLICY_LRU;
+    config.host_quota = 0;
+    assert(cache_init_config(&config) == 0);
+    assert(cache_set_stale_grace(-1) == -1);
+
+    /* Within the grace period, a stale element is a miss but is kept. */
+    assert(cache_set_stale_grace(60) == 0);
+    assert(cache_put("a", "1", 2, 0) == 1);
+    assert(cache_get("a", &out_val, &out_val_len, &out_age) == 0);
+    assert(the_cache->size == 1);
+    assert(cache_get_stale("a", &out_val, &out_val_len, &out_age) == 1);
+    assert(out_val_len == 2 && strcmp(out_val, "1") == 0);
+    free(out_val);
+    out_val = NULL;
+    assert(cache_get_stale("b", &out_val, &out_val_len, &out_age) == 0);
+
+    /* Past the grace period, it is removed. */
+    assert(cache_set_stale_grace(0) == 0);
+    assert(cache_get_stale("a", &out_val, &out_val_len, &out_age) == 0);
+    assert(the_cache->size == 0);
+
+    assert(cache_get_stats(&stats) == 0);
+    assert(stats.stale_hits == 1);
+    assert(stats.hits == 0);
+    cache_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
 void test_cache_get(void)
 {
     /* TODO */
+    test_cache_get_lru();
+    test_cache_get_clock();
+    test_cache_get_stale();
 }
 
 void test_cache_clear(void)
@@ -490,10 +892,13 @@ void test_cache_clear(void)
 int main(void)
 {
     fprintf(stderr, "====================\n");
+    /* Elements are allocated from the cache arena. */
+    assert(cache_init(10) == 0);
     test_cache_elem_new();
     test_cache_elem_free();
     test_cache_elem_age();
     test_cache_elem_is_stale();
+    cache_clear();
 
     test_cache_init();
     test_cache_put();
@@ -0,0 +1,235 @@
+/**************************************************************
+*
+*                       test_compress.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-17
+*
+*     Summary:
+*     Test driver for gzip storage of cached responses.
+*
+**************************************************************/
+
+#include "compress.h"
+#include "http_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BODY_LEN 4000
+
+/* Build a response with the given content type and a compressible body. */
+char* make_response(const char* content_type, int* out_len)
+{
+    char* response = malloc(BODY_LEN + 256);
+    int n;
+
+    assert(response != NULL);
+    n = sprintf(response,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: %s\r\n"
+                "content-length: %d\r\n"
+                "ETag: \"v1\"\r\n"
+                "\r\n",
+                content_type,
+                BODY_LEN);
+    for (int i = 0; i < BODY_LEN; ++i) {
+        response[n + i] = "<p>hello, world</p>\n"[i % 20];
+    }
+    *out_len = n + BODY_LEN;
+    return response;
+}
+
+void test_find_header_field(void)
+{
+    const char* msg = "GET / HTTP/1.1\r\n"
+                      "Host: example.com\r\n"
+                      "accept-encoding:  gzip, br \r\n"
+                      "\r\n"
+                      "Body: not a header\r\n";
+    const char* value = NULL;
+    int value_len = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST find_header_field()\n");
+    assert(get_head_len(msg, strlen(msg)) == (int)strlen(msg) - 20);
+    assert(get_head_len(msg, 10) == -1);
+    assert(find_header_field(msg, strlen(msg), HTTP_HEADER_ACCEPT_ENCODING,
+                             &value, &value_len) == 1);
+    assert(value_len == 8 && strncmp(value, "gzip, br", 8) == 0);
+    assert(find_header_field(msg, strlen(msg), HTTP_HEADER_HOST,
+                             &value, &value_len));
+    assert(value_len == 11 && strncmp(value, "example.com", 11) == 0);
+    assert(!find_header_field(msg, strlen(msg), HTTP_HEADER_UNKNOWN,
+                              &value, &value_len));
+    assert(!find_header_field(msg, strlen(msg), HTTP_HEADER_CACHE_CONTROL,
+                              &value, &value_len));
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_compress_accepts_gzip(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST compress_accepts_gzip()\n");
+#define REQ(ae) "GET / HTTP/1.1\r\nAccept-Encoding: " ae "\r\n\r\n"
+    assert(compress_accepts_gzip(REQ("gzip"), strlen(REQ("gzip"))));
+    assert(compress_accepts_gzip(REQ("br, GZIP"), strlen(REQ("br, GZIP"))));
+    assert(compress_accepts_gzip(REQ("gzip;q=0.5"), strlen(REQ("gzip;q=0.5"))));
+    assert(!compress_accepts_gzip(REQ("gzip;q=0"), strlen(REQ("gzip;q=0"))));
+    assert(!compress_accepts_gzip(REQ("x-gzipped"), strlen(REQ("x-gzipped"))));
+    assert(!compress_accepts_gzip(REQ("identity"), strlen(REQ("identity"))));
+#undef REQ
+    assert(!compress_accepts_gzip("GET / HTTP/1.1\r\n\r\n", 18));
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_compress_roundtrip(void)
+{
+    struct compress_stats stats;
+    char* response;
+    int len;
+    char* stored = NULL;
+    int stored_len = 0;
+    char* raw = NULL;
+    int raw_len = 0;
+    const char* value;
+    int value_len;
+    int head_len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST compress_response() and compress_serve()\n");
+    response = make_response("text/html; charset=utf-8", &len);
+    assert(compress_response(response, len, &stored, &stored_len) == 1);
+    assert(stored_len < len / 4);
+    assert(find_header_field(stored, stored_len, HTTP_HEADER_CONTENT_ENCODING,
+                             &value, &value_len));
+    assert(value_len == 4 && strncmp(value, "gzip", 4) == 0);
+    assert(find_header_field(stored, stored_len, HTTP_HEADER_VARY,
+                             &value, &value_len));
+    assert(find_header_field(stored, stored_len, HTTP_HEADER_ETAG,
+                             &value, &value_len));
+    assert(value_len == 6 && strncmp(value, "W/\"v1\"", 6) == 0);
+    head_len = get_head_len(stored, stored_len);
+    assert(find_header_field(stored, stored_len, HTTP_HEADER_CONTENT_LENGTH,
+                             &value, &value_len));
+    assert(atoi(value) == stored_len - head_len);
+
+    /* Served as stored to a client that accepts gzip. */
+    assert(compress_serve(stored, stored_len, 1, &raw, &raw_len) == 0);
+    assert(raw == NULL);
+
+    /* Decompressed for other clients. */
+    assert(compress_serve(stored, stored_len, 0, &raw, &raw_len) == 1);
+    head_len = get_head_len(raw, raw_len);
+    assert(raw_len - head_len == BODY_LEN);
+    assert(memcmp(raw + head_len, response + len - BODY_LEN, BODY_LEN) == 0);
+    assert(!find_header_field(raw, raw_len, HTTP_HEADER_CONTENT_ENCODING,
+                              &value, &value_len));
+    assert(find_header_field(raw, raw_len, HTTP_HEADER_CONTENT_LENGTH,
+                             &value, &value_len));
+    assert(atoi(value) == BODY_LEN);
+    assert(strncmp(raw, "HTTP/1.1 200 OK\r\n", 17) == 0);
+
+    /* A response that is not gzip coded is served as stored. */
+    free(raw);
+    raw = NULL;
+    assert(compress_serve(response, len, 0, &raw, &raw_len) == 0);
+
+    compress_get_stats(&stats);
+    assert(stats.objects == 1);
+    assert(stats.raw_bytes == len);
+    assert(stats.stored_bytes == stored_len);
+    assert(stats.hits_direct == 1);
+    assert(stats.hits_inflated == 1);
+    compress_log_stats();
+
+    free(stored);
+    free(response);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_compress_skip(void)
+{
+    char* response;
+    int len;
+    char* stored = NULL;
+    int stored_len = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST compress_response() skip\n");
+    /* Not a textual content type. */
+    response = make_response("image/png", &len);
+    assert(compress_response(response, len, &stored, &stored_len) == 0);
+    free(response);
+    /* Incomplete body. */
+    response = make_response("application/json", &len);
+    assert(compress_response(response, len - 1, &stored, &stored_len) == 0);
+    /* Not 200 OK. */
+    memcpy(response + 9, "404", 3);
+    assert(compress_response(response, len, &stored, &stored_len) == 0);
+    assert(stored == NULL);
+    free(response);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/* Compress a response with the given Vary field, and check the stored one. */
+static void check_vary(const char* vary, const char* expected)
+{
+    char* response = malloc(BODY_LEN + 256);
+    char* stored = NULL;
+    int stored_len = 0;
+    const char* value;
+    int value_len;
+    int n;
+
+    assert(response != NULL);
+    n = sprintf(response,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/plain\r\n"
+                "%s"
+                "Content-Length: %d\r\n"
+                "\r\n",
+                vary,
+                BODY_LEN);
+    memset(response + n, 'a', BODY_LEN);
+    assert(compress_response(response, n + BODY_LEN, &stored,
+                             &stored_len) == 1);
+    assert(find_header_field(stored, stored_len, HTTP_HEADER_VARY,
+                             &value, &value_len));
+    assert(value_len == (int)strlen(expected));
+    assert(strncmp(value, expected, value_len) == 0);
+    free(stored);
+    free(response);
+}
+
+void test_compress_vary(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST compress_response() Vary\n");
+    check_vary("", "Accept-Encoding");
+    check_vary("Vary: Cookie\r\n", "Cookie, Accept-Encoding");
+    check_vary("vary: Origin, Cookie  \r\n", "Origin, Cookie, Accept-Encoding");
+    check_vary("Vary: Cookie, accept-encoding\r\n", "Cookie, accept-encoding");
+    check_vary("Vary: *\r\n", "*");
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_find_header_field();
+    test_compress_accepts_gzip();
+    test_compress_roundtrip();
+    test_compress_skip();
+    test_compress_vary();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
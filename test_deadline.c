@@ -0,0 +1,232 @@
+/**************************************************************
+*
+*                       test_deadline.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-21
+*
+*     Summary:
+*     Test driver for per-phase socket deadlines.
+*
+**************************************************************/
+
+#include "deadline.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void test_deadline_parse_option(void)
+{
+    struct deadline_config config;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST deadline_parse_option()\n");
+    deadline_init_config(&config);
+    assert(config.header == DEADLINE_HEADER);
+    assert(config.tunnel == DEADLINE_TUNNEL);
+
+    assert(deadline_parse_option(&config, "header=5") == 0);
+    assert(config.header == 5);
+    assert(deadline_parse_option(&config, "rate=100") == 0);
+    assert(config.min_rate == 100);
+    assert(deadline_parse_option(&config, "first_byte=0") == 0);
+    assert(config.first_byte == 0);
+    assert(deadline_parse_option(&config, "idle=300") == 0);
+    assert(config.idle == 300);
+
+    /* Malformed options leave the configuration as is. */
+    assert(deadline_parse_option(&config, "header") < 0);
+    assert(deadline_parse_option(&config, "header=") < 0);
+    assert(deadline_parse_option(&config, "header=-1") < 0);
+    assert(deadline_parse_option(&config, "header=5s") < 0);
+    assert(deadline_parse_option(&config, "head=5") < 0);
+    assert(deadline_parse_option(&config, "=5") < 0);
+    assert(config.header == 5);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_deadline_of(void)
+{
+    struct deadline_config config;
+    int reason;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST deadline_of()\n");
+    deadline_init_config(&config);
+
+    /* A request head is due from its start, however many bytes trickle. */
+    assert(deadline_of(&config, DEADLINE_PHASE_HEAD, 1000, 1009, 50, &reason) ==
+           1000 + DEADLINE_HEADER);
+    assert(reason == DEADLINE_REASON_HEADER);
+
+    /* Idle sockets and tunnels count from their last activity. */
+    assert(deadline_of(&config, DEADLINE_PHASE_IDLE, 1000, 1050, 0, &reason) ==
+           1050 + DEADLINE_IDLE);
+    assert(reason == DEADLINE_REASON_IDLE);
+    assert(deadline_of(&config, DEADLINE_PHASE_TUNNEL, 1000, 1050, 0,
+                       &reason) == 1050 + DEADLINE_TUNNEL);
+    assert(reason == DEADLINE_REASON_IDLE);
+
+    assert(deadline_of(&config, DEADLINE_PHASE_FIRST_BYTE, 1000, 1000, 0,
+                       &reason) == 1000 + DEADLINE_FIRST_BYTE);
+    assert(reason == DEADLINE_REASON_FIRST_BYTE);
+
+    /* A response is due within the body timeout of its last byte, and at the
+     * min rate after the grace period, whichever comes first. */
+    config.body = 30;
+    config.min_rate = 100;
+    assert(deadline_of(&config, DEADLINE_PHASE_BODY, 1000, 1005, 500,
+                       &reason) == 1000 + DEADLINE_RATE_GRACE + 5);
+    assert(reason == DEADLINE_REASON_RATE);
+    assert(deadline_of(&config, DEADLINE_PHASE_BODY, 1000, 1005, 100000,
+                       &reason) == 1005 + 30);
+    assert(reason == DEADLINE_REASON_BODY);
+    config.min_rate = 0;
+    assert(deadline_of(&config, DEADLINE_PHASE_BODY, 1000, 1005, 500,
+                       &reason) == 1005 + 30);
+    assert(reason == DEADLINE_REASON_BODY);
+
+    /* Deadlines turned off. */
+    config.body = 0;
+    assert(deadline_of(&config, DEADLINE_PHASE_BODY, 1000, 1005, 500,
+                       &reason) == 0);
+    config.header = 0;
+    assert(deadline_of(&config, DEADLINE_PHASE_HEAD, 1000, 1000, 0,
+                       &reason) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_deadline_heap(void)
+{
+    struct deadline_config config;
+    struct deadline_stats stats;
+    time_t when;
+    int reason;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST deadline_arm() and deadline_expire()\n");
+    deadline_init_config(&config);
+    config.header = 10;
+    config.first_byte = 20;
+    config.idle = 30;
+    deadline_init(&config);
+    assert(deadline_next(&when) < 0);
+
+    /* Deadlines 10, 20, ..., 80 s after 1000, armed out of order. */
+    for (int i = 0; i < 8; ++i) {
+        int fd = (i * 5) % 8 + 3;
+
+        deadline_arm(fd, DEADLINE_PHASE_IDLE, 1000, 1000 + fd * 10 - 60, 0);
+    }
+    assert(deadline_next(&when) == 3);
+    assert(when == 1000);
+
+    /* Re-arming moves a deadline both ways. */
+    deadline_arm(3, DEADLINE_PHASE_IDLE, 1000, 1100, 0);
+    assert(deadline_next(&when) == 4);
+    deadline_arm(10, DEADLINE_PHASE_HEAD, 900, 900, 0);
+    assert(deadline_next(&when) == 10);
+    assert(when == 910);
+
+    /* Cancelled deadlines never expire. */
+    deadline_cancel(5);
+    deadline_cancel(5);
+    deadline_cancel(-1);
+
+    /* Only deadlines before now expire, earliest first. */
+    assert(deadline_expire(910, &reason) < 0);
+    assert(deadline_expire(1021, &reason) == 10);
+    assert(reason == DEADLINE_REASON_HEADER);
+    assert(deadline_expire(1021, &reason) == 4);
+    assert(reason == DEADLINE_REASON_IDLE);
+    assert(deadline_expire(1021, &reason) < 0);
+    assert(deadline_expire(1200, &reason) == 6);
+    assert(deadline_expire(1200, &reason) == 7);
+    assert(deadline_expire(1200, &reason) == 8);
+    assert(deadline_expire(1200, &reason) == 9);
+    assert(deadline_expire(1200, &reason) == 3);
+    assert(deadline_expire(1200, &reason) < 0);
+    assert(deadline_next(&when) < 0);
+
+    /* A phase with no deadline cancels the old one. */
+    config.tunnel = 0;
+    deadline_init(&config);
+    deadline_arm(3, DEADLINE_PHASE_HEAD, 1000, 1000, 0);
+    deadline_arm(3, DEADLINE_PHASE_TUNNEL, 1000, 1000, 0);
+    assert(deadline_next(&when) < 0);
+
+    /* Kills are counted per reason. */
+    deadline_arm(3, DEADLINE_PHASE_FIRST_BYTE, 1000, 1000, 0);
+    assert(deadline_expire(2000, &reason) == 3);
+    deadline_count(DEADLINE_REASON_CONNECT);
+    deadline_get_stats(&stats);
+    assert(stats.kills[DEADLINE_REASON_FIRST_BYTE] == 1);
+    assert(stats.kills[DEADLINE_REASON_CONNECT] == 1);
+    assert(stats.kills[DEADLINE_REASON_HEADER] == 0);
+    deadline_log_stats();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_deadline_heap_random(void)
+{
+    time_t deadlines[256];
+    time_t when;
+    time_t last = 0;
+    int reason;
+    int fd;
+    int left = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST deadline heap order\n");
+    deadline_init(NULL);
+    srand(112);
+    for (int i = 0; i < 256; ++i) {
+        deadlines[i] = 0;
+    }
+    for (int i = 0; i < 10000; ++i) {
+        fd = rand() % 256;
+        if (rand() % 4 == 0) {
+            deadline_cancel(fd);
+            deadlines[fd] = 0;
+        }
+        else {
+            time_t idle = 1 + rand() % 1000;
+
+            deadline_arm(fd, DEADLINE_PHASE_IDLE, 0, idle, 0);
+            deadlines[fd] = idle + DEADLINE_IDLE;
+        }
+    }
+    for (int i = 0; i < 256; ++i) {
+        left += deadlines[i] > 0;
+    }
+
+    /* All live deadlines expire in order, each once, at its time. */
+    while ((fd = deadline_next(&when)) >= 0) {
+        assert(when >= last);
+        assert(deadlines[fd] == when);
+        assert(deadline_expire(when, &reason) < 0);
+        assert(deadline_expire(when + 1, &reason) == fd);
+        deadlines[fd] = 0;
+        last = when;
+        left--;
+    }
+    assert(left == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_deadline_parse_option();
+    test_deadline_of();
+    test_deadline_heap();
+    test_deadline_heap_random();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+/**************************************************************
+*
+*                          test_esi.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-06
+*
+*     Summary:
+*     Test driver for assembling pages with Edge Side Includes.
+*
+**************************************************************/
+
+#include "compress.h"
+#include "esi.h"
+#include "http_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OUT 65536 /* Max byte size of output of a page. */
+
+static char out[MAX_OUT]; /* Bytes handed to the sink. */
+static int out_len = 0; /* Byte size of out. */
+static int sink_fails = 0; /* Whether the sink fails. */
+
+/**
+ * @brief Sink that appends to out.
+ */
+static int sink(void* arg, const char* data, int len)
+{
+    (void)arg;
+    assert(len > 0 && out_len + len <= MAX_OUT);
+    if (sink_fails) {
+        return -1;
+    }
+    memcpy(out + out_len, data, len);
+    out_len += len;
+    return 0;
+}
+
+/**
+ * @brief Build a shell response of a body.
+ *
+ * @param body Null-terminated body.
+ * @return char* Null-terminated response. Caller is responsible to free it.
+ */
+static char* make_shell(const char* body)
+{
+    char* response = malloc(strlen(body) + 256);
+
+    assert(response != NULL);
+    sprintf(response,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/html\r\n"
+            "Surrogate-Control: max-age=60, content=\"ESI/1.0\"\r\n"
+            "Content-Length: %d\r\n"
+            "\r\n"
+            "%s",
+            (int)strlen(body),
+            body);
+    return response;
+}
+
+static void test_esi_parse(void)
+{
+    static const char* shells[] = {
+        "HTTP/1.1 200 OK\r\n"
+        "Surrogate-Control: content=\"ESI/1.0\"\r\n"
+        "\r\n",
+        "HTTP/1.1 200 OK\r\n"
+        "Surrogate-Control: max-age=60, Content=\"esi/1.0\"\r\n"
+        "\r\n",
+    };
+    static const char* others[] = {
+        "HTTP/1.1 200 OK\r\n"
+        "\r\n",
+        "HTTP/1.1 200 OK\r\n"
+        "Surrogate-Control: max-age=60\r\n"
+        "\r\n",
+        "HTTP/1.1 404 Not Found\r\n"
+        "Surrogate-Control: content=\"ESI/1.0\"\r\n"
+        "\r\n",
+    };
+    struct esi_page* page = NULL;
+    char body[4096];
+    char* response;
+    int n = 0;
+
+    fprintf(stderr, "TEST esi parse\n");
+    for (size_t i = 0; i < sizeof(shells) / sizeof(shells[0]); ++i) {
+        assert(esi_is_shell(shells[i], strlen(shells[i])) == 1);
+    }
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); ++i) {
+        assert(esi_is_shell(others[i], strlen(others[i])) == 0);
+    }
+
+    /* Literals around self-closing and closed includes. */
+    response = make_shell("<p><esi:include src=\"/a\"/>"
+                          "<esi:include src=\"b\"></esi:include></p>");
+    assert(esi_parse(response, strlen(response), &page) == 2);
+    assert(esi_num_parts(page) == 5);
+    assert(esi_src(page, 0) == NULL);
+    assert(strcmp(esi_src(page, 1), "/a") == 0);
+    assert(esi_src(page, 2) == NULL);
+    assert(strcmp(esi_src(page, 3), "b") == 0);
+    assert(esi_src(page, 4) == NULL);
+    esi_free(page);
+    free(response);
+
+    /* A shell without includes is one literal. */
+    response = make_shell("<p>static</p>");
+    assert(esi_parse(response, strlen(response), &page) == 0);
+    assert(esi_num_parts(page) == 1);
+    esi_free(page);
+    free(response);
+
+    /* Malformed includes fail the shell. */
+    response = make_shell("<esi:include src=\"/a\"");
+    assert(esi_parse(response, strlen(response), &page) == -1);
+    free(response);
+    response = make_shell("<esi:include href=\"/a\"/>");
+    assert(esi_parse(response, strlen(response), &page) == -1);
+    free(response);
+    response = make_shell("<esi:include src=\"\"/>");
+    assert(esi_parse(response, strlen(response), &page) == -1);
+    free(response);
+
+    /* So do too many includes. */
+    for (int i = 0; i <= ESI_MAX_INCLUDES; ++i) {
+        n += sprintf(body + n, "<esi:include src=\"/%d\"/>", i);
+    }
+    response = make_shell(body);
+    assert(esi_parse(response, strlen(response), &page) == -1);
+    free(response);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_esi_resolve(void)
+{
+    static const struct {
+        const char* src;
+        const char* base;
+        const char* url;
+        const char* host;
+    } cases[] = {
+        {"http://f.example/x", "http://a.example/p/q", "http://f.example/x",
+         "f.example"},
+        {"/x?y=1", "http://a.example:8080/p/q", "http://a.example:8080/x?y=1",
+         "a.example:8080"},
+        {"x", "http://a.example/p/q?r=/s", "http://a.example/p/x",
+         "a.example"},
+        {"x", "http://a.example/p/", "http://a.example/p/x", "a.example"},
+        {"x", "http://a.example", "http://a.example/x", "a.example"},
+        {"/x", "http://a.example", "http://a.example/x", "a.example"},
+    };
+    char* url = NULL;
+    char* host = NULL;
+
+    fprintf(stderr, "TEST esi resolve\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        assert(esi_resolve(cases[i].src, cases[i].base, &url, &host) == 0);
+        assert(strcmp(url, cases[i].url) == 0);
+        assert(strcmp(host, cases[i].host) == 0);
+        free(url);
+        free(host);
+    }
+
+    /* Only plain HTTP is fetched. */
+    assert(esi_resolve("https://f.example/x", "http://a.example/", &url,
+                       &host) == -1);
+    assert(esi_resolve("/x", "https://a.example/", &url, &host) == -1);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_esi_fill(void)
+{
+    static const char plain[] = "HTTP/1.1 200 OK\r\n"
+                                "Content-Length: 3\r\n"
+                                "\r\n"
+                                "one";
+    static const char chunked[] = "HTTP/1.1 200 OK\r\n"
+                                  "Transfer-Encoding: chunked\r\n"
+                                  "\r\n"
+                                  "2\r\ntw\r\n"
+                                  "1;ext=1\r\no\r\n"
+                                  "0\r\n\r\n";
+    static const char missing[] = "HTTP/1.1 404 Not Found\r\n"
+                                  "Content-Length: 4\r\n"
+                                  "\r\n"
+                                  "gone";
+    struct esi_page* page = NULL;
+    struct esi_stats stats;
+    char* shell;
+    char* fragment;
+    char* coded;
+    int coded_len;
+    char body[4096];
+    int n = 0;
+
+    fprintf(stderr, "TEST esi fill\n");
+    esi_clear_stats();
+    shell = make_shell("[<esi:include src=\"/1\"/>|<esi:include src=\"/2\"/>|"
+                       "<esi:include src=\"/3\"/>|<esi:include src=\"/4\"/>|"
+                       "<esi:include src=\"/5\"/>]");
+    assert(esi_parse(shell, strlen(shell), &page) == 5);
+
+    /* A gzip coded fragment is decoded. */
+    for (int i = 0; i < 64; ++i) {
+        n += sprintf(body + n, "<li>item %d</li>", i);
+    }
+    fragment = malloc(n + 256);
+    assert(fragment != NULL);
+    sprintf(fragment,
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/html\r\n"
+            "Content-Length: %d\r\n"
+            "\r\n"
+            "%s",
+            n,
+            body);
+    assert(compress_response(fragment, strlen(fragment), &coded,
+                             &coded_len) == 1);
+
+    out_len = 0;
+    esi_fill(page, 1, plain, strlen(plain), 1);
+    esi_fill(page, 3, chunked, strlen(chunked), 0);
+    esi_fill(page, 5, missing, strlen(missing), 0);
+    esi_fill(page, 7, NULL, 0, 0);
+    esi_fill(page, 9, coded, coded_len, 1);
+    /* A filled include stays as it is. */
+    esi_fill(page, 1, chunked, strlen(chunked), 0);
+    assert(esi_drain(page, sink, NULL) == 1);
+    out[out_len] = '\0';
+    assert(strncmp(out, "1\r\n[\r\n3\r\none\r\n1\r\n|\r\n3\r\ntwo\r\n"
+                   "1\r\n|\r\n1\r\n|\r\n1\r\n|\r\n", 46) == 0);
+    assert(strstr(out, "<li>item 63</li>\r\n1\r\n]\r\n0\r\n\r\n") != NULL);
+    esi_get_stats(&stats);
+    assert(stats.pages == 1);
+    assert(stats.includes == 5);
+    assert(stats.hits == 2);
+    assert(stats.fetches == 1);
+    assert(stats.failed == 2);
+    esi_free(page);
+    free(shell);
+    free(fragment);
+    free(coded);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_esi_drain(void)
+{
+    static const char fragment[] = "HTTP/1.1 200 OK\r\n"
+                                   "Content-Length: 1\r\n"
+                                   "\r\n"
+                                   "x";
+    struct esi_page* page = NULL;
+    struct esi_stats stats;
+    char* shell;
+
+    fprintf(stderr, "TEST esi drain\n");
+    esi_clear_stats();
+    shell = make_shell("a<esi:include src=\"/1\"/>b<esi:include src=\"/2\"/>");
+    assert(esi_parse(shell, strlen(shell), &page) == 2);
+
+    /* Parts go out up to the first pending include. */
+    out_len = 0;
+    assert(esi_drain(page, sink, NULL) == 0);
+    assert(out_len == 6 && memcmp(out, "1\r\na\r\n", 6) == 0);
+    assert(esi_sent(page) == 6);
+
+    /* A later fragment waits for the one before it. */
+    esi_fill(page, 3, fragment, strlen(fragment), 0);
+    assert(esi_drain(page, sink, NULL) == 0);
+    assert(out_len == 6);
+    esi_fill(page, 1, fragment, strlen(fragment), 0);
+    assert(esi_drain(page, sink, NULL) == 1);
+    out[out_len] = '\0';
+    assert(strcmp(out, "1\r\na\r\n1\r\nx\r\n1\r\nb\r\n1\r\nx\r\n0\r\n\r\n")
+           == 0);
+    /* The whole page is out only once. */
+    assert(esi_drain(page, sink, NULL) == 1);
+    assert(out_len == (int)strlen(out));
+    assert(esi_sent(page) == out_len);
+    esi_get_stats(&stats);
+    assert(stats.waits == 2);
+    esi_free(page);
+
+    /* A failed sink fails the page. */
+    assert(esi_parse(shell, strlen(shell), &page) == 2);
+    sink_fails = 1;
+    assert(esi_drain(page, sink, NULL) == -1);
+    sink_fails = 0;
+    esi_free(page);
+    free(shell);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_esi_page_head(void)
+{
+    static const char shell[] = "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: text/html\r\n"
+                                "Content-Encoding: gzip\r\n"
+                                "Content-Length: 10\r\n"
+                                "ETag: \"v1\"\r\n"
+                                "Surrogate-Control: content=\"ESI/1.0\"\r\n"
+                                "Cache-Control: max-age=60\r\n"
+                                "\r\n";
+    char* head = NULL;
+    int head_len = 0;
+
+    fprintf(stderr, "TEST esi page head\n");
+    assert(esi_page_head(shell, strlen(shell), &head, &head_len) == 0);
+    assert(head_len == (int)strlen("HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: text/html\r\n"
+                                   "Cache-Control: max-age=60\r\n"
+                                   "Transfer-Encoding: chunked\r\n"));
+    assert(memcmp(head,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/html\r\n"
+                  "Cache-Control: max-age=60\r\n"
+                  "Transfer-Encoding: chunked\r\n",
+                  head_len) == 0);
+    free(head);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_esi_parse();
+    test_esi_resolve();
+    test_esi_fill();
+    test_esi_drain();
+    test_esi_page_head();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/**************************************************************
+*
+*                         test_fairq.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-08
+*
+*     Summary:
+*     Test driver for the fair scheduling of ready sockets.
+*
+**************************************************************/
+
+#include "fairq.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define READ_SIZE 8192 /* Byte size of a full read. */
+
+static void test_fairq_order(void)
+{
+    fprintf(stderr, "TEST fairq order\n");
+
+    /* Without a budget, sockets go in FD order, bulk or not. */
+    fairq_init(0);
+    assert(fairq_next() == -1);
+    fairq_add(7, 7, 1);
+    fairq_add(3, 3, 0);
+    fairq_add(5, 3, 1);
+    assert(fairq_next() == 3);
+    fairq_charge(READ_SIZE);
+    assert(fairq_next() == 5);
+    fairq_charge(READ_SIZE);
+    assert(fairq_next() == 7);
+    fairq_charge(READ_SIZE);
+    assert(fairq_next() == -1);
+    assert(fairq_next() == -1);
+
+    /* A new client goes ahead of a bulk transfer busy all along, whose
+     * server is charged to its client. */
+    fairq_init(FAIRQ_ROUND_KB * 1024);
+    for (int i = 0; i < 4; ++i) {
+        fairq_add(8, 4, 1);
+        assert(fairq_next() == 8);
+        fairq_charge(READ_SIZE);
+        assert(fairq_next() == -1);
+    }
+    fairq_add(4, 4, 0);
+    fairq_add(8, 4, 1);
+    fairq_add(9, 9, 0);
+    assert(fairq_next() == 9);
+    fairq_charge(100);
+    assert(fairq_next() == 4);
+    fairq_charge(100);
+    assert(fairq_next() == 8);
+    fairq_charge(READ_SIZE);
+    assert(fairq_next() == -1);
+
+    /* A forgotten flow starts afresh on the next client of its FD. */
+    fairq_forget(4);
+    fairq_add(8, 8, 0);
+    fairq_add(4, 4, 0);
+    assert(fairq_next() == 4);
+    assert(fairq_next() == 8);
+    assert(fairq_next() == -1);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_fairq_budget(void)
+{
+    struct fairq_stats stats;
+    int reads[16] = {0};
+    int served;
+    int fd;
+
+    fprintf(stderr, "TEST fairq budget\n");
+
+    /* A round moves 2 full reads of bulk data, and serves each interactive
+     * socket regardless. */
+    fairq_init(2 * READ_SIZE);
+    for (fd = 3; fd < 13; ++fd) {
+        fairq_add(fd, fd, 1);
+    }
+    fairq_add(13, 13, 0);
+    served = 0;
+    while ((fd = fairq_next()) >= 0) {
+        fairq_charge(READ_SIZE);
+        served++;
+    }
+    assert(served == 3);
+    fairq_get_stats(&stats);
+    assert(stats.rounds == 1);
+    assert(stats.cut == 1);
+    assert(stats.bulk == 2);
+    assert(stats.interactive == 1);
+    assert(stats.deferred == 8);
+    assert(stats.bulk_bytes == 2 * READ_SIZE);
+
+    /* Bulk flows always ready share the rounds evenly. */
+    fairq_init(READ_SIZE);
+    for (int round = 0; round < 30; ++round) {
+        for (fd = 3; fd < 6; ++fd) {
+            fairq_add(fd, fd, 1);
+        }
+        while ((fd = fairq_next()) >= 0) {
+            fairq_charge(READ_SIZE);
+            reads[fd]++;
+        }
+    }
+    assert(reads[3] == 10 && reads[4] == 10 && reads[5] == 10);
+
+    /* An interactive flow pays a fraction of the bulk price per byte, so it
+     * keeps its place ahead while it stays small. */
+    fairq_init(READ_SIZE);
+    for (int round = 0; round < 8; ++round) {
+        fairq_add(3, 3, 1);
+        fairq_add(4, 4, 0);
+        assert(fairq_next() == (round == 0 ? 3 : 4));
+        fairq_charge(READ_SIZE);
+        assert(fairq_next() == (round == 0 ? 4 : 3));
+        fairq_charge(READ_SIZE);
+        assert(fairq_next() == -1);
+    }
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_fairq_order();
+    test_fairq_budget();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,482 @@
+/**************************************************************
+*
+*                        test_filter.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-05
+*
+*     Summary:
+*     Test driver for streaming filters of response bodies.
+*
+**************************************************************/
+
+#include "filter.h"
+#include "http_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define MAX_OUT (1 << 21) /* Max byte size of output of a stream. */
+
+static char out[MAX_OUT]; /* Bytes handed to the sink. */
+static int out_len = 0; /* Byte size of out. */
+static int max_sink_len = 0; /* Largest byte size of a sink call. */
+static int sink_fails = 0; /* Whether the sink fails. */
+
+/**
+ * @brief Sink that appends to out.
+ */
+static int sink(void* arg, const char* data, int len)
+{
+    (void)arg;
+    assert(len > 0 && out_len + len <= MAX_OUT);
+    if (sink_fails) {
+        return -1;
+    }
+    memcpy(out + out_len, data, len);
+    out_len += len;
+    if (len > max_sink_len) {
+        max_sink_len = len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode the chunked body in out.
+ *
+ * @param body Output; the body; at least out_len bytes.
+ * @return int Byte size of body; -1 if out is not a whole chunked body.
+ */
+static int dechunk(char* body)
+{
+    const char* p = out;
+    const char* end = out + out_len;
+    char* q;
+    long size;
+    int n = 0;
+
+    for (;;) {
+        size = strtol(p, &q, 16);
+        if (q == p || end - q < 2 || memcmp(q, "\r\n", 2) != 0) {
+            return -1;
+        }
+        p = q + 2;
+        if (size == 0) {
+            return end - p == 2 && memcmp(p, "\r\n", 2) == 0 ? n : -1;
+        }
+        if (end - p < size + 2 || memcmp(p + size, "\r\n", 2) != 0) {
+            return -1;
+        }
+        memcpy(body + n, p, size);
+        n += size;
+        p += size + 2;
+    }
+}
+
+/**
+ * @brief Replace each occurrence of a string, leftmost first.
+ *
+ * @param text Null-terminated text.
+ * @param from String to replace.
+ * @param to Replacement.
+ * @return char* Null-terminated new text.
+ */
+static char* replace_all(const char* text, const char* from, const char* to)
+{
+    char* res = malloc(strlen(text) * (strlen(to) + 1) + 1);
+    const char* hit;
+    int n = 0;
+
+    assert(res != NULL);
+    while ((hit = strstr(text, from)) != NULL) {
+        memcpy(res + n, text, hit - text);
+        n += hit - text;
+        memcpy(res + n, to, strlen(to));
+        n += strlen(to);
+        text = hit + strlen(from);
+    }
+    strcpy(res + n, text);
+    return res;
+}
+
+/**
+ * @brief Code bytes with gzip, or decode them.
+ *
+ * @param coding 1 to code; 0 to decode.
+ * @param data Bytes.
+ * @param len Byte size of data.
+ * @param res Output; at least MAX_OUT bytes.
+ * @return int Byte size of res.
+ */
+static int zip(int coding, const char* data, int len, char* res)
+{
+    z_stream zs;
+    int ret;
+
+    memset(&zs, 0, sizeof(zs));
+    if (coding) {
+        assert(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8,
+                            Z_DEFAULT_STRATEGY) == Z_OK);
+    }
+    else {
+        assert(inflateInit2(&zs, 15 + 16) == Z_OK);
+    }
+    zs.next_in = (unsigned char*)data;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char*)res;
+    zs.avail_out = MAX_OUT;
+    ret = coding ? deflate(&zs, Z_FINISH) : inflate(&zs, Z_FINISH);
+    assert(ret == Z_STREAM_END);
+    if (coding) {
+        deflateEnd(&zs);
+    }
+    else {
+        inflateEnd(&zs);
+    }
+    return zs.total_out;
+}
+
+/**
+ * @brief Open a stream of a response, and push its body in pieces.
+ *
+ * @param response Response.
+ * @param len Byte size of response.
+ * @param accepts_gzip Whether the client accepts gzip.
+ * @param step Byte size of each piece of the body.
+ * @param out_head Output pointer to the new head, null-terminated.
+ * @return int Result of the last push; -2 if no stream is opened.
+ */
+static int run(const char* response,
+               int len,
+               int accepts_gzip,
+               int step,
+               char** out_head)
+{
+    struct filter_stream* stream;
+    int head_len = get_head_len(response, len);
+    int new_head_len;
+    int ret = 0;
+
+    out_len = 0;
+    max_sink_len = 0;
+    if (!filter_open(response, head_len, accepts_gzip,
+                     &stream, out_head, &new_head_len)) {
+        return -2;
+    }
+    *out_head = realloc(*out_head, new_head_len + 1);
+    assert(*out_head != NULL);
+    (*out_head)[new_head_len] = '\0';
+    ret = filter_push(stream, NULL, 0, sink, NULL);
+    for (int i = head_len; i < len && ret == 0; i += step) {
+        ret = filter_push(stream, response + i,
+                          len - i < step ? len - i : step, sink, NULL);
+    }
+    filter_free(stream);
+    return ret;
+}
+
+/**
+ * @brief Build a response of a body.
+ *
+ * @param fields Header lines of the response, each ending with "\r\n".
+ * @param body Body, framed as fields tell.
+ * @param body_len Byte size of body.
+ * @param out_len Output; byte size of the response.
+ * @return char* Response.
+ */
+static char* make_response(const char* fields,
+                           const char* body,
+                           int body_len,
+                           int* out_len)
+{
+    char* response = malloc(strlen(fields) + body_len + 64);
+    int n;
+
+    assert(response != NULL);
+    n = sprintf(response, "HTTP/1.1 200 OK\r\n%s\r\n", fields);
+    memcpy(response + n, body, body_len);
+    *out_len = n + body_len;
+    return response;
+}
+
+void test_filter_config(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST filter config\n");
+    assert(filter_count() == 0);
+    assert(filter_add("bogus") < 0);
+    assert(filter_add("rewrite=") < 0);
+    assert(filter_add("rewrite=a") < 0);
+    assert(filter_add("rewrite==b") < 0);
+    assert(filter_add("gunzip") == 0);
+    assert(filter_add("rewrite=a=") == 0);
+    assert(filter_add("rewrite=a=b=c") == 0);
+    assert(filter_add("gzip") == 0);
+    assert(filter_count() == 4);
+    for (int i = 4; i < FILTER_MAX; ++i) {
+        assert(filter_add("gzip") == 0);
+    }
+    assert(filter_add("gzip") < 0);
+    filter_clear();
+    assert(filter_count() == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_filter_rewrite(void)
+{
+    /* Prefixes of "aab" overlap, so partial matches fall back. */
+    const char* text = "aaab aab aaaab xaabaab aa";
+    char fields[128];
+    char body[256];
+    char* expected = replace_all(text, "aab", "<X>");
+    char* response;
+    char* head;
+    struct filter_stats stats;
+    int len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST filter rewrite\n");
+    assert(filter_add("rewrite=aab=<X>") == 0);
+    sprintf(fields, "Content-Type: text/plain\r\nContent-Length: %d\r\n"
+            "ETag: \"v1\"\r\n", (int)strlen(text));
+    response = make_response(fields, text, strlen(text), &len);
+
+    /* Any split of the body gives the same output. */
+    for (int step = 1; step <= (int)strlen(text); ++step) {
+        assert(run(response, len, 1, step, &head) == 1);
+        assert(dechunk(body) == (int)strlen(expected));
+        assert(memcmp(body, expected, strlen(expected)) == 0);
+        assert(strstr(head, "Content-Length") == NULL);
+        assert(strstr(head, "Transfer-Encoding: chunked\r\n") != NULL);
+        assert(strstr(head, "ETag: W/\"v1\"\r\n") != NULL);
+        assert(strstr(head, "Content-Encoding") == NULL);
+        assert(strstr(head, "Vary") == NULL);
+        free(head);
+    }
+    filter_get_stats(&stats);
+    assert(stats.streams == (long)strlen(text));
+    assert(stats.rewrites == 5 * stats.streams);
+    assert(stats.in_bytes == (long)strlen(text) * stats.streams);
+    free(response);
+
+    /* An empty body only gets the last chunk. */
+    response = make_response("Content-Type: text/html\r\n"
+                             "Content-Length: 0\r\n", "", 0, &len);
+    assert(run(response, len, 0, 1, &head) == 1);
+    assert(out_len == 5 && memcmp(out, "0\r\n\r\n", 5) == 0);
+    free(head);
+    free(response);
+    free(expected);
+    filter_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_filter_chunked(void)
+{
+    const char* chunked = "5;ext=1\r\nhello\r\n"
+                          "b\r\n, hello wor\r\n"
+                          "3\r\nld!\r\n"
+                          "0\r\nX-Trailer: 1\r\n\r\n"
+                          "ignored";
+    const char* expected = "HELLO, HELLO world!";
+    char body[64];
+    char* response;
+    char* head;
+    int len;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST filter chunked\n");
+    assert(filter_add("rewrite=hello=HELLO") == 0);
+    response = make_response("Content-Type: text/html\r\n"
+                             "Transfer-Encoding: chunked\r\n",
+                             chunked, strlen(chunked), &len);
+    for (int step = 1; step <= (int)strlen(chunked); ++step) {
+        assert(run(response, len, 0, step, &head) == 1);
+        assert(dechunk(body) == (int)strlen(expected));
+        assert(memcmp(body, expected, strlen(expected)) == 0);
+        assert(strstr(head, "Transfer-Encoding: chunked\r\n") != NULL);
+        assert(strstr(strstr(head, "Transfer-Encoding") + 1,
+                      "Transfer-Encoding") == NULL);
+        free(head);
+    }
+    free(response);
+
+    /* Bad framing fails the stream. */
+    response = make_response("Content-Type: text/html\r\n"
+                             "Transfer-Encoding: chunked\r\n",
+                             "5\r\nhelloXX", 10, &len);
+    assert(run(response, len, 0, 3, &head) == -1);
+    free(head);
+    free(response);
+    response = make_response("Content-Type: text/html\r\n"
+                             "Transfer-Encoding: chunked\r\n",
+                             "zz\r\n", 4, &len);
+    assert(run(response, len, 0, 1, &head) == -1);
+    free(head);
+    free(response);
+    filter_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_filter_gzip(void)
+{
+    int text_len = 200000;
+    char* text = malloc(text_len + 1);
+    char* coded = malloc(MAX_OUT);
+    char* body = malloc(MAX_OUT);
+    char* plain = malloc(MAX_OUT);
+    char* expected;
+    char fields[256];
+    char* response;
+    char* head;
+    int coded_len;
+    int len;
+    int n = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST filter gzip\n");
+    assert(text != NULL && coded != NULL && body != NULL && plain != NULL);
+    while (n < text_len) {
+        n += snprintf(text + n, text_len + 1 - n, "<p>hello %d</p>\n", n);
+    }
+    expected = replace_all(text, "hello", "bye");
+    coded_len = zip(1, text, text_len, coded);
+    assert(filter_add("gunzip") == 0);
+    assert(filter_add("rewrite=hello=bye") == 0);
+    assert(filter_add("gzip") == 0);
+
+    /* gunzip, rewrite, then gzip for a client that accepts it. */
+    sprintf(fields, "Content-Type: text/html\r\nContent-Encoding: gzip\r\n"
+            "Content-Length: %d\r\n", coded_len);
+    response = make_response(fields, coded, coded_len, &len);
+    assert(run(response, len, 1, 1460, &head) == 1);
+    assert(strstr(head, "Content-Encoding: gzip\r\n") != NULL);
+    assert(strstr(head, "Vary: Accept-Encoding\r\n") != NULL);
+    n = dechunk(body);
+    assert(n > 0);
+    assert(zip(0, body, n, plain) == (int)strlen(expected));
+    assert(memcmp(plain, expected, strlen(expected)) == 0);
+    /* Each sink call is at most a window, with its framing. */
+    assert(max_sink_len <= FILTER_WINDOW + 32);
+    free(head);
+
+    /* Only gunzip and rewrite for a client that does not. */
+    assert(run(response, len, 0, 100000, &head) == 1);
+    assert(strstr(head, "Content-Encoding") == NULL);
+    assert(dechunk(body) == (int)strlen(expected));
+    assert(memcmp(body, expected, strlen(expected)) == 0);
+    free(head);
+
+    /* A body cut before the end of its gzip stream fails. */
+    free(response);
+    sprintf(fields, "Content-Type: text/html\r\nContent-Encoding: gzip\r\n"
+            "Content-Length: %d\r\n", coded_len / 2);
+    response = make_response(fields, coded, coded_len / 2, &len);
+    assert(run(response, len, 1, 4096, &head) == -1);
+    free(head);
+    free(response);
+
+    /* Bad gzip fails. */
+    response = make_response("Content-Type: text/html\r\n"
+                             "Content-Encoding: gzip\r\n"
+                             "Content-Length: 16\r\n",
+                             "not gzip at all!", 16, &len);
+    assert(run(response, len, 1, 16, &head) == -1);
+    free(head);
+    free(response);
+
+    /* rewrite, then gzip of an uncoded body. */
+    sprintf(fields, "Content-Type: text/html\r\nContent-Length: %d\r\n"
+            "Vary: Cookie\r\n", text_len);
+    response = make_response(fields, text, text_len, &len);
+    assert(run(response, len, 1, 65536, &head) == 1);
+    assert(strstr(head, "Content-Encoding: gzip\r\n") != NULL);
+    assert(strstr(head, "Vary: Cookie, Accept-Encoding\r\n") != NULL);
+    assert(strstr(head, "Vary: Accept-Encoding") == NULL);
+    n = dechunk(body);
+    assert(zip(0, body, n, plain) == (int)strlen(expected));
+    assert(memcmp(plain, expected, strlen(expected)) == 0);
+    free(head);
+
+    /* A failing sink fails the stream. */
+    sink_fails = 1;
+    assert(run(response, len, 1, 65536, &head) == -1);
+    sink_fails = 0;
+    free(head);
+    free(response);
+
+    free(expected);
+    free(text);
+    free(coded);
+    free(body);
+    free(plain);
+    filter_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_filter_pass(void)
+{
+    const char* responses[] = {
+        "HTTP/1.1 404 Not Found\r\nContent-Type: text/html\r\n"
+        "Content-Length: 5\r\n\r\nhello",
+        "HTTP/1.1 200 OK\r\nContent-Type: image/png\r\n"
+        "Content-Length: 5\r\n\r\nhello",
+        "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\nhello",
+        "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+        "Content-Encoding: br\r\nContent-Length: 5\r\n\r\nhello",
+        "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+        "Transfer-Encoding: gzip, chunked\r\n\r\nhello",
+        NULL,
+    };
+    const char* identity = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+                           "Content-Length: 5\r\n\r\nhello";
+    struct filter_stats stats;
+    char* head;
+    int i;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST filter pass\n");
+    /* Without filters, nothing is counted. */
+    assert(run(identity, strlen(identity), 1, 5, &head) == -2);
+    filter_get_stats(&stats);
+    assert(stats.passed == 0);
+
+    assert(filter_add("rewrite=hello=bye") == 0);
+    for (i = 0; responses[i] != NULL; ++i) {
+        assert(run(responses[i], strlen(responses[i]), 1, 5, &head) == -2);
+    }
+    filter_clear();
+
+    /* gunzip does not apply to an uncoded body. */
+    assert(filter_add("gunzip") == 0);
+    assert(run(identity, strlen(identity), 1, 5, &head) == -2);
+    /* Nor gzip for a client that does not accept it. */
+    assert(filter_add("gzip") == 0);
+    assert(run(identity, strlen(identity), 0, 5, &head) == -2);
+    filter_get_stats(&stats);
+    assert(stats.passed == 2);
+    assert(stats.streams == 0);
+    filter_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_filter_config();
+    test_filter_rewrite();
+    test_filter_chunked();
+    test_filter_gzip();
+    test_filter_pass();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/**************************************************************
+*
+*                         test_hints.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-07
+*
+*     Summary:
+*     Test driver for "103 Early Hints" from preload links.
+*
+**************************************************************/
+
+#include "hints.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Learn the links of a response head.
+ *
+ * @param key Cache key.
+ * @param head Null-terminated head, with its empty line.
+ */
+static void learn(const char* key, const char* head)
+{
+    hints_learn(key, head, strlen(head));
+}
+
+/**
+ * @brief Check the 103 response of a key.
+ *
+ * @param key Cache key.
+ * @param links Expected Link field value; NULL for no 103 response.
+ */
+static void expect(const char* key, const char* links)
+{
+    char expected[4096];
+    char* hints = NULL;
+    int len = 0;
+
+    if (links == NULL) {
+        assert(hints_get(key, &hints, &len) == 0);
+        return;
+    }
+    sprintf(expected, "HTTP/1.1 103 Early Hints\r\nLink: %s\r\n\r\n", links);
+    assert(hints_get(key, &hints, &len) == 1);
+    assert(len == (int)strlen(expected));
+    assert(memcmp(hints, expected, len) == 0);
+    free(hints);
+}
+
+static void test_hints_learn(void)
+{
+    struct hints_stats stats;
+
+    fprintf(stderr, "TEST hints learn\n");
+    hints_clear();
+    expect("a.com/", NULL);
+
+    /* Preload links of each Link field, in order, and no others. */
+    learn("a.com/",
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/html; charset=utf-8\r\n"
+          "Link: </a.css>; rel=preload; as=style, </b.js>; rel=\"preload\"; "
+          "as=script\r\n"
+          "Content-Length: 10\r\n"
+          "link: </next>; rel=next, </c,d.png>; rel=\"icon preload\"; "
+          "as=image\r\n"
+          "Link: </e.js>; rel=prefetch, </f.js>; rel=preloaded, "
+          "</g.js>; title=\"x, rel=preload\"\r\n"
+          "Link: </h.js>; rel=next; rel=preload\r\n"
+          "\r\n");
+    expect("a.com/",
+           "</a.css>; rel=preload; as=style, "
+           "</b.js>; rel=\"preload\"; as=script, "
+           "</c,d.png>; rel=\"icon preload\"; as=image");
+    expect("a.com/other", NULL);
+
+    /* Only "200 OK" HTML responses count. */
+    learn("a.com/x.css",
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/css\r\n"
+          "Link: </y.css>; rel=preload\r\n"
+          "\r\n");
+    learn("a.com/404",
+          "HTTP/1.1 404 Not Found\r\n"
+          "Content-Type: text/html\r\n"
+          "Link: </y.css>; rel=preload\r\n"
+          "\r\n");
+    learn("a.com/untyped",
+          "HTTP/1.1 200 OK\r\n"
+          "Link: </y.css>; rel=preload\r\n"
+          "\r\n");
+    expect("a.com/x.css", NULL);
+    expect("a.com/404", NULL);
+    expect("a.com/untyped", NULL);
+
+    /* The latest response wins, and a page without preload links is
+     * forgotten. */
+    learn("a.com/",
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/html\r\n"
+          "Link: <https://cdn.example/z.js>; rel=preload; as=script\r\n"
+          "\r\n");
+    expect("a.com/", "<https://cdn.example/z.js>; rel=preload; as=script");
+    learn("a.com/",
+          "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/html\r\n"
+          "\r\n");
+    expect("a.com/", NULL);
+
+    hints_get_stats(&stats);
+    assert(stats.learned == 2);
+    assert(stats.forgotten == 1);
+    assert(stats.sent == 2);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+static void test_hints_table(void)
+{
+    struct hints_stats stats;
+    char head[HINTS_MAX_LEN * 2];
+    char key[64];
+    char* hints = NULL;
+    int found = 0;
+    int len = 0;
+    int n;
+
+    fprintf(stderr, "TEST hints table\n");
+    hints_clear();
+
+    /* More keys than slots: each slot keeps the latest of its keys. */
+    for (int i = 0; i < 2 * HINTS_SLOTS; ++i) {
+        sprintf(key, "a.com/%d", i);
+        sprintf(head,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/html\r\n"
+                "Link: </%d.css>; rel=preload\r\n"
+                "\r\n",
+                i);
+        learn(key, head);
+    }
+    for (int i = 0; i < 2 * HINTS_SLOTS; ++i) {
+        sprintf(key, "a.com/%d", i);
+        if (hints_get(key, &hints, &len)) {
+            sprintf(head, "</%d.css>; rel=preload", i);
+            assert(strstr(hints, head) != NULL);
+            free(hints);
+            found++;
+        }
+    }
+    hints_get_stats(&stats);
+    assert(found > HINTS_SLOTS / 2 && found <= HINTS_SLOTS);
+    assert(stats.learned == 2 * HINTS_SLOTS);
+    assert(stats.replaced == 2 * HINTS_SLOTS - found);
+
+    /* Links past HINTS_MAX_LEN are left out. */
+    n = sprintf(head,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/html\r\n");
+    for (int i = 0; n < (int)sizeof(head) - 64; ++i) {
+        n += sprintf(head + n, "Link: </%04d.js>; rel=preload\r\n", i);
+    }
+    strcpy(head + n, "\r\n");
+    learn("a.com/big", head);
+    assert(hints_get("a.com/big", &hints, &len) == 1);
+    assert(len <= HINTS_MAX_LEN + 64);
+    assert(memcmp(hints + len - 4, "\r\n\r\n", 4) == 0);
+    free(hints);
+    hints_clear();
+    expect("a.com/big", NULL);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_hints_learn();
+    test_hints_table();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
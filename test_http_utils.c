@@ -0,0 +1,258 @@
+/**************************************************************
+*
+*                      test_http_utils.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-18
+*
+*     Summary:
+*     Test driver for HTTP parsing helpers.
+*
+**************************************************************/
+
+#include "http_utils.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Cached response with both validators. */
+static const char* response = "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/css\r\n"
+                              "Content-Length: 5\r\n"
+                              "ETag:\"abc\"\r\n"
+                              "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                              "Cache-Control: max-age=60\r\n"
+                              "\r\n"
+                              "p {} ";
+
+/* Check is_not_modified() for a request with the given extra head line. */
+int not_modified(const char* line)
+{
+    char request[256];
+
+    snprintf(request, sizeof(request),
+             "GET /a.css HTTP/1.1\r\nHost: example.com\r\n%s\r\n", line);
+    return is_not_modified(request, strlen(request),
+                           response, strlen(response));
+}
+
+void test_lookup_header_name(void)
+{
+    char name[64];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST lookup_header_name()\n");
+    for (enum http_header header = HTTP_HEADER_UNKNOWN + 1;
+         header < NUM_HTTP_HEADERS;
+         ++header) {
+        const char* canonical = get_header_name(header);
+        int len = strlen(canonical);
+
+        assert(lookup_header_name(canonical, len) == header);
+        /* Lower and upper case spellings map to the same enum. */
+        for (int j = 0; j < len; ++j) {
+            name[j] = tolower(canonical[j]);
+        }
+        assert(lookup_header_name(name, len) == header);
+        for (int j = 0; j < len; ++j) {
+            name[j] = toupper(canonical[j]);
+        }
+        assert(lookup_header_name(name, len) == header);
+        /* A prefix is another name. */
+        assert(lookup_header_name(name, len - 1) != header);
+    }
+    assert(lookup_header_name("content-length", 14) ==
+           HTTP_HEADER_CONTENT_LENGTH);
+    assert(lookup_header_name("Host: a", 4) == HTTP_HEADER_HOST);
+    assert(lookup_header_name("Hos", 3) == HTTP_HEADER_UNKNOWN);
+    assert(lookup_header_name("Hostx", 5) == HTTP_HEADER_UNKNOWN);
+    assert(lookup_header_name("X-Unknown", 9) == HTTP_HEADER_UNKNOWN);
+    assert(lookup_header_name("", 0) == HTTP_HEADER_UNKNOWN);
+    assert(strcmp(get_header_name(HTTP_HEADER_UNKNOWN), "") == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_parse_response_head(void)
+{
+    const char* response = "HTTP/1.1 200 OK\r\n"
+                           "content-length:12\r\n"
+                           "CACHE-CONTROL:  max-age=60 \r\n"
+                           "\r\n";
+    char* version = NULL;
+    int status_code = 0;
+    char* phrase = NULL;
+    int content_length = 0;
+    char* cache_control = NULL;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST parse_response_head()\n");
+    parse_response_head(response, strlen(response), &version, &status_code,
+                        &phrase, &content_length, &cache_control);
+    assert(status_code == 200);
+    assert(content_length == 12);
+    assert(strcmp(cache_control, "max-age=60") == 0);
+    free(version);
+    free(phrase);
+    free(cache_control);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_is_not_modified(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST is_not_modified()\n");
+    assert(!not_modified(""));
+
+    /* If-None-Match, with the weak comparison. */
+    assert(not_modified("If-None-Match: \"abc\"\r\n"));
+    assert(not_modified("if-none-match: W/\"abc\"\r\n"));
+    assert(not_modified("If-None-Match: \"x\", \"abc\"\r\n"));
+    assert(not_modified("If-None-Match: *\r\n"));
+    assert(!not_modified("If-None-Match: \"ab\"\r\n"));
+    assert(!not_modified("If-None-Match: \"abcd\"\r\n"));
+
+    /* If-Modified-Since. */
+    assert(not_modified(
+        "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"));
+    assert(not_modified(
+        "If-Modified-Since: Mon, 07 Nov 1994 00:00:00 GMT\r\n"));
+    assert(!not_modified(
+        "If-Modified-Since: Sun, 06 Nov 1994 08:49:36 GMT\r\n"));
+    assert(!not_modified("If-Modified-Since: yesterday\r\n"));
+
+    /* If-None-Match takes precedence over If-Modified-Since. */
+    assert(!not_modified(
+        "If-None-Match: \"old\"\r\n"
+        "If-Modified-Since: Mon, 07 Nov 1994 00:00:00 GMT\r\n"));
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_make_not_modified(void)
+{
+    char* head = NULL;
+    int head_len = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST make_not_modified()\n");
+    assert(make_not_modified(response, strlen(response),
+                             &head, &head_len) == 0);
+    assert(head_len == (int)strlen(head));
+    assert(strcmp(head,
+                  "HTTP/1.1 304 Not Modified\r\n"
+                  "ETag: \"abc\"\r\n"
+                  "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                  "Cache-Control: max-age=60\r\n") == 0);
+    free(head);
+    head = NULL;
+    assert(make_not_modified(response, 20, &head, &head_len) == -1);
+    assert(head == NULL);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/* Check extract_first_response() on a chunked response with the given body. */
+int chunked_complete(const char* body)
+{
+    const char* head = "HTTP/1.1 200 OK\r\n"
+                       "Transfer-Encoding: gzip, Chunked\r\n"
+                       "\r\n";
+    int n = strlen(head) + strlen(body);
+    char* buf = malloc(n);
+    char* out = NULL;
+    int out_len = 0;
+    int max_age = 0;
+    int is_chunked = 0;
+    int ret;
+
+    memcpy(buf, head, strlen(head));
+    memcpy(buf + strlen(head), body, strlen(body));
+    ret = extract_first_response(&buf, &n, &out, &out_len,
+                                 &max_age, &is_chunked);
+    assert(is_chunked == 1);
+    free(buf);
+    free(out);
+    return ret;
+}
+
+void test_extract_chunked(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST extract_first_response() chunked\n");
+    assert(chunked_complete("0\r\n\r\n"));
+    assert(chunked_complete("5\r\nhello\r\nA;ext=1\r\n0123456789\r\n"
+                            "0\r\n\r\n"));
+    /* Trailer fields and chunk data that looks like the last chunk. */
+    assert(chunked_complete("5\r\n0\r\n\r\n\r\n0\r\nX-Sum: 1\r\n\r\n"));
+    /* Incomplete. */
+    assert(!chunked_complete(""));
+    assert(!chunked_complete("5\r\nhel"));
+    assert(!chunked_complete("5\r\nhello\r\n"));
+    assert(!chunked_complete("0\r\nX-Sum: 1\r\n"));
+    /* Malformed. */
+    assert(!chunked_complete("z\r\n\r\n"));
+    assert(!chunked_complete("3\r\nhello\r\n0\r\n\r\n"));
+    assert(!chunked_complete("ffffffffffffffff\r\nx\r\n0\r\n\r\n"));
+    assert(!chunked_complete("0\n\r\n\r\n"));
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_parse_host_field(void)
+{
+    char* hostname = NULL;
+    int port = -1;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST parse_host_field()\n");
+    parse_host_field("example.com:8080", &hostname, &port);
+    assert(strcmp(hostname, "example.com") == 0);
+    assert(port == 8080);
+    free(hostname);
+    hostname = NULL;
+    port = 80;
+    parse_host_field("example.com:99999", &hostname, &port);
+    assert(strcmp(hostname, "example.com") == 0);
+    assert(port == 80);
+    free(hostname);
+    hostname = NULL;
+    parse_host_field(NULL, &hostname, &port);
+    assert(hostname == NULL);
+    assert(port == 80);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_get_status_code(void)
+{
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST get_status_code()\n");
+    assert(get_status_code(response, strlen(response)) == 200);
+    assert(get_status_code("HTTP/1.1 304 Not Modified\r\n", 27) == 304);
+    assert(get_status_code("HTTP/1.1 304", 10) == -1);
+    assert(get_status_code("HTTP/1.1", 8) == -1);
+    assert(get_status_code("HTTP/1.1 abc OK\r\n", 17) == -1);
+    assert(get_status_code(NULL, 0) == -1);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_lookup_header_name();
+    test_parse_response_head();
+    test_is_not_modified();
+    test_make_not_modified();
+    test_extract_chunked();
+    test_parse_host_field();
+    test_get_status_code();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
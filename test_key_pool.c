@@ -0,0 +1,263 @@
+/**************************************************************
+*
+*                       test_key_pool.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-29
+*
+*     Summary:
+*     Test driver for the pool of threads that runs RSA private
+*     key operations of TLS handshakes.
+*
+**************************************************************/
+
+#include "key_pool.h"
+#include <assert.h>
+#include <openssl/async.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_CERT_FILE "cert.pem" /* Certificate of the handshake test. */
+#define TEST_KEY_FILE "key.pem" /* RSA private key of the handshake test. */
+
+struct sign_args {
+    EVP_PKEY* pkey; /* Key to sign with. */
+    unsigned char* sig; /* Output signature. */
+    size_t sig_len; /* Byte size of sig. */
+};
+
+static const unsigned char message[] = "request for a signature";
+
+/**
+ * @brief Sign the message with SHA-256.
+ *
+ * @param arg Pointer to a struct sign_args*.
+ * @return int 1 on success; 0 otherwise.
+ */
+static int sign_message(void* arg)
+{
+    struct sign_args* args = *(struct sign_args**)arg;
+    EVP_MD_CTX* md_ctx = EVP_MD_CTX_new();
+    int ok;
+
+    ok = EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, args->pkey) == 1
+         && EVP_DigestSign(md_ctx,
+                           args->sig,
+                           &args->sig_len,
+                           message,
+                           sizeof(message)) == 1;
+    EVP_MD_CTX_free(md_ctx);
+    return ok;
+}
+
+/**
+ * @brief Verify a signature of the message with SHA-256.
+ *
+ * @param pkey Key to verify with.
+ * @param sig Signature.
+ * @param sig_len Byte size of sig.
+ * @return int 1 if it is valid; 0 otherwise.
+ */
+static int verify_message(EVP_PKEY* pkey, unsigned char* sig, size_t sig_len)
+{
+    EVP_MD_CTX* md_ctx = EVP_MD_CTX_new();
+    int ok;
+
+    ok = EVP_DigestVerifyInit(md_ctx, NULL, EVP_sha256(), NULL, pkey) == 1 &&
+         EVP_DigestVerify(md_ctx, sig, sig_len, message, sizeof(message)) == 1;
+    EVP_MD_CTX_free(md_ctx);
+    return ok;
+}
+
+void test_key_pool_sign(void)
+{
+    EVP_PKEY* pkey = EVP_RSA_gen(2048);
+    EVP_PKEY* wrapped = NULL;
+    unsigned char sig[256];
+    struct sign_args args = {NULL, sig, sizeof(sig)};
+    struct sign_args* argp = &args;
+    struct key_pool_stats stats;
+    ASYNC_WAIT_CTX* wait_ctx = ASYNC_WAIT_CTX_new();
+    ASYNC_JOB* job = NULL;
+    OSSL_ASYNC_FD fd;
+    size_t num_fds = 0;
+    struct pollfd pfd;
+    int ret = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST key_pool_wrap()\n");
+    assert(pkey != NULL && wait_ctx != NULL);
+    assert(key_pool_init(0) == -1);
+    assert(key_pool_init(2) == 0);
+    wrapped = key_pool_wrap(pkey);
+    assert(wrapped != NULL);
+
+    /* Outside an async job, the key signs on this thread. */
+    args.pkey = wrapped;
+    assert(sign_message(&argp) == 1);
+    assert(verify_message(pkey, sig, args.sig_len));
+    key_pool_get_stats(&stats);
+    assert(stats.inline_ops == 1 && stats.offloaded == 0);
+
+    /* In a job, the signature goes to the pool, and the job pauses until the
+     * eventfd of the operation is readable. */
+    args.sig_len = sizeof(sig);
+    memset(sig, 0, sizeof(sig));
+    assert(ASYNC_start_job(&job,
+                           wait_ctx,
+                           &ret,
+                           sign_message,
+                           &argp,
+                           sizeof(argp)) == ASYNC_PAUSE);
+    assert(ASYNC_WAIT_CTX_get_all_fds(wait_ctx, NULL, &num_fds) == 1);
+    assert(num_fds == 1);
+    assert(ASYNC_WAIT_CTX_get_all_fds(wait_ctx, &fd, &num_fds) == 1);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(ASYNC_start_job(&job,
+                           wait_ctx,
+                           &ret,
+                           sign_message,
+                           &argp,
+                           sizeof(argp)) == ASYNC_FINISH);
+    assert(ret == 1);
+    assert(verify_message(pkey, sig, args.sig_len));
+    key_pool_get_stats(&stats);
+    assert(stats.inline_ops == 1 && stats.offloaded == 1);
+    assert(stats.max_queued == 1);
+
+    /* A key that is not RSA is not wrapped. */
+    EVP_PKEY_free(wrapped);
+    wrapped = EVP_EC_gen("P-256");
+    assert(wrapped != NULL && key_pool_wrap(wrapped) == NULL);
+
+    EVP_PKEY_free(wrapped);
+    EVP_PKEY_free(pkey);
+    ASYNC_WAIT_CTX_free(wait_ctx);
+    key_pool_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/**
+ * @brief Step a handshake.
+ *
+ * @param ssl SSL of one end.
+ * @return int 1 once done; 0 if it waits for the peer; SSL_ERROR_WANT_ASYNC
+ * if it waits for the pool.
+ */
+static int step_handshake(SSL* ssl)
+{
+    int ret = SSL_do_handshake(ssl);
+    int err;
+
+    if (ret == 1) {
+        return 1;
+    }
+    err = SSL_get_error(ssl, ret);
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_ASYNC) {
+        ERR_print_errors_fp(stderr);
+    }
+    assert(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_ASYNC);
+    return err == SSL_ERROR_WANT_ASYNC ? err : 0;
+}
+
+void test_key_pool_handshake(void)
+{
+    SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL* server;
+    SSL* client;
+    BIO* server_bio;
+    BIO* client_bio;
+    struct key_pool_stats stats;
+    int server_done = 0;
+    int client_done = 0;
+    int waits = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST key_pool_use()\n");
+    assert(key_pool_init(1) == 0);
+    assert(SSL_CTX_use_certificate_file(server_ctx,
+                                        TEST_CERT_FILE,
+                                        SSL_FILETYPE_PEM) == 1);
+    assert(SSL_CTX_use_PrivateKey_file(server_ctx,
+                                       TEST_KEY_FILE,
+                                       SSL_FILETYPE_PEM) == 1);
+    assert(key_pool_use(server_ctx) == 0);
+    assert(SSL_CTX_check_private_key(server_ctx) == 1);
+
+    /* Handshake over a BIO pair; the server signs on the pool. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(BIO_new_bio_pair(&server_bio, 0, &client_bio, 0) == 1);
+    SSL_set_bio(server, server_bio, server_bio);
+    SSL_set_bio(client, client_bio, client_bio);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    SSL_set_mode(server, SSL_MODE_ASYNC);
+    for (int i = 0; i < 100 && !(server_done && client_done); ++i) {
+        int ret;
+
+        if (!client_done) {
+            client_done = step_handshake(client);
+        }
+        if (!server_done) {
+            ret = step_handshake(server);
+            if (ret == SSL_ERROR_WANT_ASYNC) {
+                OSSL_ASYNC_FD fd;
+                size_t num_fds = 0;
+                struct pollfd pfd;
+
+                assert(SSL_get_all_async_fds(server, NULL, &num_fds) == 1);
+                assert(num_fds == 1);
+                assert(SSL_get_all_async_fds(server, &fd, &num_fds) == 1);
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                assert(poll(&pfd, 1, 5000) == 1);
+                waits++;
+            }
+            else {
+                server_done = ret;
+            }
+        }
+    }
+    assert(server_done && client_done);
+    assert(waits >= 1);
+    key_pool_get_stats(&stats);
+    assert(stats.offloaded >= 1);
+
+    /* The connection carries data. */
+    assert(SSL_write(client, "ping", 4) == 4);
+    {
+        char buf[8];
+
+        assert(SSL_read(server, buf, sizeof(buf)) == 4);
+        assert(memcmp(buf, "ping", 4) == 0);
+    }
+
+    SSL_free(server);
+    SSL_free(client);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    key_pool_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_key_pool_sign();
+    test_key_pool_handshake();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
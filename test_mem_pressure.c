@@ -0,0 +1,139 @@
+/**************************************************************
+*
+*                    test_mem_pressure.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-16
+*
+*     Summary:
+*     Test driver for memory pressure reading and cache budget
+*     sizing.
+*
+**************************************************************/
+
+#include "mem_pressure.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MB (1024 * 1024)
+
+/* Write the given contents to dir/name. */
+void write_file(const char* dir, const char* name, const char* contents)
+{
+    char path[512];
+    FILE* file;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    file = fopen(path, "w");
+    assert(file != NULL);
+    fputs(contents, file);
+    fclose(file);
+}
+
+/* Remove dir/name. */
+void remove_file(const char* dir, const char* name)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    unlink(path);
+}
+
+void test_mem_pressure_read(void)
+{
+    char dir[] = "/tmp/test_mem_pressure.XXXXXX";
+    struct mem_pressure pressure;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST mem_pressure_read()\n");
+    assert(mkdtemp(dir) != NULL);
+
+    /* cgroup v2. */
+    write_file(dir,
+               "memory.pressure",
+               "some avg10=12.50 avg60=3.00 avg300=1.00 total=12345\n"
+               "full avg10=1.00 avg60=0.00 avg300=0.00 total=100\n");
+    write_file(dir, "memory.current", "104857600\n");
+    write_file(dir, "memory.max", "max\n");
+    assert(mem_pressure_read(dir, &pressure) == 0);
+    assert(pressure.some_avg10 == 12.5);
+    assert(pressure.current == 100 * MB);
+    assert(pressure.limit == -1);
+
+    /* cgroup v1. */
+    remove_file(dir, "memory.current");
+    remove_file(dir, "memory.max");
+    write_file(dir, "memory.usage_in_bytes", "1048576\n");
+    write_file(dir, "memory.limit_in_bytes", "2097152\n");
+    assert(mem_pressure_read(dir, &pressure) == 0);
+    assert(pressure.current == MB);
+    assert(pressure.limit == 2 * MB);
+
+    remove_file(dir, "memory.pressure");
+    remove_file(dir, "memory.usage_in_bytes");
+    remove_file(dir, "memory.limit_in_bytes");
+    rmdir(dir);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_mem_pressure_next_budget(void)
+{
+    struct mem_pressure_config config;
+    struct mem_pressure pressure;
+    size_t budget;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST mem_pressure_next_budget()\n");
+    config.limit = 0;
+    config.psi_threshold = 10.0;
+    config.min_budget = 16 * MB;
+    config.max_budget = 64 * MB;
+    pressure.current = -1;
+    pressure.limit = -1;
+
+    /* Stalls shrink the budget by a quarter, down to the min. */
+    pressure.some_avg10 = 20.0;
+    budget = mem_pressure_next_budget(&config, &pressure, 64 * MB);
+    assert(budget == 48 * MB);
+    budget = mem_pressure_next_budget(&config, &pressure, 20 * MB);
+    assert(budget == 16 * MB);
+
+    /* Between half the threshold and the threshold, the budget holds. */
+    pressure.some_avg10 = 7.0;
+    assert(mem_pressure_next_budget(&config, &pressure, 48 * MB) == 48 * MB);
+
+    /* Once calm, the budget regrows by 1/16 of the max, up to the max. */
+    pressure.some_avg10 = 0.0;
+    assert(mem_pressure_next_budget(&config, &pressure, 48 * MB) == 52 * MB);
+    assert(mem_pressure_next_budget(&config, &pressure, 62 * MB) == 64 * MB);
+
+    /* Memory near the limit is pressure even without stalls. */
+    pressure.current = 95 * MB;
+    pressure.limit = 100 * MB;
+    assert(mem_pressure_next_budget(&config, &pressure, 64 * MB) == 48 * MB);
+    pressure.current = 85 * MB;
+    assert(mem_pressure_next_budget(&config, &pressure, 48 * MB) == 48 * MB);
+    pressure.current = 50 * MB;
+    assert(mem_pressure_next_budget(&config, &pressure, 48 * MB) == 52 * MB);
+
+    /* A configured limit overrides the limit of the cgroup. */
+    config.limit = 50 * MB;
+    assert(mem_pressure_next_budget(&config, &pressure, 64 * MB) == 48 * MB);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_mem_pressure_read();
+    test_mem_pressure_next_budget();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,316 @@
+/**************************************************************
+*
+*                        test_plugin.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2022-01-04
+*
+*     Summary:
+*     Test driver for plugins, with plugin_example.so and
+*     plugins linked in.
+*
+**************************************************************/
+
+#include "plugin.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXAMPLE "./plugin_example.so" /* Example plugin. */
+
+static int verdict_of_b = PLUGIN_CONTINUE; /* Verdict of plugin b. */
+static int runs_of_b = 0; /* Number of hooks of plugin b run. */
+
+/**
+ * @brief Keep the argument as the data of a plugin.
+ *
+ * @param arg Header line to append.
+ * @param out_data Output; arg.
+ * @return int 0.
+ */
+static int append_init(const char* arg, void** out_data)
+{
+    *out_data = (void*)arg;
+    return 0;
+}
+
+/**
+ * @brief Append the header line of the plugin to a head.
+ *
+ * @param ctx Context.
+ * @param head Head.
+ * @param out Output; the new head.
+ * @return int PLUGIN_REPLACE.
+ */
+static int append_line(const struct plugin_ctx* ctx,
+                       struct plugin_view head,
+                       struct plugin_view* out)
+{
+    const char* line = ctx->data;
+    size_t len = strlen(line);
+    char* buf = plugin_alloc(ctx->arena, head.len + len + 2);
+
+    assert(buf != NULL);
+    memcpy(buf, head.data, head.len);
+    memcpy(buf + head.len, line, len);
+    memcpy(buf + head.len + len, "\r\n", 2);
+    out->data = buf;
+    out->len = head.len + len + 2;
+    return PLUGIN_REPLACE;
+}
+
+/**
+ * @brief Hook of response heads of plugin a.
+ */
+static int a_response_head(const struct plugin_ctx* ctx,
+                           int status,
+                           struct plugin_view head,
+                           struct plugin_view* out)
+{
+    assert(status == 200);
+    return append_line(ctx, head, out);
+}
+
+/**
+ * @brief Hook of request heads of plugin a, which closes a client on a
+ * request without an Authorization field.
+ */
+static int a_request_head(const struct plugin_ctx* ctx,
+                          struct plugin_view head,
+                          struct plugin_view* out)
+{
+    struct plugin_view value;
+
+    (void)ctx;
+    (void)out;
+    if (!plugin_find_header(head, "authorization", &value)) {
+        return PLUGIN_CLOSE;
+    }
+    assert(value.len == 10 && memcmp(value.data, "Basic abcd", 10) == 0);
+    return PLUGIN_CONTINUE;
+}
+
+/**
+ * @brief Hook of request heads of plugin b.
+ */
+static int b_request_head(const struct plugin_ctx* ctx,
+                          struct plugin_view head,
+                          struct plugin_view* out)
+{
+    runs_of_b++;
+    return append_line(ctx, head, out);
+}
+
+/**
+ * @brief Hook of response heads of plugin b, with its set verdict.
+ */
+static int b_response_head(const struct plugin_ctx* ctx,
+                           int status,
+                           struct plugin_view head,
+                           struct plugin_view* out)
+{
+    (void)status;
+    runs_of_b++;
+    if (verdict_of_b == PLUGIN_REPLACE) {
+        return append_line(ctx, head, out);
+    }
+    return verdict_of_b;
+}
+
+static const struct plugin_desc plugin_a = {
+    PLUGIN_ABI_VERSION, "a", append_init, NULL,
+    a_request_head, NULL, NULL, a_response_head, NULL,
+};
+
+static const struct plugin_desc plugin_b = {
+    PLUGIN_ABI_VERSION, "b", append_init, NULL,
+    b_request_head, NULL, NULL, b_response_head, NULL,
+};
+
+static const struct plugin_desc plugin_old = {
+    PLUGIN_ABI_VERSION + 1, "old", NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL,
+};
+
+/**
+ * @brief Make a view of a string.
+ *
+ * @param str String.
+ * @return struct plugin_view View of str.
+ */
+static struct plugin_view view_of(const char* str)
+{
+    struct plugin_view view = {str, strlen(str)};
+
+    return view;
+}
+
+/**
+ * @brief Whether a view holds a string.
+ *
+ * @param view View.
+ * @param str String.
+ * @return int 1 if it does; 0 otherwise.
+ */
+static int view_is(struct plugin_view view, const char* str)
+{
+    return view.len == strlen(str) && memcmp(view.data, str, view.len) == 0;
+}
+
+void test_plugin_none(void)
+{
+    const char* head = "GET / HTTP/1.1\r\nHost: a\r\n";
+    struct plugin_view out;
+    char mem[32];
+    struct plugin_arena arena = {mem, sizeof(mem), 0};
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST plugin none\n");
+    for (int stage = 0; stage < PLUGIN_NUM_STAGES; ++stage) {
+        assert(!PLUGIN_HOOKED(stage));
+    }
+    assert(plugin_request_head(5, view_of(head), &out) == PLUGIN_CONTINUE);
+    assert(out.data == head);
+
+    /* The arena hands out 8-byte aligned memory until it is full. */
+    assert(plugin_alloc(&arena, 3) == mem);
+    assert(plugin_alloc(&arena, 8) == mem + 8);
+    assert(plugin_alloc(&arena, 17) == NULL);
+    assert(plugin_alloc(&arena, 16) == mem + 16);
+    assert(plugin_alloc(&arena, 0) == mem + 32);
+    assert(plugin_alloc(&arena, 1) == NULL);
+    plugin_unload_all();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_plugin_example(void)
+{
+    struct plugin_stats stats;
+    struct plugin_view out;
+    int port = 80;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST plugin example\n");
+    assert(plugin_load(EXAMPLE "=deny=/admin;nocache=/live/;"
+                       "route=127.0.0.1:8081;header=X-Edge: 1") == 0);
+    for (int stage = 0; stage < PLUGIN_NUM_STAGES; ++stage) {
+        assert(PLUGIN_HOOKED(stage));
+    }
+
+    assert(plugin_request_head(5,
+                               view_of("GET http://example.com/admin/x "
+                                       "HTTP/1.1\r\nHost: example.com\r\n"),
+                               &out) == PLUGIN_RESPOND);
+    assert(view_is(out,
+                   "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n"));
+    assert(plugin_request_head(5,
+                               view_of("GET /index.html HTTP/1.1\r\n"),
+                               &out) == PLUGIN_CONTINUE);
+
+    assert(plugin_cache_lookup(5, view_of("example.com/live/1"), &out) ==
+           PLUGIN_BYPASS);
+    assert(plugin_cache_lookup(5, view_of("example.com/a"), &out) ==
+           PLUGIN_CONTINUE);
+    assert(view_is(out, "example.com/a"));
+
+    assert(plugin_upstream_select(5, view_of("example.com"), &port, &out) ==
+           PLUGIN_REPLACE);
+    assert(view_is(out, "127.0.0.1"));
+    assert(port == 8081);
+
+    assert(plugin_response_head(5,
+                                200,
+                                view_of("HTTP/1.1 200 OK\r\n"),
+                                &out) == PLUGIN_REPLACE);
+    assert(view_is(out, "HTTP/1.1 200 OK\r\nX-Edge: 1\r\n"));
+    assert(plugin_body_chunk(5, view_of("hello")) == PLUGIN_CONTINUE);
+
+    plugin_get_stats(&stats);
+    assert(stats.runs[PLUGIN_REQUEST_HEAD] == 2);
+    assert(stats.runs[PLUGIN_BODY_CHUNK] == 1);
+    assert(stats.responded == 1);
+    assert(stats.bypassed == 1);
+    assert(stats.replaced == 2);
+    assert(stats.invalid == 0);
+    plugin_unload_all();
+    assert(!PLUGIN_HOOKED(PLUGIN_REQUEST_HEAD));
+
+    /* A bad argument fails its init. */
+    assert(plugin_load(EXAMPLE "=route=nowhere") < 0);
+    assert(plugin_load(EXAMPLE "=bogus") < 0);
+    assert(!PLUGIN_HOOKED(PLUGIN_REQUEST_HEAD));
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_plugin_chain(void)
+{
+    const char* request = "GET / HTTP/1.1\r\nAuthorization: Basic abcd\r\n";
+    struct plugin_stats stats;
+    struct plugin_view out;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST plugin chain\n");
+    assert(plugin_register(&plugin_a, "X-A: 1") == 0);
+    assert(plugin_register(&plugin_b, "X-B: 1") == 0);
+    assert(plugin_hooks[PLUGIN_RESPONSE_HEAD] == 2);
+    assert(!PLUGIN_HOOKED(PLUGIN_CACHE_LOOKUP));
+
+    /* Each hook works on the output of the one before. */
+    verdict_of_b = PLUGIN_REPLACE;
+    assert(plugin_response_head(5,
+                                200,
+                                view_of("HTTP/1.1 200 OK\r\n"),
+                                &out) == PLUGIN_REPLACE);
+    assert(view_is(out, "HTTP/1.1 200 OK\r\nX-A: 1\r\nX-B: 1\r\n"));
+
+    /* A verdict not allowed at the stage is taken as PLUGIN_CONTINUE. */
+    verdict_of_b = PLUGIN_RESPOND;
+    assert(plugin_response_head(5,
+                                200,
+                                view_of("HTTP/1.1 200 OK\r\n"),
+                                &out) == PLUGIN_REPLACE);
+    assert(view_is(out, "HTTP/1.1 200 OK\r\nX-A: 1\r\n"));
+    verdict_of_b = PLUGIN_CLOSE;
+    assert(plugin_response_head(5,
+                                200,
+                                view_of("HTTP/1.1 200 OK\r\n"),
+                                &out) == PLUGIN_CLOSE);
+
+    /* A closing hook stops the chain. */
+    runs_of_b = 0;
+    assert(plugin_request_head(5, view_of(request), &out) == PLUGIN_REPLACE);
+    assert(runs_of_b == 1);
+    assert(view_is(out, "GET / HTTP/1.1\r\nAuthorization: Basic abcd\r\n"
+                        "X-B: 1\r\n"));
+    assert(plugin_request_head(5, view_of("GET / HTTP/1.1\r\n"), &out) ==
+           PLUGIN_CLOSE);
+    assert(runs_of_b == 1);
+
+    plugin_get_stats(&stats);
+    assert(stats.invalid == 1);
+    assert(stats.closed == 2);
+    assert(stats.replaced == 3);
+
+    /* A plugin of another ABI is refused, as is a missing one. */
+    assert(plugin_register(&plugin_old, NULL) < 0);
+    assert(plugin_load("./no_such_plugin.so") < 0);
+    assert(plugin_hooks[PLUGIN_REQUEST_HEAD] == 2);
+    plugin_unload_all();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_plugin_none();
+    test_plugin_example();
+    test_plugin_chain();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/**************************************************************
+*
+*                        test_sim.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-20
+*
+*     Summary:
+*     Test driver for the proxy in the deterministic simulator.
+*
+**************************************************************/
+
+#include "sim.h"
+#include "deadline.h"
+#include "upstream.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void test_sim_no_faults(void)
+{
+    struct sim_config config;
+    struct sim_result result;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST sim_run() without faults\n");
+    sim_init_config(&config);
+    config.clients = 2000;
+    config.slow_rate = 0;
+    config.short_write_rate = 0;
+    config.eintr_rate = 0;
+    config.client_reset_rate = 0;
+    config.origin_reset_rate = 0;
+    config.dns_fail_rate = 0;
+    config.refuse_rate = 0;
+    config.slowloris_rate = 0;
+    config.stall_rate = 0;
+    config.blackhole_rate = 0;
+    assert(sim_run(&config, &result) == 0);
+
+    /* Every client gets its response, and the cache serves some. */
+    assert(result.completed == config.clients);
+    assert(result.faults == 0);
+    assert(result.origin_requests > 0);
+    assert(result.origin_requests < config.clients);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sim_faults(void)
+{
+    struct sim_config config;
+    struct sim_result result;
+    struct deadline_stats stats;
+    long connect_kills = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST sim_run() with faults\n");
+    sim_init_config(&config);
+    config.clients = 3000;
+    for (config.seed = 1; config.seed <= 3; ++config.seed) {
+        assert(sim_run(&config, &result) == 0);
+        assert(result.faults > 0);
+        assert(result.completed > config.clients / 2);
+        assert(result.completed + result.timed_out + result.closed +
+                   result.reset + result.rejected ==
+               config.clients);
+
+        /* Slowloris clients and stalled origins are cut off. */
+        deadline_get_stats(&stats);
+        assert(stats.kills[DEADLINE_REASON_HEADER] > 0);
+        assert(stats.kills[DEADLINE_REASON_FIRST_BYTE] > 0);
+        connect_kills += stats.kills[DEADLINE_REASON_CONNECT];
+    }
+    assert(connect_kills > 0);
+
+    /* The same with the clock eviction policy and compression. */
+    config.proxy_args = "-z -e clock";
+    assert(sim_run(&config, &result) == 0);
+    assert(result.faults > 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sim_replay(void)
+{
+    struct sim_config config;
+    struct sim_result first;
+    struct sim_result second;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST sim_run() replay\n");
+    sim_init_config(&config);
+    config.clients = 1000;
+    config.seed = 42;
+    assert(sim_run(&config, &first) == 0);
+    assert(sim_run(&config, &second) == 0);
+
+    /* A seed replays a run exactly. */
+    assert(first.digest == second.digest);
+    assert(first.completed == second.completed);
+    assert(first.timed_out == second.timed_out);
+    assert(first.origin_requests == second.origin_requests);
+    assert(first.polls == second.polls);
+    assert(first.virtual_sec == second.virtual_sec);
+
+    /* Another seed makes another run. */
+    config.seed = 43;
+    assert(sim_run(&config, &second) == 0);
+    assert(first.digest != second.digest);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sim_hedging(void)
+{
+    struct sim_config config;
+    struct sim_result plain;
+    struct sim_result hedged;
+    struct upstream_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST sim_run() with hedging and retries\n");
+    sim_init_config(&config);
+    config.clients = 5000;
+    config.slow_rate = 0;
+    config.short_write_rate = 0;
+    config.eintr_rate = 0;
+    config.client_reset_rate = 0;
+    config.origin_reset_rate = 0;
+    config.dns_fail_rate = 0;
+    config.refuse_rate = 0;
+    config.slowloris_rate = 0;
+    config.stall_rate = 0;
+    config.blackhole_rate = 0;
+    config.jitter_rate = 0.03;
+    assert(sim_run(&config, &plain) == 0);
+    upstream_get_stats(&stats);
+    assert(stats.hedges == 0);
+
+    /* Hedges cut the tail of late origins at a few percent more load. */
+    config.proxy_args = "-h 20";
+    assert(sim_run(&config, &hedged) == 0);
+    upstream_get_stats(&stats);
+    assert(stats.hedges > 0);
+    assert(stats.hedges_won > stats.hedges / 2);
+    assert(hedged.p99_ms < plain.p99_ms / 4);
+    assert(hedged.origin_requests < plain.origin_requests * 1.1);
+
+    /* Retries of refused connects stay within the budget. */
+    config.jitter_rate = 0;
+    config.refuse_rate = 0.5;
+    config.proxy_args = NULL;
+    assert(sim_run(&config, &plain) == 0);
+    upstream_get_stats(&stats);
+    assert(stats.retries > 0);
+    assert(stats.denied > 0);
+    assert(stats.retries <= stats.requests * UPSTREAM_BUDGET_RATIO +
+                                 UPSTREAM_BUDGET_MAX * config.num_origins);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_sim_breakers(void)
+{
+    struct sim_config config;
+    struct sim_result plain;
+    struct sim_result broken;
+    struct upstream_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST sim_run() with an origin down\n");
+    sim_init_config(&config);
+    config.clients = 5000;
+    config.slow_rate = 0;
+    config.short_write_rate = 0;
+    config.eintr_rate = 0;
+    config.client_reset_rate = 0;
+    config.origin_reset_rate = 0;
+    config.dns_fail_rate = 0;
+    config.refuse_rate = 0;
+    config.slowloris_rate = 0;
+    config.stall_rate = 0;
+    config.blackhole_rate = 0;
+    config.down_origins = 1;
+
+    /* Without breakers, every connect to the down origin blocks the loop. */
+    config.proxy_args = "-B 0";
+    assert(sim_run(&config, &plain) == 0);
+    assert(plain.rejected == 0);
+
+    /* With them, its requests fail fast and other origins stay fast. */
+    config.proxy_args = NULL;
+    assert(sim_run(&config, &broken) == 0);
+    upstream_get_stats(&stats);
+    assert(stats.opened > 0);
+    assert(stats.rejected == broken.rejected);
+    assert(broken.rejected > plain.timed_out / 2);
+    assert(broken.p99_ms < plain.p99_ms / 10);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_sim_no_faults();
+    test_sim_faults();
+    test_sim_replay();
+    test_sim_hedging();
+    test_sim_breakers();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
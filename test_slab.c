@@ -0,0 +1,189 @@
+/**************************************************************
+*
+*                       test_slab.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-14
+*
+*     Summary:
+*     Test driver for slab allocator.
+*
+**************************************************************/
+
+#include "slab.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void test_slab_init(void)
+{
+    struct slab_stats stats;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_init()\n");
+    assert(slab_init(0, 0) < 0);
+    /* Rounded up to whole pages. */
+    assert(slab_init(SLAB_PAGE_SIZE + 1, 0) == 0);
+    assert(slab_init(SLAB_PAGE_SIZE, 0) < 0);
+    slab_get_stats(&stats);
+    assert(stats.arena_size == 2 * SLAB_PAGE_SIZE);
+    assert(stats.pages_total == 2);
+    assert(stats.pages_free == 2);
+    assert(stats.bytes_requested == 0);
+    assert(stats.bytes_allocated == 0);
+    assert(stats.num_classes > 0);
+    assert(stats.classes[0].chunk_size == SLAB_MIN_CHUNK);
+    assert(stats.classes[stats.num_classes - 1].chunk_size == SLAB_MAX_CHUNK);
+    slab_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_class_of(void)
+{
+    struct slab_stats stats;
+    int cls;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_class_of()\n");
+    assert(slab_init(4 * SLAB_PAGE_SIZE, 0) == 0);
+    slab_get_stats(&stats);
+    assert(slab_class_of(0) < 0);
+    assert(slab_class_of(1) == 0);
+    assert(slab_class_of(SLAB_MIN_CHUNK) == 0);
+    assert(slab_class_of(SLAB_MIN_CHUNK + 1) == 1);
+    /* Each size maps to the smallest class that fits. */
+    for (size_t size = 1; size <= SLAB_MAX_CHUNK; size = size * 3 / 2 + 1) {
+        cls = slab_class_of(size);
+        assert(stats.classes[cls].chunk_size >= size);
+        assert(cls == 0 || stats.classes[cls - 1].chunk_size < size);
+    }
+    assert(slab_class_of(SLAB_MAX_CHUNK + 1) == slab_large_class());
+    assert(slab_class_of(4 * SLAB_PAGE_SIZE) == slab_large_class());
+    assert(slab_class_of(4 * SLAB_PAGE_SIZE + 1) < 0);
+    slab_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_alloc_free(void)
+{
+    struct slab_stats stats;
+    char* chunks[100];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_alloc() and slab_free()\n");
+    assert(slab_init(2 * SLAB_PAGE_SIZE, 0) == 0);
+    for (int i = 0; i < 100; ++i) {
+        chunks[i] = slab_alloc(100);
+        assert(chunks[i] != NULL);
+        memset(chunks[i], i, 100);
+    }
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 100; ++j) {
+            assert(chunks[i][j] == (char)i);
+        }
+    }
+    slab_get_stats(&stats);
+    assert(stats.pages_free == 1);
+    assert(stats.bytes_requested == 100 * 100);
+    assert(stats.classes[slab_class_of(100)].chunks_used == 100);
+    /* Freed chunks are reused. */
+    slab_free(chunks[50], 100);
+    assert(slab_alloc(100) == chunks[50]);
+    /* An empty page goes back to the free pages. */
+    for (int i = 0; i < 100; ++i) {
+        slab_free(chunks[i], 100);
+    }
+    slab_get_stats(&stats);
+    assert(stats.pages_free == 2);
+    assert(stats.bytes_requested == 0);
+    assert(stats.bytes_allocated == 0);
+    slab_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_alloc_exhausted(void)
+{
+    struct slab_stats stats;
+    char* small;
+    char* large;
+    char* run;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_alloc() exhausted\n");
+    assert(slab_init(3 * SLAB_PAGE_SIZE, 0) == 0);
+    small = slab_alloc(10);
+    assert(small != NULL);
+    large = slab_alloc(SLAB_MAX_CHUNK);
+    assert(large != NULL);
+    /* No free page left for a run of 2 pages. */
+    assert(slab_alloc(SLAB_PAGE_SIZE + 1) == NULL);
+    slab_free(large, SLAB_MAX_CHUNK);
+    run = slab_alloc(SLAB_PAGE_SIZE + 1);
+    assert(run != NULL);
+    memset(run, 'x', SLAB_PAGE_SIZE + 1);
+    slab_get_stats(&stats);
+    assert(stats.pages_free == 0);
+    assert(stats.classes[slab_large_class()].pages == 2);
+    assert(stats.bytes_allocated ==
+           stats.classes[0].chunk_size + 2 * SLAB_PAGE_SIZE);
+    /* The small class still has chunks in its page. */
+    assert(slab_alloc(10) != NULL);
+    assert(slab_alloc(SLAB_MAX_CHUNK) == NULL);
+    slab_free(run, SLAB_PAGE_SIZE + 1);
+    slab_get_stats(&stats);
+    assert(stats.pages_free == 2);
+    slab_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_slab_page_limit(void)
+{
+    char* a;
+    char* b;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST slab_set_page_limit()\n");
+    assert(slab_init(3 * SLAB_PAGE_SIZE, 0) == 0);
+    slab_set_page_limit(1);
+    a = slab_alloc(SLAB_MAX_CHUNK);
+    assert(a != NULL);
+    memset(a, 'x', SLAB_MAX_CHUNK);
+    /* The first page is full and no second page may be taken. */
+    assert(slab_alloc(SLAB_MAX_CHUNK) != NULL);
+    assert(slab_alloc(SLAB_MAX_CHUNK) == NULL);
+    assert(slab_alloc(10) == NULL);
+    assert(slab_pages_used() == 1);
+    slab_set_page_limit(2);
+    b = slab_alloc(10);
+    assert(b != NULL);
+    assert(slab_pages_used() == 2);
+    /* A freed page is handed back to the kernel once, and reads as zero when
+     * it is used again. */
+    slab_free(b, 10);
+    assert(slab_release_free_pages() == SLAB_PAGE_SIZE);
+    assert(slab_release_free_pages() == 0);
+    b = slab_alloc(10);
+    assert(b != NULL && b[0] == 0);
+    slab_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_slab_init();
+    test_slab_class_of();
+    test_slab_alloc_free();
+    test_slab_alloc_exhausted();
+    test_slab_page_limit();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,488 @@
+/**************************************************************
+*
+*                         test_tls.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-30
+*
+*     Summary:
+*     Test driver for the TLS settings shared by the client and
+*     upstream legs of SSL interception, and for the memory BIO
+*     engine.
+*
+**************************************************************/
+
+#include "tls.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_CERT_FILE "cert.pem" /* RSA certificate. */
+#define TEST_KEY_FILE "key.pem" /* RSA private key. */
+#define TEST_EC_CERT_FILE "ec_cert.pem" /* ECDSA P-256 certificate. */
+#define TEST_EC_KEY_FILE "ec_key.pem" /* ECDSA P-256 private key. */
+
+/**
+ * @brief Run a handshake between two SSLs over a BIO pair.
+ *
+ * @param server SSL of the server.
+ * @param client SSL of the client.
+ */
+static void handshake(SSL* server, SSL* client)
+{
+    BIO* server_bio;
+    BIO* client_bio;
+    int server_done = 0;
+    int client_done = 0;
+
+    assert(BIO_new_bio_pair(&server_bio, 0, &client_bio, 0) == 1);
+    SSL_set_bio(server, server_bio, server_bio);
+    SSL_set_bio(client, client_bio, client_bio);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    for (int i = 0; i < 100 && !(server_done && client_done); ++i) {
+        if (!client_done) {
+            client_done = SSL_do_handshake(client) == 1;
+        }
+        if (!server_done) {
+            server_done = SSL_do_handshake(server) == 1;
+        }
+    }
+    if (!(server_done && client_done)) {
+        ERR_print_errors_fp(stderr);
+    }
+    assert(server_done && client_done);
+}
+
+/**
+ * @brief Get the key type of the certificate the server sent.
+ *
+ * @param client SSL of the client after the handshake.
+ * @return int EVP_PKEY_RSA or EVP_PKEY_EC.
+ */
+static int peer_key_type(SSL* client)
+{
+    X509* cert = SSL_get1_peer_certificate(client);
+    int type;
+
+    assert(cert != NULL);
+    type = EVP_PKEY_get_base_id(X509_get0_pubkey(cert));
+    X509_free(cert);
+    return type;
+}
+
+void test_tls_tune_ctx(void)
+{
+    SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL* server;
+    SSL* client;
+    int aes_hw = tls_has_aes_hw();
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST tls_tune_ctx()\n");
+    assert(aes_hw == 0 || aes_hw == 1);
+    assert(tls_tune_ctx(server_ctx, aes_hw) == 0);
+    assert(tls_tune_ctx(client_ctx, aes_hw) == 0);
+    assert(SSL_CTX_get_min_proto_version(server_ctx) == TLS1_2_VERSION);
+    assert(SSL_CTX_get_max_proto_version(client_ctx) == TLS1_3_VERSION);
+    assert(tls_use_cert(server_ctx, TEST_CERT_FILE, TEST_KEY_FILE) == 0);
+
+    /* Two tuned ends speak TLS 1.3 over X25519, with the first cipher suite
+     * for this CPU. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    handshake(server, client);
+    assert(SSL_version(client) == TLS1_3_VERSION);
+    assert(SSL_get_negotiated_group(server) == NID_X25519);
+    assert(strcmp(SSL_get_cipher_name(client),
+                  aes_hw ? "TLS_AES_128_GCM_SHA256" :
+                  "TLS_CHACHA20_POLY1305_SHA256") == 0);
+    SSL_free(server);
+    SSL_free(client);
+
+    /* The server picks ChaCha20-Poly1305 for a client that puts it first,
+     * and AES-GCM for one that puts it after. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(SSL_set_ciphersuites(client, TLS_SUITES_CHACHA) == 1);
+    handshake(server, client);
+    assert(strcmp(SSL_get_cipher_name(client),
+                  "TLS_CHACHA20_POLY1305_SHA256") == 0);
+    SSL_free(server);
+    SSL_free(client);
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(SSL_set_ciphersuites(client, TLS_SUITES_AES) == 1);
+    handshake(server, client);
+    assert(strcmp(SSL_get_cipher_name(client),
+                  aes_hw ? "TLS_AES_128_GCM_SHA256" :
+                  "TLS_CHACHA20_POLY1305_SHA256") == 0);
+    SSL_free(server);
+    SSL_free(client);
+
+    /* A client without X25519 gets P-256. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(SSL_set1_groups_list(client, "P-256") == 1);
+    handshake(server, client);
+    assert(SSL_get_negotiated_group(server) == NID_X9_62_prime256v1);
+    SSL_free(server);
+    SSL_free(client);
+
+    /* A TLS 1.2 client gets an ECDHE AEAD cipher. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(SSL_set_max_proto_version(client, TLS1_2_VERSION) == 1);
+    handshake(server, client);
+    assert(SSL_version(client) == TLS1_2_VERSION);
+    assert(strcmp(SSL_get_cipher_name(client),
+                  aes_hw ? "ECDHE-RSA-AES128-GCM-SHA256" :
+                  "ECDHE-RSA-CHACHA20-POLY1305") == 0);
+    SSL_free(server);
+    SSL_free(client);
+
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_tls_use_cert(void)
+{
+    SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL* server;
+    SSL* client;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST tls_use_cert()\n");
+    assert(tls_tune_ctx(server_ctx, 1) == 0);
+    assert(tls_tune_ctx(client_ctx, 1) == 0);
+
+    /* A key must match the certificate loaded with it. */
+    assert(tls_use_cert(server_ctx, "missing.pem", TEST_KEY_FILE) == -1);
+    assert(tls_use_cert(server_ctx, TEST_CERT_FILE, TEST_EC_KEY_FILE) == -1);
+    SSL_CTX_free(server_ctx);
+    server_ctx = SSL_CTX_new(TLS_server_method());
+    assert(tls_tune_ctx(server_ctx, 1) == 0);
+    assert(tls_use_cert(server_ctx, TEST_CERT_FILE, TEST_KEY_FILE) == 0);
+    assert(tls_use_cert(server_ctx, TEST_EC_CERT_FILE, TEST_EC_KEY_FILE) == 0);
+
+    /* With both, a client that takes ECDSA gets the ECDSA certificate, in
+     * either version. */
+    for (int version = TLS1_2_VERSION; version <= TLS1_3_VERSION; ++version) {
+        server = SSL_new(server_ctx);
+        client = SSL_new(client_ctx);
+        assert(SSL_set_max_proto_version(client, version) == 1);
+        handshake(server, client);
+        assert(SSL_version(client) == version);
+        assert(peer_key_type(client) == EVP_PKEY_EC);
+        SSL_free(server);
+        SSL_free(client);
+    }
+
+    /* A client that takes RSA only gets the RSA certificate. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(SSL_set1_sigalgs_list(client, "rsa_pss_rsae_sha256") == 1);
+    handshake(server, client);
+    assert(peer_key_type(client) == EVP_PKEY_RSA);
+    SSL_free(server);
+    SSL_free(client);
+
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+/**
+ * @brief Wait until a socket is readable.
+ *
+ * @param fd FD of the socket.
+ */
+static void wait_readable(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 5000) == 1);
+}
+
+/**
+ * @brief Run a handshake between a server SSL on the engine and a client SSL
+ * on a non-blocking socket, stepping each in turn.
+ *
+ * @param server SSL of the server, attached with tls_attach().
+ * @param client SSL of the client, on fds[1].
+ * @param fds Socket pair; the server on fds[0].
+ */
+static void engine_handshake(SSL* server, SSL* client, int fds[2])
+{
+    int ret;
+
+    for (int i = 0; i < 100 && !SSL_is_init_finished(server); ++i) {
+        ret = SSL_do_handshake(client);
+        assert(ret == 1 || SSL_get_error(client, ret) == SSL_ERROR_WANT_READ);
+        wait_readable(fds[0]);
+        assert(tls_fill(server, fds[0]) > 0);
+        ret = tls_handshake(server, fds[0]);
+        assert(ret == 1 || ret == TLS_WANT_READ);
+    }
+    assert(SSL_is_init_finished(server));
+    assert(SSL_do_handshake(client) == 1);
+}
+
+void test_tls_engine(void)
+{
+    SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL* server;
+    SSL* client;
+    struct tls_stats stats;
+    char buf[64];
+    int fds[2];
+    int ret;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST tls_attach()\n");
+    assert(tls_tune_ctx(server_ctx, 1) == 0);
+    assert(tls_tune_ctx(client_ctx, 1) == 0);
+    assert(tls_use_cert(server_ctx, TEST_EC_CERT_FILE, TEST_EC_KEY_FILE) == 0);
+    /* No tickets: the client reads only what the test sends. */
+    assert(SSL_CTX_set_num_tickets(server_ctx, 0) == 1);
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    /* The server runs on the engine; the client on its socket. */
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(tls_attach(server) == 0);
+    assert(SSL_set_fd(client, fds[1]) == 1);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    /* The client never blocks, so one thread steps both ends. */
+    assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+    /* Without input, the handshake neither reads nor blocks. */
+    assert(tls_handshake(server, fds[0]) == TLS_WANT_READ);
+    assert(!tls_has_input(server));
+
+    /* The server steps once its socket turns readable. */
+    engine_handshake(server, client, fds);
+
+    /* Records sent in a row go out in one write. */
+    tls_get_stats(&stats);
+    assert(tls_send(server, "a", 1) == 1);
+    assert(tls_send(server, "bb", 2) == 2);
+    assert(tls_send(server, "ccc", 3) == 3);
+    assert(tls_flush(server, fds[0]) > 3);
+    assert(tls_flush(server, fds[0]) == 0);
+    {
+        struct tls_stats after;
+
+        tls_get_stats(&after);
+        assert(after.sends == stats.sends + 3);
+        assert(after.flushes == stats.flushes + 1);
+    }
+    assert(SSL_read(client, buf, sizeof(buf)) == 1);
+    assert(SSL_read(client, buf + 1, sizeof(buf) - 1) == 2);
+    assert(SSL_read(client, buf + 3, sizeof(buf) - 3) == 3);
+    assert(memcmp(buf, "abbccc", 6) == 0);
+
+    /* Two records in one socket read: the second is read without the socket,
+     * which tls_has_input() tells although the socket is drained. */
+    assert(SSL_write(client, "x", 1) == 1);
+    assert(SSL_write(client, "yy", 2) == 2);
+    wait_readable(fds[0]);
+    tls_get_stats(&stats);
+    assert(tls_read(server, fds[0], buf, sizeof(buf)) == 1 && buf[0] == 'x');
+    assert(tls_has_input(server));
+    assert(tls_read(server, fds[0], buf, sizeof(buf)) == 2);
+    assert(memcmp(buf, "yy", 2) == 0);
+    assert(!tls_has_input(server));
+    {
+        struct tls_stats after;
+
+        tls_get_stats(&after);
+        assert(after.fills == stats.fills + 1);
+        assert(after.buffered_reads == stats.buffered_reads + 1);
+    }
+
+    /* A plaintext larger than a record is read a record at a time. */
+    {
+        char big[20000];
+        char out[20000];
+        int got = 0;
+
+        memset(big, 'z', sizeof(big));
+        assert(tls_write(server, fds[0], big, sizeof(big)) == sizeof(big));
+        while (got < (int)sizeof(big)) {
+            ret = SSL_read(client, out + got, sizeof(out) - got);
+            assert(ret > 0);
+            got += ret;
+        }
+        assert(memcmp(big, out, sizeof(big)) == 0);
+    }
+
+    /* close_notify both ways. */
+    tls_shutdown(server, fds[0]);
+    assert(SSL_read(client, buf, sizeof(buf)) == 0);
+    assert(SSL_get_error(client, 0) == SSL_ERROR_ZERO_RETURN);
+    assert(SSL_shutdown(client) == 1);
+    wait_readable(fds[0]);
+    assert(tls_read(server, fds[0], buf, sizeof(buf)) == 0);
+
+    SSL_free(server);
+    SSL_free(client);
+    close(fds[0]);
+    close(fds[1]);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_tls_early_data(void)
+{
+    SSL_CTX* server_ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX* client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_SESSION* session = NULL;
+    SSL* server;
+    SSL* client;
+    struct tls_stats stats;
+    struct tls_stats after;
+    char* hello = NULL; /* First flight of the client. */
+    long hello_len;
+    char* data;
+    char buf[64];
+    int fds[2];
+    size_t n;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST tls_read_early()\n");
+    assert(tls_tune_ctx(server_ctx, 1) == 0);
+    assert(tls_tune_ctx(client_ctx, 1) == 0);
+    assert(tls_use_cert(server_ctx, TEST_EC_CERT_FILE, TEST_EC_KEY_FILE) == 0);
+    assert(tls_enable_early_data(server_ctx, 1024) == 0);
+
+    /* A first handshake gets the client a ticket that allows early data. */
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(tls_attach(server) == 0);
+    assert(SSL_set_fd(client, fds[1]) == 1);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    engine_handshake(server, client, fds);
+    assert(SSL_read(client, buf, sizeof(buf)) == -1);
+    session = SSL_get1_session(client);
+    assert(SSL_SESSION_get_max_early_data(session) == 1024);
+    tls_shutdown(server, fds[0]);
+    SSL_shutdown(client);
+    SSL_free(server);
+    SSL_free(client);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* The client resumes with a request in early data, which the server
+     * reads and answers before the client's Finished. The client is on the
+     * engine too, to keep its first flight for a replay. */
+    tls_get_stats(&stats);
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    server = SSL_new(server_ctx);
+    client = SSL_new(client_ctx);
+    assert(tls_attach(server) == 0);
+    assert(tls_attach(client) == 0);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    assert(SSL_set_session(client, session) == 1);
+    assert(SSL_write_early_data(client, "GET", 3, &n) == 1 && n == 3);
+    hello_len = BIO_get_mem_data(SSL_get_wbio(client), &data);
+    hello = malloc(hello_len);
+    assert(hello != NULL);
+    memcpy(hello, data, hello_len);
+    assert(tls_flush(client, fds[1]) == hello_len);
+    wait_readable(fds[0]);
+    assert(tls_fill(server, fds[0]) == hello_len);
+    assert(tls_read_early(server, fds[0], buf, sizeof(buf)) == 3);
+    assert(memcmp(buf, "GET", 3) == 0);
+    assert(tls_send(server, "OK", 2) == 2);
+    assert(tls_read_early(server, fds[0], buf, sizeof(buf)) == TLS_WANT_READ);
+    assert(!SSL_is_init_finished(server));
+
+    /* The answer arrives with the server's flight. */
+    wait_readable(fds[1]);
+    assert(tls_fill(client, fds[1]) > 0);
+    assert(tls_handshake(client, fds[1]) == 1);
+    assert(SSL_get_early_data_status(client) == SSL_EARLY_DATA_ACCEPTED);
+    assert(tls_has_input(client));
+    assert(tls_read(client, fds[1], buf, sizeof(buf)) == 2);
+    assert(memcmp(buf, "OK", 2) == 0);
+
+    /* The end of early data and the client's Finished end the handshake. */
+    wait_readable(fds[0]);
+    assert(tls_fill(server, fds[0]) > 0);
+    assert(tls_read_early(server, fds[0], buf, sizeof(buf)) == 0);
+    assert(tls_handshake(server, fds[0]) == 1);
+    assert(SSL_session_reused(server));
+    tls_get_stats(&after);
+    assert(after.early_accepted == stats.early_accepted + 1);
+    assert(after.early_bytes == stats.early_bytes + 3);
+    tls_shutdown(server, fds[0]);
+    SSL_free(server);
+    SSL_free(client);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* A replay of the first flight resumes nothing, and its early data is
+     * refused. */
+    tls_get_stats(&stats);
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    server = SSL_new(server_ctx);
+    assert(tls_attach(server) == 0);
+    SSL_set_accept_state(server);
+    assert(write(fds[1], hello, hello_len) == hello_len);
+    wait_readable(fds[0]);
+    assert(tls_fill(server, fds[0]) == hello_len);
+    assert(tls_read_early(server, fds[0], buf, sizeof(buf)) == 0);
+    assert(SSL_get_early_data_status(server) == SSL_EARLY_DATA_REJECTED);
+    assert(tls_handshake(server, fds[0]) == TLS_WANT_READ);
+    assert(!SSL_session_reused(server));
+    tls_get_stats(&after);
+    assert(after.early_rejected == stats.early_rejected + 1);
+    assert(after.early_bytes == stats.early_bytes);
+    SSL_free(server);
+    close(fds[0]);
+    close(fds[1]);
+
+    free(hello);
+    SSL_SESSION_free(session);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_tls_tune_ctx();
+    test_tls_use_cert();
+    test_tls_engine();
+    test_tls_early_data();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,338 @@
+/**************************************************************
+*
+*                       test_upstream.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-22
+*
+*     Summary:
+*     Test driver for per-host upstream state.
+*
+**************************************************************/
+
+#include "upstream.h"
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void test_upstream_budget(void)
+{
+    struct upstream_config config;
+    struct upstream_stats stats;
+    int taken = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream_take_budget()\n");
+    config.budget_ratio = 0.1;
+    config.hedge_min_us = 0;
+    config.breaker_failures = 0;
+    config.breaker_open = 0;
+    assert(upstream_init(&config) == 0);
+
+    /* A new host starts with UPSTREAM_BUDGET_MAX tokens. */
+    while (upstream_take_budget("a.com", 0)) {
+        taken++;
+    }
+    assert(taken == (int)UPSTREAM_BUDGET_MAX);
+
+    /* Then it earns one token per 10 requests. */
+    for (int i = 0; i < 9; ++i) {
+        upstream_add_request("a.com");
+    }
+    assert(!upstream_take_budget("a.com", 1));
+    upstream_add_request("a.com");
+    upstream_add_request("a.com");
+    assert(upstream_take_budget("a.com", 1));
+    assert(!upstream_take_budget("a.com", 1));
+
+    /* Hosts have budgets of their own, which stop growing at the max. */
+    for (int i = 0; i < 1000; ++i) {
+        upstream_add_request("b.com");
+    }
+    taken = 0;
+    while (upstream_take_budget("b.com", 0)) {
+        taken++;
+    }
+    assert(taken == (int)UPSTREAM_BUDGET_MAX);
+
+    upstream_get_stats(&stats);
+    assert(stats.requests == 1011);
+    assert(stats.retries == 2 * (int)UPSTREAM_BUDGET_MAX);
+    assert(stats.hedges == 1);
+    assert(stats.denied == 4);
+
+    /* A ratio of 0 allows no retry. */
+    config.budget_ratio = 0;
+    assert(upstream_init(&config) == 0);
+    assert(!upstream_take_budget("a.com", 0));
+    upstream_log_stats();
+    upstream_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_upstream_hedge_delay(void)
+{
+    struct upstream_config config;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream_hedge_delay()\n");
+    config.budget_ratio = 0.1;
+    config.hedge_min_us = 1000;
+    config.breaker_failures = 0;
+    config.breaker_open = 0;
+    assert(upstream_init(&config) == 0);
+
+    /* Too few samples to hedge. */
+    for (int i = 1; i < UPSTREAM_MIN_SAMPLES; ++i) {
+        upstream_add_latency("a.com", i * 100);
+    }
+    assert(upstream_hedge_delay("a.com") < 0);
+
+    /* The 95th percentile of 1..100 ms is 95 ms. */
+    assert(upstream_init(&config) == 0);
+    for (int i = 100; i >= 1; --i) {
+        upstream_add_latency("a.com", i * 1000);
+    }
+    assert(upstream_hedge_delay("a.com") == 95000);
+
+    /* Only the latest UPSTREAM_SAMPLES samples count. */
+    for (int i = 0; i < UPSTREAM_SAMPLES; ++i) {
+        upstream_add_latency("a.com", 2000);
+    }
+    assert(upstream_hedge_delay("a.com") == 2000);
+
+    /* Fast hosts are hedged no sooner than hedge_min_us. */
+    for (int i = 0; i < UPSTREAM_SAMPLES; ++i) {
+        upstream_add_latency("a.com", 10);
+    }
+    assert(upstream_hedge_delay("a.com") == 1000);
+    assert(upstream_hedge_delay("b.com") < 0);
+
+    /* Hedging off. */
+    config.hedge_min_us = 0;
+    assert(upstream_init(&config) == 0);
+    for (int i = 0; i < UPSTREAM_SAMPLES; ++i) {
+        upstream_add_latency("a.com", 2000);
+    }
+    assert(upstream_hedge_delay("a.com") < 0);
+    upstream_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_upstream_next_addr(void)
+{
+    int counts[3] = {0, 0, 0};
+    char host[32];
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream_next_addr()\n");
+    assert(upstream_init(NULL) == 0);
+
+    /* Addresses of a host are taken in turn. */
+    for (int i = 0; i < 300; ++i) {
+        counts[upstream_next_addr("a.com", 3)]++;
+    }
+    assert(counts[0] == 100 && counts[1] == 100 && counts[2] == 100);
+    assert(upstream_next_addr("a.com", 1) == 0);
+
+    /* More hosts than the table holds share one slot. */
+    for (int i = 0; i < UPSTREAM_MAX_HOSTS * 2; ++i) {
+        snprintf(host, sizeof(host), "host%d.com", i);
+        upstream_add_latency(host, 1);
+        assert(upstream_next_addr(host, 2) >= 0);
+    }
+    assert(upstream_take_budget("a.com", 0));
+    upstream_clear();
+
+    /* Calls before upstream_init() are ignored. */
+    upstream_add_request("a.com");
+    upstream_add_latency("a.com", 1);
+    assert(!upstream_take_budget("a.com", 0));
+    assert(upstream_hedge_delay("a.com") < 0);
+    assert(upstream_next_addr("a.com", 2) == 0);
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_upstream_breaker(void)
+{
+    struct upstream_config config;
+    struct upstream_stats stats;
+    time_t now = 1000;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream_allow()\n");
+    config.budget_ratio = 0.1;
+    config.hedge_min_us = 0;
+    config.breaker_failures = 3;
+    config.breaker_open = 5;
+    assert(upstream_init(&config) == 0);
+
+    /* A success resets the count of consecutive failures. */
+    upstream_report("a.com", 0, now);
+    upstream_report("a.com", 0, now);
+    upstream_report("a.com", 1, now);
+    upstream_report("a.com", 0, now);
+    upstream_report("a.com", 0, now);
+    assert(upstream_breaker_state("a.com") == UPSTREAM_CLOSED);
+    assert(upstream_allow("a.com", now));
+
+    /* The third failure in a row opens the breaker. */
+    upstream_report("a.com", 0, now);
+    assert(upstream_breaker_state("a.com") == UPSTREAM_OPEN);
+    assert(!upstream_allow("a.com", now));
+    assert(!upstream_allow("a.com", now + 4));
+    assert(upstream_allow("b.com", now));
+
+    /* After the open period, one request probes the host. */
+    assert(upstream_allow("a.com", now + 5));
+    assert(upstream_breaker_state("a.com") == UPSTREAM_HALF_OPEN);
+    assert(!upstream_allow("a.com", now + 5));
+
+    /* A failed probe opens it for twice as long. */
+    upstream_report("a.com", 0, now + 6);
+    assert(upstream_breaker_state("a.com") == UPSTREAM_OPEN);
+    assert(!upstream_allow("a.com", now + 15));
+    assert(upstream_allow("a.com", now + 16));
+
+    /* A probe that never reports is taken as lost. */
+    assert(!upstream_allow("a.com", now + 16 + UPSTREAM_PROBE_TIMEOUT - 1));
+    assert(upstream_allow("a.com", now + 16 + UPSTREAM_PROBE_TIMEOUT));
+
+    /* A successful probe closes it. */
+    upstream_report("a.com", 1, now + 50);
+    assert(upstream_breaker_state("a.com") == UPSTREAM_CLOSED);
+    assert(upstream_allow("a.com", now + 50));
+
+    /* The open period stops growing at UPSTREAM_OPEN_MAX. */
+    for (int i = 0; i < 3; ++i) {
+        upstream_report("a.com", 0, now);
+    }
+    for (int i = 0; i < 20; ++i) {
+        assert(upstream_allow("a.com", now + UPSTREAM_OPEN_MAX));
+        upstream_report("a.com", 0, now);
+    }
+    assert(!upstream_allow("a.com", now + UPSTREAM_OPEN_MAX - 1));
+
+    upstream_get_stats(&stats);
+    assert(stats.opened == 23);
+    assert(stats.probes == 23);
+    assert(stats.rejected == 6);
+    assert(stats.open_hosts == 1);
+    upstream_log_stats();
+
+    /* Breakers off. */
+    config.breaker_failures = 0;
+    assert(upstream_init(&config) == 0);
+    for (int i = 0; i < 10; ++i) {
+        upstream_report("a.com", 0, now);
+    }
+    assert(upstream_allow("a.com", now));
+    assert(upstream_breaker_state("a.com") == UPSTREAM_CLOSED);
+    upstream_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_upstream_eject(void)
+{
+    struct in_addr a;
+    struct in_addr b;
+    struct in_addr c;
+    time_t now = 1000;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream_eject()\n");
+    assert(upstream_init(NULL) == 0);
+    inet_aton("10.0.0.1", &a);
+    inet_aton("10.0.0.2", &b);
+    inet_aton("10.0.0.3", &c);
+
+    upstream_eject("a.com", a, now);
+    assert(upstream_is_ejected("a.com", a, now));
+    assert(!upstream_is_ejected("a.com", b, now));
+    assert(!upstream_is_ejected("b.com", a, now));
+    assert(!upstream_is_ejected("a.com", a, now + UPSTREAM_EJECT));
+
+    /* The ejection that ends first makes room for a new one. */
+    upstream_eject("a.com", b, now + 1);
+    upstream_eject("a.com", c, now + 2);
+    assert(!upstream_is_ejected("a.com", a, now + 2));
+    assert(upstream_is_ejected("a.com", b, now + 2));
+    assert(upstream_is_ejected("a.com", c, now + 2));
+    upstream_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+void test_upstream_many_hosts(void)
+{
+    struct upstream_config config;
+    struct upstream_stats stats;
+    char host[32];
+    time_t now = 1000;
+    int taken = 0;
+
+    fprintf(stderr, "--------------------\n");
+    fprintf(stderr, "TEST upstream hosts past the table\n");
+    config.budget_ratio = 0.1;
+    config.hedge_min_us = 0;
+    config.breaker_failures = 3;
+    config.breaker_open = 5;
+    assert(upstream_init(&config) == 0);
+
+    /* An open breaker keeps its slot however many hosts come after. */
+    for (int i = 0; i < 3; ++i) {
+        upstream_report("down.com", 0, now);
+    }
+    /* So does a host in use, whose next address keeps rotating. */
+    for (int i = 0; i < 4 * UPSTREAM_MAX_HOSTS; ++i) {
+        if (i % 100 == 0) {
+            assert(upstream_next_addr("busy.com", 1000) == i / 100);
+        }
+        sprintf(host, "h%d.com", i);
+        upstream_add_request(host);
+    }
+    assert(upstream_breaker_state("down.com") == UPSTREAM_OPEN);
+    assert(upstream_next_addr("busy.com", 1000) ==
+           4 * UPSTREAM_MAX_HOSTS / 100 + 1);
+
+    /* A new host still gets a breaker and a budget of its own. */
+    for (int i = 0; i < 3; ++i) {
+        upstream_report("late.com", 0, now);
+    }
+    assert(upstream_breaker_state("late.com") == UPSTREAM_OPEN);
+    assert(!upstream_allow("late.com", now));
+    assert(upstream_allow("later.com", now));
+    while (upstream_take_budget("late.com", 0)) {
+        taken++;
+    }
+    assert(taken == (int)UPSTREAM_BUDGET_MAX);
+    assert(upstream_take_budget("later.com", 0));
+
+    upstream_get_stats(&stats);
+    assert(stats.recycled >= 4 * UPSTREAM_MAX_HOSTS -
+           UPSTREAM_MAX_HOSTS / 4 * 3);
+    assert(stats.open_hosts == 2);
+    upstream_clear();
+    fprintf(stderr, "PASS\n");
+    fprintf(stderr, "--------------------\n");
+}
+
+int main(void)
+{
+    fprintf(stderr, "====================\n");
+    test_upstream_budget();
+    test_upstream_hedge_delay();
+    test_upstream_next_addr();
+    test_upstream_breaker();
+    test_upstream_eject();
+    test_upstream_many_hosts();
+    fprintf(stderr, "ALL PASS\n");
+    fprintf(stderr, "====================\n\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,456 @@
+/**************************************************************
+*
+*                           tls.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-30
+*
+*     Summary:
+*     Implementation for the TLS settings shared by the client
+*     and upstream legs of SSL interception, and for driving
+*     SSL objects over memory BIOs.
+*
+*     With read-ahead off, OpenSSL takes one record at a time
+*     from the read BIO, and stops at a record boundary once it
+*     returns plaintext. Data left in the read BIO thus starts
+*     with a record header, which tells whether a whole record
+*     is there.
+*
+*     OpenSSL keeps the anti-replay of early data: with early
+*     data on, a server issues tickets that point into its
+*     session cache and are removed on use, and it refuses
+*     early data with a ticket older than its age tells.
+*
+**************************************************************/
+
+#include "tls.h"
+#include "logger.h"
+#include "netio.h"
+#include <openssl/err.h>
+#include <string.h>
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#define TLS_HEADER_SIZE 5 /* Byte size of a record header. */
+
+static struct tls_stats stats; /* Statistics of the engine. */
+
+/**
+ * @brief Whether the CPU has AES instructions, e.g. AES-NI, which make
+ * AES-GCM faster than ChaCha20-Poly1305.
+ *
+ * @return int 1 if it has; 0 otherwise, or if unknown.
+ */
+int tls_has_aes_hw(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("aes") != 0;
+#elif defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Apply the shared settings to a context: TLS 1.2 to 1.3, the groups
+ * of TLS_GROUPS, and AES-GCM first with AES instructions, ChaCha20-Poly1305
+ * first without.
+ *
+ * @param ctx Context, non-null.
+ * @param aes_hw Whether to put AES-GCM first; typically tls_has_aes_hw().
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_tune_ctx(SSL_CTX* ctx, int aes_hw)
+{
+    const char* suites = aes_hw ? TLS_SUITES_AES : TLS_SUITES_CHACHA;
+    const char* ciphers = aes_hw ? TLS_CIPHERS_AES ":" TLS_CIPHERS_FALLBACK :
+                          TLS_CIPHERS_CHACHA ":" TLS_CIPHERS_FALLBACK;
+
+    /* Both ends negotiate the highest version they share, i.e. TLS 1.3 when
+     * the peer has it; TLS 1.0 and 1.1 are off. */
+    if (SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION) != 1) {
+        LOG_ERROR("SSL_CTX_set_proto_version");
+        return -1;
+    }
+
+    /* A client sends a key share for the first group only, so a server that
+     * supports X25519 needs no second round trip. */
+    if (SSL_CTX_set1_groups_list(ctx, TLS_GROUPS) != 1) {
+        LOG_ERROR("SSL_CTX_set1_groups_list");
+        return -1;
+    }
+    if (SSL_CTX_set_ciphersuites(ctx, suites) != 1 ||
+        SSL_CTX_set_cipher_list(ctx, ciphers) != 1) {
+        LOG_ERROR("SSL_CTX_set_cipher_list");
+        return -1;
+    }
+
+    /* Only servers read these. The server's order of signature algorithms
+     * puts ECDSA first, so it signs with an ECDSA certificate when it holds
+     * one and the client takes it. */
+    SSL_CTX_set_options(ctx,
+                        SSL_OP_CIPHER_SERVER_PREFERENCE |
+                        SSL_OP_PRIORITIZE_CHACHA);
+    return 0;
+}
+
+/**
+ * @brief Load a certificate and its private key into a server context.
+ *
+ * @param ctx Server context, non-null.
+ * @param cert_file Certificate PEM file.
+ * @param key_file Private key PEM file.
+ * @return int 0 on success; -1 if a file cannot be loaded or the key does not
+ * match the certificate.
+ */
+int tls_use_cert(SSL_CTX* ctx, const char* cert_file, const char* key_file)
+{
+    if (SSL_CTX_use_certificate_file(ctx, cert_file, SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        LOG_ERROR("SSL_CTX_use_certificate_file %s", cert_file);
+        return -1;
+    }
+
+    /* The key goes next to the certificate of its type, which must be the
+     * one just loaded. */
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        LOG_ERROR("SSL_CTX_use_PrivateKey_file %s", key_file);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Let a server context take TLS 1.3 early data from clients that
+ * resume a session with it.
+ *
+ * @param ctx Server context, non-null.
+ * @param max_bytes Max byte size of early data per connection, positive.
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_enable_early_data(SSL_CTX* ctx, uint32_t max_bytes)
+{
+    /* Single use tickets; the default, but required here. */
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_ANTI_REPLAY);
+    if (SSL_CTX_set_max_early_data(ctx, max_bytes) != 1 ||
+        SSL_CTX_set_recv_max_early_data(ctx, max_bytes) != 1) {
+        LOG_ERROR("fail to enable early data");
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Attach a pair of memory BIOs to an SSL in place of a socket.
+ *
+ * @param ssl SSL without BIOs, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_attach(SSL* ssl)
+{
+    BIO* rbio = BIO_new(BIO_s_mem());
+    BIO* wbio = BIO_new(BIO_s_mem());
+
+    if (rbio == NULL || wbio == NULL) {
+        BIO_free(rbio);
+        BIO_free(wbio);
+        return -1;
+    }
+    SSL_set_bio(ssl, rbio, wbio);
+    return 0;
+}
+
+/**
+ * @brief Read a socket once and hand the ciphertext to its SSL.
+ *
+ * @param ssl SSL of the socket.
+ * @param fd FD of the socket.
+ * @return int Byte size read; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+int tls_fill(SSL* ssl, int fd)
+{
+    char buf[TLS_FILL_SIZE];
+    ssize_t n = netio_read(fd, buf, sizeof(buf));
+
+    if (n <= 0) {
+        return n;
+    }
+    stats.fills++;
+    if (BIO_write(SSL_get_rbio(ssl), buf, n) != n) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Whether an SSL holds input to read without its socket.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @return int 1 if it holds input; 0 otherwise.
+ */
+int tls_has_input(SSL* ssl)
+{
+    const unsigned char* data;
+    long len;
+
+    if (SSL_pending(ssl) > 0) {
+        return 1;
+    }
+    len = BIO_get_mem_data(SSL_get_rbio(ssl), (char**)&data);
+    return len >= TLS_HEADER_SIZE &&
+           len >= TLS_HEADER_SIZE + (data[3] << 8 | data[4]);
+}
+
+/**
+ * @brief Continue the handshake of an SSL with the input it has, and write
+ * what it produced to its socket.
+ *
+ * @param ssl SSL attached with tls_attach(), in accept or connect state.
+ * @param fd FD of the socket.
+ * @return int 1 once done; TLS_WANT_READ until more input arrives;
+ * TLS_WANT_ASYNC while an async job waits; -1 on failure.
+ */
+int tls_handshake(SSL* ssl, int fd)
+{
+    int ret = SSL_do_handshake(ssl);
+    int err = ret == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl, ret);
+
+    /* Send the flight, or an alert on failure. */
+    if (tls_flush(ssl, fd) < 0) {
+        return -1;
+    }
+    switch (err) {
+    case SSL_ERROR_NONE:
+        return 1;
+    case SSL_ERROR_WANT_READ:
+        return TLS_WANT_READ;
+    case SSL_ERROR_WANT_ASYNC:
+        return TLS_WANT_ASYNC;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Continue the handshake of a server SSL that takes early data with
+ * the input it has, and read the early data.
+ *
+ * @param ssl SSL attached with tls_attach(), in accept state.
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param len Byte size of buf, positive.
+ * @return int Byte size of early data read; 0 once there is no more;
+ * TLS_WANT_READ until more input arrives; TLS_WANT_ASYNC while an async job
+ * waits; -1 on failure.
+ */
+int tls_read_early(SSL* ssl, int fd, void* buf, int len)
+{
+    size_t n = 0;
+    int ret = SSL_read_early_data(ssl, buf, len, &n);
+    int err = ret == SSL_READ_EARLY_DATA_ERROR ? SSL_get_error(ssl, ret) :
+              SSL_ERROR_NONE;
+
+    /* Send the flight of the server, which the first call produces. */
+    if (tls_flush(ssl, fd) < 0) {
+        return -1;
+    }
+    if (ret == SSL_READ_EARLY_DATA_SUCCESS) {
+        stats.early_bytes += n;
+        return n;
+    }
+    if (ret == SSL_READ_EARLY_DATA_FINISH) {
+        if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED) {
+            stats.early_accepted++;
+        }
+        else if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_REJECTED) {
+            stats.early_rejected++;
+        }
+        return 0;
+    }
+    switch (err) {
+    case SSL_ERROR_WANT_READ:
+        return TLS_WANT_READ;
+    case SSL_ERROR_WANT_ASYNC:
+        return TLS_WANT_ASYNC;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Read plaintext, reading the socket once unless the SSL holds input
+ * already.
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake.
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param len Byte size of buf, positive.
+ * @return int Byte size of plaintext read; TLS_WANT_READ if no record is
+ * whole yet; 0 if the peer closed the connection; -1 on failure.
+ */
+int tls_read(SSL* ssl, int fd, void* buf, int len)
+{
+    int n;
+
+    if (tls_has_input(ssl)) {
+        stats.buffered_reads++;
+    }
+    else {
+        n = tls_fill(ssl, fd);
+        if (n <= 0) {
+            return n;
+        }
+    }
+    n = SSL_read(ssl, buf, len);
+    if (n > 0) {
+        return n;
+    }
+    switch (SSL_get_error(ssl, n)) {
+    case SSL_ERROR_WANT_READ:
+        /* A partial record, or one without plaintext, e.g. a session
+         * ticket. */
+        return TLS_WANT_READ;
+    case SSL_ERROR_ZERO_RETURN:
+        /* close_notify. */
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Turn plaintext into records, kept until tls_flush().
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake.
+ * @param buf Plaintext.
+ * @param len Byte size of buf, positive.
+ * @return int len on success; -1 on failure.
+ */
+int tls_send(SSL* ssl, const void* buf, int len)
+{
+    size_t n = 0;
+
+    /* A memory BIO takes all records, so the write is never partial. Before
+     * the end of the handshake, a server writes its records after the flight
+     * that answers early data. */
+    if (SSL_is_init_finished(ssl)) {
+        n = SSL_write(ssl, buf, len) == len ? (size_t)len : 0;
+    }
+    else if (SSL_write_early_data(ssl, buf, len, &n) != 1) {
+        n = 0;
+    }
+    if (n != (size_t)len) {
+        return -1;
+    }
+    stats.sends++;
+    return len;
+}
+
+/**
+ * @brief Write all records kept by an SSL to its socket in one write.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @param fd FD of the socket.
+ * @return int Byte size written, 0 if none were kept; -1 on failure, or if
+ * the peer closed the connection.
+ */
+int tls_flush(SSL* ssl, int fd)
+{
+    BIO* wbio = SSL_get_wbio(ssl);
+    char* data;
+    long len = BIO_get_mem_data(wbio, &data);
+
+    if (len <= 0) {
+        return 0;
+    }
+    stats.flushes++;
+    if (netio_write(fd, data, len) != len) {
+        (void)BIO_reset(wbio);
+        return -1;
+    }
+    (void)BIO_reset(wbio);
+    return len;
+}
+
+/**
+ * @brief Turn plaintext into records and write them, with any kept before.
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake.
+ * @param fd FD of the socket.
+ * @param buf Plaintext.
+ * @param len Byte size of buf, positive.
+ * @return int len on success; 0 if the peer closed the connection; -1 on
+ * failure.
+ */
+int tls_write(SSL* ssl, int fd, const void* buf, int len)
+{
+    BIO* wbio = SSL_get_wbio(ssl);
+    char* data;
+    long out_len;
+    ssize_t n;
+
+    if (tls_send(ssl, buf, len) < 0) {
+        return -1;
+    }
+    out_len = BIO_get_mem_data(wbio, &data);
+    stats.flushes++;
+    n = netio_write(fd, data, out_len);
+    (void)BIO_reset(wbio);
+    if (n <= 0) {
+        return n;
+    }
+    return len;
+}
+
+/**
+ * @brief Send close_notify to the peer once the handshake is done.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @param fd FD of the socket, still open.
+ */
+void tls_shutdown(SSL* ssl, int fd)
+{
+    if (!SSL_is_init_finished(ssl)) {
+        return;
+    }
+    SSL_shutdown(ssl);
+    tls_flush(ssl, fd);
+}
+
+/**
+ * @brief Get statistics of the engine.
+ *
+ * @param out_stats Output; engine statistics, non-null.
+ */
+void tls_get_stats(struct tls_stats* out_stats)
+{
+    *out_stats = stats;
+}
+
+/**
+ * @brief Print statistics of the engine.
+ */
+void tls_log_stats(void)
+{
+    LOG_INFO("TLS stats:\n"
+             "- socket reads: %ld, %ld reads of buffered records\n"
+             "- plaintext writes: %ld\n"
+             "- socket writes: %ld, with handshake flights\n"
+             "- early data: %ld handshakes took %ld bytes, %ld refused",
+             stats.fills,
+             stats.buffered_reads,
+             stats.sends,
+             stats.flushes,
+             stats.early_accepted,
+             stats.early_bytes,
+             stats.early_rejected);
+}
@@ -0,0 +1,264 @@
+/**************************************************************
+*
+*                           tls.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-30
+*
+*     Summary:
+*     Interface for the TLS settings shared by the client and
+*     upstream legs of SSL interception: TLS 1.2 at the least
+*     and 1.3 first, X25519 first among key exchange groups,
+*     and AES-GCM or ChaCha20-Poly1305 first depending on
+*     whether the CPU has AES instructions. A server context
+*     holds an ECDSA and an RSA certificate at once, and picks
+*     one per ClientHello.
+*
+*     It also drives SSL objects over memory BIOs instead of
+*     their sockets: OpenSSL only turns plaintext into records
+*     and back, and the caller moves ciphertext with netio
+*     when a socket is readable. Records written in a row go
+*     out in one write, and no call blocks on a read, so
+*     handshakes and reads are steps of the event loop like
+*     any other input.
+*
+*     A server may take TLS 1.3 early data (0-RTT) from clients
+*     that resume a session, and answer it before the handshake
+*     is done. Each ticket resumes once, so early data cannot be
+*     replayed to the same process.
+*
+**************************************************************/
+
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+
+#define TLS_WANT_READ -2 /* Returned while an SSL needs more input from its
+                         * socket. */
+#define TLS_WANT_ASYNC -3 /* Returned while a handshake waits for an async
+                           * job, e.g. of the key pool. */
+#define TLS_FILL_SIZE 17408 /* Max byte size read from a socket at once: a
+                             * record of 16 KB plaintext with its overhead. */
+
+struct tls_stats {
+    long fills; /* Number of socket reads into SSLs. */
+    long buffered_reads; /* Number of reads served from records already read
+                          * from the socket. */
+    long sends; /* Number of plaintext writes turned into records. */
+    long flushes; /* Number of socket writes of records, handshake flights
+                   * included. */
+    long early_accepted; /* Number of handshakes that took early data. */
+    long early_rejected; /* Number of handshakes that refused early data,
+                          * e.g. with a ticket used before. */
+    long early_bytes; /* Byte size of early data read. */
+};
+
+#define TLS_GROUPS "X25519:P-256:P-384" /* Key exchange groups, cheapest
+                                         * first. */
+
+/* TLS 1.3 cipher suites with AES instructions. */
+#define TLS_SUITES_AES "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:" \
+                       "TLS_CHACHA20_POLY1305_SHA256"
+
+/* TLS 1.3 cipher suites without AES instructions. */
+#define TLS_SUITES_CHACHA "TLS_CHACHA20_POLY1305_SHA256:" \
+                          "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+
+/* TLS 1.2 ciphers with AES instructions; all have forward secrecy and AEAD. */
+#define TLS_CIPHERS_AES "ECDHE-ECDSA-AES128-GCM-SHA256:" \
+                        "ECDHE-RSA-AES128-GCM-SHA256:" \
+                        "ECDHE-ECDSA-AES256-GCM-SHA384:" \
+                        "ECDHE-RSA-AES256-GCM-SHA384:" \
+                        "ECDHE-ECDSA-CHACHA20-POLY1305:" \
+                        "ECDHE-RSA-CHACHA20-POLY1305"
+
+/* TLS 1.2 ciphers without AES instructions. */
+#define TLS_CIPHERS_CHACHA "ECDHE-ECDSA-CHACHA20-POLY1305:" \
+                           "ECDHE-RSA-CHACHA20-POLY1305:" \
+                           "ECDHE-ECDSA-AES128-GCM-SHA256:" \
+                           "ECDHE-RSA-AES128-GCM-SHA256:" \
+                           "ECDHE-ECDSA-AES256-GCM-SHA384:" \
+                           "ECDHE-RSA-AES256-GCM-SHA384"
+
+#define TLS_CIPHERS_FALLBACK "HIGH:!aNULL:!MD5" /* TLS 1.2 ciphers after the
+                                                 * preferred ones, for old
+                                                 * servers. */
+
+/**
+ * @brief Whether the CPU has AES instructions, e.g. AES-NI, which make
+ * AES-GCM faster than ChaCha20-Poly1305.
+ *
+ * @return int 1 if it has; 0 otherwise, or if unknown.
+ */
+int tls_has_aes_hw(void);
+
+/**
+ * @brief Apply the shared settings to a context: TLS 1.2 to 1.3, the groups
+ * of TLS_GROUPS, and AES-GCM first with AES instructions, ChaCha20-Poly1305
+ * first without. As a server, the context picks by its own preferences,
+ * e.g. an ECDSA certificate over an RSA one, except that it picks
+ * ChaCha20-Poly1305 for clients that put it first, which lack AES
+ * instructions themselves.
+ *
+ * @param ctx Context, non-null.
+ * @param aes_hw Whether to put AES-GCM first; typically tls_has_aes_hw().
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_tune_ctx(SSL_CTX* ctx, int aes_hw);
+
+/**
+ * @brief Load a certificate and its private key into a server context. A
+ * context holds one certificate per key type, so loading an ECDSA and an
+ * RSA pair serves both, and each handshake picks the one its ClientHello
+ * allows.
+ *
+ * @param ctx Server context, non-null.
+ * @param cert_file Certificate PEM file.
+ * @param key_file Private key PEM file.
+ * @return int 0 on success; -1 if a file cannot be loaded or the key does not
+ * match the certificate.
+ */
+int tls_use_cert(SSL_CTX* ctx, const char* cert_file, const char* key_file);
+
+/**
+ * @brief Let a server context take TLS 1.3 early data from clients that
+ * resume a session with it. Its tickets then resume once each, from its
+ * session cache, and OpenSSL refuses early data with a ticket used before or
+ * issued too long ago, so an attacker cannot replay it.
+ *
+ * @param ctx Server context, non-null.
+ * @param max_bytes Max byte size of early data per connection, positive.
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_enable_early_data(SSL_CTX* ctx, uint32_t max_bytes);
+
+/**
+ * @brief Attach a pair of memory BIOs to an SSL in place of a socket.
+ *
+ * @param ssl SSL without BIOs, non-null.
+ * @return int 0 on success; -1 otherwise.
+ */
+int tls_attach(SSL* ssl);
+
+/**
+ * @brief Read a socket once and hand the ciphertext to its SSL. Call it only
+ * when the socket is readable, as the read may block otherwise.
+ *
+ * @param ssl SSL of the socket.
+ * @param fd FD of the socket.
+ * @return int Byte size read; 0 if the peer closed the connection; -1 on
+ * failure, with errno set.
+ */
+int tls_fill(SSL* ssl, int fd);
+
+/**
+ * @brief Whether an SSL holds input to read without its socket: plaintext
+ * left from a record, or a whole record not yet decrypted. The event loop
+ * must handle such a socket even if select() does not report it.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @return int 1 if it holds input; 0 otherwise.
+ */
+int tls_has_input(SSL* ssl);
+
+/**
+ * @brief Continue the handshake of an SSL with the input it has, and write
+ * what it produced to its socket. It never reads the socket; call
+ * tls_fill() first once it is readable.
+ *
+ * @param ssl SSL attached with tls_attach(), in accept or connect state.
+ * @param fd FD of the socket.
+ * @return int 1 once done; TLS_WANT_READ until more input arrives;
+ * TLS_WANT_ASYNC while an async job waits; -1 on failure.
+ */
+int tls_handshake(SSL* ssl, int fd);
+
+/**
+ * @brief Continue the handshake of a server SSL that takes early data with
+ * the input it has, and read the early data. Plaintext sent meanwhile, with
+ * tls_send() or tls_write(), goes out before the handshake is done; as its
+ * client is not authenticated yet, send only what any client may get. Once it
+ * returns 0, continue with tls_handshake().
+ *
+ * @param ssl SSL attached with tls_attach(), in accept state.
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param len Byte size of buf, positive.
+ * @return int Byte size of early data read; 0 once there is no more, as the
+ * client sent all or none, or it was refused; TLS_WANT_READ until more input
+ * arrives; TLS_WANT_ASYNC while an async job waits; -1 on failure.
+ */
+int tls_read_early(SSL* ssl, int fd, void* buf, int len);
+
+/**
+ * @brief Read plaintext. It reads the socket once, as tls_fill() does,
+ * unless the SSL holds input already; so call it when the socket is readable
+ * or tls_has_input() holds.
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake.
+ * @param fd FD of the socket.
+ * @param buf Output buffer.
+ * @param len Byte size of buf, positive.
+ * @return int Byte size of plaintext read; TLS_WANT_READ if no record is
+ * whole yet; 0 if the peer closed the connection; -1 on failure.
+ */
+int tls_read(SSL* ssl, int fd, void* buf, int len);
+
+/**
+ * @brief Turn plaintext into records, kept until tls_flush().
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake, or a server
+ * SSL between early data and the end of its handshake.
+ * @param buf Plaintext.
+ * @param len Byte size of buf, positive.
+ * @return int len on success; -1 on failure.
+ */
+int tls_send(SSL* ssl, const void* buf, int len);
+
+/**
+ * @brief Write all records kept by an SSL to its socket in one write.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @param fd FD of the socket.
+ * @return int Byte size written, 0 if none were kept; -1 on failure, or if
+ * the peer closed the connection.
+ */
+int tls_flush(SSL* ssl, int fd);
+
+/**
+ * @brief Turn plaintext into records and write them, with any kept before.
+ *
+ * @param ssl SSL attached with tls_attach(), after its handshake.
+ * @param fd FD of the socket.
+ * @param buf Plaintext.
+ * @param len Byte size of buf, positive.
+ * @return int len on success; 0 if the peer closed the connection; -1 on
+ * failure.
+ */
+int tls_write(SSL* ssl, int fd, const void* buf, int len);
+
+/**
+ * @brief Send close_notify to the peer once the handshake is done. The SSL
+ * is still to be freed.
+ *
+ * @param ssl SSL attached with tls_attach().
+ * @param fd FD of the socket, still open.
+ */
+void tls_shutdown(SSL* ssl, int fd);
+
+/**
+ * @brief Get statistics of the engine.
+ *
+ * @param out_stats Output; engine statistics, non-null.
+ */
+void tls_get_stats(struct tls_stats* out_stats);
+
+/**
+ * @brief Print statistics of the engine.
+ */
+void tls_log_stats(void);
+
+#endif /* TLS_H */
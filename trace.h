@@ -0,0 +1,93 @@
+/**************************************************************
+*
+*                           trace.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-28
+*
+*     Summary:
+*     Static tracepoints (USDT) of the proxy, under the provider
+*     "proxy". With <sys/sdt.h> from SystemTap, each probe is a
+*     single nop plus an ELF note naming it and where its
+*     arguments live; a tracer such as bpftrace or perf patches
+*     the nop only while it is attached, so a probe costs
+*     nothing but its arguments otherwise. Without the header,
+*     or built with -DPROXY_NO_USDT, probes compile to nothing,
+*     and their arguments are not evaluated.
+*
+*     Probes and their arguments:
+*     - accept(fd, addr, port): a client was accepted; addr is
+*       the IPv4 address in network byte order.
+*     - request_parsed(fd, method, url, len): a request head
+*       of len bytes was parsed; method and url are strings.
+*     - cache_hit(hash, len, age), cache_miss(hash),
+*       cache_put(hash, len, max_age), cache_evict(hash, len):
+*       hash is cache_hash() of the key, len the byte size of
+*       the cached response.
+*     - connect_start(fd, host, port): a client's request
+*       starts to connect to a server; host is a string.
+*     - connect_done(fd, server_fd, tries, us): the connect
+*       took tries attempts and us microseconds; server_fd is
+*       -1 on failure.
+*     - tls_start(fd, is_client), tls_done(fd, is_client, ok,
+*       us): a TLS handshake with a client (is_client 1) or a
+*       server; ok is 1 on success.
+*     - response_done(fd, status, len, us): a response of len
+*       bytes was written to client fd, us microseconds after
+*       its request was parsed; status is 0 if unknown.
+*     - disconnect(fd, is_client): a socket is closed.
+*
+**************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#if !defined(PROXY_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PROXY_USDT 1 /* Whether probes are compiled in. */
+#endif
+#endif
+
+#ifdef PROXY_USDT
+#include <sys/sdt.h>
+
+#define TRACE1(name, a) DTRACE_PROBE1(proxy, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(proxy, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(proxy, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(proxy, name, a, b, c, d)
+#else
+/* Arguments are still type checked, but never evaluated. */
+#define TRACE1(name, a)                                                        \
+        do {                                                                   \
+            if (0) {                                                           \
+                (void)(a);                                                     \
+            }                                                                  \
+        } while(0)
+#define TRACE2(name, a, b)                                                     \
+        do {                                                                   \
+            if (0) {                                                           \
+                (void)(a);                                                     \
+                (void)(b);                                                     \
+            }                                                                  \
+        } while(0)
+#define TRACE3(name, a, b, c)                                                  \
+        do {                                                                   \
+            if (0) {                                                           \
+                (void)(a);                                                     \
+                (void)(b);                                                     \
+                (void)(c);                                                     \
+            }                                                                  \
+        } while(0)
+#define TRACE4(name, a, b, c, d)                                               \
+        do {                                                                   \
+            if (0) {                                                           \
+                (void)(a);                                                     \
+                (void)(b);                                                     \
+                (void)(c);                                                     \
+                (void)(d);                                                     \
+            }                                                                  \
+        } while(0)
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# trace_perf.sh
+#
+# Summary:
+# Record the proxy's USDT probes with perf for the given number of
+# seconds, 10 by default, then print the events. As root:
+#     ./trace_perf.sh [seconds] [proxy binary]
+# The events land in perf.data; `perf script` prints them again.
+
+set -e
+seconds=${1:-10}
+binary=${2:-./proxy}
+probes="accept request_parsed cache_hit cache_miss cache_put cache_evict \
+        connect_start connect_done tls_start tls_done response_done disconnect"
+
+# Register the probes of the binary, then turn each into an event.
+perf buildid-cache --add "$binary"
+for probe in $probes; do
+    perf probe -q --add "%sdt_proxy:$probe"
+done
+trap 'perf probe -q --del "sdt_proxy:*"' EXIT
+
+perf record -q -e "sdt_proxy:*" -a -- sleep "$seconds"
+perf script
@@ -0,0 +1,603 @@
+/**************************************************************
+*
+*                         upstream.c
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-22
+*
+*     Summary:
+*     Implementation for per-host upstream state.
+*
+**************************************************************/
+
+#include "upstream.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UPSTREAM_HOST_OTHER 0 /* Slot shared by hosts that do not fit in the
+                               * table, as all others have open breakers. */
+#define UPSTREAM_RESORT 8 /* Number of new samples after which the percentile
+                           * is computed again. */
+
+struct upstream_host {
+    char name[UPSTREAM_HOST_NAME_LEN]; /* Hostname; empty if the slot is
+                                        * free. */
+    long samples[UPSTREAM_SAMPLES]; /* Latest first-byte latencies in
+                                     * microseconds, in a ring. */
+    int num_samples; /* Number of samples, up to UPSTREAM_SAMPLES. */
+    int next_sample; /* Index in samples of the next sample. */
+    int new_samples; /* Number of samples since percentile was computed. */
+    long percentile; /* Latency percentile; -1 if not computed yet. */
+    double tokens; /* Budget of retries and hedges. */
+    unsigned int next_addr; /* Index of the address to try first next. */
+    unsigned char breaker; /* enum upstream_breaker. */
+    unsigned char open_shift; /* Times the breaker reopened after a failed
+                               * probe; it stays open breaker_open <<
+                               * open_shift seconds, up to
+                               * UPSTREAM_OPEN_MAX. */
+    unsigned short failures; /* Number of consecutive failures, up to
+                              * USHRT_MAX. */
+    time_t until; /* Time an open breaker lets a probe through, or a probe
+                   * that never reported is taken as lost. */
+    in_addr_t ejected[UPSTREAM_EJECT_SLOTS]; /* Ejected addresses; 0 if the
+                                              * slot is free. */
+    time_t ejected_until[UPSTREAM_EJECT_SLOTS]; /* Time each ejection
+                                                 * ends. */
+    unsigned long last_use; /* Value of use_clock when the host was last
+                             * looked up. */
+};
+
+static struct upstream_host* hosts = NULL; /* Host table of
+                                            * UPSTREAM_MAX_HOSTS slots. */
+static int num_hosts = 0; /* Number of used slots in the host table. */
+static unsigned long use_clock = 0; /* Number of lookups of hosts. */
+static struct upstream_config config; /* Budget and hedging settings. */
+static struct upstream_stats stats; /* Upstream statistics. */
+
+/**
+ * @brief Hash a hostname with FNV-1a.
+ *
+ * @param host Hostname.
+ * @return uint32_t Hash.
+ */
+static uint32_t upstream_hash(const char* host)
+{
+    uint32_t hash = 2166136261U;
+
+    for (; *host != '\0'; ++host) {
+        hash = (hash ^ (unsigned char)*host) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Probe the host table for the given host.
+ *
+ * @param host Hostname, non-empty.
+ * @return uint32_t Index of the slot of the host, or of the free slot that
+ * ends its probe.
+ */
+static uint32_t upstream_host_probe(const char* host)
+{
+    uint32_t i = upstream_hash(host) & (UPSTREAM_MAX_HOSTS - 1);
+
+    while (1) {
+        if (i != UPSTREAM_HOST_OTHER &&
+            (hosts[i].name[0] == '\0' || strcmp(hosts[i].name, host) == 0)) {
+            return i;
+        }
+        i = (i + 1) & (UPSTREAM_MAX_HOSTS - 1);
+    }
+}
+
+/**
+ * @brief Free the slot of the least recently used host whose breaker is
+ * closed, to make room for a new host. The hosts after it in its probe are
+ * shifted back, so no probe needs to go on past a freed slot.
+ *
+ * @return int 1 if a slot was freed; 0 if every breaker is open.
+ */
+static int upstream_host_evict(void)
+{
+    uint32_t i = UPSTREAM_HOST_OTHER;
+    uint32_t j;
+    uint32_t home;
+
+    for (uint32_t k = 0; k < UPSTREAM_MAX_HOSTS; ++k) {
+        if (k != UPSTREAM_HOST_OTHER && hosts[k].name[0] != '\0' &&
+            hosts[k].breaker == UPSTREAM_CLOSED &&
+            (i == UPSTREAM_HOST_OTHER ||
+             hosts[k].last_use < hosts[i].last_use)) {
+            i = k;
+        }
+    }
+    if (i == UPSTREAM_HOST_OTHER) {
+        return 0;
+    }
+
+    /* Move each later host of the run into the hole, unless its probe
+     * starts after the hole. */
+    j = i;
+    while (1) {
+        j = (j + 1) & (UPSTREAM_MAX_HOSTS - 1);
+        if (j == UPSTREAM_HOST_OTHER) {
+            continue;
+        }
+        if (hosts[j].name[0] == '\0') {
+            break;
+        }
+        home = upstream_hash(hosts[j].name) & (UPSTREAM_MAX_HOSTS - 1);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        hosts[i] = hosts[j];
+        i = j;
+    }
+    memset(&hosts[i], 0, sizeof(hosts[i]));
+    num_hosts--;
+    stats.recycled++;
+    return 1;
+}
+
+/**
+ * @brief Find the slot of the given host in the host table, adding the host
+ * if it is new.
+ *
+ * The table holds at most UPSTREAM_MAX_HOSTS * 3 / 4 hosts. A new host
+ * beyond that takes the place of the least recently used host whose breaker
+ * is closed, so each host keeps a breaker and budget of its own; only if
+ * every breaker is open does it share UPSTREAM_HOST_OTHER.
+ *
+ * @param host Hostname; NULL or empty for UPSTREAM_HOST_OTHER.
+ * @return struct upstream_host* Slot of the host; NULL before
+ * upstream_init().
+ */
+static struct upstream_host* upstream_host_find(const char* host)
+{
+    uint32_t i;
+
+    if (hosts == NULL) {
+        return NULL;
+    }
+    if (host == NULL || *host == '\0' ||
+        strlen(host) >= UPSTREAM_HOST_NAME_LEN) {
+        return &hosts[UPSTREAM_HOST_OTHER];
+    }
+    i = upstream_host_probe(host);
+    if (hosts[i].name[0] == '\0') {
+        if (num_hosts >= UPSTREAM_MAX_HOSTS / 4 * 3) {
+            if (!upstream_host_evict()) {
+                return &hosts[UPSTREAM_HOST_OTHER];
+            }
+            i = upstream_host_probe(host);
+        }
+        strcpy(hosts[i].name, host);
+        hosts[i].percentile = -1;
+        hosts[i].tokens = UPSTREAM_BUDGET_MAX;
+        num_hosts++;
+    }
+    hosts[i].last_use = ++use_clock;
+    return &hosts[i];
+}
+
+/**
+ * @brief Clear all hosts and statistics, and use a configuration.
+ *
+ * @param new_config Configuration; NULL for a budget ratio of
+ * UPSTREAM_BUDGET_RATIO, no hedging, and breakers that open for
+ * UPSTREAM_OPEN_TIME seconds after UPSTREAM_FAILURES failures.
+ * @return int 0 on success; -1 otherwise.
+ */
+int upstream_init(const struct upstream_config* new_config)
+{
+    upstream_clear();
+    if (new_config != NULL) {
+        config = *new_config;
+    }
+    else {
+        config.budget_ratio = UPSTREAM_BUDGET_RATIO;
+        config.hedge_min_us = 0;
+        config.breaker_failures = UPSTREAM_FAILURES;
+        config.breaker_open = UPSTREAM_OPEN_TIME;
+    }
+    memset(&stats, 0, sizeof(stats));
+    hosts = calloc(UPSTREAM_MAX_HOSTS, sizeof(struct upstream_host));
+    if (hosts == NULL) {
+        PLOG_ERROR("calloc");
+        return -1;
+    }
+    strcpy(hosts[UPSTREAM_HOST_OTHER].name, "*");
+    hosts[UPSTREAM_HOST_OTHER].percentile = -1;
+    hosts[UPSTREAM_HOST_OTHER].tokens = UPSTREAM_BUDGET_MAX;
+    num_hosts = 1;
+    return 0;
+}
+
+/**
+ * @brief Free all hosts.
+ */
+void upstream_clear(void)
+{
+    free(hosts);
+    hosts = NULL;
+    num_hosts = 0;
+    use_clock = 0;
+}
+
+/**
+ * @brief Count a request sent to a host, which adds to its budget.
+ *
+ * @param host Hostname.
+ */
+void upstream_add_request(const char* host)
+{
+    struct upstream_host* h = upstream_host_find(host);
+
+    stats.requests++;
+    if (h == NULL) {
+        return;
+    }
+    h->tokens += config.budget_ratio;
+    if (h->tokens > UPSTREAM_BUDGET_MAX) {
+        h->tokens = UPSTREAM_BUDGET_MAX;
+    }
+}
+
+/**
+ * @brief Spend one token of the budget of a host on a retry or a hedge.
+ *
+ * @param host Hostname.
+ * @param is_hedge 1 for a hedge; 0 for a retry.
+ * @return int 1 if the budget allows it; 0 otherwise.
+ */
+int upstream_take_budget(const char* host, int is_hedge)
+{
+    struct upstream_host* h = upstream_host_find(host);
+
+    if (h == NULL || config.budget_ratio <= 0 || h->tokens < 1) {
+        stats.denied++;
+        return 0;
+    }
+    h->tokens -= 1;
+    if (is_hedge) {
+        stats.hedges++;
+    }
+    else {
+        stats.retries++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Record the time a host took to send the first byte of a response.
+ *
+ * @param host Hostname.
+ * @param latency_us Microseconds from the request to the first byte.
+ */
+void upstream_add_latency(const char* host, long latency_us)
+{
+    struct upstream_host* h = upstream_host_find(host);
+
+    if (h == NULL) {
+        return;
+    }
+    h->samples[h->next_sample] = latency_us;
+    h->next_sample = (h->next_sample + 1) % UPSTREAM_SAMPLES;
+    if (h->num_samples < UPSTREAM_SAMPLES) {
+        h->num_samples++;
+    }
+    h->new_samples++;
+}
+
+/**
+ * @brief Compare two longs for qsort().
+ */
+static int compare_long(const void* a, const void* b)
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Get the delay after which a request to a host is hedged: the
+ * UPSTREAM_HEDGE_PERCENTILE percentile of its latest first-byte latencies,
+ * and at least hedge_min_us.
+ *
+ * @param host Hostname.
+ * @return long Delay in microseconds; -1 if hedging is off or the host has
+ * fewer than UPSTREAM_MIN_SAMPLES samples.
+ */
+long upstream_hedge_delay(const char* host)
+{
+    struct upstream_host* h = NULL;
+    long sorted[UPSTREAM_SAMPLES];
+
+    if (config.hedge_min_us <= 0) {
+        return -1;
+    }
+    h = upstream_host_find(host);
+    if (h == NULL || h->num_samples < UPSTREAM_MIN_SAMPLES) {
+        return -1;
+    }
+
+    /* Sorting 128 samples is cheap, but only redo it every few samples. */
+    if (h->percentile < 0 || h->new_samples >= UPSTREAM_RESORT) {
+        memcpy(sorted, h->samples, h->num_samples * sizeof(long));
+        qsort(sorted, h->num_samples, sizeof(long), compare_long);
+        h->percentile = sorted[(h->num_samples * UPSTREAM_HEDGE_PERCENTILE +
+                                99) / 100 - 1];
+        h->new_samples = 0;
+    }
+    return h->percentile > config.hedge_min_us ? h->percentile :
+           config.hedge_min_us;
+}
+
+/**
+ * @brief Count a hedge that answered before the request it hedged.
+ */
+void upstream_count_hedge_won(void)
+{
+    stats.hedges_won++;
+}
+
+/**
+ * @brief Get the index of the address to try first, rotating over calls so
+ * that load spreads over the addresses of a host.
+ *
+ * @param host Hostname.
+ * @param num_addrs Number of addresses of the host, positive.
+ * @return int Index in [0, num_addrs).
+ */
+int upstream_next_addr(const char* host, int num_addrs)
+{
+    struct upstream_host* h = upstream_host_find(host);
+
+    if (h == NULL) {
+        return 0;
+    }
+    return h->next_addr++ % num_addrs;
+}
+
+/**
+ * @brief Find the slot of a host that has a breaker of its own.
+ *
+ * @param host Hostname.
+ * @return struct upstream_host* Slot of the host; NULL if breakers are off,
+ * or the host shares UPSTREAM_HOST_OTHER, whose failures belong to no host in
+ * particular.
+ */
+static struct upstream_host* upstream_breaker_find(const char* host)
+{
+    struct upstream_host* h = NULL;
+
+    if (config.breaker_failures <= 0) {
+        return NULL;
+    }
+    h = upstream_host_find(host);
+    if (h == NULL || h == &hosts[UPSTREAM_HOST_OTHER]) {
+        return NULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Open the breaker of a host for its current open period.
+ *
+ * @param h Host.
+ * @param now Current time.
+ */
+static void upstream_open(struct upstream_host* h, time_t now)
+{
+    long seconds = config.breaker_open;
+
+    for (int i = 0; i < h->open_shift && seconds < UPSTREAM_OPEN_MAX; ++i) {
+        seconds *= 2;
+    }
+    if (seconds > UPSTREAM_OPEN_MAX) {
+        seconds = UPSTREAM_OPEN_MAX;
+    }
+    if (h->breaker == UPSTREAM_CLOSED) {
+        stats.open_hosts++;
+    }
+    h->breaker = UPSTREAM_OPEN;
+    h->until = now + seconds;
+    stats.opened++;
+    LOG_INFO("open breaker of %s for %ld s after %d failures",
+             h->name,
+             seconds,
+             h->failures);
+}
+
+/**
+ * @brief Whether a request may go to a host, given the breaker of the host.
+ * Once an open breaker has waited its time, the request is let through as
+ * the probe, and other requests fail fast until the probe reports.
+ *
+ * @param host Hostname.
+ * @param now Current time.
+ * @return int 1 if the request may go to the host; 0 if it fails fast.
+ */
+int upstream_allow(const char* host, time_t now)
+{
+    struct upstream_host* h = upstream_breaker_find(host);
+
+    if (h == NULL || h->breaker == UPSTREAM_CLOSED) {
+        return 1;
+    }
+    if (now < h->until) {
+        stats.rejected++;
+        return 0;
+    }
+
+    /* The open period is over, or the last probe got lost, e.g. with its
+     * client. */
+    h->breaker = UPSTREAM_HALF_OPEN;
+    h->until = now + UPSTREAM_PROBE_TIMEOUT;
+    stats.probes++;
+    return 1;
+}
+
+/**
+ * @brief Report the outcome of a request to a host: a response, or a failed
+ * connect, a 5xx response or no response in time.
+ *
+ * Any success closes the breaker, even one of a request sent before the
+ * breaker opened; a failure only reopens a breaker that is half open.
+ *
+ * @param host Hostname.
+ * @param ok 1 on success; 0 on failure.
+ * @param now Current time.
+ */
+void upstream_report(const char* host, int ok, time_t now)
+{
+    struct upstream_host* h = upstream_breaker_find(host);
+
+    if (h == NULL) {
+        return;
+    }
+    if (ok) {
+        h->failures = 0;
+        if (h->breaker != UPSTREAM_CLOSED) {
+            h->breaker = UPSTREAM_CLOSED;
+            h->open_shift = 0;
+            stats.open_hosts--;
+            LOG_INFO("close breaker of %s", h->name);
+        }
+        return;
+    }
+    if (h->failures < USHRT_MAX) {
+        h->failures++;
+    }
+    if (h->breaker == UPSTREAM_HALF_OPEN) {
+        if (h->open_shift < UCHAR_MAX) {
+            h->open_shift++;
+        }
+        upstream_open(h, now);
+    }
+    else if (h->breaker == UPSTREAM_CLOSED &&
+             h->failures >= config.breaker_failures) {
+        upstream_open(h, now);
+    }
+}
+
+/**
+ * @brief Get the state of the breaker of a host.
+ *
+ * @param host Hostname.
+ * @return int enum upstream_breaker.
+ */
+int upstream_breaker_state(const char* host)
+{
+    struct upstream_host* h = upstream_breaker_find(host);
+
+    return h != NULL ? h->breaker : UPSTREAM_CLOSED;
+}
+
+/**
+ * @brief Eject an address of a host that failed to connect, so it is tried
+ * last for UPSTREAM_EJECT seconds. It takes the slot of the same address,
+ * or else the one whose ejection ends first.
+ *
+ * @param host Hostname.
+ * @param addr Address.
+ * @param now Current time.
+ */
+void upstream_eject(const char* host, struct in_addr addr, time_t now)
+{
+    struct upstream_host* h = upstream_host_find(host);
+    int slot = 0;
+
+    if (h == NULL) {
+        return;
+    }
+    for (int i = 0; i < UPSTREAM_EJECT_SLOTS; ++i) {
+        if (h->ejected[i] == addr.s_addr) {
+            slot = i;
+            break;
+        }
+        if (h->ejected_until[i] < h->ejected_until[slot]) {
+            slot = i;
+        }
+    }
+    h->ejected[slot] = addr.s_addr;
+    h->ejected_until[slot] = now + UPSTREAM_EJECT;
+    stats.ejections++;
+}
+
+/**
+ * @brief Whether an address of a host is ejected.
+ *
+ * @param host Hostname.
+ * @param addr Address.
+ * @param now Current time.
+ * @return int 1 if it is ejected; 0 otherwise.
+ */
+int upstream_is_ejected(const char* host, struct in_addr addr, time_t now)
+{
+    struct upstream_host* h = upstream_host_find(host);
+
+    if (h == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < UPSTREAM_EJECT_SLOTS; ++i) {
+        if (h->ejected[i] == addr.s_addr && now < h->ejected_until[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get upstream statistics.
+ *
+ * @param out_stats Output; upstream statistics, non-null.
+ */
+void upstream_get_stats(struct upstream_stats* out_stats)
+{
+    *out_stats = stats;
+}
+
+/**
+ * @brief Print upstream statistics, and the breaker of each host that is not
+ * closed.
+ */
+void upstream_log_stats(void)
+{
+    LOG_INFO("upstream stats:\n"
+             "- requests: %ld\n"
+             "- retried connects: %ld\n"
+             "- hedges: %ld (%.1f%% of requests), %ld answered first\n"
+             "- over budget: %ld\n"
+             "- breakers: %d open, opened %ld times, %ld probes, "
+             "%ld requests failed fast\n"
+             "- ejected addresses: %ld\n"
+             "- hosts: %d, %ld forgotten to make room",
+             stats.requests,
+             stats.retries,
+             stats.hedges,
+             stats.requests > 0 ? 100.0 * stats.hedges / stats.requests : 0.0,
+             stats.hedges_won,
+             stats.denied,
+             stats.open_hosts,
+             stats.opened,
+             stats.probes,
+             stats.rejected,
+             stats.ejections,
+             num_hosts > 0 ? num_hosts - 1 : 0,
+             stats.recycled);
+    for (int i = 0; hosts != NULL && i < UPSTREAM_MAX_HOSTS; ++i) {
+        if (hosts[i].breaker != UPSTREAM_CLOSED) {
+            LOG_INFO("- breaker of %s: %s until %ld, %d failures",
+                     hosts[i].name,
+                     hosts[i].breaker == UPSTREAM_OPEN ? "open" : "half-open",
+                     (long)hosts[i].until,
+                     hosts[i].failures);
+        }
+    }
+}
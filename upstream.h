@@ -0,0 +1,218 @@
+/**************************************************************
+*
+*                         upstream.h
+*
+*     Final Project: High Performance HTTP Proxy
+*     Author:  Keren Zhou (kzhou), Ruiyuan Gu (rgu03)
+*     Date: 2021-12-22
+*
+*     Summary:
+*     Interface for per-host upstream state: first-byte
+*     latencies that set the hedging delay, the budget of
+*     retries and hedges, and circuit breakers.
+*
+*     Each request to a host deposits budget_ratio tokens, up to
+*     UPSTREAM_BUDGET_MAX, and each retry or hedge spends one,
+*     so extra attempts stay a bounded share of the load even
+*     when a host fails outright.
+*
+*     The breaker of a host opens after breaker_failures
+*     consecutive failures, and requests fail fast while it is
+*     open. Once the open period ends, one request probes the
+*     host: success closes the breaker, and failure opens it
+*     again for twice as long, up to UPSTREAM_OPEN_MAX seconds.
+*     Addresses of a host that fail to connect are ejected for
+*     UPSTREAM_EJECT seconds, so other addresses are tried
+*     first.
+*
+**************************************************************/
+
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <netinet/in.h>
+#include <time.h>
+
+#define UPSTREAM_MAX_HOSTS 1024 /* Number of slots in the host table; a power
+                                 * of 2. */
+#define UPSTREAM_HOST_NAME_LEN 256 /* Max byte size of a hostname plus 1. */
+#define UPSTREAM_SAMPLES 128 /* Number of latest first-byte latencies kept
+                              * per host. */
+#define UPSTREAM_MIN_SAMPLES 20 /* Samples needed before a host is hedged. */
+#define UPSTREAM_BUDGET_RATIO 0.1 /* Default retries and hedges per
+                                   * request. */
+#define UPSTREAM_BUDGET_MAX 10.0 /* Max tokens a host saves up, and its tokens
+                                  * when first seen. */
+#define UPSTREAM_HEDGE_PERCENTILE 95 /* Latency percentile after which a
+                                      * request is hedged. */
+#define UPSTREAM_FAILURES 5 /* Default consecutive failures that open a
+                             * breaker. */
+#define UPSTREAM_OPEN_TIME 5 /* Default seconds a breaker stays open at
+                              * first. */
+#define UPSTREAM_OPEN_MAX 60 /* Max seconds a breaker stays open. */
+#define UPSTREAM_PROBE_TIMEOUT 30 /* Seconds after which a probe that never
+                                   * reported is taken as failed. */
+#define UPSTREAM_EJECT 10 /* Seconds an address that failed to connect is
+                           * tried last. */
+#define UPSTREAM_EJECT_SLOTS 2 /* Number of ejected addresses kept per
+                                * host. */
+
+/* States of a circuit breaker. */
+enum upstream_breaker {
+    UPSTREAM_CLOSED = 0, /* Requests go to the host. */
+    UPSTREAM_OPEN, /* Requests fail fast. */
+    UPSTREAM_HALF_OPEN, /* One request probes the host. */
+};
+
+struct upstream_config {
+    double budget_ratio; /* Retries and hedges allowed per request; 0 for
+                          * none. */
+    long hedge_min_us; /* Min delay before a hedge in microseconds; 0 to turn
+                        * hedging off. */
+    int breaker_failures; /* Consecutive failures that open a breaker; 0 to
+                           * turn breakers off. */
+    int breaker_open; /* Seconds a breaker stays open at first. */
+};
+
+struct upstream_stats {
+    long requests; /* Number of requests sent to servers. */
+    long retries; /* Number of connects retried on another address. */
+    long hedges; /* Number of hedged requests. */
+    long hedges_won; /* Number of hedges that answered first. */
+    long denied; /* Number of retries and hedges over the budget. */
+    long opened; /* Number of times a breaker opened. */
+    long probes; /* Number of requests that probed a host. */
+    long rejected; /* Number of requests failed fast by an open breaker. */
+    long ejections; /* Number of addresses ejected. */
+    long recycled; /* Number of idle hosts whose slot a new host took. */
+    int open_hosts; /* Number of hosts whose breaker is not closed. */
+};
+
+/**
+ * @brief Clear all hosts and statistics, and use a configuration.
+ *
+ * @param config Configuration; NULL for a budget ratio of
+ * UPSTREAM_BUDGET_RATIO, no hedging, and breakers that open for
+ * UPSTREAM_OPEN_TIME seconds after UPSTREAM_FAILURES failures.
+ * @return int 0 on success; -1 otherwise.
+ */
+int upstream_init(const struct upstream_config* config);
+
+/**
+ * @brief Free all hosts.
+ */
+void upstream_clear(void);
+
+/**
+ * @brief Count a request sent to a host, which adds to its budget.
+ *
+ * @param host Hostname.
+ */
+void upstream_add_request(const char* host);
+
+/**
+ * @brief Spend one token of the budget of a host on a retry or a hedge.
+ *
+ * @param host Hostname.
+ * @param is_hedge 1 for a hedge; 0 for a retry.
+ * @return int 1 if the budget allows it; 0 otherwise.
+ */
+int upstream_take_budget(const char* host, int is_hedge);
+
+/**
+ * @brief Record the time a host took to send the first byte of a response.
+ *
+ * @param host Hostname.
+ * @param latency_us Microseconds from the request to the first byte.
+ */
+void upstream_add_latency(const char* host, long latency_us);
+
+/**
+ * @brief Get the delay after which a request to a host is hedged: the
+ * UPSTREAM_HEDGE_PERCENTILE percentile of its latest first-byte latencies,
+ * and at least hedge_min_us.
+ *
+ * @param host Hostname.
+ * @return long Delay in microseconds; -1 if hedging is off or the host has
+ * fewer than UPSTREAM_MIN_SAMPLES samples.
+ */
+long upstream_hedge_delay(const char* host);
+
+/**
+ * @brief Count a hedge that answered before the request it hedged.
+ */
+void upstream_count_hedge_won(void);
+
+/**
+ * @brief Get the index of the address to try first, rotating over calls so
+ * that load spreads over the addresses of a host.
+ *
+ * @param host Hostname.
+ * @param num_addrs Number of addresses of the host, positive.
+ * @return int Index in [0, num_addrs).
+ */
+int upstream_next_addr(const char* host, int num_addrs);
+
+/**
+ * @brief Whether a request may go to a host, given the breaker of the host.
+ * Once an open breaker has waited its time, the request is let through as
+ * the probe, and other requests fail fast until the probe reports.
+ *
+ * @param host Hostname.
+ * @param now Current time.
+ * @return int 1 if the request may go to the host; 0 if it fails fast.
+ */
+int upstream_allow(const char* host, time_t now);
+
+/**
+ * @brief Report the outcome of a request to a host: a response, or a failed
+ * connect, a 5xx response or no response in time.
+ *
+ * @param host Hostname.
+ * @param ok 1 on success; 0 on failure.
+ * @param now Current time.
+ */
+void upstream_report(const char* host, int ok, time_t now);
+
+/**
+ * @brief Get the state of the breaker of a host.
+ *
+ * @param host Hostname.
+ * @return int enum upstream_breaker.
+ */
+int upstream_breaker_state(const char* host);
+
+/**
+ * @brief Eject an address of a host that failed to connect, so it is tried
+ * last for UPSTREAM_EJECT seconds.
+ *
+ * @param host Hostname.
+ * @param addr Address.
+ * @param now Current time.
+ */
+void upstream_eject(const char* host, struct in_addr addr, time_t now);
+
+/**
+ * @brief Whether an address of a host is ejected.
+ *
+ * @param host Hostname.
+ * @param addr Address.
+ * @param now Current time.
+ * @return int 1 if it is ejected; 0 otherwise.
+ */
+int upstream_is_ejected(const char* host, struct in_addr addr, time_t now);
+
+/**
+ * @brief Get upstream statistics.
+ *
+ * @param out_stats Output; upstream statistics, non-null.
+ */
+void upstream_get_stats(struct upstream_stats* out_stats);
+
+/**
+ * @brief Print upstream statistics, and the breaker of each host that is not
+ * closed.
+ */
+void upstream_log_stats(void);
+
+#endif /* UPSTREAM_H */